@@ -0,0 +1,239 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "allocation_guard.h"
+#include "extensions_internal.h"
+
+#define HOOK_MESSAGE "Allocation of "
+#define HOOK_MESSAGE_END " bytes after the allocation guard was sealed\n"
+
+/* Counters are written by every thread allocating, so they are added atomically. */
+typedef struct _allocation_counters
+{
+  uint64_t startup_allocations;
+  uint64_t startup_bytes;
+  uint64_t unexpected_allocations;
+  uint64_t unexpected_bytes;
+  uint64_t permitted_allocations;
+  uint64_t frees;
+} _allocation_counters;
+
+static _allocation_counters counters;
+static bool sealed;
+static allocation_guard_hook hook;
+static __thread bool permitted;
+/* Keeps allocations made by the hook from calling it again. */
+static __thread bool in_hook;
+
+/* Formats the size by hand, as the hook must not allocate and stdio may. */
+static void _default_hook(size_t size)
+{
+  char digits[24];
+  size_t length = 0;
+
+  do
+  {
+    digits[sizeof(digits) - ++length] = (char)('0' + size % 10);
+    size /= 10;
+  } while (size > 0);
+
+  if (write(STDERR_FILENO, HOOK_MESSAGE, sizeof(HOOK_MESSAGE) - 1) < 0
+      || write(STDERR_FILENO, digits + sizeof(digits) - length, length) < 0
+      || write(STDERR_FILENO, HOOK_MESSAGE_END, sizeof(HOOK_MESSAGE_END) - 1) < 0)
+  {
+    /* Nothing more to do from inside the allocator. */
+  }
+#ifndef NDEBUG
+  raise(SIGTRAP);
+#endif
+}
+
+static void _record_allocation(size_t size)
+{
+  allocation_guard_hook current;
+
+  if (!__atomic_load_n(&sealed, __ATOMIC_RELAXED))
+  {
+    stat_add_shared(&counters.startup_allocations, 1);
+    stat_add_shared(&counters.startup_bytes, size);
+    return;
+  }
+  if (permitted || in_hook)
+  {
+    stat_add_shared(&counters.permitted_allocations, 1);
+    return;
+  }
+
+  stat_add_shared(&counters.unexpected_allocations, 1);
+  stat_add_shared(&counters.unexpected_bytes, size);
+  current = __atomic_load_n(&hook, __ATOMIC_ACQUIRE);
+  in_hook = true;
+  (current != NULL ? current : _default_hook)(size);
+  in_hook = false;
+}
+
+#ifdef STATIC_ALLOCATION
+#ifndef __GLIBC__
+#error "STATIC_ALLOCATION counts the calls to the allocator of glibc"
+#endif
+
+/* The allocator of glibc, which the functions below count the calls to. */
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size)
+{
+  _record_allocation(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  _record_allocation(count * size);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size)
+{
+  /* realloc(pointer, 0) frees. */
+  if (size > 0)
+  {
+    _record_allocation(size);
+  }
+  else if (pointer != NULL)
+  {
+    stat_add_shared(&counters.frees, 1);
+  }
+  return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer)
+{
+  if (pointer != NULL)
+  {
+    stat_add_shared(&counters.frees, 1);
+  }
+  __libc_free(pointer);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  _record_allocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) { return memalign(alignment, size); }
+
+int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+  void* allocated;
+
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+  {
+    return EINVAL;
+  }
+  if ((allocated = memalign(alignment, size)) == NULL)
+  {
+    return ENOMEM;
+  }
+  *pointer = allocated;
+  return 0;
+}
+
+void* valloc(size_t size) { return memalign((size_t)sysconf(_SC_PAGESIZE), size); }
+
+void* pvalloc(size_t size)
+{
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+  /* Rounds the size up to whole pages. */
+  if (size > SIZE_MAX - page_size)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return memalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+void* reallocarray(void* pointer, size_t count, size_t size)
+{
+  size_t total;
+
+  if (__builtin_mul_overflow(count, size, &total))
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(pointer, total);
+}
+#endif
+
+void allocation_guard_seal(void) { __atomic_store_n(&sealed, true, __ATOMIC_RELAXED); }
+
+void allocation_guard_unseal(void) { __atomic_store_n(&sealed, false, __ATOMIC_RELAXED); }
+
+void allocation_guard_set_hook(allocation_guard_hook new_hook)
+{
+  __atomic_store_n(&hook, new_hook, __ATOMIC_RELEASE);
+}
+
+bool allocation_guard_permit(bool permit)
+{
+  bool previous = permitted;
+
+  permitted = permit;
+  return previous;
+}
+
+void allocation_guard_read_stats(allocation_guard_stats* stats)
+{
+  struct rusage usage;
+
+#ifdef STATIC_ALLOCATION
+  stats->enabled = true;
+#else
+  stats->enabled = false;
+#endif
+  stats->sealed = __atomic_load_n(&sealed, __ATOMIC_RELAXED);
+  stats->startup_allocations = __atomic_load_n(&counters.startup_allocations, __ATOMIC_RELAXED);
+  stats->startup_bytes = __atomic_load_n(&counters.startup_bytes, __ATOMIC_RELAXED);
+  stats->unexpected_allocations
+      = __atomic_load_n(&counters.unexpected_allocations, __ATOMIC_RELAXED);
+  stats->unexpected_bytes = __atomic_load_n(&counters.unexpected_bytes, __ATOMIC_RELAXED);
+  stats->permitted_allocations
+      = __atomic_load_n(&counters.permitted_allocations, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&counters.frees, __ATOMIC_RELAXED);
+  stats->peak_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+void allocation_guard_print_stats(void)
+{
+  allocation_guard_stats stats;
+
+  allocation_guard_read_stats(&stats);
+  printf("Peak RSS: %ld KiB\n", stats.peak_rss_kb);
+  if (!stats.enabled)
+  {
+    printf("Allocator calls: not counted, build with STATIC_ALLOCATION to count them\n");
+    return;
+  }
+  printf(
+      "Allocator calls: %llu at startup (%llu bytes), %llu after (%llu bytes) and %llu permitted "
+      "to libraries, %llu frees\n",
+      (unsigned long long)stats.startup_allocations,
+      (unsigned long long)stats.startup_bytes,
+      (unsigned long long)stats.unexpected_allocations,
+      (unsigned long long)stats.unexpected_bytes,
+      (unsigned long long)stats.permitted_allocations,
+      (unsigned long long)stats.frees);
+}
@@ -0,0 +1,95 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef ALLOCATION_GUARD_H
+#define ALLOCATION_GUARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Static-allocation mode for long-running clients on constrained devices: buffers, queues and
+ * pools are sized at startup, and nothing is allocated once the client runs.
+ *
+ * Built with the STATIC_ALLOCATION option, this replaces malloc(), calloc(), realloc(),
+ * reallocarray(), free() and the aligned allocation functions of the process (memalign(),
+ * aligned_alloc(), posix_memalign(), valloc() and pvalloc()), so that every allocation, including
+ * those of operator new, is counted. Memory mapped without the allocator, ex. with mmap(), is not.
+ * Once allocation_guard_seal() marks the end of the startup, any allocation calls the hook, which
+ * by default traps (SIGTRAP) in debug builds, so the debugger stops on the allocation that broke
+ * the mode. Allocations made by libraries that allocate by design, ex. libmosquitto for every
+ * packet, are permitted around their calls with allocation_guard_permit() and only counted.
+ *
+ * Without STATIC_ALLOCATION nothing is replaced, and the stats only hold the peak RSS.
+ */
+
+/* Called on every allocation made after the seal outside a permitted scope. Must not allocate. */
+typedef void (*allocation_guard_hook)(size_t size);
+
+typedef struct allocation_guard_stats
+{
+  /* Whether allocations are counted, i.e. built with STATIC_ALLOCATION. */
+  bool enabled;
+  bool sealed;
+  /* Allocator calls before the seal, and the bytes they requested. */
+  uint64_t startup_allocations;
+  uint64_t startup_bytes;
+  /* Allocator calls after the seal that went to the hook. */
+  uint64_t unexpected_allocations;
+  uint64_t unexpected_bytes;
+  /* Allocator calls after the seal in permitted scopes. */
+  uint64_t permitted_allocations;
+  uint64_t frees;
+  /* Peak resident set size of the process, in KiB. */
+  long peak_rss_kb;
+} allocation_guard_stats;
+
+/**
+ * @brief Ends the startup: from now on, allocations outside permitted scopes call the hook.
+ */
+void allocation_guard_seal(void);
+
+/**
+ * @brief Starts another startup phase, ex. to reconfigure the client or between tests.
+ */
+void allocation_guard_unseal(void);
+
+/**
+ * @brief Sets the hook called on unexpected allocations.
+ *
+ * @param hook The hook, or NULL for the default one, which writes the size to stderr and raises
+ * SIGTRAP unless built with NDEBUG.
+ */
+void allocation_guard_set_hook(allocation_guard_hook hook);
+
+/**
+ * @brief Permits the allocations of the calling thread, or stops permitting them. Calls are nested
+ * by restoring the previous value once done.
+ *
+ * @param permitted Whether the allocations of the thread are permitted.
+ * @return bool Whether they were permitted before the call.
+ */
+bool allocation_guard_permit(bool permitted);
+
+/**
+ * @brief Reads the counters and the peak RSS. Can be called from any thread.
+ *
+ * @param stats Receives the counters.
+ */
+void allocation_guard_read_stats(allocation_guard_stats* stats);
+
+/**
+ * @brief Prints the counters and the peak RSS to stdout.
+ */
+void allocation_guard_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOCATION_GUARD_H */
@@ -0,0 +1,1411 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chunked_transfer.h"
+#include "extensions_internal.h"
+#include "logging.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define CORRELATION_DATA_SIZE 12
+#define OFFER_INDEX UINT32_MAX
+#define TRANSFER_ID_DIGITS 16
+#define OFFER_SUFFIX "/offer"
+#define CHUNK_SUFFIX "/chunk"
+#define FILTER_WILDCARD "/+"
+
+#define NAME_PROPERTY "name"
+#define SIZE_PROPERTY "size"
+#define CHUNK_SIZE_PROPERTY "chunk-size"
+#define CRC_PROPERTY "crc32c"
+#define STATUS_PROPERTY "status"
+#define PROPERTY_VALUE_SIZE 24
+
+#define STATUS_OK "ok"
+#define STATUS_CHECKSUM "checksum"
+#define STATUS_UNKNOWN "unknown"
+#define STATUS_ERROR "error"
+
+#define STATE_MAGIC "MQXFER01"
+#define DATA_EXTENSION ".data"
+#define STATE_EXTENSION ".state"
+
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+#define NS_PER_MS 1000000
+#define MAX_WAIT_NS (100 * NS_PER_MS)
+
+enum
+{
+  SLOT_FREE,
+  /* Assigned a chunk that still has to be read from the file. */
+  SLOT_LOADING,
+  SLOT_SENT,
+  SLOT_RESEND,
+};
+
+/* Header of a state file, followed by a state_record per chunk. */
+typedef struct state_header
+{
+  char magic[8];
+  uint64_t id;
+  uint64_t size;
+  uint32_t chunk_size;
+  uint32_t chunk_count;
+  char name[CHUNKED_TRANSFER_MAX_NAME];
+} state_header;
+
+typedef struct state_record
+{
+  uint32_t crc;
+  uint32_t received;
+} state_record;
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void _crc_table_init(void)
+{
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+    }
+    crc_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    for (int t = 1; t < 8; t++)
+    {
+      crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xFF];
+    }
+  }
+}
+
+/* Slicing-by-8: the CRC of 8 bytes is computed with 8 table lookups, instead of 8 dependent
+ * rounds of one lookup, which keeps up with the disk and the network. */
+uint32_t chunked_transfer_crc32c(uint32_t crc, const void* data, size_t length)
+{
+  const uint8_t* bytes = data;
+
+  pthread_once(&crc_table_once, _crc_table_init);
+  crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (length > 0 && ((uintptr_t)bytes & 7) != 0)
+  {
+    crc = crc_table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    length--;
+  }
+  while (length >= 8)
+  {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    word ^= crc;
+    crc = crc_table[7][word & 0xFF] ^ crc_table[6][(word >> 8) & 0xFF]
+        ^ crc_table[5][(word >> 16) & 0xFF] ^ crc_table[4][(word >> 24) & 0xFF]
+        ^ crc_table[3][(word >> 32) & 0xFF] ^ crc_table[2][(word >> 40) & 0xFF]
+        ^ crc_table[1][(word >> 48) & 0xFF] ^ crc_table[0][word >> 56];
+    bytes += 8;
+    length -= 8;
+  }
+#endif
+  while (length > 0)
+  {
+    crc = crc_table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    length--;
+  }
+  return ~crc;
+}
+
+static bool _bit(const uint8_t* bits, uint32_t index)
+{
+  return (bits[index / 8] >> (index % 8)) & 1;
+}
+
+static void _set_bit(uint8_t* bits, uint32_t index)
+{
+  bits[index / 8] |= (uint8_t)(1 << (index % 8));
+}
+
+/* At least one byte, so an empty file has a bitmap too. */
+static size_t _bitmap_size(uint32_t count)
+{
+  return count / 8 + 1;
+}
+
+static uint32_t _chunk_length(uint64_t size, uint32_t chunk_size, uint32_t index)
+{
+  uint64_t offset = (uint64_t)index * chunk_size;
+  return size - offset < chunk_size ? (uint32_t)(size - offset) : chunk_size;
+}
+
+static int _publish(
+    chunked_transfer_publish publish,
+    struct mosquitto* mosq,
+    const char* topic,
+    const void* payload,
+    size_t payload_length,
+    const mosquitto_property* props)
+{
+  if (publish == NULL)
+  {
+    publish = mosquitto_publish_v5;
+  }
+  return publish(
+      mosq, NULL, topic, (int)payload_length, payload, CHUNKED_TRANSFER_QOS, false, props);
+}
+
+static int _add_correlation(mosquitto_property** props, uint64_t id, uint32_t index)
+{
+  uint8_t data[CORRELATION_DATA_SIZE];
+
+  for (int i = 0; i < 8; i++)
+  {
+    data[i] = (uint8_t)(id >> (56 - 8 * i));
+  }
+  for (int i = 0; i < 4; i++)
+  {
+    data[8 + i] = (uint8_t)(index >> (24 - 8 * i));
+  }
+  return mosquitto_property_add_binary(props, MQTT_PROP_CORRELATION_DATA, data, sizeof(data));
+}
+
+static bool _read_correlation(const mosquitto_property* props, uint64_t* id, uint32_t* index)
+{
+  uint8_t* data = NULL;
+  uint16_t length = 0;
+  bool valid;
+
+  if (mosquitto_property_read_binary(
+          props, MQTT_PROP_CORRELATION_DATA, (void**)&data, &length, false)
+      == NULL)
+  {
+    return false;
+  }
+  if ((valid = length == CORRELATION_DATA_SIZE))
+  {
+    *id = 0;
+    *index = 0;
+    for (int i = 0; i < 8; i++)
+    {
+      *id = *id << 8 | data[i];
+    }
+    for (int i = 8; i < CORRELATION_DATA_SIZE; i++)
+    {
+      *index = *index << 8 | data[i];
+    }
+  }
+  free(data);
+  return valid;
+}
+
+/* Copies the value of the user property name into value, returns false if there is none or it
+ * doesn't fit. */
+static bool _read_user_property(
+    const mosquitto_property* props,
+    const char* name,
+    char* value,
+    size_t value_size)
+{
+  const mosquitto_property* prop = props;
+  bool skip_first = false;
+  bool found = false;
+  char* prop_name;
+  char* prop_value;
+
+  while (!found
+         && (prop = mosquitto_property_read_string_pair(
+                 prop, MQTT_PROP_USER_PROPERTY, &prop_name, &prop_value, skip_first))
+             != NULL)
+  {
+    skip_first = true;
+    if (strcmp(prop_name, name) == 0 && strlen(prop_value) < value_size)
+    {
+      strcpy(value, prop_value);
+      found = true;
+    }
+    free(prop_name);
+    free(prop_value);
+  }
+  return found;
+}
+
+static bool _read_number_property(
+    const mosquitto_property* props,
+    const char* name,
+    int base,
+    uint64_t* number)
+{
+  char value[PROPERTY_VALUE_SIZE];
+  char* end;
+
+  if (!_read_user_property(props, name, value, sizeof(value)) || value[0] == '\0'
+      || value[0] == '-')
+  {
+    return false;
+  }
+  errno = 0;
+  *number = strtoull(value, &end, base);
+  return errno == 0 && *end == '\0';
+}
+
+static char* _transfer_topic(const char* topic, uint64_t id, const char* suffix)
+{
+  size_t size = strlen(topic) + 1 + TRANSFER_ID_DIGITS + strlen(suffix) + 1;
+  char* transfer_topic = malloc(size);
+
+  if (transfer_topic != NULL)
+  {
+    snprintf(
+        transfer_topic,
+        size,
+        "%s/%0*llx%s",
+        topic,
+        TRANSFER_ID_DIGITS,
+        (unsigned long long)id,
+        suffix);
+  }
+  return transfer_topic;
+}
+
+/* FNV-1a of the name, size and modification time of the file, never 0. */
+static uint64_t _derive_transfer_id(const char* name, const struct stat* st)
+{
+  uint64_t values[3]
+      = { (uint64_t)st->st_size, (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec };
+  uint64_t hash = fnv1a_64(fnv1a_64_string(FNV1A_64_INIT, name), values, sizeof(values));
+
+  return hash != 0 ? hash : 1;
+}
+
+int chunked_transfer_sender_init(
+    chunked_transfer_sender* sender,
+    const chunked_transfer_sender_options* options)
+{
+  pthread_condattr_t condattr;
+  struct stat st;
+  const char* name;
+  uint64_t chunk_count;
+
+  memset(sender, 0, sizeof(*sender));
+  sender->fd = -1;
+  sender->options = *options;
+  pthread_mutex_init(&sender->lock, NULL);
+  pthread_condattr_init(&condattr);
+  pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+  pthread_cond_init(&sender->wake, &condattr);
+  pthread_condattr_destroy(&condattr);
+
+  if (sender->options.chunk_size == 0)
+  {
+    sender->options.chunk_size = CHUNKED_TRANSFER_DEFAULT_CHUNK_SIZE;
+  }
+  if (sender->options.window == 0)
+  {
+    sender->options.window = CHUNKED_TRANSFER_DEFAULT_WINDOW;
+  }
+  if (sender->options.ack_timeout_ms == 0)
+  {
+    sender->options.ack_timeout_ms = CHUNKED_TRANSFER_DEFAULT_ACK_TIMEOUT_MS;
+  }
+  if (options->path == NULL || options->topic == NULL || options->response_topic == NULL
+      || sender->options.chunk_size > CHUNKED_TRANSFER_MAX_CHUNK_SIZE
+      || sender->options.window > CHUNKED_TRANSFER_MAX_WINDOW)
+  {
+    LOG_ERROR("Invalid transfer settings");
+    chunked_transfer_sender_destroy(sender);
+    return -1;
+  }
+
+  name = options->name;
+  if (name == NULL)
+  {
+    name = strrchr(options->path, '/') != NULL ? strrchr(options->path, '/') + 1 : options->path;
+  }
+  if (name[0] == '\0' || strlen(name) >= CHUNKED_TRANSFER_MAX_NAME)
+  {
+    LOG_ERROR("Invalid transfer name for %s", options->path);
+    chunked_transfer_sender_destroy(sender);
+    return -1;
+  }
+
+  if ((sender->fd = open(options->path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(sender->fd, &st) != 0)
+  {
+    LOG_ERROR("Failed to open %s: %s", options->path, strerror(errno));
+    chunked_transfer_sender_destroy(sender);
+    return -1;
+  }
+  chunk_count
+      = ((uint64_t)st.st_size + sender->options.chunk_size - 1) / sender->options.chunk_size;
+  if (!S_ISREG(st.st_mode) || chunk_count >= OFFER_INDEX)
+  {
+    LOG_ERROR("%s is not a regular file or is too large", options->path);
+    chunked_transfer_sender_destroy(sender);
+    return -1;
+  }
+  sender->size = (uint64_t)st.st_size;
+  sender->chunk_count = (uint32_t)chunk_count;
+  if (sender->options.transfer_id == 0)
+  {
+    sender->options.transfer_id = _derive_transfer_id(name, &st);
+  }
+  /* The window never needs more slots than chunks. */
+  if (sender->options.window > sender->chunk_count)
+  {
+    sender->options.window = sender->chunk_count > 0 ? sender->chunk_count : 1;
+  }
+
+  sender->name = strdup(name);
+  sender->offer_topic = _transfer_topic(options->topic, sender->options.transfer_id, OFFER_SUFFIX);
+  sender->chunk_topic = _transfer_topic(options->topic, sender->options.transfer_id, CHUNK_SUFFIX);
+  sender->acked = calloc(_bitmap_size(sender->chunk_count), 1);
+  sender->slots = calloc(sender->options.window, sizeof(chunked_transfer_slot));
+  sender->buffers = malloc((size_t)sender->options.window * sender->options.chunk_size);
+  if (sender->name == NULL || sender->offer_topic == NULL || sender->chunk_topic == NULL
+      || sender->acked == NULL || sender->slots == NULL || sender->buffers == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for transfer of %s", options->path);
+    chunked_transfer_sender_destroy(sender);
+    return -1;
+  }
+  for (uint32_t i = 0; i < sender->options.window; i++)
+  {
+    sender->slots[i].buffer = sender->buffers + (size_t)i * sender->options.chunk_size;
+  }
+
+  posix_fadvise(sender->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  sender->state = CHUNKED_TRANSFER_OFFERING;
+  return 0;
+}
+
+static bool _in_window(const chunked_transfer_sender* sender, uint32_t index)
+{
+  for (uint32_t i = 0; i < sender->options.window; i++)
+  {
+    if (sender->slots[i].state != SLOT_FREE && sender->slots[i].index == index)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Returns the slot to send next, a timed out or rejected chunk first, then the next chunk that
+ * isn't acknowledged nor in flight if a slot is free. Otherwise sets wake_ns to the time the
+ * first chunk in flight times out. */
+static chunked_transfer_slot* _next_slot(
+    chunked_transfer_sender* sender,
+    int64_t now_ns,
+    int64_t timeout_ns,
+    int64_t* wake_ns)
+{
+  chunked_transfer_slot* resend = NULL;
+  chunked_transfer_slot* free_slot = NULL;
+
+  for (uint32_t i = 0; i < sender->options.window; i++)
+  {
+    chunked_transfer_slot* slot = &sender->slots[i];
+
+    if (slot->state == SLOT_SENT)
+    {
+      if (slot->sent_ns + timeout_ns <= now_ns)
+      {
+        slot->state = SLOT_RESEND;
+      }
+      else if (slot->sent_ns + timeout_ns < *wake_ns)
+      {
+        *wake_ns = slot->sent_ns + timeout_ns;
+      }
+    }
+    if (slot->state == SLOT_RESEND && resend == NULL)
+    {
+      resend = slot;
+    }
+    else if (slot->state == SLOT_FREE && free_slot == NULL)
+    {
+      free_slot = slot;
+    }
+  }
+  if (resend != NULL || free_slot == NULL)
+  {
+    return resend;
+  }
+
+  while (sender->cursor < sender->chunk_count
+         && (_bit(sender->acked, sender->cursor) || _in_window(sender, sender->cursor)))
+  {
+    sender->cursor++;
+  }
+  if (sender->cursor == sender->chunk_count)
+  {
+    return NULL;
+  }
+  free_slot->index = sender->cursor++;
+  free_slot->state = SLOT_LOADING;
+  return free_slot;
+}
+
+static int _read_chunk(chunked_transfer_sender* sender, chunked_transfer_slot* slot)
+{
+  uint64_t offset = (uint64_t)slot->index * sender->options.chunk_size;
+  size_t length = _chunk_length(sender->size, sender->options.chunk_size, slot->index);
+  size_t done = 0;
+
+  while (done < length)
+  {
+    ssize_t result = pread(sender->fd, slot->buffer + done, length - done, (off_t)(offset + done));
+    if (result < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result <= 0)
+    {
+      LOG_ERROR(
+          "Failed to read %s: %s",
+          sender->options.path,
+          result < 0 ? strerror(errno) : "file truncated");
+      return -1;
+    }
+    done += (size_t)result;
+  }
+  slot->length = (uint32_t)length;
+  slot->crc = chunked_transfer_crc32c(0, slot->buffer, length);
+  return 0;
+}
+
+static int _publish_offer(chunked_transfer_sender* sender, struct mosquitto* mosq)
+{
+  mosquitto_property* props = NULL;
+  char size[PROPERTY_VALUE_SIZE];
+  char chunk_size[PROPERTY_VALUE_SIZE];
+  int rc;
+
+  snprintf(size, sizeof(size), "%llu", (unsigned long long)sender->size);
+  snprintf(chunk_size, sizeof(chunk_size), "%u", sender->options.chunk_size);
+  if ((rc = mosquitto_property_add_string(
+           &props, MQTT_PROP_RESPONSE_TOPIC, sender->options.response_topic))
+          == MOSQ_ERR_SUCCESS
+      && (rc = _add_correlation(&props, sender->options.transfer_id, OFFER_INDEX))
+          == MOSQ_ERR_SUCCESS
+      && (rc = mosquitto_property_add_string_pair(
+              &props, MQTT_PROP_USER_PROPERTY, NAME_PROPERTY, sender->name))
+          == MOSQ_ERR_SUCCESS
+      && (rc = mosquitto_property_add_string_pair(
+              &props, MQTT_PROP_USER_PROPERTY, SIZE_PROPERTY, size))
+          == MOSQ_ERR_SUCCESS
+      && (rc = mosquitto_property_add_string_pair(
+              &props, MQTT_PROP_USER_PROPERTY, CHUNK_SIZE_PROPERTY, chunk_size))
+          == MOSQ_ERR_SUCCESS)
+  {
+    rc = _publish(sender->options.publish, mosq, sender->offer_topic, NULL, 0, props);
+  }
+  mosquitto_property_free_all(&props);
+  return rc;
+}
+
+static int _publish_chunk(
+    chunked_transfer_sender* sender,
+    struct mosquitto* mosq,
+    const chunked_transfer_slot* slot,
+    uint32_t index)
+{
+  mosquitto_property* props = NULL;
+  char crc[PROPERTY_VALUE_SIZE];
+  int rc;
+
+  snprintf(crc, sizeof(crc), "%08x", slot->crc);
+  if ((rc = mosquitto_property_add_string(
+           &props, MQTT_PROP_RESPONSE_TOPIC, sender->options.response_topic))
+          == MOSQ_ERR_SUCCESS
+      && (rc = _add_correlation(&props, sender->options.transfer_id, index)) == MOSQ_ERR_SUCCESS
+      && (rc = mosquitto_property_add_string_pair(
+              &props, MQTT_PROP_USER_PROPERTY, CRC_PROPERTY, crc))
+          == MOSQ_ERR_SUCCESS)
+  {
+    rc = _publish(
+        sender->options.publish, mosq, sender->chunk_topic, slot->buffer, slot->length, props);
+  }
+  mosquitto_property_free_all(&props);
+  return rc;
+}
+
+int chunked_transfer_sender_run(chunked_transfer_sender* sender, struct mosquitto* mosq)
+{
+  int64_t timeout_ns = (int64_t)sender->options.ack_timeout_ms * NS_PER_MS;
+  int result;
+
+  pthread_mutex_lock(&sender->lock);
+  while ((sender->state == CHUNKED_TRANSFER_OFFERING || sender->state == CHUNKED_TRANSFER_SENDING)
+         && !sender->cancelled && keep_running)
+  {
+    int64_t now_ns = monotonic_ns();
+    int64_t wake_ns = now_ns + MAX_WAIT_NS;
+    chunked_transfer_slot* slot = NULL;
+
+    if (sender->state == CHUNKED_TRANSFER_OFFERING)
+    {
+      if (now_ns >= sender->offer_due_ns)
+      {
+        int rc;
+
+        sender->offer_due_ns = now_ns + timeout_ns;
+        pthread_mutex_unlock(&sender->lock);
+        if ((rc = _publish_offer(sender, mosq)) != MOSQ_ERR_SUCCESS)
+        {
+          LOG_ERROR("Failed to publish transfer offer: %s", mosquitto_strerror(rc));
+        }
+        pthread_mutex_lock(&sender->lock);
+        continue;
+      }
+      if (sender->offer_due_ns < wake_ns)
+      {
+        wake_ns = sender->offer_due_ns;
+      }
+    }
+    else if ((slot = _next_slot(sender, now_ns, timeout_ns, &wake_ns)) != NULL)
+    {
+      /* Only this thread fills and publishes the slots, the message callback only changes their
+       * state, so the chunk is read and published without holding the lock. */
+      bool load = slot->state == SLOT_LOADING;
+      uint32_t index = slot->index;
+      int rc = 0;
+
+      if (!load)
+      {
+        sender->retransmits++;
+      }
+      slot->state = SLOT_SENT;
+      slot->sent_ns = now_ns;
+      pthread_mutex_unlock(&sender->lock);
+      if (load && _read_chunk(sender, slot) != 0)
+      {
+        rc = -1;
+      }
+      else if ((rc = _publish_chunk(sender, mosq, slot, index)) != MOSQ_ERR_SUCCESS)
+      {
+        /* Sent again when the acknowledgement times out, ex. once reconnected. */
+        LOG_ERROR("Failed to publish chunk %u: %s", index, mosquitto_strerror(rc));
+      }
+      pthread_mutex_lock(&sender->lock);
+      if (load && rc < 0)
+      {
+        sender->state = CHUNKED_TRANSFER_FAILED;
+      }
+      else if (rc == MOSQ_ERR_SUCCESS)
+      {
+        sender->chunks_sent++;
+        sender->bytes_sent += slot->length;
+      }
+      continue;
+    }
+
+    struct timespec timeout = { .tv_sec = wake_ns / 1000000000, .tv_nsec = wake_ns % 1000000000 };
+    pthread_cond_timedwait(&sender->wake, &sender->lock, &timeout);
+  }
+  result = sender->state == CHUNKED_TRANSFER_COMPLETE ? 0 : -1;
+  pthread_mutex_unlock(&sender->lock);
+  return result;
+}
+
+static void _complete_if_acked(chunked_transfer_sender* sender)
+{
+  if (sender->acked_count == sender->chunk_count)
+  {
+    sender->state = CHUNKED_TRANSFER_COMPLETE;
+  }
+}
+
+/* Takes the chunks the receiver has from the answer to an offer, and starts sending the others. */
+static void _apply_offer_answer(
+    chunked_transfer_sender* sender,
+    const uint8_t* bitmap,
+    size_t length)
+{
+  if (length != _bitmap_size(sender->chunk_count))
+  {
+    LOG_WARNING("Ignoring transfer bitmap of %zu bytes", length);
+    length = 0;
+  }
+  memset(sender->acked, 0, _bitmap_size(sender->chunk_count));
+  sender->acked_count = 0;
+  for (uint32_t index = 0; length > 0 && index < sender->chunk_count; index++)
+  {
+    if (_bit(bitmap, index))
+    {
+      _set_bit(sender->acked, index);
+      sender->acked_count++;
+    }
+  }
+  for (uint32_t i = 0; i < sender->options.window; i++)
+  {
+    chunked_transfer_slot* slot = &sender->slots[i];
+    if (slot->state != SLOT_FREE && _bit(sender->acked, slot->index))
+    {
+      slot->state = SLOT_FREE;
+    }
+  }
+  if (sender->chunks_sent == 0)
+  {
+    sender->resumed_chunks = sender->acked_count;
+  }
+  sender->cursor = 0;
+  sender->state = CHUNKED_TRANSFER_SENDING;
+  _complete_if_acked(sender);
+}
+
+static chunked_transfer_slot* _find_slot(chunked_transfer_sender* sender, uint32_t index)
+{
+  for (uint32_t i = 0; i < sender->options.window; i++)
+  {
+    if (sender->slots[i].state != SLOT_FREE && sender->slots[i].index == index)
+    {
+      return &sender->slots[i];
+    }
+  }
+  return NULL;
+}
+
+static void _restart_offer(chunked_transfer_sender* sender)
+{
+  sender->state = CHUNKED_TRANSFER_OFFERING;
+  sender->offer_due_ns = 0;
+  for (uint32_t i = 0; i < sender->options.window; i++)
+  {
+    if (sender->slots[i].state == SLOT_SENT)
+    {
+      sender->slots[i].state = SLOT_RESEND;
+    }
+  }
+}
+
+bool chunked_transfer_sender_handle_message(
+    chunked_transfer_sender* sender,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  char status[PROPERTY_VALUE_SIZE] = "";
+  uint64_t id;
+  uint32_t index;
+
+  if (!_read_correlation(props, &id, &index) || id != sender->options.transfer_id)
+  {
+    return false;
+  }
+  _read_user_property(props, STATUS_PROPERTY, status, sizeof(status));
+
+  pthread_mutex_lock(&sender->lock);
+  if (strcmp(status, STATUS_OK) != 0 && strcmp(status, STATUS_CHECKSUM) != 0
+      && strcmp(status, STATUS_UNKNOWN) != 0)
+  {
+    LOG_ERROR("Receiver failed transfer of %s: %s", sender->name, status);
+    sender->state = CHUNKED_TRANSFER_FAILED;
+  }
+  else if (index == OFFER_INDEX)
+  {
+    if (sender->state == CHUNKED_TRANSFER_OFFERING)
+    {
+      _apply_offer_answer(sender, message->payload, (size_t)message->payloadlen);
+    }
+  }
+  else if (sender->state == CHUNKED_TRANSFER_SENDING && index < sender->chunk_count)
+  {
+    chunked_transfer_slot* slot = _find_slot(sender, index);
+
+    if (strcmp(status, STATUS_UNKNOWN) == 0)
+    {
+      /* The receiver lost the transfer, the answer to the new offer tells what it has. */
+      _restart_offer(sender);
+    }
+    else if (strcmp(status, STATUS_CHECKSUM) == 0)
+    {
+      if (slot != NULL && slot->state == SLOT_SENT)
+      {
+        slot->state = SLOT_RESEND;
+      }
+    }
+    else if (!_bit(sender->acked, index))
+    {
+      _set_bit(sender->acked, index);
+      sender->acked_count++;
+      if (slot != NULL)
+      {
+        slot->state = SLOT_FREE;
+      }
+      _complete_if_acked(sender);
+    }
+  }
+  pthread_cond_signal(&sender->wake);
+  pthread_mutex_unlock(&sender->lock);
+  return true;
+}
+
+void chunked_transfer_sender_reconnected(chunked_transfer_sender* sender)
+{
+  pthread_mutex_lock(&sender->lock);
+  if (sender->state == CHUNKED_TRANSFER_OFFERING || sender->state == CHUNKED_TRANSFER_SENDING)
+  {
+    _restart_offer(sender);
+    pthread_cond_signal(&sender->wake);
+  }
+  pthread_mutex_unlock(&sender->lock);
+}
+
+void chunked_transfer_sender_cancel(chunked_transfer_sender* sender)
+{
+  pthread_mutex_lock(&sender->lock);
+  sender->cancelled = true;
+  pthread_cond_signal(&sender->wake);
+  pthread_mutex_unlock(&sender->lock);
+}
+
+void chunked_transfer_sender_destroy(chunked_transfer_sender* sender)
+{
+  if (sender->fd >= 0)
+  {
+    close(sender->fd);
+    sender->fd = -1;
+  }
+  free(sender->name);
+  free(sender->offer_topic);
+  free(sender->chunk_topic);
+  free(sender->acked);
+  free(sender->slots);
+  free(sender->buffers);
+  sender->name = NULL;
+  sender->offer_topic = NULL;
+  sender->chunk_topic = NULL;
+  sender->acked = NULL;
+  sender->slots = NULL;
+  sender->buffers = NULL;
+  pthread_cond_destroy(&sender->wake);
+  pthread_mutex_destroy(&sender->lock);
+}
+
+int chunked_transfer_receiver_init(
+    chunked_transfer_receiver* receiver,
+    const chunked_transfer_receiver_options* options)
+{
+  memset(receiver, 0, sizeof(*receiver));
+  receiver->options = *options;
+  for (int i = 0; i < CHUNKED_TRANSFER_MAX_TRANSFERS; i++)
+  {
+    receiver->incoming[i].data_fd = -1;
+    receiver->incoming[i].state_fd = -1;
+  }
+  if (options->directory == NULL || options->topic == NULL)
+  {
+    LOG_ERROR("Invalid transfer settings");
+    return -1;
+  }
+  if (mkdir(options->directory, 0755) != 0 && errno != EEXIST)
+  {
+    LOG_ERROR("Failed to create transfer directory %s: %s", options->directory, strerror(errno));
+    return -1;
+  }
+  receiver->directory = strdup(options->directory);
+  receiver->topic = strdup(options->topic);
+  if (receiver->directory == NULL || receiver->topic == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for transfer receiver");
+    chunked_transfer_receiver_destroy(receiver);
+    return -1;
+  }
+  return 0;
+}
+
+int chunked_transfer_receiver_subscribe(
+    chunked_transfer_receiver* receiver,
+    struct mosquitto* mosq)
+{
+  size_t size = strlen(receiver->topic) + strlen(FILTER_WILDCARD) + strlen(OFFER_SUFFIX) + 1;
+  char* filters[2] = { malloc(size), malloc(size) };
+  int rc = MOSQ_ERR_NOMEM;
+
+  if (filters[0] != NULL && filters[1] != NULL)
+  {
+    snprintf(filters[0], size, "%s%s%s", receiver->topic, FILTER_WILDCARD, OFFER_SUFFIX);
+    snprintf(filters[1], size, "%s%s%s", receiver->topic, FILTER_WILDCARD, CHUNK_SUFFIX);
+    rc = mosquitto_subscribe_multiple(mosq, NULL, 2, filters, CHUNKED_TRANSFER_QOS, 0, NULL);
+  }
+  free(filters[0]);
+  free(filters[1]);
+  return rc;
+}
+
+static void _receiver_path(
+    const chunked_transfer_receiver* receiver,
+    char* path,
+    size_t path_size,
+    uint64_t id,
+    const char* extension)
+{
+  snprintf(
+      path,
+      path_size,
+      "%s/%0*llx%s",
+      receiver->directory,
+      TRANSFER_ID_DIGITS,
+      (unsigned long long)id,
+      extension);
+}
+
+static bool _valid_name(const char* name)
+{
+  return name[0] != '\0' && strchr(name, '/') == NULL && strcmp(name, ".") != 0
+      && strcmp(name, "..") != 0;
+}
+
+static bool _completed(const chunked_transfer_receiver* receiver, uint64_t id)
+{
+  for (uint32_t i = 0; i < receiver->completed_count && i < CHUNKED_TRANSFER_COMPLETED_HISTORY; i++)
+  {
+    if (receiver->completed[i] == id)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void _incoming_close(chunked_transfer_incoming* incoming)
+{
+  if (incoming->data_fd >= 0)
+  {
+    close(incoming->data_fd);
+  }
+  if (incoming->state_fd >= 0)
+  {
+    close(incoming->state_fd);
+  }
+  free(incoming->received);
+  memset(incoming, 0, sizeof(*incoming));
+  incoming->data_fd = -1;
+  incoming->state_fd = -1;
+}
+
+static chunked_transfer_incoming* _find_incoming(chunked_transfer_receiver* receiver, uint64_t id)
+{
+  for (int i = 0; i < CHUNKED_TRANSFER_MAX_TRANSFERS; i++)
+  {
+    if (receiver->incoming[i].id == id)
+    {
+      return &receiver->incoming[i];
+    }
+  }
+  return NULL;
+}
+
+/* Returns a free entry, closing the least recently active transfer if there is none. Its state
+ * file stays, so it resumes if its sender comes back. */
+static chunked_transfer_incoming* _free_incoming(chunked_transfer_receiver* receiver)
+{
+  chunked_transfer_incoming* oldest = &receiver->incoming[0];
+
+  for (int i = 0; i < CHUNKED_TRANSFER_MAX_TRANSFERS; i++)
+  {
+    if (receiver->incoming[i].id == 0)
+    {
+      return &receiver->incoming[i];
+    }
+    if (receiver->incoming[i].active_ns < oldest->active_ns)
+    {
+      oldest = &receiver->incoming[i];
+    }
+  }
+  _incoming_close(oldest);
+  return oldest;
+}
+
+static int _pread_full(int fd, void* buffer, size_t length, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < length)
+  {
+    ssize_t result = pread(fd, (uint8_t*)buffer + done, length - done, offset + (off_t)done);
+    if (result < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result <= 0)
+    {
+      return -1;
+    }
+    done += (size_t)result;
+  }
+  return 0;
+}
+
+static int _pwrite_full(int fd, const void* buffer, size_t length, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < length)
+  {
+    ssize_t result = pwrite(fd, (const uint8_t*)buffer + done, length - done, offset + (off_t)done);
+    if (result < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result < 0)
+    {
+      return -1;
+    }
+    done += (size_t)result;
+  }
+  return 0;
+}
+
+static off_t _record_offset(uint32_t index)
+{
+  return (off_t)(sizeof(state_header) + (size_t)index * sizeof(state_record));
+}
+
+/* Starts a transfer from scratch, replacing the files of a previous one with the same id. */
+static chunked_transfer_incoming* _create_incoming(
+    chunked_transfer_receiver* receiver,
+    uint64_t id,
+    const char* name,
+    uint64_t size,
+    uint32_t chunk_size,
+    uint32_t chunk_count)
+{
+  chunked_transfer_incoming* incoming = _free_incoming(receiver);
+  char path[PATH_MAX];
+  state_header header = { 0 };
+
+  incoming->id = id;
+  incoming->size = size;
+  incoming->chunk_size = chunk_size;
+  incoming->chunk_count = chunk_count;
+  strcpy(incoming->name, name);
+
+  _receiver_path(receiver, path, sizeof(path), id, DATA_EXTENSION);
+  if ((incoming->data_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+      || ftruncate(incoming->data_fd, (off_t)size) != 0)
+  {
+    LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+    _incoming_close(incoming);
+    return NULL;
+  }
+
+  memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+  header.id = id;
+  header.size = size;
+  header.chunk_size = chunk_size;
+  header.chunk_count = chunk_count;
+  strcpy(header.name, name);
+  _receiver_path(receiver, path, sizeof(path), id, STATE_EXTENSION);
+  if ((incoming->state_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+      || ftruncate(incoming->state_fd, _record_offset(chunk_count)) != 0
+      || _pwrite_full(incoming->state_fd, &header, sizeof(header), 0) != 0
+      || (incoming->received = calloc(_bitmap_size(chunk_count), 1)) == NULL)
+  {
+    LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+    _incoming_close(incoming);
+    return NULL;
+  }
+  return incoming;
+}
+
+/* Resumes a transfer from its state file. The chunks recorded as received are read back and
+ * checked against their CRC, in case the data didn't reach the disk before a crash. */
+static chunked_transfer_incoming* _load_incoming(chunked_transfer_receiver* receiver, uint64_t id)
+{
+  chunked_transfer_incoming* incoming;
+  state_header header;
+  state_record* records = NULL;
+  uint8_t* buffer = NULL;
+  char path[PATH_MAX];
+  int state_fd;
+  int data_fd = -1;
+
+  _receiver_path(receiver, path, sizeof(path), id, STATE_EXTENSION);
+  if ((state_fd = open(path, O_RDWR | O_CLOEXEC)) < 0)
+  {
+    return NULL;
+  }
+  if (_pread_full(state_fd, &header, sizeof(header), 0) != 0
+      || memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) != 0 || header.id != id
+      || header.chunk_size == 0 || header.chunk_size > CHUNKED_TRANSFER_MAX_CHUNK_SIZE
+      || header.chunk_count
+          != (header.size + header.chunk_size - 1) / header.chunk_size
+      || memchr(header.name, '\0', sizeof(header.name)) == NULL || !_valid_name(header.name))
+  {
+    LOG_WARNING("Ignoring invalid transfer state %s", path);
+    close(state_fd);
+    return NULL;
+  }
+
+  _receiver_path(receiver, path, sizeof(path), id, DATA_EXTENSION);
+  if ((data_fd = open(path, O_RDWR | O_CLOEXEC)) < 0
+      || (records = malloc(_record_offset(header.chunk_count) - sizeof(header) + 1)) == NULL
+      || (buffer = malloc(header.chunk_size)) == NULL
+      || _pread_full(
+             state_fd,
+             records,
+             (size_t)header.chunk_count * sizeof(state_record),
+             (off_t)sizeof(header))
+          != 0)
+  {
+    LOG_WARNING("Failed to resume transfer %s", path);
+    close(state_fd);
+    if (data_fd >= 0)
+    {
+      close(data_fd);
+    }
+    free(records);
+    free(buffer);
+    return NULL;
+  }
+
+  incoming = _free_incoming(receiver);
+  incoming->id = id;
+  incoming->size = header.size;
+  incoming->chunk_size = header.chunk_size;
+  incoming->chunk_count = header.chunk_count;
+  incoming->data_fd = data_fd;
+  incoming->state_fd = state_fd;
+  strcpy(incoming->name, header.name);
+  if ((incoming->received = calloc(_bitmap_size(header.chunk_count), 1)) == NULL)
+  {
+    _incoming_close(incoming);
+    free(records);
+    free(buffer);
+    return NULL;
+  }
+  for (uint32_t index = 0; index < header.chunk_count; index++)
+  {
+    uint32_t length = _chunk_length(header.size, header.chunk_size, index);
+
+    if (!records[index].received)
+    {
+      continue;
+    }
+    if (_pread_full(data_fd, buffer, length, (off_t)index * header.chunk_size) == 0
+        && chunked_transfer_crc32c(0, buffer, length) == records[index].crc)
+    {
+      _set_bit(incoming->received, index);
+      incoming->received_count++;
+    }
+    else
+    {
+      state_record empty = { 0 };
+      _pwrite_full(state_fd, &empty, sizeof(empty), _record_offset(index));
+    }
+  }
+  free(records);
+  free(buffer);
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Resuming transfer of %s with %u of %u chunks",
+      incoming->name,
+      incoming->received_count,
+      incoming->chunk_count);
+  return incoming;
+}
+
+/* Syncs the file and moves it to its name once every chunk has been written. */
+static int _finish_incoming(
+    chunked_transfer_receiver* receiver,
+    chunked_transfer_incoming* incoming)
+{
+  char data_path[PATH_MAX];
+  char path[PATH_MAX];
+  char name[CHUNKED_TRANSFER_MAX_NAME];
+  uint64_t size = incoming->size;
+  int result = 0;
+
+  _receiver_path(receiver, data_path, sizeof(data_path), incoming->id, DATA_EXTENSION);
+  snprintf(path, sizeof(path), "%s/%s", receiver->directory, incoming->name);
+  strcpy(name, incoming->name);
+  if (fsync(incoming->data_fd) != 0 || rename(data_path, path) != 0)
+  {
+    LOG_ERROR("Failed to complete %s: %s", path, strerror(errno));
+    result = -1;
+  }
+  else
+  {
+    _receiver_path(receiver, data_path, sizeof(data_path), incoming->id, STATE_EXTENSION);
+    unlink(data_path);
+    receiver->completed[receiver->completed_count++ % CHUNKED_TRANSFER_COMPLETED_HISTORY]
+        = incoming->id;
+    receiver->files_completed++;
+  }
+  _incoming_close(incoming);
+  if (result == 0 && receiver->options.on_complete != NULL)
+  {
+    receiver->options.on_complete(name, path, size, receiver->options.context);
+  }
+  return result;
+}
+
+static int _reply(
+    chunked_transfer_receiver* receiver,
+    struct mosquitto* mosq,
+    const char* response_topic,
+    uint64_t id,
+    uint32_t index,
+    const char* status,
+    const void* payload,
+    size_t payload_length)
+{
+  mosquitto_property* props = NULL;
+  int rc;
+
+  if ((rc = _add_correlation(&props, id, index)) == MOSQ_ERR_SUCCESS
+      && (rc = mosquitto_property_add_string_pair(
+              &props, MQTT_PROP_USER_PROPERTY, STATUS_PROPERTY, status))
+          == MOSQ_ERR_SUCCESS)
+  {
+    rc = _publish(receiver->options.publish, mosq, response_topic, payload, payload_length, props);
+  }
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to acknowledge transfer: %s", mosquitto_strerror(rc));
+  }
+  mosquitto_property_free_all(&props);
+  return rc;
+}
+
+/* Answers an offer with the bitmap of the chunks already received. */
+static void _handle_offer(
+    chunked_transfer_receiver* receiver,
+    struct mosquitto* mosq,
+    const char* response_topic,
+    uint64_t id,
+    const mosquitto_property* props)
+{
+  char name[CHUNKED_TRANSFER_MAX_NAME];
+  chunked_transfer_incoming* incoming;
+  uint8_t* complete = NULL;
+  uint64_t size;
+  uint64_t chunk_size;
+  uint64_t chunk_count;
+
+  if (!_read_user_property(props, NAME_PROPERTY, name, sizeof(name)) || !_valid_name(name)
+      || !_read_number_property(props, SIZE_PROPERTY, 10, &size)
+      || !_read_number_property(props, CHUNK_SIZE_PROPERTY, 10, &chunk_size) || chunk_size == 0
+      || chunk_size > CHUNKED_TRANSFER_MAX_CHUNK_SIZE
+      || (chunk_count = (size + chunk_size - 1) / chunk_size) >= OFFER_INDEX)
+  {
+    LOG_ERROR("Invalid transfer offer");
+    _reply(receiver, mosq, response_topic, id, OFFER_INDEX, STATUS_ERROR, NULL, 0);
+    return;
+  }
+
+  incoming = _find_incoming(receiver, id);
+  if (incoming == NULL && !_completed(receiver, id))
+  {
+    incoming = _load_incoming(receiver, id);
+  }
+  if (incoming != NULL
+      && (incoming->size != size || incoming->chunk_size != chunk_size
+          || strcmp(incoming->name, name) != 0))
+  {
+    _incoming_close(incoming);
+    incoming = NULL;
+  }
+  if (incoming == NULL && !_completed(receiver, id)
+      && (incoming = _create_incoming(
+              receiver, id, name, size, (uint32_t)chunk_size, (uint32_t)chunk_count))
+          == NULL)
+  {
+    _reply(receiver, mosq, response_topic, id, OFFER_INDEX, STATUS_ERROR, NULL, 0);
+    return;
+  }
+
+  if (incoming != NULL && incoming->received_count < incoming->chunk_count)
+  {
+    incoming->active_ns = monotonic_ns();
+    _reply(
+        receiver,
+        mosq,
+        response_topic,
+        id,
+        OFFER_INDEX,
+        STATUS_OK,
+        incoming->received,
+        _bitmap_size(incoming->chunk_count));
+    return;
+  }
+
+  /* Every chunk is there: completed earlier, or the receiver stopped before finishing. */
+  if (incoming != NULL && _finish_incoming(receiver, incoming) != 0)
+  {
+    _reply(receiver, mosq, response_topic, id, OFFER_INDEX, STATUS_ERROR, NULL, 0);
+    return;
+  }
+  if ((complete = malloc(_bitmap_size((uint32_t)chunk_count))) == NULL)
+  {
+    _reply(receiver, mosq, response_topic, id, OFFER_INDEX, STATUS_ERROR, NULL, 0);
+    return;
+  }
+  memset(complete, 0xFF, _bitmap_size((uint32_t)chunk_count));
+  _reply(
+      receiver,
+      mosq,
+      response_topic,
+      id,
+      OFFER_INDEX,
+      STATUS_OK,
+      complete,
+      _bitmap_size((uint32_t)chunk_count));
+  free(complete);
+}
+
+/* Checks and writes a chunk, returns the status to acknowledge it with. */
+static const char* _handle_chunk(
+    chunked_transfer_receiver* receiver,
+    uint64_t id,
+    uint32_t index,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  chunked_transfer_incoming* incoming;
+  state_record record;
+  uint64_t crc;
+  uint32_t length;
+
+  if (_completed(receiver, id))
+  {
+    receiver->duplicates++;
+    return STATUS_OK;
+  }
+  if ((incoming = _find_incoming(receiver, id)) == NULL
+      && (incoming = _load_incoming(receiver, id)) == NULL)
+  {
+    return STATUS_UNKNOWN;
+  }
+  incoming->active_ns = monotonic_ns();
+  if (index >= incoming->chunk_count)
+  {
+    LOG_ERROR("Chunk %u of %s is out of range", index, incoming->name);
+    return STATUS_ERROR;
+  }
+
+  length = _chunk_length(incoming->size, incoming->chunk_size, index);
+  if ((uint32_t)message->payloadlen != length
+      || !_read_number_property(props, CRC_PROPERTY, 16, &crc)
+      || chunked_transfer_crc32c(0, message->payload, length) != crc)
+  {
+    receiver->checksum_failures++;
+    return STATUS_CHECKSUM;
+  }
+  if (_bit(incoming->received, index))
+  {
+    /* A resumed transfer may have every chunk already, if the receiver stopped before finishing. */
+    receiver->duplicates++;
+    return incoming->received_count == incoming->chunk_count
+            && _finish_incoming(receiver, incoming) != 0
+        ? STATUS_ERROR
+        : STATUS_OK;
+  }
+
+  /* The data is written before its record, so a record never stands for data not written. */
+  record.crc = (uint32_t)crc;
+  record.received = 1;
+  if (_pwrite_full(
+          incoming->data_fd, message->payload, length, (off_t)index * incoming->chunk_size)
+          != 0
+      || _pwrite_full(incoming->state_fd, &record, sizeof(record), _record_offset(index)) != 0)
+  {
+    LOG_ERROR("Failed to write chunk %u of %s: %s", index, incoming->name, strerror(errno));
+    return STATUS_ERROR;
+  }
+  _set_bit(incoming->received, index);
+  incoming->received_count++;
+  receiver->chunks_received++;
+  receiver->bytes_received += length;
+
+  if (incoming->received_count == incoming->chunk_count
+      && _finish_incoming(receiver, incoming) != 0)
+  {
+    return STATUS_ERROR;
+  }
+  return STATUS_OK;
+}
+
+static bool _ends_with(const char* topic, size_t topic_length, const char* suffix)
+{
+  size_t suffix_length = strlen(suffix);
+  return topic_length >= suffix_length
+      && memcmp(topic + topic_length - suffix_length, suffix, suffix_length) == 0;
+}
+
+bool chunked_transfer_receiver_handle_message(
+    chunked_transfer_receiver* receiver,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  size_t base_length = strlen(receiver->topic);
+  size_t topic_length = strlen(message->topic);
+  char* response_topic = NULL;
+  bool offer;
+  uint64_t id;
+  uint32_t index;
+
+  if (strncmp(message->topic, receiver->topic, base_length) != 0
+      || message->topic[base_length] != '/')
+  {
+    return false;
+  }
+  offer = _ends_with(message->topic, topic_length, OFFER_SUFFIX);
+  if (!offer && !_ends_with(message->topic, topic_length, CHUNK_SUFFIX))
+  {
+    return false;
+  }
+
+  if (mosquitto_property_read_string(props, MQTT_PROP_RESPONSE_TOPIC, &response_topic, false)
+      == NULL)
+  {
+    LOG_ERROR("Transfer message does not have a response topic");
+    return true;
+  }
+  if (!_read_correlation(props, &id, &index) || id == 0 || offer != (index == OFFER_INDEX))
+  {
+    LOG_ERROR("Transfer message does not have a valid correlation data");
+  }
+  else if (offer)
+  {
+    _handle_offer(receiver, mosq, response_topic, id, props);
+  }
+  else
+  {
+    _reply(
+        receiver,
+        mosq,
+        response_topic,
+        id,
+        index,
+        _handle_chunk(receiver, id, index, message, props),
+        NULL,
+        0);
+  }
+  free(response_topic);
+  return true;
+}
+
+void chunked_transfer_receiver_destroy(chunked_transfer_receiver* receiver)
+{
+  for (int i = 0; i < CHUNKED_TRANSFER_MAX_TRANSFERS; i++)
+  {
+    _incoming_close(&receiver->incoming[i]);
+  }
+  free(receiver->directory);
+  free(receiver->topic);
+  receiver->directory = NULL;
+  receiver->topic = NULL;
+}
@@ -0,0 +1,286 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef CHUNKED_TRANSFER_H
+#define CHUNKED_TRANSFER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mosquitto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHUNKED_TRANSFER_DEFAULT_CHUNK_SIZE (256 * 1024)
+#define CHUNKED_TRANSFER_MAX_CHUNK_SIZE (16 * 1024 * 1024)
+#define CHUNKED_TRANSFER_DEFAULT_WINDOW 16
+#define CHUNKED_TRANSFER_MAX_WINDOW 256
+#define CHUNKED_TRANSFER_DEFAULT_ACK_TIMEOUT_MS 5000
+#define CHUNKED_TRANSFER_MAX_NAME 128
+#define CHUNKED_TRANSFER_MAX_TRANSFERS 8
+#define CHUNKED_TRANSFER_COMPLETED_HISTORY 16
+#define CHUNKED_TRANSFER_QOS 1
+
+/*
+ * Transfers a file over MQTT v5 in chunks, for blobs too large for a single message, ex. firmware
+ * images or map tiles. Every message of a transfer carries a correlation data of 12 bytes: the
+ * 64-bit transfer id and the 32-bit chunk index, big-endian.
+ *
+ * The sender publishes an offer to <topic>/<transfer id>/offer, with the name, size and chunk size
+ * of the file, and the receiver answers on the response topic of the offer with the bitmap of the
+ * chunks it already has. The sender then streams the missing chunks to <topic>/<transfer id>/chunk,
+ * each with its CRC-32C, keeping at most window chunks in flight. The receiver acknowledges every
+ * chunk on its own, with a status user property: "ok", "checksum" if the CRC doesn't match and the
+ * chunk must be sent again, "unknown" if it has no offer for the transfer, or "error". A chunk
+ * without acknowledgement after ack_timeout_ms is sent again.
+ *
+ * The sender reads the chunks from disk as the window moves, so its memory is window * chunk_size
+ * whatever the size of the file. The receiver writes them in place into
+ * <directory>/<transfer id>.data and records them in <directory>/<transfer id>.state, so a
+ * transfer interrupted by a reconnect or a restart of either side resumes with the chunks that
+ * are missing. Once complete, the file is renamed to <directory>/<name>.
+ */
+typedef int (*chunked_transfer_publish)(
+    struct mosquitto* mosq,
+    int* mid,
+    const char* topic,
+    int payloadlen,
+    const void* payload,
+    int qos,
+    bool retain,
+    const mosquitto_property* properties);
+
+typedef struct chunked_transfer_sender_options
+{
+  /* The file to send. */
+  const char* path;
+  /* Name of the file on the receiver, the base name of path if NULL. */
+  const char* name;
+  /* Base topic of the transfers, ex. vehicles/vehicle01/transfer. */
+  const char* topic;
+  /* Topic the receiver answers on, that the sender must be subscribed to. */
+  const char* response_topic;
+  /* Derived from the name, size and modification time of the file if 0, so a restarted sender
+   * resumes the same transfer. */
+  uint64_t transfer_id;
+  uint32_t chunk_size;
+  uint32_t window;
+  uint32_t ack_timeout_ms;
+  /* mosquitto_publish_v5 if NULL. */
+  chunked_transfer_publish publish;
+} chunked_transfer_sender_options;
+
+typedef enum chunked_transfer_sender_state
+{
+  CHUNKED_TRANSFER_OFFERING,
+  CHUNKED_TRANSFER_SENDING,
+  CHUNKED_TRANSFER_COMPLETE,
+  CHUNKED_TRANSFER_FAILED,
+} chunked_transfer_sender_state;
+
+typedef struct chunked_transfer_slot
+{
+  uint32_t index;
+  int state;
+  uint32_t length;
+  uint32_t crc;
+  int64_t sent_ns;
+  uint8_t* buffer;
+} chunked_transfer_slot;
+
+typedef struct chunked_transfer_sender
+{
+  chunked_transfer_sender_options options;
+  char* name;
+  char* offer_topic;
+  char* chunk_topic;
+  int fd;
+  uint64_t size;
+  uint32_t chunk_count;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  chunked_transfer_sender_state state;
+  bool cancelled;
+  int64_t offer_due_ns;
+  /* Chunks acknowledged by the receiver, one bit per chunk. */
+  uint8_t* acked;
+  uint32_t acked_count;
+  /* Next chunk to look at when a slot of the window is free. */
+  uint32_t cursor;
+  chunked_transfer_slot* slots;
+  uint8_t* buffers;
+  uint64_t chunks_sent;
+  uint64_t bytes_sent;
+  uint64_t retransmits;
+  uint64_t resumed_chunks;
+} chunked_transfer_sender;
+
+typedef struct chunked_transfer_receiver_options
+{
+  /* Where the files are received, created if needed. */
+  const char* directory;
+  /* Base topic of the transfers, ex. vehicles/vehicle01/transfer. */
+  const char* topic;
+  /* Called when a file has been received, with its name and path. */
+  void (*on_complete)(const char* name, const char* path, uint64_t size, void* context);
+  void* context;
+  /* mosquitto_publish_v5 if NULL. */
+  chunked_transfer_publish publish;
+} chunked_transfer_receiver_options;
+
+typedef struct chunked_transfer_incoming
+{
+  uint64_t id;
+  uint64_t size;
+  uint32_t chunk_size;
+  uint32_t chunk_count;
+  uint32_t received_count;
+  int data_fd;
+  int state_fd;
+  /* Chunks written, one bit per chunk. */
+  uint8_t* received;
+  int64_t active_ns;
+  char name[CHUNKED_TRANSFER_MAX_NAME];
+} chunked_transfer_incoming;
+
+typedef struct chunked_transfer_receiver
+{
+  chunked_transfer_receiver_options options;
+  char* directory;
+  char* topic;
+  chunked_transfer_incoming incoming[CHUNKED_TRANSFER_MAX_TRANSFERS];
+  /* Transfers completed recently, acknowledged again if the last acknowledgements were lost. */
+  uint64_t completed[CHUNKED_TRANSFER_COMPLETED_HISTORY];
+  uint32_t completed_count;
+  uint64_t chunks_received;
+  uint64_t bytes_received;
+  uint64_t duplicates;
+  uint64_t checksum_failures;
+  uint64_t files_completed;
+} chunked_transfer_receiver;
+
+/**
+ * @brief Computes the CRC-32C (Castagnoli) of data, continuing from a previous crc.
+ *
+ * @param crc 0, or the CRC of the data before.
+ * @param data The data.
+ * @param length The length of data.
+ * @return uint32_t The CRC-32C.
+ */
+uint32_t chunked_transfer_crc32c(uint32_t crc, const void* data, size_t length);
+
+/**
+ * @brief Opens the file to send and allocates the window. Unset options (0) take their default
+ * value.
+ *
+ * @param sender The chunked_transfer_sender to initialize.
+ * @param options The file, topics and window of the transfer.
+ * @return int 0 on success, -1 on failure. On success the sender must be destroyed with
+ * chunked_transfer_sender_destroy().
+ */
+int chunked_transfer_sender_init(
+    chunked_transfer_sender* sender,
+    const chunked_transfer_sender_options* options);
+
+/**
+ * @brief Sends the file, returning when the receiver has acknowledged every chunk, the transfer
+ * failed, or it was cancelled. Must be called from another thread than the mosquitto loop, which
+ * delivers the acknowledgements.
+ *
+ * @param sender The chunked_transfer_sender.
+ * @param mosq The connected mosquitto client.
+ * @return int 0 when the file was received, -1 otherwise.
+ */
+int chunked_transfer_sender_run(chunked_transfer_sender* sender, struct mosquitto* mosq);
+
+/**
+ * @brief Handles a message received on the response topic. Called from the message callback.
+ *
+ * @param sender The chunked_transfer_sender.
+ * @param message The received message.
+ * @param props The properties of the received message.
+ * @return bool true if the message was an answer for this transfer.
+ */
+bool chunked_transfer_sender_handle_message(
+    chunked_transfer_sender* sender,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props);
+
+/**
+ * @brief Restarts the transfer with a new offer, to call from the connect callback once the
+ * client is connected again, as chunks in flight may have been lost with the connection.
+ *
+ * @param sender The chunked_transfer_sender.
+ */
+void chunked_transfer_sender_reconnected(chunked_transfer_sender* sender);
+
+/**
+ * @brief Makes chunked_transfer_sender_run() return. Can be called from any thread.
+ *
+ * @param sender The chunked_transfer_sender.
+ */
+void chunked_transfer_sender_cancel(chunked_transfer_sender* sender);
+
+/**
+ * @brief Closes the file and frees the window of a sender.
+ *
+ * @param sender The chunked_transfer_sender to destroy.
+ */
+void chunked_transfer_sender_destroy(chunked_transfer_sender* sender);
+
+/**
+ * @brief Initializes a receiver, creating its directory if needed.
+ *
+ * @param receiver The chunked_transfer_receiver to initialize.
+ * @param options The directory, topic and completion callback of the receiver.
+ * @return int 0 on success, -1 on failure. On success the receiver must be destroyed with
+ * chunked_transfer_receiver_destroy().
+ */
+int chunked_transfer_receiver_init(
+    chunked_transfer_receiver* receiver,
+    const chunked_transfer_receiver_options* options);
+
+/**
+ * @brief Subscribes to the offers and chunks of the transfers. Called from the connect callback.
+ *
+ * @param receiver The chunked_transfer_receiver.
+ * @param mosq The connected mosquitto client.
+ * @return int MOSQ_ERR_SUCCESS on success, a mosquitto error otherwise.
+ */
+int chunked_transfer_receiver_subscribe(
+    chunked_transfer_receiver* receiver,
+    struct mosquitto* mosq);
+
+/**
+ * @brief Handles an offer or a chunk, writing the chunk and acknowledging it. Called from the
+ * message callback.
+ *
+ * @param receiver The chunked_transfer_receiver.
+ * @param mosq The mosquitto client to acknowledge with.
+ * @param message The received message.
+ * @param props The properties of the received message.
+ * @return bool true if the message was an offer or a chunk.
+ */
+bool chunked_transfer_receiver_handle_message(
+    chunked_transfer_receiver* receiver,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props);
+
+/**
+ * @brief Closes the transfers in progress, which resume from their state files with the next
+ * receiver on the same directory.
+ *
+ * @param receiver The chunked_transfer_receiver to destroy.
+ */
+void chunked_transfer_receiver_destroy(chunked_transfer_receiver* receiver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHUNKED_TRANSFER_H */
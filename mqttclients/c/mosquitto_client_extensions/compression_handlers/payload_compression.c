@@ -0,0 +1,445 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "payload_compression.h"
+
+/* Longest content type: the prefix and a 32 bit dictionary id. */
+#define CONTENT_TYPE_LENGTH (sizeof(PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX) + 10)
+
+static payload_dictionary* _find_dictionary(payload_codec* codec, uint32_t id)
+{
+  for (uint32_t i = 0; i < codec->dictionary_count; i++)
+  {
+    if (codec->dictionaries[i].id == id)
+    {
+      return &codec->dictionaries[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Parses the dictionary id of a content type. Returns 1 if the content type is the one of a
+ * compressed payload, 0 if it is another content type and -1 if it is a malformed zstd one.
+ */
+static int _parse_content_type(const char* content_type, uint32_t* id)
+{
+  size_t prefix_length = sizeof(PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX) - 1;
+  unsigned long long value;
+  char* end;
+
+  if (strncmp(content_type, PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX, prefix_length) != 0)
+  {
+    return 0;
+  }
+  errno = 0;
+  value = strtoull(content_type + prefix_length, &end, 10);
+  if (errno != 0 || end == content_type + prefix_length || *end != '\0' || value == 0
+      || value > UINT32_MAX)
+  {
+    return -1;
+  }
+  *id = (uint32_t)value;
+  return 1;
+}
+
+/* Parses the dictionary id of the content type of a message, as _parse_content_type(). */
+static int _read_content_type(const mosquitto_property* props, uint32_t* id)
+{
+  const mosquitto_property* property;
+  char* content_type = NULL;
+  int parsed;
+
+  /* Most messages have no content type, so look for one before reading it into a copy. */
+  for (property = props; property != NULL; property = mosquitto_property_next(property))
+  {
+    if (mosquitto_property_identifier(property) == MQTT_PROP_CONTENT_TYPE)
+    {
+      break;
+    }
+  }
+  if (property == NULL
+      || mosquitto_property_read_string(property, MQTT_PROP_CONTENT_TYPE, &content_type, false)
+          == NULL)
+  {
+    return 0;
+  }
+  parsed = _parse_content_type(content_type, id);
+  free(content_type);
+  return parsed;
+}
+
+int payload_codec_use_dictionary(payload_codec* codec, uint32_t id)
+{
+  payload_dictionary* dictionary = _find_dictionary(codec, id);
+
+  if (dictionary == NULL)
+  {
+    return -1;
+  }
+  codec->current = dictionary;
+  return 0;
+}
+
+#ifdef PAYLOAD_COMPRESSION
+
+static void _free_dictionary(payload_dictionary* dictionary)
+{
+  ZSTD_freeCDict(dictionary->cdict);
+  ZSTD_freeDDict(dictionary->ddict);
+  mosquitto_property_free_all(&dictionary->props);
+}
+
+int payload_codec_init(payload_codec* codec, int level)
+{
+  memset(codec, 0, sizeof(*codec));
+  codec->level = level;
+  codec->cctx = ZSTD_createCCtx();
+  codec->dctx = ZSTD_createDCtx();
+  if (codec->cctx == NULL || codec->dctx == NULL)
+  {
+    LOG_ERROR("Failed to create the zstd contexts");
+    payload_codec_destroy(codec);
+    return -1;
+  }
+  /* The dictionary id is in the content type, and the receiver has the buffer the payload is
+   * decompressed into, so neither is repeated in the frame. */
+  if (ZSTD_isError(ZSTD_CCtx_setParameter(codec->cctx, ZSTD_c_dictIDFlag, 0))
+      || ZSTD_isError(ZSTD_CCtx_setParameter(codec->cctx, ZSTD_c_contentSizeFlag, 0)))
+  {
+    LOG_ERROR("Failed to set the zstd frame parameters");
+    payload_codec_destroy(codec);
+    return -1;
+  }
+  return 0;
+}
+
+int payload_codec_init_from_env(payload_codec* codec)
+{
+  char* directory = NULL;
+  int level;
+  int dictionary_id;
+
+  if (!set_char_connection_setting(&directory, "COMPRESSION_DICTIONARY_DIR", false)
+      || directory == NULL)
+  {
+    return 0;
+  }
+  if (!set_int_connection_setting(&level, "COMPRESSION_LEVEL", PAYLOAD_COMPRESSION_DEFAULT_LEVEL)
+      || !set_int_connection_setting(&dictionary_id, "COMPRESSION_DICTIONARY_ID", 0)
+      || level < ZSTD_minCLevel() || level > ZSTD_maxCLevel() || dictionary_id < 0)
+  {
+    LOG_ERROR("Invalid compression settings");
+    return -1;
+  }
+
+  if (payload_codec_init(codec, level) != 0)
+  {
+    return -1;
+  }
+  if (payload_codec_load_dictionaries(codec, directory) <= 0)
+  {
+    LOG_ERROR("No compression dictionary in %s", directory);
+    payload_codec_destroy(codec);
+    return -1;
+  }
+  if (dictionary_id != 0 && payload_codec_use_dictionary(codec, (uint32_t)dictionary_id) != 0)
+  {
+    LOG_ERROR("No compression dictionary %d in %s", dictionary_id, directory);
+    payload_codec_destroy(codec);
+    return -1;
+  }
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Compressing payloads with dictionary %" PRIu32 " (%" PRIu32 " dictionaries loaded)",
+      codec->current->id,
+      codec->dictionary_count);
+  return 1;
+}
+
+int payload_codec_add_dictionary(payload_codec* codec, const void* dictionary, size_t size)
+{
+  payload_dictionary* added;
+  char content_type[CONTENT_TYPE_LENGTH];
+  uint32_t id = ZSTD_getDictID_fromDict(dictionary, size);
+
+  /* A raw content dictionary has no id to signal it with. */
+  if (id == 0)
+  {
+    LOG_ERROR("Compression dictionary has no id");
+    return -1;
+  }
+  if (_find_dictionary(codec, id) != NULL)
+  {
+    LOG_ERROR("Duplicate compression dictionary %" PRIu32, id);
+    return -1;
+  }
+  if (codec->dictionary_count == PAYLOAD_COMPRESSION_MAX_DICTIONARIES)
+  {
+    LOG_ERROR("Too many compression dictionaries");
+    return -1;
+  }
+
+  added = &codec->dictionaries[codec->dictionary_count];
+  memset(added, 0, sizeof(*added));
+  added->id = id;
+  added->cdict = ZSTD_createCDict(dictionary, size, codec->level);
+  added->ddict = ZSTD_createDDict(dictionary, size);
+  snprintf(
+      content_type, sizeof(content_type), PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX "%" PRIu32, id);
+  if (added->cdict == NULL || added->ddict == NULL
+      || mosquitto_property_add_string(&added->props, MQTT_PROP_CONTENT_TYPE, content_type)
+          != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to load compression dictionary %" PRIu32, id);
+    _free_dictionary(added);
+    return -1;
+  }
+
+  codec->dictionary_count++;
+  /* Dictionaries are versioned by id: a newer dictionary replaces the older ones for compression,
+   * while payloads compressed with the older ones can still be decompressed. */
+  if (codec->current == NULL || id > codec->current->id)
+  {
+    codec->current = added;
+  }
+  return 0;
+}
+
+static int _load_dictionary_file(payload_codec* codec, const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  void* data = NULL;
+  long size;
+  int result = -1;
+
+  if (file == NULL)
+  {
+    LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+    return -1;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0
+      && (data = malloc((size_t)size)) != NULL
+      && fread(data, 1, (size_t)size, file) == (size_t)size)
+  {
+    result = payload_codec_add_dictionary(codec, data, (size_t)size);
+  }
+  else
+  {
+    LOG_ERROR("Failed to read %s", path);
+  }
+
+  /* The zstd dictionaries keep their own copy. */
+  free(data);
+  fclose(file);
+  return result;
+}
+
+int payload_codec_load_dictionaries(payload_codec* codec, const char* directory)
+{
+  size_t extension_length = strlen(PAYLOAD_COMPRESSION_DICTIONARY_EXTENSION);
+  DIR* dir = opendir(directory);
+  struct dirent* entry;
+  char path[4096];
+  int loaded = 0;
+
+  if (dir == NULL)
+  {
+    LOG_ERROR("Failed to open %s: %s", directory, strerror(errno));
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    size_t length = strlen(entry->d_name);
+    if (length <= extension_length
+        || strcmp(
+               entry->d_name + length - extension_length, PAYLOAD_COMPRESSION_DICTIONARY_EXTENSION)
+            != 0)
+    {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+    if (_load_dictionary_file(codec, path) != 0)
+    {
+      loaded = -1;
+      break;
+    }
+    loaded++;
+  }
+  closedir(dir);
+  return loaded;
+}
+
+bool payload_codec_compress(
+    payload_codec* codec,
+    const void* payload,
+    size_t length,
+    void* buffer,
+    size_t capacity,
+    size_t* compressed_length,
+    const mosquitto_property** props)
+{
+  size_t result;
+
+  if (codec->current == NULL || length < 2
+      || ZSTD_isError(ZSTD_CCtx_refCDict(codec->cctx, codec->current->cdict)))
+  {
+    codec->sent_as_is++;
+    return false;
+  }
+  /* Capping the output below the payload length stops compression as soon as it is no gain. */
+  result = ZSTD_compress2(
+      codec->cctx, buffer, capacity < length ? capacity : length - 1, payload, length);
+  if (ZSTD_isError(result))
+  {
+    codec->sent_as_is++;
+    return false;
+  }
+
+  codec->compressed++;
+  codec->compressed_input_bytes += length;
+  codec->compressed_output_bytes += result;
+  *compressed_length = result;
+  *props = codec->current->props;
+  return true;
+}
+
+int payload_codec_decompress(
+    payload_codec* codec,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* buffer,
+    size_t capacity,
+    size_t* length)
+{
+  payload_dictionary* dictionary;
+  uint32_t id = 0;
+  int parsed;
+  size_t result;
+
+  if ((parsed = _read_content_type(props, &id)) == 0)
+  {
+    return 0;
+  }
+
+  if (parsed < 0 || (dictionary = _find_dictionary(codec, id)) == NULL)
+  {
+    LOG_ERROR("Unknown compression dictionary for message on %s", message->topic);
+    codec->decompress_failures++;
+    return -1;
+  }
+  result = ZSTD_decompress_usingDDict(
+      codec->dctx,
+      buffer,
+      capacity,
+      message->payload,
+      message->payloadlen > 0 ? (size_t)message->payloadlen : 0,
+      dictionary->ddict);
+  if (ZSTD_isError(result))
+  {
+    LOG_ERROR(
+        "Failed to decompress message on %s: %s", message->topic, ZSTD_getErrorName(result));
+    codec->decompress_failures++;
+    return -1;
+  }
+
+  codec->decompressed++;
+  *length = result;
+  return 1;
+}
+
+void payload_codec_destroy(payload_codec* codec)
+{
+  for (uint32_t i = 0; i < codec->dictionary_count; i++)
+  {
+    _free_dictionary(&codec->dictionaries[i]);
+  }
+  ZSTD_freeCCtx(codec->cctx);
+  ZSTD_freeDCtx(codec->dctx);
+  memset(codec, 0, sizeof(*codec));
+}
+
+#else
+
+/*
+ * Built without PAYLOAD_COMPRESSION, when libzstd wasn't found: payloads are published as is and
+ * compressed payloads can't be decompressed.
+ */
+
+int payload_codec_init(payload_codec* codec, int level)
+{
+  memset(codec, 0, sizeof(*codec));
+  codec->level = level;
+  return 0;
+}
+
+int payload_codec_init_from_env(payload_codec* codec)
+{
+  char* directory = NULL;
+
+  if (set_char_connection_setting(&directory, "COMPRESSION_DICTIONARY_DIR", false)
+      && directory != NULL)
+  {
+    LOG_WARNING("COMPRESSION_DICTIONARY_DIR is ignored, built without PAYLOAD_COMPRESSION");
+  }
+  return 0;
+}
+
+int payload_codec_add_dictionary(payload_codec* codec, const void* dictionary, size_t size)
+{
+  LOG_ERROR("Compression dictionaries need PAYLOAD_COMPRESSION");
+  return -1;
+}
+
+int payload_codec_load_dictionaries(payload_codec* codec, const char* directory)
+{
+  LOG_ERROR("Compression dictionaries need PAYLOAD_COMPRESSION");
+  return -1;
+}
+
+bool payload_codec_compress(
+    payload_codec* codec,
+    const void* payload,
+    size_t length,
+    void* buffer,
+    size_t capacity,
+    size_t* compressed_length,
+    const mosquitto_property** props)
+{
+  codec->sent_as_is++;
+  return false;
+}
+
+int payload_codec_decompress(
+    payload_codec* codec,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* buffer,
+    size_t capacity,
+    size_t* length)
+{
+  uint32_t id;
+
+  if (_read_content_type(props, &id) == 0)
+  {
+    return 0;
+  }
+  LOG_ERROR("Can't decompress message on %s without PAYLOAD_COMPRESSION", message->topic);
+  codec->decompress_failures++;
+  return -1;
+}
+
+void payload_codec_destroy(payload_codec* codec) { memset(codec, 0, sizeof(*codec)); }
+
+#endif /* PAYLOAD_COMPRESSION */
@@ -0,0 +1,182 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PAYLOAD_COMPRESSION_H
+#define PAYLOAD_COMPRESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef PAYLOAD_COMPRESSION
+#include <zstd.h>
+#else
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
+#endif
+
+#include "mosquitto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Content type of a payload compressed with the dictionary <id>, ex. zstd:3. */
+#define PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX "zstd:"
+#define PAYLOAD_COMPRESSION_DICTIONARY_EXTENSION ".zdict"
+#define PAYLOAD_COMPRESSION_MAX_DICTIONARIES 8
+#define PAYLOAD_COMPRESSION_DEFAULT_LEVEL 3
+#define PAYLOAD_COMPRESSION_DEFAULT_DICTIONARY_SIZE (8 * 1024)
+
+/*
+ * zstd compression of small payloads with trained dictionaries. Generic compression does little
+ * for payloads of a few dozen bytes like GeoJSON points, while a dictionary trained on recorded
+ * payloads holds what they have in common, so only what differs is sent.
+ *
+ * Dictionaries are versioned by their zstd dictionary id, and stored in a directory as
+ * <id>.zdict. A compressed payload has the content type zstd:<id>, so a receiver that loaded the
+ * dictionaries of the directory decompresses it whatever the dictionary it was compressed with,
+ * and a new dictionary is rolled out to the receivers before the publishers use it. Payloads are
+ * only compressed when it makes them smaller, and sent as is otherwise.
+ *
+ * A codec isn't thread-safe: every thread compressing or decompressing needs its own.
+ *
+ * zstd is only used when PAYLOAD_COMPRESSION is defined, which the build does when it finds
+ * libzstd. Without it, the codec has no dictionaries: payloads are published as is, and compressed
+ * payloads fail to decompress.
+ */
+typedef struct payload_dictionary
+{
+  uint32_t id;
+  ZSTD_CDict* cdict;
+  ZSTD_DDict* ddict;
+  /* Content type of the payloads compressed with this dictionary, built once for all of them. */
+  mosquitto_property* props;
+} payload_dictionary;
+
+typedef struct payload_codec
+{
+  ZSTD_CCtx* cctx;
+  ZSTD_DCtx* dctx;
+  int level;
+  payload_dictionary dictionaries[PAYLOAD_COMPRESSION_MAX_DICTIONARIES];
+  uint32_t dictionary_count;
+  /* Dictionary payloads are compressed with, the one with the highest id by default. */
+  payload_dictionary* current;
+  uint64_t compressed;
+  uint64_t sent_as_is;
+  uint64_t compressed_input_bytes;
+  uint64_t compressed_output_bytes;
+  uint64_t decompressed;
+  uint64_t decompress_failures;
+} payload_codec;
+
+/**
+ * @brief Initializes a codec without dictionaries.
+ *
+ * @param codec The payload_codec to initialize.
+ * @param level The zstd compression level the dictionaries are loaded with.
+ * @return int 0 on success, -1 on failure. On success the codec must be destroyed with
+ * payload_codec_destroy().
+ */
+int payload_codec_init(payload_codec* codec, int level);
+
+/**
+ * @brief Initializes a codec with the dictionaries of the COMPRESSION_DICTIONARY_DIR environment
+ * variable, if it is set, compressing with COMPRESSION_LEVEL and the dictionary
+ * COMPRESSION_DICTIONARY_ID if set. Must be called after the environment has been loaded, ex. by
+ * mqtt_client_load_settings().
+ *
+ * @param codec The payload_codec to initialize.
+ * @return int 1 if the codec was initialized, 0 if COMPRESSION_DICTIONARY_DIR is not set, -1 on
+ * failure.
+ */
+int payload_codec_init_from_env(payload_codec* codec);
+
+/**
+ * @brief Adds a dictionary trained by zstd, ex. with ZDICT_trainFromBuffer().
+ *
+ * @param codec The payload_codec.
+ * @param dictionary The dictionary.
+ * @param size The size of the dictionary.
+ * @return int 0 on success, -1 if the dictionary is invalid, has the id of another dictionary or
+ * there are too many dictionaries.
+ */
+int payload_codec_add_dictionary(payload_codec* codec, const void* dictionary, size_t size);
+
+/**
+ * @brief Adds the dictionaries of the <id>.zdict files of a directory.
+ *
+ * @param codec The payload_codec.
+ * @param directory The directory of the dictionaries.
+ * @return int The number of dictionaries added, -1 on failure.
+ */
+int payload_codec_load_dictionaries(payload_codec* codec, const char* directory);
+
+/**
+ * @brief Selects the dictionary payloads are compressed with.
+ *
+ * @param codec The payload_codec.
+ * @param id The id of a dictionary added to the codec.
+ * @return int 0 on success, -1 if the codec has no dictionary with this id.
+ */
+int payload_codec_use_dictionary(payload_codec* codec, uint32_t id);
+
+/**
+ * @brief Compresses a payload to publish with the current dictionary. Doesn't allocate memory
+ * once the codec has compressed a first payload.
+ *
+ * @param codec The payload_codec.
+ * @param payload The payload to compress.
+ * @param length The length of payload.
+ * @param buffer Receives the compressed payload.
+ * @param capacity The size of buffer.
+ * @param compressed_length Receives the length of the compressed payload.
+ * @param props Receives the properties to publish the compressed payload with, owned by the codec.
+ * @return bool true if the payload was compressed, false if it must be published as is: there is
+ * no dictionary, or compressing it doesn't make it smaller.
+ */
+bool payload_codec_compress(
+    payload_codec* codec,
+    const void* payload,
+    size_t length,
+    void* buffer,
+    size_t capacity,
+    size_t* compressed_length,
+    const mosquitto_property** props);
+
+/**
+ * @brief Decompresses the payload of a received message if its content type says it is
+ * compressed.
+ *
+ * @param codec The payload_codec.
+ * @param message The received message.
+ * @param props The properties of the received message.
+ * @param buffer Receives the decompressed payload.
+ * @param capacity The size of buffer.
+ * @param length Receives the length of the decompressed payload.
+ * @return int 1 if the payload was decompressed into buffer, 0 if it isn't compressed, -1 if it
+ * can't be decompressed, ex. its dictionary is unknown.
+ */
+int payload_codec_decompress(
+    payload_codec* codec,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* buffer,
+    size_t capacity,
+    size_t* length);
+
+/**
+ * @brief Frees the dictionaries and contexts of a codec.
+ *
+ * @param codec The payload_codec to destroy.
+ */
+void payload_codec_destroy(payload_codec* codec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAYLOAD_COMPRESSION_H */
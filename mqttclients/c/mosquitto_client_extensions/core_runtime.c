@@ -0,0 +1,646 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/* For CPU affinity. */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core_runtime.h"
+#include "extensions_internal.h"
+#include "logging.h"
+#include "mqtt_setup.h"
+
+#define CACHE_LINE_SIZE 64
+#define POLL_TIMEOUT_MS 1000
+#define RECONNECT_DELAY_NS 1000000000LL
+#define MIN_MAILBOX_CAPACITY 2
+
+typedef struct shard_start
+{
+  core_runtime* runtime;
+  uint32_t index;
+  int cpu;
+} shard_start;
+
+static __thread core_shard* current_shard = NULL;
+
+static int _mailbox_init(core_mailbox* mailbox, uint32_t capacity)
+{
+  uint64_t size = MIN_MAILBOX_CAPACITY;
+
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  if (posix_memalign((void**)&mailbox->slots, CACHE_LINE_SIZE, size * sizeof(core_mailbox_slot))
+      != 0)
+  {
+    mailbox->slots = NULL;
+    return -1;
+  }
+  for (uint64_t i = 0; i < size; i++)
+  {
+    mailbox->slots[i].sequence = i;
+  }
+  mailbox->mask = size - 1;
+  mailbox->enqueue_position = 0;
+  mailbox->dequeue_position = 0;
+  return 0;
+}
+
+static int _mailbox_push(
+    core_mailbox* mailbox,
+    core_task_function function,
+    const void* data,
+    size_t size)
+{
+  uint64_t position = __atomic_load_n(&mailbox->enqueue_position, __ATOMIC_RELAXED);
+  core_mailbox_slot* slot;
+
+  for (;;)
+  {
+    int64_t difference;
+
+    slot = &mailbox->slots[position & mailbox->mask];
+    difference = (int64_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+    if (difference == 0)
+    {
+      /* The slot is free for this position, claim it. On failure position is reloaded. */
+      if (__atomic_compare_exchange_n(
+              &mailbox->enqueue_position,
+              &position,
+              position + 1,
+              true,
+              __ATOMIC_RELAXED,
+              __ATOMIC_RELAXED))
+      {
+        break;
+      }
+    }
+    else if (difference < 0)
+    {
+      /* The slot still holds the task of the previous lap, the mailbox is full. */
+      return -1;
+    }
+    else
+    {
+      position = __atomic_load_n(&mailbox->enqueue_position, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->function = function;
+  if (size > 0)
+  {
+    memcpy(slot->data, data, size);
+  }
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static bool _mailbox_pending(core_mailbox* mailbox)
+{
+  core_mailbox_slot* slot = &mailbox->slots[mailbox->dequeue_position & mailbox->mask];
+  return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == mailbox->dequeue_position + 1;
+}
+
+/* Runs at most one lap of tasks, so a shard sending tasks to itself does not starve its
+ * connection. */
+static void _mailbox_drain(core_shard* shard)
+{
+  core_mailbox* mailbox = &shard->mailbox;
+  uint64_t run = 0;
+
+  while (run <= mailbox->mask && _mailbox_pending(mailbox))
+  {
+    uint64_t position = mailbox->dequeue_position;
+    core_mailbox_slot* slot = &mailbox->slots[position & mailbox->mask];
+
+    slot->function(shard, slot->data);
+    memory_arena_reset(&shard->arena);
+    __atomic_store_n(&slot->sequence, position + mailbox->mask + 1, __ATOMIC_RELEASE);
+    mailbox->dequeue_position = position + 1;
+    run++;
+  }
+  if (run > 0)
+  {
+    stat_add(&shard->stats.tasks_run, run);
+  }
+}
+
+static void _on_message(
+    struct mosquitto* mosq,
+    void* obj,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  core_shard* shard = current_shard;
+  int64_t start = monotonic_ns();
+
+  shard->runtime->options.handle_message(mosq, message, props);
+  memory_arena_reset(&shard->arena);
+
+  stat_add(&shard->stats.messages, 1);
+  stat_add(&shard->stats.message_bytes, (uint64_t)message->payloadlen);
+  stat_add(&shard->stats.handler_ns, (uint64_t)(monotonic_ns() - start));
+}
+
+static int _shard_connect(core_shard* shard)
+{
+  core_runtime* runtime = shard->runtime;
+  mqtt_client_connection_settings connection_settings = runtime->connection_settings;
+  int rc;
+
+  /* Every connection of the runtime needs its own client id. */
+  if (connection_settings.client_id != NULL)
+  {
+    size_t length = strlen(connection_settings.client_id) + 12;
+    if ((shard->client_id = malloc(length)) == NULL)
+    {
+      LOG_ERROR("Out of memory.");
+      return -1;
+    }
+    snprintf(shard->client_id, length, "%s-%u", connection_settings.client_id, shard->index);
+    connection_settings.client_id = shard->client_id;
+  }
+
+  shard->obj.mqtt_version = runtime->options.mqtt_version;
+  shard->obj.handle_message = runtime->options.handle_message;
+  if ((shard->mosq = mqtt_client_new(
+           runtime->options.publish,
+           &connection_settings,
+           runtime->options.on_connect_with_subscribe,
+           &shard->obj))
+      == NULL)
+  {
+    return -1;
+  }
+  if (runtime->options.handle_message != NULL)
+  {
+    mosquitto_message_v5_callback_set(shard->mosq, _on_message);
+  }
+
+  if ((rc = mosquitto_connect_bind_v5(
+           shard->mosq,
+           shard->obj.hostname,
+           shard->obj.tcp_port,
+           shard->obj.keep_alive_in_seconds,
+           NULL,
+           NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Shard %u failed to connect: %s", shard->index, mosquitto_strerror(rc));
+    return -1;
+  }
+  shard->connected = true;
+  return 0;
+}
+
+static void _shard_reconnect(core_shard* shard)
+{
+  int rc;
+
+  if (monotonic_ns() < shard->reconnect_at_ns)
+  {
+    return;
+  }
+  if ((rc = mosquitto_reconnect(shard->mosq)) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Shard %u failed to reconnect: %s", shard->index, mosquitto_strerror(rc));
+    shard->reconnect_at_ns = monotonic_ns() + RECONNECT_DELAY_NS;
+    return;
+  }
+  shard->connected = true;
+  stat_add(&shard->stats.reconnects, 1);
+}
+
+/* Event loop of a shard: runs the tasks of the mailbox, then waits for the connection or the
+ * mailbox, and hands the connection to mosquitto when it is ready. */
+static void _shard_run(core_shard* shard)
+{
+  core_runtime* runtime = shard->runtime;
+
+  while (__atomic_load_n(&runtime->running, __ATOMIC_RELAXED) && keep_running)
+  {
+    struct pollfd fds[2];
+    nfds_t fd_count = 1;
+    int timeout = POLL_TIMEOUT_MS;
+
+    _mailbox_drain(shard);
+
+    if (shard->mosq != NULL && !shard->connected)
+    {
+      _shard_reconnect(shard);
+    }
+
+    fds[0].fd = shard->wake_fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    if (shard->mosq != NULL && shard->connected)
+    {
+      fds[1].fd = mosquitto_socket(shard->mosq);
+      fds[1].events = POLLIN | (mosquitto_want_write(shard->mosq) ? POLLOUT : 0);
+      fds[1].revents = 0;
+      fd_count = 2;
+    }
+
+    /* Senders only write to wake_fd when the shard is sleeping, so check the mailbox once more
+     * after announcing it. */
+    __atomic_store_n(&shard->sleeping, true, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (_mailbox_pending(&shard->mailbox))
+    {
+      timeout = 0;
+    }
+    if (poll(fds, fd_count, timeout) < 0 && errno != EINTR)
+    {
+      LOG_ERROR("Shard %u failed to poll: %s", shard->index, strerror(errno));
+    }
+    __atomic_store_n(&shard->sleeping, false, __ATOMIC_RELAXED);
+
+    if (fds[0].revents & POLLIN)
+    {
+      uint64_t wakes;
+      if (read(shard->wake_fd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN)
+      {
+        LOG_ERROR("Shard %u failed to read its wake event: %s", shard->index, strerror(errno));
+      }
+    }
+
+    if (fd_count == 2)
+    {
+      int rc = MOSQ_ERR_SUCCESS;
+
+      if (fds[1].revents & (POLLIN | POLLERR | POLLHUP))
+      {
+        rc = mosquitto_loop_read(shard->mosq, 1);
+      }
+      if (rc == MOSQ_ERR_SUCCESS && (fds[1].revents & POLLOUT))
+      {
+        rc = mosquitto_loop_write(shard->mosq, 1);
+      }
+      if (rc == MOSQ_ERR_SUCCESS)
+      {
+        rc = mosquitto_loop_misc(shard->mosq);
+      }
+      if (rc != MOSQ_ERR_SUCCESS)
+      {
+        LOG_ERROR("Shard %u lost its connection: %s", shard->index, mosquitto_strerror(rc));
+        shard->connected = false;
+        shard->reconnect_at_ns = monotonic_ns() + RECONNECT_DELAY_NS;
+      }
+    }
+  }
+}
+
+static core_shard* _shard_create(core_runtime* runtime, uint32_t index, int cpu)
+{
+  core_shard* shard;
+
+  if (posix_memalign((void**)&shard, CACHE_LINE_SIZE, sizeof(core_shard)) != 0)
+  {
+    return NULL;
+  }
+  memset(shard, 0, sizeof(core_shard));
+  shard->runtime = runtime;
+  shard->index = index;
+  shard->cpu = cpu;
+  shard->wake_fd = -1;
+
+  if (_mailbox_init(&shard->mailbox, runtime->options.mailbox_capacity) != 0
+      || memory_arena_init(&shard->arena, runtime->options.arena_size) != 0
+      || (shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    LOG_ERROR("Failed to allocate shard %u", index);
+    return shard;
+  }
+  /* Touch the arena from this thread, so its pages are placed on the node of the core. */
+  memset(shard->arena.buffer, 0, shard->arena.capacity);
+  return shard;
+}
+
+static void* _shard_thread(void* argument)
+{
+  shard_start* start = argument;
+  core_runtime* runtime = start->runtime;
+  uint32_t index = start->index;
+  int cpu = start->cpu;
+  core_shard* shard;
+  bool initialized = false;
+  bool failed = false;
+  bool running;
+
+  if (cpu >= 0)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+      LOG_WARNING("Shard %u could not be pinned to CPU %d", index, cpu);
+      cpu = -1;
+    }
+  }
+
+  if ((shard = _shard_create(runtime, index, cpu)) == NULL || shard->wake_fd < 0)
+  {
+    failed = true;
+  }
+  else
+  {
+    current_shard = shard;
+    if (runtime->options.shard_init != NULL && runtime->options.shard_init(shard) != 0)
+    {
+      LOG_ERROR("Failed to initialize shard %u", index);
+      failed = true;
+    }
+    else
+    {
+      initialized = true;
+      failed = runtime->options.connect && _shard_connect(shard) != 0;
+    }
+  }
+
+  pthread_mutex_lock(&runtime->lock);
+  runtime->shards[index] = shard;
+  runtime->failed |= failed;
+  runtime->ready_count++;
+  pthread_cond_broadcast(&runtime->changed);
+  while (!runtime->released)
+  {
+    pthread_cond_wait(&runtime->changed, &runtime->lock);
+  }
+  running = __atomic_load_n(&runtime->running, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&runtime->lock);
+
+  if (running)
+  {
+    _shard_run(shard);
+  }
+
+  if (shard != NULL)
+  {
+    if (shard->mosq != NULL)
+    {
+      if (shard->connected)
+      {
+        mosquitto_disconnect_v5(shard->mosq, 0, NULL);
+        mosquitto_loop_write(shard->mosq, 1);
+      }
+      mosquitto_destroy(shard->mosq);
+      shard->mosq = NULL;
+    }
+    if (runtime->options.shard_destroy != NULL && initialized)
+    {
+      runtime->options.shard_destroy(shard);
+    }
+    memory_arena_destroy(&shard->arena);
+    current_shard = NULL;
+  }
+  return NULL;
+}
+
+/* Shard i runs on the i-th CPU the process may run on, so the runtime follows taskset and cgroup
+ * limits. */
+static int _allowed_cpus(int** cpus)
+{
+  cpu_set_t allowed;
+  int count = 0;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0
+      || (*cpus = malloc(CPU_COUNT(&allowed) * sizeof(int))) == NULL)
+  {
+    *cpus = NULL;
+    return 0;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE && count < CPU_COUNT(&allowed); cpu++)
+  {
+    if (CPU_ISSET(cpu, &allowed))
+    {
+      (*cpus)[count++] = cpu;
+    }
+  }
+  return count;
+}
+
+int core_runtime_start(core_runtime* runtime, const core_runtime_options* options)
+{
+  shard_start* starts;
+  int* cpus = NULL;
+  int cpu_count;
+
+  memset(runtime, 0, sizeof(core_runtime));
+  runtime->options = *options;
+  if (runtime->options.mailbox_capacity == 0)
+  {
+    runtime->options.mailbox_capacity = CORE_RUNTIME_DEFAULT_MAILBOX_CAPACITY;
+  }
+  if (runtime->options.arena_size == 0)
+  {
+    runtime->options.arena_size = CORE_RUNTIME_DEFAULT_ARENA_SIZE;
+  }
+
+  cpu_count = _allowed_cpus(&cpus);
+  runtime->core_count = options->core_count > 0 ? options->core_count : (uint32_t)cpu_count;
+  if (runtime->core_count == 0)
+  {
+    LOG_ERROR("No CPU to run the shards on");
+    free(cpus);
+    return -1;
+  }
+  if (options->core_count > (uint32_t)cpu_count)
+  {
+    LOG_WARNING(
+        "%u shards for %d CPUs, some CPUs run more than one shard", options->core_count, cpu_count);
+  }
+
+  if (runtime->options.connect)
+  {
+    if (options->connection_settings == NULL)
+    {
+      LOG_ERROR("Connection settings are required to connect the shards");
+      free(cpus);
+      return -1;
+    }
+    runtime->connection_settings = *options->connection_settings;
+    /* Required before calling other mosquitto functions */
+    if (mosquitto_lib_init() != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failed to initialize mosquitto");
+      free(cpus);
+      return -1;
+    }
+  }
+
+  runtime->shards = calloc(runtime->core_count, sizeof(core_shard*));
+  runtime->threads = calloc(runtime->core_count, sizeof(pthread_t));
+  starts = calloc(runtime->core_count, sizeof(shard_start));
+  if (runtime->shards == NULL || runtime->threads == NULL || starts == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(runtime->shards);
+    free(runtime->threads);
+    free(starts);
+    free(cpus);
+    return -1;
+  }
+  pthread_mutex_init(&runtime->lock, NULL);
+  pthread_cond_init(&runtime->changed, NULL);
+
+  for (uint32_t i = 0; i < runtime->core_count; i++)
+  {
+    starts[i].runtime = runtime;
+    starts[i].index = i;
+    starts[i].cpu = cpu_count > 0 ? cpus[i % cpu_count] : -1;
+    if (pthread_create(&runtime->threads[i], NULL, _shard_thread, &starts[i]) != 0)
+    {
+      LOG_ERROR("Failed to start the thread of shard %u", i);
+      break;
+    }
+    runtime->thread_count++;
+  }
+
+  /* Run the shards only once all of them are ready, so tasks are never sent to a shard that is
+   * still starting. */
+  pthread_mutex_lock(&runtime->lock);
+  while (runtime->ready_count < runtime->thread_count)
+  {
+    pthread_cond_wait(&runtime->changed, &runtime->lock);
+  }
+  runtime->failed |= runtime->thread_count < runtime->core_count;
+  runtime->running = !runtime->failed;
+  runtime->released = true;
+  pthread_cond_broadcast(&runtime->changed);
+  pthread_mutex_unlock(&runtime->lock);
+
+  free(starts);
+  free(cpus);
+  if (runtime->failed)
+  {
+    core_runtime_stop(runtime);
+    return -1;
+  }
+  LOG_INFO(APP_LOG_TAG, "Started %u shards", runtime->core_count);
+  return 0;
+}
+
+void core_runtime_stop(core_runtime* runtime)
+{
+  if (runtime->shards == NULL)
+  {
+    return;
+  }
+
+  __atomic_store_n(&runtime->running, false, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i < runtime->thread_count; i++)
+  {
+    core_shard* shard = runtime->shards[i];
+    uint64_t wake = 1;
+    if (shard != NULL && shard->wake_fd >= 0
+        && write(shard->wake_fd, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+    {
+      LOG_ERROR("Failed to wake shard %u: %s", i, strerror(errno));
+    }
+  }
+  for (uint32_t i = 0; i < runtime->thread_count; i++)
+  {
+    pthread_join(runtime->threads[i], NULL);
+  }
+
+  /* Other shards may send to a mailbox until every shard stopped. */
+  for (uint32_t i = 0; i < runtime->core_count; i++)
+  {
+    core_shard* shard = runtime->shards[i];
+    if (shard != NULL)
+    {
+      if (shard->wake_fd >= 0)
+      {
+        close(shard->wake_fd);
+      }
+      free(shard->mailbox.slots);
+      free(shard->client_id);
+      free(shard);
+    }
+  }
+  pthread_cond_destroy(&runtime->changed);
+  pthread_mutex_destroy(&runtime->lock);
+  free(runtime->shards);
+  free(runtime->threads);
+  runtime->shards = NULL;
+  runtime->threads = NULL;
+}
+
+core_shard* core_runtime_current(void) { return current_shard; }
+
+int core_runtime_send(
+    core_runtime* runtime,
+    uint32_t shard,
+    core_task_function function,
+    const void* data,
+    size_t size)
+{
+  core_shard* sender = current_shard;
+  core_shard* target;
+
+  if (shard >= runtime->core_count || function == NULL || size > CORE_TASK_DATA_SIZE
+      || (size > 0 && data == NULL))
+  {
+    return -1;
+  }
+  target = runtime->shards[shard];
+
+  if (_mailbox_push(&target->mailbox, function, data, size) != 0)
+  {
+    if (sender != NULL)
+    {
+      stat_add(&sender->stats.mailbox_full, 1);
+    }
+    return -1;
+  }
+  if (sender != NULL)
+  {
+    stat_add(&sender->stats.tasks_sent, 1);
+  }
+
+  /* Pairs with the fence of the target between setting sleeping and checking its mailbox. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&target->sleeping, __ATOMIC_RELAXED))
+  {
+    uint64_t wake = 1;
+    if (write(target->wake_fd, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+    {
+      LOG_ERROR("Failed to wake shard %u: %s", shard, strerror(errno));
+    }
+  }
+  return 0;
+}
+
+uint32_t core_runtime_shard_for_key(const core_runtime* runtime, const char* key)
+{
+  return (uint32_t)(fnv1a_64_string(FNV1A_64_INIT, key) % runtime->core_count);
+}
+
+void core_runtime_stats(const core_runtime* runtime, core_shard_stats* stats)
+{
+  memset(stats, 0, sizeof(core_shard_stats));
+  for (uint32_t i = 0; i < runtime->core_count; i++)
+  {
+    const core_shard_stats* shard = &runtime->shards[i]->stats;
+    stats->messages += __atomic_load_n(&shard->messages, __ATOMIC_RELAXED);
+    stats->message_bytes += __atomic_load_n(&shard->message_bytes, __ATOMIC_RELAXED);
+    stats->handler_ns += __atomic_load_n(&shard->handler_ns, __ATOMIC_RELAXED);
+    stats->tasks_sent += __atomic_load_n(&shard->tasks_sent, __ATOMIC_RELAXED);
+    stats->tasks_run += __atomic_load_n(&shard->tasks_run, __ATOMIC_RELAXED);
+    stats->mailbox_full += __atomic_load_n(&shard->mailbox_full, __ATOMIC_RELAXED);
+    stats->reconnects += __atomic_load_n(&shard->reconnects, __ATOMIC_RELAXED);
+  }
+}
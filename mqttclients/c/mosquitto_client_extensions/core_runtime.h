@@ -0,0 +1,209 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef CORE_RUNTIME_H
+#define CORE_RUNTIME_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory_arena.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CORE_RUNTIME_DEFAULT_MAILBOX_CAPACITY 4096
+#define CORE_RUNTIME_DEFAULT_ARENA_SIZE (256 * 1024)
+/* Bytes of data copied with each task, so a mailbox slot is two cache lines. */
+#define CORE_TASK_DATA_SIZE 112
+
+struct core_shard;
+
+/**
+ * @brief A function run by a shard with data sent by core_runtime_send().
+ *
+ * @param shard The shard running the task.
+ * @param data The copy of the data of the task, valid until the function returns.
+ */
+typedef void (*core_task_function)(struct core_shard* shard, void* data);
+
+typedef struct core_mailbox_slot
+{
+  uint64_t sequence;
+  core_task_function function;
+  unsigned char data[CORE_TASK_DATA_SIZE];
+} core_mailbox_slot;
+
+/* Bounded multi-producer single-consumer queue of tasks, in which every slot carries the position
+ * it can next be written or read at. */
+typedef struct core_mailbox
+{
+  core_mailbox_slot* slots;
+  uint64_t mask;
+  uint64_t enqueue_position __attribute__((aligned(64)));
+  uint64_t dequeue_position __attribute__((aligned(64)));
+} core_mailbox;
+
+/* Counters of a shard. Only its own thread writes them, any thread may read them. */
+typedef struct core_shard_stats
+{
+  uint64_t messages;
+  uint64_t message_bytes;
+  uint64_t handler_ns;
+  uint64_t tasks_sent;
+  uint64_t tasks_run;
+  uint64_t mailbox_full;
+  uint64_t reconnects;
+} core_shard_stats;
+
+/*
+ * State owned by a single core: its thread, pinned to the core, its mosquitto connection, its
+ * arena, its counters and the application state set by shard_init. Shards are allocated by their
+ * own thread once it is pinned, so the kernel places their memory on the NUMA node of the core.
+ */
+typedef struct core_shard
+{
+  struct core_runtime* runtime;
+  uint32_t index;
+  int cpu;
+  struct mosquitto* mosq;
+  mqtt_client_obj obj;
+  char* client_id;
+  /* Released after every message and task. */
+  memory_arena arena;
+  /* Set by shard_init. */
+  void* state;
+  core_mailbox mailbox;
+  int wake_fd;
+  bool sleeping;
+  bool connected;
+  int64_t reconnect_at_ns;
+  core_shard_stats stats __attribute__((aligned(64)));
+} core_shard;
+
+typedef struct core_runtime_options
+{
+  /* Number of shards, 0 for one per CPU the process may run on. */
+  uint32_t core_count;
+  /* Tasks each mailbox holds, rounded up to a power of two. */
+  uint32_t mailbox_capacity;
+  size_t arena_size;
+  /* Whether every shard opens a connection with connection_settings, ex. read by
+   * mqtt_client_load_settings(). */
+  bool connect;
+  const mqtt_client_connection_settings* connection_settings;
+  bool publish;
+  int mqtt_version;
+  /* Connect callback of every connection, which subscribes. Shared subscriptions spread the
+   * messages over the connections. */
+  void (*on_connect_with_subscribe)(
+      struct mosquitto*,
+      void*,
+      int,
+      int,
+      const mosquitto_property* props);
+  /* Called on the thread of the shard receiving the message, see core_runtime_current(). */
+  void (*handle_message)(
+      struct mosquitto*,
+      const struct mosquitto_message*,
+      const mosquitto_property*);
+  /* Called on the thread of each shard before it connects, returns 0 on success. */
+  int (*shard_init)(core_shard* shard);
+  /* Called on the thread of each shard once it stopped. */
+  void (*shard_destroy)(core_shard* shard);
+} core_runtime_options;
+
+/*
+ * Thread-per-core runtime: every shard runs its own event loop over its connection and its
+ * mailbox on a thread pinned to one core, and shares no state with the other shards. Work crosses
+ * cores only as tasks sent to the mailbox of another shard, ex. to the shard owning the state of a
+ * key (core_runtime_shard_for_key()). Statistics are kept per shard and merged on demand.
+ */
+typedef struct core_runtime
+{
+  core_runtime_options options;
+  mqtt_client_connection_settings connection_settings;
+  uint32_t core_count;
+  core_shard** shards;
+  pthread_t* threads;
+  uint32_t thread_count;
+  /* Shards wait for each other to be ready before running. */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint32_t ready_count;
+  bool released;
+  bool running;
+  bool failed;
+} core_runtime;
+
+/**
+ * @brief Starts the shards. Returns once every shard is initialized, connected if options->connect
+ * is set, and running. The core_runtime must be stopped with core_runtime_stop().
+ *
+ * @param runtime The core_runtime to start.
+ * @param options The options of the runtime, copied.
+ * @return int 0 on success, -1 if a shard failed to start, in which case every shard is stopped.
+ */
+int core_runtime_start(core_runtime* runtime, const core_runtime_options* options);
+
+/**
+ * @brief Stops the shards, waiting for their current message or task to complete. Tasks left in
+ * the mailboxes are dropped.
+ *
+ * @param runtime The core_runtime to stop.
+ */
+void core_runtime_stop(core_runtime* runtime);
+
+/**
+ * @brief Returns the shard of the calling thread.
+ *
+ * @return core_shard* The shard, or NULL if not called from a shard thread.
+ */
+core_shard* core_runtime_current(void);
+
+/**
+ * @brief Copies a task to the mailbox of a shard, waking it if it waits. Can be called from any
+ * thread.
+ *
+ * @param runtime The core_runtime of the shard.
+ * @param shard The index of the shard to run the task on.
+ * @param function The function to run.
+ * @param data The data passed to the function, copied.
+ * @param size The size of data, at most CORE_TASK_DATA_SIZE.
+ * @return int 0 on success, -1 if the mailbox is full or the arguments are invalid.
+ */
+int core_runtime_send(
+    core_runtime* runtime,
+    uint32_t shard,
+    core_task_function function,
+    const void* data,
+    size_t size);
+
+/**
+ * @brief Returns the shard owning a key, the same for a key as long as the number of shards does
+ * not change.
+ *
+ * @param runtime The core_runtime.
+ * @param key The key, ex. a vehicle id.
+ * @return uint32_t The index of the shard.
+ */
+uint32_t core_runtime_shard_for_key(const core_runtime* runtime, const char* key);
+
+/**
+ * @brief Sums the statistics of every shard. Can be called from any thread while the shards run.
+ *
+ * @param runtime The core_runtime.
+ * @param stats The core_shard_stats to write the sums to.
+ */
+void core_runtime_stats(const core_runtime* runtime, core_shard_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CORE_RUNTIME_H */
@@ -0,0 +1,30 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# SPDX-License-Identifier: MIT
+
+# Defines the mqtt_coroutines library when the compiler has C++20 coroutines: GCC 10 has them
+# behind -fcoroutines, and older compilers don't have them. Its targets link the extensions that
+# mqtt_coroutines.cpp uses themselves.
+include(CheckCXXSourceCompiles)
+
+function(check_coroutines)
+  set(CMAKE_CXX_STANDARD 20)
+  set(source "#include <coroutine>\nint main() { return std::coroutine_handle<>() ? 1 : 0; }")
+  check_cxx_source_compiles("${source}" HAVE_COROUTINES)
+  if(NOT HAVE_COROUTINES)
+    set(CMAKE_REQUIRED_FLAGS -fcoroutines)
+    check_cxx_source_compiles("${source}" HAVE_COROUTINES_WITH_FLAG)
+  endif()
+endfunction()
+
+check_coroutines()
+
+if(HAVE_COROUTINES OR HAVE_COROUTINES_WITH_FLAG)
+  add_library(mqtt_coroutines STATIC ${CMAKE_CURRENT_LIST_DIR}/mqtt_coroutines.cpp)
+  target_include_directories(mqtt_coroutines PUBLIC ${CMAKE_CURRENT_LIST_DIR})
+  target_compile_features(mqtt_coroutines PUBLIC cxx_std_20)
+  if(HAVE_COROUTINES_WITH_FLAG)
+    target_compile_options(mqtt_coroutines PUBLIC -fcoroutines)
+  endif()
+else()
+  message(WARNING "The compiler has no C++20 coroutines, building without mqtt_coroutines")
+endif()
@@ -0,0 +1,497 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+
+#include "allocation_guard.h"
+#include "logging.h"
+#include "mqtt_callbacks.h"
+#include "mqtt_coroutines.h"
+
+constexpr int POLL_TIMEOUT_MS = 1000;
+constexpr std::chrono::seconds RECONNECT_DELAY{ 1 };
+constexpr size_t CORRELATION_ID_LENGTH = sizeof(uint64_t);
+
+static std::pmr::memory_resource* frameResource = std::pmr::new_delete_resource();
+
+// Allocations of libmosquitto are permitted by the allocation guard, those of the client, ex. in
+// the callbacks, are not.
+class AllocationScope {
+public:
+    explicit AllocationScope(bool permitted) : previous_(allocation_guard_permit(permitted)) {}
+    ~AllocationScope() { allocation_guard_permit(previous_); }
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+private:
+    bool previous_;
+};
+
+void setCoroutineFrameResource(std::pmr::memory_resource* resource)
+{
+    frameResource = resource;
+}
+
+std::pmr::memory_resource* coroutineFrameResource()
+{
+    return frameResource;
+}
+
+static void encodeCorrelationId(uint64_t id, unsigned char* data)
+{
+    for (size_t i = 0; i < CORRELATION_ID_LENGTH; i++) {
+        data[i] = static_cast<unsigned char>(id >> (8 * (CORRELATION_ID_LENGTH - 1 - i)));
+    }
+}
+
+static uint64_t decodeCorrelationId(const std::string& data)
+{
+    uint64_t id = 0;
+    for (unsigned char byte : data) {
+        id = (id << 8) | byte;
+    }
+    return id;
+}
+
+bool ConnectAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    if (client_.connecting_ != nullptr) {
+        result_ = MOSQ_ERR_INVAL;
+        return false;
+    }
+    AllocationScope mosquittoAllocations(true);
+    result_ = mosquitto_connect_bind_v5(
+        client_.mosq_, client_.obj_.hostname, client_.obj_.tcp_port,
+        client_.obj_.keep_alive_in_seconds, nullptr, nullptr);
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        return false;
+    }
+    client_.connectStarted_ = true;
+    client_.connecting_ = this;
+    handle_ = handle;
+    return true;
+}
+
+int ConnectAwaitable::await_resume()
+{
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        throw MqttError("Failed to connect", result_);
+    }
+    return reasonCode_;
+}
+
+bool PublishAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    handle_ = handle;
+    client_.publishing_ = this;
+    {
+        AllocationScope mosquittoAllocations(true);
+        result_ = mosquitto_publish_v5(
+            client_.mosq_, &mid_, topic_, static_cast<int>(payload_.size()), payload_.data(), qos_,
+            retain_, props_);
+    }
+    client_.publishing_ = nullptr;
+    if (result_ != MOSQ_ERR_SUCCESS || done_) {
+        return false;
+    }
+    client_.publishes_.emplace(mid_, this);
+    return true;
+}
+
+int PublishAwaitable::await_resume()
+{
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        throw MqttError("Failed to publish", result_);
+    }
+    return reasonCode_;
+}
+
+bool SubscribeAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    {
+        AllocationScope mosquittoAllocations(true);
+        result_ = mosquitto_subscribe_v5(client_.mosq_, &mid_, topic_, qos_, 0, nullptr);
+    }
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        return false;
+    }
+    client_.subscribes_.emplace(mid_, this);
+    handle_ = handle;
+    return true;
+}
+
+int SubscribeAwaitable::await_resume()
+{
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        throw MqttError("Failed to subscribe", result_);
+    }
+    return grantedQos_;
+}
+
+bool RequestAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    unsigned char correlationData[CORRELATION_ID_LENGTH];
+    mosquitto_property* props = nullptr;
+    uint64_t id = ++client_.nextCorrelationId_;
+
+    if (client_.responseTopic_.empty()) {
+        result_ = MOSQ_ERR_INVAL;
+        return false;
+    }
+    encodeCorrelationId(id, correlationData);
+    {
+        AllocationScope mosquittoAllocations(true);
+        result_ = mosquitto_property_add_string(
+            &props, MQTT_PROP_RESPONSE_TOPIC, client_.responseTopic_.c_str());
+        if (result_ == MOSQ_ERR_SUCCESS) {
+            result_ = mosquitto_property_add_binary(
+                &props, MQTT_PROP_CORRELATION_DATA, correlationData, sizeof(correlationData));
+        }
+        // The response tells the request was delivered, so there is no PUBACK to wait for.
+        if (result_ == MOSQ_ERR_SUCCESS) {
+            result_ = mosquitto_publish_v5(
+                client_.mosq_, nullptr, topic_, static_cast<int>(payload_.size()),
+                payload_.data(), CoroutineClient::DEFAULT_QOS, false, props);
+        }
+        mosquitto_property_free_all(&props);
+    }
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        return false;
+    }
+
+    handle_ = handle;
+    client_.requests_.emplace(id, this);
+    client_.addTimer(std::chrono::steady_clock::now() + timeout_, handle, id);
+    return true;
+}
+
+std::optional<MqttMessage> RequestAwaitable::await_resume()
+{
+    if (result_ != MOSQ_ERR_SUCCESS) {
+        throw MqttError("Failed to publish the request", result_);
+    }
+    return std::move(response_);
+}
+
+void SleepAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    client_.addTimer(deadline_, handle, 0);
+}
+
+CoroutineClient::CoroutineClient(
+    const mqtt_client_connection_settings& settings,
+    int mqttVersion,
+    std::string responseTopic,
+    std::pmr::memory_resource* memory)
+    : responseTopic_(std::move(responseTopic)), flows_(memory), ready_(memory),
+      timers_(std::greater<Timer>(), std::pmr::vector<Timer>(memory)), publishes_(memory),
+      subscribes_(memory), requests_(memory)
+{
+    if (!responseTopic_.empty() && mqttVersion != MQTT_PROTOCOL_V5) {
+        throw std::invalid_argument("Requests need MQTT v5.");
+    }
+    obj_.mqtt_version = mqttVersion;
+    mosq_ = mqtt_client_new(false, &settings, nullptr, &obj_);
+    if (mosq_ == nullptr) {
+        throw std::runtime_error("Failed to create the MQTT client.");
+    }
+
+    // The callbacks get the client, and pass the obj the mqtt_client_new() callbacks expect.
+    mosquitto_user_data_set(mosq_, this);
+    mosquitto_connect_v5_callback_set(mosq_, onConnect);
+    mosquitto_publish_v5_callback_set(mosq_, onPublish);
+    mosquitto_subscribe_v5_callback_set(mosq_, onSubscribe);
+    mosquitto_message_v5_callback_set(mosq_, onMessage);
+}
+
+CoroutineClient::~CoroutineClient()
+{
+    // Destroying a flow destroys the tasks it awaits, and the awaitables they are suspended in.
+    for (std::coroutine_handle<Flow::promise_type> flow : flows_) {
+        flow.destroy();
+    }
+    flows_.clear();
+
+    AllocationScope mosquittoAllocations(true);
+    if (mosquitto_socket(mosq_) >= 0) {
+        mosquitto_disconnect_v5(mosq_, MQTT_RC_NORMAL_DISCONNECTION, nullptr);
+    }
+    mosquitto_destroy(mosq_);
+}
+
+PublishAwaitable CoroutineClient::respond(const MqttMessage& request, std::string_view payload)
+{
+    mosquitto_property* props = nullptr;
+    AllocationScope mosquittoAllocations(true);
+
+    if (!request.correlationData.empty()
+        && mosquitto_property_add_binary(
+               &props, MQTT_PROP_CORRELATION_DATA, request.correlationData.data(),
+               static_cast<uint16_t>(request.correlationData.size()))
+            != MOSQ_ERR_SUCCESS) {
+        LOG_ERROR("Failed to add the correlation data of the response");
+    }
+    return PublishAwaitable(
+        *this, request.responseTopic.c_str(), payload, DEFAULT_QOS, false, props);
+}
+
+void CoroutineClient::spawn(Task<> task)
+{
+    Flow flow = startFlow(std::move(task));
+    flows_.insert(flow.handle);
+    ready_.push_back(flow.handle);
+}
+
+CoroutineClient::Flow CoroutineClient::startFlow(Task<> task)
+{
+    try {
+        co_await task;
+    } catch (const std::exception& e) {
+        LOG_ERROR("Flow failed: %s", e.what());
+        failedFlows_++;
+    } catch (...) {
+        LOG_ERROR("Flow failed");
+        failedFlows_++;
+    }
+}
+
+void CoroutineClient::addTimer(
+    std::chrono::steady_clock::time_point deadline,
+    std::coroutine_handle<> handle,
+    uint64_t request)
+{
+    timers_.push(Timer{ deadline, ++timerSequence_, handle, request });
+}
+
+// Coroutines are resumed here rather than in the mosquitto callbacks, so they may call mosquitto
+// and complete whatever the state of the client.
+void CoroutineClient::resumeReady()
+{
+    while (!ready_.empty() && !stopped_) {
+        std::coroutine_handle<> handle = ready_.front();
+        ready_.pop_front();
+        handle.resume();
+    }
+}
+
+void CoroutineClient::fireTimers()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    while (!timers_.empty() && timers_.top().deadline <= now) {
+        Timer timer = timers_.top();
+        timers_.pop();
+        if (timer.request == 0) {
+            ready_.push_back(timer.handle);
+            continue;
+        }
+        // The timer of a request stays queued once the response arrives, and is ignored here.
+        auto found = requests_.find(timer.request);
+        if (found != requests_.end()) {
+            requests_.erase(found);
+            ready_.push_back(timer.handle);
+        }
+    }
+}
+
+int CoroutineClient::pollTimeoutMs() const
+{
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::milliseconds(POLL_TIMEOUT_MS);
+
+    if (!ready_.empty()) {
+        return 0;
+    }
+    if (!timers_.empty()) {
+        timeout = std::min(
+            timeout, std::chrono::ceil<std::chrono::milliseconds>(timers_.top().deadline - now));
+    }
+    if (connectStarted_ && mosquitto_socket(mosq_) < 0) {
+        timeout = std::min(
+            timeout, std::chrono::ceil<std::chrono::milliseconds>(reconnectAt_ - now));
+    }
+    return static_cast<int>(std::max<std::chrono::milliseconds::rep>(timeout.count(), 0));
+}
+
+// Waits for the connection or the next timer, and hands the connection to mosquitto when it is
+// ready.
+void CoroutineClient::pollOnce(int timeoutMs)
+{
+    struct pollfd fd;
+    int rc = MOSQ_ERR_SUCCESS;
+    AllocationScope mosquittoAllocations(true);
+
+    fd.fd = mosquitto_socket(mosq_);
+    if (fd.fd < 0) {
+        if (connectStarted_ && std::chrono::steady_clock::now() >= reconnectAt_) {
+            rc = mosquitto_reconnect(mosq_);
+            if (rc != MOSQ_ERR_SUCCESS) {
+                LOG_ERROR("Failed to reconnect: %s", mosquitto_strerror(rc));
+                reconnectAt_ = std::chrono::steady_clock::now() + RECONNECT_DELAY;
+            }
+        } else if (poll(nullptr, 0, timeoutMs) < 0 && errno != EINTR) {
+            LOG_ERROR("Failed to poll: %s", strerror(errno));
+        }
+        return;
+    }
+
+    fd.events = POLLIN | (mosquitto_want_write(mosq_) ? POLLOUT : 0);
+    fd.revents = 0;
+    if (poll(&fd, 1, timeoutMs) < 0 && errno != EINTR) {
+        LOG_ERROR("Failed to poll: %s", strerror(errno));
+    }
+    if (fd.revents & (POLLIN | POLLERR | POLLHUP)) {
+        rc = mosquitto_loop_read(mosq_, 1);
+    }
+    if (rc == MOSQ_ERR_SUCCESS && (fd.revents & POLLOUT)) {
+        rc = mosquitto_loop_write(mosq_, 1);
+    }
+    if (rc == MOSQ_ERR_SUCCESS) {
+        rc = mosquitto_loop_misc(mosq_);
+    }
+    if (rc != MOSQ_ERR_SUCCESS) {
+        LOG_ERROR("Lost the connection: %s", mosquitto_strerror(rc));
+        reconnectAt_ = std::chrono::steady_clock::now() + RECONNECT_DELAY;
+    }
+}
+
+void CoroutineClient::run()
+{
+    stopped_ = false;
+    while (keep_running && !stopped_) {
+        resumeReady();
+        if (flows_.empty() || stopped_) {
+            break;
+        }
+        pollOnce(pollTimeoutMs());
+        fireTimers();
+    }
+}
+
+void CoroutineClient::onConnect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reasonCode,
+    int flags,
+    const mosquitto_property* props)
+{
+    CoroutineClient* client = static_cast<CoroutineClient*>(obj);
+    AllocationScope clientAllocations(false);
+
+    on_connect(mosq, &client->obj_, reasonCode, flags, props);
+    // Subscribing on every connect keeps the responses coming after a reconnect without session.
+    if (reasonCode == 0 && !client->responseTopic_.empty()) {
+        int rc = mosquitto_subscribe_v5(
+            mosq, nullptr, client->responseTopic_.c_str(), DEFAULT_QOS, 0, nullptr);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            LOG_ERROR("Failed to subscribe to the responses: %s", mosquitto_strerror(rc));
+        }
+    }
+    if (client->connecting_ != nullptr) {
+        client->connecting_->reasonCode_ = reasonCode;
+        client->ready_.push_back(client->connecting_->handle_);
+        client->connecting_ = nullptr;
+    }
+}
+
+void CoroutineClient::onPublish(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int reasonCode,
+    const mosquitto_property* props)
+{
+    CoroutineClient* client = static_cast<CoroutineClient*>(obj);
+    AllocationScope clientAllocations(false);
+    PublishAwaitable* publish;
+    auto found = client->publishes_.find(mid);
+
+    if (found != client->publishes_.end()) {
+        publish = found->second;
+        client->publishes_.erase(found);
+        client->ready_.push_back(publish->handle_);
+    } else if (client->publishing_ != nullptr && client->publishing_->mid_ == mid) {
+        // Completed before mosquitto_publish_v5() returned: the coroutine doesn't suspend.
+        publish = client->publishing_;
+    } else {
+        return;
+    }
+    publish->reasonCode_ = reasonCode;
+    publish->done_ = true;
+}
+
+void CoroutineClient::onSubscribe(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int qosCount,
+    const int* grantedQos,
+    const mosquitto_property* props)
+{
+    CoroutineClient* client = static_cast<CoroutineClient*>(obj);
+    AllocationScope clientAllocations(false);
+    auto found = client->subscribes_.find(mid);
+
+    if (found == client->subscribes_.end()) {
+        return;
+    }
+    found->second->grantedQos_ = qosCount > 0 ? grantedQos[0] : MQTT_RC_UNSPECIFIED;
+    client->ready_.push_back(found->second->handle_);
+    client->subscribes_.erase(found);
+}
+
+void CoroutineClient::onMessage(
+    struct mosquitto* mosq,
+    void* obj,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+    CoroutineClient* client = static_cast<CoroutineClient*>(obj);
+    AllocationScope clientAllocations(false);
+    MqttMessage received;
+    char* responseTopic = nullptr;
+    void* correlationData = nullptr;
+    uint16_t correlationLength = 0;
+
+    try {
+        received.topic = message->topic;
+        if (message->payloadlen > 0) {
+            received.payload.assign(
+                static_cast<const char*>(message->payload), message->payloadlen);
+        }
+        if (mosquitto_property_read_string(props, MQTT_PROP_RESPONSE_TOPIC, &responseTopic, false)
+            != nullptr) {
+            received.responseTopic = responseTopic;
+            free(responseTopic);
+        }
+        if (mosquitto_property_read_binary(
+                props, MQTT_PROP_CORRELATION_DATA, &correlationData, &correlationLength, false)
+            != nullptr) {
+            received.correlationData.assign(static_cast<char*>(correlationData), correlationLength);
+            free(correlationData);
+        }
+
+        if (received.topic == client->responseTopic_) {
+            // A response arriving after the timeout of its request is dropped.
+            auto found = received.correlationData.size() == CORRELATION_ID_LENGTH
+                ? client->requests_.find(decodeCorrelationId(received.correlationData))
+                : client->requests_.end();
+            if (found != client->requests_.end()) {
+                found->second->response_ = std::move(received);
+                client->ready_.push_back(found->second->handle_);
+                client->requests_.erase(found);
+            }
+            return;
+        }
+        if (client->messageHandler_) {
+            client->messageHandler_(std::move(received));
+        }
+    } catch (const std::exception& e) {
+        // Exceptions can't go through mosquitto.
+        LOG_ERROR("Failed to handle the message on %s: %s", message->topic, e.what());
+    }
+}
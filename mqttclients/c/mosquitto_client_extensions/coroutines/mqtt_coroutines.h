@@ -0,0 +1,460 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_COROUTINES_H
+#define MQTT_COROUTINES_H
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory_resource>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+// C++20 coroutines over a mosquitto client. A CoroutineClient runs its own event loop on the
+// thread calling run(): it polls the socket of the client, fires the timers, and resumes the
+// coroutines whose PUBACK, SUBACK, response or timer has arrived. Any number of flows, ex.
+// thousands of concurrent requests, run on that single thread, each written as straight-line code:
+//
+//     Task<> flow(CoroutineClient& client)
+//     {
+//         co_await client.connect();
+//         int reasonCode = co_await client.publish("devices/rasp", "hello");
+//         std::optional<MqttMessage> response = co_await client.request("vehicles/x/unlock", "");
+//         co_await client.sleepFor(std::chrono::seconds(1));
+//     }
+//
+//     client.spawn(flow(client));
+//     client.run();
+//
+// The awaitables returned by the client are awaited in the expression creating them, as they
+// refer to its arguments. Nothing is thread-safe: the client and its coroutines are only used from
+// the thread of run().
+//
+// The coroutine frames and the state of the client come from memory resources, the heap by
+// default. A pool sized at startup instead, ex. std::pmr::unsynchronized_pool_resource over a
+// std::pmr::monotonic_buffer_resource, keeps the event loop from allocating once it runs, except
+// for the strings of received messages and within libmosquitto.
+
+// Memory resource of the coroutine frames. Set it before creating the first coroutine, and keep it
+// alive until the last one is destroyed.
+void setCoroutineFrameResource(std::pmr::memory_resource* resource);
+std::pmr::memory_resource* coroutineFrameResource();
+
+// Failure of a mosquitto call, with its enum mosq_err_t.
+class MqttError : public std::runtime_error {
+public:
+    MqttError(const std::string& what, int code)
+        : std::runtime_error(what + ": " + mosquitto_strerror(code)), code_(code) {}
+
+    int code() const { return code_; }
+
+private:
+    int code_;
+};
+
+// A message received by the client, owning copies of what the coroutines may keep.
+struct MqttMessage {
+    std::string topic;
+    std::string payload;
+    std::string responseTopic;
+    std::string correlationData;
+};
+
+template <typename T = void>
+class Task;
+
+template <typename T>
+struct TaskResult {
+    std::optional<T> value;
+
+    template <typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+    T take() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void> {
+    void return_void() {}
+
+    void take() {}
+};
+
+template <typename T>
+struct TaskPromise : TaskResult<T> {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    // Resumes the coroutine awaiting the task, without growing the stack.
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<TaskPromise> handle) noexcept {
+            std::coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    Task<T> get_return_object();
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    static void* operator new(size_t size) { return coroutineFrameResource()->allocate(size); }
+    static void operator delete(void* frame, size_t size) {
+        coroutineFrameResource()->deallocate(frame, size);
+    }
+};
+
+// A coroutine returning a T, started when it is awaited. Exceptions are rethrown to the awaiter.
+template <typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task& operator=(Task&&) = delete;
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+
+    T await_resume() {
+        if (handle_.promise().exception) {
+            std::rethrow_exception(handle_.promise().exception);
+        }
+        return handle_.promise().take();
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+class CoroutineClient;
+
+// co_await resumes with the reason code of the CONNACK.
+class ConnectAwaitable {
+public:
+    explicit ConnectAwaitable(CoroutineClient& client) : client_(client) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    int await_resume();
+
+private:
+    friend class CoroutineClient;
+
+    CoroutineClient& client_;
+    std::coroutine_handle<> handle_;
+    int result_ = MOSQ_ERR_SUCCESS;
+    int reasonCode_ = 0;
+};
+
+// co_await resumes once the message is published: with the reason code of the PUBACK for QoS 1,
+// of the PUBCOMP for QoS 2, and once written to the socket for QoS 0.
+class PublishAwaitable {
+public:
+    PublishAwaitable(
+        CoroutineClient& client,
+        const char* topic,
+        std::string_view payload,
+        int qos,
+        bool retain,
+        mosquitto_property* props)
+        : client_(client), topic_(topic), payload_(payload), qos_(qos), retain_(retain),
+          props_(props) {}
+    PublishAwaitable(const PublishAwaitable&) = delete;
+    PublishAwaitable& operator=(const PublishAwaitable&) = delete;
+    ~PublishAwaitable() { mosquitto_property_free_all(&props_); }
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    int await_resume();
+
+private:
+    friend class CoroutineClient;
+
+    CoroutineClient& client_;
+    const char* topic_;
+    std::string_view payload_;
+    int qos_;
+    bool retain_;
+    mosquitto_property* props_;
+    std::coroutine_handle<> handle_;
+    int mid_ = -1;
+    int result_ = MOSQ_ERR_SUCCESS;
+    int reasonCode_ = 0;
+    bool done_ = false;
+};
+
+// co_await resumes with the QoS granted by the SUBACK, or a reason code of 128 or more.
+class SubscribeAwaitable {
+public:
+    SubscribeAwaitable(CoroutineClient& client, const char* topic, int qos)
+        : client_(client), topic_(topic), qos_(qos) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    int await_resume();
+
+private:
+    friend class CoroutineClient;
+
+    CoroutineClient& client_;
+    const char* topic_;
+    int qos_;
+    std::coroutine_handle<> handle_;
+    int mid_ = -1;
+    int result_ = MOSQ_ERR_SUCCESS;
+    int grantedQos_ = 0;
+};
+
+// co_await publishes a request with the response topic of the client and a correlation id, and
+// resumes with the response carrying the same correlation id, or std::nullopt after the timeout.
+class RequestAwaitable {
+public:
+    RequestAwaitable(
+        CoroutineClient& client,
+        const char* topic,
+        std::string_view payload,
+        std::chrono::steady_clock::duration timeout)
+        : client_(client), topic_(topic), payload_(payload), timeout_(timeout) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    std::optional<MqttMessage> await_resume();
+
+private:
+    friend class CoroutineClient;
+
+    CoroutineClient& client_;
+    const char* topic_;
+    std::string_view payload_;
+    std::chrono::steady_clock::duration timeout_;
+    std::coroutine_handle<> handle_;
+    int result_ = MOSQ_ERR_SUCCESS;
+    std::optional<MqttMessage> response_;
+};
+
+// co_await resumes on the event loop once the deadline has passed.
+class SleepAwaitable {
+public:
+    SleepAwaitable(CoroutineClient& client, std::chrono::steady_clock::time_point deadline)
+        : client_(client), deadline_(deadline) {}
+
+    bool await_ready() const noexcept { return deadline_ <= std::chrono::steady_clock::now(); }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    CoroutineClient& client_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+class CoroutineClient {
+public:
+    static constexpr int DEFAULT_QOS = 1;
+    static constexpr std::chrono::seconds DEFAULT_REQUEST_TIMEOUT{ 10 };
+
+    // Creates the client with mqtt_client_new(). mosquitto_lib_init() must have been called, and
+    // the settings must outlive the client.
+    // Requests need MQTT v5 and a response topic, which the client subscribes to on every connect.
+    // The flows, timers and pending acknowledgements are kept in memory from the resource, which
+    // must outlive the client.
+    CoroutineClient(
+        const mqtt_client_connection_settings& settings,
+        int mqttVersion = MQTT_PROTOCOL_V5,
+        std::string responseTopic = std::string(),
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+    ~CoroutineClient();
+    CoroutineClient(const CoroutineClient&) = delete;
+    CoroutineClient& operator=(const CoroutineClient&) = delete;
+
+    // Connects to the broker of the settings. The client reconnects by itself if the connection
+    // is lost afterwards.
+    ConnectAwaitable connect() { return ConnectAwaitable(*this); }
+
+    PublishAwaitable publish(
+        const std::string& topic,
+        std::string_view payload,
+        int qos = DEFAULT_QOS,
+        bool retain = false) {
+        return PublishAwaitable(*this, topic.c_str(), payload, qos, retain, nullptr);
+    }
+
+    SubscribeAwaitable subscribe(const std::string& topic, int qos = DEFAULT_QOS) {
+        return SubscribeAwaitable(*this, topic.c_str(), qos);
+    }
+
+    RequestAwaitable request(
+        const std::string& topic,
+        std::string_view payload,
+        std::chrono::steady_clock::duration timeout = DEFAULT_REQUEST_TIMEOUT) {
+        return RequestAwaitable(*this, topic.c_str(), payload, timeout);
+    }
+
+    // Publishes a response to a request received by the message handler.
+    PublishAwaitable respond(const MqttMessage& request, std::string_view payload);
+
+    SleepAwaitable sleepFor(std::chrono::steady_clock::duration duration) {
+        return SleepAwaitable(*this, std::chrono::steady_clock::now() + duration);
+    }
+
+    SleepAwaitable sleepUntil(std::chrono::steady_clock::time_point deadline) {
+        return SleepAwaitable(*this, deadline);
+    }
+
+    // Called for the received messages that aren't responses to a request.
+    void setMessageHandler(std::function<void(MqttMessage)> handler) {
+        messageHandler_ = std::move(handler);
+    }
+
+    // Starts a flow on the next turn of the event loop. An exception escaping the flow is logged
+    // and counted in failedFlows().
+    void spawn(Task<> task);
+
+    // Runs the event loop until every flow has completed, stop() is called or keep_running is
+    // cleared, ex. by Ctrl+C.
+    void run();
+    void stop() { stopped_ = true; }
+
+    size_t activeFlows() const { return flows_.size(); }
+    uint64_t failedFlows() const { return failedFlows_; }
+    size_t pendingRequests() const { return requests_.size(); }
+    struct mosquitto* handle() const { return mosq_; }
+
+private:
+    friend class ConnectAwaitable;
+    friend class PublishAwaitable;
+    friend class SubscribeAwaitable;
+    friend class RequestAwaitable;
+    friend class SleepAwaitable;
+
+    // Top-level coroutine of a spawned task, destroying itself when the task completes.
+    struct Flow {
+        struct promise_type {
+            CoroutineClient* client;
+
+            promise_type(CoroutineClient& owner, Task<>&) : client(&owner) {}
+
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    handle.promise().client->flows_.erase(handle);
+                    handle.destroy();
+                }
+                void await_resume() noexcept {}
+            };
+
+            Flow get_return_object() {
+                return Flow{ std::coroutine_handle<promise_type>::from_promise(*this) };
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            FinalAwaiter final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+
+            static void* operator new(size_t size) {
+                return coroutineFrameResource()->allocate(size);
+            }
+            static void operator delete(void* frame, size_t size) {
+                coroutineFrameResource()->deallocate(frame, size);
+            }
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    struct Timer {
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t sequence;
+        std::coroutine_handle<> handle;
+        // Correlation id of the request timing out, 0 for a sleep.
+        uint64_t request;
+
+        bool operator>(const Timer& other) const {
+            return deadline != other.deadline ? deadline > other.deadline
+                                              : sequence > other.sequence;
+        }
+    };
+
+    // std::hash of coroutine handles can't be called on a const hash with libstdc++ 12.
+    struct FlowHash {
+        size_t operator()(std::coroutine_handle<Flow::promise_type> handle) const {
+            return std::hash<void*>()(handle.address());
+        }
+    };
+
+    Flow startFlow(Task<> task);
+    void addTimer(std::chrono::steady_clock::time_point deadline, std::coroutine_handle<> handle,
+                  uint64_t request);
+    void resumeReady();
+    void fireTimers();
+    int pollTimeoutMs() const;
+    void pollOnce(int timeoutMs);
+
+    static void onConnect(struct mosquitto* mosq, void* obj, int reasonCode, int flags,
+                          const mosquitto_property* props);
+    static void onPublish(struct mosquitto* mosq, void* obj, int mid, int reasonCode,
+                          const mosquitto_property* props);
+    static void onSubscribe(struct mosquitto* mosq, void* obj, int mid, int qosCount,
+                            const int* grantedQos, const mosquitto_property* props);
+    static void onMessage(struct mosquitto* mosq, void* obj,
+                          const struct mosquitto_message* message, const mosquitto_property* props);
+
+    struct mosquitto* mosq_ = nullptr;
+    mqtt_client_obj obj_ = {};
+    std::string responseTopic_;
+    std::function<void(MqttMessage)> messageHandler_;
+    std::pmr::unordered_set<std::coroutine_handle<Flow::promise_type>, FlowHash> flows_;
+    std::pmr::deque<std::coroutine_handle<>> ready_;
+    std::priority_queue<Timer, std::pmr::vector<Timer>, std::greater<Timer>> timers_;
+    uint64_t timerSequence_ = 0;
+    ConnectAwaitable* connecting_ = nullptr;
+    // Set while mosquitto_publish_v5() runs, as it may complete a QoS 0 publish before returning.
+    PublishAwaitable* publishing_ = nullptr;
+    std::pmr::unordered_map<int, PublishAwaitable*> publishes_;
+    std::pmr::unordered_map<int, SubscribeAwaitable*> subscribes_;
+    std::pmr::unordered_map<uint64_t, RequestAwaitable*> requests_;
+    uint64_t nextCorrelationId_ = 0;
+    bool connectStarted_ = false;
+    std::chrono::steady_clock::time_point reconnectAt_;
+    bool stopped_ = false;
+    uint64_t failedFlows_ = 0;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef EXTENSIONS_INTERNAL_H
+#define EXTENSIONS_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Helpers shared by the implementations of the extensions. They are not part of the API of any
+ * extension, so only include this header from .c files.
+ */
+
+#define FNV1A_32_INIT 2166136261u
+#define FNV1A_64_INIT 14695981039346656037ULL
+
+/* Continues a 32-bit FNV-1a hash, started from FNV1A_32_INIT, over length bytes of data. */
+static inline uint32_t fnv1a_32(uint32_t hash, const void* data, size_t length)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* Continues a 64-bit FNV-1a hash, started from FNV1A_64_INIT, over length bytes of data. */
+static inline uint64_t fnv1a_64(uint64_t hash, const void* data, size_t length)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Continues a 64-bit FNV-1a hash over the characters of a string. */
+static inline uint64_t fnv1a_64_string(uint64_t hash, const char* string)
+{
+  for (; *string != '\0'; string++)
+  {
+    hash = (hash ^ (uint8_t)*string) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* The smallest power of two not below value, to size open addressing tables. */
+static inline uint32_t power_of_two_above(uint32_t value)
+{
+  uint32_t power = 1;
+
+  while (power < value)
+  {
+    power <<= 1;
+  }
+  return power;
+}
+
+static inline int64_t clock_ns(clockid_t clock)
+{
+  struct timespec now;
+
+  clock_gettime(clock, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline int64_t monotonic_ns(void) { return clock_ns(CLOCK_MONOTONIC); }
+
+/* Adds to a counter with a single writer. The atomic store only keeps readers on other threads
+ * from seeing torn values. */
+static inline void stat_add(uint64_t* counter, uint64_t value)
+{
+  __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/* Adds to a counter written by several threads. */
+static inline void stat_add_shared(uint64_t* counter, uint64_t value)
+{
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+#endif /* EXTENSIONS_INTERNAL_H */
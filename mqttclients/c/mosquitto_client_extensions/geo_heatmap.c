@@ -0,0 +1,533 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extensions_internal.h"
+#include "geo_heatmap.h"
+#include "logging.h"
+
+#define CACHE_LINE_SIZE 64
+#define EARTH_RADIUS_KM 6371.0088
+#define DEGREES_TO_RADIANS (M_PI / 180)
+#define MS_PER_HOUR 3600000.0
+/* Key of the empty slots, geohashes having at most 60 bits. */
+#define EMPTY_CELL UINT64_MAX
+/* Key of the empty vehicle slots, hashes of 0 are stored as 1. */
+#define EMPTY_VEHICLE 0
+#define NO_PANE INT64_MIN
+
+static const char GEOHASH_ALPHABET[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+
+/* Last position of a vehicle. */
+typedef struct geo_heatmap_vehicle
+{
+  uint64_t key;
+  uint64_t cell;
+  double longitude;
+  double latitude;
+  int64_t at_ms;
+  /* Pane of the position. */
+  int64_t pane;
+} geo_heatmap_vehicle;
+
+/* Open-addressing table of the cells of a pane or a window. */
+typedef struct geo_heatmap_window
+{
+  int64_t window;
+  uint32_t cell_count;
+  geo_heatmap_cell* cells;
+} geo_heatmap_window;
+
+/* Fibonacci hashing spreads the neighboring cells, which share their high bits. */
+static uint32_t _cell_slot(uint64_t cell, uint32_t capacity)
+{
+  return (uint32_t)((cell * 11400714819323198485ull) >> 32) & (capacity - 1);
+}
+
+/* Pane of a time, rounding down before the epoch too. */
+static int64_t _pane_of(const geo_heatmap* heatmap, int64_t now_ms)
+{
+  int64_t slide = heatmap->options.slide_ms;
+  return now_ms >= 0 ? now_ms / slide : (now_ms - slide + 1) / slide;
+}
+
+/* Slot of a pane or a window in a ring, for negative ones too. */
+static uint32_t _ring_index(int64_t value, uint32_t count)
+{
+  int64_t index = value % count;
+  return (uint32_t)(index < 0 ? index + count : index);
+}
+
+static void _window_reset(const geo_heatmap* heatmap, geo_heatmap_window* window, int64_t id)
+{
+  if (window->cell_count > 0)
+  {
+    for (uint32_t i = 0; i < heatmap->cell_capacity; i++)
+    {
+      window->cells[i].cell = EMPTY_CELL;
+    }
+    window->cell_count = 0;
+  }
+  window->window = id;
+}
+
+/* Returns the aggregates of a cell, added if missing, or NULL if the window has max_cells. */
+static geo_heatmap_cell* _window_cell(
+    const geo_heatmap* heatmap,
+    geo_heatmap_window* window,
+    uint64_t cell)
+{
+  uint32_t slot = _cell_slot(cell, heatmap->cell_capacity);
+
+  while (window->cells[slot].cell != cell)
+  {
+    if (window->cells[slot].cell == EMPTY_CELL)
+    {
+      if (window->cell_count == heatmap->options.max_cells)
+      {
+        return NULL;
+      }
+      window->cell_count++;
+      window->cells[slot] = (geo_heatmap_cell){ .cell = cell };
+      break;
+    }
+    slot = (slot + 1) & (heatmap->cell_capacity - 1);
+  }
+  return &window->cells[slot];
+}
+
+/* Adds the aggregates of a window to another, returning the number of cells that did not fit. */
+static uint64_t _window_merge(
+    const geo_heatmap* heatmap,
+    geo_heatmap_window* into,
+    const geo_heatmap_window* from,
+    bool speeds_only)
+{
+  uint64_t dropped = 0;
+
+  for (uint32_t i = 0; i < heatmap->cell_capacity && from->cell_count > 0; i++)
+  {
+    const geo_heatmap_cell* cell = &from->cells[i];
+    geo_heatmap_cell* merged;
+
+    if (cell->cell == EMPTY_CELL)
+    {
+      continue;
+    }
+    if ((merged = _window_cell(heatmap, into, cell->cell)) == NULL)
+    {
+      dropped++;
+      continue;
+    }
+    if (!speeds_only)
+    {
+      merged->vehicles += cell->vehicles;
+    }
+    merged->speed_samples += cell->speed_samples;
+    merged->speed_sum_kmh += cell->speed_sum_kmh;
+  }
+  return dropped;
+}
+
+/* Returns the last position of a vehicle, added if missing, or NULL if the shard has
+ * max_vehicles. */
+static geo_heatmap_vehicle* _vehicle(
+    const geo_heatmap* heatmap,
+    geo_heatmap_shard* shard,
+    const char* id)
+{
+  uint64_t key = fnv1a_64_string(FNV1A_64_INIT, id);
+  uint32_t slot;
+
+  key = key == EMPTY_VEHICLE ? 1 : key;
+  slot = (uint32_t)key & (heatmap->vehicle_capacity - 1);
+  while (shard->vehicles[slot].key != key)
+  {
+    if (shard->vehicles[slot].key == EMPTY_VEHICLE)
+    {
+      if (shard->vehicle_count == heatmap->options.max_vehicles)
+      {
+        return NULL;
+      }
+      shard->vehicle_count++;
+      shard->vehicles[slot] = (geo_heatmap_vehicle){ .key = key, .pane = NO_PANE };
+      break;
+    }
+    slot = (slot + 1) & (heatmap->vehicle_capacity - 1);
+  }
+  return &shard->vehicles[slot];
+}
+
+/* Counts the vehicles of the shard whose last position is in the window ending with pane e and
+ * merges the speeds of its panes, then hands the window to the collector. Every position before
+ * the end of the window was applied, and none after. */
+static void _close_window(geo_heatmap* heatmap, geo_heatmap_shard* shard, int64_t e)
+{
+  int64_t first_pane = e - heatmap->pane_count + 1;
+  geo_heatmap_window* closed = &shard->closed[_ring_index(e, heatmap->closed_count)];
+  uint64_t dropped = 0;
+
+  /* Windows without positions are left out, the collector seeing no aggregates for them. */
+  if (shard->active_pane < first_pane)
+  {
+    __atomic_store_n(&shard->closed_through, e, __ATOMIC_RELEASE);
+    return;
+  }
+  /* The slot is reused once the collector is done with the window it held. */
+  if (e - heatmap->closed_count > __atomic_load_n(&heatmap->collected_through, __ATOMIC_ACQUIRE))
+  {
+    stat_add(&shard->stats.dropped_windows, 1);
+    __atomic_store_n(&shard->closed_through, e, __ATOMIC_RELEASE);
+    return;
+  }
+
+  _window_reset(heatmap, closed, e);
+  for (uint32_t i = 0; i < heatmap->vehicle_capacity; i++)
+  {
+    const geo_heatmap_vehicle* vehicle = &shard->vehicles[i];
+    geo_heatmap_cell* cell;
+
+    if (vehicle->key == EMPTY_VEHICLE || vehicle->pane < first_pane || vehicle->pane > e)
+    {
+      continue;
+    }
+    if ((cell = _window_cell(heatmap, closed, vehicle->cell)) == NULL)
+    {
+      dropped++;
+      continue;
+    }
+    cell->vehicles++;
+  }
+  for (int64_t pane = first_pane; pane <= e; pane++)
+  {
+    const geo_heatmap_window* speeds = &shard->panes[_ring_index(pane, heatmap->pane_count)];
+    if (speeds->window == pane)
+    {
+      dropped += _window_merge(heatmap, closed, speeds, true);
+    }
+  }
+  if (dropped > 0)
+  {
+    stat_add(&shard->stats.dropped_cells, dropped);
+  }
+  __atomic_store_n(&shard->closed_through, e, __ATOMIC_RELEASE);
+}
+
+static void _advance(geo_heatmap* heatmap, geo_heatmap_shard* shard, int64_t pane)
+{
+  while (shard->closed_through < pane - 1)
+  {
+    _close_window(heatmap, shard, shard->closed_through + 1);
+  }
+}
+
+uint64_t geohash_encode(double longitude, double latitude, uint32_t precision)
+{
+  double longitude_range[2] = { -180, 180 };
+  double latitude_range[2] = { -90, 90 };
+  uint64_t bits = 0;
+
+  for (uint32_t i = 0; i < precision * 5; i++)
+  {
+    double* range = i % 2 == 0 ? longitude_range : latitude_range;
+    double value = i % 2 == 0 ? longitude : latitude;
+    double middle = (range[0] + range[1]) / 2;
+    uint64_t bit = value >= middle;
+
+    range[bit ? 0 : 1] = middle;
+    bits = (bits << 1) | bit;
+  }
+  return bits;
+}
+
+void geohash_to_string(uint64_t cell, uint32_t precision, char* buffer)
+{
+  for (uint32_t i = 0; i < precision; i++)
+  {
+    buffer[i] = GEOHASH_ALPHABET[(cell >> (5 * (precision - 1 - i))) & 31];
+  }
+  buffer[precision] = '\0';
+}
+
+double geo_distance_km(double longitude1, double latitude1, double longitude2, double latitude2)
+{
+  double half_latitude = (latitude2 - latitude1) * DEGREES_TO_RADIANS / 2;
+  double half_longitude = (longitude2 - longitude1) * DEGREES_TO_RADIANS / 2;
+  double a = sin(half_latitude) * sin(half_latitude)
+      + cos(latitude1 * DEGREES_TO_RADIANS) * cos(latitude2 * DEGREES_TO_RADIANS)
+          * sin(half_longitude) * sin(half_longitude);
+
+  return 2 * EARTH_RADIUS_KM * asin(fmin(1, sqrt(a)));
+}
+
+static int _window_alloc(const geo_heatmap* heatmap, geo_heatmap_window* windows, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if ((windows[i].cells = malloc(heatmap->cell_capacity * sizeof(geo_heatmap_cell))) == NULL)
+    {
+      return -1;
+    }
+    /* Resetting a window only clears the tables holding cells. */
+    windows[i].cell_count = 1;
+    _window_reset(heatmap, &windows[i], NO_PANE);
+  }
+  return 0;
+}
+
+static void _window_free(geo_heatmap_window* windows, uint32_t count)
+{
+  for (uint32_t i = 0; windows != NULL && i < count; i++)
+  {
+    free(windows[i].cells);
+  }
+  free(windows);
+}
+
+int geo_heatmap_init(geo_heatmap* heatmap, const geo_heatmap_options* options, int64_t now_ms)
+{
+  int64_t pane;
+
+  memset(heatmap, 0, sizeof(geo_heatmap));
+  heatmap->options = *options;
+  if (heatmap->options.slide_ms == 0)
+  {
+    heatmap->options.slide_ms = options->window_ms;
+  }
+  if (options->precision == 0 || options->precision > GEO_HEATMAP_MAX_PRECISION
+      || options->window_ms == 0 || options->window_ms % heatmap->options.slide_ms != 0
+      || options->shard_count == 0 || options->max_cells == 0 || options->max_cells > INT32_MAX
+      || options->max_vehicles == 0 || options->max_vehicles > INT32_MAX)
+  {
+    LOG_ERROR("Invalid heatmap options");
+    return -1;
+  }
+
+  heatmap->pane_count = options->window_ms / heatmap->options.slide_ms;
+  heatmap->closed_count = heatmap->pane_count + GEO_HEATMAP_PENDING_WINDOWS;
+  /* Tables are kept at most half full. */
+  heatmap->cell_capacity = power_of_two_above(options->max_cells * 2);
+  heatmap->vehicle_capacity = power_of_two_above(options->max_vehicles * 2);
+  pane = _pane_of(heatmap, now_ms);
+  heatmap->collected_through = pane - 1;
+
+  if (posix_memalign(
+          (void**)&heatmap->shards,
+          CACHE_LINE_SIZE,
+          options->shard_count * sizeof(geo_heatmap_shard))
+      != 0)
+  {
+    heatmap->shards = NULL;
+    LOG_ERROR("Out of memory.");
+    return -1;
+  }
+  memset(heatmap->shards, 0, options->shard_count * sizeof(geo_heatmap_shard));
+
+  bool failed = (heatmap->merged = calloc(1, sizeof(geo_heatmap_window))) == NULL
+      || _window_alloc(heatmap, heatmap->merged, 1) != 0
+      || (heatmap->summary_cells = malloc(options->max_cells * sizeof(geo_heatmap_cell))) == NULL;
+  for (uint32_t i = 0; i < options->shard_count && !failed; i++)
+  {
+    geo_heatmap_shard* shard = &heatmap->shards[i];
+
+    shard->active_pane = NO_PANE;
+    shard->closed_through = pane - 1;
+    failed = (shard->vehicles = calloc(heatmap->vehicle_capacity, sizeof(geo_heatmap_vehicle)))
+            == NULL
+        || (shard->panes = calloc(heatmap->pane_count, sizeof(geo_heatmap_window))) == NULL
+        || _window_alloc(heatmap, shard->panes, heatmap->pane_count) != 0
+        || (shard->closed = calloc(heatmap->closed_count, sizeof(geo_heatmap_window))) == NULL
+        || _window_alloc(heatmap, shard->closed, heatmap->closed_count) != 0;
+  }
+
+  if (failed)
+  {
+    LOG_ERROR("Out of memory.");
+    geo_heatmap_destroy(heatmap);
+    return -1;
+  }
+  return 0;
+}
+
+void geo_heatmap_destroy(geo_heatmap* heatmap)
+{
+  for (uint32_t i = 0; heatmap->shards != NULL && i < heatmap->options.shard_count; i++)
+  {
+    free(heatmap->shards[i].vehicles);
+    _window_free(heatmap->shards[i].panes, heatmap->pane_count);
+    _window_free(heatmap->shards[i].closed, heatmap->closed_count);
+  }
+  free(heatmap->shards);
+  _window_free(heatmap->merged, 1);
+  free(heatmap->summary_cells);
+  memset(heatmap, 0, sizeof(geo_heatmap));
+}
+
+void geo_heatmap_update(
+    geo_heatmap* heatmap,
+    uint32_t shard_index,
+    const char* id,
+    double longitude,
+    double latitude,
+    int64_t now_ms)
+{
+  geo_heatmap_shard* shard = &heatmap->shards[shard_index];
+  int64_t pane = _pane_of(heatmap, now_ms);
+  geo_heatmap_vehicle* vehicle;
+  uint64_t cell = geohash_encode(longitude, latitude, heatmap->options.precision);
+
+  _advance(heatmap, shard, pane);
+  stat_add(&shard->stats.positions, 1);
+  if ((vehicle = _vehicle(heatmap, shard, id)) == NULL)
+  {
+    stat_add(&shard->stats.dropped_vehicles, 1);
+    return;
+  }
+
+  /* The speed is measured from the previous position, unless it is older than a window. */
+  if (vehicle->pane != NO_PANE && now_ms > vehicle->at_ms
+      && now_ms - vehicle->at_ms <= heatmap->options.window_ms)
+  {
+    geo_heatmap_window* speeds = &shard->panes[_ring_index(pane, heatmap->pane_count)];
+    geo_heatmap_cell* aggregates;
+
+    if (speeds->window != pane)
+    {
+      _window_reset(heatmap, speeds, pane);
+    }
+    if ((aggregates = _window_cell(heatmap, speeds, cell)) == NULL)
+    {
+      stat_add(&shard->stats.dropped_cells, 1);
+    }
+    else
+    {
+      double distance
+          = geo_distance_km(vehicle->longitude, vehicle->latitude, longitude, latitude);
+      aggregates->speed_samples++;
+      aggregates->speed_sum_kmh += distance / ((now_ms - vehicle->at_ms) / MS_PER_HOUR);
+    }
+  }
+
+  vehicle->cell = cell;
+  vehicle->longitude = longitude;
+  vehicle->latitude = latitude;
+  vehicle->at_ms = now_ms;
+  vehicle->pane = pane;
+  shard->active_pane = pane;
+}
+
+void geo_heatmap_advance(geo_heatmap* heatmap, uint32_t shard, int64_t now_ms)
+{
+  _advance(heatmap, &heatmap->shards[shard], _pane_of(heatmap, now_ms));
+}
+
+uint32_t geo_heatmap_collect(
+    geo_heatmap* heatmap,
+    geo_heatmap_summary_callback callback,
+    void* context)
+{
+  uint32_t collected = 0;
+
+  for (;;)
+  {
+    int64_t window = heatmap->collected_through + 1;
+    geo_heatmap_summary summary;
+    uint64_t dropped = 0;
+
+    for (uint32_t i = 0; i < heatmap->options.shard_count; i++)
+    {
+      if (__atomic_load_n(&heatmap->shards[i].closed_through, __ATOMIC_ACQUIRE) < window)
+      {
+        return collected;
+      }
+    }
+
+    _window_reset(heatmap, heatmap->merged, window);
+    for (uint32_t i = 0; i < heatmap->options.shard_count; i++)
+    {
+      const geo_heatmap_window* closed
+          = &heatmap->shards[i].closed[_ring_index(window, heatmap->closed_count)];
+      if (closed->window == window)
+      {
+        dropped += _window_merge(heatmap, heatmap->merged, closed, false);
+      }
+    }
+
+    summary.start_ms = (window - heatmap->pane_count + 1) * heatmap->options.slide_ms;
+    summary.end_ms = (window + 1) * heatmap->options.slide_ms;
+    summary.precision = heatmap->options.precision;
+    summary.cell_count = 0;
+    summary.cells = heatmap->summary_cells;
+    for (uint32_t i = 0; i < heatmap->cell_capacity && heatmap->merged->cell_count > 0; i++)
+    {
+      if (heatmap->merged->cells[i].cell != EMPTY_CELL)
+      {
+        heatmap->summary_cells[summary.cell_count++] = heatmap->merged->cells[i];
+      }
+    }
+    if (dropped > 0)
+    {
+      stat_add(&heatmap->dropped_cells, dropped);
+    }
+    callback(&summary, context);
+
+    /* Hands the slots of the window back to the shards. */
+    __atomic_store_n(&heatmap->collected_through, window, __ATOMIC_RELEASE);
+    collected++;
+  }
+}
+
+int geo_heatmap_format_summary(const geo_heatmap_summary* summary, char* buffer, size_t size)
+{
+  size_t length = 0;
+  int written = snprintf(
+      buffer,
+      size,
+      "{\"start\":%lld,\"end\":%lld,\"cells\":[",
+      (long long)summary->start_ms,
+      (long long)summary->end_ms);
+
+  /* snprintf() needs room for its null terminator, which is not part of the JSON. */
+  for (uint32_t i = 0;
+       i < summary->cell_count && written >= 0 && (size_t)written < size - length;
+       i++)
+  {
+    const geo_heatmap_cell* cell = &summary->cells[i];
+    char geohash[GEO_HEATMAP_MAX_PRECISION + 1];
+
+    length += written;
+    geohash_to_string(cell->cell, summary->precision, geohash);
+    written = snprintf(
+        buffer + length,
+        size - length,
+        "%s[\"%s\",%u,%.4g]",
+        i > 0 ? "," : "",
+        geohash,
+        cell->vehicles,
+        cell->speed_samples > 0 ? cell->speed_sum_kmh / cell->speed_samples : 0.0);
+  }
+  if (written >= 0 && (size_t)written < size - length)
+  {
+    length += written;
+    written = snprintf(buffer + length, size - length, "]}");
+  }
+  return written >= 0 && (size_t)written < size - length ? (int)(length + written) : -1;
+}
+
+void geo_heatmap_read_stats(const geo_heatmap* heatmap, geo_heatmap_stats* stats)
+{
+  memset(stats, 0, sizeof(geo_heatmap_stats));
+  for (uint32_t i = 0; i < heatmap->options.shard_count; i++)
+  {
+    const geo_heatmap_stats* shard = &heatmap->shards[i].stats;
+    stats->positions += __atomic_load_n(&shard->positions, __ATOMIC_RELAXED);
+    stats->dropped_vehicles += __atomic_load_n(&shard->dropped_vehicles, __ATOMIC_RELAXED);
+    stats->dropped_cells += __atomic_load_n(&shard->dropped_cells, __ATOMIC_RELAXED);
+    stats->dropped_windows += __atomic_load_n(&shard->dropped_windows, __ATOMIC_RELAXED);
+  }
+  stats->dropped_cells += __atomic_load_n(&heatmap->dropped_cells, __ATOMIC_RELAXED);
+}
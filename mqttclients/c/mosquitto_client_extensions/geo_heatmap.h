@@ -0,0 +1,232 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef GEO_HEATMAP_H
+#define GEO_HEATMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Geohash characters of the finest cells, 60 bits. */
+#define GEO_HEATMAP_MAX_PRECISION 12
+/* Windows a shard keeps closed until they are collected, on top of the window_ms / slide_ms
+ * windows a single position can close. */
+#define GEO_HEATMAP_PENDING_WINDOWS 8
+/* Longest cell of a summary formatted by geo_heatmap_format_summary(), with its separator. */
+#define GEO_HEATMAP_CELL_JSON_MAX_LENGTH 48
+/* Longest summary formatted by geo_heatmap_format_summary() without its cells. */
+#define GEO_HEATMAP_SUMMARY_JSON_MAX_LENGTH 80
+
+typedef struct geo_heatmap_options
+{
+  /* Geohash characters of the cells, 1 to GEO_HEATMAP_MAX_PRECISION, ex. 5 for cells of about
+   * 5 by 5 km at the equator. */
+  uint32_t precision;
+  /* Length of the windows. */
+  uint32_t window_ms;
+  /* Time between the start of two windows, a divisor of window_ms. 0 or window_ms for tumbling
+   * windows. */
+  uint32_t slide_ms;
+  /* Threads updating the heatmap, each with its own shard. */
+  uint32_t shard_count;
+  /* Cells kept per window, by each shard and once merged. */
+  uint32_t max_cells;
+  /* Vehicles tracked by each shard. */
+  uint32_t max_vehicles;
+} geo_heatmap_options;
+
+/* Aggregates of a cell over a window. */
+typedef struct geo_heatmap_cell
+{
+  /* Geohash of the cell, as bits, see geohash_to_string(). */
+  uint64_t cell;
+  /* Vehicles whose last position in the window is in the cell. */
+  uint32_t vehicles;
+  /* Speeds measured in the cell, between a position and the previous one of the same vehicle. */
+  uint32_t speed_samples;
+  double speed_sum_kmh;
+} geo_heatmap_cell;
+
+/* Aggregates of every cell of a closed window, as merged over the shards. */
+typedef struct geo_heatmap_summary
+{
+  int64_t start_ms;
+  int64_t end_ms;
+  uint32_t precision;
+  uint32_t cell_count;
+  const geo_heatmap_cell* cells;
+} geo_heatmap_summary;
+
+/**
+ * @brief Called by geo_heatmap_collect() for every window closed by all shards, in order.
+ *
+ * @param summary The summary, valid until the function returns.
+ * @param context The context passed to geo_heatmap_collect().
+ */
+typedef void (*geo_heatmap_summary_callback)(const geo_heatmap_summary* summary, void* context);
+
+/* Counters of a shard. Only its own thread writes them, any thread may read them. */
+typedef struct geo_heatmap_stats
+{
+  uint64_t positions;
+  /* Positions ignored as the vehicle table of the shard is full. */
+  uint64_t dropped_vehicles;
+  /* Aggregates lost as a cell table is full. */
+  uint64_t dropped_cells;
+  /* Windows a shard closed while the collector was too far behind, missing from the summaries. */
+  uint64_t dropped_windows;
+} geo_heatmap_stats;
+
+struct geo_heatmap_vehicle;
+struct geo_heatmap_window;
+
+/* Aggregates of the windows updated by a single thread. */
+typedef struct geo_heatmap_shard
+{
+  struct geo_heatmap_vehicle* vehicles;
+  uint32_t vehicle_count;
+  /* Speeds of every pane still part of an open window, pane p at p % pane_count. */
+  struct geo_heatmap_window* panes;
+  /* Windows closed and not collected yet, window w at w % closed_count. */
+  struct geo_heatmap_window* closed;
+  /* Last pane with a position, the windows after it are empty. */
+  int64_t active_pane;
+  /* Last window closed, read by the collector. */
+  int64_t closed_through;
+  geo_heatmap_stats stats;
+} __attribute__((aligned(64))) geo_heatmap_shard;
+
+/*
+ * Streaming heatmap of vehicle positions: the number of vehicles and their average speed in every
+ * cell of a geohash grid, over tumbling or sliding windows.
+ *
+ * Time is cut into panes of slide_ms, and the window ending with pane e spans the
+ * window_ms / slide_ms panes up to e. Each thread updates its own shard without locks or shared
+ * writes, so a vehicle must always be updated on the same shard, ex. the core owning it. A shard
+ * closes a window, merging the speeds of its panes and counting each of its vehicles in the cell of
+ * its last position, before applying the first position past the end of the window, or on
+ * geo_heatmap_advance() when it receives none. Closed windows are published to the collector with
+ * a release store, which merges the windows of the shards once they all closed them.
+ *
+ * Every table is allocated by geo_heatmap_init(). Vehicles are told apart by a 64-bit hash of their
+ * id, and are never removed, so max_vehicles bounds the vehicles a shard ever sees.
+ */
+typedef struct geo_heatmap
+{
+  geo_heatmap_options options;
+  uint32_t pane_count;
+  uint32_t closed_count;
+  /* Slots of the cell tables, a power of two. */
+  uint32_t cell_capacity;
+  uint32_t vehicle_capacity;
+  geo_heatmap_shard* shards;
+  /* Owned by the collector. */
+  struct geo_heatmap_window* merged;
+  geo_heatmap_cell* summary_cells;
+  uint64_t dropped_cells;
+  /* Last window collected, read by the shards. */
+  int64_t collected_through;
+} geo_heatmap;
+
+/**
+ * @brief Returns the geohash of a position as bits, longitude first, 5 bits per character.
+ *
+ * @param longitude The longitude, in degrees.
+ * @param latitude The latitude, in degrees.
+ * @param precision The number of characters, at most GEO_HEATMAP_MAX_PRECISION.
+ * @return uint64_t The bits of the geohash.
+ */
+uint64_t geohash_encode(double longitude, double latitude, uint32_t precision);
+
+/**
+ * @brief Writes the characters of the geohash returned by geohash_encode().
+ *
+ * @param cell The bits of the geohash.
+ * @param precision The number of characters.
+ * @param buffer Receives the null-terminated geohash, at least precision + 1 characters.
+ */
+void geohash_to_string(uint64_t cell, uint32_t precision, char* buffer);
+
+/**
+ * @brief Returns the great-circle distance between two positions.
+ *
+ * @return double The distance, in km.
+ */
+double geo_distance_km(double longitude1, double latitude1, double longitude2, double latitude2);
+
+/**
+ * @brief Allocates the shards of a heatmap. Windows before now_ms are not reported.
+ *
+ * @param heatmap The geo_heatmap to initialize.
+ * @param options The options, copied.
+ * @param now_ms The current time, in the clock of the updates.
+ * @return int 0 on success, -1 if the options are invalid or out of memory.
+ */
+int geo_heatmap_init(geo_heatmap* heatmap, const geo_heatmap_options* options, int64_t now_ms);
+
+void geo_heatmap_destroy(geo_heatmap* heatmap);
+
+/**
+ * @brief Adds the position of a vehicle, closing the windows ended before now_ms first. Must only
+ * be called from the thread of the shard.
+ *
+ * @param heatmap The geo_heatmap.
+ * @param shard The index of the shard of the calling thread.
+ * @param vehicle The id of the vehicle, always updated on the same shard.
+ * @param longitude The longitude, in degrees.
+ * @param latitude The latitude, in degrees.
+ * @param now_ms The time of the position, never before that of the previous call on the shard.
+ */
+void geo_heatmap_update(
+    geo_heatmap* heatmap,
+    uint32_t shard,
+    const char* vehicle,
+    double longitude,
+    double latitude,
+    int64_t now_ms);
+
+/**
+ * @brief Closes the windows of a shard ended before now_ms, for the shards receiving no position.
+ * Must only be called from the thread of the shard.
+ */
+void geo_heatmap_advance(geo_heatmap* heatmap, uint32_t shard, int64_t now_ms);
+
+/**
+ * @brief Merges the windows closed by every shard, calling callback with the summary of each.
+ * Must only be called from one thread at a time, which may be the thread of a shard.
+ *
+ * @return uint32_t The number of windows collected.
+ */
+uint32_t geo_heatmap_collect(
+    geo_heatmap* heatmap,
+    geo_heatmap_summary_callback callback,
+    void* context);
+
+/**
+ * @brief Formats a summary as compact JSON, ex.
+ * {"start":1700000000000,"end":1700000060000,"cells":[["u09tv",12,43.5],["u09tw",3,0.0]]}
+ * listing the geohash, the vehicles and the average speed in km/h of each cell.
+ *
+ * @param summary The summary.
+ * @param buffer Receives the JSON, not null-terminated.
+ * @param size The size of buffer, GEO_HEATMAP_SUMMARY_JSON_MAX_LENGTH +
+ * GEO_HEATMAP_CELL_JSON_MAX_LENGTH per cell is always enough.
+ * @return int The length of the JSON, -1 if buffer is too small.
+ */
+int geo_heatmap_format_summary(const geo_heatmap_summary* summary, char* buffer, size_t size);
+
+/**
+ * @brief Sums the counters of every shard. Can be called from any thread.
+ */
+void geo_heatmap_read_stats(const geo_heatmap* heatmap, geo_heatmap_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GEO_HEATMAP_H */
@@ -0,0 +1,538 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extensions_internal.h"
+#include "geofence.h"
+#include "logging.h"
+
+#define INITIAL_FENCE_CAPACITY 64
+#define INITIAL_EDGE_CAPACITY 1024
+#define INITIAL_VEHICLE_CAPACITY 64
+#define INITIAL_INSIDE_CAPACITY 4
+#define MAX_GRID_DIMENSION 4096
+
+/* Vectors of GEOFENCE_EDGE_LANES edges. Comparing vectors gives a mask of -1 for true lanes and 0
+ * for false ones. The compiler maps them to SSE/AVX on x86 and NEON on ARM. */
+typedef double edge_vector __attribute__((vector_size(GEOFENCE_EDGE_LANES * sizeof(double))));
+typedef int64_t edge_mask __attribute__((vector_size(GEOFENCE_EDGE_LANES * sizeof(int64_t))));
+
+static bool _grow(void** array, size_t element_size, size_t capacity)
+{
+  void* grown = realloc(*array, capacity * element_size);
+  if (grown == NULL)
+  {
+    return false;
+  }
+  *array = grown;
+  return true;
+}
+
+void geofence_engine_init(geofence_engine* engine)
+{
+  memset(engine, 0, sizeof(geofence_engine));
+}
+
+int geofence_engine_add(geofence_engine* engine, const char* name)
+{
+  uint32_t fence = engine->fence_count;
+
+  if (engine->built)
+  {
+    LOG_ERROR("Fences can not be added once the geofence engine is built");
+    return -1;
+  }
+
+  if (fence == engine->fence_capacity)
+  {
+    uint32_t capacity = fence == 0 ? INITIAL_FENCE_CAPACITY : fence * 2;
+    /* edge_start has one more element, the end of the edges of the last fence. */
+    if (!_grow((void**)&engine->names, sizeof(char*), capacity)
+        || !_grow((void**)&engine->edge_start, sizeof(uint32_t), capacity + 1)
+        || !_grow((void**)&engine->min_x, sizeof(double), capacity)
+        || !_grow((void**)&engine->min_y, sizeof(double), capacity)
+        || !_grow((void**)&engine->max_x, sizeof(double), capacity)
+        || !_grow((void**)&engine->max_y, sizeof(double), capacity))
+    {
+      LOG_ERROR("Failed to allocate memory for geofence");
+      return -1;
+    }
+    engine->fence_capacity = capacity;
+  }
+
+  if ((engine->names[fence] = strdup(name)) == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for geofence");
+    return -1;
+  }
+  engine->edge_start[fence] = (uint32_t)engine->edge_count;
+  engine->edge_start[fence + 1] = (uint32_t)engine->edge_count;
+  engine->min_x[fence] = INFINITY;
+  engine->min_y[fence] = INFINITY;
+  engine->max_x[fence] = -INFINITY;
+  engine->max_y[fence] = -INFINITY;
+  engine->fence_count++;
+  return (int)fence;
+}
+
+int geofence_engine_add_ring(
+    geofence_engine* engine,
+    const double* coordinates,
+    size_t point_count)
+{
+  uint32_t fence = engine->fence_count - 1;
+
+  if (engine->fence_count == 0 || engine->built)
+  {
+    LOG_ERROR("Rings must be added to a fence, before the geofence engine is built");
+    return -1;
+  }
+  /* The closing point is implied. */
+  if (point_count > 1 && coordinates[0] == coordinates[2 * (point_count - 1)]
+      && coordinates[1] == coordinates[2 * (point_count - 1) + 1])
+  {
+    point_count--;
+  }
+  if (point_count < 3)
+  {
+    LOG_ERROR("A geofence ring needs at least 3 points");
+    return -1;
+  }
+
+  if (engine->edge_count + point_count + GEOFENCE_EDGE_LANES > engine->edge_capacity)
+  {
+    size_t capacity = engine->edge_capacity == 0 ? INITIAL_EDGE_CAPACITY : engine->edge_capacity;
+    while (capacity < engine->edge_count + point_count + GEOFENCE_EDGE_LANES)
+    {
+      capacity *= 2;
+    }
+    if (capacity > UINT32_MAX || !_grow((void**)&engine->edge_x, sizeof(double), capacity)
+        || !_grow((void**)&engine->edge_y, sizeof(double), capacity)
+        || !_grow((void**)&engine->edge_y_end, sizeof(double), capacity)
+        || !_grow((void**)&engine->edge_slope, sizeof(double), capacity))
+    {
+      LOG_ERROR("Failed to allocate memory for geofence");
+      return -1;
+    }
+    engine->edge_capacity = capacity;
+  }
+
+  for (size_t i = 0; i < point_count; i++)
+  {
+    double x0 = coordinates[2 * i];
+    double y0 = coordinates[2 * i + 1];
+    double x1 = coordinates[2 * ((i + 1) % point_count)];
+    double y1 = coordinates[2 * ((i + 1) % point_count) + 1];
+    size_t edge = engine->edge_count;
+
+    engine->min_x[fence] = fmin(engine->min_x[fence], x0);
+    engine->min_y[fence] = fmin(engine->min_y[fence], y0);
+    engine->max_x[fence] = fmax(engine->max_x[fence], x0);
+    engine->max_y[fence] = fmax(engine->max_y[fence], y0);
+
+    /* Horizontal edges are never crossed by the horizontal ray of the test. */
+    if (y0 == y1)
+    {
+      continue;
+    }
+    engine->edge_x[edge] = x0;
+    engine->edge_y[edge] = y0;
+    engine->edge_y_end[edge] = y1;
+    engine->edge_slope[edge] = (x1 - x0) / (y1 - y0);
+    engine->edge_count++;
+  }
+
+  /* Padding edges from (0, 0) to (0, 0) are never crossed. */
+  while (engine->edge_count % GEOFENCE_EDGE_LANES != 0)
+  {
+    engine->edge_x[engine->edge_count] = 0;
+    engine->edge_y[engine->edge_count] = 0;
+    engine->edge_y_end[engine->edge_count] = 0;
+    engine->edge_slope[engine->edge_count] = 0;
+    engine->edge_count++;
+  }
+  engine->edge_start[fence + 1] = (uint32_t)engine->edge_count;
+  return 0;
+}
+
+static uint32_t _cell_column(const geofence_engine* engine, double x)
+{
+  double column = floor((x - engine->grid_min_x) * engine->cell_scale_x);
+  return column < 0 ? 0 : column >= engine->columns ? engine->columns - 1 : (uint32_t)column;
+}
+
+static uint32_t _cell_row(const geofence_engine* engine, double y)
+{
+  double row = floor((y - engine->grid_min_y) * engine->cell_scale_y);
+  return row < 0 ? 0 : row >= engine->rows ? engine->rows - 1 : (uint32_t)row;
+}
+
+static void _free_grid(geofence_engine* engine)
+{
+  free(engine->cell_start);
+  free(engine->cell_fences);
+  free(engine->scratch);
+  engine->cell_start = NULL;
+  engine->cell_fences = NULL;
+  engine->scratch = NULL;
+}
+
+int geofence_engine_build(geofence_engine* engine)
+{
+  double min_x = INFINITY;
+  double min_y = INFINITY;
+  double max_x = -INFINITY;
+  double max_y = -INFINITY;
+  double width;
+  double height;
+  size_t cell_count;
+  size_t entry_count = 0;
+
+  if (engine->built)
+  {
+    return 0;
+  }
+  if (engine->fence_count == 0)
+  {
+    LOG_ERROR("The geofence engine has no fences");
+    return -1;
+  }
+
+  for (uint32_t f = 0; f < engine->fence_count; f++)
+  {
+    if (engine->edge_start[f] == engine->edge_start[f + 1])
+    {
+      LOG_ERROR("Geofence %s has no rings", engine->names[f]);
+      return -1;
+    }
+    min_x = fmin(min_x, engine->min_x[f]);
+    min_y = fmin(min_y, engine->min_y[f]);
+    max_x = fmax(max_x, engine->max_x[f]);
+    max_y = fmax(max_y, engine->max_y[f]);
+  }
+
+  /* About one cell per fence, as square as the extent of the fences allows. */
+  width = fmax(max_x - min_x, 1e-9);
+  height = fmax(max_y - min_y, 1e-9);
+  engine->columns = (uint32_t)fmin(
+      fmax(ceil(sqrt(engine->fence_count * width / height)), 1), MAX_GRID_DIMENSION);
+  engine->rows = (uint32_t)fmin(
+      fmax(ceil((double)engine->fence_count / engine->columns), 1), MAX_GRID_DIMENSION);
+  engine->grid_min_x = min_x;
+  engine->grid_min_y = min_y;
+  engine->cell_scale_x = engine->columns / width;
+  engine->cell_scale_y = engine->rows / height;
+  cell_count = (size_t)engine->columns * engine->rows;
+
+  if ((engine->cell_start = calloc(cell_count + 1, sizeof(uint32_t))) == NULL
+      || (engine->scratch = malloc(engine->fence_count * sizeof(uint32_t))) == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for geofence grid");
+    _free_grid(engine);
+    return -1;
+  }
+
+  /* Counts the fences of each cell, then fills the cells in fence order so each cell lists its
+   * fences in ascending order. */
+  for (int pass = 0; pass < 2; pass++)
+  {
+    if (pass == 1)
+    {
+      for (size_t c = 0; c < cell_count; c++)
+      {
+        engine->cell_start[c + 1] += engine->cell_start[c];
+      }
+      entry_count = engine->cell_start[cell_count];
+      if ((engine->cell_fences = malloc(entry_count * sizeof(uint32_t))) == NULL)
+      {
+        LOG_ERROR("Failed to allocate memory for geofence grid");
+        _free_grid(engine);
+        return -1;
+      }
+    }
+
+    for (uint32_t f = 0; f < engine->fence_count; f++)
+    {
+      uint32_t first_column = _cell_column(engine, engine->min_x[f]);
+      uint32_t last_column = _cell_column(engine, engine->max_x[f]);
+      uint32_t first_row = _cell_row(engine, engine->min_y[f]);
+      uint32_t last_row = _cell_row(engine, engine->max_y[f]);
+
+      for (uint32_t row = first_row; row <= last_row; row++)
+      {
+        for (uint32_t column = first_column; column <= last_column; column++)
+        {
+          size_t cell = (size_t)row * engine->columns + column;
+          if (pass == 0)
+          {
+            engine->cell_start[cell + 1]++;
+          }
+          else
+          {
+            engine->cell_fences[engine->cell_start[cell]++] = f;
+          }
+        }
+      }
+    }
+  }
+
+  /* Filling advanced each cell_start to the start of the next cell. */
+  memmove(engine->cell_start + 1, engine->cell_start, cell_count * sizeof(uint32_t));
+  engine->cell_start[0] = 0;
+  engine->built = true;
+  return 0;
+}
+
+/* Even-odd test of the horizontal ray from (x, y) towards +x against the edges [begin, end), a
+ * multiple of GEOFENCE_EDGE_LANES edges. Both conditions are computed for every edge, without
+ * branches. */
+static bool _point_in_fence(
+    const geofence_engine* engine,
+    uint32_t begin,
+    uint32_t end,
+    double x,
+    double y)
+{
+  edge_vector point_x = { 0 };
+  edge_vector point_y = { 0 };
+  edge_mask crossings = { 0 };
+  int64_t count = 0;
+
+  point_x += x;
+  point_y += y;
+  for (uint32_t i = begin; i < end; i += GEOFENCE_EDGE_LANES)
+  {
+    edge_vector edge_x;
+    edge_vector edge_y;
+    edge_vector edge_y_end;
+    edge_vector edge_slope;
+
+    memcpy(&edge_x, engine->edge_x + i, sizeof(edge_vector));
+    memcpy(&edge_y, engine->edge_y + i, sizeof(edge_vector));
+    memcpy(&edge_y_end, engine->edge_y_end + i, sizeof(edge_vector));
+    memcpy(&edge_slope, engine->edge_slope + i, sizeof(edge_vector));
+
+    /* Each crossing subtracts 1, the mask of a true lane being -1. */
+    crossings += ((edge_y > point_y) ^ (edge_y_end > point_y))
+        & (point_x < edge_x + (point_y - edge_y) * edge_slope);
+  }
+
+  for (int lane = 0; lane < GEOFENCE_EDGE_LANES; lane++)
+  {
+    count -= crossings[lane];
+  }
+  return (count & 1) != 0;
+}
+
+size_t geofence_engine_contains(
+    geofence_engine* engine,
+    double x,
+    double y,
+    uint32_t* fences,
+    size_t max_fences)
+{
+  size_t count = 0;
+  size_t cell;
+
+  engine->queries++;
+  if (!engine->built || !(x >= engine->grid_min_x && y >= engine->grid_min_y)
+      || (x - engine->grid_min_x) * engine->cell_scale_x > engine->columns
+      || (y - engine->grid_min_y) * engine->cell_scale_y > engine->rows)
+  {
+    return 0;
+  }
+
+  cell = (size_t)_cell_row(engine, y) * engine->columns + _cell_column(engine, x);
+  for (uint32_t k = engine->cell_start[cell]; k < engine->cell_start[cell + 1]; k++)
+  {
+    uint32_t f = engine->cell_fences[k];
+
+    if (x < engine->min_x[f] || x > engine->max_x[f] || y < engine->min_y[f]
+        || y > engine->max_y[f])
+    {
+      continue;
+    }
+    engine->candidates++;
+    if (_point_in_fence(engine, engine->edge_start[f], engine->edge_start[f + 1], x, y))
+    {
+      if (count < max_fences)
+      {
+        fences[count] = f;
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+static int _grow_vehicles(geofence_engine* engine)
+{
+  size_t capacity
+      = engine->vehicle_capacity == 0 ? INITIAL_VEHICLE_CAPACITY : engine->vehicle_capacity * 2;
+  geofence_vehicle* vehicles = calloc(capacity, sizeof(geofence_vehicle));
+
+  if (vehicles == NULL)
+  {
+    return -1;
+  }
+  for (size_t i = 0; i < engine->vehicle_capacity; i++)
+  {
+    if (engine->vehicles[i].id != NULL)
+    {
+      size_t slot = fnv1a_64_string(FNV1A_64_INIT, engine->vehicles[i].id) & (capacity - 1);
+      while (vehicles[slot].id != NULL)
+      {
+        slot = (slot + 1) & (capacity - 1);
+      }
+      vehicles[slot] = engine->vehicles[i];
+    }
+  }
+  free(engine->vehicles);
+  engine->vehicles = vehicles;
+  engine->vehicle_capacity = capacity;
+  return 0;
+}
+
+static geofence_vehicle* _find_vehicle(geofence_engine* engine, const char* id)
+{
+  size_t slot;
+
+  /* Keeps the table at most 3/4 full. */
+  if ((engine->vehicle_count + 1) * 4 > engine->vehicle_capacity * 3
+      && _grow_vehicles(engine) != 0)
+  {
+    return NULL;
+  }
+
+  slot = fnv1a_64_string(FNV1A_64_INIT, id) & (engine->vehicle_capacity - 1);
+  while (engine->vehicles[slot].id != NULL)
+  {
+    if (strcmp(engine->vehicles[slot].id, id) == 0)
+    {
+      return &engine->vehicles[slot];
+    }
+    slot = (slot + 1) & (engine->vehicle_capacity - 1);
+  }
+
+  if ((engine->vehicles[slot].id = strdup(id)) == NULL)
+  {
+    return NULL;
+  }
+  engine->vehicle_count++;
+  return &engine->vehicles[slot];
+}
+
+int geofence_engine_update(
+    geofence_engine* engine,
+    const char* vehicle_id,
+    double x,
+    double y,
+    geofence_event_callback callback,
+    void* context)
+{
+  geofence_vehicle* vehicle;
+  size_t count;
+  size_t previous = 0;
+  size_t current = 0;
+  int transitions = 0;
+
+  if (!engine->built)
+  {
+    LOG_ERROR("The geofence engine must be built before it is updated");
+    return -1;
+  }
+  if ((vehicle = _find_vehicle(engine, vehicle_id)) == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for vehicle %s", vehicle_id);
+    return -1;
+  }
+  count = geofence_engine_contains(engine, x, y, engine->scratch, engine->fence_count);
+
+  /* Both sets are sorted, so the transitions are found by merging them. */
+  while (previous < vehicle->inside_count || current < count)
+  {
+    if (current == count
+        || (previous < vehicle->inside_count
+            && vehicle->inside[previous] < engine->scratch[current]))
+    {
+      if (callback != NULL)
+      {
+        uint32_t fence = vehicle->inside[previous];
+        callback(vehicle->id, fence, engine->names[fence], GEOFENCE_EXIT, context);
+      }
+      previous++;
+      transitions++;
+    }
+    else if (
+        previous == vehicle->inside_count || engine->scratch[current] < vehicle->inside[previous])
+    {
+      if (callback != NULL)
+      {
+        uint32_t fence = engine->scratch[current];
+        callback(vehicle->id, fence, engine->names[fence], GEOFENCE_ENTER, context);
+      }
+      current++;
+      transitions++;
+    }
+    else
+    {
+      previous++;
+      current++;
+    }
+  }
+
+  if (transitions > 0)
+  {
+    if (count > vehicle->inside_capacity)
+    {
+      uint32_t capacity = vehicle->inside_capacity == 0 ? INITIAL_INSIDE_CAPACITY
+                                                        : vehicle->inside_capacity;
+      while (capacity < count)
+      {
+        capacity *= 2;
+      }
+      if (!_grow((void**)&vehicle->inside, sizeof(uint32_t), capacity))
+      {
+        LOG_ERROR("Failed to allocate memory for vehicle %s", vehicle_id);
+        return -1;
+      }
+      vehicle->inside_capacity = capacity;
+    }
+    if (count > 0)
+    {
+      memcpy(vehicle->inside, engine->scratch, count * sizeof(uint32_t));
+    }
+    vehicle->inside_count = (uint32_t)count;
+  }
+  return transitions;
+}
+
+void geofence_engine_destroy(geofence_engine* engine)
+{
+  for (uint32_t f = 0; f < engine->fence_count; f++)
+  {
+    free(engine->names[f]);
+  }
+  for (size_t i = 0; i < engine->vehicle_capacity; i++)
+  {
+    free(engine->vehicles[i].id);
+    free(engine->vehicles[i].inside);
+  }
+  free(engine->names);
+  free(engine->edge_start);
+  free(engine->min_x);
+  free(engine->min_y);
+  free(engine->max_x);
+  free(engine->max_y);
+  free(engine->edge_x);
+  free(engine->edge_y);
+  free(engine->edge_y_end);
+  free(engine->edge_slope);
+  free(engine->vehicles);
+  _free_grid(engine);
+  memset(engine, 0, sizeof(geofence_engine));
+}
@@ -0,0 +1,191 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of edges tested at once by the point-in-polygon test. */
+#define GEOFENCE_EDGE_LANES 4
+
+typedef enum geofence_transition
+{
+  GEOFENCE_ENTER,
+  GEOFENCE_EXIT
+} geofence_transition;
+
+/**
+ * @brief Called for every fence a vehicle entered or exited.
+ *
+ * @param vehicle The id of the vehicle.
+ * @param fence The index of the fence, as returned by geofence_engine_add().
+ * @param name The name of the fence.
+ * @param transition Whether the vehicle entered or exited the fence.
+ * @param context The context passed to geofence_engine_update().
+ */
+typedef void (*geofence_event_callback)(
+    const char* vehicle,
+    uint32_t fence,
+    const char* name,
+    geofence_transition transition,
+    void* context);
+
+/* Fences a vehicle was inside of at its last position, sorted by index. */
+typedef struct geofence_vehicle
+{
+  char* id;
+  uint32_t* inside;
+  uint32_t inside_count;
+  uint32_t inside_capacity;
+} geofence_vehicle;
+
+/*
+ * Point-in-polygon tests against a large set of polygon fences.
+ *
+ * Edges of every fence are stored as structure of arrays, edge i going from (x[i], y[i]) to
+ * (x[i] + (y_end[i] - y[i]) * slope[i], y_end[i]), so the crossing test runs on
+ * GEOFENCE_EDGE_LANES edges at a time with vector instructions. The edges of each ring are padded
+ * to a multiple of GEOFENCE_EDGE_LANES with edges that are never crossed. The rings of a fence are
+ * tested together with the even-odd rule, so the holes of a polygon are added as more rings of the
+ * same fence.
+ *
+ * A uniform grid over the bounding boxes of the fences lists the fences overlapping each cell, so a
+ * point is only tested against the few fences near it.
+ */
+typedef struct geofence_engine
+{
+  /* Fences, fence f owning edges [edge_start[f], edge_start[f + 1]). */
+  uint32_t fence_count;
+  uint32_t fence_capacity;
+  char** names;
+  uint32_t* edge_start;
+  double* min_x;
+  double* min_y;
+  double* max_x;
+  double* max_y;
+  /* Edges of every fence. */
+  size_t edge_count;
+  size_t edge_capacity;
+  double* edge_x;
+  double* edge_y;
+  double* edge_y_end;
+  double* edge_slope;
+  /* Grid, cell c listing fences [cell_start[c], cell_start[c + 1]) of cell_fences. */
+  bool built;
+  uint32_t columns;
+  uint32_t rows;
+  double grid_min_x;
+  double grid_min_y;
+  double cell_scale_x;
+  double cell_scale_y;
+  uint32_t* cell_start;
+  uint32_t* cell_fences;
+  /* Vehicles, in an open addressing table of vehicle_capacity slots. */
+  geofence_vehicle* vehicles;
+  size_t vehicle_count;
+  size_t vehicle_capacity;
+  /* Fences containing the last position, reused between updates. */
+  uint32_t* scratch;
+  /* Statistics of the queries. */
+  uint64_t queries;
+  uint64_t candidates;
+} geofence_engine;
+
+/**
+ * @brief Initializes an empty geofence_engine. The geofence_engine must be freed with
+ * geofence_engine_destroy().
+ *
+ * @param engine The geofence_engine to initialize.
+ */
+void geofence_engine_init(geofence_engine* engine);
+
+/**
+ * @brief Adds a fence without rings. Its rings are added with geofence_engine_add_ring(). Fences
+ * can only be added before geofence_engine_build().
+ *
+ * @param engine The geofence_engine to add to.
+ * @param name The name of the fence, reported with its events.
+ * @return int The index of the fence, or -1 on failure.
+ */
+int geofence_engine_add(geofence_engine* engine, const char* name);
+
+/**
+ * @brief Adds a ring to the last fence added, ex. the exterior ring or a hole of a GeoJSON polygon.
+ *
+ * @param engine The geofence_engine to add to.
+ * @param coordinates The x, y pairs of the points of the ring. The ring is closed, the last point
+ * may repeat the first one or not.
+ * @param point_count The number of points of the ring, at least 3.
+ * @return int 0 on success, -1 on failure.
+ */
+int geofence_engine_add_ring(
+    geofence_engine* engine,
+    const double* coordinates,
+    size_t point_count);
+
+/**
+ * @brief Builds the grid of the fences. Must be called once every fence has been added, and before
+ * querying the engine.
+ *
+ * @param engine The geofence_engine to build.
+ * @return int 0 on success, -1 on failure.
+ */
+int geofence_engine_build(geofence_engine* engine);
+
+/**
+ * @brief Finds the fences containing a point.
+ *
+ * @param engine The geofence_engine to query.
+ * @param x The x coordinate of the point, ex. the longitude.
+ * @param y The y coordinate of the point, ex. the latitude.
+ * @param fences The array to write the indexes of the fences to, in ascending order.
+ * @param max_fences The length of fences.
+ * @return size_t The number of fences containing the point, which may be more than max_fences.
+ */
+size_t geofence_engine_contains(
+    geofence_engine* engine,
+    double x,
+    double y,
+    uint32_t* fences,
+    size_t max_fences);
+
+/**
+ * @brief Moves a vehicle to a new position, calling callback for every fence it entered or exited
+ * since its last position. The first position of a vehicle reports the fences it is inside of as
+ * entered.
+ *
+ * @param engine The geofence_engine to update.
+ * @param vehicle The id of the vehicle.
+ * @param x The x coordinate of the position, ex. the longitude.
+ * @param y The y coordinate of the position, ex. the latitude.
+ * @param callback The function called for every transition, or NULL.
+ * @param context Passed to callback.
+ * @return int The number of transitions, or -1 on failure.
+ */
+int geofence_engine_update(
+    geofence_engine* engine,
+    const char* vehicle,
+    double x,
+    double y,
+    geofence_event_callback callback,
+    void* context);
+
+/**
+ * @brief Frees the fences and vehicles of a geofence_engine.
+ *
+ * @param engine The geofence_engine to free.
+ */
+void geofence_engine_destroy(geofence_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GEOFENCE_H */
@@ -2,8 +2,9 @@
 /* SPDX-License-Identifier: MIT */
 
 #include "logging.h"
-#include <errno.h>
+#include <ctype.h>
 #include <json-c/json.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,43 +25,18 @@
     }                                                    \
   } while (0)
 
-#define RETURN_IF_NON_ZERO(x)                    \
-  do                                             \
-  {                                              \
-    if ((x) != 0)                                \
-    {                                            \
-      LOG_ERROR("Failure parsing JSON: %s", #x); \
-      json_object_put(jobj);                     \
-      return -1;                                 \
-    }                                            \
-  } while (0)
-
-#define RETURN_IF_NAN(x)                                         \
-  do                                                             \
-  {                                                              \
-    errno = 0;                                                   \
-    x;                                                           \
-    if (errno == EINVAL)                                         \
-    {                                                            \
-      LOG_ERROR("Failure parsing JSON: %s is not a number", #x); \
-      json_object_put(jobj);                                     \
-      return -1;                                                 \
-    }                                                            \
-  } while (0)
+#define POINT_TYPE "Point"
+/* Nesting of the members skipped in a point, deeper values are rejected. */
+#define MAX_SKIPPED_DEPTH 16
 
 geojson_point geojson_point_init()
 {
-  return (geojson_point){ .type = calloc(1, strlen("Point") + 1),
-                          .coordinates = (geojson_coordinates){ .x = 0, .y = 0 } };
+  return (geojson_point){ .type = "", .coordinates = (geojson_coordinates){ .x = 0, .y = 0 } };
 }
 
 void geojson_point_destroy(geojson_point* pt)
 {
-  if (pt->type != NULL)
-  {
-    free(pt->type);
-    pt->type = NULL;
-  }
+  pt->type[0] = '\0';
   pt->coordinates.x = 0;
   pt->coordinates.y = 0;
 }
@@ -83,46 +59,413 @@ void mosquitto_payload_destroy(mosquitto_payload* payload)
   payload->max_payload_length = 0;
 }
 
+mosquitto_payload mosquitto_payload_from_buffer(char* buffer, size_t size)
+{
+  if (size > 0)
+  {
+    buffer[0] = '\0';
+  }
+  return (mosquitto_payload){ .payload = buffer, .payload_length = 0, .max_payload_length = size };
+}
+
+int mosquitto_payload_pool_init(
+    mosquitto_payload_pool* pool,
+    uint32_t capacity,
+    size_t buffer_size)
+{
+  memset(pool, 0, sizeof(mosquitto_payload_pool));
+  if (capacity == 0 || buffer_size == 0 || buffer_size > SIZE_MAX / capacity)
+  {
+    return -1;
+  }
+  pool->buffers = malloc((size_t)capacity * buffer_size);
+  pool->free_buffers = malloc(capacity * sizeof(uint32_t));
+  pool->in_use = calloc(capacity, sizeof(bool));
+  if (pool->buffers == NULL || pool->free_buffers == NULL || pool->in_use == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    mosquitto_payload_pool_destroy(pool);
+    return -1;
+  }
+  pool->buffer_size = buffer_size;
+  pool->capacity = capacity;
+  /* Hand out the first buffers first, they are the most likely to be in cache. */
+  for (uint32_t i = 0; i < capacity; i++)
+  {
+    pool->free_buffers[i] = capacity - 1 - i;
+  }
+  pool->free_count = capacity;
+  return 0;
+}
+
+int mosquitto_payload_pool_acquire(mosquitto_payload_pool* pool, mosquitto_payload* payload)
+{
+  uint32_t index;
+
+  if (pool->free_count == 0)
+  {
+    pool->exhausted++;
+    return -1;
+  }
+  index = pool->free_buffers[--pool->free_count];
+  pool->in_use[index] = true;
+  *payload = mosquitto_payload_from_buffer(
+      pool->buffers + (size_t)index * pool->buffer_size, pool->buffer_size);
+  return 0;
+}
+
+int mosquitto_payload_pool_release(mosquitto_payload_pool* pool, mosquitto_payload* payload)
+{
+  size_t offset;
+  uint32_t index;
+
+  if (payload->payload < pool->buffers
+      || payload->payload >= pool->buffers + (size_t)pool->capacity * pool->buffer_size)
+  {
+    return -1;
+  }
+  offset = (size_t)(payload->payload - pool->buffers);
+  index = (uint32_t)(offset / pool->buffer_size);
+  if (offset % pool->buffer_size != 0 || !pool->in_use[index])
+  {
+    return -1;
+  }
+  pool->in_use[index] = false;
+  pool->free_buffers[pool->free_count++] = index;
+  payload->payload = NULL;
+  payload->payload_length = 0;
+  payload->max_payload_length = 0;
+  return 0;
+}
+
+void mosquitto_payload_pool_destroy(mosquitto_payload_pool* pool)
+{
+  free(pool->buffers);
+  free(pool->free_buffers);
+  free(pool->in_use);
+  memset(pool, 0, sizeof(mosquitto_payload_pool));
+}
+
 void geojson_point_set_coordinates(geojson_point* pt, double x, double y)
 {
   pt->coordinates.x = x;
   pt->coordinates.y = y;
 }
 
+/*
+ * Point messages are parsed in place rather than with json-c, which allocates every object of the
+ * message. The payload is scanned once for the "type" and "coordinates" members, other members are
+ * skipped.
+ */
+static int _parse_failure(const char* reason)
+{
+  LOG_ERROR("Failure parsing JSON: %s", reason);
+  return -1;
+}
+
+static const char* _skip_whitespace(const char* json)
+{
+  while (*json == ' ' || *json == '\t' || *json == '\n' || *json == '\r')
+  {
+    json++;
+  }
+  return json;
+}
+
+/* Returns the end of the string starting at json, escapes included, or NULL if it is not one. */
+static const char* _skip_string(const char* json)
+{
+  if (*json != '"')
+  {
+    return NULL;
+  }
+  for (json++; *json != '"'; json++)
+  {
+    if ((unsigned char)*json < 0x20)
+    {
+      /* Control characters, the terminating null included, must be escaped. */
+      return NULL;
+    }
+    if (*json == '\\')
+    {
+      json++;
+      if (*json == 'u')
+      {
+        for (int i = 0; i < 4; i++)
+        {
+          if (!isxdigit((unsigned char)*++json))
+          {
+            return NULL;
+          }
+        }
+      }
+      else if (*json == '\0' || strchr("\"\\/bfnrt", *json) == NULL)
+      {
+        return NULL;
+      }
+    }
+  }
+  return json + 1;
+}
+
+static const char* _skip_digits(const char* json)
+{
+  while (*json >= '0' && *json <= '9')
+  {
+    json++;
+  }
+  return json;
+}
+
+/* Returns the end of the number starting at json, or NULL if it is not a JSON number: no leading
+ * +, no leading zeros, no hexadecimal, no inf or nan. */
+static const char* _skip_number(const char* json)
+{
+  const char* start;
+
+  if (*json == '-')
+  {
+    json++;
+  }
+  if (*json == '0')
+  {
+    json++;
+  }
+  else if (*json >= '1' && *json <= '9')
+  {
+    json = _skip_digits(json);
+  }
+  else
+  {
+    return NULL;
+  }
+  if (*json == '.')
+  {
+    start = json + 1;
+    if ((json = _skip_digits(start)) == start)
+    {
+      return NULL;
+    }
+  }
+  if (*json == 'e' || *json == 'E')
+  {
+    json++;
+    if (*json == '+' || *json == '-')
+    {
+      json++;
+    }
+    start = json;
+    if ((json = _skip_digits(start)) == start)
+    {
+      return NULL;
+    }
+  }
+  return json;
+}
+
+static const char* _skip_literal(const char* json, const char* literal)
+{
+  size_t length = strlen(literal);
+  return strncmp(json, literal, length) == 0 ? json + length : NULL;
+}
+
+/* Returns the end of the value starting at json, after whitespace, or NULL if it is not one.
+ * Containers are checked for their separators, and are nested at most MAX_SKIPPED_DEPTH deep. */
+static const char* _skip_value_at_depth(const char* json, int depth)
+{
+  json = _skip_whitespace(json);
+  if (*json == '"')
+  {
+    return _skip_string(json);
+  }
+  if (*json == 't')
+  {
+    return _skip_literal(json, "true");
+  }
+  if (*json == 'f')
+  {
+    return _skip_literal(json, "false");
+  }
+  if (*json == 'n')
+  {
+    return _skip_literal(json, "null");
+  }
+  if (*json != '{' && *json != '[')
+  {
+    return _skip_number(json);
+  }
+  if (depth == MAX_SKIPPED_DEPTH)
+  {
+    return NULL;
+  }
+
+  char close = *json == '{' ? '}' : ']';
+  json = _skip_whitespace(json + 1);
+  if (*json == close)
+  {
+    return json + 1;
+  }
+  for (;;)
+  {
+    /* Members are "key": value, elements are a value. */
+    if (close == '}')
+    {
+      if ((json = _skip_string(json)) == NULL || *(json = _skip_whitespace(json)) != ':')
+      {
+        return NULL;
+      }
+      json++;
+    }
+    if ((json = _skip_value_at_depth(json, depth + 1)) == NULL)
+    {
+      return NULL;
+    }
+    json = _skip_whitespace(json);
+    if (*json == close)
+    {
+      return json + 1;
+    }
+    if (*json != ',')
+    {
+      return NULL;
+    }
+    json = _skip_whitespace(json + 1);
+  }
+}
+
+static const char* _skip_value(const char* json)
+{
+  return _skip_value_at_depth(json, 0);
+}
+
+static bool _string_equals(const char* start, const char* end, const char* expected)
+{
+  size_t length = strlen(expected);
+  return (size_t)(end - start) == length + 2 && memcmp(start + 1, expected, length) == 0;
+}
+
+/* Parses the first two positions of a coordinates array, returns its end or NULL. */
+static const char* _parse_coordinates(const char* json, geojson_coordinates* coordinates)
+{
+  double* values[2] = { &coordinates->x, &coordinates->y };
+  char* end;
+
+  if (*json != '[')
+  {
+    return NULL;
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    const char* number_end;
+
+    json = _skip_whitespace(json + 1);
+    /* strtod() alone would also take a leading +, hexadecimal, inf and nan. */
+    if ((number_end = _skip_number(json)) == NULL)
+    {
+      return NULL;
+    }
+    *values[i] = strtod(json, &end);
+    if (end != number_end || !isfinite(*values[i]))
+    {
+      return NULL;
+    }
+    json = _skip_whitespace(end);
+    if (i == 0 && *json != ',')
+    {
+      return NULL;
+    }
+  }
+  /* An altitude may follow. */
+  while (*json == ',')
+  {
+    if ((json = _skip_value(json + 1)) == NULL)
+    {
+      return NULL;
+    }
+    json = _skip_whitespace(json);
+  }
+  return *json == ']' ? json + 1 : NULL;
+}
+
 int mosquitto_payload_to_geojson_point(
     const struct mosquitto_message* message,
     geojson_point* output)
 {
   RETURN_IF_NULL(message, NULL);
   RETURN_IF_NULL(output, NULL);
+  RETURN_IF_NULL(message->payload, NULL);
 
-  json_object* type;
-  json_object* coordinates;
-  json_object* jobj = json_tokener_parse(message->payload);
-
-  char* type_string;
-  double x;
-  double y;
+  const char* json = _skip_whitespace(message->payload);
+  geojson_coordinates coordinates;
+  bool has_type = false;
+  bool has_coordinates = false;
 
-  RETURN_IF_NULL(type = json_object_object_get(jobj, "type"), jobj);
-  RETURN_IF_NULL(type_string = (char*)json_object_get_string(type), jobj);
-  if (strcmp(type_string, "Point") != 0)
+  if (*json != '{')
   {
-    LOG_ERROR("Failure parsing JSON: type is not Point");
-    json_object_put(jobj);
-    return -1;
+    return _parse_failure("payload is not an object");
   }
-  RETURN_IF_NULL(coordinates = json_object_object_get(jobj, "coordinates"), jobj);
-  RETURN_IF_NAN(x = json_object_get_double(json_object_array_get_idx(coordinates, 0)));
-  RETURN_IF_NAN(y = json_object_get_double(json_object_array_get_idx(coordinates, 1)));
+  json = _skip_whitespace(json + 1);
+  while (*json != '}')
+  {
+    const char* key = json;
+    const char* key_end;
+    const char* value;
 
-  strcpy(output->type, type_string);
-  output->coordinates.x = x;
-  output->coordinates.y = y;
+    if ((key_end = _skip_string(key)) == NULL || *(json = _skip_whitespace(key_end)) != ':')
+    {
+      return _parse_failure("expected a member");
+    }
+    value = _skip_whitespace(json + 1);
 
-  // decrements the reference count of the object and frees it if it reaches zero.
-  json_object_put(jobj);
+    if (_string_equals(key, key_end, "type"))
+    {
+      if ((json = _skip_string(value)) == NULL || !_string_equals(value, json, POINT_TYPE))
+      {
+        return _parse_failure("type is not Point");
+      }
+      has_type = true;
+    }
+    else if (_string_equals(key, key_end, "coordinates"))
+    {
+      if ((json = _parse_coordinates(value, &coordinates)) == NULL)
+      {
+        return _parse_failure("coordinates are not a position");
+      }
+      has_coordinates = true;
+    }
+    else if ((json = _skip_value(value)) == NULL)
+    {
+      return _parse_failure("invalid value");
+    }
 
+    json = _skip_whitespace(json);
+    if (*json == ',')
+    {
+      if (*(json = _skip_whitespace(json + 1)) == '}')
+      {
+        return _parse_failure("expected a member after ,");
+      }
+    }
+    else if (*json != '}')
+    {
+      return _parse_failure("expected , or }");
+    }
+  }
+  if (*_skip_whitespace(json + 1) != '\0')
+  {
+    return _parse_failure("unexpected data after the object");
+  }
+  if (!has_type)
+  {
+    return _parse_failure("type is missing");
+  }
+  if (!has_coordinates)
+  {
+    return _parse_failure("coordinates are missing");
+  }
+
+  strcpy(output->type, POINT_TYPE);
+  output->coordinates = coordinates;
   return 0;
 }
 
@@ -130,36 +473,179 @@ int geojson_point_to_mosquitto_payload(
     const geojson_point geojson_point,
     mosquitto_payload* message)
 {
-  RETURN_IF_NULL(geojson_point.type, NULL);
   RETURN_IF_NULL(message->payload, NULL);
 
-  const char* payload;
-  size_t payload_length;
-  json_object* jobj = json_object_new_object();
-  json_object* type = json_object_new_string(geojson_point.type);
-  json_object* coordinates = json_object_new_array();
-
-  RETURN_IF_NON_ZERO(json_c_set_serialization_double_format("%.6f", JSON_C_OPTION_THREAD));
-  RETURN_IF_NON_ZERO(
-      json_object_array_add(coordinates, json_object_new_double(geojson_point.coordinates.x)));
-  RETURN_IF_NON_ZERO(
-      json_object_array_add(coordinates, json_object_new_double(geojson_point.coordinates.y)));
-  RETURN_IF_NON_ZERO(json_object_object_add(jobj, "type", type));
-  RETURN_IF_NON_ZERO(json_object_object_add(jobj, "coordinates", coordinates));
-  RETURN_IF_NULL(
-      payload = json_object_to_json_string_length(jobj, JSON_C_TO_STRING_PLAIN, &payload_length),
-      jobj);
-  if (payload_length > message->max_payload_length)
-  {
-    LOG_ERROR("Failure parsing JSON: mosquitto payload buffer is too small");
+  int payload_length;
+
+  /* The type is written as is, so it must not need escaping. */
+  size_t type_length = strnlen(geojson_point.type, GEOJSON_TYPE_SIZE);
+  if (type_length == 0 || type_length == GEOJSON_TYPE_SIZE
+      || strcspn(geojson_point.type, "\"\\") != type_length)
+  {
+    LOG_ERROR("Failure writing JSON: invalid type");
+    return -1;
+  }
+  if (!isfinite(geojson_point.coordinates.x) || !isfinite(geojson_point.coordinates.y))
+  {
+    LOG_ERROR("Failure writing JSON: coordinates are not finite");
+    return -1;
+  }
+
+  payload_length = snprintf(
+      message->payload,
+      message->max_payload_length,
+      "{\"type\":\"%s\",\"coordinates\":[%.6f,%.6f]}",
+      geojson_point.type,
+      geojson_point.coordinates.x,
+      geojson_point.coordinates.y);
+  if (payload_length < 0 || (size_t)payload_length >= message->max_payload_length)
+  {
+    LOG_ERROR("Failure writing JSON: mosquitto payload buffer is too small");
+    if (message->max_payload_length > 0)
+    {
+      message->payload[0] = '\0';
+    }
+    return -1;
+  }
+
+  message->payload_length = (size_t)payload_length;
+  return 0;
+}
+
+/* Adds the rings of a GeoJSON polygon, an array of rings of [x, y] positions, to the last fence. */
+static bool _is_array(json_object* jobj)
+{
+  return json_object_get_type(jobj) == json_type_array;
+}
+
+static int _add_polygon_rings(json_object* polygon, geofence_engine* engine)
+{
+  size_t ring_count;
+
+  if (!_is_array(polygon) || (ring_count = json_object_array_length(polygon)) == 0)
+  {
+    return -1;
+  }
+  for (size_t r = 0; r < ring_count; r++)
+  {
+    json_object* ring = json_object_array_get_idx(polygon, r);
+    size_t point_count;
+    double* coordinates;
+    int rc = 0;
+
+    if (!_is_array(ring) || (point_count = json_object_array_length(ring)) == 0
+        || (coordinates = malloc(2 * point_count * sizeof(double))) == NULL)
+    {
+      return -1;
+    }
+    for (size_t i = 0; i < point_count; i++)
+    {
+      json_object* position = json_object_array_get_idx(ring, i);
+      if (!_is_array(position) || json_object_array_length(position) < 2)
+      {
+        rc = -1;
+        break;
+      }
+      coordinates[2 * i] = json_object_get_double(json_object_array_get_idx(position, 0));
+      coordinates[2 * i + 1] = json_object_get_double(json_object_array_get_idx(position, 1));
+    }
+    if (rc == 0)
+    {
+      rc = geofence_engine_add_ring(engine, coordinates, point_count);
+    }
+    free(coordinates);
+    if (rc != 0)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int geojson_file_to_geofences(const char* path, geofence_engine* engine)
+{
+  json_object* jobj = json_object_from_file(path);
+  json_object* features;
+  size_t feature_count;
+  int fence_count = 0;
+
+  if (jobj == NULL || !json_object_object_get_ex(jobj, "features", &features)
+      || json_object_get_type(features) != json_type_array)
+  {
+    LOG_ERROR("Failure parsing GeoJSON file %s: not a FeatureCollection", path);
     json_object_put(jobj);
     return -1;
   }
 
-  strcpy(message->payload, payload);
-  message->payload_length = payload_length;
+  feature_count = json_object_array_length(features);
+  for (size_t f = 0; f < feature_count; f++)
+  {
+    json_object* feature = json_object_array_get_idx(features, f);
+    json_object* geometry;
+    json_object* type;
+    json_object* coordinates;
+    json_object* properties;
+    json_object* name;
+    const char* type_string;
+    char default_name[32];
+    int rc = 0;
+
+    if (!json_object_object_get_ex(feature, "geometry", &geometry)
+        || !json_object_object_get_ex(geometry, "type", &type)
+        || !json_object_object_get_ex(geometry, "coordinates", &coordinates)
+        || (type_string = json_object_get_string(type)) == NULL)
+    {
+      continue;
+    }
+    if (strcmp(type_string, "Polygon") != 0 && strcmp(type_string, "MultiPolygon") != 0)
+    {
+      continue;
+    }
+
+    snprintf(default_name, sizeof(default_name), "%zu", f);
+    if (geofence_engine_add(
+            engine,
+            json_object_object_get_ex(feature, "properties", &properties)
+                    && json_object_object_get_ex(properties, "name", &name)
+                ? json_object_get_string(name)
+                : default_name)
+        < 0)
+    {
+      json_object_put(jobj);
+      return -1;
+    }
+
+    /* The polygons of a MultiPolygon do not overlap, so their rings form a single fence. */
+    if (strcmp(type_string, "Polygon") == 0)
+    {
+      rc = _add_polygon_rings(coordinates, engine);
+    }
+    else if (!_is_array(coordinates))
+    {
+      rc = -1;
+    }
+    else
+    {
+      for (size_t p = 0; p < json_object_array_length(coordinates) && rc == 0; p++)
+      {
+        rc = _add_polygon_rings(json_object_array_get_idx(coordinates, p), engine);
+      }
+    }
+    if (rc != 0)
+    {
+      LOG_ERROR("Failure parsing GeoJSON file %s: invalid polygon in feature %zu", path, f);
+      json_object_put(jobj);
+      return -1;
+    }
+    fence_count++;
+  }
 
   // decrements the reference count of the object and frees it if it reaches zero.
   json_object_put(jobj);
-  return 0;
+
+  if (geofence_engine_build(engine) != 0)
+  {
+    return -1;
+  }
+  return fence_count;
 }
@@ -4,8 +4,14 @@
 #ifndef GEO_JSON_HANDLER_H
 #define GEO_JSON_HANDLER_H
 
+#include "geofence.h"
 #include "mosquitto.h"
 #include <json-c/json.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Size of the type of a geojson_point, including the terminating NUL. */
+#define GEOJSON_TYPE_SIZE 16
 
 typedef struct mosquitto_payload
 {
@@ -14,6 +20,23 @@ typedef struct mosquitto_payload
   size_t max_payload_length;
 } mosquitto_payload;
 
+/*
+ * Fixed number of payload buffers of the same size, carved out of a single allocation made at init,
+ * so acquiring and releasing a payload never touches the heap. Not thread safe: use one pool per
+ * thread, ex. per core_shard.
+ */
+typedef struct mosquitto_payload_pool
+{
+  char* buffers;
+  size_t buffer_size;
+  uint32_t capacity;
+  /* Indexes of the free buffers, the last one is acquired first. */
+  uint32_t* free_buffers;
+  uint32_t free_count;
+  bool* in_use;
+  uint64_t exhausted;
+} mosquitto_payload_pool;
+
 typedef struct geojson_coordinates
 {
   double x, y;
@@ -21,16 +44,15 @@ typedef struct geojson_coordinates
 
 typedef struct geojson_point
 {
-  char* type;
+  char type[GEOJSON_TYPE_SIZE];
   geojson_coordinates coordinates;
 } geojson_point;
 
 /**
- * @brief Converts a mosquitto_message to a geojson_point
+ * @brief Converts a mosquitto_message to a geojson_point, without allocating memory.
  *
- * @param message The mosquitto_message to convert
- * @param output The geojson_point to output to. The type field must already be allocated. The
- * geojson_point_init() function will do this for you.
+ * @param message The mosquitto_message to convert, with a NUL terminated payload.
+ * @param output The geojson_point to output to.
  * @return int 0 on success, -1 on failure
  */
 int mosquitto_payload_to_geojson_point(
@@ -38,18 +60,30 @@ int mosquitto_payload_to_geojson_point(
     geojson_point* output);
 
 /**
- * @brief Converts a geojson_point to a mosquitto_payload
+ * @brief Converts a geojson_point to a mosquitto_payload, without allocating memory.
  *
  * @param geojson_point The geojson_point to convert
  * @param message The mosquitto_payload to output to. Payload must already be allocated to a size of
- * max_payload_length (which must be set and will not be modified in this function).
- * mosquitto_payload_init() will do this for you.
+ * max_payload_length (which must be set and will not be modified in this function), including the
+ * terminating NUL. mosquitto_payload_init(), mosquitto_payload_from_buffer() or
+ * mosquitto_payload_pool_acquire() will do this for you.
  * @return int 0 on success, -1 on failure
  */
 int geojson_point_to_mosquitto_payload(
     const geojson_point geojson_point,
     mosquitto_payload* message);
 
+/**
+ * @brief Loads the polygons of a GeoJSON FeatureCollection file as geofences, and builds the
+ * geofence_engine. Each Polygon or MultiPolygon feature is a fence named after its "name" property,
+ * or after its index in the collection. Features of other geometry types are skipped.
+ *
+ * @param path The path of the GeoJSON file.
+ * @param engine The initialized geofence_engine to add the fences to.
+ * @return int The number of fences loaded, or -1 on failure.
+ */
+int geojson_file_to_geofences(const char* path, geofence_engine* engine);
+
 /**
  * @brief Sets the coordinates of a geojson_point
  *
@@ -60,17 +94,17 @@ int geojson_point_to_mosquitto_payload(
 void geojson_point_set_coordinates(geojson_point* pt, double x, double y);
 
 /**
- * @brief Initializes an empty geojson_point with type allocated to a length of "Point" and
- * coordinates set to (0, 0). The geojson_point must be freed with geojson_point_destroy().
+ * @brief Initializes an empty geojson_point with an empty type and coordinates set to (0, 0). The
+ * type is stored in the geojson_point, so it can live on the stack.
  *
  * @return geojson_point The initialized geojson_point
  */
 geojson_point geojson_point_init();
 
 /**
- * @brief Frees the memory of a geojson_point's type field and sets the coordinates to 0.
+ * @brief Clears the type of a geojson_point and sets the coordinates to 0.
  *
- * @param pt The geojson_point to free
+ * @param pt The geojson_point to clear
  */
 void geojson_point_destroy(geojson_point* pt);
 
@@ -92,4 +126,54 @@ mosquitto_payload mosquitto_payload_init(int max_payload_length);
  */
 void mosquitto_payload_destroy(mosquitto_payload* payload);
 
+/**
+ * @brief Initializes an empty mosquitto_payload over a buffer owned by the caller, ex. on the
+ * stack. The mosquitto_payload must not be passed to mosquitto_payload_destroy().
+ *
+ * @param buffer The buffer to write the payload to.
+ * @param size The size of the buffer.
+ * @return mosquitto_payload The initialized mosquitto_payload
+ */
+mosquitto_payload mosquitto_payload_from_buffer(char* buffer, size_t size);
+
+/**
+ * @brief Allocates the buffers of a mosquitto_payload_pool. The mosquitto_payload_pool must be
+ * freed with mosquitto_payload_pool_destroy().
+ *
+ * @param pool The mosquitto_payload_pool to initialize.
+ * @param capacity The number of buffers.
+ * @param buffer_size The size of each buffer, the max_payload_length of the payloads.
+ * @return int 0 on success, -1 on failure.
+ */
+int mosquitto_payload_pool_init(
+    mosquitto_payload_pool* pool,
+    uint32_t capacity,
+    size_t buffer_size);
+
+/**
+ * @brief Initializes an empty mosquitto_payload over a free buffer of the pool. The
+ * mosquitto_payload must be returned with mosquitto_payload_pool_release().
+ *
+ * @param pool The mosquitto_payload_pool to take the buffer from.
+ * @param payload The mosquitto_payload to initialize.
+ * @return int 0 on success, -1 if every buffer is in use.
+ */
+int mosquitto_payload_pool_acquire(mosquitto_payload_pool* pool, mosquitto_payload* payload);
+
+/**
+ * @brief Returns the buffer of a mosquitto_payload to its pool and clears the mosquitto_payload.
+ *
+ * @param pool The mosquitto_payload_pool the payload was acquired from.
+ * @param payload The mosquitto_payload to release.
+ * @return int 0 on success, -1 if the buffer is not an acquired buffer of the pool.
+ */
+int mosquitto_payload_pool_release(mosquitto_payload_pool* pool, mosquitto_payload* payload);
+
+/**
+ * @brief Frees the buffers of a mosquitto_payload_pool. Payloads still acquired become invalid.
+ *
+ * @param pool The mosquitto_payload_pool to free.
+ */
+void mosquitto_payload_pool_destroy(mosquitto_payload_pool* pool);
+
 #endif /* GEO_JSON_HANDLER_H */
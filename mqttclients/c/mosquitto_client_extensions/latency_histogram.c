@@ -0,0 +1,122 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+
+#include "latency_histogram.h"
+
+#define MAX_VALUE ((UINT64_C(1) << LATENCY_HISTOGRAM_MAX_VALUE_BITS) - 1)
+
+static uint32_t _bucket_index(uint64_t value)
+{
+  if (value < LATENCY_HISTOGRAM_SUB_BUCKET_COUNT)
+  {
+    return (uint32_t)value;
+  }
+
+  /* Shift the value so its top bit lands on the top bit of a sub bucket index. */
+  uint32_t shift
+      = (uint32_t)(63 - __builtin_clzll(value)) - (LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1);
+  uint32_t sub_bucket = (uint32_t)(value >> shift);
+  return LATENCY_HISTOGRAM_SUB_BUCKET_COUNT + (shift - 1) * LATENCY_HISTOGRAM_SUB_BUCKET_HALF
+      + (sub_bucket - LATENCY_HISTOGRAM_SUB_BUCKET_HALF);
+}
+
+static uint64_t _highest_equivalent_value(uint32_t index)
+{
+  if (index < LATENCY_HISTOGRAM_SUB_BUCKET_COUNT)
+  {
+    return index;
+  }
+
+  uint32_t offset = index - LATENCY_HISTOGRAM_SUB_BUCKET_COUNT;
+  uint32_t shift = offset / LATENCY_HISTOGRAM_SUB_BUCKET_HALF + 1;
+  uint64_t sub_bucket
+      = offset % LATENCY_HISTOGRAM_SUB_BUCKET_HALF + LATENCY_HISTOGRAM_SUB_BUCKET_HALF;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+void latency_histogram_reset(latency_histogram* histogram)
+{
+  memset(histogram->counts, 0, sizeof(histogram->counts));
+  histogram->total_count = 0;
+  histogram->min = UINT64_MAX;
+  histogram->max = 0;
+  histogram->sum = 0;
+}
+
+void latency_histogram_record(latency_histogram* histogram, uint64_t value_ns)
+{
+  if (value_ns > MAX_VALUE)
+  {
+    value_ns = MAX_VALUE;
+  }
+
+  histogram->counts[_bucket_index(value_ns)]++;
+  histogram->total_count++;
+  histogram->sum += (double)value_ns;
+  if (value_ns < histogram->min)
+  {
+    histogram->min = value_ns;
+  }
+  if (value_ns > histogram->max)
+  {
+    histogram->max = value_ns;
+  }
+}
+
+void latency_histogram_merge(latency_histogram* destination, const latency_histogram* source)
+{
+  for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKET_COUNT; i++)
+  {
+    destination->counts[i] += source->counts[i];
+  }
+  destination->total_count += source->total_count;
+  destination->sum += source->sum;
+  if (source->min < destination->min)
+  {
+    destination->min = source->min;
+  }
+  if (source->max > destination->max)
+  {
+    destination->max = source->max;
+  }
+}
+
+uint64_t latency_histogram_value_at_percentile(
+    const latency_histogram* histogram,
+    double percentile)
+{
+  double exact_target;
+  uint64_t target;
+  uint64_t cumulative = 0;
+
+  if (histogram->total_count == 0)
+  {
+    return 0;
+  }
+
+  /* Round up, so the value returned covers at least the requested share of the values. */
+  exact_target = percentile / 100.0 * (double)histogram->total_count;
+  target = (uint64_t)exact_target;
+  if ((double)target < exact_target || target == 0)
+  {
+    target++;
+  }
+
+  for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKET_COUNT; i++)
+  {
+    cumulative += histogram->counts[i];
+    if (cumulative >= target)
+    {
+      uint64_t value = _highest_equivalent_value(i);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+double latency_histogram_mean(const latency_histogram* histogram)
+{
+  return histogram->total_count == 0 ? 0 : histogram->sum / (double)histogram->total_count;
+}
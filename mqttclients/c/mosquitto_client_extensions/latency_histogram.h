@@ -0,0 +1,83 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log-linear histogram of nanosecond values. Every power of two range is split into
+ * 2^(LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1) buckets, so recorded values are exact below
+ * 2^LATENCY_HISTOGRAM_SUB_BUCKET_BITS and within 1/64 (about 1.6%) above. Values above
+ * 2^LATENCY_HISTOGRAM_MAX_VALUE_BITS (about 18 minutes) are clamped.
+ */
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 7
+#define LATENCY_HISTOGRAM_MAX_VALUE_BITS 40
+#define LATENCY_HISTOGRAM_SUB_BUCKET_COUNT (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_SUB_BUCKET_HALF (LATENCY_HISTOGRAM_SUB_BUCKET_COUNT / 2)
+#define LATENCY_HISTOGRAM_BUCKET_COUNT                                      \
+  (LATENCY_HISTOGRAM_SUB_BUCKET_COUNT                                       \
+   + (LATENCY_HISTOGRAM_MAX_VALUE_BITS - LATENCY_HISTOGRAM_SUB_BUCKET_BITS) \
+       * LATENCY_HISTOGRAM_SUB_BUCKET_HALF)
+
+typedef struct latency_histogram
+{
+  uint64_t counts[LATENCY_HISTOGRAM_BUCKET_COUNT];
+  uint64_t total_count;
+  uint64_t min;
+  uint64_t max;
+  double sum;
+} latency_histogram;
+
+/**
+ * @brief Clears all recorded values.
+ *
+ * @param histogram The latency_histogram to reset.
+ */
+void latency_histogram_reset(latency_histogram* histogram);
+
+/**
+ * @brief Records a value.
+ *
+ * @param histogram The latency_histogram to record to.
+ * @param value_ns The value in nanoseconds.
+ */
+void latency_histogram_record(latency_histogram* histogram, uint64_t value_ns);
+
+/**
+ * @brief Adds all values recorded in another histogram.
+ *
+ * @param destination The latency_histogram to add to.
+ * @param source The latency_histogram to add from.
+ */
+void latency_histogram_merge(latency_histogram* destination, const latency_histogram* source);
+
+/**
+ * @brief Gets the value below or at which a percentage of the recorded values fall.
+ *
+ * @param histogram The latency_histogram to read.
+ * @param percentile The percentile, between 0 and 100.
+ * @return uint64_t The highest value equivalent to the percentile, or 0 if nothing was recorded.
+ */
+uint64_t latency_histogram_value_at_percentile(
+    const latency_histogram* histogram,
+    double percentile);
+
+/**
+ * @brief Gets the mean of the recorded values.
+ *
+ * @param histogram The latency_histogram to read.
+ * @return double The mean, or 0 if nothing was recorded.
+ */
+double latency_histogram_mean(const latency_histogram* histogram);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCY_HISTOGRAM_H */
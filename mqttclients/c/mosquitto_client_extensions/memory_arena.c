@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logging.h"
+#include "memory_arena.h"
+
+#define ALIGN_UP(size) \
+  (((size) + MEMORY_ARENA_ALIGNMENT - 1) & ~((size_t)MEMORY_ARENA_ALIGNMENT - 1))
+
+int memory_arena_init(memory_arena* arena, size_t capacity)
+{
+  arena->capacity = ALIGN_UP(capacity);
+  arena->buffer = malloc(arena->capacity);
+  arena->offset = 0;
+  arena->overflow = NULL;
+  arena->alloc_count = 0;
+  arena->overflow_count = 0;
+  arena->high_water_mark = 0;
+
+  if (arena->buffer == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for arena buffer.");
+    arena->capacity = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void* memory_arena_alloc(memory_arena* arena, size_t size)
+{
+  size_t aligned_size = ALIGN_UP(size);
+
+  arena->alloc_count++;
+  if (aligned_size <= arena->capacity - arena->offset)
+  {
+    void* ptr = arena->buffer + arena->offset;
+    arena->offset += aligned_size;
+    if (arena->offset > arena->high_water_mark)
+    {
+      arena->high_water_mark = arena->offset;
+    }
+    return ptr;
+  }
+
+  /* The block header is padded to the alignment so the returned memory stays aligned. */
+  memory_arena_block* block = malloc(ALIGN_UP(sizeof(memory_arena_block)) + aligned_size);
+  if (block == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for arena overflow block.");
+    return NULL;
+  }
+  block->next = arena->overflow;
+  arena->overflow = block;
+  arena->overflow_count++;
+  return (unsigned char*)block + ALIGN_UP(sizeof(memory_arena_block));
+}
+
+void memory_arena_reset(memory_arena* arena)
+{
+  while (arena->overflow != NULL)
+  {
+    memory_arena_block* next = arena->overflow->next;
+    free(arena->overflow);
+    arena->overflow = next;
+  }
+  arena->offset = 0;
+}
+
+void memory_arena_destroy(memory_arena* arena)
+{
+  memory_arena_reset(arena);
+  if (arena->buffer != NULL)
+  {
+    free(arena->buffer);
+    arena->buffer = NULL;
+  }
+  arena->capacity = 0;
+}
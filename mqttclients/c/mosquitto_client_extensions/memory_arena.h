@@ -0,0 +1,75 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Alignment of every allocation served by an arena. */
+#define MEMORY_ARENA_ALIGNMENT (2 * sizeof(void*))
+
+typedef struct memory_arena_block
+{
+  struct memory_arena_block* next;
+} memory_arena_block;
+
+/*
+ * Bump allocator over a single buffer allocated at init. Individual allocations are never freed,
+ * the whole arena is released at once with memory_arena_reset(). Allocations that do not fit in the
+ * buffer fall back to the heap and are freed on reset.
+ */
+typedef struct memory_arena
+{
+  unsigned char* buffer;
+  size_t capacity;
+  size_t offset;
+  memory_arena_block* overflow;
+  size_t alloc_count;
+  size_t overflow_count;
+  size_t high_water_mark;
+} memory_arena;
+
+/**
+ * @brief Initializes a memory_arena with a buffer of the given capacity. The memory_arena must be
+ * freed with memory_arena_destroy().
+ *
+ * @param arena The memory_arena to initialize.
+ * @param capacity The size in bytes of the arena buffer.
+ * @return int 0 on success, -1 on failure.
+ */
+int memory_arena_init(memory_arena* arena, size_t capacity);
+
+/**
+ * @brief Allocates memory from the arena, aligned to MEMORY_ARENA_ALIGNMENT.
+ *
+ * @param arena The memory_arena to allocate from.
+ * @param size The number of bytes to allocate.
+ * @return void* The allocated memory, or NULL if the heap fallback failed.
+ */
+void* memory_arena_alloc(memory_arena* arena, size_t size);
+
+/**
+ * @brief Releases every allocation made since the last reset. This doesn't touch the arena buffer,
+ * so it's O(1) unless allocations overflowed to the heap.
+ *
+ * @param arena The memory_arena to reset.
+ */
+void memory_arena_reset(memory_arena* arena);
+
+/**
+ * @brief Frees the arena buffer and any heap fallback allocations.
+ *
+ * @param arena The memory_arena to free.
+ */
+void memory_arena_destroy(memory_arena* arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMORY_ARENA_H */
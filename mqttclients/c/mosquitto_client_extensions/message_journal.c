@@ -0,0 +1,1264 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "extensions_internal.h"
+#include "logging.h"
+#include "message_journal.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define SEGMENT_MAGIC "MQJRNL01"
+#define SEGMENT_HEADER_SIZE 64
+#define SEGMENT_NUMBER_DIGITS 20
+#define SEGMENT_EXTENSION ".journal"
+#define INDEX_EXTENSION ".index"
+#define RECORD_ALIGNMENT 8
+#define INITIAL_INDEX_CAPACITY 16
+
+/* Records are 8 byte aligned, so the header of the next record can be read in place. */
+typedef struct segment_header
+{
+  char magic[8];
+  uint64_t number;
+  /* Receive time of the first record, 0 while the segment is empty. */
+  int64_t first_timestamp_ns;
+  uint8_t reserved[SEGMENT_HEADER_SIZE - 24];
+} segment_header;
+
+/* Followed by the topic, the encoded properties, the payload and zero padding. A length of 0 marks
+ * the end of the records of a segment. */
+typedef struct record_header
+{
+  uint32_t length;
+  /* FNV-1a of the record after this field, padding included. */
+  uint32_t checksum;
+  int64_t timestamp_ns;
+  uint64_t sequence;
+  uint16_t topic_length;
+  uint8_t qos;
+  uint8_t retain;
+  uint32_t properties_length;
+  uint32_t payload_length;
+  uint32_t reserved;
+} record_header;
+
+/* Properties are encoded as an identifier byte, a 32 bit value length and the value. Numbers are
+ * stored as 32 bits, string pairs as a 16 bit name length, the name and the value. */
+#define PROPERTY_HEADER_SIZE (1 + sizeof(uint32_t))
+
+static size_t _align(size_t length)
+{
+  return (length + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1);
+}
+
+static void _file_path(
+    char* path,
+    size_t path_size,
+    const char* directory,
+    uint64_t number,
+    const char* extension)
+{
+  snprintf(
+      path,
+      path_size,
+      "%s/%0*llu%s",
+      directory,
+      SEGMENT_NUMBER_DIGITS,
+      (unsigned long long)number,
+      extension);
+}
+
+static int _compare_numbers(const void* a, const void* b)
+{
+  uint64_t left = *(const uint64_t*)a;
+  uint64_t right = *(const uint64_t*)b;
+  return left < right ? -1 : left > right;
+}
+
+/* Lists the numbers of the segments of a journal in ascending order. */
+static int _list_segments(const char* directory, uint64_t** numbers, size_t* count)
+{
+  DIR* dir;
+  struct dirent* entry;
+  size_t capacity = 0;
+
+  *numbers = NULL;
+  *count = 0;
+
+  if ((dir = opendir(directory)) == NULL)
+  {
+    LOG_ERROR("Failed to open journal directory %s: %s", directory, strerror(errno));
+    return -1;
+  }
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    char* end;
+    unsigned long long number = strtoull(entry->d_name, &end, 10);
+
+    if (end - entry->d_name != SEGMENT_NUMBER_DIGITS || strcmp(end, SEGMENT_EXTENSION) != 0)
+    {
+      continue;
+    }
+
+    if (*count == capacity)
+    {
+      size_t new_capacity = capacity == 0 ? INITIAL_INDEX_CAPACITY : capacity * 2;
+      uint64_t* new_numbers = realloc(*numbers, new_capacity * sizeof(uint64_t));
+      if (new_numbers == NULL)
+      {
+        LOG_ERROR("Failed to allocate memory for journal segments");
+        free(*numbers);
+        *numbers = NULL;
+        *count = 0;
+        closedir(dir);
+        return -1;
+      }
+      *numbers = new_numbers;
+      capacity = new_capacity;
+    }
+    (*numbers)[(*count)++] = number;
+  }
+  closedir(dir);
+
+  if (*count > 0)
+  {
+    qsort(*numbers, *count, sizeof(uint64_t), _compare_numbers);
+  }
+  return 0;
+}
+
+/* Checks that the record at offset is complete, ex. it was not torn by a crash while it was being
+ * written. expected_sequence is 0 when any sequence is accepted. */
+static bool _record_valid(
+    const uint8_t* base,
+    size_t size,
+    size_t offset,
+    uint32_t length,
+    uint64_t expected_sequence)
+{
+  const record_header* header = (const record_header*)(base + offset);
+
+  if (length < sizeof(record_header) || length % RECORD_ALIGNMENT != 0 || length > size - offset)
+  {
+    return false;
+  }
+  if (sizeof(record_header) + (size_t)header->topic_length + header->properties_length
+          + header->payload_length
+      > length)
+  {
+    return false;
+  }
+  if (expected_sequence != 0 && header->sequence != expected_sequence)
+  {
+    return false;
+  }
+  return fnv1a_32(
+             FNV1A_32_INIT, base + offset + 2 * sizeof(uint32_t), length - 2 * sizeof(uint32_t))
+      == header->checksum;
+}
+
+static void _segment_close(message_journal_segment* segment)
+{
+  if (segment->base != NULL)
+  {
+    munmap(segment->base, segment->size);
+  }
+  if (segment->fd >= 0)
+  {
+    close(segment->fd);
+  }
+  if (segment->index_fd >= 0)
+  {
+    close(segment->index_fd);
+  }
+  free(segment->pending_index);
+  free(segment);
+}
+
+static void _segment_remove(const char* directory, message_journal_segment* segment)
+{
+  char path[PATH_MAX];
+  uint64_t number = segment->number;
+
+  _segment_close(segment);
+  _file_path(path, sizeof(path), directory, number, SEGMENT_EXTENSION);
+  unlink(path);
+  _file_path(path, sizeof(path), directory, number, INDEX_EXTENSION);
+  unlink(path);
+}
+
+/* Opens a segment, creating and preallocating it if it does not exist. Preallocating the blocks
+ * means that appends never wait on the file system to allocate space, and that a full disk is
+ * reported here rather than as a SIGBUS when the mapping is written. */
+static message_journal_segment* _segment_open(const char* directory, uint64_t number, size_t size)
+{
+  char path[PATH_MAX];
+  struct stat status;
+  segment_header* header;
+  message_journal_segment* segment = calloc(1, sizeof(message_journal_segment));
+  int rc;
+
+  if (segment == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for journal segment");
+    return NULL;
+  }
+  segment->number = number;
+  segment->fd = -1;
+  segment->index_fd = -1;
+  segment->write_offset = SEGMENT_HEADER_SIZE;
+  segment->last_index_offset = SIZE_MAX;
+
+  _file_path(path, sizeof(path), directory, number, SEGMENT_EXTENSION);
+  if ((segment->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(segment->fd, &status) != 0)
+  {
+    LOG_ERROR("Failed to open journal segment %s: %s", path, strerror(errno));
+    _segment_close(segment);
+    return NULL;
+  }
+
+  if (status.st_size == 0)
+  {
+    if ((rc = posix_fallocate(segment->fd, 0, (off_t)size)) != 0)
+    {
+      LOG_ERROR("Failed to allocate journal segment %s: %s", path, strerror(rc));
+      _segment_close(segment);
+      unlink(path);
+      return NULL;
+    }
+  }
+  else
+  {
+    size = (size_t)status.st_size;
+  }
+
+  if (size < SEGMENT_HEADER_SIZE
+      || (segment->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0))
+          == MAP_FAILED)
+  {
+    LOG_ERROR("Failed to map journal segment %s", path);
+    segment->base = NULL;
+    _segment_close(segment);
+    return NULL;
+  }
+  segment->size = size;
+
+  header = (segment_header*)segment->base;
+  if (status.st_size == 0)
+  {
+    memcpy(header->magic, SEGMENT_MAGIC, sizeof(header->magic));
+    header->number = number;
+  }
+  else if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(header->magic)) != 0
+           || header->number != number)
+  {
+    LOG_ERROR("Journal segment %s has an invalid header", path);
+    _segment_close(segment);
+    return NULL;
+  }
+
+  _file_path(path, sizeof(path), directory, number, INDEX_EXTENSION);
+  if ((segment->index_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0)
+  {
+    LOG_ERROR("Failed to open journal index %s: %s", path, strerror(errno));
+    _segment_close(segment);
+    return NULL;
+  }
+  return segment;
+}
+
+/* Clears the pages after the last complete record, so that records left over from before a crash
+ * can not be mistaken for records appended after recovery. Pages that are already zero are only
+ * read, to avoid dirtying the whole segment. */
+static void _segment_clear_tail(message_journal_segment* segment)
+{
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t offset = segment->write_offset;
+
+  while (offset < segment->size)
+  {
+    size_t end = (offset / page_size + 1) * page_size;
+    size_t i;
+
+    if (end > segment->size)
+    {
+      end = segment->size;
+    }
+    for (i = offset; i < end && segment->base[i] == 0; i++)
+    {
+    }
+    if (i < end)
+    {
+      memset(segment->base + offset, 0, end - offset);
+    }
+    offset = end;
+  }
+  msync(segment->base, segment->size, MS_SYNC);
+}
+
+/* Finds the end of the complete records of a segment and drops the index entries past it. */
+static int _segment_recover(message_journal_segment* segment, uint64_t* last_sequence)
+{
+  segment_header* header = (segment_header*)segment->base;
+  message_journal_index_entry entry;
+  uint64_t expected_sequence = 0;
+  size_t offset = SEGMENT_HEADER_SIZE;
+  size_t index_count = 0;
+
+  while (offset + sizeof(record_header) <= segment->size)
+  {
+    const record_header* record = (const record_header*)(segment->base + offset);
+    if (!_record_valid(segment->base, segment->size, offset, record->length, expected_sequence))
+    {
+      break;
+    }
+    expected_sequence = record->sequence + 1;
+    offset += record->length;
+  }
+
+  segment->write_offset = offset;
+  if (expected_sequence == 0)
+  {
+    header->first_timestamp_ns = 0;
+  }
+  else
+  {
+    *last_sequence = expected_sequence - 1;
+  }
+  _segment_clear_tail(segment);
+  segment->synced_offset = segment->write_offset;
+
+  while (pread(
+             segment->index_fd,
+             &entry,
+             sizeof(entry),
+             (off_t)(index_count * sizeof(entry)))
+             == sizeof(entry)
+         && entry.offset < segment->write_offset)
+  {
+    segment->last_index_offset = entry.offset;
+    index_count++;
+  }
+  if (ftruncate(segment->index_fd, (off_t)(index_count * sizeof(entry))) != 0)
+  {
+    LOG_ERROR("Failed to truncate journal index: %s", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* Writes the appended records up to end and their index entries to disk. Index entries are
+ * written after the records they point to, so they never point past the end of a segment. */
+static int _segment_sync(
+    message_journal_segment* segment,
+    size_t end,
+    const message_journal_index_entry* entries,
+    size_t entry_count)
+{
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t start = segment->synced_offset / page_size * page_size;
+  int result = 0;
+
+  if (end > segment->synced_offset)
+  {
+    if (msync(segment->base + start, end - start, MS_SYNC) != 0)
+    {
+      LOG_ERROR("Failed to sync journal segment: %s", strerror(errno));
+      result = -1;
+    }
+    segment->synced_offset = end;
+  }
+
+  if (entry_count > 0)
+  {
+    size_t length = entry_count * sizeof(message_journal_index_entry);
+    if (write(segment->index_fd, entries, length) != (ssize_t)length
+        || fdatasync(segment->index_fd) != 0)
+    {
+      LOG_ERROR("Failed to write journal index: %s", strerror(errno));
+      result = -1;
+    }
+  }
+  return result;
+}
+
+/* Group commit: waits until sync_batch records are pending, sync_interval_ms have passed since the
+ * first pending record or a segment was sealed, then syncs everything appended so far at once. The
+ * lock is only held to take a snapshot of the pending work, never while syncing. */
+static void* _sync_thread(void* arg)
+{
+  message_journal* journal = arg;
+  int64_t interval_ns = (int64_t)journal->options.sync_interval_ms * 1000000;
+  bool stopping = false;
+
+  pthread_mutex_lock(&journal->lock);
+  while (!stopping)
+  {
+    message_journal_segment* active;
+    message_journal_segment* sealed;
+    message_journal_segment* spare = NULL;
+    message_journal_index_entry* entries;
+    size_t entry_count;
+    size_t end;
+    bool need_spare;
+    int64_t start;
+    int64_t duration;
+
+    if (!journal->stopping && journal->sealed == NULL
+        && journal->pending_records < journal->options.sync_batch
+        && (journal->spare != NULL || journal->spare_failed))
+    {
+      if (journal->pending_records == 0)
+      {
+        pthread_cond_wait(&journal->wake, &journal->lock);
+        continue;
+      }
+
+      int64_t deadline = journal->first_pending_ns + interval_ns;
+      if (monotonic_ns() < deadline)
+      {
+        struct timespec timeout
+            = { .tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000 };
+        pthread_cond_timedwait(&journal->wake, &journal->lock, &timeout);
+        continue;
+      }
+    }
+
+    stopping = journal->stopping;
+    active = journal->active;
+    end = active->write_offset;
+    entries = active->pending_index;
+    entry_count = active->pending_index_count;
+    active->pending_index = NULL;
+    active->pending_index_count = 0;
+    active->pending_index_capacity = 0;
+    sealed = journal->sealed;
+    journal->sealed = NULL;
+    journal->pending_records = 0;
+    need_spare = !stopping && journal->spare == NULL && !journal->spare_failed;
+    pthread_mutex_unlock(&journal->lock);
+
+    start = monotonic_ns();
+    while (sealed != NULL)
+    {
+      message_journal_segment* next = sealed->next;
+      _segment_sync(
+          sealed, sealed->write_offset, sealed->pending_index, sealed->pending_index_count);
+      _segment_close(sealed);
+      sealed = next;
+    }
+    _segment_sync(active, end, entries, entry_count);
+    free(entries);
+    duration = monotonic_ns() - start;
+
+    if (need_spare)
+    {
+      spare = _segment_open(
+          journal->options.directory, active->number + 1, journal->options.segment_size);
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->syncs++;
+    if (duration > journal->max_sync_ns)
+    {
+      journal->max_sync_ns = duration;
+    }
+    if (need_spare)
+    {
+      journal->spare = spare;
+      journal->spare_failed = spare == NULL;
+      pthread_cond_broadcast(&journal->spare_ready);
+    }
+  }
+  pthread_mutex_unlock(&journal->lock);
+  return NULL;
+}
+
+/* Replaces the full active segment with the spare one. Only waits if the sync thread has not
+ * created the spare segment yet, ex. when segments fill faster than they can be created. */
+static int _roll_segment(message_journal* journal)
+{
+  int result = 0;
+
+  pthread_mutex_lock(&journal->lock);
+  while (journal->spare == NULL && !journal->spare_failed)
+  {
+    pthread_cond_signal(&journal->wake);
+    pthread_cond_wait(&journal->spare_ready, &journal->lock);
+  }
+
+  if (journal->spare == NULL)
+  {
+    /* Retry on the next append that does not fit. */
+    journal->spare_failed = false;
+    result = -1;
+  }
+  else
+  {
+    journal->active->next = journal->sealed;
+    journal->sealed = journal->active;
+    journal->active = journal->spare;
+    journal->spare = NULL;
+  }
+  pthread_cond_signal(&journal->wake);
+  pthread_mutex_unlock(&journal->lock);
+  return result;
+}
+
+static int _reserve_scratch(message_journal* journal, size_t length)
+{
+  if (length > journal->scratch_capacity)
+  {
+    size_t capacity = journal->scratch_capacity == 0 ? 256 : journal->scratch_capacity;
+    uint8_t* scratch;
+
+    while (capacity < length)
+    {
+      capacity *= 2;
+    }
+    if ((scratch = realloc(journal->scratch, capacity)) == NULL)
+    {
+      return -1;
+    }
+    journal->scratch = scratch;
+    journal->scratch_capacity = capacity;
+  }
+  return 0;
+}
+
+static int _put_property(
+    message_journal* journal,
+    size_t* used,
+    int identifier,
+    const void* name,
+    uint16_t name_length,
+    const void* value,
+    uint32_t value_length)
+{
+  uint32_t length = value_length + (name != NULL ? sizeof(uint16_t) + name_length : 0);
+  uint8_t* out;
+
+  if (_reserve_scratch(journal, *used + PROPERTY_HEADER_SIZE + length) != 0)
+  {
+    return -1;
+  }
+
+  out = journal->scratch + *used;
+  *out++ = (uint8_t)identifier;
+  memcpy(out, &length, sizeof(length));
+  out += sizeof(length);
+  if (name != NULL)
+  {
+    memcpy(out, &name_length, sizeof(name_length));
+    out += sizeof(name_length);
+    memcpy(out, name, name_length);
+    out += name_length;
+  }
+  memcpy(out, value, value_length);
+  *used += PROPERTY_HEADER_SIZE + length;
+  return 0;
+}
+
+/* Encodes the properties a PUBLISH can carry into the scratch buffer. */
+static int _encode_properties(
+    message_journal* journal,
+    const mosquitto_property* props,
+    size_t* length)
+{
+  const mosquitto_property* prop;
+  int result = 0;
+
+  *length = 0;
+  for (prop = props; prop != NULL && result == 0; prop = mosquitto_property_next(prop))
+  {
+    int identifier = mosquitto_property_identifier(prop);
+    uint8_t byte_value = 0;
+    uint16_t int16_value = 0;
+    uint32_t number = 0;
+    char* name = NULL;
+    char* value = NULL;
+    void* binary = NULL;
+    uint16_t binary_length = 0;
+
+    switch (identifier)
+    {
+      case MQTT_PROP_PAYLOAD_FORMAT_INDICATOR:
+        mosquitto_property_read_byte(prop, identifier, &byte_value, false);
+        number = byte_value;
+        result = _put_property(journal, length, identifier, NULL, 0, &number, sizeof(number));
+        break;
+      case MQTT_PROP_TOPIC_ALIAS:
+        mosquitto_property_read_int16(prop, identifier, &int16_value, false);
+        number = int16_value;
+        result = _put_property(journal, length, identifier, NULL, 0, &number, sizeof(number));
+        break;
+      case MQTT_PROP_MESSAGE_EXPIRY_INTERVAL:
+        mosquitto_property_read_int32(prop, identifier, &number, false);
+        result = _put_property(journal, length, identifier, NULL, 0, &number, sizeof(number));
+        break;
+      case MQTT_PROP_SUBSCRIPTION_IDENTIFIER:
+        mosquitto_property_read_varint(prop, identifier, &number, false);
+        result = _put_property(journal, length, identifier, NULL, 0, &number, sizeof(number));
+        break;
+      case MQTT_PROP_CONTENT_TYPE:
+      case MQTT_PROP_RESPONSE_TOPIC:
+        if (mosquitto_property_read_string(prop, identifier, &value, false) != NULL)
+        {
+          result = _put_property(
+              journal, length, identifier, NULL, 0, value, (uint32_t)strlen(value));
+        }
+        break;
+      case MQTT_PROP_CORRELATION_DATA:
+        if (mosquitto_property_read_binary(prop, identifier, &binary, &binary_length, false)
+            != NULL)
+        {
+          result = _put_property(journal, length, identifier, NULL, 0, binary, binary_length);
+        }
+        break;
+      case MQTT_PROP_USER_PROPERTY:
+        if (mosquitto_property_read_string_pair(prop, identifier, &name, &value, false) != NULL)
+        {
+          result = _put_property(
+              journal,
+              length,
+              identifier,
+              name,
+              (uint16_t)strlen(name),
+              value,
+              (uint32_t)strlen(value));
+        }
+        break;
+      default:
+        break;
+    }
+
+    free(name);
+    free(value);
+    free(binary);
+  }
+  return result;
+}
+
+int message_journal_open(message_journal* journal, const message_journal_options* options)
+{
+  uint64_t* numbers;
+  size_t count;
+  uint64_t last_sequence = 0;
+  message_journal_segment* segment = NULL;
+  pthread_condattr_t condattr;
+
+  memset(journal, 0, sizeof(message_journal));
+  journal->options = *options;
+  if (journal->options.segment_size == 0)
+  {
+    journal->options.segment_size = MESSAGE_JOURNAL_DEFAULT_SEGMENT_SIZE;
+  }
+  if (journal->options.sync_batch == 0)
+  {
+    journal->options.sync_batch = MESSAGE_JOURNAL_DEFAULT_SYNC_BATCH;
+  }
+  if (journal->options.sync_interval_ms == 0)
+  {
+    journal->options.sync_interval_ms = MESSAGE_JOURNAL_DEFAULT_SYNC_INTERVAL_MS;
+  }
+  if (journal->options.index_interval == 0)
+  {
+    journal->options.index_interval = MESSAGE_JOURNAL_DEFAULT_INDEX_INTERVAL;
+  }
+  if (journal->options.segment_size <= SEGMENT_HEADER_SIZE + sizeof(record_header))
+  {
+    LOG_ERROR("Journal segment size %zu is too small", journal->options.segment_size);
+    return -1;
+  }
+
+  if (mkdir(options->directory, 0755) != 0 && errno != EEXIST)
+  {
+    LOG_ERROR("Failed to create journal directory %s: %s", options->directory, strerror(errno));
+    return -1;
+  }
+  if (_list_segments(options->directory, &numbers, &count) != 0)
+  {
+    return -1;
+  }
+
+  /* Resume in the last segment holding records. Trailing empty segments are spare segments
+   * created ahead of time by a previous run. */
+  while (count > 0)
+  {
+    if ((segment = _segment_open(
+             options->directory, numbers[count - 1], journal->options.segment_size))
+            == NULL
+        || _segment_recover(segment, &last_sequence) != 0)
+    {
+      if (segment != NULL)
+      {
+        _segment_close(segment);
+      }
+      free(numbers);
+      return -1;
+    }
+    if (segment->write_offset > SEGMENT_HEADER_SIZE || count == 1)
+    {
+      break;
+    }
+    _segment_remove(options->directory, segment);
+    segment = NULL;
+    count--;
+  }
+  free(numbers);
+
+  if (segment == NULL
+      && (segment = _segment_open(options->directory, 0, journal->options.segment_size)) == NULL)
+  {
+    return -1;
+  }
+  journal->active = segment;
+  journal->next_sequence = last_sequence + 1;
+
+  pthread_condattr_init(&condattr);
+  pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&journal->lock, NULL);
+  pthread_cond_init(&journal->wake, &condattr);
+  pthread_cond_init(&journal->spare_ready, NULL);
+  pthread_condattr_destroy(&condattr);
+
+  if (pthread_create(&journal->sync_thread, NULL, _sync_thread, journal) != 0)
+  {
+    LOG_ERROR("Failed to start journal sync thread");
+    pthread_cond_destroy(&journal->spare_ready);
+    pthread_cond_destroy(&journal->wake);
+    pthread_mutex_destroy(&journal->lock);
+    _segment_close(segment);
+    return -1;
+  }
+  return 0;
+}
+
+int message_journal_open_from_env(message_journal* journal)
+{
+  message_journal_options options = { 0 };
+  char* directory = NULL;
+  int segment_mb;
+  int sync_batch;
+  int sync_interval_ms;
+
+  if (!set_char_connection_setting(&directory, "JOURNAL_DIR", false) || directory == NULL)
+  {
+    return 0;
+  }
+  if (!set_int_connection_setting(
+          &segment_mb, "JOURNAL_SEGMENT_MB", MESSAGE_JOURNAL_DEFAULT_SEGMENT_SIZE / (1024 * 1024))
+      || !set_int_connection_setting(
+          &sync_batch, "JOURNAL_SYNC_BATCH", MESSAGE_JOURNAL_DEFAULT_SYNC_BATCH)
+      || !set_int_connection_setting(
+          &sync_interval_ms, "JOURNAL_SYNC_INTERVAL_MS", MESSAGE_JOURNAL_DEFAULT_SYNC_INTERVAL_MS)
+      || segment_mb <= 0 || sync_batch <= 0 || sync_interval_ms <= 0)
+  {
+    LOG_ERROR("Invalid journal settings");
+    return -1;
+  }
+
+  options.directory = directory;
+  options.segment_size = (size_t)segment_mb * 1024 * 1024;
+  options.sync_batch = (uint32_t)sync_batch;
+  options.sync_interval_ms = (uint32_t)sync_interval_ms;
+  return message_journal_open(journal, &options) == 0 ? 1 : -1;
+}
+
+int message_journal_append(
+    message_journal* journal,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    int64_t timestamp_ns)
+{
+  message_journal_segment* segment = journal->active;
+  size_t topic_length = strlen(message->topic);
+  size_t payload_length = message->payloadlen > 0 ? (size_t)message->payloadlen : 0;
+  size_t properties_length = 0;
+  size_t length;
+  size_t offset;
+  record_header header;
+  uint8_t* record;
+
+  if (topic_length > UINT16_MAX
+      || (props != NULL && _encode_properties(journal, props, &properties_length) != 0))
+  {
+    journal->dropped++;
+    return -1;
+  }
+
+  length = _align(sizeof(record_header) + topic_length + properties_length + payload_length);
+  if (length > journal->options.segment_size - SEGMENT_HEADER_SIZE)
+  {
+    LOG_ERROR("Message of %zu bytes does not fit in a journal segment", payload_length);
+    journal->dropped++;
+    return -1;
+  }
+  if (segment->write_offset + length > segment->size)
+  {
+    if (_roll_segment(journal) != 0)
+    {
+      journal->dropped++;
+      return -1;
+    }
+    segment = journal->active;
+  }
+
+  offset = segment->write_offset;
+  record = segment->base + offset;
+  header = (record_header){ .length = 0,
+                            .timestamp_ns = timestamp_ns,
+                            .sequence = journal->next_sequence,
+                            .topic_length = (uint16_t)topic_length,
+                            .qos = (uint8_t)message->qos,
+                            .retain = message->retain,
+                            .properties_length = (uint32_t)properties_length,
+                            .payload_length = (uint32_t)payload_length };
+
+  /* The padding of the record is already zero, segments are only written once. */
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), message->topic, topic_length);
+  if (properties_length > 0)
+  {
+    memcpy(record + sizeof(header) + topic_length, journal->scratch, properties_length);
+  }
+  if (payload_length > 0)
+  {
+    memcpy(
+        record + sizeof(header) + topic_length + properties_length,
+        message->payload,
+        payload_length);
+  }
+  ((record_header*)record)->checksum
+      = fnv1a_32(FNV1A_32_INIT, record + 2 * sizeof(uint32_t), length - 2 * sizeof(uint32_t));
+  if (offset == SEGMENT_HEADER_SIZE)
+  {
+    ((segment_header*)segment->base)->first_timestamp_ns = timestamp_ns;
+  }
+  /* Readers of the mapping only see the record once it is complete. */
+  __atomic_store_n(&((record_header*)record)->length, (uint32_t)length, __ATOMIC_RELEASE);
+  journal->next_sequence++;
+
+  pthread_mutex_lock(&journal->lock);
+  segment->write_offset = offset + length;
+  if (segment->last_index_offset == SIZE_MAX
+      || offset - segment->last_index_offset >= journal->options.index_interval)
+  {
+    if (segment->pending_index_count == segment->pending_index_capacity)
+    {
+      size_t capacity = segment->pending_index_capacity == 0
+          ? INITIAL_INDEX_CAPACITY
+          : segment->pending_index_capacity * 2;
+      message_journal_index_entry* entries
+          = realloc(segment->pending_index, capacity * sizeof(message_journal_index_entry));
+      if (entries != NULL)
+      {
+        segment->pending_index = entries;
+        segment->pending_index_capacity = capacity;
+      }
+    }
+    /* Without an index entry, seeking scans from the previous entry instead. */
+    if (segment->pending_index_count < segment->pending_index_capacity)
+    {
+      segment->pending_index[segment->pending_index_count++]
+          = (message_journal_index_entry){ .timestamp_ns = timestamp_ns, .offset = offset };
+      segment->last_index_offset = offset;
+    }
+  }
+  journal->appended++;
+  journal->appended_bytes += length;
+  if (journal->pending_records++ == 0)
+  {
+    journal->first_pending_ns = monotonic_ns();
+    pthread_cond_signal(&journal->wake);
+  }
+  else if (journal->pending_records >= journal->options.sync_batch)
+  {
+    pthread_cond_signal(&journal->wake);
+  }
+  pthread_mutex_unlock(&journal->lock);
+  return 0;
+}
+
+void message_journal_close(message_journal* journal)
+{
+  pthread_mutex_lock(&journal->lock);
+  journal->stopping = true;
+  pthread_cond_signal(&journal->wake);
+  pthread_mutex_unlock(&journal->lock);
+  pthread_join(journal->sync_thread, NULL);
+
+  if (journal->spare != NULL)
+  {
+    _segment_remove(journal->options.directory, journal->spare);
+  }
+  _segment_close(journal->active);
+  free(journal->scratch);
+  pthread_cond_destroy(&journal->spare_ready);
+  pthread_cond_destroy(&journal->wake);
+  pthread_mutex_destroy(&journal->lock);
+}
+
+static void _reader_unmap(message_journal_reader* reader)
+{
+  if (reader->base != NULL)
+  {
+    munmap(reader->base, reader->size);
+    reader->base = NULL;
+    reader->size = 0;
+  }
+}
+
+static int _reader_map(message_journal_reader* reader, size_t position)
+{
+  char path[PATH_MAX];
+  struct stat status;
+  int fd;
+  void* base = MAP_FAILED;
+
+  _reader_unmap(reader);
+  reader->segment_position = position;
+  reader->offset = SEGMENT_HEADER_SIZE;
+  reader->next_sequence = 0;
+
+  _file_path(path, sizeof(path), reader->directory, reader->segments[position], SEGMENT_EXTENSION);
+  if ((fd = open(path, O_RDONLY)) >= 0)
+  {
+    if (fstat(fd, &status) == 0 && status.st_size >= SEGMENT_HEADER_SIZE)
+    {
+      base = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+  }
+  if (base == MAP_FAILED)
+  {
+    LOG_ERROR("Failed to map journal segment %s", path);
+    return -1;
+  }
+  reader->base = base;
+  reader->size = (size_t)status.st_size;
+
+  if (memcmp(((const segment_header*)base)->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC) - 1) != 0)
+  {
+    LOG_ERROR("Journal segment %s has an invalid header", path);
+    _reader_unmap(reader);
+    return -1;
+  }
+  return 0;
+}
+
+/* Receive time of the first record of a segment, INT64_MAX for an empty segment. */
+static int64_t _first_timestamp(const message_journal_reader* reader, size_t position)
+{
+  char path[PATH_MAX];
+  segment_header header;
+  int fd;
+  ssize_t length = 0;
+
+  _file_path(path, sizeof(path), reader->directory, reader->segments[position], SEGMENT_EXTENSION);
+  if ((fd = open(path, O_RDONLY)) >= 0)
+  {
+    length = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+  }
+  return length == sizeof(header) && header.first_timestamp_ns != 0 ? header.first_timestamp_ns
+                                                                    : INT64_MAX;
+}
+
+/* Offset of the last indexed record received at or before timestamp_ns. */
+static size_t _index_offset(const message_journal_reader* reader, int64_t timestamp_ns)
+{
+  char path[PATH_MAX];
+  struct stat status;
+  message_journal_index_entry* entries = NULL;
+  size_t count = 0;
+  size_t offset = SEGMENT_HEADER_SIZE;
+  int fd;
+
+  _file_path(
+      path,
+      sizeof(path),
+      reader->directory,
+      reader->segments[reader->segment_position],
+      INDEX_EXTENSION);
+  if ((fd = open(path, O_RDONLY)) < 0)
+  {
+    return offset;
+  }
+  if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(message_journal_index_entry)
+      && (entries = malloc((size_t)status.st_size)) != NULL
+      && pread(fd, entries, (size_t)status.st_size, 0) == status.st_size)
+  {
+    count = (size_t)status.st_size / sizeof(message_journal_index_entry);
+  }
+  close(fd);
+
+  if (count > 0)
+  {
+    size_t low = 0;
+    size_t high = count;
+    while (low < high)
+    {
+      size_t middle = low + (high - low) / 2;
+      if (entries[middle].timestamp_ns <= timestamp_ns)
+      {
+        low = middle + 1;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+    if (low > 0 && entries[low - 1].offset % RECORD_ALIGNMENT == 0
+        && entries[low - 1].offset < reader->size)
+    {
+      offset = (size_t)entries[low - 1].offset;
+    }
+  }
+  free(entries);
+  return offset;
+}
+
+int message_journal_reader_open(message_journal_reader* reader, const char* directory)
+{
+  memset(reader, 0, sizeof(message_journal_reader));
+
+  if ((reader->directory = strdup(directory)) == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for journal reader");
+    return -1;
+  }
+  if (_list_segments(directory, &reader->segments, &reader->segment_count) != 0
+      || (reader->segment_count > 0 && _reader_map(reader, 0) != 0))
+  {
+    message_journal_reader_close(reader);
+    return -1;
+  }
+  return 0;
+}
+
+int message_journal_reader_seek(message_journal_reader* reader, int64_t timestamp_ns)
+{
+  size_t low = 0;
+  size_t high = reader->segment_count;
+  message_journal_record record;
+
+  if (reader->segment_count == 0)
+  {
+    return 0;
+  }
+
+  /* Last segment whose first record was received at or before timestamp_ns. */
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+    if (_first_timestamp(reader, middle) <= timestamp_ns)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  if (_reader_map(reader, low > 0 ? low - 1 : 0) != 0)
+  {
+    return -1;
+  }
+  reader->offset = _index_offset(reader, timestamp_ns);
+
+  /* Scan from the index entry to the first record at or after timestamp_ns. */
+  while (true)
+  {
+    size_t position = reader->segment_position;
+    size_t offset = reader->offset;
+    uint64_t next_sequence = reader->next_sequence;
+    int rc = message_journal_reader_next(reader, &record);
+
+    if (rc <= 0)
+    {
+      return rc;
+    }
+    if (record.timestamp_ns >= timestamp_ns)
+    {
+      if (reader->segment_position != position && _reader_map(reader, position) != 0)
+      {
+        return -1;
+      }
+      reader->offset = offset;
+      reader->next_sequence = next_sequence;
+      return 0;
+    }
+  }
+}
+
+int message_journal_reader_next(message_journal_reader* reader, message_journal_record* record)
+{
+  while (reader->base != NULL)
+  {
+    if (reader->offset + sizeof(record_header) <= reader->size)
+    {
+      const record_header* header = (const record_header*)(reader->base + reader->offset);
+      uint32_t length = __atomic_load_n(&header->length, __ATOMIC_ACQUIRE);
+
+      if (length != 0)
+      {
+        const uint8_t* data = reader->base + reader->offset + sizeof(record_header);
+
+        if (!_record_valid(
+                reader->base, reader->size, reader->offset, length, reader->next_sequence))
+        {
+          /* A torn record at the end of the journal is the tail lost by a crash. */
+          return reader->segment_position + 1 == reader->segment_count ? 0 : -1;
+        }
+
+        record->sequence = header->sequence;
+        record->timestamp_ns = header->timestamp_ns;
+        record->topic = (const char*)data;
+        record->topic_length = header->topic_length;
+        record->qos = header->qos;
+        record->retain = header->retain != 0;
+        record->properties = data + header->topic_length;
+        record->properties_length = header->properties_length;
+        record->payload = data + header->topic_length + header->properties_length;
+        record->payload_length = header->payload_length;
+
+        reader->offset += length;
+        reader->next_sequence = header->sequence + 1;
+        return 1;
+      }
+    }
+
+    if (reader->segment_position + 1 >= reader->segment_count)
+    {
+      return 0;
+    }
+    if (_reader_map(reader, reader->segment_position + 1) != 0)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void message_journal_reader_close(message_journal_reader* reader)
+{
+  _reader_unmap(reader);
+  free(reader->segments);
+  free(reader->directory);
+  memset(reader, 0, sizeof(message_journal_reader));
+}
+
+static int _record_properties(
+    const message_journal_record* record,
+    mosquitto_property** props,
+    bool publish)
+{
+  const uint8_t* data = record->properties;
+  const uint8_t* end = record->properties + record->properties_length;
+  int rc = MOSQ_ERR_SUCCESS;
+
+  while (rc == MOSQ_ERR_SUCCESS && end - data >= (ptrdiff_t)PROPERTY_HEADER_SIZE)
+  {
+    int identifier = data[0];
+    uint32_t length;
+    uint32_t number = 0;
+    uint16_t name_length;
+    char* name = NULL;
+    char* value = NULL;
+
+    memcpy(&length, data + 1, sizeof(length));
+    data += PROPERTY_HEADER_SIZE;
+    if (length > (size_t)(end - data))
+    {
+      return MOSQ_ERR_MALFORMED_PACKET;
+    }
+    if (length == sizeof(number))
+    {
+      memcpy(&number, data, sizeof(number));
+    }
+
+    switch (identifier)
+    {
+      case MQTT_PROP_PAYLOAD_FORMAT_INDICATOR:
+        rc = mosquitto_property_add_byte(props, identifier, (uint8_t)number);
+        break;
+      case MQTT_PROP_TOPIC_ALIAS:
+        /* Aliases and subscription identifiers belong to the connection the record was received
+         * on, a client must not send them. */
+        if (!publish)
+        {
+          rc = mosquitto_property_add_int16(props, identifier, (uint16_t)number);
+        }
+        break;
+      case MQTT_PROP_MESSAGE_EXPIRY_INTERVAL:
+        rc = mosquitto_property_add_int32(props, identifier, number);
+        break;
+      case MQTT_PROP_SUBSCRIPTION_IDENTIFIER:
+        if (!publish)
+        {
+          rc = mosquitto_property_add_varint(props, identifier, number);
+        }
+        break;
+      case MQTT_PROP_CONTENT_TYPE:
+      case MQTT_PROP_RESPONSE_TOPIC:
+        if ((value = strndup((const char*)data, length)) == NULL)
+        {
+          return MOSQ_ERR_NOMEM;
+        }
+        rc = mosquitto_property_add_string(props, identifier, value);
+        break;
+      case MQTT_PROP_CORRELATION_DATA:
+        rc = mosquitto_property_add_binary(props, identifier, data, (uint16_t)length);
+        break;
+      case MQTT_PROP_USER_PROPERTY:
+        memcpy(&name_length, data, sizeof(name_length));
+        if (length < sizeof(name_length) + name_length)
+        {
+          return MOSQ_ERR_MALFORMED_PACKET;
+        }
+        name = strndup((const char*)data + sizeof(name_length), name_length);
+        value = strndup(
+            (const char*)data + sizeof(name_length) + name_length,
+            length - sizeof(name_length) - name_length);
+        rc = name != NULL && value != NULL
+            ? mosquitto_property_add_string_pair(props, identifier, name, value)
+            : MOSQ_ERR_NOMEM;
+        break;
+      default:
+        break;
+    }
+
+    free(name);
+    free(value);
+    data += length;
+  }
+  return rc;
+}
+
+int message_journal_record_properties(
+    const message_journal_record* record,
+    mosquitto_property** props)
+{
+  return _record_properties(record, props, false);
+}
+
+int message_journal_record_publish_properties(
+    const message_journal_record* record,
+    mosquitto_property** props)
+{
+  return _record_properties(record, props, true);
+}
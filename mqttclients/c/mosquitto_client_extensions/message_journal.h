@@ -0,0 +1,226 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MESSAGE_JOURNAL_H
+#define MESSAGE_JOURNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mosquitto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MESSAGE_JOURNAL_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define MESSAGE_JOURNAL_DEFAULT_SYNC_BATCH 256
+#define MESSAGE_JOURNAL_DEFAULT_SYNC_INTERVAL_MS 100
+#define MESSAGE_JOURNAL_DEFAULT_INDEX_INTERVAL (64 * 1024)
+
+/*
+ * Append-only journal of received messages, stored in fixed-size memory-mapped segment files
+ * <directory>/<segment number>.journal. Each segment has a sparse time index in
+ * <segment number>.index, with one entry every index_interval bytes, to seek by receive time
+ * without scanning the segments.
+ *
+ * Appending only copies the message into the mapped segment. A background thread commits the
+ * appended records in groups: it syncs them to disk once sync_batch records are pending or
+ * sync_interval_ms after the first pending record, whichever comes first, so the receiving thread
+ * never waits on the disk. A crash loses at most the records of the last group, and reopening the
+ * journal resumes after the last complete record.
+ */
+typedef struct message_journal_options
+{
+  const char* directory;
+  size_t segment_size;
+  uint32_t sync_batch;
+  uint32_t sync_interval_ms;
+  uint32_t index_interval;
+} message_journal_options;
+
+typedef struct message_journal_index_entry
+{
+  int64_t timestamp_ns;
+  uint64_t offset;
+} message_journal_index_entry;
+
+typedef struct message_journal_segment
+{
+  struct message_journal_segment* next;
+  uint64_t number;
+  int fd;
+  int index_fd;
+  uint8_t* base;
+  size_t size;
+  size_t write_offset;
+  size_t synced_offset;
+  size_t last_index_offset;
+  message_journal_index_entry* pending_index;
+  size_t pending_index_count;
+  size_t pending_index_capacity;
+} message_journal_segment;
+
+typedef struct message_journal
+{
+  message_journal_options options;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t spare_ready;
+  pthread_t sync_thread;
+  bool stopping;
+  /* Segment being appended to, and segments that are full but not synced yet. */
+  message_journal_segment* active;
+  message_journal_segment* sealed;
+  /* Created ahead of time by the sync thread, so appends do not wait on creating files. */
+  message_journal_segment* spare;
+  bool spare_failed;
+  uint64_t next_sequence;
+  /* Properties of the message being appended, encoded before the record is reserved. */
+  uint8_t* scratch;
+  size_t scratch_capacity;
+  uint32_t pending_records;
+  int64_t first_pending_ns;
+  uint64_t appended;
+  uint64_t appended_bytes;
+  uint64_t dropped;
+  uint64_t syncs;
+  int64_t max_sync_ns;
+} message_journal;
+
+/* A record returned by the reader. The pointers are valid until the next call of the reader. */
+typedef struct message_journal_record
+{
+  uint64_t sequence;
+  int64_t timestamp_ns;
+  const char* topic;
+  uint16_t topic_length;
+  int qos;
+  bool retain;
+  const uint8_t* properties;
+  uint32_t properties_length;
+  const void* payload;
+  uint32_t payload_length;
+} message_journal_record;
+
+typedef struct message_journal_reader
+{
+  char* directory;
+  uint64_t* segments;
+  size_t segment_count;
+  size_t segment_position;
+  uint8_t* base;
+  size_t size;
+  size_t offset;
+  uint64_t next_sequence;
+} message_journal_reader;
+
+/**
+ * @brief Opens a journal for appending, creating the directory if needed and resuming after the
+ * last complete record of an existing journal. Unset options (0) take their default value.
+ *
+ * @param journal The message_journal to open.
+ * @param options The directory and commit settings of the journal.
+ * @return int 0 on success, -1 on failure. On success the journal must be closed with
+ * message_journal_close().
+ */
+int message_journal_open(message_journal* journal, const message_journal_options* options);
+
+/**
+ * @brief Opens the journal configured by the JOURNAL_DIR, JOURNAL_SEGMENT_MB, JOURNAL_SYNC_BATCH
+ * and JOURNAL_SYNC_INTERVAL_MS environment variables, if JOURNAL_DIR is set. Must be called after
+ * mqtt_client_init() has loaded the environment.
+ *
+ * @param journal The message_journal to open.
+ * @return int 1 if the journal was opened, 0 if JOURNAL_DIR is not set, -1 on failure.
+ */
+int message_journal_open_from_env(message_journal* journal);
+
+/**
+ * @brief Appends a received message. Must be called from a single thread, ex. the mosquitto loop.
+ *
+ * @param journal The message_journal to append to.
+ * @param message The received message.
+ * @param props The properties of the received message, or NULL.
+ * @param timestamp_ns The time the message was received, in nanoseconds since the Unix epoch.
+ * @return int 0 on success, -1 if the message could not be appended.
+ */
+int message_journal_append(
+    message_journal* journal,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    int64_t timestamp_ns);
+
+/**
+ * @brief Syncs every appended record to disk, stops the sync thread and closes the journal.
+ *
+ * @param journal The message_journal to close.
+ */
+void message_journal_close(message_journal* journal);
+
+/**
+ * @brief Opens the journal in directory for reading, positioned at its first record.
+ *
+ * @param reader The message_journal_reader to open.
+ * @param directory The directory of the journal.
+ * @return int 0 on success, -1 on failure. On success the reader must be closed with
+ * message_journal_reader_close().
+ */
+int message_journal_reader_open(message_journal_reader* reader, const char* directory);
+
+/**
+ * @brief Positions the reader at the first record received at or after timestamp_ns, using the
+ * segment headers and time indexes.
+ *
+ * @param reader The message_journal_reader to position.
+ * @param timestamp_ns The receive time to seek to, in nanoseconds since the Unix epoch.
+ * @return int 0 on success, -1 on failure.
+ */
+int message_journal_reader_seek(message_journal_reader* reader, int64_t timestamp_ns);
+
+/**
+ * @brief Reads the next record.
+ *
+ * @param reader The message_journal_reader to read from.
+ * @param record The record read.
+ * @return int 1 if a record was read, 0 at the end of the journal, -1 on failure.
+ */
+int message_journal_reader_next(message_journal_reader* reader, message_journal_record* record);
+
+/**
+ * @brief Closes a message_journal_reader.
+ *
+ * @param reader The message_journal_reader to close.
+ */
+void message_journal_reader_close(message_journal_reader* reader);
+
+/**
+ * @brief Rebuilds the properties of a record as they were received.
+ *
+ * @param record The record to read the properties of.
+ * @param props The property list to add the properties to.
+ * @return int MOSQ_ERR_SUCCESS on success, other enum mosq_err_t on failure.
+ */
+int message_journal_record_properties(
+    const message_journal_record* record,
+    mosquitto_property** props);
+
+/**
+ * @brief Rebuilds the properties a client may publish a record with, leaving out the topic alias
+ * and subscription identifiers set by the broker it was received from.
+ *
+ * @param record The record to read the properties of.
+ * @param props The property list to add the properties to.
+ * @return int MOSQ_ERR_SUCCESS on success, other enum mosq_err_t on failure.
+ */
+int message_journal_record_publish_properties(
+    const message_journal_record* record,
+    mosquitto_property** props);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MESSAGE_JOURNAL_H */
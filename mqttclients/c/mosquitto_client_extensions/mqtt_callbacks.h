@@ -50,8 +50,8 @@ void on_publish(
     int reason_code,
     const mosquitto_property* props);
 
-#endif /* MQTT_CALLBACKS_H */
-
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif /* MQTT_CALLBACKS_H */
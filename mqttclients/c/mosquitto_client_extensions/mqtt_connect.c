@@ -0,0 +1,399 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "extensions_internal.h"
+#include "latency_histogram.h"
+#include "logging.h"
+#include "mqtt_connect.h"
+
+#define POLL_TIMEOUT_MS 100
+#define NS_PER_MS 1000000
+
+/* A client being connected, found by the connect callback through its mqtt_client_obj. */
+typedef struct mqtt_connect_attempt
+{
+  struct mosquitto* mosq;
+  mqtt_client_obj* obj;
+  mqtt_connect_timing timing;
+  int64_t start_ns;
+  int64_t phase_start_ns;
+  bool done;
+} mqtt_connect_attempt;
+
+/* The clients connected by one thread. */
+typedef struct connect_share
+{
+  mqtt_connect_attempt* attempts;
+  size_t count;
+  int timeout_ms;
+  pthread_t thread;
+  bool started;
+} connect_share;
+
+static const char* phase_names[MQTT_CONNECT_PHASE_COUNT] = { "DNS", "TCP", "TLS", "CONNACK" };
+
+static void _end_phase(mqtt_connect_attempt* attempt, mqtt_connect_phase next)
+{
+  int64_t now = monotonic_ns();
+
+  attempt->timing.phase_ns[attempt->timing.phase] = now - attempt->phase_start_ns;
+  attempt->timing.phase = next;
+  attempt->phase_start_ns = now;
+}
+
+/* Ends the current phase, which keeps the time until the failure if the connect failed. */
+static void _finish(mqtt_connect_attempt* attempt, int result)
+{
+  int64_t now = monotonic_ns();
+
+  if (attempt->done)
+  {
+    return;
+  }
+  attempt->timing.phase_ns[attempt->timing.phase] = now - attempt->phase_start_ns;
+  attempt->timing.total_ns = now - attempt->start_ns;
+  attempt->timing.result = result;
+  if (result == MOSQ_ERR_SUCCESS)
+  {
+    attempt->timing.phase = MQTT_CONNECT_PHASE_COUNT;
+  }
+  attempt->done = true;
+}
+
+/* Replaces the connect callback of the client while it connects, then calls it. */
+static void _on_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  mqtt_client_obj* client_obj = (mqtt_client_obj*)obj;
+  mqtt_connect_attempt* attempt = client_obj->connect_attempt;
+
+  if (attempt != NULL)
+  {
+    /* Should the end of the handshake have gone unseen, the TLS phase lasts until the CONNACK. */
+    attempt->timing.reason_code = reason_code;
+    _finish(attempt, reason_code == 0 ? MOSQ_ERR_SUCCESS : MOSQ_ERR_CONN_REFUSED);
+  }
+  if (client_obj->on_connect != NULL)
+  {
+    client_obj->on_connect(mosq, obj, reason_code, flags, props);
+  }
+}
+
+static void _start(mqtt_connect_attempt* attempt)
+{
+  int rc;
+
+  attempt->start_ns = attempt->phase_start_ns = monotonic_ns();
+  attempt->timing.phase = MQTT_CONNECT_PHASE_DNS;
+  if ((attempt->obj = mosquitto_userdata(attempt->mosq)) == NULL)
+  {
+    _finish(attempt, MOSQ_ERR_INVAL);
+    return;
+  }
+  attempt->obj->connect_attempt = attempt;
+  mosquitto_connect_v5_callback_set(attempt->mosq, _on_connect);
+
+  if ((rc = mosquitto_connect_bind_async(
+           attempt->mosq,
+           attempt->obj->hostname,
+           attempt->obj->tcp_port,
+           attempt->obj->keep_alive_in_seconds,
+           NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    /* Only MOSQ_ERR_EAI comes from resolving, the connect may also be refused before returning,
+     * ex. on loopback. */
+    if (rc != MOSQ_ERR_EAI)
+    {
+      _end_phase(attempt, MQTT_CONNECT_PHASE_TCP);
+    }
+    _finish(attempt, rc);
+    return;
+  }
+  _end_phase(attempt, MQTT_CONNECT_PHASE_TCP);
+}
+
+/* Hands the socket to mosquitto once it is ready, and moves to the next phase. */
+static void _drive(mqtt_connect_attempt* attempt, short revents)
+{
+  int rc = MOSQ_ERR_SUCCESS;
+
+  if (attempt->timing.phase == MQTT_CONNECT_PHASE_TCP)
+  {
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (getsockopt(mosquitto_socket(attempt->mosq), SOL_SOCKET, SO_ERROR, &error, &length) != 0
+        || error != 0)
+    {
+      errno = error != 0 ? error : errno;
+      _finish(attempt, MOSQ_ERR_ERRNO);
+      return;
+    }
+    _end_phase(
+        attempt, attempt->obj->use_TLS ? MQTT_CONNECT_PHASE_TLS : MQTT_CONNECT_PHASE_CONNACK);
+  }
+
+  /* During the handshake, mosquitto_loop_read() continues it whichever way the socket is ready. */
+  if ((revents & (POLLIN | POLLERR | POLLHUP))
+      || (attempt->timing.phase == MQTT_CONNECT_PHASE_TLS && (revents & POLLOUT)))
+  {
+    rc = mosquitto_loop_read(attempt->mosq, 1);
+    /* mosquitto only wants to write the queued CONNECT once the handshake is done. */
+    if (rc == MOSQ_ERR_SUCCESS && !attempt->done
+        && attempt->timing.phase == MQTT_CONNECT_PHASE_TLS && (revents & POLLIN)
+        && mosquitto_want_write(attempt->mosq))
+    {
+      _end_phase(attempt, MQTT_CONNECT_PHASE_CONNACK);
+    }
+  }
+  if (rc == MOSQ_ERR_SUCCESS && !attempt->done && (revents & POLLOUT))
+  {
+    rc = mosquitto_loop_write(attempt->mosq, 1);
+  }
+  if (rc == MOSQ_ERR_SUCCESS && !attempt->done)
+  {
+    rc = mosquitto_loop_misc(attempt->mosq);
+  }
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    _finish(attempt, rc);
+  }
+}
+
+/* Starts every connect of the share, then polls the sockets until they are all done. */
+static void _connect_share(connect_share* share)
+{
+  struct pollfd* fds = calloc(share->count, sizeof(struct pollfd));
+  mqtt_connect_attempt** polled = calloc(share->count, sizeof(mqtt_connect_attempt*));
+  int64_t deadline_ns = monotonic_ns() + (int64_t)share->timeout_ms * NS_PER_MS;
+  int unfinished = MOSQ_ERR_TIMEOUT;
+
+  if (fds == NULL || polled == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    for (size_t i = 0; i < share->count; i++)
+    {
+      share->attempts[i].timing.result = MOSQ_ERR_NOMEM;
+    }
+    free(fds);
+    free(polled);
+    return;
+  }
+  for (size_t i = 0; i < share->count; i++)
+  {
+    _start(&share->attempts[i]);
+  }
+
+  while (keep_running)
+  {
+    int64_t remaining_ms = (deadline_ns - monotonic_ns()) / NS_PER_MS;
+    nfds_t fd_count = 0;
+
+    for (size_t i = 0; i < share->count; i++)
+    {
+      mqtt_connect_attempt* attempt = &share->attempts[i];
+      int fd;
+
+      if (attempt->done)
+      {
+        continue;
+      }
+      if ((fd = mosquitto_socket(attempt->mosq)) < 0)
+      {
+        _finish(attempt, MOSQ_ERR_NO_CONN);
+        continue;
+      }
+      fds[fd_count].fd = fd;
+      fds[fd_count].events = attempt->timing.phase == MQTT_CONNECT_PHASE_TCP
+          ? POLLOUT
+          : POLLIN | (mosquitto_want_write(attempt->mosq) ? POLLOUT : 0);
+      fds[fd_count].revents = 0;
+      polled[fd_count++] = attempt;
+    }
+    if (fd_count == 0 || remaining_ms <= 0)
+    {
+      break;
+    }
+
+    if (poll(fds, fd_count, remaining_ms < POLL_TIMEOUT_MS ? (int)remaining_ms : POLL_TIMEOUT_MS)
+        < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      LOG_ERROR("Failed to poll the connecting clients: %s", strerror(errno));
+      unfinished = MOSQ_ERR_ERRNO;
+      break;
+    }
+    for (nfds_t i = 0; i < fd_count; i++)
+    {
+      if (fds[i].revents != 0)
+      {
+        _drive(polled[i], fds[i].revents);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < share->count; i++)
+  {
+    mqtt_connect_attempt* attempt = &share->attempts[i];
+
+    _finish(attempt, unfinished);
+    if (attempt->obj != NULL)
+    {
+      mosquitto_connect_v5_callback_set(attempt->mosq, attempt->obj->on_connect);
+      attempt->obj->connect_attempt = NULL;
+    }
+  }
+  free(fds);
+  free(polled);
+}
+
+static void* _connect_thread(void* argument)
+{
+  _connect_share(argument);
+  return NULL;
+}
+
+size_t mqtt_client_connect_all(
+    struct mosquitto** clients,
+    size_t count,
+    uint32_t threads,
+    int timeout_ms,
+    mqtt_connect_timing* timings)
+{
+  mqtt_connect_attempt* attempts;
+  connect_share* shares;
+  size_t connected = 0;
+
+  if (count == 0)
+  {
+    return 0;
+  }
+  threads = threads < 1 ? 1 : threads > count ? (uint32_t)count : threads;
+  attempts = calloc(count, sizeof(mqtt_connect_attempt));
+  shares = calloc(threads, sizeof(connect_share));
+  if (attempts == NULL || shares == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(attempts);
+    free(shares);
+    for (size_t i = 0; timings != NULL && i < count; i++)
+    {
+      memset(&timings[i], 0, sizeof(mqtt_connect_timing));
+      timings[i].result = MOSQ_ERR_NOMEM;
+    }
+    return 0;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    attempts[i].mosq = clients[i];
+  }
+  for (uint32_t t = 0; t < threads; t++)
+  {
+    size_t first = t * count / threads;
+
+    shares[t].attempts = &attempts[first];
+    shares[t].count = (t + 1) * count / threads - first;
+    shares[t].timeout_ms = timeout_ms;
+  }
+
+  /* The calling thread connects the first share, and those whose thread failed to start. */
+  for (uint32_t t = 1; t < threads; t++)
+  {
+    shares[t].started = pthread_create(&shares[t].thread, NULL, _connect_thread, &shares[t]) == 0;
+  }
+  _connect_share(&shares[0]);
+  for (uint32_t t = 1; t < threads; t++)
+  {
+    if (shares[t].started)
+    {
+      pthread_join(shares[t].thread, NULL);
+    }
+    else
+    {
+      _connect_share(&shares[t]);
+    }
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (attempts[i].timing.result == MOSQ_ERR_SUCCESS)
+    {
+      connected++;
+    }
+    if (timings != NULL)
+    {
+      timings[i] = attempts[i].timing;
+    }
+  }
+  free(attempts);
+  free(shares);
+  return connected;
+}
+
+void mqtt_client_print_connect_timings(const mqtt_connect_timing* timings, size_t count)
+{
+  latency_histogram* histogram = malloc(sizeof(latency_histogram));
+  size_t failed[MQTT_CONNECT_PHASE_COUNT] = { 0 };
+  size_t connected = 0;
+
+  if (histogram == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    if (timings[i].result == MOSQ_ERR_SUCCESS)
+    {
+      connected++;
+    }
+    else
+    {
+      failed[timings[i].phase]++;
+    }
+  }
+
+  printf("Connected %zu of %zu clients, times of the connected clients in ms:\n", connected, count);
+  printf("%-8s %10s %10s %10s %8s\n", "Phase", "p50", "p99", "max", "Failed");
+  /* The last row is the whole connect. */
+  for (int phase = 0; phase <= MQTT_CONNECT_PHASE_COUNT; phase++)
+  {
+    latency_histogram_reset(histogram);
+    for (size_t i = 0; i < count; i++)
+    {
+      if (timings[i].result == MOSQ_ERR_SUCCESS)
+      {
+        latency_histogram_record(
+            histogram,
+            (uint64_t)(phase < MQTT_CONNECT_PHASE_COUNT ? timings[i].phase_ns[phase]
+                                                        : timings[i].total_ns));
+      }
+    }
+    printf(
+        "%-8s %10.3f %10.3f %10.3f %8zu\n",
+        phase < MQTT_CONNECT_PHASE_COUNT ? phase_names[phase] : "Total",
+        latency_histogram_value_at_percentile(histogram, 50) / (double)NS_PER_MS,
+        latency_histogram_value_at_percentile(histogram, 99) / (double)NS_PER_MS,
+        histogram->max / (double)NS_PER_MS,
+        phase < MQTT_CONNECT_PHASE_COUNT ? failed[phase] : count - connected);
+  }
+  free(histogram);
+}
@@ -0,0 +1,85 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_CONNECT_H
+#define MQTT_CONNECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_CONNECT_DEFAULT_TIMEOUT_MS 30000
+
+/*
+ * Phases of a connect, in order. mosquitto_connect_bind_async() resolves the hostname before
+ * returning, so the DNS phase also holds the creation of the socket and, with TLS, of the TLS
+ * context.
+ */
+typedef enum mqtt_connect_phase
+{
+  MQTT_CONNECT_PHASE_DNS,
+  /* From the SYN to the socket being connected. */
+  MQTT_CONNECT_PHASE_TCP,
+  /* Until the handshake lets mosquitto write the CONNECT, 0 without TLS. */
+  MQTT_CONNECT_PHASE_TLS,
+  /* From the CONNECT to the CONNACK. */
+  MQTT_CONNECT_PHASE_CONNACK,
+  MQTT_CONNECT_PHASE_COUNT
+} mqtt_connect_phase;
+
+typedef struct mqtt_connect_timing
+{
+  int64_t phase_ns[MQTT_CONNECT_PHASE_COUNT];
+  int64_t total_ns;
+  /* MOSQ_ERR_SUCCESS once connected, MOSQ_ERR_CONN_REFUSED if the CONNACK refused the
+   * connection, MOSQ_ERR_TIMEOUT, or the error of mosquitto. */
+  int result;
+  /* Reason code of the CONNACK. */
+  int reason_code;
+  /* The phase the connect ended in, MQTT_CONNECT_PHASE_COUNT once connected. */
+  mqtt_connect_phase phase;
+} mqtt_connect_timing;
+
+/**
+ * @brief Connects clients created with mqtt_client_new() concurrently, timing the phases of every
+ * connect. Instead of a blocking mosquitto_connect_bind_v5() after the other, each thread starts
+ * the connects of its share of the clients with mosquitto_connect_bind_async(), then drives all of
+ * them from a single poll() until they are connected, so the round trips of the clients overlap.
+ * The connect callback of each client is called as usual. Clients are then used from any thread,
+ * ex. with mosquitto_loop_start(). Those that failed can be reconnected with mosquitto_reconnect().
+ *
+ * @param clients The clients, not connected yet.
+ * @param count The number of clients.
+ * @param threads The number of threads connecting the clients, as each one resolves its hostnames
+ * one after the other. 0 or 1 connects them all from the calling thread.
+ * @param timeout_ms The time each thread waits for its clients to connect.
+ * @param timings Receives the timing of each client, or NULL.
+ * @return size_t The number of clients connected.
+ */
+size_t mqtt_client_connect_all(
+    struct mosquitto** clients,
+    size_t count,
+    uint32_t threads,
+    int timeout_ms,
+    mqtt_connect_timing* timings);
+
+/**
+ * @brief Prints the median, 99th percentile and maximum time of every phase over the connected
+ * clients, and the number of clients that failed in each phase.
+ *
+ * @param timings The timings filled by mqtt_client_connect_all().
+ * @param count The number of timings.
+ */
+void mqtt_client_print_connect_timings(const mqtt_connect_timing* timings, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_CONNECT_H */
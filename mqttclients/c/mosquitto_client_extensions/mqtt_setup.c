@@ -260,9 +260,9 @@ void on_mosquitto_log(struct mosquitto* mosq, void* obj, int level, const char*
 #endif
 }
 
-struct mosquitto* mqtt_client_init(
+struct mosquitto* mqtt_client_new(
     bool publish,
-    char* env_file,
+    const mqtt_client_connection_settings* connection_settings,
     void (*on_connect_with_subscribe)(
         struct mosquitto*,
         void*,
@@ -271,34 +271,23 @@ struct mosquitto* mqtt_client_init(
         const mosquitto_property* props),
     mqtt_client_obj* obj)
 {
-  signal(SIGINT, sig_handler);
-
   struct mosquitto* mosq = NULL;
-  mqtt_client_connection_settings connection_settings;
   bool subscribe = on_connect_with_subscribe != NULL;
 
-  /* Get environment variables for connection settings */
-  mqtt_client_read_env_file(env_file);
-  if (!mqtt_client_set_connection_settings(&connection_settings))
-  {
-    LOG_ERROR("Failed to set connection settings.");
-    return NULL;
-  }
-
-  obj->hostname = connection_settings.hostname;
-  obj->keep_alive_in_seconds = connection_settings.keep_alive_in_seconds;
-  obj->tcp_port = connection_settings.tcp_port;
-  obj->client_id = connection_settings.client_id;
-
-  /* Required before calling other mosquitto functions */
-  MQTT_RETURN_IF_FAILED(mosquitto_lib_init());
+  obj->hostname = connection_settings->hostname;
+  obj->keep_alive_in_seconds = connection_settings->keep_alive_in_seconds;
+  obj->tcp_port = connection_settings->tcp_port;
+  obj->client_id = connection_settings->client_id;
+  obj->use_TLS = connection_settings->use_TLS;
+  obj->on_connect = on_connect_with_subscribe ?: on_connect;
+  obj->connect_attempt = NULL;
 
   /* Create a new client instance.
    * id = NULL -> ask the broker to generate a client id for us
    * clean session = true -> the broker should remove old sessions when we connect
    * obj = NULL -> we aren't passing any of our private data for callbacks
    */
-  mosq = mosquitto_new(connection_settings.client_id, connection_settings.clean_session, obj);
+  mosq = mosquitto_new(connection_settings->client_id, connection_settings->clean_session, obj);
 
   if (mosq == NULL)
   {
@@ -316,7 +305,7 @@ struct mosquitto* mqtt_client_init(
   MQTT_RETURN_IF_FAILED(mosquitto_int_option(mosq, MOSQ_OPT_PROTOCOL_VERSION, obj->mqtt_version));
 
   /*callbacks */
-  mosquitto_connect_v5_callback_set(mosq, on_connect_with_subscribe ?: on_connect);
+  mosquitto_connect_v5_callback_set(mosq, obj->on_connect);
   mosquitto_disconnect_v5_callback_set(mosq, on_disconnect);
 
   if (subscribe)
@@ -329,29 +318,66 @@ struct mosquitto* mqtt_client_init(
     _set_publish_callbacks(mosq);
   }
 
-  int result;
-
-  if (connection_settings.username)
+  if (connection_settings->username)
   {
     MQTT_RETURN_IF_FAILED(mosquitto_username_pw_set(
-        mosq, connection_settings.username, connection_settings.password));
+        mosq, connection_settings->username, connection_settings->password));
   }
 
-  if (connection_settings.use_TLS)
+  if (connection_settings->use_TLS)
   {
-    bool use_OS_certs = connection_settings.ca_file == NULL;
+    bool use_OS_certs = connection_settings->ca_file == NULL;
     if (use_OS_certs)
     {
       MQTT_RETURN_IF_FAILED(mosquitto_int_option(mosq, MOSQ_OPT_TLS_USE_OS_CERTS, true));
     }
     MQTT_RETURN_IF_FAILED(mosquitto_tls_set(
         mosq,
-        connection_settings.ca_file,
+        connection_settings->ca_file,
         use_OS_certs ? REQUIRED_TLS_SET_CERT_PATH : NULL,
-        connection_settings.cert_file,
-        connection_settings.key_file,
+        connection_settings->cert_file,
+        connection_settings->key_file,
         NULL));
   }
 
   return mosq;
 }
+
+bool mqtt_client_load_settings(char* env_file, mqtt_client_connection_settings* connection_settings)
+{
+  signal(SIGINT, sig_handler);
+
+  /* Get environment variables for connection settings */
+  mqtt_client_read_env_file(env_file);
+  if (!mqtt_client_set_connection_settings(connection_settings))
+  {
+    LOG_ERROR("Failed to set connection settings.");
+    return false;
+  }
+  return true;
+}
+
+struct mosquitto* mqtt_client_init(
+    bool publish,
+    char* env_file,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props),
+    mqtt_client_obj* obj)
+{
+  struct mosquitto* mosq = NULL;
+  mqtt_client_connection_settings connection_settings;
+
+  if (!mqtt_client_load_settings(env_file, &connection_settings))
+  {
+    return NULL;
+  }
+
+  /* Required before calling other mosquitto functions */
+  MQTT_RETURN_IF_FAILED(mosquitto_lib_init());
+
+  return mqtt_client_new(publish, &connection_settings, on_connect_with_subscribe, obj);
+}
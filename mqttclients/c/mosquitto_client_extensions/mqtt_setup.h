@@ -35,19 +35,37 @@ typedef struct mqtt_client_connection_settings
   bool use_TLS;
 } mqtt_client_connection_settings;
 
+struct mqtt_connect_attempt;
+
 typedef struct mqtt_client_obj
 {
   void (*handle_message)(
       struct mosquitto*,
       const struct mosquitto_message*,
       const mosquitto_property*);
+  /* The connect callback set by mqtt_client_new(), which mqtt_client_connect_all() calls from its
+   * own while it connects the client. */
+  void (*on_connect)(struct mosquitto*, void*, int, int, const mosquitto_property*);
+  /* Set while mqtt_client_connect_all() connects the client. */
+  struct mqtt_connect_attempt* connect_attempt;
   char* client_id;
   char* hostname;
   int keep_alive_in_seconds;
   int mqtt_version;
   int tcp_port;
+  bool use_TLS;
 } mqtt_client_obj;
 
+/**
+ * @brief Loads the env file and reads the connection settings from the environment variables, then
+ * creates a mosquitto client with them.
+ *
+ * @param publish Whether to set the publish callbacks.
+ * @param env_file The env file to load, or NULL for .env in the current directory.
+ * @param on_connect_with_subscribe The connect callback, which subscribes, or NULL.
+ * @param mqtt_client_obj The object passed to the callbacks.
+ * @return struct mosquitto* The client, or NULL on failure.
+ */
 struct mosquitto* mqtt_client_init(
     bool publish,
     char* env_file,
@@ -59,6 +77,39 @@ struct mosquitto* mqtt_client_init(
         const mosquitto_property* props),
     mqtt_client_obj* mqtt_client_obj);
 
+/**
+ * @brief Loads the env file and reads the connection settings from the environment variables, for
+ * creating clients with mqtt_client_new().
+ *
+ * @param env_file The env file to load, or NULL for .env in the current directory.
+ * @param connection_settings The connection settings to write to.
+ * @return bool true on success, false if an environment variable is missing or invalid.
+ */
+bool mqtt_client_load_settings(
+    char* env_file,
+    mqtt_client_connection_settings* connection_settings);
+
+/**
+ * @brief Creates a mosquitto client from connection settings. mosquitto_lib_init() must have been
+ * called. Clients created from the same settings need different client ids.
+ *
+ * @param publish Whether to set the publish callbacks.
+ * @param connection_settings The connection settings of the client.
+ * @param on_connect_with_subscribe The connect callback, which subscribes, or NULL.
+ * @param mqtt_client_obj The object passed to the callbacks.
+ * @return struct mosquitto* The client, or NULL on failure.
+ */
+struct mosquitto* mqtt_client_new(
+    bool publish,
+    const mqtt_client_connection_settings* connection_settings,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props),
+    mqtt_client_obj* mqtt_client_obj);
+
 bool set_char_connection_setting(
     char** connection_setting,
     const char* env_name,
@@ -70,8 +121,8 @@ bool set_bool_connection_setting(bool* connection_setting, char* env_name, bool
 
 bool mqtt_client_set_connection_settings(mqtt_client_connection_settings* connection_settings);
 
-#endif /* MQTT_SETUP_H */
-
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif /* MQTT_SETUP_H */
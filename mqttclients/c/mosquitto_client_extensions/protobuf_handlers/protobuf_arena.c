@@ -0,0 +1,24 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include "protobuf_arena.h"
+#include "memory_arena.h"
+
+static void* _arena_alloc(void* allocator_data, size_t size)
+{
+  return memory_arena_alloc((memory_arena*)allocator_data, size);
+}
+
+static void _arena_free(void* allocator_data, void* pointer)
+{
+  /* Released all at once by memory_arena_reset(). */
+  (void)allocator_data;
+  (void)pointer;
+}
+
+ProtobufCAllocator protobuf_arena_allocator(memory_arena* arena)
+{
+  return (ProtobufCAllocator){ .alloc = _arena_alloc,
+                               .free = _arena_free,
+                               .allocator_data = arena };
+}
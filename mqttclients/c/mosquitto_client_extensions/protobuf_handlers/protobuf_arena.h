@@ -0,0 +1,20 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PROTOBUF_ARENA_H
+#define PROTOBUF_ARENA_H
+
+#include "memory_arena.h"
+#include <protobuf-c/protobuf-c.h>
+
+/**
+ * @brief Creates a ProtobufCAllocator that serves pack/unpack allocations from a memory_arena.
+ * free() is a no-op, so messages unpacked with this allocator don't need *__free_unpacked(); they
+ * are released by memory_arena_reset(). The arena must not be shared between threads.
+ *
+ * @param arena The memory_arena to allocate from. Must outlive the allocator.
+ * @return ProtobufCAllocator The allocator.
+ */
+ProtobufCAllocator protobuf_arena_allocator(memory_arena* arena);
+
+#endif /* PROTOBUF_ARENA_H */
@@ -0,0 +1,165 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Compares unpacking the messages of the command scenario into a memory_arena, as command_server
+ * and command_client do, with unpacking them with the default allocator of protobuf-c and freeing
+ * them with *__free_unpacked(): the messages unpacked per second and the allocator calls per
+ * message.
+ *
+ * Usage: protobuf_arena_bench [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "extensions_internal.h"
+#include "memory_arena.h"
+#include "protobuf_arena.h"
+#include "unlock_command.pb-c.h"
+
+#define DEFAULT_MESSAGES 1000000
+/* Same as the request arena of command_server. */
+#define ARENA_SIZE 1024
+
+typedef struct packed_message
+{
+  const char* name;
+  const ProtobufCMessageDescriptor* descriptor;
+  uint8_t buffer[128];
+  size_t length;
+} packed_message;
+
+/* Forwards to malloc() and free() like the default allocator, counting the calls. */
+typedef struct counting_allocator
+{
+  uint64_t allocs;
+  uint64_t frees;
+} counting_allocator;
+
+static void* _counting_alloc(void* allocator_data, size_t size)
+{
+  ((counting_allocator*)allocator_data)->allocs++;
+  return malloc(size);
+}
+
+static void _counting_free(void* allocator_data, void* pointer)
+{
+  ((counting_allocator*)allocator_data)->frees++;
+  free(pointer);
+}
+
+/* Unpacks the message `messages` times and frees it with the allocator, NULL for the default one,
+ * and returns the elapsed seconds. */
+static double unpack_with_malloc(
+    const packed_message* packed,
+    ProtobufCAllocator* allocator,
+    int messages)
+{
+  int64_t start = monotonic_ns();
+
+  for (int i = 0; i < messages; i++)
+  {
+    ProtobufCMessage* message
+        = protobuf_c_message_unpack(packed->descriptor, allocator, packed->length, packed->buffer);
+    if (message == NULL)
+    {
+      fprintf(stderr, "Failed to unpack %s\n", packed->name);
+      exit(EXIT_FAILURE);
+    }
+    protobuf_c_message_free_unpacked(message, allocator);
+  }
+  return (monotonic_ns() - start) / 1e9;
+}
+
+/* Unpacks the message `messages` times into the arena, reset after each message, and returns the
+ * elapsed seconds. */
+static double unpack_with_arena(const packed_message* packed, memory_arena* arena, int messages)
+{
+  ProtobufCAllocator allocator = protobuf_arena_allocator(arena);
+  int64_t start = monotonic_ns();
+
+  for (int i = 0; i < messages; i++)
+  {
+    if (protobuf_c_message_unpack(packed->descriptor, &allocator, packed->length, packed->buffer)
+        == NULL)
+    {
+      fprintf(stderr, "Failed to unpack %s\n", packed->name);
+      exit(EXIT_FAILURE);
+    }
+    memory_arena_reset(arena);
+  }
+  return (monotonic_ns() - start) / 1e9;
+}
+
+static void bench(const packed_message* packed, int messages)
+{
+  counting_allocator counts = { 0 };
+  ProtobufCAllocator counting
+      = { .alloc = _counting_alloc, .free = _counting_free, .allocator_data = &counts };
+  memory_arena arena;
+  double malloc_elapsed;
+  double arena_elapsed;
+
+  if (memory_arena_init(&arena, ARENA_SIZE) != 0)
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  /* Timed with the default allocator, the calls are counted in a separate run. */
+  malloc_elapsed = unpack_with_malloc(packed, NULL, messages);
+  unpack_with_malloc(packed, &counting, messages);
+  arena_elapsed = unpack_with_arena(packed, &arena, messages);
+
+  printf("%s (%zu bytes):\n", packed->name, packed->length);
+  printf(
+      "\tmalloc: %.0f messages/s, %.2f allocs and %.2f frees per message\n",
+      messages / malloc_elapsed,
+      (double)counts.allocs / messages,
+      (double)counts.frees / messages);
+  printf(
+      "\tarena:  %.0f messages/s, %.2f arena allocs and %.2f heap fallbacks per message, %zu bytes "
+      "peak\n",
+      messages / arena_elapsed,
+      (double)arena.alloc_count / messages,
+      (double)arena.overflow_count / messages,
+      arena.high_water_mark);
+  memory_arena_destroy(&arena);
+}
+
+int main(int argc, char* argv[])
+{
+  int messages = argc > 1 ? atoi(argv[1]) : DEFAULT_MESSAGES;
+  Google__Protobuf__Timestamp when = GOOGLE__PROTOBUF__TIMESTAMP__INIT;
+  UnlockRequest request = UNLOCK_REQUEST__INIT;
+  UnlockResponse response = UNLOCK_RESPONSE__INIT;
+  packed_message packed_request
+      = { .name = "UnlockRequest", .descriptor = &unlock_request__descriptor };
+  packed_message packed_response
+      = { .name = "UnlockResponse", .descriptor = &unlock_response__descriptor };
+
+  if (messages <= 0)
+  {
+    fprintf(stderr, "Usage: %s [messages]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  /* Messages like the ones of command_client and of a failed unlock of command_server. */
+  when.seconds = 1700000000;
+  when.nanos = 123456789;
+  request.when = &when;
+  request.requestedfrom = "mobile-app";
+  response.succeed = 0;
+  response.errordetail = "Error executing unlock request";
+  if (unlock_request__get_packed_size(&request) > sizeof(packed_request.buffer)
+      || unlock_response__get_packed_size(&response) > sizeof(packed_response.buffer))
+  {
+    return EXIT_FAILURE;
+  }
+  packed_request.length = unlock_request__pack(&request, packed_request.buffer);
+  packed_response.length = unlock_response__pack(&response, packed_response.buffer);
+
+  bench(&packed_request, messages);
+  bench(&packed_response, messages);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,468 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+
+#include "protobuf_arena.h"
+#include "protobuf_rpc.h"
+#include "topic_template.h"
+
+#define TOPIC_SHARE "$share/"
+
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+#define DEADLINE_MAX_LENGTH 21
+
+static int _compare_method_names(const char* name, size_t name_length, const protobuf_rpc_method* m)
+{
+  size_t length = name_length < m->name_length ? name_length : m->name_length;
+  int result = memcmp(name, m->name, length);
+  if (result != 0)
+  {
+    return result;
+  }
+  return name_length < m->name_length ? -1 : name_length > m->name_length ? 1 : 0;
+}
+
+static int _compare_methods(const void* a, const void* b)
+{
+  const protobuf_rpc_method* method_a = (const protobuf_rpc_method*)a;
+  return _compare_method_names(
+      method_a->name, method_a->name_length, (const protobuf_rpc_method*)b);
+}
+
+int protobuf_rpc_server_init(
+    protobuf_rpc_server* server,
+    ProtobufCService* service,
+    const char* client_id,
+    int qos)
+{
+  const ProtobufCServiceDescriptor* descriptor = service->descriptor;
+  size_t share_prefix_length
+      = server->share_group != NULL ? strlen(TOPIC_SHARE) + strlen(server->share_group) + 1 : 0;
+  char topic[TOPIC_SIZE(PROTOBUF_RPC_REQUEST_TOPIC)];
+
+  server->service = service;
+  server->qos = qos;
+  server->method_count = 0;
+  server->methods = NULL;
+  if (descriptor->n_methods == 0)
+  {
+    LOG_ERROR("RPC service %s has no methods.", descriptor->name);
+    return -1;
+  }
+  server->method_count = descriptor->n_methods;
+  server->methods = calloc(descriptor->n_methods, sizeof(protobuf_rpc_method));
+  if (server->methods == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for RPC method table.");
+    return -1;
+  }
+
+  for (unsigned i = 0; i < descriptor->n_methods; i++)
+  {
+    protobuf_rpc_method* method = &server->methods[i];
+    const char* method_name = descriptor->methods[i].name;
+
+    method->descriptor = &descriptor->methods[i];
+    method->method_index = i;
+    method->name_length = strlen(method_name);
+    method->name = malloc(method->name_length + 1);
+    if (method->name == NULL)
+    {
+      LOG_ERROR("Failed to allocate memory for RPC method %s.", method_name);
+      protobuf_rpc_server_destroy(server);
+      return -1;
+    }
+
+    for (size_t c = 0; c <= method->name_length; c++)
+    {
+      method->name[c] = (char)tolower((unsigned char)method_name[c]);
+    }
+
+    int topic_length = TOPIC_FORMAT(topic, PROTOBUF_RPC_REQUEST_TOPIC, client_id, method->name);
+    if (topic_length < 0)
+    {
+      LOG_ERROR("Invalid request topic for client %s and RPC method %s.", client_id, method_name);
+      protobuf_rpc_server_destroy(server);
+      return -1;
+    }
+    method->request_topic = malloc(share_prefix_length + (size_t)topic_length + 1);
+    if (method->request_topic == NULL)
+    {
+      LOG_ERROR("Failed to allocate memory for RPC method %s.", method_name);
+      protobuf_rpc_server_destroy(server);
+      return -1;
+    }
+    if (server->share_group != NULL)
+    {
+      sprintf(method->request_topic, TOPIC_SHARE "%s/", server->share_group);
+    }
+    memcpy(method->request_topic + share_prefix_length, topic, (size_t)topic_length + 1);
+  }
+
+  /* Sorted once here so dispatch is a binary search on the method segment of the topic. */
+  qsort(server->methods, server->method_count, sizeof(protobuf_rpc_method), _compare_methods);
+
+  return 0;
+}
+
+void protobuf_rpc_server_destroy(protobuf_rpc_server* server)
+{
+  if (server->methods != NULL)
+  {
+    for (unsigned i = 0; i < server->method_count; i++)
+    {
+      free(server->methods[i].name);
+      free(server->methods[i].request_topic);
+    }
+    free(server->methods);
+    server->methods = NULL;
+  }
+  server->method_count = 0;
+}
+
+int protobuf_rpc_server_subscribe(const protobuf_rpc_server* server, struct mosquitto* mosq)
+{
+  char* topics[server->method_count];
+  for (unsigned i = 0; i < server->method_count; i++)
+  {
+    topics[i] = server->methods[i].request_topic;
+  }
+
+  return mosquitto_subscribe_multiple(
+      mosq, NULL, (int)server->method_count, topics, server->qos, 0, NULL);
+}
+
+/* Parses vehicles/<client id>/command/<method>/request without copying the topic. Messages
+ * received through a shared subscription carry the topic they were published to, without the
+ * $share/<group>/ prefix. */
+static const protobuf_rpc_method* _parse_request_topic(
+    const protobuf_rpc_server* server,
+    const char* topic,
+    const char** client_id,
+    size_t* client_id_length)
+{
+  topic_level levels[2];
+
+  if (!TOPIC_MATCH(topic, PROTOBUF_RPC_REQUEST_TOPIC, levels))
+  {
+    return NULL;
+  }
+  *client_id = levels[0].value;
+  *client_id_length = levels[0].length;
+
+  const char* method_name = levels[1].value;
+  size_t name_length = levels[1].length;
+  size_t low = 0;
+  size_t high = server->method_count;
+  while (low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    int result = _compare_method_names(method_name, name_length, &server->methods[mid]);
+    if (result == 0)
+    {
+      return &server->methods[mid];
+    }
+    else if (result < 0)
+    {
+      high = mid;
+    }
+    else
+    {
+      low = mid + 1;
+    }
+  }
+  return NULL;
+}
+
+const protobuf_rpc_method* protobuf_rpc_server_find_method(
+    const protobuf_rpc_server* server,
+    const char* topic)
+{
+  const char* client_id;
+  size_t client_id_length;
+  return _parse_request_topic(server, topic, &client_id, &client_id_length);
+}
+
+static int64_t _now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * MS_PER_SEC + ts.tv_nsec / NS_PER_MS;
+}
+
+int protobuf_rpc_add_deadline(mosquitto_property** proplist, uint32_t timeout_sec)
+{
+  char deadline[DEADLINE_MAX_LENGTH];
+  int rc;
+
+  snprintf(
+      deadline,
+      sizeof(deadline),
+      "%lld",
+      (long long)(_now_ms() + (int64_t)timeout_sec * MS_PER_SEC));
+  if ((rc = mosquitto_property_add_int32(proplist, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, timeout_sec))
+      == MOSQ_ERR_SUCCESS)
+  {
+    rc = mosquitto_property_add_string_pair(
+        proplist, MQTT_PROP_USER_PROPERTY, PROTOBUF_RPC_DEADLINE_PROPERTY, deadline);
+  }
+  return rc;
+}
+
+/* Returns true if the request has a deadline property and it has passed. The broker already drops
+ * requests that expire while queued for this client, this catches the ones that expire in the
+ * backlog of the server itself. */
+static bool _is_expired(const mosquitto_property* props)
+{
+  const mosquitto_property* prop = props;
+  bool skip_first = false;
+  bool expired = false;
+  char* name;
+  char* value;
+
+  while ((prop = mosquitto_property_read_string_pair(
+              prop, MQTT_PROP_USER_PROPERTY, &name, &value, skip_first))
+         != NULL)
+  {
+    skip_first = true;
+    if (strcmp(name, PROTOBUF_RPC_DEADLINE_PROPERTY) == 0)
+    {
+      char* end;
+      long long deadline = strtoll(value, &end, 10);
+      expired = end != value && *end == '\0' && deadline < _now_ms();
+    }
+    free(name);
+    free(value);
+  }
+  return expired;
+}
+
+/* Publishes a serialized response to the response topic of the request. */
+static void _publish_response(
+    const protobuf_rpc_request_context* context,
+    const void* payload,
+    size_t payload_len)
+{
+  mosquitto_property* response_props = NULL;
+  int rc;
+
+  if ((rc = mosquitto_property_add_binary(
+           &response_props,
+           MQTT_PROP_CORRELATION_DATA,
+           context->correlation_data,
+           context->correlation_data_length))
+          != MOSQ_ERR_SUCCESS
+      || (rc = mosquitto_property_add_string(
+              &response_props, MQTT_PROP_CONTENT_TYPE, PROTOBUF_RPC_CONTENT_TYPE))
+          != MOSQ_ERR_SUCCESS
+      || (rc = mosquitto_publish_v5(
+              context->mosq,
+              NULL,
+              context->response_topic,
+              (int)payload_len,
+              payload,
+              context->server->qos,
+              false,
+              response_props))
+          != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failure while sending response: %s", mosquitto_strerror(rc));
+  }
+
+  mosquitto_property_free_all(&response_props);
+}
+
+/* Builds the key the response to the request is cached under, see response_cache_request_key(). */
+static size_t _cache_key(const protobuf_rpc_request_context* context, uint8_t* key)
+{
+  return response_cache_request_key(
+      key,
+      context->method->descriptor->name,
+      context->response_topic,
+      context->correlation_data,
+      context->correlation_data_length);
+}
+
+/* Closure handed to the service method: packs the output message, caches it for redeliveries and
+ * publishes it to the response topic of the request. */
+static void _send_response(const ProtobufCMessage* output, void* closure_data)
+{
+  protobuf_rpc_request_context* context = (protobuf_rpc_request_context*)closure_data;
+  uint8_t stack_buf[PROTOBUF_RPC_RESPONSE_BUFFER_SIZE];
+  uint8_t* payload_buf = stack_buf;
+  size_t payload_len;
+
+  context->responded = true;
+  if (output == NULL)
+  {
+    LOG_ERROR("RPC method %s failed without a response.", context->method->descriptor->name);
+    return;
+  }
+
+  payload_len = protobuf_c_message_get_packed_size(output);
+  if (payload_len > sizeof(stack_buf) && (payload_buf = malloc(payload_len)) == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for payload buffer.");
+    return;
+  }
+
+  if (protobuf_c_message_pack(output, payload_buf) != payload_len)
+  {
+    LOG_ERROR("Failure serializing payload.");
+  }
+  else
+  {
+    if (context->server->response_cache != NULL)
+    {
+      uint8_t key[RESPONSE_CACHE_MAX_KEY_LENGTH];
+
+      response_cache_put(
+          context->server->response_cache,
+          key,
+          _cache_key(context, key),
+          payload_buf,
+          payload_len,
+          time(NULL));
+    }
+    _publish_response(context, payload_buf, payload_len);
+  }
+
+  if (payload_buf != stack_buf)
+  {
+    free(payload_buf);
+  }
+}
+
+bool protobuf_rpc_server_handle_message(
+    protobuf_rpc_server* server,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  protobuf_rpc_request_context context = { 0 };
+  ProtobufCAllocator arena_allocator;
+  ProtobufCAllocator* allocator = NULL;
+  ProtobufCMessage* input;
+
+  context.mosq = mosq;
+  context.server = server;
+  context.method
+      = _parse_request_topic(server, message->topic, &context.client_id, &context.client_id_length);
+  if (context.method == NULL)
+  {
+    return false;
+  }
+
+  if (_is_expired(props))
+  {
+    /* Not logged individually, expired requests pile up when the server is already overloaded. */
+    server->expired_count++;
+    return true;
+  }
+
+  if (mosquitto_property_read_string(
+          props, MQTT_PROP_RESPONSE_TOPIC, &context.response_topic, false)
+      == NULL)
+  {
+    LOG_ERROR("Message does not have a response topic property");
+    return true;
+  }
+
+  if (mosquitto_property_read_binary(
+          props,
+          MQTT_PROP_CORRELATION_DATA,
+          &context.correlation_data,
+          &context.correlation_data_length,
+          false)
+      == NULL)
+  {
+    LOG_ERROR("Message does not have a correlation data property");
+    free(context.response_topic);
+    return true;
+  }
+
+  if (server->response_cache != NULL)
+  {
+    uint8_t key[RESPONSE_CACHE_MAX_KEY_LENGTH];
+    const response_cache_entry* cached
+        = response_cache_get(server->response_cache, key, _cache_key(&context, key), time(NULL));
+    if (cached != NULL)
+    {
+      LOG_INFO(
+          SERVER_LOG_TAG,
+          "Replaying cached %s response for a redelivered request",
+          context.method->descriptor->name);
+      _publish_response(&context, cached->response, cached->response_length);
+      free(context.response_topic);
+      free(context.correlation_data);
+      return true;
+    }
+  }
+
+  if (server->arena != NULL)
+  {
+    arena_allocator = protobuf_arena_allocator(server->arena);
+    allocator = &arena_allocator;
+  }
+
+  input = protobuf_c_message_unpack(
+      context.method->descriptor->input,
+      allocator,
+      (size_t)message->payloadlen,
+      message->payload);
+  if (input == NULL)
+  {
+    /* Answer with a default response so the caller does not have to wait for its timeout. */
+    LOG_ERROR("Failure deserializing protobuf payload");
+    const ProtobufCMessageDescriptor* output_descriptor = context.method->descriptor->output;
+    ProtobufCMessage* output = server->arena != NULL
+        ? memory_arena_alloc(server->arena, output_descriptor->sizeof_message)
+        : malloc(output_descriptor->sizeof_message);
+    if (output != NULL)
+    {
+      protobuf_c_message_init(output_descriptor, output);
+      if (server->init_error_response != NULL)
+      {
+        server->init_error_response(context.method, output);
+      }
+      _send_response(output, &context);
+      if (server->arena == NULL)
+      {
+        free(output);
+      }
+    }
+  }
+  else
+  {
+    server->service->invoke(
+        server->service, context.method->method_index, input, _send_response, &context);
+    if (server->arena == NULL)
+    {
+      protobuf_c_message_free_unpacked(input, NULL);
+    }
+  }
+
+  if (server->arena != NULL)
+  {
+    memory_arena_reset(server->arena);
+  }
+
+  if (!context.responded)
+  {
+    LOG_WARNING("RPC method %s returned without responding.", context.method->descriptor->name);
+  }
+
+  free(context.response_topic);
+  free(context.correlation_data);
+  return true;
+}
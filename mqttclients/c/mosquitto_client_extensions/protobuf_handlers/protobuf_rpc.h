@@ -0,0 +1,162 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PROTOBUF_RPC_H
+#define PROTOBUF_RPC_H
+
+#include "memory_arena.h"
+#include "mosquitto.h"
+#include "response_cache.h"
+#include <protobuf-c/protobuf-c.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PROTOBUF_RPC_CONTENT_TYPE "application/protobuf"
+
+/* Size of the stack buffer responses are packed into. Larger responses fall back to the heap. */
+#define PROTOBUF_RPC_RESPONSE_BUFFER_SIZE 256
+
+/* User property holding the time after which the caller no longer waits for the response, in
+ * milliseconds since the Unix epoch. */
+#define PROTOBUF_RPC_DEADLINE_PROPERTY "deadline"
+
+/* Template of the request topics, with the client id and the method name as placeholders, see
+ * topic_template.h. */
+#define PROTOBUF_RPC_REQUEST_TOPIC(level) "vehicles/" level "/command/" level "/request"
+/* Template of the response topic callers put in the response topic property of their requests,
+ * with the same placeholders. */
+#define PROTOBUF_RPC_RESPONSE_TOPIC(level) "vehicles/" level "/command/" level "/response"
+
+/*
+ * Request topics are derived from the service descriptor as
+ * vehicles/<client id>/command/<method name in lower case>/request, and responses are published to
+ * the response topic property of each request. With a share group, the server subscribes to
+ * $share/<group>/vehicles/<client id>/command/<method>/request so that the broker load balances
+ * requests between every server in the group.
+ */
+
+typedef struct protobuf_rpc_method
+{
+  char* name;
+  size_t name_length;
+  char* request_topic;
+  const ProtobufCMethodDescriptor* descriptor;
+  unsigned method_index;
+} protobuf_rpc_method;
+
+typedef struct protobuf_rpc_server
+{
+  /* Optional, set by the caller before protobuf_rpc_server_init(). When set, requests are unpacked
+   * into the arena, which is reset after each request instead of freeing the request piecewise, so
+   * requests are only valid until the service method returns. */
+  memory_arena* arena;
+  /* Optional, set by the caller before protobuf_rpc_server_init(). When set, responses are cached
+   * by method, response topic and correlation data, and redelivered requests are answered from the
+   * cache without invoking the service method again. */
+  response_cache* response_cache;
+  /* Optional, set by the caller before protobuf_rpc_server_init(). When set, the request topics are
+   * subscribed as MQTT v5 shared subscriptions of this group. */
+  const char* share_group;
+  /* Optional, set by the caller before protobuf_rpc_server_init(). When set, it fills the default
+   * response sent for requests that can't be unpacked, ex. with an error detail. */
+  void (*init_error_response)(const protobuf_rpc_method* method, ProtobufCMessage* output);
+  ProtobufCService* service;
+  protobuf_rpc_method* methods;
+  unsigned method_count;
+  int qos;
+  /* Number of requests dropped because their deadline had passed when they were received. */
+  uint64_t expired_count;
+} protobuf_rpc_server;
+
+/* State of a single request, passed as the closure_data of a service method. Handlers may read it
+ * but must not modify it. */
+typedef struct protobuf_rpc_request_context
+{
+  struct mosquitto* mosq;
+  const protobuf_rpc_server* server;
+  const protobuf_rpc_method* method;
+  const char* client_id;
+  size_t client_id_length;
+  char* response_topic;
+  void* correlation_data;
+  uint16_t correlation_data_length;
+  bool responded;
+} protobuf_rpc_request_context;
+
+/**
+ * @brief Initializes an RPC server for every method of a protobuf-c service. The arena,
+ * response_cache and share_group fields must be set (or NULL) before calling this. The arena and
+ * response_cache must only be used from the thread running the mosquitto loop.
+ *
+ * @param server The protobuf_rpc_server to initialize.
+ * @param service The service implementation, ex. initialized with COMMANDS__INIT(prefix).
+ * @param client_id The client id used in the request topics, or "+" to serve every vehicle. The
+ * vehicle a request is addressed to is available in the protobuf_rpc_request_context.
+ * @param qos The QoS used for subscriptions and responses.
+ * @return int 0 on success, -1 on failure, including for a service without methods. On success the
+ * server must be freed with protobuf_rpc_server_destroy().
+ */
+int protobuf_rpc_server_init(
+    protobuf_rpc_server* server,
+    ProtobufCService* service,
+    const char* client_id,
+    int qos);
+
+/**
+ * @brief Frees the method table of a protobuf_rpc_server.
+ *
+ * @param server The protobuf_rpc_server to free.
+ */
+void protobuf_rpc_server_destroy(protobuf_rpc_server* server);
+
+/**
+ * @brief Subscribes to the request topics of all methods with a single SUBSCRIBE. Should be called
+ * from the on_connect callback so subscriptions are recreated on reconnect.
+ *
+ * @param server The protobuf_rpc_server to subscribe for.
+ * @param mosq The mosquitto client.
+ * @return int MOSQ_ERR_SUCCESS on success, other enum mosq_err_t on failure.
+ */
+int protobuf_rpc_server_subscribe(const protobuf_rpc_server* server, struct mosquitto* mosq);
+
+/**
+ * @brief Finds the method a request topic is addressed to.
+ *
+ * @param server The protobuf_rpc_server to search.
+ * @param topic The topic the request was received on.
+ * @return const protobuf_rpc_method* The matching method, or NULL if the topic is not a request
+ * topic of this server.
+ */
+const protobuf_rpc_method* protobuf_rpc_server_find_method(
+    const protobuf_rpc_server* server,
+    const char* topic);
+
+/**
+ * @brief Adds the message expiry interval and deadline properties of a request, so that neither the
+ * broker nor the server spends time on the request once the caller has stopped waiting for it.
+ *
+ * @param proplist The properties of the request.
+ * @param timeout_sec How long the caller waits for the response, from now.
+ * @return int MOSQ_ERR_SUCCESS on success, other enum mosq_err_t on failure.
+ */
+int protobuf_rpc_add_deadline(mosquitto_property** proplist, uint32_t timeout_sec);
+
+/**
+ * @brief Dispatches a received request to its service method and publishes the response with the
+ * correlation data of the request. Requests with a deadline property that has already passed are
+ * dropped without being unpacked or answered, and counted in expired_count. The deadline is
+ * compared against the local clock, so the clocks of callers and servers must be synchronized.
+ *
+ * @param server The protobuf_rpc_server that received the message.
+ * @param mosq The mosquitto client.
+ * @param message The received request.
+ * @param props The properties of the received request.
+ * @return true if the message was addressed to a method of this server, false otherwise.
+ */
+bool protobuf_rpc_server_handle_message(
+    protobuf_rpc_server* server,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props);
+
+#endif /* PROTOBUF_RPC_H */
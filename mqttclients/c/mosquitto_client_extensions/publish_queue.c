@@ -0,0 +1,733 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "extensions_internal.h"
+#include "logging.h"
+#include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
+#include "publish_queue.h"
+
+#define CACHE_LINE_SIZE 64
+#define POLL_TIMEOUT_MS 1000
+#define RECONNECT_DELAY_NS 1000000000LL
+#define MIN_LANE_CAPACITY 64
+
+#define PUBLISH_PACKET 0x30
+#define RETAIN_FLAG 0x01
+/* Largest remaining length a variable byte integer encodes, on four bytes. */
+#define MAX_REMAINING_LENGTH 268435455
+/* Fixed header, remaining length and topic length. */
+#define MAX_HEADER_LENGTH 7
+
+static uint64_t _lane_capacity(const publish_queue_lane* lane) { return lane->mask + 1; }
+
+static void _lane_copy(publish_queue_lane* lane, uint64_t position, const void* data, size_t size)
+{
+  size_t offset = (size_t)(position & lane->mask);
+  size_t first = _lane_capacity(lane) - offset < size ? _lane_capacity(lane) - offset : size;
+
+  memcpy(lane->buffer + offset, data, first);
+  memcpy(lane->buffer, (const unsigned char*)data + first, size - first);
+}
+
+static void _lane_read(const publish_queue_lane* lane, uint64_t position, void* data, size_t size)
+{
+  size_t offset = (size_t)(position & lane->mask);
+  size_t first = _lane_capacity(lane) - offset < size ? _lane_capacity(lane) - offset : size;
+
+  memcpy(data, lane->buffer + offset, first);
+  memcpy((unsigned char*)data + first, lane->buffer, size - first);
+}
+
+/* Length of the packet starting at position, from its remaining length. */
+static uint64_t _packet_length(const publish_queue_lane* lane, uint64_t position)
+{
+  uint64_t remaining = 0;
+  uint64_t next = position + 1;
+  unsigned shift = 0;
+  unsigned char byte;
+
+  do
+  {
+    byte = lane->buffer[next++ & lane->mask];
+    remaining |= (uint64_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while ((byte & 0x80) != 0);
+  return next - position + remaining;
+}
+
+static size_t _encode_remaining_length(unsigned char* buffer, size_t length)
+{
+  size_t size = 0;
+
+  do
+  {
+    unsigned char byte = length & 0x7F;
+    length >>= 7;
+    buffer[size++] = length > 0 ? byte | 0x80 : byte;
+  } while (length > 0);
+  return size;
+}
+
+static bool _lanes_pending(publish_queue* queue)
+{
+  uint32_t count = __atomic_load_n(&queue->lane_count, __ATOMIC_ACQUIRE);
+
+  for (uint32_t i = 0; i < count && i < queue->options.max_lanes; i++)
+  {
+    publish_queue_lane* lane = __atomic_load_n(&queue->lanes[i], __ATOMIC_ACQUIRE);
+    if (lane != NULL && __atomic_load_n(&lane->head, __ATOMIC_ACQUIRE) != lane->tail)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+int publish_queue_init(publish_queue* queue, const publish_queue_options* options)
+{
+  memset(queue, 0, sizeof(publish_queue));
+  queue->options = *options;
+  queue->wake_fd = -1;
+  if (queue->options.lane_capacity == 0)
+  {
+    queue->options.lane_capacity = PUBLISH_QUEUE_DEFAULT_LANE_CAPACITY;
+  }
+  if (queue->options.max_lanes == 0)
+  {
+    queue->options.max_lanes = PUBLISH_QUEUE_DEFAULT_MAX_LANES;
+  }
+  if (queue->options.mqtt_version == 0)
+  {
+    queue->options.mqtt_version = MQTT_PROTOCOL_V311;
+  }
+  if (queue->options.max_lanes > PUBLISH_QUEUE_MAX_LANES)
+  {
+    LOG_ERROR("A publish queue has at most %d lanes.", PUBLISH_QUEUE_MAX_LANES);
+    return -1;
+  }
+
+  if ((queue->lanes = calloc(queue->options.max_lanes, sizeof(publish_queue_lane*))) == NULL
+      || (queue->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    LOG_ERROR("Failed to initialize the publish queue.");
+    publish_queue_destroy(queue);
+    return -1;
+  }
+  return 0;
+}
+
+publish_queue_lane* publish_queue_lane_open(publish_queue* queue, publish_queue_priority priority)
+{
+  uint32_t index = __atomic_fetch_add(&queue->lane_count, 1, __ATOMIC_RELAXED);
+  publish_queue_lane* lane;
+  uint64_t capacity = MIN_LANE_CAPACITY;
+
+  if (index >= queue->options.max_lanes)
+  {
+    LOG_ERROR("The %u lanes of the publish queue are open.", queue->options.max_lanes);
+    return NULL;
+  }
+  while (capacity < queue->options.lane_capacity)
+  {
+    capacity <<= 1;
+  }
+
+  if (posix_memalign((void**)&lane, CACHE_LINE_SIZE, sizeof(publish_queue_lane)) != 0)
+  {
+    LOG_ERROR("Out of memory.");
+    return NULL;
+  }
+  memset(lane, 0, sizeof(publish_queue_lane));
+  if ((lane->buffer = malloc(capacity)) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(lane);
+    return NULL;
+  }
+  lane->queue = queue;
+  lane->mask = capacity - 1;
+  lane->priority = priority;
+  /* Only visible to the network thread from here. */
+  __atomic_store_n(&queue->lanes[index], lane, __ATOMIC_RELEASE);
+  return lane;
+}
+
+int publish_queue_publish(
+    publish_queue_lane* lane,
+    const char* topic,
+    const void* payload,
+    size_t payload_length,
+    bool retain)
+{
+  publish_queue* queue = lane->queue;
+  bool v5 = queue->options.mqtt_version == MQTT_PROTOCOL_V5;
+  unsigned char header[MAX_HEADER_LENGTH];
+  size_t header_length = 0;
+  size_t topic_length;
+  size_t remaining_length;
+  uint64_t length;
+  uint64_t head = lane->head;
+
+  if (topic == NULL || topic[0] == '\0' || (payload == NULL && payload_length > 0)
+      || mosquitto_pub_topic_check(topic) != MOSQ_ERR_SUCCESS
+      || (topic_length = strlen(topic)) > UINT16_MAX
+      || payload_length > MAX_REMAINING_LENGTH - 3 - topic_length)
+  {
+    return -1;
+  }
+  /* Topic length, topic, property length with MQTT v5, and payload. */
+  remaining_length = 2 + topic_length + (v5 ? 1 : 0) + payload_length;
+
+  header[header_length++] = PUBLISH_PACKET | (retain ? RETAIN_FLAG : 0);
+  header_length += _encode_remaining_length(header + header_length, remaining_length);
+  length = header_length + remaining_length;
+  header[header_length++] = (unsigned char)(topic_length >> 8);
+  header[header_length++] = (unsigned char)(topic_length & 0xFF);
+
+  if (length > _lane_capacity(lane))
+  {
+    return -1;
+  }
+  if (head + length - lane->cached_tail > _lane_capacity(lane))
+  {
+    lane->cached_tail = __atomic_load_n(&lane->tail, __ATOMIC_ACQUIRE);
+    if (head + length - lane->cached_tail > _lane_capacity(lane))
+    {
+      stat_add(&lane->full, 1);
+      return -1;
+    }
+  }
+
+  _lane_copy(lane, head, header, header_length);
+  head += header_length;
+  _lane_copy(lane, head, topic, topic_length);
+  head += topic_length;
+  if (v5)
+  {
+    unsigned char property_length = 0;
+    _lane_copy(lane, head++, &property_length, 1);
+  }
+  _lane_copy(lane, head, payload, payload_length);
+  head += payload_length;
+  __atomic_store_n(&lane->head, head, __ATOMIC_RELEASE);
+  stat_add(&lane->messages, 1);
+
+  /* Pairs with the fence of the network thread between setting sleeping and checking the lanes. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&queue->sleeping, __ATOMIC_RELAXED))
+  {
+    uint64_t wake = 1;
+    if (write(queue->wake_fd, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+    {
+      LOG_ERROR("Failed to wake the publish queue: %s", strerror(errno));
+    }
+  }
+  return 0;
+}
+
+/* Packets of the lanes gathered for a write, in the order they are written. */
+typedef struct _write_batch
+{
+  struct iovec* iov;
+  int iov_count;
+  /* Lane of each gathered range, and where the range ends. */
+  uint32_t* lanes;
+  uint64_t* ends;
+  uint32_t lane_count;
+} _write_batch;
+
+static void _gather(_write_batch* batch, publish_queue_lane* lane, uint32_t index, uint64_t end)
+{
+  size_t offset = (size_t)(lane->tail & lane->mask);
+  size_t size = (size_t)(end - lane->tail);
+  size_t first = _lane_capacity(lane) - offset < size ? _lane_capacity(lane) - offset : size;
+
+  batch->iov[batch->iov_count].iov_base = lane->buffer + offset;
+  batch->iov[batch->iov_count++].iov_len = first;
+  if (first < size)
+  {
+    batch->iov[batch->iov_count].iov_base = lane->buffer;
+    batch->iov[batch->iov_count++].iov_len = size - first;
+  }
+  batch->lanes[batch->lane_count] = index;
+  batch->ends[batch->lane_count++] = end;
+}
+
+ssize_t publish_queue_write(publish_queue* queue, int fd)
+{
+  uint32_t count = __atomic_load_n(&queue->lane_count, __ATOMIC_ACQUIRE);
+  ssize_t written;
+  uint64_t remaining;
+
+  if (count > queue->options.max_lanes)
+  {
+    count = queue->options.max_lanes;
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  struct iovec iov[2 * count];
+  uint32_t lanes[count];
+  uint64_t ends[count];
+  _write_batch batch = { iov, 0, lanes, ends, 0 };
+
+  /* Only the rest of the packet cut in two has to come first, the lane is not written further so
+   * that it does not get ahead of the high priority lanes. */
+  if (queue->partial)
+  {
+    publish_queue_lane* lane = queue->lanes[queue->partial_lane];
+    _gather(&batch, lane, queue->partial_lane, lane->packet_end);
+  }
+  for (int priority = 0; priority < PUBLISH_QUEUE_PRIORITY_COUNT; priority++)
+  {
+    uint32_t start = queue->next_lane[priority] % count;
+
+    for (uint32_t k = 0; k < count; k++)
+    {
+      uint32_t index = (start + k) % count;
+      publish_queue_lane* lane = __atomic_load_n(&queue->lanes[index], __ATOMIC_ACQUIRE);
+      uint64_t head;
+
+      if (lane == NULL || lane->priority != (publish_queue_priority)priority
+          || (queue->partial && index == queue->partial_lane)
+          || (head = __atomic_load_n(&lane->head, __ATOMIC_ACQUIRE)) == lane->tail)
+      {
+        continue;
+      }
+      _gather(&batch, lane, index, head);
+    }
+    queue->next_lane[priority] = (start + 1) % count;
+  }
+  if (batch.iov_count == 0)
+  {
+    return 0;
+  }
+
+  struct msghdr message = { 0 };
+  message.msg_iov = iov;
+  message.msg_iovlen = (size_t)batch.iov_count;
+  if ((written = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0)
+  {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  }
+  stat_add(&queue->writes, 1);
+  stat_add(&queue->bytes, (uint64_t)written);
+
+  /* The ranges were written in order, the first one not written to its end has the packet cut in
+   * two, if any. */
+  remaining = (uint64_t)written;
+  queue->partial = false;
+  for (uint32_t u = 0; u < batch.lane_count; u++)
+  {
+    publish_queue_lane* lane = queue->lanes[lanes[u]];
+    uint64_t tail = lane->tail;
+    uint64_t boundary;
+
+    if (remaining >= ends[u] - tail)
+    {
+      remaining -= ends[u] - tail;
+      __atomic_store_n(&lane->tail, ends[u], __ATOMIC_RELEASE);
+      continue;
+    }
+    /* Walks the packets from the last known boundary to the first one at or after the new tail. */
+    boundary = tail < lane->packet_end ? lane->packet_end : tail;
+    while (boundary < tail + remaining)
+    {
+      boundary += _packet_length(lane, boundary);
+    }
+    lane->packet_end = boundary;
+    __atomic_store_n(&lane->tail, tail + remaining, __ATOMIC_RELEASE);
+    queue->partial = boundary != tail + remaining;
+    queue->partial_lane = lanes[u];
+    break;
+  }
+  return written;
+}
+
+bool publish_queue_partial(const publish_queue* queue) { return queue->partial; }
+
+void publish_queue_drop_partial(publish_queue* queue)
+{
+  if (queue->partial)
+  {
+    publish_queue_lane* lane = queue->lanes[queue->partial_lane];
+    __atomic_store_n(&lane->tail, lane->packet_end, __ATOMIC_RELEASE);
+    queue->partial = false;
+    stat_add(&queue->dropped, 1);
+  }
+}
+
+/* With TLS, hands the packets to mosquitto one by one, high priority lanes first, corking the
+ * socket so that they still leave in full segments. Stops once mosquitto cannot write them right
+ * away. */
+static int _publish_through_mosquitto(publish_queue* queue)
+{
+  uint32_t count = __atomic_load_n(&queue->lane_count, __ATOMIC_ACQUIRE);
+  bool v5 = queue->options.mqtt_version == MQTT_PROTOCOL_V5;
+  int fd = mosquitto_socket(queue->mosq);
+  int cork = 1;
+  int result = 0;
+
+  if (count > queue->options.max_lanes)
+  {
+    count = queue->options.max_lanes;
+  }
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+
+  for (uint32_t k = 0; k < PUBLISH_QUEUE_PRIORITY_COUNT * count && result == 0
+                     && !mosquitto_want_write(queue->mosq);
+       k++)
+  {
+    int priority = (int)(k / count);
+    publish_queue_lane* lane = __atomic_load_n(
+        &queue->lanes[(queue->next_lane[priority] + k) % count], __ATOMIC_ACQUIRE);
+    uint64_t head = lane != NULL && lane->priority == (publish_queue_priority)priority
+        ? __atomic_load_n(&lane->head, __ATOMIC_ACQUIRE)
+        : 0;
+
+    while (lane != NULL && lane->tail < head && !mosquitto_want_write(queue->mosq))
+    {
+      uint64_t length = _packet_length(lane, lane->tail);
+      unsigned char* packet = queue->scratch;
+      char* topic = (char*)queue->scratch + _lane_capacity(lane);
+      size_t offset = 1;
+      size_t topic_length;
+      int rc;
+
+      _lane_read(lane, lane->tail, packet, (size_t)length);
+      while ((packet[offset++] & 0x80) != 0)
+      {
+      }
+      topic_length = (size_t)packet[offset] << 8 | packet[offset + 1];
+      offset += 2;
+      memcpy(topic, packet + offset, topic_length);
+      topic[topic_length] = '\0';
+      offset += topic_length + (v5 ? 1 : 0);
+
+      rc = mosquitto_publish_v5(
+          queue->mosq,
+          NULL,
+          topic,
+          (int)(length - offset),
+          packet + offset,
+          0,
+          (packet[0] & RETAIN_FLAG) != 0,
+          NULL);
+      __atomic_store_n(&lane->tail, lane->tail + length, __ATOMIC_RELEASE);
+      if (rc != MOSQ_ERR_SUCCESS)
+      {
+        LOG_ERROR("Failed to publish a queued message: %s", mosquitto_strerror(rc));
+        result = -1;
+        break;
+      }
+      stat_add(&queue->writes, 1);
+      stat_add(&queue->bytes, length);
+    }
+  }
+
+  cork = 0;
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+  for (int priority = 0; priority < PUBLISH_QUEUE_PRIORITY_COUNT && count > 0; priority++)
+  {
+    queue->next_lane[priority] = (queue->next_lane[priority] + 1) % count;
+  }
+  return result;
+}
+
+/* The socket is new on every connection. */
+static void _set_unsent_limit(publish_queue* queue)
+{
+  int limit = (int)queue->options.unsent_limit;
+
+  if (limit > 0
+      && setsockopt(
+             mosquitto_socket(queue->mosq), IPPROTO_TCP, TCP_NOTSENT_LOWAT, &limit, sizeof(limit))
+          != 0)
+  {
+    LOG_WARNING("Failed to limit the unsent bytes of the publish queue: %s", strerror(errno));
+  }
+}
+
+static void _on_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  publish_queue* queue = obj;
+
+  on_connect(mosq, obj, reason_code, flags, props);
+  queue->connack = reason_code == 0;
+}
+
+static void _connection_lost(publish_queue* queue, const char* reason)
+{
+  LOG_ERROR("The publish queue lost its connection: %s", reason);
+  publish_queue_drop_partial(queue);
+  queue->connected = false;
+  queue->connack = false;
+  queue->reconnect_at_ns = monotonic_ns() + RECONNECT_DELAY_NS;
+}
+
+static void _reconnect(publish_queue* queue)
+{
+  int rc;
+
+  if (monotonic_ns() < queue->reconnect_at_ns)
+  {
+    return;
+  }
+  if ((rc = mosquitto_reconnect(queue->mosq)) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("The publish queue failed to reconnect: %s", mosquitto_strerror(rc));
+    queue->reconnect_at_ns = monotonic_ns() + RECONNECT_DELAY_NS;
+    return;
+  }
+  queue->connected = true;
+  _set_unsent_limit(queue);
+  stat_add(&queue->reconnects, 1);
+}
+
+/* Writes the lanes once the connection is acknowledged and mosquitto has nothing left to write,
+ * or to finish a partially written packet. */
+static void _flush(publish_queue* queue)
+{
+  if (!queue->partial && (!queue->connack || mosquitto_want_write(queue->mosq)))
+  {
+    return;
+  }
+  if (queue->use_tls)
+  {
+    if (_publish_through_mosquitto(queue) != 0)
+    {
+      _connection_lost(queue, "publish failed");
+    }
+  }
+  else if (publish_queue_write(queue, mosquitto_socket(queue->mosq)) < 0)
+  {
+    _connection_lost(queue, strerror(errno));
+  }
+}
+
+/* Event loop of the network thread: writes the lanes, then waits for the connection or a lane,
+ * and hands the connection to mosquitto between whole packets. */
+static void* _network_thread(void* argument)
+{
+  publish_queue* queue = argument;
+
+  while (__atomic_load_n(&queue->running, __ATOMIC_RELAXED) && keep_running)
+  {
+    struct pollfd fds[2];
+    nfds_t fd_count = 1;
+
+    if (!queue->connected)
+    {
+      _reconnect(queue);
+    }
+    if (queue->connected)
+    {
+      _flush(queue);
+    }
+
+    fds[0].fd = queue->wake_fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    if (queue->connected)
+    {
+      fds[1].fd = mosquitto_socket(queue->mosq);
+      fds[1].events = queue->partial ? POLLOUT
+                                     : POLLIN | (mosquitto_want_write(queue->mosq) ? POLLOUT : 0);
+      fds[1].revents = 0;
+      fd_count = 2;
+    }
+
+    /* Producers only write to wake_fd when the thread is sleeping, so check the lanes once more
+     * after announcing it. Pending packets wait for the socket to be writable. */
+    __atomic_store_n(&queue->sleeping, true, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (fd_count == 2 && queue->connack && _lanes_pending(queue))
+    {
+      fds[1].events |= POLLOUT;
+    }
+    if (poll(fds, fd_count, POLL_TIMEOUT_MS) < 0 && errno != EINTR)
+    {
+      LOG_ERROR("The publish queue failed to poll: %s", strerror(errno));
+    }
+    __atomic_store_n(&queue->sleeping, false, __ATOMIC_RELAXED);
+
+    if (fds[0].revents & POLLIN)
+    {
+      uint64_t wakes;
+      if (read(queue->wake_fd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN)
+      {
+        LOG_ERROR("The publish queue failed to read its wake event: %s", strerror(errno));
+      }
+    }
+
+    /* mosquitto may write while reading, ex. acknowledgements, so it waits for whole packets. */
+    if (fd_count == 2 && !queue->partial)
+    {
+      int rc = MOSQ_ERR_SUCCESS;
+
+      if (fds[1].revents & (POLLIN | POLLERR | POLLHUP))
+      {
+        rc = mosquitto_loop_read(queue->mosq, 1);
+      }
+      if (rc == MOSQ_ERR_SUCCESS && (fds[1].revents & POLLOUT)
+          && mosquitto_want_write(queue->mosq))
+      {
+        rc = mosquitto_loop_write(queue->mosq, 1);
+      }
+      if (rc == MOSQ_ERR_SUCCESS)
+      {
+        rc = mosquitto_loop_misc(queue->mosq);
+      }
+      if (rc != MOSQ_ERR_SUCCESS)
+      {
+        _connection_lost(queue, mosquitto_strerror(rc));
+      }
+    }
+  }
+  return NULL;
+}
+
+int publish_queue_start(
+    publish_queue* queue,
+    const mqtt_client_connection_settings* connection_settings)
+{
+  int rc;
+
+  queue->use_tls = connection_settings->use_TLS;
+  if (queue->use_tls)
+  {
+    uint64_t capacity = MIN_LANE_CAPACITY;
+    while (capacity < queue->options.lane_capacity)
+    {
+      capacity <<= 1;
+    }
+    /* A whole packet, then its topic with a terminating null. */
+    if ((queue->scratch = malloc(capacity + UINT16_MAX + 1)) == NULL)
+    {
+      LOG_ERROR("Out of memory.");
+      return -1;
+    }
+  }
+
+  queue->obj.mqtt_version = queue->options.mqtt_version;
+  if ((queue->mosq = mqtt_client_new(false, connection_settings, _on_connect, &queue->obj))
+      == NULL)
+  {
+    return -1;
+  }
+  if ((rc = mosquitto_connect_bind_v5(
+           queue->mosq,
+           queue->obj.hostname,
+           queue->obj.tcp_port,
+           queue->obj.keep_alive_in_seconds,
+           NULL,
+           NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("The publish queue failed to connect: %s", mosquitto_strerror(rc));
+    return -1;
+  }
+  queue->connected = true;
+  _set_unsent_limit(queue);
+
+  queue->running = true;
+  if (pthread_create(&queue->thread, NULL, _network_thread, queue) != 0)
+  {
+    LOG_ERROR("Failed to start the publish queue thread.");
+    queue->running = false;
+    return -1;
+  }
+  queue->started = true;
+  return 0;
+}
+
+void publish_queue_destroy(publish_queue* queue)
+{
+  if (queue->started)
+  {
+    uint64_t wake = 1;
+
+    __atomic_store_n(&queue->running, false, __ATOMIC_RELAXED);
+    if (write(queue->wake_fd, &wake, sizeof(wake)) < 0)
+    {
+      LOG_ERROR("Failed to wake the publish queue: %s", strerror(errno));
+    }
+    pthread_join(queue->thread, NULL);
+    queue->started = false;
+  }
+  if (queue->mosq != NULL)
+  {
+    /* The DISCONNECT can't follow a partially written packet. */
+    if (queue->connected && !queue->partial)
+    {
+      mosquitto_disconnect_v5(queue->mosq, 0, NULL);
+      mosquitto_loop_write(queue->mosq, 1);
+    }
+    mosquitto_destroy(queue->mosq);
+    queue->mosq = NULL;
+  }
+
+  if (queue->lanes != NULL)
+  {
+    uint32_t count = queue->lane_count < queue->options.max_lanes ? queue->lane_count
+                                                                  : queue->options.max_lanes;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (queue->lanes[i] != NULL)
+      {
+        free(queue->lanes[i]->buffer);
+        free(queue->lanes[i]);
+      }
+    }
+    free(queue->lanes);
+    queue->lanes = NULL;
+  }
+  free(queue->scratch);
+  queue->scratch = NULL;
+  if (queue->wake_fd >= 0)
+  {
+    close(queue->wake_fd);
+    queue->wake_fd = -1;
+  }
+}
+
+void publish_queue_read_stats(publish_queue* queue, publish_queue_stats* stats)
+{
+  uint32_t count = __atomic_load_n(&queue->lane_count, __ATOMIC_ACQUIRE);
+
+  memset(stats, 0, sizeof(publish_queue_stats));
+  for (uint32_t i = 0; i < count && i < queue->options.max_lanes; i++)
+  {
+    publish_queue_lane* lane = __atomic_load_n(&queue->lanes[i], __ATOMIC_ACQUIRE);
+    if (lane != NULL)
+    {
+      stats->messages += __atomic_load_n(&lane->messages, __ATOMIC_RELAXED);
+      stats->lane_full += __atomic_load_n(&lane->full, __ATOMIC_RELAXED);
+    }
+  }
+  stats->writes = __atomic_load_n(&queue->writes, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&queue->bytes, __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+  stats->reconnects = __atomic_load_n(&queue->reconnects, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,224 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PUBLISH_QUEUE_H
+#define PUBLISH_QUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PUBLISH_QUEUE_DEFAULT_LANE_CAPACITY (256 * 1024)
+#define PUBLISH_QUEUE_DEFAULT_MAX_LANES 64
+/* Every lane takes at most two iovecs of a write. */
+#define PUBLISH_QUEUE_MAX_LANES 512
+
+/* Each write takes the packets of the high priority lanes before those of the bulk lanes. */
+typedef enum publish_queue_priority
+{
+  /* Commands, command responses and alerts. */
+  PUBLISH_QUEUE_PRIORITY_HIGH,
+  /* Telemetry, which gets what capacity the high priority lanes leave. */
+  PUBLISH_QUEUE_PRIORITY_BULK,
+  PUBLISH_QUEUE_PRIORITY_COUNT
+} publish_queue_priority;
+
+/* Single-producer single-consumer ring of encoded PUBLISH packets. Positions only grow, the
+ * producer owns head and the network thread owns tail. */
+typedef struct publish_queue_lane
+{
+  struct publish_queue* queue;
+  unsigned char* buffer;
+  uint64_t mask;
+  publish_queue_priority priority;
+  uint64_t head __attribute__((aligned(64)));
+  /* Last tail seen by the producer, so it only reads tail when the lane looks full. */
+  uint64_t cached_tail;
+  uint64_t messages;
+  uint64_t full;
+  uint64_t tail __attribute__((aligned(64)));
+  /* End of the packet being written when a write stopped inside it. */
+  uint64_t packet_end;
+} publish_queue_lane;
+
+/* Counters of a publish_queue, see publish_queue_read_stats(). */
+typedef struct publish_queue_stats
+{
+  /* Messages queued by the lanes. */
+  uint64_t messages;
+  /* Messages refused because their lane was full. */
+  uint64_t lane_full;
+  /* Socket writes, or publishes handed to mosquitto with TLS. */
+  uint64_t writes;
+  uint64_t bytes;
+  /* Partially written packets dropped with their connection. */
+  uint64_t dropped;
+  uint64_t reconnects;
+} publish_queue_stats;
+
+typedef struct publish_queue_options
+{
+  /* Bytes of encoded packets each lane holds, rounded up to a power of two. */
+  size_t lane_capacity;
+  /* Lanes publish_queue_lane_open() can open. */
+  uint32_t max_lanes;
+  /* MQTT_PROTOCOL_V311 or MQTT_PROTOCOL_V5, the packets are encoded for it. */
+  int mqtt_version;
+  /* Bytes written to the socket and not yet sent past which the kernel refuses more
+   * (TCP_NOTSENT_LOWAT), 0 for no limit. Bulk packets then wait in their lanes rather than in the
+   * socket, where high priority packets would be queued behind them. */
+  uint32_t unsent_limit;
+} publish_queue_options;
+
+/*
+ * Publish path for several threads sharing a connection. Each thread opens its own lane and
+ * encodes its QoS 0 PUBLISH packets into it without locks. The network thread owns the connection
+ * and, once per loop iteration, writes the packets of every lane with a single sendmsg(), so small
+ * messages are coalesced into few syscalls and TCP segments. Writes of mosquitto (CONNECT, PINGREQ,
+ * acknowledgements) are only made between whole packets of the lanes.
+ *
+ * The packets of high priority lanes go before those of bulk lanes in every write, and with an
+ * unsent_limit bulk packets fill the socket only up to it, so commands are not delayed by the
+ * telemetry of the same connection by more than unsent_limit bytes. Commands can also get a
+ * connection of their own with a second publish_queue.
+ *
+ * With TLS the socket belongs to the TLS session, so the network thread hands the packets to
+ * mosquitto_publish_v5() instead, with TCP_CORK set while it does.
+ */
+typedef struct publish_queue
+{
+  /* First, so the mosquitto callbacks get the queue as their object. */
+  mqtt_client_obj obj;
+  publish_queue_options options;
+  publish_queue_lane** lanes;
+  uint32_t lane_count;
+  /* Network thread state. */
+  struct mosquitto* mosq;
+  bool use_tls;
+  unsigned char* scratch;
+  /* Lane each priority starts from in the next write, so that its lanes take turns. */
+  uint32_t next_lane[PUBLISH_QUEUE_PRIORITY_COUNT];
+  bool partial;
+  uint32_t partial_lane;
+  bool connected;
+  bool connack;
+  int64_t reconnect_at_ns;
+  int wake_fd;
+  bool sleeping;
+  bool running;
+  bool started;
+  pthread_t thread;
+  uint64_t writes;
+  uint64_t bytes;
+  uint64_t dropped;
+  uint64_t reconnects;
+} publish_queue;
+
+/**
+ * @brief Initializes a publish_queue without connection, for writing its lanes with
+ * publish_queue_write(). Must be destroyed with publish_queue_destroy().
+ *
+ * @param queue The publish_queue to initialize.
+ * @param options The options, copied, with 0 fields set to their defaults.
+ * @return int 0 on success, -1 on failure.
+ */
+int publish_queue_init(publish_queue* queue, const publish_queue_options* options);
+
+/**
+ * @brief Connects and starts the network thread, which writes the lanes and reconnects when the
+ * connection is lost. Returns once connected. Stopped by publish_queue_destroy().
+ *
+ * @param queue The publish_queue, initialized.
+ * @param connection_settings The connection settings, ex. read by mqtt_client_load_settings().
+ * @return int 0 on success, -1 on failure.
+ */
+int publish_queue_start(
+    publish_queue* queue,
+    const mqtt_client_connection_settings* connection_settings);
+
+/**
+ * @brief Stops the network thread if started, disconnects and frees the lanes. Messages still in
+ * the lanes are dropped.
+ *
+ * @param queue The publish_queue to destroy.
+ */
+void publish_queue_destroy(publish_queue* queue);
+
+/**
+ * @brief Opens a lane. Can be called from any thread, and the lane must then only be published to
+ * by one thread at a time.
+ *
+ * @param queue The publish_queue.
+ * @param priority The priority of the packets of the lane.
+ * @return publish_queue_lane* The lane, or NULL if max_lanes are open or out of memory.
+ */
+publish_queue_lane* publish_queue_lane_open(publish_queue* queue, publish_queue_priority priority);
+
+/**
+ * @brief Encodes a QoS 0 PUBLISH packet into the lane, for the network thread to write.
+ *
+ * @param lane The lane of the calling thread.
+ * @param topic The topic, without wildcards.
+ * @param payload The payload.
+ * @param payload_length The length of payload.
+ * @param retain Whether the broker retains the message.
+ * @return int 0 on success, -1 if the lane is full or the message is invalid or larger than the
+ * lane.
+ */
+int publish_queue_publish(
+    publish_queue_lane* lane,
+    const char* topic,
+    const void* payload,
+    size_t payload_length,
+    bool retain);
+
+/**
+ * @brief Writes the packets of every lane to a socket with a single sendmsg(). After a partial
+ * write the rest of the packet cut in two comes first, then the high priority lanes and the bulk
+ * lanes, each taking turns with the lanes of its priority. Only for one thread, the network thread
+ * once started.
+ *
+ * @param queue The publish_queue.
+ * @param fd A non-blocking socket.
+ * @return ssize_t The bytes written, 0 if none were pending or the socket is full, -1 on error.
+ */
+ssize_t publish_queue_write(publish_queue* queue, int fd);
+
+/**
+ * @brief Whether the last write stopped inside a packet, in which case nothing else may be written
+ * to the socket before the rest of the packet.
+ *
+ * @param queue The publish_queue.
+ * @return bool true if a packet is partially written.
+ */
+bool publish_queue_partial(const publish_queue* queue);
+
+/**
+ * @brief Drops the rest of a partially written packet, when its connection is lost.
+ *
+ * @param queue The publish_queue.
+ */
+void publish_queue_drop_partial(publish_queue* queue);
+
+/**
+ * @brief Sums the counters of the queue and its lanes. Can be called from any thread.
+ *
+ * @param queue The publish_queue.
+ * @param stats Receives the counters.
+ */
+void publish_queue_read_stats(publish_queue* queue, publish_queue_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PUBLISH_QUEUE_H */
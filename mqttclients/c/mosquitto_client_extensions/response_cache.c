@@ -0,0 +1,263 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extensions_internal.h"
+#include "logging.h"
+#include "response_cache.h"
+
+static void _lru_unlink(response_cache* cache, uint32_t index)
+{
+  response_cache_entry* entry = &cache->entries[index];
+
+  if (entry->lru_prev != RESPONSE_CACHE_NO_ENTRY)
+  {
+    cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+  }
+  else
+  {
+    cache->lru_head = entry->lru_next;
+  }
+
+  if (entry->lru_next != RESPONSE_CACHE_NO_ENTRY)
+  {
+    cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+  }
+  else
+  {
+    cache->lru_tail = entry->lru_prev;
+  }
+}
+
+static void _lru_push_front(response_cache* cache, uint32_t index)
+{
+  response_cache_entry* entry = &cache->entries[index];
+
+  entry->lru_prev = RESPONSE_CACHE_NO_ENTRY;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head != RESPONSE_CACHE_NO_ENTRY)
+  {
+    cache->entries[cache->lru_head].lru_prev = index;
+  }
+  cache->lru_head = index;
+  if (cache->lru_tail == RESPONSE_CACHE_NO_ENTRY)
+  {
+    cache->lru_tail = index;
+  }
+}
+
+/* Removes an entry from its hash chain and the LRU list and returns it to the free list. */
+static void _remove(response_cache* cache, uint32_t index)
+{
+  response_cache_entry* entry = &cache->entries[index];
+  uint32_t* link = &cache->buckets[entry->hash & cache->bucket_mask];
+
+  while (*link != index)
+  {
+    link = &cache->entries[*link].hash_next;
+  }
+  *link = entry->hash_next;
+
+  _lru_unlink(cache, index);
+  entry->hash_next = cache->free_head;
+  cache->free_head = index;
+  cache->count--;
+}
+
+static uint32_t _find(
+    const response_cache* cache,
+    uint32_t hash,
+    const void* key,
+    size_t key_length)
+{
+  uint32_t index = cache->buckets[hash & cache->bucket_mask];
+
+  while (index != RESPONSE_CACHE_NO_ENTRY)
+  {
+    const response_cache_entry* entry = &cache->entries[index];
+    if (entry->hash == hash && entry->key_length == key_length
+        && memcmp(entry->key, key, key_length) == 0)
+    {
+      return index;
+    }
+    index = entry->hash_next;
+  }
+  return RESPONSE_CACHE_NO_ENTRY;
+}
+
+int response_cache_init(
+    response_cache* cache,
+    uint32_t capacity,
+    size_t max_response_length,
+    int ttl_seconds)
+{
+  uint32_t bucket_count = 1;
+
+  memset(cache, 0, sizeof(response_cache));
+  if (capacity == 0 || capacity > RESPONSE_CACHE_MAX_CAPACITY
+      || max_response_length > SIZE_MAX / capacity)
+  {
+    LOG_ERROR(
+        "Invalid response cache capacity %u for responses of %zu bytes.",
+        capacity,
+        max_response_length);
+    return -1;
+  }
+
+  /* Twice as many buckets as entries keeps the hash chains short. */
+  while (bucket_count < capacity * 2)
+  {
+    bucket_count <<= 1;
+  }
+
+  cache->entries = calloc(capacity, sizeof(response_cache_entry));
+  cache->responses = malloc(capacity * max_response_length);
+  cache->buckets = malloc(bucket_count * sizeof(uint32_t));
+  if (cache->entries == NULL || cache->responses == NULL || cache->buckets == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for response cache.");
+    response_cache_destroy(cache);
+    return -1;
+  }
+
+  cache->bucket_mask = bucket_count - 1;
+  cache->capacity = capacity;
+  cache->count = 0;
+  cache->lru_head = RESPONSE_CACHE_NO_ENTRY;
+  cache->lru_tail = RESPONSE_CACHE_NO_ENTRY;
+  cache->max_response_length = max_response_length;
+  cache->ttl_seconds = ttl_seconds;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+
+  for (uint32_t i = 0; i < bucket_count; i++)
+  {
+    cache->buckets[i] = RESPONSE_CACHE_NO_ENTRY;
+  }
+  for (uint32_t i = 0; i < capacity; i++)
+  {
+    cache->entries[i].response = cache->responses + (size_t)i * max_response_length;
+    cache->entries[i].hash_next = i + 1 < capacity ? i + 1 : RESPONSE_CACHE_NO_ENTRY;
+  }
+  cache->free_head = 0;
+
+  return 0;
+}
+
+size_t response_cache_request_key(
+    uint8_t* key,
+    const char* method,
+    const char* response_topic,
+    const void* correlation_data,
+    size_t correlation_data_length)
+{
+  /* Both names keep their null terminator, which no name contains, so keys can't be ambiguous. */
+  size_t method_size = strlen(method) + 1;
+  size_t topic_size = strlen(response_topic) + 1;
+  size_t length = method_size + topic_size + correlation_data_length;
+
+  if (length <= RESPONSE_CACHE_MAX_KEY_LENGTH)
+  {
+    memcpy(key, method, method_size);
+    memcpy(key + method_size, response_topic, topic_size);
+    memcpy(key + method_size + topic_size, correlation_data, correlation_data_length);
+  }
+  return length;
+}
+
+const response_cache_entry* response_cache_get(
+    response_cache* cache,
+    const void* key,
+    size_t key_length,
+    time_t now)
+{
+  uint32_t index;
+
+  if (key_length > RESPONSE_CACHE_MAX_KEY_LENGTH)
+  {
+    cache->misses++;
+    return NULL;
+  }
+
+  index = _find(cache, fnv1a_32(FNV1A_32_INIT, key, key_length), key, key_length);
+  if (index == RESPONSE_CACHE_NO_ENTRY)
+  {
+    cache->misses++;
+    return NULL;
+  }
+
+  if (cache->entries[index].expires_at <= now)
+  {
+    _remove(cache, index);
+    cache->misses++;
+    return NULL;
+  }
+
+  _lru_unlink(cache, index);
+  _lru_push_front(cache, index);
+  cache->hits++;
+  return &cache->entries[index];
+}
+
+bool response_cache_put(
+    response_cache* cache,
+    const void* key,
+    size_t key_length,
+    const void* response,
+    size_t response_length,
+    time_t now)
+{
+  uint32_t hash;
+  uint32_t index;
+  response_cache_entry* entry;
+
+  if (key_length > RESPONSE_CACHE_MAX_KEY_LENGTH || response_length > cache->max_response_length)
+  {
+    return false;
+  }
+
+  hash = fnv1a_32(FNV1A_32_INIT, key, key_length);
+  if ((index = _find(cache, hash, key, key_length)) != RESPONSE_CACHE_NO_ENTRY)
+  {
+    _remove(cache, index);
+  }
+  else if (cache->count == cache->capacity)
+  {
+    _remove(cache, cache->lru_tail);
+    cache->evictions++;
+  }
+
+  index = cache->free_head;
+  entry = &cache->entries[index];
+  cache->free_head = entry->hash_next;
+
+  entry->hash = hash;
+  entry->expires_at = now + cache->ttl_seconds;
+  entry->key_length = (uint16_t)key_length;
+  entry->response_length = response_length;
+  memcpy(entry->key, key, key_length);
+  memcpy(entry->response, response, response_length);
+
+  entry->hash_next = cache->buckets[hash & cache->bucket_mask];
+  cache->buckets[hash & cache->bucket_mask] = index;
+  _lru_push_front(cache, index);
+  cache->count++;
+
+  return true;
+}
+
+void response_cache_destroy(response_cache* cache)
+{
+  free(cache->entries);
+  cache->entries = NULL;
+  free(cache->responses);
+  cache->responses = NULL;
+  free(cache->buckets);
+  cache->buckets = NULL;
+  cache->capacity = 0;
+  cache->count = 0;
+}
@@ -0,0 +1,143 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Keys longer than this are not cached. */
+#define RESPONSE_CACHE_MAX_KEY_LENGTH 256
+
+#define RESPONSE_CACHE_NO_ENTRY UINT32_MAX
+/* Largest capacity, so that the twice as many buckets still fit in a uint32_t. */
+#define RESPONSE_CACHE_MAX_CAPACITY (UINT32_C(1) << 30)
+
+typedef struct response_cache_entry
+{
+  uint32_t hash;
+  uint32_t hash_next;
+  uint32_t lru_prev;
+  uint32_t lru_next;
+  time_t expires_at;
+  uint16_t key_length;
+  size_t response_length;
+  unsigned char key[RESPONSE_CACHE_MAX_KEY_LENGTH];
+  unsigned char* response;
+} response_cache_entry;
+
+/*
+ * Fixed-size cache of serialized responses keyed by their request, see
+ * response_cache_request_key(), used to answer redelivered requests without executing them again.
+ * Entries are evicted least recently used first and expire ttl_seconds after they were added. All
+ * memory is allocated at init.
+ */
+typedef struct response_cache
+{
+  response_cache_entry* entries;
+  unsigned char* responses;
+  uint32_t* buckets;
+  uint32_t bucket_mask;
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t lru_head;
+  uint32_t lru_tail;
+  uint32_t free_head;
+  size_t max_response_length;
+  int ttl_seconds;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+} response_cache;
+
+/**
+ * @brief Initializes a response_cache. The response_cache must be freed with
+ * response_cache_destroy().
+ *
+ * @param cache The response_cache to initialize.
+ * @param capacity The maximum number of cached responses, at most RESPONSE_CACHE_MAX_CAPACITY.
+ * @param max_response_length Responses longer than this are not cached.
+ * @param ttl_seconds How long a response stays in the cache.
+ * @return int 0 on success, -1 if the capacity is out of range, the responses don't fit in memory
+ * or out of memory.
+ */
+int response_cache_init(
+    response_cache* cache,
+    uint32_t capacity,
+    size_t max_response_length,
+    int ttl_seconds);
+
+/**
+ * @brief Builds the key the response to a request is cached under. Requests are identified by
+ * their method, response topic and correlation data together, so that callers or methods that use
+ * the same correlation data don't get each other's responses.
+ *
+ * @param key The buffer of RESPONSE_CACHE_MAX_KEY_LENGTH bytes the key is written to.
+ * @param method The name of the method the request is addressed to.
+ * @param response_topic The response topic of the request.
+ * @param correlation_data The correlation data of the request.
+ * @param correlation_data_length The length of the correlation data.
+ * @return size_t The length of the key. Keys longer than RESPONSE_CACHE_MAX_KEY_LENGTH are not
+ * written, and are neither found nor cached by response_cache_get() and response_cache_put().
+ */
+size_t response_cache_request_key(
+    uint8_t* key,
+    const char* method,
+    const char* response_topic,
+    const void* correlation_data,
+    size_t correlation_data_length);
+
+/**
+ * @brief Looks up the response cached for a key and marks it as most recently used.
+ *
+ * @param cache The response_cache to search.
+ * @param key The key of the request, see response_cache_request_key().
+ * @param key_length The length of the key.
+ * @param now The current time, used to expire entries.
+ * @return const response_cache_entry* The cached entry, or NULL if there isn't one. Only valid
+ * until the next call to response_cache_put().
+ */
+const response_cache_entry* response_cache_get(
+    response_cache* cache,
+    const void* key,
+    size_t key_length,
+    time_t now);
+
+/**
+ * @brief Caches a copy of a response, evicting the least recently used entry if the cache is full.
+ *
+ * @param cache The response_cache to add to.
+ * @param key The key of the request, see response_cache_request_key().
+ * @param key_length The length of the key.
+ * @param response The serialized response.
+ * @param response_length The length of the serialized response.
+ * @param now The current time, used to set the expiry of the entry.
+ * @return true if the response was cached, false if the key or response is too long.
+ */
+bool response_cache_put(
+    response_cache* cache,
+    const void* key,
+    size_t key_length,
+    const void* response,
+    size_t response_length,
+    time_t now);
+
+/**
+ * @brief Frees the memory of a response_cache.
+ *
+ * @param cache The response_cache to free.
+ */
+void response_cache_destroy(response_cache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESPONSE_CACHE_H */
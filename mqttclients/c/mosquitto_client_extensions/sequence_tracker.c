@@ -0,0 +1,365 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extensions_internal.h"
+#include "logging.h"
+#include "mqtt_protocol.h"
+#include "sequence_tracker.h"
+
+/* Key of the empty slots, hashes of 0 are stored as 1. */
+#define EMPTY_SOURCE 0
+/* Sequences before the next one whose delivery is remembered. */
+#define HISTORY_LENGTH 64
+/* "<session>:<sequence>" with both at their maximum. */
+#define PROPERTY_VALUE_LENGTH 24
+
+typedef struct sequence_source
+{
+  uint64_t key;
+  /* Order of arrival of the source, indexing its id and its held items. */
+  uint32_t index;
+  uint32_t session;
+  /* Sequence delivered next. */
+  uint32_t next;
+  /* Bit i set when next + i is held. */
+  uint64_t held;
+  /* Bit i set when next - 1 - i was delivered. */
+  uint64_t delivered;
+  /* Time the held items started waiting. */
+  int64_t held_since_ms;
+} sequence_source;
+
+static char* _id(const sequence_tracker* tracker, const sequence_source* source)
+{
+  return tracker->ids + (size_t)source->index * (tracker->options.max_id_length + 1);
+}
+
+static void* _item(
+    const sequence_tracker* tracker,
+    const sequence_source* source,
+    uint32_t sequence)
+{
+  return tracker->items
+      + ((size_t)source->index * tracker->options.window + sequence % tracker->options.window)
+      * tracker->options.item_size;
+}
+
+/* Returns the source of an id, added if missing, or NULL if the tracker has max_sources or the id
+ * is too long. Ids whose hashes collide get their own slots. */
+static sequence_source* _source(sequence_tracker* tracker, const char* id, bool* added)
+{
+  uint64_t key = fnv1a_64_string(FNV1A_64_INIT, id);
+  uint32_t slot;
+  size_t length;
+
+  key = key == EMPTY_SOURCE ? 1 : key;
+  slot = (uint32_t)key & (tracker->capacity - 1);
+  *added = false;
+  while (tracker->sources[slot].key != EMPTY_SOURCE)
+  {
+    if (tracker->sources[slot].key == key
+        && strcmp(_id(tracker, &tracker->sources[slot]), id) == 0)
+    {
+      return &tracker->sources[slot];
+    }
+    slot = (slot + 1) & (tracker->capacity - 1);
+  }
+  if (tracker->source_count == tracker->options.max_sources
+      || (length = strlen(id)) > tracker->options.max_id_length)
+  {
+    return NULL;
+  }
+  tracker->sources[slot] = (sequence_source){ .key = key, .index = tracker->source_count++ };
+  memcpy(_id(tracker, &tracker->sources[slot]), id, length + 1);
+  *added = true;
+  return &tracker->sources[slot];
+}
+
+/* Moves past the next sequence, delivered or skipped. */
+static void _advance(sequence_tracker* tracker, sequence_source* source, bool delivered)
+{
+  source->held >>= 1;
+  source->delivered = (source->delivered << 1) | delivered;
+  source->next++;
+  if (delivered)
+  {
+    tracker->stats.delivered++;
+  }
+  else
+  {
+    tracker->stats.gaps++;
+  }
+}
+
+/* Delivers the items held from the next sequence on, up to the first gap. */
+static void _drain(
+    sequence_tracker* tracker,
+    sequence_source* source,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  while (source->held & 1)
+  {
+    deliver(_id(tracker, source), _item(tracker, source, source->next), context);
+    _advance(tracker, source, true);
+  }
+}
+
+/* Delivers the items held before target and skips the missing ones, so that target is next. Takes
+ * at most window steps, as nothing is held past them. */
+static void _skip_to(
+    sequence_tracker* tracker,
+    sequence_source* source,
+    uint32_t target,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  uint32_t gap;
+
+  while (source->next != target && source->held != 0)
+  {
+    if (source->held & 1)
+    {
+      deliver(_id(tracker, source), _item(tracker, source, source->next), context);
+    }
+    _advance(tracker, source, source->held & 1);
+  }
+  if ((gap = target - source->next) > 0)
+  {
+    tracker->stats.gaps += gap;
+    source->delivered = gap >= HISTORY_LENGTH ? 0 : source->delivered << gap;
+    source->next = target;
+  }
+}
+
+/* Skips the gap before the held items once they waited max_delay_ms. */
+static void _expire_source(
+    sequence_tracker* tracker,
+    sequence_source* source,
+    int64_t now_ms,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  if (source->held != 0 && now_ms - source->held_since_ms >= tracker->options.max_delay_ms)
+  {
+    _skip_to(
+        tracker, source, source->next + (uint32_t)__builtin_ctzll(source->held), deliver, context);
+    _drain(tracker, source, deliver, context);
+    /* The items still held wait behind another gap. */
+    source->held_since_ms = now_ms;
+  }
+}
+
+int sequence_tracker_init(sequence_tracker* tracker, const sequence_tracker_options* options)
+{
+  memset(tracker, 0, sizeof(sequence_tracker));
+  if (options->max_sources == 0 || options->max_sources > INT32_MAX || options->window == 0
+      || options->window > SEQUENCE_TRACKER_MAX_WINDOW || options->item_size == 0)
+  {
+    LOG_ERROR("Invalid sequence tracker options");
+    return -1;
+  }
+
+  tracker->options = *options;
+  /* The table is kept at most half full. */
+  tracker->capacity = power_of_two_above(options->max_sources * 2);
+  if ((tracker->sources = calloc(tracker->capacity, sizeof(sequence_source))) == NULL
+      || (tracker->ids = malloc(options->max_sources * (options->max_id_length + 1))) == NULL
+      || (tracker->items = malloc(options->max_sources * options->window * options->item_size))
+          == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    sequence_tracker_destroy(tracker);
+    return -1;
+  }
+  return 0;
+}
+
+void sequence_tracker_destroy(sequence_tracker* tracker)
+{
+  free(tracker->sources);
+  free(tracker->ids);
+  free(tracker->items);
+  memset(tracker, 0, sizeof(sequence_tracker));
+}
+
+void sequence_tracker_push(
+    sequence_tracker* tracker,
+    const char* id,
+    uint32_t session,
+    uint32_t sequence,
+    const void* item,
+    int64_t now_ms,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  bool added;
+  sequence_source* source = _source(tracker, id, &added);
+  bool was_holding;
+  uint32_t distance;
+
+  if (source == NULL)
+  {
+    tracker->stats.untracked++;
+    deliver(id, item, context);
+    return;
+  }
+
+  was_holding = source->held != 0;
+  if (added)
+  {
+    source->session = session;
+    source->next = sequence;
+  }
+  else if (session != source->session)
+  {
+    /* Sessions are compared like sequences, so they may wrap. */
+    if ((int32_t)(session - source->session) < 0)
+    {
+      tracker->stats.late++;
+      return;
+    }
+    /* The items held from the previous session are delivered first. */
+    if (source->held != 0)
+    {
+      _skip_to(
+          tracker,
+          source,
+          source->next + HISTORY_LENGTH - (uint32_t)__builtin_clzll(source->held),
+          deliver,
+          context);
+    }
+    source->session = session;
+    source->next = sequence;
+    source->delivered = 0;
+    tracker->stats.restarts++;
+  }
+
+  distance = sequence - source->next;
+  if ((int32_t)distance < 0)
+  {
+    uint32_t behind = source->next - sequence;
+    if (behind <= HISTORY_LENGTH && ((source->delivered >> (behind - 1)) & 1))
+    {
+      tracker->stats.duplicates++;
+    }
+    else
+    {
+      tracker->stats.late++;
+    }
+  }
+  else
+  {
+    /* Landing past the window skips the gaps at its start. */
+    if (distance >= tracker->options.window)
+    {
+      _skip_to(tracker, source, sequence - tracker->options.window + 1, deliver, context);
+      /* The window may now start on a held item. */
+      _drain(tracker, source, deliver, context);
+      distance = sequence - source->next;
+    }
+    if (distance == 0)
+    {
+      deliver(id, item, context);
+      _advance(tracker, source, true);
+      _drain(tracker, source, deliver, context);
+    }
+    else if ((source->held >> distance) & 1)
+    {
+      tracker->stats.duplicates++;
+    }
+    else
+    {
+      memcpy(_item(tracker, source, sequence), item, tracker->options.item_size);
+      source->held |= 1ull << distance;
+      tracker->stats.reordered++;
+    }
+  }
+
+  if (was_holding)
+  {
+    _expire_source(tracker, source, now_ms, deliver, context);
+  }
+  if (!was_holding && source->held != 0)
+  {
+    tracker->holding++;
+    source->held_since_ms = now_ms;
+  }
+  else if (was_holding && source->held == 0)
+  {
+    tracker->holding--;
+  }
+}
+
+void sequence_tracker_expire(
+    sequence_tracker* tracker,
+    int64_t now_ms,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  for (uint32_t i = 0; i < tracker->capacity && tracker->holding > 0; i++)
+  {
+    sequence_source* source = &tracker->sources[i];
+
+    if (source->key != EMPTY_SOURCE && source->held != 0)
+    {
+      _expire_source(tracker, source, now_ms, deliver, context);
+      if (source->held == 0)
+      {
+        tracker->holding--;
+      }
+    }
+  }
+}
+
+int sequence_property_add(mosquitto_property** props, uint32_t session, uint32_t sequence)
+{
+  char value[PROPERTY_VALUE_LENGTH];
+
+  snprintf(value, sizeof(value), "%u:%u", session, sequence);
+  return mosquitto_property_add_string_pair(
+      props, MQTT_PROP_USER_PROPERTY, SEQUENCE_PROPERTY, value);
+}
+
+bool sequence_property_read(const mosquitto_property* props, uint32_t* session, uint32_t* sequence)
+{
+  const mosquitto_property* prop = props;
+  bool skip_first = false;
+  bool found = false;
+  char* name;
+  char* value;
+
+  while (!found
+         && (prop = mosquitto_property_read_string_pair(
+                 prop, MQTT_PROP_USER_PROPERTY, &name, &value, skip_first))
+             != NULL)
+  {
+    skip_first = true;
+    if (strcmp(name, SEQUENCE_PROPERTY) == 0)
+    {
+      char* end;
+      char* start;
+      unsigned long long parsed_session = strtoull(value, &end, 10);
+      unsigned long long parsed_sequence;
+
+      if (end != value && *end == ':' && parsed_session <= UINT32_MAX)
+      {
+        start = end + 1;
+        parsed_sequence = strtoull(start, &end, 10);
+        found = end != start && *end == '\0' && parsed_sequence <= UINT32_MAX;
+      }
+      if (found)
+      {
+        *session = (uint32_t)parsed_session;
+        *sequence = (uint32_t)parsed_sequence;
+      }
+    }
+    free(name);
+    free(value);
+  }
+  return found;
+}
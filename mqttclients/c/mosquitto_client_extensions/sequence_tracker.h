@@ -0,0 +1,154 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SEQUENCE_TRACKER_H
+#define SEQUENCE_TRACKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mosquitto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* MQTT v5 user property stamping a message with "<session>:<sequence>". */
+#define SEQUENCE_PROPERTY "seq"
+/* Most items held behind a gap for a single source. */
+#define SEQUENCE_TRACKER_MAX_WINDOW 64
+
+typedef struct sequence_tracker_options
+{
+  /* Sources tracked, the items of the others are delivered unchecked. */
+  uint32_t max_sources;
+  /* Longest source id, without its terminating null. */
+  size_t max_id_length;
+  /* Items held behind a gap for each source, at most SEQUENCE_TRACKER_MAX_WINDOW. */
+  uint32_t window;
+  /* Size of each item, copied while it is held. */
+  size_t item_size;
+  /* Time after which held items are delivered even though the gap before them is not filled. */
+  uint32_t max_delay_ms;
+} sequence_tracker_options;
+
+typedef struct sequence_tracker_stats
+{
+  uint64_t delivered;
+  /* Items received again, ex. QoS 1 redeliveries. */
+  uint64_t duplicates;
+  /* Items received before an earlier one of their source, then held. */
+  uint64_t reordered;
+  /* Sequences never received, skipped once the window or the delay ran out. */
+  uint64_t gaps;
+  /* Items received after their gap was skipped, or from a previous session, dropped. */
+  uint64_t late;
+  /* Sources that started a new session, ex. a producer that restarted. */
+  uint64_t restarts;
+  /* Items delivered unchecked as the tracker has max_sources. */
+  uint64_t untracked;
+} sequence_tracker_stats;
+
+/**
+ * @brief Called with every item, in sequence order for each source.
+ *
+ * @param id The id of the source.
+ * @param item The item, valid until the function returns.
+ * @param context The context passed to the sequence_tracker.
+ */
+typedef void (*sequence_deliver_callback)(const char* id, const void* item, void* context);
+
+struct sequence_source;
+
+/*
+ * Duplicate suppression and reordering of the messages of many sources, ex. the positions of each
+ * vehicle, stamped by their source with a session, changing when the source restarts, and a
+ * sequence starting at 1 within the session.
+ *
+ * Each source has a window of the next `window` sequences: an item that is next is delivered
+ * right away, along with the items held after it, and an item further in the window is copied and
+ * held until the gap before it is filled. A gap is skipped once an item lands past the window or
+ * once items have been held for max_delay_ms, checked on every item of the source and by
+ * sequence_tracker_expire(). A bitmap of the 64 sequences before the next one tells the
+ * duplicates of delivered items from the late ones. Every operation is O(1) on memory allocated
+ * by sequence_tracker_init(), and the tracker is only used from a single thread.
+ */
+typedef struct sequence_tracker
+{
+  sequence_tracker_options options;
+  /* Slots of the source table, a power of two. */
+  uint32_t capacity;
+  uint32_t source_count;
+  /* Sources holding items. */
+  uint32_t holding;
+  struct sequence_source* sources;
+  /* Ids and held items of the sources, by order of arrival. */
+  char* ids;
+  unsigned char* items;
+  sequence_tracker_stats stats;
+} sequence_tracker;
+
+/**
+ * @brief Allocates the tables of a sequence_tracker.
+ *
+ * @param tracker The sequence_tracker to initialize.
+ * @param options The options, copied.
+ * @return int 0 on success, -1 if the options are invalid or out of memory.
+ */
+int sequence_tracker_init(sequence_tracker* tracker, const sequence_tracker_options* options);
+
+void sequence_tracker_destroy(sequence_tracker* tracker);
+
+/**
+ * @brief Delivers or holds an item, then delivers the items it let through, or drops it if it is a
+ * duplicate or late.
+ *
+ * @param tracker The sequence_tracker.
+ * @param id The id of the source, at most max_id_length characters.
+ * @param session The session of the source.
+ * @param sequence The sequence of the item in the session.
+ * @param item The item, item_size bytes.
+ * @param now_ms The current time, for max_delay_ms.
+ * @param deliver The function receiving the items.
+ * @param context The context passed to deliver.
+ */
+void sequence_tracker_push(
+    sequence_tracker* tracker,
+    const char* id,
+    uint32_t session,
+    uint32_t sequence,
+    const void* item,
+    int64_t now_ms,
+    sequence_deliver_callback deliver,
+    void* context);
+
+/**
+ * @brief Delivers the items held for max_delay_ms by sources that sent nothing since. Scans the
+ * sources only while some hold items.
+ */
+void sequence_tracker_expire(
+    sequence_tracker* tracker,
+    int64_t now_ms,
+    sequence_deliver_callback deliver,
+    void* context);
+
+/**
+ * @brief Adds the SEQUENCE_PROPERTY user property to the properties of a message.
+ *
+ * @return int MOSQ_ERR_SUCCESS on success, the error of mosquitto otherwise.
+ */
+int sequence_property_add(mosquitto_property** props, uint32_t session, uint32_t sequence);
+
+/**
+ * @brief Reads the SEQUENCE_PROPERTY user property of a message.
+ *
+ * @return bool true if the message has a valid SEQUENCE_PROPERTY.
+ */
+bool sequence_property_read(const mosquitto_property* props, uint32_t* session, uint32_t* sequence);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEQUENCE_TRACKER_H */
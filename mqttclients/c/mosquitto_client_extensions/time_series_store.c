@@ -0,0 +1,526 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extensions_internal.h"
+#include "logging.h"
+#include "time_series_store.h"
+
+#define INITIAL_SERIES_CAPACITY 8
+#define INITIAL_INDEX_CAPACITY 16
+/* Positions are stored plus one in 32 bits, and the index is kept at most half full. */
+#define MAX_SERIES (UINT32_MAX / 2)
+#define CHUNK_CAPACITY_BITS (TIME_SERIES_CHUNK_BYTES * 8)
+
+/* Leading zero counts are stored in 5 bits. */
+#define MAX_LEADING_ZEROS 31
+
+static uint64_t _double_bits(double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static double _bits_double(uint64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Writes the low bit_count bits of value, most significant bit first. */
+static void _write_bits(time_series_chunk* chunk, uint64_t value, unsigned bit_count)
+{
+  while (bit_count > 0)
+  {
+    unsigned free_bits = 8 - (chunk->bit_length & 7);
+    unsigned n = bit_count < free_bits ? bit_count : free_bits;
+    uint8_t bits = (uint8_t)((value >> (bit_count - n)) & ((1u << n) - 1));
+
+    chunk->data[chunk->bit_length >> 3] |= (uint8_t)(bits << (free_bits - n));
+    chunk->bit_length += n;
+    bit_count -= n;
+  }
+}
+
+static uint64_t _read_bits(time_series_iterator* iterator, unsigned bit_count)
+{
+  uint64_t value = 0;
+  while (bit_count > 0)
+  {
+    unsigned available = 8 - (iterator->bit_position & 7);
+    unsigned n = bit_count < available ? bit_count : available;
+    uint8_t byte = iterator->chunk->data[iterator->bit_position >> 3];
+
+    value = (value << n) | ((byte >> (available - n)) & ((1u << n) - 1));
+    iterator->bit_position += n;
+    bit_count -= n;
+  }
+  return value;
+}
+
+static int64_t _sign_extend(uint64_t value, unsigned bit_count)
+{
+  uint64_t sign = UINT64_C(1) << (bit_count - 1);
+  return (int64_t)((value ^ sign) - sign);
+}
+
+/* Timestamps that keep their interval take a single bit, small jitter takes 9 to 16 bits. */
+static void _write_timestamp(time_series_chunk* chunk, int64_t delta)
+{
+  int64_t delta_of_delta = delta - chunk->last_delta;
+
+  if (delta_of_delta == 0)
+  {
+    _write_bits(chunk, 0x0, 1);
+  }
+  else if (delta_of_delta >= -64 && delta_of_delta <= 63)
+  {
+    _write_bits(chunk, 0x2, 2);
+    _write_bits(chunk, (uint64_t)delta_of_delta, 7);
+  }
+  else if (delta_of_delta >= -256 && delta_of_delta <= 255)
+  {
+    _write_bits(chunk, 0x6, 3);
+    _write_bits(chunk, (uint64_t)delta_of_delta, 9);
+  }
+  else if (delta_of_delta >= -2048 && delta_of_delta <= 2047)
+  {
+    _write_bits(chunk, 0xE, 4);
+    _write_bits(chunk, (uint64_t)delta_of_delta, 12);
+  }
+  else
+  {
+    _write_bits(chunk, 0xF, 4);
+    _write_bits(chunk, (uint64_t)delta_of_delta, 64);
+  }
+  chunk->last_delta = delta;
+}
+
+static int64_t _read_timestamp_delta(time_series_iterator* iterator)
+{
+  int64_t delta_of_delta;
+
+  if (_read_bits(iterator, 1) == 0)
+  {
+    delta_of_delta = 0;
+  }
+  else if (_read_bits(iterator, 1) == 0)
+  {
+    delta_of_delta = _sign_extend(_read_bits(iterator, 7), 7);
+  }
+  else if (_read_bits(iterator, 1) == 0)
+  {
+    delta_of_delta = _sign_extend(_read_bits(iterator, 9), 9);
+  }
+  else if (_read_bits(iterator, 1) == 0)
+  {
+    delta_of_delta = _sign_extend(_read_bits(iterator, 12), 12);
+  }
+  else
+  {
+    delta_of_delta = (int64_t)_read_bits(iterator, 64);
+  }
+  iterator->last_delta += delta_of_delta;
+  return iterator->last_delta;
+}
+
+/* An unchanged value takes a single bit. Otherwise only the bits that differ from the previous
+ * value are stored, reusing the previous leading and trailing zero counts when they still fit. */
+static void _write_value(time_series_chunk* chunk, uint64_t value)
+{
+  uint64_t xor = value ^ chunk->last_value;
+
+  if (xor == 0)
+  {
+    _write_bits(chunk, 0x0, 1);
+  }
+  else
+  {
+    unsigned leading = (unsigned)__builtin_clzll(xor);
+    unsigned trailing = (unsigned)__builtin_ctzll(xor);
+    unsigned previous_trailing = 64u - chunk->leading_zeros - chunk->meaningful_bits;
+
+    if (leading > MAX_LEADING_ZEROS)
+    {
+      leading = MAX_LEADING_ZEROS;
+    }
+
+    if (chunk->meaningful_bits != 0 && leading >= chunk->leading_zeros
+        && trailing >= previous_trailing)
+    {
+      _write_bits(chunk, 0x2, 2);
+      _write_bits(chunk, xor >> previous_trailing, chunk->meaningful_bits);
+    }
+    else
+    {
+      unsigned meaningful = 64 - leading - trailing;
+      _write_bits(chunk, 0x3, 2);
+      _write_bits(chunk, leading, 5);
+      /* 64 meaningful bits do not fit in 6 bits and are stored as 0. */
+      _write_bits(chunk, meaningful & 0x3F, 6);
+      _write_bits(chunk, xor >> trailing, meaningful);
+      chunk->leading_zeros = (uint8_t)leading;
+      chunk->meaningful_bits = (uint8_t)meaningful;
+    }
+  }
+  chunk->last_value = value;
+}
+
+static uint64_t _read_value(time_series_iterator* iterator)
+{
+  if (_read_bits(iterator, 1) == 0)
+  {
+    return iterator->last_value;
+  }
+  if (_read_bits(iterator, 1) == 1)
+  {
+    iterator->leading_zeros = (uint8_t)_read_bits(iterator, 5);
+    iterator->meaningful_bits = (uint8_t)_read_bits(iterator, 6);
+    if (iterator->meaningful_bits == 0)
+    {
+      iterator->meaningful_bits = 64;
+    }
+  }
+  unsigned trailing = 64u - iterator->leading_zeros - iterator->meaningful_bits;
+  iterator->last_value ^= _read_bits(iterator, iterator->meaningful_bits) << trailing;
+  return iterator->last_value;
+}
+
+void time_series_store_init(time_series_store* store, const time_series_store_options* options)
+{
+  memset(store, 0, sizeof(time_series_store));
+  store->options = *options;
+}
+
+/* Slot of the series with this name, or the empty slot to insert it at. */
+static uint32_t _index_slot(const time_series_store* store, uint64_t hash, const char* name)
+{
+  uint32_t mask = store->index_capacity - 1;
+  uint32_t slot = (uint32_t)hash & mask;
+
+  while (store->index[slot] != 0 && strcmp(store->series[store->index[slot] - 1].name, name) != 0)
+  {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static int _index_grow(time_series_store* store)
+{
+  uint32_t capacity
+      = store->index_capacity == 0 ? INITIAL_INDEX_CAPACITY : store->index_capacity * 2;
+  uint32_t* index = calloc(capacity, sizeof(uint32_t));
+
+  if (index == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for time series index.");
+    return -1;
+  }
+  free(store->index);
+  store->index = index;
+  store->index_capacity = capacity;
+  for (size_t i = 0; i < store->count; i++)
+  {
+    const char* name = store->series[i].name;
+    store->index[_index_slot(store, fnv1a_64_string(FNV1A_64_INIT, name), name)] = (uint32_t)i + 1;
+  }
+  return 0;
+}
+
+time_series* time_series_store_get(time_series_store* store, const char* name, bool create)
+{
+  uint64_t hash = fnv1a_64_string(FNV1A_64_INIT, name);
+  uint32_t slot = 0;
+
+  if (store->index_capacity > 0)
+  {
+    slot = _index_slot(store, hash, name);
+    if (store->index[slot] != 0)
+    {
+      return &store->series[store->index[slot] - 1];
+    }
+  }
+  if (!create)
+  {
+    return NULL;
+  }
+
+  if ((store->options.max_series > 0 && store->count >= store->options.max_series)
+      || store->count >= MAX_SERIES)
+  {
+    /* Logged once, as every message of a new source would log it again. */
+    if (store->rejected_series++ == 0)
+    {
+      LOG_ERROR("The time series store is full, series like %s are not created.", name);
+    }
+    return NULL;
+  }
+
+  if (store->count == store->capacity)
+  {
+    size_t capacity = store->capacity == 0 ? INITIAL_SERIES_CAPACITY : store->capacity * 2;
+    time_series* series = realloc(store->series, capacity * sizeof(time_series));
+    if (series == NULL)
+    {
+      LOG_ERROR("Failed to allocate memory for time series.");
+      return NULL;
+    }
+    store->series = series;
+    store->capacity = capacity;
+  }
+  if ((store->count + 1) * 2 > store->index_capacity)
+  {
+    if (_index_grow(store) != 0)
+    {
+      return NULL;
+    }
+    slot = _index_slot(store, hash, name);
+  }
+
+  time_series* series = &store->series[store->count];
+  size_t name_length = strlen(name);
+  memset(series, 0, sizeof(time_series));
+  if ((series->name = malloc(name_length + 1)) == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for time series name.");
+    return NULL;
+  }
+  memcpy(series->name, name, name_length + 1);
+  series->retention = store->options.retention;
+  store->count++;
+  store->index[slot] = (uint32_t)store->count;
+  return series;
+}
+
+/* Frees the chunks that end before oldest, keeping the chunk being appended to. */
+static void _evict_chunks(time_series* series, int64_t oldest)
+{
+  while (series->head != series->tail && series->head->end_time < oldest)
+  {
+    time_series_chunk* chunk = series->head;
+
+    series->head = chunk->next;
+    series->chunk_count--;
+    series->point_count -= chunk->count;
+    free(chunk);
+  }
+}
+
+int time_series_append(time_series* series, int64_t timestamp, double value)
+{
+  time_series_chunk* chunk = series->tail;
+  uint64_t value_bits = _double_bits(value);
+
+  if (chunk != NULL && timestamp < chunk->end_time)
+  {
+    LOG_ERROR("Point of %s is older than the last point.", series->name);
+    return -1;
+  }
+
+  if (chunk == NULL || chunk->bit_length + TIME_SERIES_MAX_POINT_BITS > CHUNK_CAPACITY_BITS)
+  {
+    if ((chunk = calloc(1, sizeof(time_series_chunk))) == NULL)
+    {
+      LOG_ERROR("Failed to allocate memory for time series chunk.");
+      return -1;
+    }
+    /* The first point of a chunk is stored raw, so every chunk can be decoded on its own. */
+    chunk->start_time = timestamp;
+    chunk->end_time = timestamp;
+    chunk->last_value = value_bits;
+    _write_bits(chunk, (uint64_t)timestamp, 64);
+    _write_bits(chunk, value_bits, 64);
+
+    if (series->tail == NULL)
+    {
+      series->head = chunk;
+    }
+    else
+    {
+      series->tail->next = chunk;
+    }
+    series->tail = chunk;
+    series->chunk_count++;
+    if (series->retention > 0)
+    {
+      _evict_chunks(series, timestamp - series->retention);
+    }
+  }
+  else
+  {
+    _write_timestamp(chunk, timestamp - chunk->end_time);
+    _write_value(chunk, value_bits);
+    chunk->end_time = timestamp;
+  }
+
+  chunk->count++;
+  series->point_count++;
+  return 0;
+}
+
+static void _iterator_enter_chunk(time_series_iterator* iterator, const time_series_chunk* chunk)
+{
+  /* Chunks are in time order, so the ones that end before the range are skipped undecoded. */
+  while (chunk != NULL && chunk->end_time < iterator->from)
+  {
+    chunk = chunk->next;
+  }
+  if (chunk != NULL && chunk->start_time > iterator->to)
+  {
+    chunk = NULL;
+  }
+
+  iterator->chunk = chunk;
+  iterator->index = 0;
+  iterator->bit_position = 0;
+  iterator->last_delta = 0;
+  iterator->leading_zeros = 0;
+  iterator->meaningful_bits = 0;
+}
+
+void time_series_iterator_init(
+    time_series_iterator* iterator,
+    const time_series* series,
+    int64_t from,
+    int64_t to)
+{
+  iterator->from = from;
+  iterator->to = to;
+  _iterator_enter_chunk(iterator, series->head);
+}
+
+bool time_series_iterator_next(time_series_iterator* iterator, time_series_point* point)
+{
+  while (iterator->chunk != NULL)
+  {
+    if (iterator->index == iterator->chunk->count)
+    {
+      _iterator_enter_chunk(iterator, iterator->chunk->next);
+      continue;
+    }
+
+    if (iterator->index == 0)
+    {
+      iterator->last_time = (int64_t)_read_bits(iterator, 64);
+      iterator->last_value = _read_bits(iterator, 64);
+    }
+    else
+    {
+      iterator->last_time += _read_timestamp_delta(iterator);
+      _read_value(iterator);
+    }
+    iterator->index++;
+
+    if (iterator->last_time > iterator->to)
+    {
+      iterator->chunk = NULL;
+      return false;
+    }
+    if (iterator->last_time >= iterator->from)
+    {
+      point->timestamp = iterator->last_time;
+      point->value = _bits_double(iterator->last_value);
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t time_series_query_range(
+    const time_series* series,
+    int64_t from,
+    int64_t to,
+    time_series_point* points,
+    size_t max_points)
+{
+  time_series_iterator iterator;
+  size_t count = 0;
+
+  time_series_iterator_init(&iterator, series, from, to);
+  while (count < max_points && time_series_iterator_next(&iterator, &points[count]))
+  {
+    count++;
+  }
+  return count;
+}
+
+size_t time_series_query_downsample(
+    const time_series* series,
+    int64_t from,
+    int64_t to,
+    int64_t bucket_width,
+    time_series_bucket* buckets,
+    size_t max_buckets)
+{
+  time_series_iterator iterator;
+  time_series_point point;
+  time_series_bucket* bucket = NULL;
+  double sum = 0;
+  size_t count = 0;
+
+  time_series_iterator_init(&iterator, series, from, to);
+  while (time_series_iterator_next(&iterator, &point))
+  {
+    int64_t start_time = from + (point.timestamp - from) / bucket_width * bucket_width;
+    if (bucket == NULL || bucket->start_time != start_time)
+    {
+      if (bucket != NULL)
+      {
+        bucket->mean = sum / bucket->count;
+      }
+      if (count == max_buckets)
+      {
+        return count;
+      }
+      bucket = &buckets[count++];
+      bucket->start_time = start_time;
+      bucket->count = 0;
+      bucket->min = point.value;
+      bucket->max = point.value;
+      sum = 0;
+    }
+    bucket->count++;
+    bucket->min = point.value < bucket->min ? point.value : bucket->min;
+    bucket->max = point.value > bucket->max ? point.value : bucket->max;
+    bucket->last = point.value;
+    sum += point.value;
+  }
+  if (bucket != NULL)
+  {
+    bucket->mean = sum / bucket->count;
+  }
+  return count;
+}
+
+size_t time_series_store_memory(const time_series_store* store)
+{
+  size_t bytes = 0;
+  for (size_t i = 0; i < store->count; i++)
+  {
+    bytes += store->series[i].chunk_count * sizeof(time_series_chunk);
+  }
+  return bytes;
+}
+
+void time_series_store_destroy(time_series_store* store)
+{
+  for (size_t i = 0; i < store->count; i++)
+  {
+    time_series_chunk* chunk = store->series[i].head;
+    while (chunk != NULL)
+    {
+      time_series_chunk* next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+    free(store->series[i].name);
+  }
+  free(store->series);
+  free(store->index);
+  memset(store, 0, sizeof(time_series_store));
+}
@@ -0,0 +1,224 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef TIME_SERIES_STORE_H
+#define TIME_SERIES_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the compressed data of a chunk. A chunk holds about 700 points of a slowly changing
+ * gauge sampled at a regular interval. */
+#define TIME_SERIES_CHUNK_BYTES 1024
+
+/* Longest encoding of a point: a 64 bit timestamp delta of delta and a value with new leading and
+ * trailing zero counts. */
+#define TIME_SERIES_MAX_POINT_BITS (4 + 64 + 2 + 5 + 6 + 64)
+
+/*
+ * Fixed-size block of points compressed as in Facebook's Gorilla: timestamps are stored as the
+ * delta of their delta with the previous one, and values as the XOR with the previous value, so a
+ * regular series of slowly changing values takes a few bits per point. start_time and end_time
+ * let queries skip chunks without decoding them.
+ */
+typedef struct time_series_chunk
+{
+  struct time_series_chunk* next;
+  int64_t start_time;
+  int64_t end_time;
+  uint32_t count;
+  uint32_t bit_length;
+  /* Encoder state, to append to the chunk. */
+  int64_t last_delta;
+  uint64_t last_value;
+  uint8_t leading_zeros;
+  uint8_t meaningful_bits;
+  uint8_t data[TIME_SERIES_CHUNK_BYTES];
+} time_series_chunk;
+
+typedef struct time_series
+{
+  char* name;
+  time_series_chunk* head;
+  time_series_chunk* tail;
+  size_t chunk_count;
+  uint64_t point_count;
+  /* Retention of the store, see time_series_store_options. */
+  int64_t retention;
+} time_series;
+
+typedef struct time_series_point
+{
+  int64_t timestamp;
+  double value;
+} time_series_point;
+
+typedef struct time_series_bucket
+{
+  int64_t start_time;
+  uint32_t count;
+  double min;
+  double max;
+  double mean;
+  double last;
+} time_series_bucket;
+
+/* Decoding state of a query, points are decoded one at a time as the iterator advances. */
+typedef struct time_series_iterator
+{
+  const time_series_chunk* chunk;
+  int64_t from;
+  int64_t to;
+  uint32_t index;
+  uint32_t bit_position;
+  int64_t last_time;
+  int64_t last_delta;
+  uint64_t last_value;
+  uint8_t leading_zeros;
+  uint8_t meaningful_bits;
+} time_series_iterator;
+
+/* Bounds of a time_series_store, 0 for none. */
+typedef struct time_series_store_options
+{
+  /* Series past this count are not created. */
+  size_t max_series;
+  /* Chunks that only hold points older than the newest point of their series by more than the
+   * retention are freed, in the unit of the timestamps. */
+  int64_t retention;
+} time_series_store_options;
+
+/* In-process store of named series, ex. one per device and gauge. */
+typedef struct time_series_store
+{
+  time_series* series;
+  size_t count;
+  size_t capacity;
+  /* Open addressing index of the series by name, kept at most half full. Slots hold the position
+   * of a series plus one, 0 for empty slots. */
+  uint32_t* index;
+  uint32_t index_capacity;
+  time_series_store_options options;
+  /* Series not created because of max_series. */
+  uint64_t rejected_series;
+} time_series_store;
+
+/**
+ * @brief Initializes an empty time_series_store. The time_series_store must be freed with
+ * time_series_store_destroy().
+ *
+ * @param store The time_series_store to initialize.
+ * @param options The bounds of the store.
+ */
+void time_series_store_init(time_series_store* store, const time_series_store_options* options);
+
+/**
+ * @brief Finds a series by name, creating it if requested.
+ *
+ * @param store The time_series_store to search.
+ * @param name The name of the series.
+ * @param create Whether to create the series if it does not exist.
+ * @return time_series* The series, or NULL if it does not exist and could not be created, ex.
+ * because the store holds max_series series. The pointer is invalidated when another series is
+ * created.
+ */
+time_series* time_series_store_get(time_series_store* store, const char* name, bool create);
+
+/**
+ * @brief Appends a point to a series. Timestamps must not go backwards. Starting a chunk frees the
+ * chunks that fell out of the retention of the store.
+ *
+ * @param series The series to append to.
+ * @param timestamp The time of the point, ex. in milliseconds since the Unix epoch.
+ * @param value The value of the point.
+ * @return int 0 on success, -1 if the timestamp is older than the last point or memory could not
+ * be allocated.
+ */
+int time_series_append(time_series* series, int64_t timestamp, double value);
+
+/**
+ * @brief Starts a query of the points of a series in [from, to]. Chunks outside the range are
+ * skipped without being decoded.
+ *
+ * @param iterator The time_series_iterator to initialize.
+ * @param series The series to query.
+ * @param from The first timestamp to return.
+ * @param to The last timestamp to return.
+ */
+void time_series_iterator_init(
+    time_series_iterator* iterator,
+    const time_series* series,
+    int64_t from,
+    int64_t to);
+
+/**
+ * @brief Decodes the next point of a query.
+ *
+ * @param iterator The time_series_iterator of the query.
+ * @param point The decoded point.
+ * @return true if a point was decoded, false at the end of the range.
+ */
+bool time_series_iterator_next(time_series_iterator* iterator, time_series_point* point);
+
+/**
+ * @brief Copies the points of a series in [from, to].
+ *
+ * @param series The series to query.
+ * @param from The first timestamp to return.
+ * @param to The last timestamp to return.
+ * @param points The array to copy the points to.
+ * @param max_points The length of points.
+ * @return size_t The number of points copied.
+ */
+size_t time_series_query_range(
+    const time_series* series,
+    int64_t from,
+    int64_t to,
+    time_series_point* points,
+    size_t max_points);
+
+/**
+ * @brief Aggregates the points of a series in [from, to] into buckets of bucket_width, aligned on
+ * from. Empty buckets are skipped.
+ *
+ * @param series The series to query.
+ * @param from The first timestamp to aggregate.
+ * @param to The last timestamp to aggregate.
+ * @param bucket_width The width of a bucket, in the unit of the timestamps.
+ * @param buckets The array to write the buckets to.
+ * @param max_buckets The length of buckets.
+ * @return size_t The number of buckets written.
+ */
+size_t time_series_query_downsample(
+    const time_series* series,
+    int64_t from,
+    int64_t to,
+    int64_t bucket_width,
+    time_series_bucket* buckets,
+    size_t max_buckets);
+
+/**
+ * @brief Returns the memory used by the chunks of every series of the store.
+ *
+ * @param store The time_series_store to measure.
+ * @return size_t The number of bytes allocated for chunks.
+ */
+size_t time_series_store_memory(const time_series_store* store);
+
+/**
+ * @brief Frees every series of a time_series_store.
+ *
+ * @param store The time_series_store to free.
+ */
+void time_series_store_destroy(time_series_store* store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIME_SERIES_STORE_H */
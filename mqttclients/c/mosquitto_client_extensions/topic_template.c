@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+
+#include "topic_template.h"
+
+#define PLACEHOLDER '+'
+#define LEVEL_SEPARATOR '/'
+
+/* A + is a placeholder when it is a whole level of the filter. */
+static bool _is_placeholder(const char* filter, const char* c)
+{
+  return *c == PLACEHOLDER && (c == filter || c[-1] == LEVEL_SEPARATOR)
+      && (c[1] == LEVEL_SEPARATOR || c[1] == '\0');
+}
+
+int topic_template_format(
+    char* buffer,
+    size_t size,
+    const char* filter,
+    const char* const* values,
+    size_t count)
+{
+  size_t length = 0;
+  size_t used = 0;
+
+  for (const char* c = filter; *c != '\0'; c++)
+  {
+    const char* value = c;
+    size_t value_length = 1;
+
+    if (_is_placeholder(filter, c))
+    {
+      if (used == count)
+      {
+        return -1;
+      }
+      value = values[used++];
+      value_length = strcspn(value, "/+#");
+      /* A value of + keeps the level a wildcard, to build filters. */
+      if (strcmp(value, "+") == 0)
+      {
+        value_length = 1;
+      }
+      else if (value[value_length] != '\0' || value_length > TOPIC_LEVEL_MAX_LENGTH)
+      {
+        return -1;
+      }
+    }
+    if (length + value_length >= size)
+    {
+      return -1;
+    }
+    memcpy(buffer + length, value, value_length);
+    length += value_length;
+  }
+
+  if (used != count)
+  {
+    return -1;
+  }
+  buffer[length] = '\0';
+  return (int)length;
+}
+
+bool topic_template_match(const char* topic, const char* filter, topic_level* levels, size_t count)
+{
+  size_t used = 0;
+
+  for (const char* c = filter; *c != '\0'; c++)
+  {
+    if (_is_placeholder(filter, c))
+    {
+      if (used == count)
+      {
+        return false;
+      }
+      levels[used].value = topic;
+      levels[used].length = strcspn(topic, "/");
+      topic += levels[used++].length;
+    }
+    else if (*topic++ != *c)
+    {
+      return false;
+    }
+  }
+  return *topic == '\0' && used == count;
+}
+
+bool topic_level_copy(const topic_level* level, char* buffer, size_t size)
+{
+  if (level->length >= size)
+  {
+    return false;
+  }
+  memcpy(buffer, level->value, level->length);
+  buffer[level->length] = '\0';
+  return true;
+}
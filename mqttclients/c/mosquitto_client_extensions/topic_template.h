@@ -0,0 +1,127 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef TOPIC_TEMPLATE_H
+#define TOPIC_TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Topic templates, declared as a macro of their placeholders. Every placeholder is a whole topic
+ * level and is written as the single parameter of the macro; placeholders are filled in order:
+ *
+ *   #define VEHICLE_POSITION_TOPIC(level) "vehicles/" level "/position"
+ *   #define METHOD_REQUEST_TOPIC(level) "vehicles/" level "/command/" level "/request"
+ *
+ * The compiler derives everything else from the template:
+ * - TOPIC_FILTER(VEHICLE_POSITION_TOPIC) is the string literal "vehicles/+/position", to subscribe
+ *   with or to prefix with $share/<group>/.
+ * - TOPIC_SIZE(VEHICLE_POSITION_TOPIC) is the size of the longest topic with placeholders of up to
+ *   TOPIC_LEVEL_MAX_LENGTH characters, so buffers sized with it are never too small.
+ * - VEHICLE_POSITION_TOPIC("vehicle03") is the topic itself when the value is a string literal.
+ *
+ * TOPIC_FORMAT() fills a template into a buffer without format string parsing or heap use, and
+ * TOPIC_MATCH() returns the placeholders of a received topic as pointers into the topic, without
+ * copy. Both check at compile time that the buffer is large enough and that they are given one
+ * value per placeholder.
+ */
+
+/* Placeholder values of up to 128 characters. */
+#define TOPIC_TEMPLATE_LEVEL_16 "################"
+#define TOPIC_TEMPLATE_LEVEL_MAX                                                                   \
+  TOPIC_TEMPLATE_LEVEL_16 TOPIC_TEMPLATE_LEVEL_16 TOPIC_TEMPLATE_LEVEL_16                          \
+      TOPIC_TEMPLATE_LEVEL_16 TOPIC_TEMPLATE_LEVEL_16 TOPIC_TEMPLATE_LEVEL_16                      \
+      TOPIC_TEMPLATE_LEVEL_16 TOPIC_TEMPLATE_LEVEL_16
+#define TOPIC_LEVEL_MAX_LENGTH (sizeof(TOPIC_TEMPLATE_LEVEL_MAX) - 1)
+
+#define TOPIC_FILTER(template) template("+")
+#define TOPIC_SIZE(template) sizeof(template(TOPIC_TEMPLATE_LEVEL_MAX))
+/* Every placeholder adds a character when the placeholders go from one to two characters. */
+#define TOPIC_PLACEHOLDERS(template) (sizeof(template("++")) - sizeof(template("+")))
+
+/* Fails to compile when the condition is false, and evaluates to 0 otherwise. */
+#define TOPIC_TEMPLATE_CHECK(condition) (0 * sizeof(char[(condition) ? 1 : -1]))
+#define TOPIC_TEMPLATE_COUNT(...) (sizeof((const char*[]){ __VA_ARGS__ }) / sizeof(const char*))
+
+/* Formats the template into buffer, an array, with one value per placeholder. Evaluates to the
+ * length of the topic, or -1 if a value is invalid. */
+#define TOPIC_FORMAT(buffer, template, ...)                                                        \
+  topic_template_format(                                                                           \
+      (buffer),                                                                                    \
+      sizeof(buffer) + TOPIC_TEMPLATE_CHECK(sizeof(buffer) >= TOPIC_SIZE(template)),               \
+      TOPIC_FILTER(template),                                                                      \
+      (const char*[]){ __VA_ARGS__ },                                                              \
+      TOPIC_TEMPLATE_COUNT(__VA_ARGS__)                                                            \
+          + TOPIC_TEMPLATE_CHECK(TOPIC_TEMPLATE_COUNT(__VA_ARGS__) == TOPIC_PLACEHOLDERS(template)))
+
+/* Matches topic against the template, filling levels, an array of topic_level with one entry per
+ * placeholder. Evaluates to true if the topic matches. */
+#define TOPIC_MATCH(topic, template, levels)                                                       \
+  topic_template_match(                                                                            \
+      (topic),                                                                                     \
+      TOPIC_FILTER(template),                                                                      \
+      (levels),                                                                                    \
+      sizeof(levels) / sizeof((levels)[0])                                                         \
+          + TOPIC_TEMPLATE_CHECK(                                                                  \
+              sizeof(levels) / sizeof((levels)[0]) == TOPIC_PLACEHOLDERS(template)))
+
+/* A placeholder of a received topic, pointing into the topic. */
+typedef struct topic_level
+{
+  const char* value;
+  size_t length;
+} topic_level;
+
+/**
+ * @brief Fills the + levels of a filter with values. Prefer TOPIC_FORMAT(), which checks the
+ * sizes at compile time.
+ *
+ * @param buffer Receives the topic.
+ * @param size The size of buffer.
+ * @param filter The filter of the template, with + for each placeholder.
+ * @param values The value of each placeholder, in order. A value of + keeps the placeholder a
+ * wildcard.
+ * @param count The number of values.
+ * @return int The length of the topic, or -1 if the values don't match the placeholders, a value
+ * is longer than TOPIC_LEVEL_MAX_LENGTH or has a / or # in it or a + next to other characters, or
+ * the topic doesn't fit.
+ */
+int topic_template_format(
+    char* buffer,
+    size_t size,
+    const char* filter,
+    const char* const* values,
+    size_t count);
+
+/**
+ * @brief Matches a topic against the filter of a template. Prefer TOPIC_MATCH(), which checks the
+ * number of levels at compile time.
+ *
+ * @param topic The received topic.
+ * @param filter The filter of the template, with + for each placeholder.
+ * @param levels Receives the value of each placeholder, pointing into topic.
+ * @param count The number of levels.
+ * @return bool true if the topic matches the filter and has count placeholders.
+ */
+bool topic_template_match(const char* topic, const char* filter, topic_level* levels, size_t count);
+
+/**
+ * @brief Copies a placeholder value into a null-terminated string.
+ *
+ * @param level The placeholder value.
+ * @param buffer Receives the value.
+ * @param size The size of buffer.
+ * @return bool true on success, false if the value doesn't fit.
+ */
+bool topic_level_copy(const topic_level* level, char* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TOPIC_TEMPLATE_H */
@@ -0,0 +1,6 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "allocation_guard_test.h"
+
+int main() { return test_allocation_guard(); }
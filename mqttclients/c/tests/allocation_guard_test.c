@@ -0,0 +1,189 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <malloc.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "allocation_guard_test.h"
+
+static size_t hook_calls;
+static size_t hook_size;
+
+static void _counting_hook(size_t size)
+{
+  hook_calls++;
+  hook_size = size;
+}
+
+// Volatile so that the compiler cannot drop the allocations.
+static void _allocate_and_free(size_t size)
+{
+  void* volatile allocated = malloc(size);
+
+  free(allocated);
+}
+
+static void _clear_allocate_and_free(size_t count, size_t size)
+{
+  void* volatile allocated = calloc(count, size);
+
+  free(allocated);
+}
+
+static int setup(void** state)
+{
+  hook_calls = 0;
+  hook_size = 0;
+  allocation_guard_set_hook(_counting_hook);
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  allocation_guard_unseal();
+  allocation_guard_set_hook(NULL);
+  return 0;
+}
+
+static void test_allocation_guard_startup_success(void** state)
+{
+  allocation_guard_stats before;
+  allocation_guard_stats after;
+
+  allocation_guard_read_stats(&before);
+  _allocate_and_free(100);
+  allocation_guard_read_stats(&after);
+
+  assert_true(after.enabled);
+  assert_false(after.sealed);
+  assert_int_equal(after.startup_allocations - before.startup_allocations, 1);
+  assert_int_equal(after.startup_bytes - before.startup_bytes, 100);
+  assert_int_equal(after.frees - before.frees, 1);
+  assert_int_equal(after.unexpected_allocations, before.unexpected_allocations);
+  assert_int_equal(hook_calls, 0);
+  assert_true(after.peak_rss_kb > 0);
+}
+
+static void test_allocation_guard_sealed_success(void** state)
+{
+  allocation_guard_stats before;
+  allocation_guard_stats sealed;
+
+  allocation_guard_read_stats(&before);
+  // Nothing else may allocate until the guard is unsealed, cmocka included.
+  allocation_guard_seal();
+  _allocate_and_free(32);
+  _clear_allocate_and_free(4, 8);
+  allocation_guard_read_stats(&sealed);
+  allocation_guard_unseal();
+
+  assert_true(sealed.sealed);
+  assert_int_equal(sealed.unexpected_allocations - before.unexpected_allocations, 2);
+  assert_int_equal(sealed.unexpected_bytes - before.unexpected_bytes, 64);
+  assert_int_equal(sealed.startup_allocations, before.startup_allocations);
+  assert_int_equal(hook_calls, 2);
+  assert_int_equal(hook_size, 32);
+}
+
+static void test_allocation_guard_permitted_success(void** state)
+{
+  allocation_guard_stats before;
+  allocation_guard_stats sealed;
+  bool outer;
+  bool inner;
+
+  allocation_guard_read_stats(&before);
+  allocation_guard_seal();
+  outer = allocation_guard_permit(true);
+  _allocate_and_free(16);
+  inner = allocation_guard_permit(true);
+  _allocate_and_free(16);
+  allocation_guard_permit(inner);
+  _allocate_and_free(16);
+  allocation_guard_permit(outer);
+  allocation_guard_read_stats(&sealed);
+  allocation_guard_unseal();
+
+  assert_false(outer);
+  assert_true(inner);
+  assert_int_equal(sealed.permitted_allocations - before.permitted_allocations, 3);
+  assert_int_equal(sealed.unexpected_allocations, before.unexpected_allocations);
+  assert_int_equal(sealed.frees - before.frees, 3);
+  assert_int_equal(hook_calls, 0);
+}
+
+static void test_allocation_guard_other_functions_success(void** state)
+{
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  allocation_guard_stats before;
+  allocation_guard_stats after;
+  void* volatile allocated;
+
+  allocation_guard_read_stats(&before);
+  allocated = reallocarray(NULL, 4, 8);
+  free(allocated);
+  allocated = valloc(10);
+  free(allocated);
+  allocated = pvalloc(10);
+  free(allocated);
+  allocation_guard_read_stats(&after);
+
+  assert_int_equal(after.startup_allocations - before.startup_allocations, 3);
+  assert_int_equal(after.startup_bytes - before.startup_bytes, 32 + 10 + page_size);
+  assert_int_equal(after.frees - before.frees, 3);
+}
+
+static void test_allocation_guard_reallocarray_overflow_failure(void** state)
+{
+  // Volatile so that the compiler cannot see the overflow.
+  volatile size_t count = SIZE_MAX / 2;
+  allocation_guard_stats before;
+  allocation_guard_stats after;
+
+  allocation_guard_read_stats(&before);
+  assert_null(reallocarray(NULL, count, 4));
+  allocation_guard_read_stats(&after);
+
+  assert_int_equal(after.startup_allocations, before.startup_allocations);
+}
+
+static void test_allocation_guard_unsealed_success(void** state)
+{
+  allocation_guard_stats before;
+  allocation_guard_stats after;
+
+  allocation_guard_read_stats(&before);
+  allocation_guard_seal();
+  allocation_guard_unseal();
+  _allocate_and_free(8);
+  allocation_guard_read_stats(&after);
+
+  assert_false(after.sealed);
+  assert_int_equal(after.startup_allocations - before.startup_allocations, 1);
+  assert_int_equal(after.unexpected_allocations, before.unexpected_allocations);
+  assert_int_equal(hook_calls, 0);
+}
+
+int test_allocation_guard()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_allocation_guard_startup_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_allocation_guard_sealed_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_allocation_guard_permitted_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_allocation_guard_unsealed_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_allocation_guard_other_functions_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_allocation_guard_reallocarray_overflow_failure, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("allocation_guard", tests, NULL, NULL);
+}
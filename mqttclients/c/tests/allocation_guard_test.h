@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef ALLOCATION_GUARD_TEST_H
+#define ALLOCATION_GUARD_TEST_H
+
+#include "allocation_guard.h"
+
+int test_allocation_guard();
+
+#endif // ALLOCATION_GUARD_TEST_H
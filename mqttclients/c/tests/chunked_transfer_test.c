@@ -0,0 +1,553 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "chunked_transfer_test.h"
+#include "mqtt_protocol.h"
+
+#define TOPIC "vehicles/vehicle01/transfer"
+#define RESPONSE_TOPIC "vehicles/vehicle01/transfer/response"
+#define FILE_NAME "firmware.bin"
+#define FILE_SIZE (1024 * 1024 + 123)
+#define CHUNK_SIZE (64 * 1024)
+#define CHUNK_COUNT ((FILE_SIZE + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define WINDOW 4
+#define ACK_TIMEOUT_MS 1000
+#define LOSSY_ACK_TIMEOUT_MS 20
+#define PUMP_TIMEOUT_S 10
+#define PUMP_WAIT_NS 100000
+
+// The sender and the receiver publish through this fake network instead of a broker. Messages are
+// queued, and delivered by pump() on the test thread while the sender runs on its own thread, like
+// the mosquitto loop delivering acknowledgements to a sender.
+typedef struct network_message
+{
+  struct network_message* next;
+  struct mosquitto_message message;
+  mosquitto_property* props;
+} network_message;
+
+static pthread_mutex_t network_lock = PTHREAD_MUTEX_INITIALIZER;
+static network_message* queue_head;
+static network_message* queue_tail;
+static int chunks_accepted;
+static int drop_every;
+static int corrupt_chunk;
+static int disconnect_after;
+static bool disconnected;
+
+typedef struct transfer_run
+{
+  chunked_transfer_sender* sender;
+  pthread_t thread;
+  int result;
+  bool done;
+} transfer_run;
+
+static int completed_files;
+
+static void reset_network(void)
+{
+  chunks_accepted = 0;
+  drop_every = 0;
+  corrupt_chunk = -1;
+  disconnect_after = 0;
+  disconnected = false;
+  completed_files = 0;
+}
+
+static bool is_chunk(const char* topic)
+{
+  size_t length = strlen(topic);
+  return length > 6 && strcmp(topic + length - 6, "/chunk") == 0;
+}
+
+static int fake_publish(
+    struct mosquitto* mosq,
+    int* mid,
+    const char* topic,
+    int payloadlen,
+    const void* payload,
+    int qos,
+    bool retain,
+    const mosquitto_property* properties)
+{
+  network_message* queued;
+  int chunk = -1;
+
+  (void)mosq;
+  (void)mid;
+  (void)qos;
+  (void)retain;
+  pthread_mutex_lock(&network_lock);
+  if (disconnected)
+  {
+    pthread_mutex_unlock(&network_lock);
+    return MOSQ_ERR_NO_CONN;
+  }
+  if (is_chunk(topic))
+  {
+    chunk = ++chunks_accepted;
+    if (chunks_accepted == disconnect_after)
+    {
+      disconnected = true;
+    }
+    if (drop_every > 0 && chunk % drop_every == 0)
+    {
+      pthread_mutex_unlock(&network_lock);
+      return MOSQ_ERR_SUCCESS;
+    }
+  }
+
+  queued = calloc(1, sizeof(network_message));
+  queued->message.topic = strdup(topic);
+  queued->message.payload = malloc(payloadlen > 0 ? payloadlen : 1);
+  queued->message.payloadlen = payloadlen;
+  memcpy(queued->message.payload, payload != NULL ? payload : "", payloadlen);
+  if (chunk > 0 && chunk == corrupt_chunk)
+  {
+    ((uint8_t*)queued->message.payload)[payloadlen / 2] ^= 0x01;
+  }
+  mosquitto_property_copy_all(&queued->props, properties);
+  if (queue_tail != NULL)
+  {
+    queue_tail->next = queued;
+  }
+  else
+  {
+    queue_head = queued;
+  }
+  queue_tail = queued;
+  pthread_mutex_unlock(&network_lock);
+  return MOSQ_ERR_SUCCESS;
+}
+
+static network_message* pop_message(void)
+{
+  network_message* message;
+
+  pthread_mutex_lock(&network_lock);
+  message = queue_head;
+  if (message != NULL)
+  {
+    queue_head = message->next;
+    if (queue_head == NULL)
+    {
+      queue_tail = NULL;
+    }
+  }
+  pthread_mutex_unlock(&network_lock);
+  return message;
+}
+
+static void free_message(network_message* message)
+{
+  free(message->message.topic);
+  free(message->message.payload);
+  mosquitto_property_free_all(&message->props);
+  free(message);
+}
+
+static void* sender_thread(void* arg)
+{
+  transfer_run* run = arg;
+  run->result = chunked_transfer_sender_run(run->sender, NULL);
+  __atomic_store_n(&run->done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void start_sender(transfer_run* run, chunked_transfer_sender* sender)
+{
+  run->sender = sender;
+  run->done = false;
+  assert_int_equal(pthread_create(&run->thread, NULL, sender_thread, run), 0);
+}
+
+static bool network_idle(void)
+{
+  bool idle;
+  pthread_mutex_lock(&network_lock);
+  idle = disconnected && queue_head == NULL;
+  pthread_mutex_unlock(&network_lock);
+  return idle;
+}
+
+// Delivers the messages until the sender is done, or until the network is disconnected and
+// drained if until_disconnected is set.
+static void pump(transfer_run* run, chunked_transfer_receiver* receiver, bool until_disconnected)
+{
+  const struct timespec wait = { .tv_sec = 0, .tv_nsec = PUMP_WAIT_NS };
+  time_t deadline = time(NULL) + PUMP_TIMEOUT_S;
+
+  while (!__atomic_load_n(&run->done, __ATOMIC_ACQUIRE) && time(NULL) < deadline)
+  {
+    network_message* message = pop_message();
+
+    if (message == NULL)
+    {
+      if (until_disconnected && network_idle())
+      {
+        return;
+      }
+      nanosleep(&wait, NULL);
+      continue;
+    }
+    if (strcmp(message->message.topic, RESPONSE_TOPIC) == 0)
+    {
+      assert_true(
+          chunked_transfer_sender_handle_message(run->sender, &message->message, message->props));
+    }
+    else
+    {
+      assert_true(chunked_transfer_receiver_handle_message(
+          receiver, NULL, &message->message, message->props));
+    }
+    free_message(message);
+  }
+}
+
+static int finish_sender(transfer_run* run)
+{
+  network_message* message;
+
+  chunked_transfer_sender_cancel(run->sender);
+  pthread_join(run->thread, NULL);
+  while ((message = pop_message()) != NULL)
+  {
+    free_message(message);
+  }
+  return run->result;
+}
+
+static void on_complete(const char* name, const char* path, uint64_t size, void* context)
+{
+  (void)path;
+  (void)context;
+  assert_string_equal(name, FILE_NAME);
+  assert_int_equal(size, FILE_SIZE);
+  completed_files++;
+}
+
+static int setup(void** state)
+{
+  char* directory = strdup("/tmp/chunked_transfer_test_XXXXXX");
+  char path[PATH_MAX];
+  uint8_t* data = malloc(FILE_SIZE);
+  uint32_t random = 1;
+  FILE* file;
+
+  if (directory == NULL || data == NULL || mkdtemp(directory) == NULL)
+  {
+    free(directory);
+    free(data);
+    return -1;
+  }
+  for (size_t i = 0; i < FILE_SIZE; i++)
+  {
+    random = random * 1103515245 + 12345;
+    data[i] = (uint8_t)(random >> 16);
+  }
+  snprintf(path, sizeof(path), "%s/%s", directory, FILE_NAME);
+  file = fopen(path, "wb");
+  if (file == NULL || fwrite(data, 1, FILE_SIZE, file) != FILE_SIZE)
+  {
+    free(directory);
+    free(data);
+    return -1;
+  }
+  fclose(file);
+  free(data);
+  reset_network();
+  *state = directory;
+  return 0;
+}
+
+static int remove_entry(const char* path, const struct stat* status, int type, struct FTW* ftw)
+{
+  (void)status;
+  (void)type;
+  (void)ftw;
+  return remove(path);
+}
+
+static int teardown(void** state)
+{
+  nftw(*state, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  free(*state);
+  return 0;
+}
+
+static void init_sender(
+    chunked_transfer_sender* sender,
+    const char* directory,
+    uint32_t ack_timeout_ms)
+{
+  chunked_transfer_sender_options options = { 0 };
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/%s", directory, FILE_NAME);
+  options.path = path;
+  options.topic = TOPIC;
+  options.response_topic = RESPONSE_TOPIC;
+  options.chunk_size = CHUNK_SIZE;
+  options.window = WINDOW;
+  options.ack_timeout_ms = ack_timeout_ms;
+  options.publish = fake_publish;
+  assert_int_equal(chunked_transfer_sender_init(sender, &options), 0);
+  assert_int_equal(sender->chunk_count, CHUNK_COUNT);
+}
+
+static void init_receiver(chunked_transfer_receiver* receiver, const char* directory)
+{
+  chunked_transfer_receiver_options options = { 0 };
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/received", directory);
+  options.directory = path;
+  options.topic = TOPIC;
+  options.on_complete = on_complete;
+  options.publish = fake_publish;
+  assert_int_equal(chunked_transfer_receiver_init(receiver, &options), 0);
+}
+
+static void assert_received(const char* directory)
+{
+  char sent_path[PATH_MAX];
+  char received_path[PATH_MAX];
+  uint8_t* sent = malloc(FILE_SIZE + 1);
+  uint8_t* received = malloc(FILE_SIZE + 1);
+  FILE* file;
+
+  snprintf(sent_path, sizeof(sent_path), "%s/%s", directory, FILE_NAME);
+  snprintf(received_path, sizeof(received_path), "%s/received/%s", directory, FILE_NAME);
+  assert_non_null(file = fopen(sent_path, "rb"));
+  assert_int_equal(fread(sent, 1, FILE_SIZE + 1, file), FILE_SIZE);
+  fclose(file);
+  assert_non_null(file = fopen(received_path, "rb"));
+  assert_int_equal(fread(received, 1, FILE_SIZE + 1, file), FILE_SIZE);
+  fclose(file);
+  assert_memory_equal(sent, received, FILE_SIZE);
+  free(sent);
+  free(received);
+  assert_int_equal(completed_files, 1);
+}
+
+static void test_chunked_transfer_crc32c_success(void** state)
+{
+  const char* check = "123456789";
+  uint8_t data[1000];
+
+  // The check value of CRC-32C
+  assert_int_equal(chunked_transfer_crc32c(0, check, strlen(check)), 0xE3069283);
+  assert_int_equal(chunked_transfer_crc32c(0, check, 0), 0);
+
+  // Computed in parts and from an unaligned address, the CRC is the same
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (uint8_t)(i * 7 + 3);
+  }
+  assert_int_equal(
+      chunked_transfer_crc32c(chunked_transfer_crc32c(0, data + 1, 13), data + 14, 985),
+      chunked_transfer_crc32c(0, data + 1, 998));
+}
+
+static void test_chunked_transfer_success(void** state)
+{
+  chunked_transfer_sender sender;
+  chunked_transfer_receiver receiver;
+  transfer_run run;
+
+  init_sender(&sender, *state, ACK_TIMEOUT_MS);
+  init_receiver(&receiver, *state);
+
+  start_sender(&run, &sender);
+  pump(&run, &receiver, false);
+  assert_int_equal(finish_sender(&run), 0);
+
+  assert_received(*state);
+  assert_int_equal(sender.chunks_sent, CHUNK_COUNT);
+  assert_int_equal(sender.bytes_sent, FILE_SIZE);
+  assert_int_equal(sender.retransmits, 0);
+  assert_int_equal(receiver.chunks_received, CHUNK_COUNT);
+  assert_int_equal(receiver.files_completed, 1);
+
+  chunked_transfer_sender_destroy(&sender);
+  chunked_transfer_receiver_destroy(&receiver);
+}
+
+// Lost chunks are sent again when their acknowledgement times out, a corrupted chunk as soon as
+// the receiver rejects it
+static void test_chunked_transfer_lossy_success(void** state)
+{
+  chunked_transfer_sender sender;
+  chunked_transfer_receiver receiver;
+  transfer_run run;
+
+  drop_every = 5;
+  corrupt_chunk = 3;
+  init_sender(&sender, *state, LOSSY_ACK_TIMEOUT_MS);
+  init_receiver(&receiver, *state);
+
+  start_sender(&run, &sender);
+  pump(&run, &receiver, false);
+  assert_int_equal(finish_sender(&run), 0);
+
+  assert_received(*state);
+  assert_true(sender.retransmits >= CHUNK_COUNT / 5 + 1);
+  assert_int_equal(receiver.checksum_failures, 1);
+  assert_int_equal(receiver.chunks_received, CHUNK_COUNT);
+
+  chunked_transfer_sender_destroy(&sender);
+  chunked_transfer_receiver_destroy(&receiver);
+}
+
+// After a reconnect, the new offer tells the sender which chunks were received before
+static void test_chunked_transfer_reconnect_success(void** state)
+{
+  chunked_transfer_sender sender;
+  chunked_transfer_receiver receiver;
+  transfer_run run;
+
+  disconnect_after = 6;
+  init_sender(&sender, *state, ACK_TIMEOUT_MS);
+  init_receiver(&receiver, *state);
+
+  start_sender(&run, &sender);
+  pump(&run, &receiver, true);
+  assert_int_equal(receiver.chunks_received, 6);
+
+  pthread_mutex_lock(&network_lock);
+  disconnected = false;
+  pthread_mutex_unlock(&network_lock);
+  chunked_transfer_sender_reconnected(&sender);
+  pump(&run, &receiver, false);
+  assert_int_equal(finish_sender(&run), 0);
+
+  assert_received(*state);
+  assert_int_equal(receiver.chunks_received, CHUNK_COUNT);
+
+  chunked_transfer_sender_destroy(&sender);
+  chunked_transfer_receiver_destroy(&receiver);
+}
+
+// A new sender and a new receiver resume the transfer of a stopped pair, except for a chunk that
+// got corrupted on disk in between
+static void test_chunked_transfer_resume_success(void** state)
+{
+  chunked_transfer_sender sender;
+  chunked_transfer_receiver receiver;
+  transfer_run run;
+  char path[PATH_MAX];
+  int fd;
+
+  disconnect_after = 8;
+  init_sender(&sender, *state, ACK_TIMEOUT_MS);
+  init_receiver(&receiver, *state);
+  start_sender(&run, &sender);
+  pump(&run, &receiver, true);
+  assert_int_not_equal(finish_sender(&run), 0);
+  assert_int_equal(receiver.chunks_received, 8);
+  chunked_transfer_sender_destroy(&sender);
+  chunked_transfer_receiver_destroy(&receiver);
+
+  snprintf(
+      path,
+      sizeof(path),
+      "%s/received/%016llx.data",
+      (char*)*state,
+      (unsigned long long)sender.options.transfer_id);
+  assert_true((fd = open(path, O_WRONLY)) >= 0);
+  assert_int_equal(pwrite(fd, "x", 1, CHUNK_SIZE + 10), 1);
+  close(fd);
+
+  reset_network();
+  init_sender(&sender, *state, ACK_TIMEOUT_MS);
+  init_receiver(&receiver, *state);
+  start_sender(&run, &sender);
+  pump(&run, &receiver, false);
+  assert_int_equal(finish_sender(&run), 0);
+
+  assert_received(*state);
+  assert_int_equal(sender.resumed_chunks, 7);
+  assert_int_equal(sender.chunks_sent - sender.retransmits, CHUNK_COUNT - 7);
+  assert_int_equal(receiver.chunks_received, CHUNK_COUNT - 7);
+
+  chunked_transfer_sender_destroy(&sender);
+  chunked_transfer_receiver_destroy(&receiver);
+}
+
+// Chunks of a transfer that was never offered are not written
+static void test_chunked_transfer_unknown_transfer_fail(void** state)
+{
+  chunked_transfer_receiver receiver;
+  struct mosquitto_message message = { 0 };
+  mosquitto_property* props = NULL;
+  uint8_t correlation[12] = { 0, 0, 0, 0, 0, 0, 0, 42, 0, 0, 0, 0 };
+  network_message* reply;
+  char* name;
+  char* value;
+
+  init_receiver(&receiver, *state);
+  message.topic = TOPIC "/000000000000002a/chunk";
+  message.payload = "data";
+  message.payloadlen = 4;
+  assert_int_equal(
+      mosquitto_property_add_string(&props, MQTT_PROP_RESPONSE_TOPIC, RESPONSE_TOPIC), 0);
+  assert_int_equal(
+      mosquitto_property_add_binary(
+          &props, MQTT_PROP_CORRELATION_DATA, correlation, sizeof(correlation)),
+      0);
+  assert_int_equal(
+      mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "crc32c", "0"), 0);
+
+  assert_true(chunked_transfer_receiver_handle_message(&receiver, NULL, &message, props));
+  assert_int_equal(receiver.chunks_received, 0);
+  assert_non_null(reply = pop_message());
+  assert_string_equal(reply->message.topic, RESPONSE_TOPIC);
+  assert_non_null(mosquitto_property_read_string_pair(
+      reply->props, MQTT_PROP_USER_PROPERTY, &name, &value, false));
+  assert_string_equal(name, "status");
+  assert_string_equal(value, "unknown");
+  free(name);
+  free(value);
+  free_message(reply);
+
+  // Messages outside of the transfer topics are left to the caller
+  message.topic = "vehicles/vehicle01/position";
+  assert_false(chunked_transfer_receiver_handle_message(&receiver, NULL, &message, props));
+
+  mosquitto_property_free_all(&props);
+  chunked_transfer_receiver_destroy(&receiver);
+}
+
+int test_chunked_transfer()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_chunked_transfer_crc32c_success),
+    cmocka_unit_test_setup_teardown(test_chunked_transfer_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_chunked_transfer_lossy_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_chunked_transfer_reconnect_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_chunked_transfer_resume_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_chunked_transfer_unknown_transfer_fail, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("chunked_transfer", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef CHUNKED_TRANSFER_TEST_H
+#define CHUNKED_TRANSFER_TEST_H
+
+#include "chunked_transfer.h"
+
+int test_chunked_transfer();
+
+#endif // CHUNKED_TRANSFER_TEST_H
@@ -0,0 +1,274 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "core_runtime_test.h"
+
+#define TEST_CORE_COUNT 4
+#define TASKS_PER_SHARD 1000
+#define HOPS 10000
+#define WAIT_TIMEOUT_MS 10000
+#define SMALL_MAILBOX 4
+
+typedef struct test_shard_state
+{
+  uint64_t tasks;
+  uint64_t wrong_shard;
+  int sends_accepted;
+  int sends_rejected;
+} test_shard_state;
+
+typedef struct hop_task
+{
+  uint32_t target;
+  uint32_t remaining;
+} hop_task;
+
+static core_runtime runtime;
+
+static int init_shard_state(core_shard* shard)
+{
+  shard->state = calloc(1, sizeof(test_shard_state));
+  return shard->state != NULL ? 0 : -1;
+}
+
+static void destroy_shard_state(core_shard* shard) { free(shard->state); }
+
+static int fail_shard_init(core_shard* shard) { return shard->index == 1 ? -1 : 0; }
+
+static void count_task(core_shard* shard, void* data)
+{
+  test_shard_state* state = shard->state;
+  uint32_t target;
+
+  memcpy(&target, data, sizeof(target));
+  if (target != shard->index || core_runtime_current() != shard)
+  {
+    state->wrong_shard++;
+  }
+  // Memory from the arena only lives until the task returns
+  if (memory_arena_alloc(&shard->arena, 64) != NULL && shard->arena.offset > 64)
+  {
+    state->wrong_shard++;
+  }
+  __atomic_store_n(&state->tasks, state->tasks + 1, __ATOMIC_RELEASE);
+}
+
+static void hop(core_shard* shard, void* data)
+{
+  hop_task task;
+  test_shard_state* state = shard->state;
+
+  memcpy(&task, data, sizeof(task));
+  if (task.target != shard->index)
+  {
+    state->wrong_shard++;
+  }
+  __atomic_store_n(&state->tasks, state->tasks + 1, __ATOMIC_RELEASE);
+  if (task.remaining > 0)
+  {
+    task.remaining--;
+    task.target = (shard->index + 1) % shard->runtime->core_count;
+    while (core_runtime_send(shard->runtime, task.target, hop, &task, sizeof(task)) != 0)
+    {
+    }
+  }
+}
+
+static void fill_own_mailbox(core_shard* shard, void* data)
+{
+  test_shard_state* state = shard->state;
+  uint32_t target = shard->index;
+
+  // The slot of the running task is only released once it returns
+  for (int i = 0; i < SMALL_MAILBOX; i++)
+  {
+    if (core_runtime_send(shard->runtime, shard->index, count_task, &target, sizeof(target)) == 0)
+    {
+      state->sends_accepted++;
+    }
+    else
+    {
+      state->sends_rejected++;
+    }
+  }
+}
+
+static uint64_t total_tasks(void)
+{
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < runtime.core_count; i++)
+  {
+    test_shard_state* state = runtime.shards[i]->state;
+    total += __atomic_load_n(&state->tasks, __ATOMIC_ACQUIRE);
+  }
+  return total;
+}
+
+static void wait_for_tasks(uint64_t expected)
+{
+  struct timespec delay = { 0, 1000000 };
+  for (int i = 0; i < WAIT_TIMEOUT_MS && total_tasks() < expected; i++)
+  {
+    nanosleep(&delay, NULL);
+  }
+  assert_int_equal(total_tasks(), expected);
+}
+
+static int setup(void** state)
+{
+  core_runtime_options options = { 0 };
+
+  options.core_count = TEST_CORE_COUNT;
+  options.shard_init = init_shard_state;
+  options.shard_destroy = destroy_shard_state;
+  if (core_runtime_start(&runtime, &options) != 0)
+  {
+    return -1;
+  }
+  *state = &runtime;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  core_runtime_stop(&runtime);
+  return 0;
+}
+
+// Tasks sent from outside of the runtime run on the shard they were sent to
+static void test_core_runtime_send_success(void** state)
+{
+  core_shard_stats stats;
+
+  assert_int_equal(runtime.core_count, TEST_CORE_COUNT);
+  assert_null(core_runtime_current());
+  for (int i = 0; i < TASKS_PER_SHARD; i++)
+  {
+    for (uint32_t shard = 0; shard < TEST_CORE_COUNT; shard++)
+    {
+      while (core_runtime_send(&runtime, shard, count_task, &shard, sizeof(shard)) != 0)
+      {
+      }
+    }
+  }
+  wait_for_tasks(TASKS_PER_SHARD * TEST_CORE_COUNT);
+
+  for (uint32_t shard = 0; shard < TEST_CORE_COUNT; shard++)
+  {
+    test_shard_state* shard_state = runtime.shards[shard]->state;
+    assert_int_equal(shard_state->tasks, TASKS_PER_SHARD);
+    assert_int_equal(shard_state->wrong_shard, 0);
+  }
+  core_runtime_stats(&runtime, &stats);
+  assert_int_equal(stats.tasks_run, TASKS_PER_SHARD * TEST_CORE_COUNT);
+  // Sends from outside of the shards are not counted
+  assert_int_equal(stats.tasks_sent, 0);
+}
+
+// Shards pass a task around, each hop going through the mailbox of the next shard
+static void test_core_runtime_cross_core_success(void** state)
+{
+  hop_task task = { .target = 0, .remaining = HOPS };
+  core_shard_stats stats;
+
+  assert_int_equal(core_runtime_send(&runtime, 0, hop, &task, sizeof(task)), 0);
+  wait_for_tasks(HOPS + 1);
+
+  core_runtime_stats(&runtime, &stats);
+  assert_int_equal(stats.tasks_run, HOPS + 1);
+  assert_int_equal(stats.tasks_sent, HOPS);
+  for (uint32_t shard = 0; shard < TEST_CORE_COUNT; shard++)
+  {
+    test_shard_state* shard_state = runtime.shards[shard]->state;
+    assert_int_equal(shard_state->wrong_shard, 0);
+  }
+}
+
+// A full mailbox rejects tasks and counts the rejection on the sender
+static void test_core_runtime_mailbox_full_failure(void** state)
+{
+  core_runtime small_runtime;
+  core_runtime_options options = { 0 };
+  test_shard_state* shard_state;
+  core_shard_stats stats;
+  struct timespec delay = { 0, 1000000 };
+
+  options.core_count = 1;
+  options.mailbox_capacity = SMALL_MAILBOX;
+  options.shard_init = init_shard_state;
+  options.shard_destroy = destroy_shard_state;
+  assert_int_equal(core_runtime_start(&small_runtime, &options), 0);
+  shard_state = small_runtime.shards[0]->state;
+
+  assert_int_equal(core_runtime_send(&small_runtime, 0, fill_own_mailbox, NULL, 0), 0);
+  for (int i = 0; i < WAIT_TIMEOUT_MS
+                  && __atomic_load_n(&shard_state->tasks, __ATOMIC_ACQUIRE) < SMALL_MAILBOX - 1;
+       i++)
+  {
+    nanosleep(&delay, NULL);
+  }
+  assert_int_equal(shard_state->sends_accepted, SMALL_MAILBOX - 1);
+  assert_int_equal(shard_state->sends_rejected, 1);
+  core_runtime_stats(&small_runtime, &stats);
+  assert_int_equal(stats.mailbox_full, 1);
+  assert_int_equal(stats.tasks_sent, SMALL_MAILBOX - 1);
+  core_runtime_stop(&small_runtime);
+}
+
+// Invalid tasks are rejected and keys always map to the same shard
+static void test_core_runtime_invalid_send_failure(void** state)
+{
+  uint32_t shard = 0;
+  unsigned char data[CORE_TASK_DATA_SIZE + 1] = { 0 };
+  char key[32];
+
+  assert_int_equal(core_runtime_send(&runtime, TEST_CORE_COUNT, count_task, &shard, 4), -1);
+  assert_int_equal(core_runtime_send(&runtime, 0, NULL, &shard, 4), -1);
+  assert_int_equal(core_runtime_send(&runtime, 0, count_task, data, sizeof(data)), -1);
+  assert_int_equal(core_runtime_send(&runtime, 0, count_task, NULL, 4), -1);
+
+  for (int i = 0; i < 100; i++)
+  {
+    snprintf(key, sizeof(key), "vehicle%d", i);
+    shard = core_runtime_shard_for_key(&runtime, key);
+    assert_true(shard < TEST_CORE_COUNT);
+    assert_int_equal(core_runtime_shard_for_key(&runtime, key), shard);
+  }
+}
+
+// A shard failing to initialize stops the runtime
+static void test_core_runtime_shard_init_failure(void** state)
+{
+  core_runtime failing_runtime;
+  core_runtime_options options = { 0 };
+
+  options.core_count = 2;
+  options.shard_init = fail_shard_init;
+  assert_int_equal(core_runtime_start(&failing_runtime, &options), -1);
+  assert_null(failing_runtime.shards);
+}
+
+int test_core_runtime()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_core_runtime_send_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_core_runtime_cross_core_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_core_runtime_invalid_send_failure, setup, teardown),
+    cmocka_unit_test(test_core_runtime_mailbox_full_failure),
+    cmocka_unit_test(test_core_runtime_shard_init_failure)
+  };
+  return cmocka_run_group_tests_name("core_runtime", tests, NULL, NULL);
+}
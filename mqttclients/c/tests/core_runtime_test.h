@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef CORE_RUNTIME_TEST_H
+#define CORE_RUNTIME_TEST_H
+
+#include "core_runtime.h"
+
+int test_core_runtime();
+
+#endif // CORE_RUNTIME_TEST_H
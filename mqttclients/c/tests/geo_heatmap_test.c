@@ -0,0 +1,318 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "geo_heatmap_test.h"
+
+#define MAX_SUMMARIES 32
+#define MAX_SUMMARY_CELLS 4
+#define SHARD_VEHICLES 100
+
+// Two positions in the cell "u09" and one in the cell "u0d" at precision 3
+#define U09_X 2.30
+#define U09_Y 48.85
+#define U09_X2 2.40
+#define U09_Y2 48.90
+#define U0D_X 3.90
+#define U0D_Y 48.60
+
+typedef struct recorded_summary
+{
+  int64_t start_ms;
+  int64_t end_ms;
+  uint32_t cell_count;
+  geo_heatmap_cell cells[MAX_SUMMARY_CELLS];
+} recorded_summary;
+
+typedef struct recorded_summaries
+{
+  recorded_summary summaries[MAX_SUMMARIES];
+  int count;
+} recorded_summaries;
+
+typedef struct shard_thread
+{
+  geo_heatmap* heatmap;
+  uint32_t shard;
+} shard_thread;
+
+static void record_summary(const geo_heatmap_summary* summary, void* context)
+{
+  recorded_summaries* recorded = context;
+  recorded_summary* copy;
+
+  assert_true(recorded->count < MAX_SUMMARIES);
+  assert_true(summary->cell_count <= MAX_SUMMARY_CELLS);
+  copy = &recorded->summaries[recorded->count++];
+  copy->start_ms = summary->start_ms;
+  copy->end_ms = summary->end_ms;
+  copy->cell_count = summary->cell_count;
+  memcpy(copy->cells, summary->cells, summary->cell_count * sizeof(geo_heatmap_cell));
+}
+
+static const geo_heatmap_cell* find_cell(const recorded_summary* summary, const char* geohash)
+{
+  char cell[GEO_HEATMAP_MAX_PRECISION + 1];
+
+  for (uint32_t i = 0; i < summary->cell_count; i++)
+  {
+    geohash_to_string(summary->cells[i].cell, (uint32_t)strlen(geohash), cell);
+    if (strcmp(cell, geohash) == 0)
+    {
+      return &summary->cells[i];
+    }
+  }
+  return NULL;
+}
+
+static geo_heatmap_options options_of(uint32_t window_ms, uint32_t slide_ms, uint32_t shards)
+{
+  geo_heatmap_options options = { 0 };
+
+  options.precision = 3;
+  options.window_ms = window_ms;
+  options.slide_ms = slide_ms;
+  options.shard_count = shards;
+  options.max_cells = 16;
+  options.max_vehicles = 256;
+  return options;
+}
+
+static void* update_shard(void* argument)
+{
+  shard_thread* thread = argument;
+  char vehicle[32];
+
+  for (int i = 0; i < SHARD_VEHICLES; i++)
+  {
+    snprintf(vehicle, sizeof(vehicle), "vehicle%u-%d", thread->shard, i);
+    geo_heatmap_update(thread->heatmap, thread->shard, vehicle, U09_X, U09_Y, 10);
+  }
+  geo_heatmap_advance(thread->heatmap, thread->shard, 1000);
+  return NULL;
+}
+
+static void test_geohash_encode_success(void** state)
+{
+  char geohash[GEO_HEATMAP_MAX_PRECISION + 1];
+  double distance;
+
+  geohash_to_string(geohash_encode(-5.6, 42.6, 5), 5, geohash);
+  assert_string_equal(geohash, "ezs42");
+  geohash_to_string(geohash_encode(10.40744, 57.64911, 11), 11, geohash);
+  assert_string_equal(geohash, "u4pruydqqvj");
+  geohash_to_string(geohash_encode(U0D_X, U0D_Y, 3), 3, geohash);
+  assert_string_equal(geohash, "u0d");
+
+  // Paris to London
+  distance = geo_distance_km(2.3522, 48.8566, -0.1276, 51.5072);
+  assert_true(distance > 342 && distance < 345);
+  assert_true(geo_distance_km(U09_X, U09_Y, U09_X, U09_Y) == 0);
+}
+
+static void test_geo_heatmap_tumbling_windows_success(void** state)
+{
+  geo_heatmap heatmap;
+  geo_heatmap_options options = options_of(1000, 0, 1);
+  recorded_summaries recorded = { 0 };
+  double distance = geo_distance_km(U09_X, U09_Y, U09_X2, U09_Y2);
+  const geo_heatmap_cell* cell;
+
+  assert_int_equal(geo_heatmap_init(&heatmap, &options, 0), 0);
+  geo_heatmap_update(&heatmap, 0, "a", U09_X, U09_Y, 100);
+  geo_heatmap_update(&heatmap, 0, "a", U09_X2, U09_Y2, 500);
+  geo_heatmap_update(&heatmap, 0, "b", U0D_X, U0D_Y, 600);
+  // The window is still open
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 0);
+
+  geo_heatmap_advance(&heatmap, 0, 1000);
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 1);
+  assert_int_equal(recorded.summaries[0].start_ms, 0);
+  assert_int_equal(recorded.summaries[0].end_ms, 1000);
+  assert_int_equal(recorded.summaries[0].cell_count, 2);
+  assert_non_null(cell = find_cell(&recorded.summaries[0], "u09"));
+  assert_int_equal(cell->vehicles, 1);
+  assert_int_equal(cell->speed_samples, 1);
+  assert_true(cell->speed_sum_kmh > distance / (0.4 / 3600) - 0.001);
+  assert_true(cell->speed_sum_kmh < distance / (0.4 / 3600) + 0.001);
+  assert_non_null(cell = find_cell(&recorded.summaries[0], "u0d"));
+  assert_int_equal(cell->vehicles, 1);
+  assert_int_equal(cell->speed_samples, 0);
+
+  // a joins b, which does not report in the next window
+  geo_heatmap_update(&heatmap, 0, "a", U0D_X, U0D_Y, 1500);
+  geo_heatmap_advance(&heatmap, 0, 2000);
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 1);
+  assert_int_equal(recorded.summaries[1].start_ms, 1000);
+  assert_int_equal(recorded.summaries[1].cell_count, 1);
+  assert_non_null(cell = find_cell(&recorded.summaries[1], "u0d"));
+  assert_int_equal(cell->vehicles, 1);
+  assert_int_equal(cell->speed_samples, 1);
+
+  geo_heatmap_destroy(&heatmap);
+}
+
+static void test_geo_heatmap_sliding_windows_success(void** state)
+{
+  geo_heatmap heatmap;
+  geo_heatmap_options options = options_of(3000, 1000, 1);
+  recorded_summaries recorded = { 0 };
+  const geo_heatmap_cell* cell;
+
+  assert_int_equal(geo_heatmap_init(&heatmap, &options, 0), 0);
+  geo_heatmap_update(&heatmap, 0, "a", U09_X, U09_Y, 100);
+  geo_heatmap_update(&heatmap, 0, "a", U0D_X, U0D_Y, 1100);
+  geo_heatmap_advance(&heatmap, 0, 5000);
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 5);
+
+  // Each window ending at t spans [t - 3000, t)
+  for (int i = 0; i < 5; i++)
+  {
+    assert_int_equal(recorded.summaries[i].end_ms, (i + 1) * 1000);
+    assert_int_equal(recorded.summaries[i].start_ms, (i - 2) * 1000);
+  }
+  assert_int_equal(recorded.summaries[0].cell_count, 1);
+  assert_non_null(cell = find_cell(&recorded.summaries[0], "u09"));
+  assert_int_equal(cell->vehicles, 1);
+  // Once a moved, it is only counted in its last cell, while its speed stays in the window
+  for (int i = 1; i < 4; i++)
+  {
+    assert_int_equal(recorded.summaries[i].cell_count, 1);
+    assert_non_null(cell = find_cell(&recorded.summaries[i], "u0d"));
+    assert_int_equal(cell->vehicles, 1);
+    assert_int_equal(cell->speed_samples, 1);
+  }
+  assert_int_equal(recorded.summaries[4].cell_count, 0);
+
+  geo_heatmap_destroy(&heatmap);
+}
+
+static void test_geo_heatmap_shards_merge_success(void** state)
+{
+  geo_heatmap heatmap;
+  geo_heatmap_options options = options_of(1000, 0, 2);
+  recorded_summaries recorded = { 0 };
+  shard_thread threads[2];
+  pthread_t ids[2];
+  const geo_heatmap_cell* cell;
+
+  assert_int_equal(geo_heatmap_init(&heatmap, &options, 0), 0);
+  for (uint32_t i = 0; i < 2; i++)
+  {
+    threads[i].heatmap = &heatmap;
+    threads[i].shard = i;
+    assert_int_equal(pthread_create(&ids[i], NULL, update_shard, &threads[i]), 0);
+  }
+  for (uint32_t i = 0; i < 2; i++)
+  {
+    pthread_join(ids[i], NULL);
+  }
+
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 1);
+  assert_int_equal(recorded.summaries[0].cell_count, 1);
+  assert_non_null(cell = find_cell(&recorded.summaries[0], "u09"));
+  assert_int_equal(cell->vehicles, 2 * SHARD_VEHICLES);
+
+  // The window is only collected once every shard closed it
+  geo_heatmap_update(&heatmap, 0, "vehicle0-0", U09_X, U09_Y, 1100);
+  geo_heatmap_advance(&heatmap, 0, 2000);
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 0);
+  geo_heatmap_advance(&heatmap, 1, 2000);
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 1);
+  assert_int_equal(recorded.summaries[1].cells[0].vehicles, 1);
+
+  geo_heatmap_destroy(&heatmap);
+}
+
+static void test_geo_heatmap_limits_failure(void** state)
+{
+  geo_heatmap heatmap;
+  geo_heatmap_options options = options_of(1000, 0, 1);
+  geo_heatmap_stats stats;
+  recorded_summaries recorded = { 0 };
+
+  options.precision = GEO_HEATMAP_MAX_PRECISION + 1;
+  assert_int_equal(geo_heatmap_init(&heatmap, &options, 0), -1);
+  options = options_of(1000, 300, 1);
+  assert_int_equal(geo_heatmap_init(&heatmap, &options, 0), -1);
+
+  options = options_of(1000, 0, 1);
+  options.max_cells = 1;
+  options.max_vehicles = 1;
+  assert_int_equal(geo_heatmap_init(&heatmap, &options, 0), 0);
+  geo_heatmap_update(&heatmap, 0, "a", U09_X, U09_Y, 100);
+  geo_heatmap_update(&heatmap, 0, "b", U09_X, U09_Y, 200);
+  geo_heatmap_update(&heatmap, 0, "a", U0D_X, U0D_Y, 300);
+  geo_heatmap_read_stats(&heatmap, &stats);
+  assert_int_equal(stats.positions, 3);
+  assert_int_equal(stats.dropped_vehicles, 1);
+  assert_int_equal(stats.dropped_cells, 0);
+
+  // The collector is too far behind for the window closed at 20 s
+  geo_heatmap_update(&heatmap, 0, "a", U0D_X, U0D_Y, 19500);
+  geo_heatmap_advance(&heatmap, 0, 20000);
+  geo_heatmap_read_stats(&heatmap, &stats);
+  assert_int_equal(stats.dropped_windows, 1);
+  assert_int_equal(geo_heatmap_collect(&heatmap, record_summary, &recorded), 20);
+  assert_int_equal(recorded.summaries[0].cell_count, 1);
+  assert_int_equal(recorded.summaries[18].cell_count, 0);
+  assert_int_equal(recorded.summaries[19].cell_count, 0);
+
+  geo_heatmap_destroy(&heatmap);
+}
+
+static void test_geo_heatmap_format_summary_success(void** state)
+{
+  geo_heatmap_cell cells[2] = { { 0 } };
+  geo_heatmap_summary summary = { 0 };
+  char buffer[GEO_HEATMAP_SUMMARY_JSON_MAX_LENGTH + 2 * GEO_HEATMAP_CELL_JSON_MAX_LENGTH];
+  const char* expected
+      = "{\"start\":1000,\"end\":2000,\"cells\":[[\"u09\",2,42.5],[\"u0d\",1,0]]}";
+  int length;
+
+  cells[0].cell = geohash_encode(U09_X, U09_Y, 3);
+  cells[0].vehicles = 2;
+  cells[0].speed_samples = 2;
+  cells[0].speed_sum_kmh = 85;
+  cells[1].cell = geohash_encode(U0D_X, U0D_Y, 3);
+  cells[1].vehicles = 1;
+  summary.start_ms = 1000;
+  summary.end_ms = 2000;
+  summary.precision = 3;
+  summary.cell_count = 2;
+  summary.cells = cells;
+
+  length = geo_heatmap_format_summary(&summary, buffer, sizeof(buffer));
+  assert_int_equal(length, strlen(expected));
+  assert_memory_equal(buffer, expected, length);
+  assert_int_equal(geo_heatmap_format_summary(&summary, buffer, strlen(expected)), -1);
+
+  summary.cell_count = 0;
+  length = geo_heatmap_format_summary(&summary, buffer, sizeof(buffer));
+  assert_int_equal(length, strlen("{\"start\":1000,\"end\":2000,\"cells\":[]}"));
+}
+
+int test_geo_heatmap()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_geohash_encode_success),
+    cmocka_unit_test(test_geo_heatmap_tumbling_windows_success),
+    cmocka_unit_test(test_geo_heatmap_sliding_windows_success),
+    cmocka_unit_test(test_geo_heatmap_shards_merge_success),
+    cmocka_unit_test(test_geo_heatmap_limits_failure),
+    cmocka_unit_test(test_geo_heatmap_format_summary_success)
+  };
+  return cmocka_run_group_tests_name("geo_heatmap", tests, NULL, NULL);
+}
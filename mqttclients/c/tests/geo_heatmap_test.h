@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef GEO_HEATMAP_TEST_H
+#define GEO_HEATMAP_TEST_H
+
+#include "geo_heatmap.h"
+
+int test_geo_heatmap();
+
+#endif // GEO_HEATMAP_TEST_H
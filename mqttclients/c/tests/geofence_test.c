@@ -0,0 +1,267 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "geofence_test.h"
+
+#define MAX_EVENTS 16
+#define RANDOM_FENCES 500
+#define RANDOM_POINTS 20000
+#define MAX_RING_POINTS 24
+
+typedef struct recorded_event
+{
+  char vehicle[32];
+  uint32_t fence;
+  geofence_transition transition;
+} recorded_event;
+
+typedef struct recorded_events
+{
+  recorded_event events[MAX_EVENTS];
+  int count;
+} recorded_events;
+
+static const double square[] = { 0, 0, 10, 0, 10, 10, 0, 10, 0, 0 };
+static const double hole[] = { 4, 4, 6, 4, 6, 6, 4, 6 };
+// L shape, whose bounding box contains (8, 8) but not the shape
+static const double l_shape[] = { 0, 0, 10, 0, 10, 3, 3, 3, 3, 10, 0, 10 };
+
+static int setup(void** state)
+{
+  geofence_engine* engine = malloc(sizeof(geofence_engine));
+  if (engine == NULL)
+  {
+    return -1;
+  }
+  geofence_engine_init(engine);
+  *state = engine;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  geofence_engine_destroy(*state);
+  free(*state);
+  return 0;
+}
+
+static void record_event(
+    const char* vehicle,
+    uint32_t fence,
+    const char* name,
+    geofence_transition transition,
+    void* context)
+{
+  recorded_events* recorded = context;
+  recorded_event* event = &recorded->events[recorded->count++];
+
+  (void)name;
+  snprintf(event->vehicle, sizeof(event->vehicle), "%s", vehicle);
+  event->fence = fence;
+  event->transition = transition;
+}
+
+static void add_fence(geofence_engine* engine, const char* name, const double* ring, size_t size)
+{
+  assert_true(geofence_engine_add(engine, name) >= 0);
+  assert_int_equal(geofence_engine_add_ring(engine, ring, size / (2 * sizeof(double))), 0);
+}
+
+// Reference even-odd test, edge by edge
+static bool ring_contains(const double* ring, size_t point_count, double x, double y)
+{
+  bool inside = false;
+  for (size_t i = 0, j = point_count - 1; i < point_count; j = i++)
+  {
+    double xi = ring[2 * i];
+    double yi = ring[2 * i + 1];
+    double xj = ring[2 * j];
+    double yj = ring[2 * j + 1];
+    if ((yi > y) != (yj > y) && x < xi + (y - yi) * (xj - xi) / (yj - yi))
+    {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+// Points are tested against the polygon, not only its bounding box
+static void test_geofence_contains_success(void** state)
+{
+  geofence_engine* engine = (geofence_engine*)*state;
+  uint32_t fences[4];
+
+  add_fence(engine, "square", square, sizeof(square));
+  add_fence(engine, "l_shape", l_shape, sizeof(l_shape));
+  assert_int_equal(geofence_engine_build(engine), 0);
+
+  assert_int_equal(geofence_engine_contains(engine, 1, 1, fences, 4), 2);
+  assert_int_equal(fences[0], 0);
+  assert_int_equal(fences[1], 1);
+  assert_int_equal(geofence_engine_contains(engine, 8, 8, fences, 4), 1);
+  assert_int_equal(fences[0], 0);
+  assert_int_equal(geofence_engine_contains(engine, 11, 5, fences, 4), 0);
+  assert_int_equal(geofence_engine_contains(engine, -1, -1, fences, 4), 0);
+  assert_int_equal(geofence_engine_contains(engine, NAN, 5, fences, 4), 0);
+}
+
+// Points in a hole of a fence are outside of it
+static void test_geofence_hole_success(void** state)
+{
+  geofence_engine* engine = (geofence_engine*)*state;
+  uint32_t fences[1];
+
+  add_fence(engine, "square", square, sizeof(square));
+  assert_int_equal(geofence_engine_add_ring(engine, hole, 4), 0);
+  assert_int_equal(geofence_engine_build(engine), 0);
+
+  assert_int_equal(geofence_engine_contains(engine, 2, 2, fences, 1), 1);
+  assert_int_equal(geofence_engine_contains(engine, 5, 5, fences, 1), 0);
+  assert_int_equal(geofence_engine_contains(engine, 7, 5, fences, 1), 1);
+}
+
+// Only transitions are reported, per vehicle
+static void test_geofence_update_transitions_success(void** state)
+{
+  geofence_engine* engine = (geofence_engine*)*state;
+  recorded_events recorded = { 0 };
+
+  add_fence(engine, "square", square, sizeof(square));
+  add_fence(engine, "l_shape", l_shape, sizeof(l_shape));
+  assert_int_equal(geofence_engine_build(engine), 0);
+
+  // First positions report the fences they are in
+  assert_int_equal(geofence_engine_update(engine, "vehicle1", 1, 1, record_event, &recorded), 2);
+  assert_int_equal(geofence_engine_update(engine, "vehicle2", 20, 20, record_event, &recorded), 0);
+  assert_int_equal(recorded.count, 2);
+  assert_string_equal(recorded.events[0].vehicle, "vehicle1");
+  assert_int_equal(recorded.events[0].fence, 0);
+  assert_int_equal(recorded.events[0].transition, GEOFENCE_ENTER);
+  assert_int_equal(recorded.events[1].fence, 1);
+  assert_int_equal(recorded.events[1].transition, GEOFENCE_ENTER);
+
+  // Moving inside the same fences reports nothing
+  assert_int_equal(geofence_engine_update(engine, "vehicle1", 2, 1, record_event, &recorded), 0);
+
+  // Leaving the L shape but staying in the square
+  assert_int_equal(geofence_engine_update(engine, "vehicle1", 8, 8, record_event, &recorded), 1);
+  assert_int_equal(recorded.events[2].fence, 1);
+  assert_int_equal(recorded.events[2].transition, GEOFENCE_EXIT);
+
+  // Another vehicle entering, then the first one leaving everything
+  assert_int_equal(geofence_engine_update(engine, "vehicle2", 9, 9, record_event, &recorded), 1);
+  assert_string_equal(recorded.events[3].vehicle, "vehicle2");
+  assert_int_equal(recorded.events[3].transition, GEOFENCE_ENTER);
+  assert_int_equal(geofence_engine_update(engine, "vehicle1", 50, 8, record_event, &recorded), 1);
+  assert_string_equal(recorded.events[4].vehicle, "vehicle1");
+  assert_int_equal(recorded.events[4].fence, 0);
+  assert_int_equal(recorded.events[4].transition, GEOFENCE_EXIT);
+  assert_int_equal(engine->vehicle_count, 2);
+}
+
+// The grid and vector test find the same fences as testing every fence edge by edge
+static void test_geofence_random_fences_success(void** state)
+{
+  geofence_engine* engine = (geofence_engine*)*state;
+  double* rings = malloc(RANDOM_FENCES * MAX_RING_POINTS * 2 * sizeof(double));
+  size_t* point_counts = malloc(RANDOM_FENCES * sizeof(size_t));
+  uint32_t fences[RANDOM_FENCES];
+  char name[32];
+
+  assert_non_null(rings);
+  assert_non_null(point_counts);
+  srand(7);
+  for (int f = 0; f < RANDOM_FENCES; f++)
+  {
+    // Star shaped polygons of 3 to MAX_RING_POINTS points, some of them concave
+    double* ring = rings + f * MAX_RING_POINTS * 2;
+    double center_x = rand() / (double)RAND_MAX * 100;
+    double center_y = rand() / (double)RAND_MAX * 50;
+    double radius = 0.5 + rand() / (double)RAND_MAX * 4;
+
+    point_counts[f] = 3 + rand() % (MAX_RING_POINTS - 2);
+    for (size_t i = 0; i < point_counts[f]; i++)
+    {
+      double angle = 2 * M_PI * i / point_counts[f];
+      double r = radius * (0.3 + 0.7 * rand() / (double)RAND_MAX);
+      ring[2 * i] = center_x + r * cos(angle);
+      ring[2 * i + 1] = center_y + r * sin(angle);
+    }
+    sprintf(name, "fence%d", f);
+    assert_int_equal(geofence_engine_add(engine, name), f);
+    assert_int_equal(geofence_engine_add_ring(engine, ring, point_counts[f]), 0);
+  }
+  assert_int_equal(geofence_engine_build(engine), 0);
+
+  for (int p = 0; p < RANDOM_POINTS; p++)
+  {
+    double x = rand() / (double)RAND_MAX * 110 - 5;
+    double y = rand() / (double)RAND_MAX * 60 - 5;
+    size_t count = geofence_engine_contains(engine, x, y, fences, RANDOM_FENCES);
+    size_t expected = 0;
+
+    for (int f = 0; f < RANDOM_FENCES; f++)
+    {
+      if (ring_contains(rings + f * MAX_RING_POINTS * 2, point_counts[f], x, y))
+      {
+        assert_true(expected < count);
+        assert_int_equal(fences[expected], f);
+        expected++;
+      }
+    }
+    assert_int_equal(count, expected);
+  }
+  // The grid leaves a few candidates per point
+  assert_true(engine->candidates < engine->queries * 4);
+
+  free(rings);
+  free(point_counts);
+}
+
+// Fences are built once, from rings of at least 3 points
+static void test_geofence_invalid_fences_failure(void** state)
+{
+  geofence_engine* engine = (geofence_engine*)*state;
+  uint32_t fences[1];
+
+  assert_int_equal(geofence_engine_add_ring(engine, square, 5), -1);
+  assert_int_equal(geofence_engine_build(engine), -1);
+  assert_int_equal(geofence_engine_update(engine, "vehicle1", 1, 1, NULL, NULL), -1);
+  assert_int_equal(geofence_engine_contains(engine, 1, 1, fences, 1), 0);
+
+  assert_int_equal(geofence_engine_add(engine, "empty"), 0);
+  assert_int_equal(geofence_engine_add_ring(engine, square, 2), -1);
+  // The closing point does not count
+  assert_int_equal(geofence_engine_add_ring(engine, (const double[]){ 0, 0, 1, 1, 0, 0 }, 3), -1);
+  assert_int_equal(geofence_engine_build(engine), -1);
+
+  assert_int_equal(geofence_engine_add_ring(engine, square, 5), 0);
+  assert_int_equal(geofence_engine_build(engine), 0);
+  assert_int_equal(geofence_engine_add(engine, "late"), -1);
+  assert_int_equal(geofence_engine_add_ring(engine, square, 5), -1);
+}
+
+int test_geofence()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_geofence_contains_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_geofence_hole_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_geofence_update_transitions_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_geofence_random_fences_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_geofence_invalid_fences_failure, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("geofence", tests, NULL, NULL);
+}
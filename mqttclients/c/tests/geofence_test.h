@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef GEOFENCE_TEST_H
+#define GEOFENCE_TEST_H
+
+#include "geofence.h"
+
+int test_geofence();
+
+#endif // GEOFENCE_TEST_H
@@ -94,13 +94,13 @@ static void test_geojson_point_to_mosquitto_payload_max_length_success(void** st
   geojson_point_destroy(&json_point);
 }
 
-// NULL type
-static void test_geojson_point_to_mosquitto_payload_null_type_fail(void** state)
+// empty type
+static void test_geojson_point_to_mosquitto_payload_empty_type_fail(void** state)
 {
 
   mosquitto_payload mosq_payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
   geojson_point json_point
-      = { .type = NULL, .coordinates = (geojson_coordinates){ .x = 5, .y = 3 } };
+      = { .type = "", .coordinates = (geojson_coordinates){ .x = 5, .y = 3 } };
   assert_int_equal(-1, geojson_point_to_mosquitto_payload(json_point, &mosq_payload));
   assert_int_equal(mosq_payload.payload_length, 0);
   assert_int_equal(strlen(mosq_payload.payload), 0);
@@ -244,6 +244,253 @@ static void test_mosquitto_payload_to_geojson_point_missing_coordinates_fail(voi
   geojson_point_destroy(&json_point);
 }
 
+// Members may come in any order, with whitespace, other members and an altitude
+static void test_mosquitto_payload_to_geojson_point_members_success(void** state)
+{
+  struct mosquitto_message message;
+  message.payload = " { \"coordinates\" : [ -83.551071 , 1e1, 250.5 ],\n"
+                    "\"properties\": {\"name\": \"a \\\"}\\\" b\", \"tags\": [1, {\"c\": null}]},"
+                    "\"type\": \"Point\" } ";
+  geojson_point json_point = geojson_point_init();
+
+  assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), 0);
+  assert_string_equal(json_point.type, "Point");
+  assert_float_equal(json_point.coordinates.x, -83.551071, 0.000001);
+  assert_float_equal(json_point.coordinates.y, 10, 0.000001);
+
+  geojson_point_destroy(&json_point);
+}
+
+// malformed JSON
+static void test_mosquitto_payload_to_geojson_point_malformed_fail(void** state)
+{
+  const char* payloads[] = {
+    "{\"type\":\"Point\",\"coordinates\":[1,2]",
+    "{\"type\":\"Point\",\"coordinates\":[1,2]} x",
+    "{\"type\":\"Point\",\"coordinates\":[1]}",
+    "{\"type\":\"Point\",\"coordinates\":[\"1\",2]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2}",
+    "{\"type\":\"Point\" \"coordinates\":[1,2]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"other\":[}",
+    "{\"type\":\"Point,\"coordinates\":[1,2]}",
+    "[1,2]",
+    // nested deeper than the members skipped in a point may be
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]}",
+  };
+  geojson_point json_point = geojson_point_init();
+  struct mosquitto_message message;
+
+  for (size_t i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++)
+  {
+    message.payload = (void*)payloads[i];
+    assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), -1);
+  }
+  assert_string_equal(json_point.type, "");
+}
+
+static void assert_payloads_fail(const char** payloads, size_t count)
+{
+  geojson_point json_point = geojson_point_init();
+  struct mosquitto_message message;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    message.payload = (void*)payloads[i];
+    assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), -1);
+  }
+  assert_string_equal(json_point.type, "");
+}
+
+// Only true, false and null are literals
+static void test_mosquitto_payload_to_geojson_point_invalid_literal_fail(void** state)
+{
+  const char* payloads[] = {
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":garbage}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":True}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":nul}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":truex}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":[null,-]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":\"\\x\"}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":\"\\u12G4\"}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":\"tab\there\"}",
+  };
+  assert_payloads_fail(payloads, sizeof(payloads) / sizeof(payloads[0]));
+}
+
+// Elements are separated by commas and members by colons and commas, wherever they are nested
+static void test_mosquitto_payload_to_geojson_point_missing_separator_fail(void** state)
+{
+  const char* payloads[] = {
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":[1 2]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":{\"b\" \"c\"}}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":{\"b\":1 \"c\":2}}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":{\"b\",\"c\"}}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":[1,]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":[,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":{1:2}}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":[1}}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],}",
+  };
+  assert_payloads_fail(payloads, sizeof(payloads) / sizeof(payloads[0]));
+}
+
+// Coordinates and skipped numbers follow the JSON number grammar, not strtod()
+static void test_mosquitto_payload_to_geojson_point_invalid_number_fail(void** state)
+{
+  const char* payloads[] = {
+    "{\"type\":\"Point\",\"coordinates\":[0x1p3,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,+1]}",
+    "{\"type\":\"Point\",\"coordinates\":[inf,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[nan,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[01,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[1.,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[.5,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[1e,1]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2,0x10]}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":+1}",
+    "{\"type\":\"Point\",\"coordinates\":[1,2],\"a\":1.2.3}",
+  };
+  assert_payloads_fail(payloads, sizeof(payloads) / sizeof(payloads[0]));
+}
+
+// A payload over a caller buffer is written like an allocated one
+static void test_mosquitto_payload_from_buffer_success(void** state)
+{
+  char buffer[MAX_PAYLOAD_LENGTH];
+  mosquitto_payload mosq_payload = mosquitto_payload_from_buffer(buffer, sizeof(buffer));
+  geojson_point json_point = geojson_point_init();
+  strcpy(json_point.type, "Point");
+
+  assert_ptr_equal(mosq_payload.payload, buffer);
+  assert_int_equal(mosq_payload.max_payload_length, MAX_PAYLOAD_LENGTH);
+  assert_int_equal(strlen(mosq_payload.payload), 0);
+  assert_int_equal(0, geojson_point_to_mosquitto_payload(json_point, &mosq_payload));
+  assert_string_equal(buffer, "{\"type\":\"Point\",\"coordinates\":[0.000000,0.000000]}");
+  assert_int_equal(mosq_payload.payload_length, strlen(buffer));
+}
+
+// Buffers are handed out until the pool is exhausted, and can be acquired again once released
+static void test_mosquitto_payload_pool_success(void** state)
+{
+  mosquitto_payload_pool pool;
+  mosquitto_payload payloads[3];
+  mosquitto_payload extra;
+
+  assert_int_equal(mosquitto_payload_pool_init(&pool, 3, MAX_PAYLOAD_LENGTH), 0);
+  for (int i = 0; i < 3; i++)
+  {
+    assert_int_equal(mosquitto_payload_pool_acquire(&pool, &payloads[i]), 0);
+    assert_int_equal(payloads[i].max_payload_length, MAX_PAYLOAD_LENGTH);
+    assert_int_equal(payloads[i].payload_length, 0);
+    strcpy(payloads[i].payload, "test");
+  }
+  assert_ptr_not_equal(payloads[0].payload, payloads[1].payload);
+  assert_ptr_not_equal(payloads[1].payload, payloads[2].payload);
+  assert_int_equal(mosquitto_payload_pool_acquire(&pool, &extra), -1);
+  assert_int_equal(pool.exhausted, 1);
+
+  char* released = payloads[1].payload;
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &payloads[1]), 0);
+  assert_null(payloads[1].payload);
+  assert_int_equal(mosquitto_payload_pool_acquire(&pool, &extra), 0);
+  assert_ptr_equal(extra.payload, released);
+  assert_int_equal(strlen(extra.payload), 0);
+
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &extra), 0);
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &payloads[0]), 0);
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &payloads[2]), 0);
+  assert_int_equal(pool.free_count, 3);
+
+  mosquitto_payload_pool_destroy(&pool);
+}
+
+// Buffers that were not acquired from the pool are not released
+static void test_mosquitto_payload_pool_release_fail(void** state)
+{
+  mosquitto_payload_pool pool;
+  mosquitto_payload payload;
+  mosquitto_payload copy;
+  char buffer[MAX_PAYLOAD_LENGTH];
+  mosquitto_payload foreign = mosquitto_payload_from_buffer(buffer, sizeof(buffer));
+
+  assert_int_equal(mosquitto_payload_pool_init(&pool, 2, MAX_PAYLOAD_LENGTH), 0);
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &foreign), -1);
+
+  assert_int_equal(mosquitto_payload_pool_acquire(&pool, &payload), 0);
+  copy = payload;
+  copy.payload++;
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &copy), -1);
+  copy = payload;
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &payload), 0);
+  assert_int_equal(mosquitto_payload_pool_release(&pool, &copy), -1);
+  assert_int_equal(pool.free_count, 2);
+  mosquitto_payload_pool_destroy(&pool);
+
+  assert_int_equal(mosquitto_payload_pool_init(&pool, 0, MAX_PAYLOAD_LENGTH), -1);
+}
+
+// Polygon and MultiPolygon features become fences, holes included, other features are skipped
+static void test_geojson_file_to_geofences_success(void** state)
+{
+  char path[] = "/tmp/geofences_XXXXXX";
+  int fd = mkstemp(path);
+  FILE* file;
+  geofence_engine engine;
+  uint32_t fences[2];
+
+  assert_true(fd >= 0);
+  file = fdopen(fd, "w");
+  assert_non_null(file);
+  fputs(
+      "{\"type\":\"FeatureCollection\",\"features\":["
+      "{\"type\":\"Feature\",\"properties\":{\"name\":\"depot\"},\"geometry\":"
+      "{\"type\":\"Polygon\",\"coordinates\":"
+      "[[[0,0],[10,0],[10,10],[0,10],[0,0]],[[4,4],[6,4],[6,6],[4,6],[4,4]]]}},"
+      "{\"type\":\"Feature\",\"properties\":{},\"geometry\":"
+      "{\"type\":\"Point\",\"coordinates\":[1,1]}},"
+      "{\"type\":\"Feature\",\"properties\":{},\"geometry\":"
+      "{\"type\":\"MultiPolygon\",\"coordinates\":"
+      "[[[[20,0],[30,0],[30,10],[20,0]]],[[[0,20],[10,20],[10,30],[0,20]]]]}}]}",
+      file);
+  fclose(file);
+
+  geofence_engine_init(&engine);
+  assert_int_equal(geojson_file_to_geofences(path, &engine), 2);
+  assert_string_equal(engine.names[0], "depot");
+  assert_string_equal(engine.names[1], "2");
+  assert_int_equal(geofence_engine_contains(&engine, 1, 1, fences, 2), 1);
+  assert_int_equal(fences[0], 0);
+  assert_int_equal(geofence_engine_contains(&engine, 5, 5, fences, 2), 0);
+  assert_int_equal(geofence_engine_contains(&engine, 29, 1, fences, 2), 1);
+  assert_int_equal(fences[0], 1);
+  assert_int_equal(geofence_engine_contains(&engine, 9, 21, fences, 2), 1);
+  assert_int_equal(fences[0], 1);
+
+  geofence_engine_destroy(&engine);
+  remove(path);
+}
+
+// not a FeatureCollection
+static void test_geojson_file_to_geofences_not_feature_collection_fail(void** state)
+{
+  char path[] = "/tmp/geofences_XXXXXX";
+  int fd = mkstemp(path);
+  FILE* file;
+  geofence_engine engine;
+
+  assert_true(fd >= 0);
+  file = fdopen(fd, "w");
+  assert_non_null(file);
+  fputs("{\"type\":\"Point\",\"coordinates\":[1,1]}", file);
+  fclose(file);
+
+  geofence_engine_init(&engine);
+  assert_int_equal(geojson_file_to_geofences(path, &engine), -1);
+
+  geofence_engine_destroy(&engine);
+  remove(path);
+}
+
 int test_json_handler()
 {
   const struct CMUnitTest tests[]
@@ -252,7 +499,7 @@ int test_json_handler()
           cmocka_unit_test(mosquitto_payload_destroy_success),
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_min_length_success),
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_max_length_success),
-          cmocka_unit_test(test_geojson_point_to_mosquitto_payload_null_type_fail),
+          cmocka_unit_test(test_geojson_point_to_mosquitto_payload_empty_type_fail),
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_output_null_fail),
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_output_buffer_too_small_fail),
           cmocka_unit_test(test_geojson_point_set_coordinates_sucess),
@@ -264,6 +511,16 @@ int test_json_handler()
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_empty_json_fail),
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_not_geojson_fail),
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_not_point_fail),
-          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_missing_coordinates_fail) };
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_missing_coordinates_fail),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_members_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_malformed_fail),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_invalid_literal_fail),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_missing_separator_fail),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_invalid_number_fail),
+          cmocka_unit_test(test_mosquitto_payload_from_buffer_success),
+          cmocka_unit_test(test_mosquitto_payload_pool_success),
+          cmocka_unit_test(test_mosquitto_payload_pool_release_fail),
+          cmocka_unit_test(test_geojson_file_to_geofences_success),
+          cmocka_unit_test(test_geojson_file_to_geofences_not_feature_collection_fail) };
   return cmocka_run_group_tests_name("json_handler", tests, NULL, NULL);
 }
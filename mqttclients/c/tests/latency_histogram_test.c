@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "latency_histogram_test.h"
+
+// 1/64 relative precision above the exact range
+#define RELATIVE_PRECISION (1.0 / 64)
+
+static int setup(void** state)
+{
+  latency_histogram* histogram = malloc(sizeof(latency_histogram));
+  if (histogram == NULL)
+  {
+    return -1;
+  }
+  latency_histogram_reset(histogram);
+  *state = histogram;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  free(*state);
+  return 0;
+}
+
+// Empty histogram reports 0
+static void test_latency_histogram_empty_success(void** state)
+{
+  latency_histogram* histogram = *state;
+
+  assert_int_equal(histogram->total_count, 0);
+  assert_int_equal(latency_histogram_value_at_percentile(histogram, 50), 0);
+  assert_float_equal(latency_histogram_mean(histogram), 0, 0.1);
+}
+
+// Small values are recorded exactly
+static void test_latency_histogram_small_values_exact_success(void** state)
+{
+  latency_histogram* histogram = *state;
+
+  for (uint64_t i = 1; i <= 100; i++)
+  {
+    latency_histogram_record(histogram, i);
+  }
+
+  assert_int_equal(histogram->total_count, 100);
+  assert_int_equal(histogram->min, 1);
+  assert_int_equal(histogram->max, 100);
+  assert_int_equal(latency_histogram_value_at_percentile(histogram, 50), 50);
+  assert_int_equal(latency_histogram_value_at_percentile(histogram, 99), 99);
+  assert_int_equal(latency_histogram_value_at_percentile(histogram, 100), 100);
+  assert_float_equal(latency_histogram_mean(histogram), 50.5, 0.001);
+}
+
+// Large values are within the relative precision
+static void test_latency_histogram_large_values_precision_success(void** state)
+{
+  latency_histogram* histogram = *state;
+  const uint64_t values[] = { 1000, 123456, 7654321, 987654321, 60000000000ULL };
+
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    latency_histogram_reset(histogram);
+    latency_histogram_record(histogram, values[i]);
+    latency_histogram_record(histogram, values[i] * 2);
+
+    uint64_t median = latency_histogram_value_at_percentile(histogram, 50);
+    assert_true(median >= values[i]);
+    assert_true(median <= values[i] + (uint64_t)(values[i] * RELATIVE_PRECISION));
+  }
+}
+
+// Tail percentiles pick out rare slow values
+static void test_latency_histogram_tail_percentile_success(void** state)
+{
+  latency_histogram* histogram = *state;
+
+  for (int i = 0; i < 9999; i++)
+  {
+    latency_histogram_record(histogram, 1000000);
+  }
+  latency_histogram_record(histogram, 500000000);
+
+  assert_true(latency_histogram_value_at_percentile(histogram, 99.9) < 1100000);
+  assert_true(latency_histogram_value_at_percentile(histogram, 99.99) < 1100000);
+  assert_int_equal(latency_histogram_value_at_percentile(histogram, 100), 500000000);
+}
+
+// Merge adds the counts of both histograms
+static void test_latency_histogram_merge_success(void** state)
+{
+  latency_histogram* histogram = *state;
+  latency_histogram* other = malloc(sizeof(latency_histogram));
+  assert_non_null(other);
+  latency_histogram_reset(other);
+
+  latency_histogram_record(histogram, 10);
+  latency_histogram_record(other, 20);
+  latency_histogram_record(other, 30);
+  latency_histogram_merge(histogram, other);
+
+  assert_int_equal(histogram->total_count, 3);
+  assert_int_equal(histogram->min, 10);
+  assert_int_equal(histogram->max, 30);
+  assert_int_equal(latency_histogram_value_at_percentile(histogram, 50), 20);
+
+  free(other);
+}
+
+int test_latency_histogram()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test_setup_teardown(test_latency_histogram_empty_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_latency_histogram_small_values_exact_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_latency_histogram_large_values_precision_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_latency_histogram_tail_percentile_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(test_latency_histogram_merge_success, setup, teardown) };
+  return cmocka_run_group_tests_name("latency_histogram", tests, NULL, NULL);
+}
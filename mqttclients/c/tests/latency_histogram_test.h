@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef LATENCY_HISTOGRAM_TEST_H
+#define LATENCY_HISTOGRAM_TEST_H
+
+#include "latency_histogram.h"
+
+int test_latency_histogram();
+
+#endif // LATENCY_HISTOGRAM_TEST_H
@@ -1,8 +1,23 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // SPDX-License-Identifier: MIT
 
+#include "chunked_transfer_test.h"
+#include "core_runtime_test.h"
+#include "geo_heatmap_test.h"
+#include "geofence_test.h"
 #include "json_handler_test.h"
+#include "latency_histogram_test.h"
+#include "memory_arena_test.h"
+#include "message_journal_test.h"
 #include "mqtt_client_test.h"
+#include "mqtt_connect_test.h"
+#include "payload_compression_test.h"
+#include "publish_queue_test.h"
+#include "response_cache_test.h"
+#include "sequence_tracker_test.h"
+#include "telemetry_allocation_test.h"
+#include "time_series_store_test.h"
+#include "topic_template_test.h"
 
 int main()
 {
@@ -10,6 +25,23 @@ int main()
 
   result += test_mqtt_client();
   result += test_json_handler();
+  result += test_memory_arena();
+  result += test_response_cache();
+  result += test_latency_histogram();
+  result += test_time_series_store();
+  result += test_message_journal();
+  result += test_geofence();
+  result += test_core_runtime();
+  result += test_telemetry_allocation();
+  result += test_chunked_transfer();
+#ifdef PAYLOAD_COMPRESSION
+  result += test_payload_compression();
+#endif
+  result += test_topic_template();
+  result += test_publish_queue();
+  result += test_mqtt_connect();
+  result += test_geo_heatmap();
+  result += test_sequence_tracker();
 
   return result;
 }
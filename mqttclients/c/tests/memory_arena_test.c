@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "memory_arena_test.h"
+
+#define ARENA_CAPACITY 64
+
+// Allocations are aligned and served from the arena buffer
+static void test_memory_arena_alloc_aligned_success(void** state)
+{
+  memory_arena arena;
+  assert_int_equal(memory_arena_init(&arena, ARENA_CAPACITY), 0);
+
+  char* first = memory_arena_alloc(&arena, 3);
+  char* second = memory_arena_alloc(&arena, 5);
+
+  assert_non_null(first);
+  assert_non_null(second);
+  assert_int_equal((uintptr_t)first % MEMORY_ARENA_ALIGNMENT, 0);
+  assert_int_equal((uintptr_t)second % MEMORY_ARENA_ALIGNMENT, 0);
+  assert_ptr_equal(first, arena.buffer);
+  assert_ptr_equal(second, arena.buffer + MEMORY_ARENA_ALIGNMENT);
+  assert_int_equal(arena.alloc_count, 2);
+  assert_int_equal(arena.overflow_count, 0);
+
+  memory_arena_destroy(&arena);
+}
+
+// Reset makes the whole buffer available again
+static void test_memory_arena_reset_reuses_buffer_success(void** state)
+{
+  memory_arena arena;
+  assert_int_equal(memory_arena_init(&arena, ARENA_CAPACITY), 0);
+
+  char* first = memory_arena_alloc(&arena, ARENA_CAPACITY);
+  memory_arena_reset(&arena);
+  char* second = memory_arena_alloc(&arena, ARENA_CAPACITY);
+
+  assert_ptr_equal(first, second);
+  assert_int_equal(arena.offset, ARENA_CAPACITY);
+  assert_int_equal(arena.high_water_mark, ARENA_CAPACITY);
+  assert_int_equal(arena.overflow_count, 0);
+
+  memory_arena_destroy(&arena);
+}
+
+// Allocations that don't fit fall back to the heap and are released on reset
+static void test_memory_arena_overflow_success(void** state)
+{
+  memory_arena arena;
+  assert_int_equal(memory_arena_init(&arena, ARENA_CAPACITY), 0);
+
+  char* in_buffer = memory_arena_alloc(&arena, ARENA_CAPACITY / 2);
+  char* overflow = memory_arena_alloc(&arena, ARENA_CAPACITY);
+
+  assert_non_null(overflow);
+  assert_int_equal((uintptr_t)overflow % MEMORY_ARENA_ALIGNMENT, 0);
+  assert_true(overflow < (char*)arena.buffer || overflow >= (char*)arena.buffer + arena.capacity);
+  memset(overflow, 0xAB, ARENA_CAPACITY);
+  assert_ptr_equal(in_buffer, arena.buffer);
+  assert_int_equal(arena.overflow_count, 1);
+  assert_non_null(arena.overflow);
+
+  memory_arena_reset(&arena);
+  assert_null(arena.overflow);
+  assert_int_equal(arena.offset, 0);
+
+  memory_arena_destroy(&arena);
+}
+
+// Destroy frees the buffer
+static void test_memory_arena_destroy_success(void** state)
+{
+  memory_arena arena;
+  assert_int_equal(memory_arena_init(&arena, ARENA_CAPACITY), 0);
+  memory_arena_alloc(&arena, ARENA_CAPACITY * 2);
+
+  memory_arena_destroy(&arena);
+  assert_null(arena.buffer);
+  assert_null(arena.overflow);
+  assert_int_equal(arena.capacity, 0);
+}
+
+int test_memory_arena()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_memory_arena_alloc_aligned_success),
+          cmocka_unit_test(test_memory_arena_reset_reuses_buffer_success),
+          cmocka_unit_test(test_memory_arena_overflow_success),
+          cmocka_unit_test(test_memory_arena_destroy_success) };
+  return cmocka_run_group_tests_name("memory_arena", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MEMORY_ARENA_TEST_H
+#define MEMORY_ARENA_TEST_H
+
+#include "memory_arena.h"
+
+int test_memory_arena();
+
+#endif // MEMORY_ARENA_TEST_H
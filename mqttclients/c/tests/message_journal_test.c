@@ -0,0 +1,356 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "message_journal_test.h"
+#include "mqtt_protocol.h"
+
+#define START_TIME_NS 1700000000000000000LL
+#define INTERVAL_NS 1000000LL
+#define MESSAGE_COUNT 1000
+
+static int setup(void** state)
+{
+  char* directory = strdup("/tmp/message_journal_test_XXXXXX");
+  if (directory == NULL || mkdtemp(directory) == NULL)
+  {
+    free(directory);
+    return -1;
+  }
+  *state = directory;
+  return 0;
+}
+
+static int remove_entry(const char* path, const struct stat* status, int type, struct FTW* ftw)
+{
+  (void)status;
+  (void)type;
+  (void)ftw;
+  return remove(path);
+}
+
+static int teardown(void** state)
+{
+  nftw(*state, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  free(*state);
+  return 0;
+}
+
+static void append_messages(message_journal* journal, int first, int count)
+{
+  char topic[64];
+  char payload[64];
+  struct mosquitto_message message = { 0 };
+
+  message.topic = topic;
+  message.payload = payload;
+  message.qos = 1;
+  for (int i = first; i < first + count; i++)
+  {
+    sprintf(topic, "vehicles/vehicle%d/position", i % 10);
+    message.payloadlen = sprintf(payload, "{\"type\":\"Point\",\"coordinates\":[%d,%d]}", i, -i);
+    assert_int_equal(
+        message_journal_append(journal, &message, NULL, START_TIME_NS + i * INTERVAL_NS), 0);
+  }
+}
+
+static void assert_record(const message_journal_record* record, int i)
+{
+  char topic[64];
+  char payload[64];
+  int topic_length = sprintf(topic, "vehicles/vehicle%d/position", i % 10);
+  int payload_length = sprintf(payload, "{\"type\":\"Point\",\"coordinates\":[%d,%d]}", i, -i);
+
+  assert_int_equal(record->sequence, i + 1);
+  assert_true(record->timestamp_ns == START_TIME_NS + i * INTERVAL_NS);
+  assert_int_equal(record->topic_length, topic_length);
+  assert_memory_equal(record->topic, topic, topic_length);
+  assert_int_equal(record->qos, 1);
+  assert_false(record->retain);
+  assert_int_equal(record->properties_length, 0);
+  assert_int_equal(record->payload_length, payload_length);
+  assert_memory_equal(record->payload, payload, payload_length);
+}
+
+static void assert_journal(const char* directory, int count)
+{
+  message_journal_reader reader;
+  message_journal_record record;
+
+  assert_int_equal(message_journal_reader_open(&reader, directory), 0);
+  for (int i = 0; i < count; i++)
+  {
+    assert_int_equal(message_journal_reader_next(&reader, &record), 1);
+    assert_record(&record, i);
+  }
+  assert_int_equal(message_journal_reader_next(&reader, &record), 0);
+  message_journal_reader_close(&reader);
+}
+
+// Appended messages are read back in order with their receive time and sequence
+static void test_message_journal_round_trip_success(void** state)
+{
+  message_journal journal;
+  message_journal_options options = { .directory = *state };
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  append_messages(&journal, 0, MESSAGE_COUNT);
+  assert_int_equal(journal.appended, MESSAGE_COUNT);
+  assert_int_equal(journal.dropped, 0);
+  message_journal_close(&journal);
+
+  assert_journal(*state, MESSAGE_COUNT);
+}
+
+// Records continue in a new segment when a segment is full
+static void test_message_journal_segment_rollover_success(void** state)
+{
+  message_journal journal;
+  message_journal_options options = { .directory = *state, .segment_size = 4096 };
+  message_journal_reader reader;
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  append_messages(&journal, 0, MESSAGE_COUNT);
+  message_journal_close(&journal);
+
+  assert_journal(*state, MESSAGE_COUNT);
+  assert_int_equal(message_journal_reader_open(&reader, *state), 0);
+  assert_true(reader.segment_count > 20);
+  message_journal_reader_close(&reader);
+}
+
+// Seeking positions the reader at the first record received at or after the requested time
+static void test_message_journal_seek_success(void** state)
+{
+  message_journal journal;
+  message_journal_options options
+      = { .directory = *state, .segment_size = 16384, .index_interval = 512 };
+  message_journal_reader reader;
+  message_journal_record record;
+  const int targets[] = { 0, 1, 37, 499, 500, 998 };
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  append_messages(&journal, 0, MESSAGE_COUNT);
+  message_journal_close(&journal);
+
+  assert_int_equal(message_journal_reader_open(&reader, *state), 0);
+  for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++)
+  {
+    // Between two records, the next one is returned
+    assert_int_equal(
+        message_journal_reader_seek(
+            &reader, START_TIME_NS + targets[i] * INTERVAL_NS - INTERVAL_NS / 2),
+        0);
+    assert_int_equal(message_journal_reader_next(&reader, &record), 1);
+    assert_record(&record, targets[i]);
+    assert_int_equal(message_journal_reader_next(&reader, &record), 1);
+    assert_record(&record, targets[i] + 1);
+  }
+
+  assert_int_equal(message_journal_reader_seek(&reader, START_TIME_NS - INTERVAL_NS), 0);
+  assert_int_equal(message_journal_reader_next(&reader, &record), 1);
+  assert_record(&record, 0);
+
+  assert_int_equal(
+      message_journal_reader_seek(&reader, START_TIME_NS + MESSAGE_COUNT * INTERVAL_NS), 0);
+  assert_int_equal(message_journal_reader_next(&reader, &record), 0);
+  message_journal_reader_close(&reader);
+}
+
+// Reopening a journal continues after its last record
+static void test_message_journal_reopen_success(void** state)
+{
+  message_journal journal;
+  message_journal_options options = { .directory = *state, .segment_size = 4096 };
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  append_messages(&journal, 0, 100);
+  message_journal_close(&journal);
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  append_messages(&journal, 100, 100);
+  message_journal_close(&journal);
+
+  assert_journal(*state, 200);
+}
+
+// Properties of MQTT v5 messages are restored by the reader
+static void test_message_journal_properties_success(void** state)
+{
+  message_journal journal;
+  message_journal_options options = { .directory = *state };
+  message_journal_reader reader;
+  message_journal_record record;
+  struct mosquitto_message message = { .topic = "vehicles/vehicle1/position", .qos = 1 };
+  mosquitto_property* props = NULL;
+  mosquitto_property* read_props = NULL;
+  char* value = NULL;
+  char* name = NULL;
+  void* correlation_data = NULL;
+  uint16_t correlation_data_length = 0;
+  uint32_t expiry = 0;
+
+  assert_int_equal(mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "text/plain"), 0);
+  assert_int_equal(
+      mosquitto_property_add_binary(&props, MQTT_PROP_CORRELATION_DATA, "\x01\x00\x02", 3), 0);
+  assert_int_equal(mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, 30), 0);
+  assert_int_equal(
+      mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "unit", "celsius"), 0);
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  assert_int_equal(message_journal_append(&journal, &message, props, START_TIME_NS), 0);
+  message_journal_close(&journal);
+  mosquitto_property_free_all(&props);
+
+  assert_int_equal(message_journal_reader_open(&reader, *state), 0);
+  assert_int_equal(message_journal_reader_next(&reader, &record), 1);
+  assert_int_equal(record.payload_length, 0);
+  assert_int_equal(message_journal_record_properties(&record, &read_props), 0);
+  message_journal_reader_close(&reader);
+
+  assert_non_null(
+      mosquitto_property_read_string(read_props, MQTT_PROP_CONTENT_TYPE, &value, false));
+  assert_string_equal(value, "text/plain");
+  assert_non_null(mosquitto_property_read_binary(
+      read_props,
+      MQTT_PROP_CORRELATION_DATA,
+      &correlation_data,
+      &correlation_data_length,
+      false));
+  assert_int_equal(correlation_data_length, 3);
+  assert_memory_equal(correlation_data, "\x01\x00\x02", 3);
+  assert_non_null(mosquitto_property_read_int32(
+      read_props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &expiry, false));
+  assert_int_equal(expiry, 30);
+  free(value);
+  value = NULL;
+  assert_non_null(mosquitto_property_read_string_pair(
+      read_props, MQTT_PROP_USER_PROPERTY, &name, &value, false));
+  assert_string_equal(name, "unit");
+  assert_string_equal(value, "celsius");
+
+  free(name);
+  free(value);
+  free(correlation_data);
+  mosquitto_property_free_all(&read_props);
+}
+
+// Properties set by the broker are left out when a record is republished
+static void test_message_journal_publish_properties_success(void** state)
+{
+  message_journal journal;
+  message_journal_options options = { .directory = *state };
+  message_journal_reader reader;
+  message_journal_record record;
+  struct mosquitto_message message = { .topic = "vehicles/vehicle1/position", .qos = 1 };
+  mosquitto_property* props = NULL;
+  mosquitto_property* read_props = NULL;
+  mosquitto_property* publish_props = NULL;
+  uint32_t identifier = 0;
+  uint16_t alias = 0;
+  char* value = NULL;
+
+  assert_int_equal(mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "text/plain"), 0);
+  assert_int_equal(mosquitto_property_add_varint(&props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, 7), 0);
+  assert_int_equal(mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, 3), 0);
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  assert_int_equal(message_journal_append(&journal, &message, props, START_TIME_NS), 0);
+  message_journal_close(&journal);
+  mosquitto_property_free_all(&props);
+
+  assert_int_equal(message_journal_reader_open(&reader, *state), 0);
+  assert_int_equal(message_journal_reader_next(&reader, &record), 1);
+  assert_int_equal(message_journal_record_properties(&record, &read_props), 0);
+  assert_int_equal(message_journal_record_publish_properties(&record, &publish_props), 0);
+  message_journal_reader_close(&reader);
+
+  assert_non_null(mosquitto_property_read_varint(
+      read_props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, &identifier, false));
+  assert_int_equal(identifier, 7);
+  assert_non_null(mosquitto_property_read_int16(read_props, MQTT_PROP_TOPIC_ALIAS, &alias, false));
+  assert_int_equal(alias, 3);
+
+  assert_null(mosquitto_property_read_varint(
+      publish_props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, &identifier, false));
+  assert_null(mosquitto_property_read_int16(publish_props, MQTT_PROP_TOPIC_ALIAS, &alias, false));
+  assert_non_null(
+      mosquitto_property_read_string(publish_props, MQTT_PROP_CONTENT_TYPE, &value, false));
+  assert_string_equal(value, "text/plain");
+
+  free(value);
+  mosquitto_property_free_all(&read_props);
+  mosquitto_property_free_all(&publish_props);
+}
+
+// A record torn by a crash ends the journal, and is overwritten when the journal is reopened
+static void test_message_journal_torn_record_failure(void** state)
+{
+  message_journal journal;
+  message_journal_options options = { .directory = *state };
+  message_journal_reader reader;
+  message_journal_record record;
+  char path[PATH_MAX];
+  size_t offset = 0;
+  char corrupted = '#';
+  int fd;
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  append_messages(&journal, 0, 10);
+  message_journal_close(&journal);
+
+  assert_int_equal(message_journal_reader_open(&reader, *state), 0);
+  while (message_journal_reader_next(&reader, &record) == 1)
+  {
+    offset = (const uint8_t*)record.payload - reader.base;
+  }
+  message_journal_reader_close(&reader);
+
+  sprintf(path, "%s/%020d.journal", (char*)*state, 0);
+  fd = open(path, O_WRONLY);
+  assert_true(fd >= 0);
+  assert_int_equal(pwrite(fd, &corrupted, 1, (off_t)offset), 1);
+  close(fd);
+
+  assert_journal(*state, 9);
+
+  assert_int_equal(message_journal_open(&journal, &options), 0);
+  assert_int_equal(journal.next_sequence, 10);
+  append_messages(&journal, 9, 5);
+  message_journal_close(&journal);
+
+  assert_journal(*state, 14);
+}
+
+int test_message_journal()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_message_journal_round_trip_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_message_journal_segment_rollover_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_message_journal_seek_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_message_journal_reopen_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_message_journal_properties_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_message_journal_publish_properties_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_message_journal_torn_record_failure, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("message_journal", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MESSAGE_JOURNAL_TEST_H
+#define MESSAGE_JOURNAL_TEST_H
+
+#include "message_journal.h"
+
+int test_message_journal();
+
+#endif // MESSAGE_JOURNAL_TEST_H
@@ -0,0 +1,278 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_connect_test.h"
+
+#define CLIENT_COUNT 16
+#define CONNECT_THREADS 4
+#define TIMEOUT_MS 5000
+#define SILENT_TIMEOUT_MS 200
+
+static char hostname[] = "127.0.0.1";
+static int connect_callbacks;
+
+// Accepts the connections on a loopback port, and answers their CONNECT with a CONNACK unless
+// silent.
+typedef struct fake_broker
+{
+  int listen_fd;
+  int port;
+  bool silent;
+  int fds[CLIENT_COUNT];
+  int accepted;
+  pthread_t thread;
+} fake_broker;
+
+static bool read_exactly(int fd, unsigned char* buffer, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t received = read(fd, buffer, length);
+    if (received <= 0)
+    {
+      return false;
+    }
+    buffer += received;
+    length -= (size_t)received;
+  }
+  return true;
+}
+
+static bool read_connect(int fd)
+{
+  unsigned char packet[256];
+  uint32_t remaining = 0;
+  int shift = 0;
+
+  if (!read_exactly(fd, packet, 1) || packet[0] != 0x10)
+  {
+    return false;
+  }
+  do
+  {
+    if (!read_exactly(fd, packet, 1))
+    {
+      return false;
+    }
+    remaining |= (uint32_t)(packet[0] & 0x7F) << shift;
+    shift += 7;
+  } while (packet[0] & 0x80);
+  return remaining <= sizeof(packet) && read_exactly(fd, packet, remaining);
+}
+
+static void* serve(void* argument)
+{
+  fake_broker* broker = argument;
+  // MQTT 3.1.1 CONNACK, accepted
+  static const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+  while (broker->accepted < CLIENT_COUNT)
+  {
+    int fd = accept(broker->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      break;
+    }
+    broker->fds[broker->accepted++] = fd;
+    if (!broker->silent && read_connect(fd) && write(fd, connack, sizeof(connack)) < 0)
+    {
+      break;
+    }
+  }
+  return NULL;
+}
+
+static int listen_loopback(int* port)
+{
+  struct sockaddr_in address = { 0 };
+  socklen_t length = sizeof(address);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert_true(fd >= 0);
+  assert_int_equal(bind(fd, (struct sockaddr*)&address, sizeof(address)), 0);
+  assert_int_equal(listen(fd, CLIENT_COUNT), 0);
+  assert_int_equal(getsockname(fd, (struct sockaddr*)&address, &length), 0);
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+static void start_broker(fake_broker* broker, bool silent)
+{
+  memset(broker, 0, sizeof(fake_broker));
+  broker->silent = silent;
+  broker->listen_fd = listen_loopback(&broker->port);
+  assert_int_equal(pthread_create(&broker->thread, NULL, serve, broker), 0);
+}
+
+static void stop_broker(fake_broker* broker)
+{
+  // Unblocks accept() if fewer clients connected.
+  shutdown(broker->listen_fd, SHUT_RDWR);
+  pthread_join(broker->thread, NULL);
+  close(broker->listen_fd);
+  for (int i = 0; i < broker->accepted; i++)
+  {
+    close(broker->fds[i]);
+  }
+}
+
+static void count_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  __atomic_fetch_add(&connect_callbacks, 1, __ATOMIC_RELAXED);
+}
+
+static void create_clients(
+    struct mosquitto** clients,
+    mqtt_client_obj* objs,
+    size_t count,
+    int port)
+{
+  mqtt_client_connection_settings settings = { 0 };
+
+  settings.hostname = hostname;
+  settings.tcp_port = port;
+  settings.keep_alive_in_seconds = 30;
+  settings.clean_session = true;
+  memset(objs, 0, count * sizeof(mqtt_client_obj));
+  for (size_t i = 0; i < count; i++)
+  {
+    objs[i].mqtt_version = MQTT_PROTOCOL_V311;
+    clients[i] = mqtt_client_new(false, &settings, count_connect, &objs[i]);
+    assert_non_null(clients[i]);
+  }
+}
+
+static void destroy_clients(struct mosquitto** clients, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    mosquitto_destroy(clients[i]);
+  }
+}
+
+static int setup(void** state)
+{
+  connect_callbacks = 0;
+  return mosquitto_lib_init();
+}
+
+static int teardown(void** state)
+{
+  return mosquitto_lib_cleanup();
+}
+
+static void test_mqtt_connect_all_success(void** state)
+{
+  fake_broker broker;
+  struct mosquitto* clients[CLIENT_COUNT];
+  mqtt_client_obj objs[CLIENT_COUNT];
+  mqtt_connect_timing timings[CLIENT_COUNT];
+
+  start_broker(&broker, false);
+  create_clients(clients, objs, CLIENT_COUNT, broker.port);
+
+  assert_int_equal(
+      mqtt_client_connect_all(clients, CLIENT_COUNT, CONNECT_THREADS, TIMEOUT_MS, timings),
+      CLIENT_COUNT);
+  assert_int_equal(connect_callbacks, CLIENT_COUNT);
+  for (int i = 0; i < CLIENT_COUNT; i++)
+  {
+    int64_t phases_ns = 0;
+
+    assert_int_equal(timings[i].result, MOSQ_ERR_SUCCESS);
+    assert_int_equal(timings[i].reason_code, 0);
+    assert_int_equal(timings[i].phase, MQTT_CONNECT_PHASE_COUNT);
+    // Without TLS the CONNECT is written once the socket is connected.
+    assert_int_equal(timings[i].phase_ns[MQTT_CONNECT_PHASE_TLS], 0);
+    for (int phase = 0; phase < MQTT_CONNECT_PHASE_COUNT; phase++)
+    {
+      assert_true(timings[i].phase_ns[phase] >= 0);
+      phases_ns += timings[i].phase_ns[phase];
+    }
+    assert_int_equal(phases_ns, timings[i].total_ns);
+    assert_null(objs[i].connect_attempt);
+  }
+
+  destroy_clients(clients, CLIENT_COUNT);
+  stop_broker(&broker);
+}
+
+static void test_mqtt_connect_all_connack_timeout_failure(void** state)
+{
+  fake_broker broker;
+  struct mosquitto* clients[CLIENT_COUNT];
+  mqtt_client_obj objs[CLIENT_COUNT];
+  mqtt_connect_timing timings[CLIENT_COUNT];
+
+  start_broker(&broker, true);
+  create_clients(clients, objs, CLIENT_COUNT, broker.port);
+
+  assert_int_equal(
+      mqtt_client_connect_all(clients, CLIENT_COUNT, CONNECT_THREADS, SILENT_TIMEOUT_MS, timings),
+      0);
+  assert_int_equal(connect_callbacks, 0);
+  for (int i = 0; i < CLIENT_COUNT; i++)
+  {
+    assert_int_equal(timings[i].result, MOSQ_ERR_TIMEOUT);
+    assert_int_equal(timings[i].phase, MQTT_CONNECT_PHASE_CONNACK);
+    assert_true(timings[i].total_ns >= (int64_t)SILENT_TIMEOUT_MS * 1000000 / 2);
+  }
+
+  destroy_clients(clients, CLIENT_COUNT);
+  stop_broker(&broker);
+}
+
+static void test_mqtt_connect_all_refused_failure(void** state)
+{
+  struct mosquitto* clients[2];
+  mqtt_client_obj objs[2];
+  mqtt_connect_timing timings[2];
+  int port;
+
+  // Nothing listens on the port once it is closed.
+  close(listen_loopback(&port));
+  create_clients(clients, objs, 2, port);
+
+  assert_int_equal(mqtt_client_connect_all(clients, 2, 1, TIMEOUT_MS, timings), 0);
+  for (int i = 0; i < 2; i++)
+  {
+    assert_int_equal(timings[i].result, MOSQ_ERR_ERRNO);
+    assert_int_equal(timings[i].phase, MQTT_CONNECT_PHASE_TCP);
+    assert_null(objs[i].connect_attempt);
+  }
+
+  destroy_clients(clients, 2);
+}
+
+int test_mqtt_connect()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_mqtt_connect_all_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_mqtt_connect_all_connack_timeout_failure, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_connect_all_refused_failure, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("mqtt_connect", tests, NULL, NULL);
+}
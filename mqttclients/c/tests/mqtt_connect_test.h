@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_CONNECT_TEST_H
+#define MQTT_CONNECT_TEST_H
+
+#include "mqtt_connect.h"
+
+int test_mqtt_connect();
+
+#endif // MQTT_CONNECT_TEST_H
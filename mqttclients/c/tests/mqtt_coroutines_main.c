@@ -0,0 +1,6 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "mqtt_coroutines_test.h"
+
+int main() { return test_mqtt_coroutines(); }
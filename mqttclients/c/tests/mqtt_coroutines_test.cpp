@@ -0,0 +1,220 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <chrono>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_coroutines.h"
+#include "mqtt_coroutines_test.h"
+
+// Sleeps are short, so the flows overlap without slowing down the tests.
+constexpr int FLOW_COUNT = 10000;
+constexpr int MAX_SLEEP_MS = 5;
+
+static char hostname[] = "localhost";
+
+static mqtt_client_connection_settings testSettings()
+{
+    mqtt_client_connection_settings settings = {};
+    settings.hostname = hostname;
+    settings.tcp_port = 1883;
+    settings.keep_alive_in_seconds = 30;
+    settings.clean_session = true;
+    return settings;
+}
+
+static Task<> sleepThenRecord(CoroutineClient& client, int sleepMs, std::vector<int>& order)
+{
+    co_await client.sleepFor(std::chrono::milliseconds(sleepMs));
+    order.push_back(sleepMs);
+}
+
+static Task<int> increment(CoroutineClient& client, int value)
+{
+    co_await client.sleepFor(std::chrono::milliseconds(value % MAX_SLEEP_MS));
+    co_return value + 1;
+}
+
+static Task<> sumIncrements(CoroutineClient& client, int value, long long& sum)
+{
+    int first = co_await increment(client, value);
+    int second = co_await increment(client, first);
+    sum += second;
+}
+
+static Task<int> failAfterSleep(CoroutineClient& client)
+{
+    co_await client.sleepFor(std::chrono::milliseconds(1));
+    throw std::runtime_error("expected failure");
+}
+
+static Task<> catchFailure(CoroutineClient& client, int& caught)
+{
+    try {
+        co_await failAfterSleep(client);
+    } catch (const std::runtime_error&) {
+        caught++;
+    }
+}
+
+static Task<> failUncaught(CoroutineClient& client)
+{
+    co_await failAfterSleep(client);
+}
+
+static Task<> publishWithoutConnection(
+    CoroutineClient& client, int& publishError, int& requestError)
+{
+    try {
+        co_await client.publish("devices/rasp", "payload", 0);
+    } catch (const MqttError& e) {
+        publishError = e.code();
+    }
+    try {
+        co_await client.request("devices/rasp", "payload");
+    } catch (const MqttError& e) {
+        requestError = e.code();
+    }
+}
+
+static Task<> sleepForever(CoroutineClient& client, int& wokeUp)
+{
+    co_await client.sleepFor(std::chrono::hours(1));
+    wokeUp++;
+}
+
+static Task<> stopAfterSleep(CoroutineClient& client)
+{
+    co_await client.sleepFor(std::chrono::milliseconds(1));
+    client.stop();
+}
+
+static int setup(void** state)
+{
+    return mosquitto_lib_init();
+}
+
+static int teardown(void** state)
+{
+    return mosquitto_lib_cleanup();
+}
+
+static void test_coroutine_sleep_order_success(void** state)
+{
+    mqtt_client_connection_settings settings = testSettings();
+    CoroutineClient client(settings, MQTT_PROTOCOL_V311);
+    std::vector<int> order;
+
+    client.spawn(sleepThenRecord(client, 30, order));
+    client.spawn(sleepThenRecord(client, 10, order));
+    client.spawn(sleepThenRecord(client, 20, order));
+    client.run();
+
+    assert_int_equal(order.size(), 3);
+    assert_int_equal(order[0], 10);
+    assert_int_equal(order[1], 20);
+    assert_int_equal(order[2], 30);
+    assert_int_equal(client.activeFlows(), 0);
+}
+
+static void test_coroutine_concurrent_flows_success(void** state)
+{
+    mqtt_client_connection_settings settings = testSettings();
+    CoroutineClient client(settings, MQTT_PROTOCOL_V311);
+    long long sum = 0;
+    long long expected = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < FLOW_COUNT; i++) {
+        client.spawn(sumIncrements(client, i, sum));
+        expected += i + 2;
+    }
+    client.run();
+
+    // All the flows sleep at the same time on the thread of run().
+    assert_int_equal(sum, expected);
+    assert_int_equal(client.failedFlows(), 0);
+    assert_true(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+}
+
+static void test_coroutine_exception_failure(void** state)
+{
+    mqtt_client_connection_settings settings = testSettings();
+    CoroutineClient client(settings, MQTT_PROTOCOL_V311);
+    int caught = 0;
+
+    client.spawn(catchFailure(client, caught));
+    client.spawn(failUncaught(client));
+    client.run();
+
+    assert_int_equal(caught, 1);
+    assert_int_equal(client.failedFlows(), 1);
+    assert_int_equal(client.activeFlows(), 0);
+}
+
+static void test_coroutine_not_connected_failure(void** state)
+{
+    mqtt_client_connection_settings settings = testSettings();
+    CoroutineClient client(settings, MQTT_PROTOCOL_V311);
+    int publishError = MOSQ_ERR_SUCCESS;
+    int requestError = MOSQ_ERR_SUCCESS;
+
+    client.spawn(publishWithoutConnection(client, publishError, requestError));
+    client.run();
+
+    assert_int_equal(publishError, MOSQ_ERR_NO_CONN);
+    // Requests need a response topic.
+    assert_int_equal(requestError, MOSQ_ERR_INVAL);
+    assert_int_equal(client.pendingRequests(), 0);
+}
+
+static void test_coroutine_stop_success(void** state)
+{
+    mqtt_client_connection_settings settings = testSettings();
+    int wokeUp = 0;
+
+    {
+        CoroutineClient client(settings, MQTT_PROTOCOL_V311);
+        client.spawn(sleepForever(client, wokeUp));
+        client.spawn(stopAfterSleep(client));
+        client.run();
+        assert_int_equal(client.activeFlows(), 1);
+    }
+    // The suspended flow was destroyed with the client without resuming.
+    assert_int_equal(wokeUp, 0);
+}
+
+static void test_coroutine_response_topic_failure(void** state)
+{
+    mqtt_client_connection_settings settings = testSettings();
+    bool thrown = false;
+
+    try {
+        CoroutineClient client(settings, MQTT_PROTOCOL_V311, "clients/rasp/responses");
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert_true(thrown);
+}
+
+int test_mqtt_coroutines()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_coroutine_sleep_order_success),
+        cmocka_unit_test(test_coroutine_concurrent_flows_success),
+        cmocka_unit_test(test_coroutine_exception_failure),
+        cmocka_unit_test(test_coroutine_not_connected_failure),
+        cmocka_unit_test(test_coroutine_stop_success),
+        cmocka_unit_test(test_coroutine_response_topic_failure)
+    };
+    return cmocka_run_group_tests_name("mqtt_coroutines", tests, setup, teardown);
+}
@@ -0,0 +1,18 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_COROUTINES_TEST_H
+#define MQTT_COROUTINES_TEST_H
+
+// The test is C++, called from the C test runner.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int test_mqtt_coroutines();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MQTT_COROUTINES_TEST_H
@@ -0,0 +1,332 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zdict.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_protocol.h"
+#include "payload_compression_test.h"
+
+#define SAMPLE_COUNT 2000
+#define SAMPLE_LENGTH 64
+#define DICTIONARY_CAPACITY (4 * 1024)
+#define BUFFER_LENGTH 256
+
+typedef struct compression_fixture
+{
+  payload_codec codec;
+  char samples[SAMPLE_COUNT * SAMPLE_LENGTH];
+  size_t sample_sizes[SAMPLE_COUNT];
+  size_t samples_length;
+  uint8_t dictionary[DICTIONARY_CAPACITY];
+} compression_fixture;
+
+static size_t format_point(char* buffer, size_t capacity, unsigned int seed)
+{
+  double x = (seed % 18000) / 100.0 - 90;
+  double y = ((seed * 7919) % 18000) / 100.0 - 90;
+
+  return (size_t)snprintf(
+      buffer, capacity, "{\"type\":\"Point\",\"coordinates\":[%.6f,%.6f]}", x, y);
+}
+
+// Trains a dictionary on positions like the ones of the telemetry producer, with the given id.
+static size_t train_dictionary(compression_fixture* fixture, uint32_t id)
+{
+  ZDICT_params_t params = { 0 };
+  size_t header;
+  size_t size;
+
+  fixture->samples_length = 0;
+  for (int i = 0; i < SAMPLE_COUNT; i++)
+  {
+    fixture->sample_sizes[i] = format_point(
+        fixture->samples + fixture->samples_length, SAMPLE_LENGTH, (unsigned int)i * 31 + id);
+    fixture->samples_length += fixture->sample_sizes[i];
+  }
+
+  size = ZDICT_trainFromBuffer(
+      fixture->dictionary,
+      DICTIONARY_CAPACITY,
+      fixture->samples,
+      fixture->sample_sizes,
+      SAMPLE_COUNT);
+  assert_false(ZDICT_isError(size));
+  header = ZDICT_getDictHeaderSize(fixture->dictionary, size);
+  assert_false(ZDICT_isError(header));
+  params.dictID = id;
+  size = ZDICT_finalizeDictionary(
+      fixture->dictionary,
+      DICTIONARY_CAPACITY,
+      fixture->dictionary + header,
+      size - header,
+      fixture->samples,
+      fixture->sample_sizes,
+      SAMPLE_COUNT,
+      params);
+  assert_false(ZDICT_isError(size));
+  return size;
+}
+
+static void add_dictionary(compression_fixture* fixture, uint32_t id)
+{
+  size_t size = train_dictionary(fixture, id);
+  assert_int_equal(payload_codec_add_dictionary(&fixture->codec, fixture->dictionary, size), 0);
+}
+
+static int setup(void** state)
+{
+  compression_fixture* fixture = calloc(1, sizeof(compression_fixture));
+  assert_non_null(fixture);
+  assert_int_equal(payload_codec_init(&fixture->codec, PAYLOAD_COMPRESSION_DEFAULT_LEVEL), 0);
+  *state = fixture;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  compression_fixture* fixture = *state;
+  payload_codec_destroy(&fixture->codec);
+  free(fixture);
+  return 0;
+}
+
+static struct mosquitto_message make_message(void* payload, size_t length)
+{
+  struct mosquitto_message message = { 0 };
+  message.topic = "vehicles/vehicle01/position";
+  message.payload = payload;
+  message.payloadlen = (int)length;
+  return message;
+}
+
+static char* content_type(const mosquitto_property* props)
+{
+  char* value = NULL;
+  mosquitto_property_read_string(props, MQTT_PROP_CONTENT_TYPE, &value, false);
+  return value;
+}
+
+static void test_payload_compression_round_trip_success(void** state)
+{
+  compression_fixture* fixture = *state;
+  char payload[SAMPLE_LENGTH];
+  uint8_t compressed[BUFFER_LENGTH];
+  char decompressed[BUFFER_LENGTH];
+  const mosquitto_property* props = NULL;
+  size_t compressed_length = 0;
+  size_t length = 0;
+  char* type;
+
+  add_dictionary(fixture, 7);
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    // Positions the dictionary was not trained on
+    size_t payload_length = format_point(payload, sizeof(payload), 1000003 + i * 17);
+
+    assert_true(payload_codec_compress(
+        &fixture->codec,
+        payload,
+        payload_length,
+        compressed,
+        sizeof(compressed),
+        &compressed_length,
+        &props));
+    assert_true(compressed_length < payload_length);
+    type = content_type(props);
+    assert_string_equal(type, "zstd:7");
+    free(type);
+
+    struct mosquitto_message message = make_message(compressed, compressed_length);
+    assert_int_equal(
+        payload_codec_decompress(
+            &fixture->codec, &message, props, decompressed, sizeof(decompressed), &length),
+        1);
+    assert_int_equal(length, payload_length);
+    assert_memory_equal(decompressed, payload, payload_length);
+  }
+  assert_int_equal(fixture->codec.compressed, 100);
+  assert_int_equal(fixture->codec.decompressed, 100);
+  // The dictionary holds the JSON around the coordinates, so mostly their digits are left
+  assert_true(
+      fixture->codec.compressed_output_bytes * 4 < fixture->codec.compressed_input_bytes * 3);
+}
+
+static void test_payload_compression_not_compressed_success(void** state)
+{
+  compression_fixture* fixture = *state;
+  char payload[] = "{\"type\":\"Point\",\"coordinates\":[1.000000,2.000000]}";
+  char incompressible[] = "q8Zx";
+  uint8_t compressed[BUFFER_LENGTH];
+  char decompressed[BUFFER_LENGTH];
+  const mosquitto_property* props = NULL;
+  mosquitto_property* json_props = NULL;
+  size_t compressed_length = 0;
+  size_t length = 0;
+
+  // Without a dictionary payloads are sent as is
+  assert_false(payload_codec_compress(
+      &fixture->codec,
+      payload,
+      strlen(payload),
+      compressed,
+      sizeof(compressed),
+      &compressed_length,
+      &props));
+
+  add_dictionary(fixture, 3);
+  // Compressing a short payload would make it longer
+  assert_false(payload_codec_compress(
+      &fixture->codec,
+      incompressible,
+      strlen(incompressible),
+      compressed,
+      sizeof(compressed),
+      &compressed_length,
+      &props));
+  assert_int_equal(fixture->codec.sent_as_is, 2);
+
+  // Messages without a content type, or with another one, are not touched
+  struct mosquitto_message message = make_message(payload, strlen(payload));
+  assert_int_equal(
+      payload_codec_decompress(
+          &fixture->codec, &message, NULL, decompressed, sizeof(decompressed), &length),
+      0);
+  assert_int_equal(
+      mosquitto_property_add_string(&json_props, MQTT_PROP_CONTENT_TYPE, "application/json"),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(
+      payload_codec_decompress(
+          &fixture->codec, &message, json_props, decompressed, sizeof(decompressed), &length),
+      0);
+  assert_int_equal(fixture->codec.decompressed, 0);
+  mosquitto_property_free_all(&json_props);
+}
+
+static void test_payload_compression_dictionary_versions_success(void** state)
+{
+  compression_fixture* fixture = *state;
+  char payload[SAMPLE_LENGTH];
+  uint8_t compressed[BUFFER_LENGTH];
+  char decompressed[BUFFER_LENGTH];
+  const mosquitto_property* props = NULL;
+  size_t compressed_length = 0;
+  size_t length = 0;
+  size_t payload_length = format_point(payload, sizeof(payload), 4242);
+  char* type;
+
+  add_dictionary(fixture, 2);
+  add_dictionary(fixture, 5);
+  add_dictionary(fixture, 4);
+  assert_int_equal(fixture->codec.dictionary_count, 3);
+  assert_int_equal(fixture->codec.current->id, 5);
+
+  // A dictionary id can only be used once
+  size_t size = train_dictionary(fixture, 5);
+  assert_int_equal(payload_codec_add_dictionary(&fixture->codec, fixture->dictionary, size), -1);
+
+  // Payloads compressed with an older dictionary are still decompressed
+  assert_int_equal(payload_codec_use_dictionary(&fixture->codec, 2), 0);
+  assert_int_equal(payload_codec_use_dictionary(&fixture->codec, 9), -1);
+  assert_true(payload_codec_compress(
+      &fixture->codec,
+      payload,
+      payload_length,
+      compressed,
+      sizeof(compressed),
+      &compressed_length,
+      &props));
+  type = content_type(props);
+  assert_string_equal(type, "zstd:2");
+  free(type);
+
+  struct mosquitto_message message = make_message(compressed, compressed_length);
+  assert_int_equal(
+      payload_codec_decompress(
+          &fixture->codec, &message, props, decompressed, sizeof(decompressed), &length),
+      1);
+  assert_int_equal(length, payload_length);
+  assert_memory_equal(decompressed, payload, payload_length);
+}
+
+static void test_payload_compression_unknown_dictionary_failure(void** state)
+{
+  compression_fixture* fixture = *state;
+  char payload[SAMPLE_LENGTH];
+  uint8_t compressed[BUFFER_LENGTH];
+  char decompressed[BUFFER_LENGTH];
+  const mosquitto_property* props = NULL;
+  mosquitto_property* other_props = NULL;
+  size_t compressed_length = 0;
+  size_t length = 0;
+  size_t payload_length = format_point(payload, sizeof(payload), 99);
+  payload_codec receiver;
+
+  add_dictionary(fixture, 11);
+  assert_true(payload_codec_compress(
+      &fixture->codec,
+      payload,
+      payload_length,
+      compressed,
+      sizeof(compressed),
+      &compressed_length,
+      &props));
+  struct mosquitto_message message = make_message(compressed, compressed_length);
+
+  // A receiver that doesn't have the dictionary yet
+  assert_int_equal(payload_codec_init(&receiver, PAYLOAD_COMPRESSION_DEFAULT_LEVEL), 0);
+  assert_int_equal(
+      payload_codec_decompress(
+          &receiver, &message, props, decompressed, sizeof(decompressed), &length),
+      -1);
+  assert_int_equal(receiver.decompress_failures, 1);
+  payload_codec_destroy(&receiver);
+
+  // Malformed content types, and a corrupted payload
+  assert_int_equal(
+      mosquitto_property_add_string(&other_props, MQTT_PROP_CONTENT_TYPE, "zstd:x"),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(
+      payload_codec_decompress(
+          &fixture->codec, &message, other_props, decompressed, sizeof(decompressed), &length),
+      -1);
+  mosquitto_property_free_all(&other_props);
+
+  compressed[compressed_length / 2] ^= 0xff;
+  compressed[compressed_length - 1] ^= 0xff;
+  int result = payload_codec_decompress(
+      &fixture->codec, &message, props, decompressed, sizeof(decompressed), &length);
+  // zstd frames have no checksum here, so a corruption may go unnoticed but never overflows
+  assert_true(result == -1 || (result == 1 && length <= sizeof(decompressed)));
+
+  // A payload that doesn't fit the buffer
+  compressed[compressed_length / 2] ^= 0xff;
+  compressed[compressed_length - 1] ^= 0xff;
+  assert_int_equal(
+      payload_codec_decompress(&fixture->codec, &message, props, decompressed, 8, &length), -1);
+}
+
+int test_payload_compression()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_payload_compression_round_trip_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_payload_compression_not_compressed_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_payload_compression_dictionary_versions_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_payload_compression_unknown_dictionary_failure, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("payload_compression", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef PAYLOAD_COMPRESSION_TEST_H
+#define PAYLOAD_COMPRESSION_TEST_H
+
+#include "payload_compression.h"
+
+int test_payload_compression();
+
+#endif // PAYLOAD_COMPRESSION_TEST_H
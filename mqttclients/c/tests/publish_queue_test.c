@@ -0,0 +1,414 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_protocol.h"
+#include "publish_queue_test.h"
+
+#define PRODUCER_COUNT 8
+#define MESSAGES_PER_PRODUCER 20000
+#define SMALL_SEND_BUFFER 4096
+#define READ_BUFFER_SIZE 65536
+// Fixed header, topic length, "lanes/<n>", property length and a 4 bytes sequence number.
+#define PACKET_SIZE (2 + 2 + 7 + 1 + 4)
+
+typedef struct producer
+{
+  publish_queue* queue;
+  int index;
+} producer;
+
+// Parses the PUBLISH packets written by the queue, checking that every lane arrives in order.
+typedef struct stream_reader
+{
+  int fd;
+  int mqtt_version;
+  uint64_t expected;
+  uint64_t packets;
+  uint64_t errors;
+  uint32_t next_sequence[PRODUCER_COUNT];
+} stream_reader;
+
+static void* produce(void* argument)
+{
+  producer* p = argument;
+  // Both priorities share the socket, each lane must still arrive in order.
+  publish_queue_lane* lane = publish_queue_lane_open(
+      p->queue, p->index % 2 == 0 ? PUBLISH_QUEUE_PRIORITY_BULK : PUBLISH_QUEUE_PRIORITY_HIGH);
+  char topic[32];
+
+  if (lane == NULL)
+  {
+    return NULL;
+  }
+  snprintf(topic, sizeof(topic), "lanes/%d", p->index);
+  for (uint32_t sequence = 0; sequence < MESSAGES_PER_PRODUCER; sequence++)
+  {
+    while (publish_queue_publish(lane, topic, &sequence, sizeof(sequence), false) != 0)
+    {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static size_t parse_packet(stream_reader* reader, const unsigned char* data, size_t size)
+{
+  size_t remaining = 0;
+  size_t offset = 1;
+  unsigned shift = 0;
+  size_t topic_length;
+  uint32_t sequence;
+  int lane;
+
+  do
+  {
+    if (offset >= size)
+    {
+      return 0;
+    }
+    remaining |= (size_t)(data[offset] & 0x7F) << shift;
+    shift += 7;
+  } while ((data[offset++] & 0x80) != 0);
+  if (offset + remaining > size)
+  {
+    return 0;
+  }
+
+  topic_length = (size_t)data[offset] << 8 | data[offset + 1];
+  if (data[0] != 0x30 || sscanf((const char*)data + offset + 2, "lanes/%d", &lane) != 1
+      || lane < 0 || lane >= PRODUCER_COUNT)
+  {
+    reader->errors++;
+    return offset + remaining;
+  }
+  memcpy(
+      &sequence,
+      data + offset + 2 + topic_length + (reader->mqtt_version == MQTT_PROTOCOL_V5 ? 1 : 0),
+      sizeof(sequence));
+  if (sequence != reader->next_sequence[lane]++)
+  {
+    reader->errors++;
+  }
+  reader->packets++;
+  return offset + remaining;
+}
+
+static void* read_stream(void* argument)
+{
+  stream_reader* reader = argument;
+  unsigned char* buffer = malloc(READ_BUFFER_SIZE);
+  size_t length = 0;
+
+  while (buffer != NULL && reader->packets < reader->expected)
+  {
+    ssize_t received = read(reader->fd, buffer + length, READ_BUFFER_SIZE - length);
+    size_t parsed = 0;
+    size_t size;
+
+    if (received <= 0)
+    {
+      break;
+    }
+    length += (size_t)received;
+    while ((size = parse_packet(reader, buffer + parsed, length - parsed)) > 0)
+    {
+      parsed += size;
+    }
+    memmove(buffer, buffer + parsed, length - parsed);
+    length -= parsed;
+  }
+  free(buffer);
+  return NULL;
+}
+
+// Writes the lanes until they are empty, receiving what the peer gets into buffer.
+static size_t write_all(publish_queue* queue, int fds[2], unsigned char* buffer, size_t size)
+{
+  size_t length = 0;
+  bool pending = true;
+  ssize_t received;
+
+  while (pending)
+  {
+    ssize_t written = publish_queue_write(queue, fds[0]);
+    assert_true(written >= 0);
+    pending = written > 0 || publish_queue_partial(queue);
+    while ((received = recv(fds[1], buffer + length, size - length, MSG_DONTWAIT)) > 0)
+    {
+      length += (size_t)received;
+    }
+  }
+  return length;
+}
+
+// Copies the topic of the MQTT v3.1.1 PUBLISH packet at data, returns the length of the packet.
+static size_t packet_topic(const unsigned char* data, char* topic)
+{
+  size_t remaining = 0;
+  size_t offset = 1;
+  unsigned shift = 0;
+  size_t topic_length;
+
+  do
+  {
+    remaining |= (size_t)(data[offset] & 0x7F) << shift;
+    shift += 7;
+  } while ((data[offset++] & 0x80) != 0);
+  topic_length = (size_t)data[offset] << 8 | data[offset + 1];
+  memcpy(topic, data + offset + 2, topic_length);
+  topic[topic_length] = '\0';
+  return offset + remaining;
+}
+
+static void init_queue(publish_queue* queue, int mqtt_version, size_t lane_capacity)
+{
+  publish_queue_options options = { 0 };
+
+  options.mqtt_version = mqtt_version;
+  options.lane_capacity = lane_capacity;
+  assert_int_equal(publish_queue_init(queue, &options), 0);
+}
+
+static void test_publish_queue_encode_success(void** state)
+{
+  publish_queue queue;
+  publish_queue_lane* lane;
+  int fds[2];
+  unsigned char received[64];
+  const unsigned char v5_packet[] = { 0x30, 0x0E, 0x00, 0x07, 'v', 'e', 'h', 'i',
+                                      'c', 'l', 'e', 0x00, '4', '2', '.', '5' };
+  const unsigned char retained_packet[] = { 0x31, 0x05, 0x00, 0x01, 'a', 'o', 'k' };
+
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  init_queue(&queue, MQTT_PROTOCOL_V5, 0);
+  assert_non_null(lane = publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_BULK));
+  assert_int_equal(publish_queue_publish(lane, "vehicle", "42.5", 4, false), 0);
+  assert_int_equal(publish_queue_write(&queue, fds[0]), sizeof(v5_packet));
+  assert_int_equal(read(fds[1], received, sizeof(received)), sizeof(v5_packet));
+  assert_memory_equal(received, v5_packet, sizeof(v5_packet));
+  // Nothing left to write.
+  assert_int_equal(publish_queue_write(&queue, fds[0]), 0);
+  publish_queue_destroy(&queue);
+
+  init_queue(&queue, MQTT_PROTOCOL_V311, 0);
+  assert_non_null(lane = publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_BULK));
+  assert_int_equal(publish_queue_publish(lane, "a", "ok", 2, true), 0);
+  assert_int_equal(publish_queue_write(&queue, fds[0]), sizeof(retained_packet));
+  assert_int_equal(read(fds[1], received, sizeof(received)), sizeof(retained_packet));
+  assert_memory_equal(received, retained_packet, sizeof(retained_packet));
+  publish_queue_destroy(&queue);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Producers fill their lanes while the test writes them, through a small socket buffer so most
+// writes are partial. Every packet must arrive whole and in the order of its lane.
+static void test_publish_queue_concurrent_producers_success(void** state)
+{
+  publish_queue queue;
+  publish_queue_stats stats;
+  pthread_t producers[PRODUCER_COUNT];
+  producer arguments[PRODUCER_COUNT];
+  pthread_t reader_thread;
+  stream_reader reader = { 0 };
+  int send_buffer = SMALL_SEND_BUFFER;
+  int fds[2];
+
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  assert_int_equal(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)), 0);
+  init_queue(&queue, MQTT_PROTOCOL_V5, 4096);
+
+  reader.fd = fds[1];
+  reader.mqtt_version = MQTT_PROTOCOL_V5;
+  reader.expected = (uint64_t)PRODUCER_COUNT * MESSAGES_PER_PRODUCER;
+  assert_int_equal(pthread_create(&reader_thread, NULL, read_stream, &reader), 0);
+  for (int i = 0; i < PRODUCER_COUNT; i++)
+  {
+    arguments[i].queue = &queue;
+    arguments[i].index = i;
+    assert_int_equal(pthread_create(&producers[i], NULL, produce, &arguments[i]), 0);
+  }
+
+  do
+  {
+    assert_true(publish_queue_write(&queue, fds[0]) >= 0);
+    publish_queue_read_stats(&queue, &stats);
+  } while (stats.bytes < reader.expected * PACKET_SIZE);
+
+  for (int i = 0; i < PRODUCER_COUNT; i++)
+  {
+    pthread_join(producers[i], NULL);
+  }
+  pthread_join(reader_thread, NULL);
+
+  assert_int_equal(reader.packets, reader.expected);
+  assert_int_equal(reader.errors, 0);
+  // Writes carry several packets.
+  assert_true(stats.writes < stats.messages);
+
+  publish_queue_destroy(&queue);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// A packet cut in two by a lost connection is dropped, the next packet starts on a new one.
+static void test_publish_queue_drop_partial_success(void** state)
+{
+  publish_queue queue;
+  publish_queue_lane* lane;
+  publish_queue_stats stats;
+  int send_buffer = SMALL_SEND_BUFFER;
+  int fds[2];
+  size_t payload_length = 16 * SMALL_SEND_BUFFER;
+  char* payload = calloc(1, payload_length);
+  unsigned char received[64];
+
+  assert_non_null(payload);
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  assert_int_equal(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)), 0);
+  init_queue(&queue, MQTT_PROTOCOL_V311, 0);
+  assert_non_null(lane = publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_BULK));
+
+  assert_int_equal(publish_queue_publish(lane, "large", payload, payload_length, false), 0);
+  assert_true(publish_queue_write(&queue, fds[0]) > 0);
+  assert_true(publish_queue_partial(&queue));
+  publish_queue_drop_partial(&queue);
+  assert_false(publish_queue_partial(&queue));
+  publish_queue_read_stats(&queue, &stats);
+  assert_int_equal(stats.dropped, 1);
+
+  // The peer of the new connection only receives the next packet.
+  close(fds[0]);
+  close(fds[1]);
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  assert_int_equal(publish_queue_publish(lane, "a", "ok", 2, false), 0);
+  assert_int_equal(publish_queue_write(&queue, fds[0]), 7);
+  assert_int_equal(read(fds[1], received, sizeof(received)), 7);
+  assert_int_equal(received[0], 0x30);
+
+  publish_queue_destroy(&queue);
+  close(fds[0]);
+  close(fds[1]);
+  free(payload);
+}
+
+// High priority packets go before the bulk packets queued earlier, and only wait for the rest of a
+// bulk packet already cut in two.
+static void test_publish_queue_priority_success(void** state)
+{
+  publish_queue queue;
+  publish_queue_lane* bulk;
+  publish_queue_lane* high;
+  int send_buffer = SMALL_SEND_BUFFER;
+  int fds[2];
+  size_t payload_length = 4 * SMALL_SEND_BUFFER;
+  char* payload = calloc(1, payload_length);
+  size_t buffer_size = 2 * payload_length;
+  unsigned char* buffer = malloc(buffer_size);
+  size_t length;
+  size_t offset;
+  char topic[16];
+
+  assert_non_null(payload);
+  assert_non_null(buffer);
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  init_queue(&queue, MQTT_PROTOCOL_V311, 0);
+  assert_non_null(bulk = publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_BULK));
+  assert_non_null(high = publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_HIGH));
+
+  assert_int_equal(publish_queue_publish(bulk, "bulk/1", "1", 1, false), 0);
+  assert_int_equal(publish_queue_publish(bulk, "bulk/2", "2", 1, false), 0);
+  assert_int_equal(publish_queue_publish(high, "high", "h", 1, false), 0);
+  length = write_all(&queue, fds, buffer, buffer_size);
+  offset = packet_topic(buffer, topic);
+  assert_string_equal(topic, "high");
+  offset += packet_topic(buffer + offset, topic);
+  assert_string_equal(topic, "bulk/1");
+  offset += packet_topic(buffer + offset, topic);
+  assert_string_equal(topic, "bulk/2");
+  assert_int_equal(offset, length);
+
+  // A bulk packet larger than the socket buffer is cut in two by the first write.
+  assert_int_equal(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)), 0);
+  assert_int_equal(publish_queue_publish(bulk, "large", payload, payload_length, false), 0);
+  assert_int_equal(publish_queue_publish(bulk, "bulk/3", "3", 1, false), 0);
+  assert_true(publish_queue_write(&queue, fds[0]) > 0);
+  assert_true(publish_queue_partial(&queue));
+  assert_int_equal(publish_queue_publish(high, "high", "h", 1, false), 0);
+  length = write_all(&queue, fds, buffer, buffer_size);
+  offset = packet_topic(buffer, topic);
+  assert_string_equal(topic, "large");
+  offset += packet_topic(buffer + offset, topic);
+  assert_string_equal(topic, "high");
+  offset += packet_topic(buffer + offset, topic);
+  assert_string_equal(topic, "bulk/3");
+  assert_int_equal(offset, length);
+
+  publish_queue_destroy(&queue);
+  close(fds[0]);
+  close(fds[1]);
+  free(buffer);
+  free(payload);
+}
+
+static void test_publish_queue_publish_failure(void** state)
+{
+  publish_queue queue;
+  publish_queue_options options = { 0 };
+  publish_queue_lane* lane;
+  publish_queue_stats stats;
+  char payload[100] = { 0 };
+  int published = 0;
+
+  options.lane_capacity = 64;
+  options.max_lanes = 1;
+  assert_int_equal(publish_queue_init(&queue, &options), 0);
+  assert_non_null(lane = publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_BULK));
+  assert_null(publish_queue_lane_open(&queue, PUBLISH_QUEUE_PRIORITY_BULK));
+
+  assert_int_equal(publish_queue_publish(lane, "vehicles/+/position", "", 0, false), -1);
+  assert_int_equal(publish_queue_publish(lane, "", "", 0, false), -1);
+  assert_int_equal(publish_queue_publish(lane, "a", payload, sizeof(payload), false), -1);
+
+  while (publish_queue_publish(lane, "a", payload, 10, false) == 0)
+  {
+    published++;
+  }
+  publish_queue_read_stats(&queue, &stats);
+  assert_int_equal(stats.messages, published);
+  assert_int_equal(stats.lane_full, 1);
+  assert_int_equal(published, 64 / 15);
+
+  publish_queue_destroy(&queue);
+}
+
+int test_publish_queue()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_publish_queue_encode_success),
+    cmocka_unit_test(test_publish_queue_concurrent_producers_success),
+    cmocka_unit_test(test_publish_queue_drop_partial_success),
+    cmocka_unit_test(test_publish_queue_priority_success),
+    cmocka_unit_test(test_publish_queue_publish_failure)
+  };
+  return cmocka_run_group_tests_name("publish_queue", tests, NULL, NULL);
+}
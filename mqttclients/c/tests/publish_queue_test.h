@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef PUBLISH_QUEUE_TEST_H
+#define PUBLISH_QUEUE_TEST_H
+
+#include "publish_queue.h"
+
+int test_publish_queue();
+
+#endif // PUBLISH_QUEUE_TEST_H
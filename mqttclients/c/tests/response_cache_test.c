@@ -0,0 +1,210 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "response_cache_test.h"
+
+#define CACHE_CAPACITY 2
+#define MAX_RESPONSE_LENGTH 16
+#define TTL_SECONDS 10
+
+static const char* key_1 = "correlation-1";
+static const char* key_2 = "correlation-2";
+static const char* key_3 = "correlation-3";
+static const char* response_1 = "response-1";
+static const char* response_2 = "response-2";
+static const char* response_3 = "response-3";
+
+static int setup(void** state)
+{
+  response_cache* cache = malloc(sizeof(response_cache));
+  if (cache == NULL
+      || response_cache_init(cache, CACHE_CAPACITY, MAX_RESPONSE_LENGTH, TTL_SECONDS) != 0)
+  {
+    free(cache);
+    return -1;
+  }
+  *state = cache;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  response_cache_destroy(*state);
+  free(*state);
+  return 0;
+}
+
+static bool put(response_cache* cache, const char* key, const char* response, time_t now)
+{
+  return response_cache_put(cache, key, strlen(key), response, strlen(response), now);
+}
+
+static const response_cache_entry* get(response_cache* cache, const char* key, time_t now)
+{
+  return response_cache_get(cache, key, strlen(key), now);
+}
+
+// A cached response is returned for the same correlation data
+static void test_response_cache_get_hit_success(void** state)
+{
+  response_cache* cache = *state;
+
+  assert_true(put(cache, key_1, response_1, 0));
+  const response_cache_entry* entry = get(cache, key_1, 1);
+
+  assert_non_null(entry);
+  assert_int_equal(entry->response_length, strlen(response_1));
+  assert_memory_equal(entry->response, response_1, strlen(response_1));
+  assert_int_equal(cache->hits, 1);
+}
+
+// Unknown correlation data misses
+static void test_response_cache_get_miss_success(void** state)
+{
+  response_cache* cache = *state;
+
+  assert_true(put(cache, key_1, response_1, 0));
+
+  assert_null(get(cache, key_2, 0));
+  assert_int_equal(cache->misses, 1);
+}
+
+// Entries expire after the TTL
+static void test_response_cache_get_expired_success(void** state)
+{
+  response_cache* cache = *state;
+
+  assert_true(put(cache, key_1, response_1, 0));
+
+  assert_non_null(get(cache, key_1, TTL_SECONDS - 1));
+  assert_null(get(cache, key_1, TTL_SECONDS));
+  assert_int_equal(cache->count, 0);
+}
+
+// The least recently used entry is evicted when the cache is full
+static void test_response_cache_put_evicts_lru_success(void** state)
+{
+  response_cache* cache = *state;
+
+  assert_true(put(cache, key_1, response_1, 0));
+  assert_true(put(cache, key_2, response_2, 0));
+  // key_1 becomes the most recently used, so key_2 is evicted
+  assert_non_null(get(cache, key_1, 0));
+  assert_true(put(cache, key_3, response_3, 0));
+
+  assert_int_equal(cache->count, CACHE_CAPACITY);
+  assert_int_equal(cache->evictions, 1);
+  assert_non_null(get(cache, key_1, 0));
+  assert_null(get(cache, key_2, 0));
+  assert_non_null(get(cache, key_3, 0));
+}
+
+// Putting the same correlation data twice replaces the response
+static void test_response_cache_put_replaces_success(void** state)
+{
+  response_cache* cache = *state;
+
+  assert_true(put(cache, key_1, response_1, 0));
+  assert_true(put(cache, key_1, response_2, 0));
+
+  const response_cache_entry* entry = get(cache, key_1, 0);
+  assert_non_null(entry);
+  assert_memory_equal(entry->response, response_2, strlen(response_2));
+  assert_int_equal(cache->count, 1);
+}
+
+// Responses longer than the maximum are not cached
+static void test_response_cache_put_response_too_long_fail(void** state)
+{
+  response_cache* cache = *state;
+  char long_response[MAX_RESPONSE_LENGTH + 2];
+  memset(long_response, 'a', sizeof(long_response) - 1);
+  long_response[sizeof(long_response) - 1] = '\0';
+
+  assert_false(put(cache, key_1, long_response, 0));
+  assert_null(get(cache, key_1, 0));
+}
+
+// Requests of different methods or response topics don't share responses, even with the same
+// correlation data
+static void test_response_cache_request_key_success(void** state)
+{
+  const char* methods[] = { "Unlock", "Lock" };
+  const char* topics[] = { "vehicles/vehicle1/command/unlock/response/mobile1",
+                           "vehicles/vehicle1/command/unlock/response/mobile2" };
+  const char* responses[] = { response_1, response_2, response_3, "response-4" };
+  uint8_t key[RESPONSE_CACHE_MAX_KEY_LENGTH];
+  char long_correlation_data[RESPONSE_CACHE_MAX_KEY_LENGTH];
+  size_t key_length;
+  response_cache cache;
+
+  assert_int_equal(response_cache_init(&cache, 4, MAX_RESPONSE_LENGTH, TTL_SECONDS), 0);
+  for (int i = 0; i < 4; i++)
+  {
+    key_length = response_cache_request_key(key, methods[i / 2], topics[i % 2], key_1, 4);
+    assert_true(response_cache_put(
+        &cache, key, key_length, responses[i], strlen(responses[i]), 0));
+  }
+  for (int i = 0; i < 4; i++)
+  {
+    key_length = response_cache_request_key(key, methods[i / 2], topics[i % 2], key_1, 4);
+    const response_cache_entry* entry = response_cache_get(&cache, key, key_length, 0);
+    assert_non_null(entry);
+    assert_int_equal(entry->response_length, strlen(responses[i]));
+    assert_memory_equal(entry->response, responses[i], strlen(responses[i]));
+  }
+  assert_int_equal(cache.count, 4);
+
+  // Keys that don't fit are not written nor cached
+  memset(long_correlation_data, 'c', sizeof(long_correlation_data));
+  key_length = response_cache_request_key(
+      key, methods[0], topics[0], long_correlation_data, sizeof(long_correlation_data));
+  assert_true(key_length > RESPONSE_CACHE_MAX_KEY_LENGTH);
+  assert_false(response_cache_put(&cache, key, key_length, response_1, strlen(response_1), 0));
+  response_cache_destroy(&cache);
+}
+
+// Capacities whose buckets or responses would not fit are rejected before allocating
+static void test_response_cache_init_capacity_fail(void** state)
+{
+  response_cache cache;
+
+  assert_int_equal(response_cache_init(&cache, 0, MAX_RESPONSE_LENGTH, TTL_SECONDS), -1);
+  assert_int_equal(
+      response_cache_init(
+          &cache, RESPONSE_CACHE_MAX_CAPACITY + 1, MAX_RESPONSE_LENGTH, TTL_SECONDS),
+      -1);
+  assert_int_equal(response_cache_init(&cache, UINT32_MAX, MAX_RESPONSE_LENGTH, TTL_SECONDS), -1);
+  assert_int_equal(response_cache_init(&cache, CACHE_CAPACITY, SIZE_MAX, TTL_SECONDS), -1);
+  assert_null(cache.entries);
+}
+
+int test_response_cache()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test_setup_teardown(test_response_cache_get_hit_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(test_response_cache_get_miss_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_response_cache_get_expired_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_response_cache_put_evicts_lru_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_response_cache_put_replaces_success, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_response_cache_put_response_too_long_fail, setup, teardown),
+          cmocka_unit_test(test_response_cache_request_key_success),
+          cmocka_unit_test(test_response_cache_init_capacity_fail) };
+  return cmocka_run_group_tests_name("response_cache", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef RESPONSE_CACHE_TEST_H
+#define RESPONSE_CACHE_TEST_H
+
+#include "response_cache.h"
+
+int test_response_cache();
+
+#endif // RESPONSE_CACHE_TEST_H
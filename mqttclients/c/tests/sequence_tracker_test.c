@@ -0,0 +1,243 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_protocol.h"
+#include "sequence_tracker_test.h"
+
+#define MAX_DELIVERIES 32
+#define WINDOW 4
+#define MAX_DELAY_MS 1000
+
+typedef struct recorded_deliveries
+{
+  char ids[MAX_DELIVERIES][16];
+  uint32_t items[MAX_DELIVERIES];
+  int count;
+} recorded_deliveries;
+
+static recorded_deliveries recorded;
+
+static void record_delivery(const char* id, const void* item, void* context)
+{
+  assert_true(recorded.count < MAX_DELIVERIES);
+  snprintf(recorded.ids[recorded.count], sizeof(recorded.ids[0]), "%s", id);
+  memcpy(&recorded.items[recorded.count++], item, sizeof(uint32_t));
+}
+
+// Pushes an item holding its own sequence.
+static void push(sequence_tracker* tracker, const char* id, uint32_t session, uint32_t sequence)
+{
+  sequence_tracker_push(tracker, id, session, sequence, &sequence, 0, record_delivery, NULL);
+}
+
+static void assert_delivered(const uint32_t* items, int count)
+{
+  assert_int_equal(recorded.count, count);
+  for (int i = 0; i < count; i++)
+  {
+    assert_int_equal(recorded.items[i], items[i]);
+  }
+}
+
+static int setup(void** state)
+{
+  sequence_tracker* tracker = malloc(sizeof(sequence_tracker));
+  sequence_tracker_options options = { 0 };
+
+  options.max_sources = 2;
+  options.max_id_length = 15;
+  options.window = WINDOW;
+  options.item_size = sizeof(uint32_t);
+  options.max_delay_ms = MAX_DELAY_MS;
+  if (tracker == NULL || sequence_tracker_init(tracker, &options) != 0)
+  {
+    free(tracker);
+    return -1;
+  }
+  memset(&recorded, 0, sizeof(recorded));
+  *state = tracker;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  sequence_tracker_destroy(*state);
+  free(*state);
+  return 0;
+}
+
+static void test_sequence_tracker_duplicates_success(void** state)
+{
+  sequence_tracker* tracker = *state;
+
+  push(tracker, "vehicle1", 1, 10);
+  push(tracker, "vehicle1", 1, 11);
+  push(tracker, "vehicle1", 1, 11);
+  push(tracker, "vehicle1", 1, 10);
+  push(tracker, "vehicle1", 1, 12);
+
+  assert_delivered((const uint32_t[]){ 10, 11, 12 }, 3);
+  assert_int_equal(tracker->stats.delivered, 3);
+  assert_int_equal(tracker->stats.duplicates, 2);
+  assert_int_equal(tracker->stats.gaps, 0);
+}
+
+static void test_sequence_tracker_reorder_success(void** state)
+{
+  sequence_tracker* tracker = *state;
+
+  push(tracker, "vehicle1", 1, 1);
+  push(tracker, "vehicle2", 1, 1);
+  push(tracker, "vehicle1", 1, 3);
+  push(tracker, "vehicle1", 1, 4);
+  // Held items are suppressed too
+  push(tracker, "vehicle1", 1, 4);
+  assert_delivered((const uint32_t[]){ 1, 1 }, 2);
+
+  push(tracker, "vehicle1", 1, 2);
+  assert_delivered((const uint32_t[]){ 1, 1, 2, 3, 4 }, 5);
+  assert_string_equal(recorded.ids[4], "vehicle1");
+  assert_int_equal(tracker->stats.reordered, 2);
+  assert_int_equal(tracker->stats.duplicates, 1);
+  assert_int_equal(tracker->holding, 0);
+}
+
+static void test_sequence_tracker_window_gap_success(void** state)
+{
+  sequence_tracker* tracker = *state;
+
+  push(tracker, "vehicle1", 1, 1);
+  push(tracker, "vehicle1", 1, 3);
+  // 2 is skipped so that 7 fits in the window, which then holds 7 behind 4, 5 and 6
+  push(tracker, "vehicle1", 1, 7);
+  assert_delivered((const uint32_t[]){ 1, 3 }, 2);
+  assert_int_equal(tracker->stats.gaps, 1);
+
+  push(tracker, "vehicle1", 1, 2);
+  assert_int_equal(tracker->stats.late, 1);
+
+  // A jump far past the window delivers what was held
+  push(tracker, "vehicle1", 1, 1000);
+  assert_delivered((const uint32_t[]){ 1, 3, 7 }, 3);
+  push(tracker, "vehicle1", 1, 997);
+  assert_delivered((const uint32_t[]){ 1, 3, 7, 997 }, 4);
+  assert_int_equal(tracker->stats.gaps, 1 + 3 + 989);
+
+  // A jump that moves the window onto a held item delivers it: 3 once 6 moves the window to 3
+  push(tracker, "vehicle2", 1, 0);
+  push(tracker, "vehicle2", 1, 3);
+  push(tracker, "vehicle2", 1, 6);
+  assert_delivered((const uint32_t[]){ 1, 3, 7, 997, 0, 3 }, 6);
+  assert_int_equal(tracker->stats.gaps, 1 + 3 + 989 + 2);
+  push(tracker, "vehicle2", 1, 4);
+  push(tracker, "vehicle2", 1, 5);
+  assert_delivered((const uint32_t[]){ 1, 3, 7, 997, 0, 3, 4, 5, 6 }, 9);
+}
+
+static void test_sequence_tracker_delay_expired_success(void** state)
+{
+  sequence_tracker* tracker = *state;
+  uint32_t item = 1;
+
+  sequence_tracker_push(tracker, "vehicle1", 1, 1, &item, 0, record_delivery, NULL);
+  item = 3;
+  sequence_tracker_push(tracker, "vehicle1", 1, 3, &item, 100, record_delivery, NULL);
+  sequence_tracker_expire(tracker, MAX_DELAY_MS + 99, record_delivery, NULL);
+  assert_delivered((const uint32_t[]){ 1 }, 1);
+
+  sequence_tracker_expire(tracker, MAX_DELAY_MS + 100, record_delivery, NULL);
+  assert_delivered((const uint32_t[]){ 1, 3 }, 2);
+  assert_int_equal(tracker->holding, 0);
+  assert_int_equal(tracker->stats.gaps, 1);
+
+  // The next item of the source expires what it held as well
+  item = 6;
+  sequence_tracker_push(tracker, "vehicle1", 1, 6, &item, 2000, record_delivery, NULL);
+  item = 7;
+  sequence_tracker_push(tracker, "vehicle1", 1, 7, &item, 3000, record_delivery, NULL);
+  assert_delivered((const uint32_t[]){ 1, 3, 6, 7 }, 4);
+  assert_int_equal(tracker->stats.gaps, 3);
+}
+
+static void test_sequence_tracker_restart_success(void** state)
+{
+  sequence_tracker* tracker = *state;
+
+  push(tracker, "vehicle1", 5, 1);
+  push(tracker, "vehicle1", 5, 2);
+  push(tracker, "vehicle1", 5, 4);
+  // The producer restarted, 4 is delivered before the items of the new session
+  push(tracker, "vehicle1", 6, 1);
+  push(tracker, "vehicle1", 5, 3);
+  push(tracker, "vehicle1", 6, 2);
+
+  assert_delivered((const uint32_t[]){ 1, 2, 4, 1, 2 }, 5);
+  assert_int_equal(tracker->stats.restarts, 1);
+  assert_int_equal(tracker->stats.gaps, 1);
+  assert_int_equal(tracker->stats.late, 1);
+}
+
+static void test_sequence_tracker_untracked_success(void** state)
+{
+  sequence_tracker* tracker = *state;
+
+  // Ids longer than max_id_length are not tracked
+  push(tracker, "vehicle_with_a_long_id", 1, 1);
+  push(tracker, "vehicle1", 1, 1);
+  push(tracker, "vehicle2", 1, 1);
+  push(tracker, "vehicle3", 1, 1);
+  push(tracker, "vehicle3", 1, 1);
+
+  assert_int_equal(recorded.count, 5);
+  assert_int_equal(tracker->stats.untracked, 3);
+  assert_int_equal(tracker->source_count, 2);
+}
+
+static void test_sequence_property_success(void** state)
+{
+  mosquitto_property* props = NULL;
+  uint32_t session = 0;
+  uint32_t sequence = 0;
+
+  assert_int_equal(
+      mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "other", "1:2"),
+      MOSQ_ERR_SUCCESS);
+  assert_false(sequence_property_read(props, &session, &sequence));
+  assert_int_equal(sequence_property_add(&props, 1700000000, 4294967295u), MOSQ_ERR_SUCCESS);
+  assert_true(sequence_property_read(props, &session, &sequence));
+  assert_int_equal(session, 1700000000);
+  assert_int_equal(sequence, 4294967295u);
+  mosquitto_property_free_all(&props);
+
+  assert_int_equal(
+      mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, SEQUENCE_PROPERTY, "12"),
+      MOSQ_ERR_SUCCESS);
+  assert_false(sequence_property_read(props, &session, &sequence));
+  mosquitto_property_free_all(&props);
+}
+
+int test_sequence_tracker()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_sequence_tracker_duplicates_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_sequence_tracker_reorder_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_sequence_tracker_window_gap_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_sequence_tracker_delay_expired_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_sequence_tracker_restart_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_sequence_tracker_untracked_success, setup, teardown),
+    cmocka_unit_test(test_sequence_property_success)
+  };
+  return cmocka_run_group_tests_name("sequence_tracker", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef SEQUENCE_TRACKER_TEST_H
+#define SEQUENCE_TRACKER_TEST_H
+
+#include "sequence_tracker.h"
+
+int test_sequence_tracker();
+
+#endif // SEQUENCE_TRACKER_TEST_H
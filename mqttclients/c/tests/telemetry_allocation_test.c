@@ -0,0 +1,159 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "telemetry_allocation_test.h"
+
+#define MESSAGE_COUNT 10000
+#define POOL_CAPACITY 8
+#define MAX_PAYLOAD_LENGTH 60
+
+// The test executable is linked with --wrap for malloc, calloc and realloc, so every call made by
+// the extensions and the tests goes through these functions, which count them while counting is
+// set.
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+static bool counting;
+static size_t allocations;
+
+void* __wrap_malloc(size_t size)
+{
+  allocations += counting;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+  allocations += counting;
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size)
+{
+  allocations += counting;
+  return __real_realloc(pointer, size);
+}
+
+static void start_counting(void)
+{
+  allocations = 0;
+  counting = true;
+}
+
+static size_t stop_counting(void)
+{
+  counting = false;
+  return allocations;
+}
+
+// The count sees the allocations of the extensions, so a zero count below is meaningful
+static void test_telemetry_allocation_counted_success(void** state)
+{
+  mosquitto_payload payload;
+
+  start_counting();
+  payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  assert_int_equal(stop_counting(), 1);
+  mosquitto_payload_destroy(&payload);
+}
+
+// Producing and consuming positions with pooled payloads and stack points doesn't allocate
+static void test_telemetry_allocation_pooled_messages_success(void** state)
+{
+  mosquitto_payload_pool pool;
+  mosquitto_payload payloads[POOL_CAPACITY];
+  struct mosquitto_message message = { 0 };
+  int converted = 0;
+
+  assert_int_equal(mosquitto_payload_pool_init(&pool, POOL_CAPACITY, MAX_PAYLOAD_LENGTH), 0);
+
+  start_counting();
+  for (int i = 0; i < MESSAGE_COUNT; i++)
+  {
+    mosquitto_payload* payload = &payloads[i % POOL_CAPACITY];
+    geojson_point sent = geojson_point_init();
+    geojson_point received = geojson_point_init();
+
+    // Messages are released a full pool later, like messages waiting to be acknowledged
+    if (i >= POOL_CAPACITY && mosquitto_payload_pool_release(&pool, payload) != 0)
+    {
+      break;
+    }
+    if (mosquitto_payload_pool_acquire(&pool, payload) != 0)
+    {
+      break;
+    }
+    strcpy(sent.type, "Point");
+    geojson_point_set_coordinates(&sent, -90 + i % 180, 45 - i % 90);
+    if (geojson_point_to_mosquitto_payload(sent, payload) != 0)
+    {
+      break;
+    }
+
+    message.payload = payload->payload;
+    message.payloadlen = (int)payload->payload_length;
+    if (mosquitto_payload_to_geojson_point(&message, &received) != 0
+        || received.coordinates.x != sent.coordinates.x
+        || received.coordinates.y != sent.coordinates.y)
+    {
+      break;
+    }
+    geojson_point_destroy(&sent);
+    geojson_point_destroy(&received);
+    converted++;
+  }
+  assert_int_equal(stop_counting(), 0);
+  assert_int_equal(converted, MESSAGE_COUNT);
+  assert_int_equal(pool.exhausted, 0);
+
+  mosquitto_payload_pool_destroy(&pool);
+}
+
+// The same with a payload buffer on the stack, as in the telemetry producer
+static void test_telemetry_allocation_stack_messages_success(void** state)
+{
+  char buffer[MAX_PAYLOAD_LENGTH];
+  struct mosquitto_message message = { 0 };
+  int converted = 0;
+
+  start_counting();
+  for (int i = 0; i < MESSAGE_COUNT; i++)
+  {
+    mosquitto_payload payload = mosquitto_payload_from_buffer(buffer, sizeof(buffer));
+    geojson_point point = geojson_point_init();
+
+    strcpy(point.type, "Point");
+    geojson_point_set_coordinates(&point, i % 180 - 90.5, i % 90 - 45.25);
+    message.payload = payload.payload;
+    if (geojson_point_to_mosquitto_payload(point, &payload) == 0
+        && mosquitto_payload_to_geojson_point(&message, &point) == 0)
+    {
+      converted++;
+    }
+  }
+  assert_int_equal(stop_counting(), 0);
+  assert_int_equal(converted, MESSAGE_COUNT);
+}
+
+int test_telemetry_allocation()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_telemetry_allocation_counted_success),
+          cmocka_unit_test(test_telemetry_allocation_pooled_messages_success),
+          cmocka_unit_test(test_telemetry_allocation_stack_messages_success) };
+  return cmocka_run_group_tests_name("telemetry_allocation", tests, NULL, NULL);
+}
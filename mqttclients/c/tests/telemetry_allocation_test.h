@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef TELEMETRY_ALLOCATION_TEST_H
+#define TELEMETRY_ALLOCATION_TEST_H
+
+#include "geo_json_handler.h"
+
+int test_telemetry_allocation();
+
+#endif // TELEMETRY_ALLOCATION_TEST_H
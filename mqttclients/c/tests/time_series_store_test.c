@@ -0,0 +1,291 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "time_series_store_test.h"
+
+#define START_TIME 1700000000000LL
+#define INTERVAL_MS 5000
+#define POINT_COUNT 10000
+
+static int setup(void** state)
+{
+  time_series_store_options options = { 0 };
+  time_series_store* store = malloc(sizeof(time_series_store));
+  if (store == NULL)
+  {
+    return -1;
+  }
+  time_series_store_init(store, &options);
+  *state = store;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  time_series_store_destroy(*state);
+  free(*state);
+  return 0;
+}
+
+// Slowly changing gauge sampled every 5 seconds, in steps of 0.01 like a sensor reading
+static double gauge_value(int i)
+{
+  return 21.0 + ((i / 10) % 50) * 0.01;
+}
+
+static size_t data_bits(const time_series* series)
+{
+  size_t bits = 0;
+  for (const time_series_chunk* chunk = series->head; chunk != NULL; chunk = chunk->next)
+  {
+    bits += chunk->bit_length;
+  }
+  return bits;
+}
+
+// Regular series are stored in a few bytes per point and decoded exactly
+static void test_time_series_store_regular_series_round_trip_success(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series* series = time_series_store_get(store, "devices/rasp/temperature", true);
+  time_series_iterator iterator;
+  time_series_point point;
+  int i;
+
+  assert_non_null(series);
+  for (i = 0; i < POINT_COUNT; i++)
+  {
+    assert_int_equal(time_series_append(series, START_TIME + i * INTERVAL_MS, gauge_value(i)), 0);
+  }
+  assert_int_equal(series->point_count, POINT_COUNT);
+  assert_true(series->chunk_count > 1);
+  assert_true(data_bits(series) / POINT_COUNT < 4 * 8);
+
+  time_series_iterator_init(&iterator, series, INT64_MIN, INT64_MAX);
+  for (i = 0; time_series_iterator_next(&iterator, &point); i++)
+  {
+    assert_int_equal(point.timestamp, START_TIME + i * INTERVAL_MS);
+    assert_true(point.value == gauge_value(i));
+  }
+  assert_int_equal(i, POINT_COUNT);
+}
+
+// Irregular timestamps and arbitrary values, including repeated timestamps, large gaps and
+// values with no bits in common, are decoded exactly
+static void test_time_series_store_irregular_series_round_trip_success(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series* series = time_series_store_get(store, "irregular", true);
+  static time_series_point expected[POINT_COUNT];
+  static time_series_point actual[POINT_COUNT];
+  int64_t timestamp = START_TIME;
+  const int64_t gaps[] = { 0, 1, 1000, 5000, 5100, 4900, 60000, 3600000, 86400000LL * 30 };
+  const double values[] = { 0.0, -0.0, 1.0, -1e300, 1e-300, 3.14159, 1013.25, -40.5, 1e18 };
+
+  srand(1);
+  for (int i = 0; i < POINT_COUNT; i++)
+  {
+    timestamp += gaps[rand() % (sizeof(gaps) / sizeof(gaps[0]))];
+    expected[i].timestamp = timestamp;
+    expected[i].value = rand() % 4 == 0 ? (double)rand() / RAND_MAX
+                                        : values[rand() % (sizeof(values) / sizeof(values[0]))];
+    assert_int_equal(time_series_append(series, expected[i].timestamp, expected[i].value), 0);
+  }
+
+  assert_int_equal(
+      time_series_query_range(series, INT64_MIN, INT64_MAX, actual, POINT_COUNT), POINT_COUNT);
+  for (int i = 0; i < POINT_COUNT; i++)
+  {
+    assert_int_equal(actual[i].timestamp, expected[i].timestamp);
+    assert_memory_equal(&actual[i].value, &expected[i].value, sizeof(double));
+  }
+}
+
+// Range queries return the points in [from, to], across chunk boundaries
+static void test_time_series_store_query_range_success(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series* series = time_series_store_get(store, "range", true);
+  static time_series_point points[POINT_COUNT];
+  int first = 1234;
+  int last = 5678;
+
+  for (int i = 0; i < POINT_COUNT; i++)
+  {
+    assert_int_equal(time_series_append(series, START_TIME + i * INTERVAL_MS, gauge_value(i)), 0);
+  }
+
+  size_t count = time_series_query_range(
+      series,
+      START_TIME + first * INTERVAL_MS - 1,
+      START_TIME + last * INTERVAL_MS,
+      points,
+      POINT_COUNT);
+  assert_int_equal(count, last - first + 1);
+  for (size_t i = 0; i < count; i++)
+  {
+    assert_int_equal(points[i].timestamp, START_TIME + (first + (int)i) * INTERVAL_MS);
+    assert_true(points[i].value == gauge_value(first + (int)i));
+  }
+
+  assert_int_equal(time_series_query_range(series, 0, START_TIME - 1, points, POINT_COUNT), 0);
+  assert_int_equal(
+      time_series_query_range(
+          series, START_TIME + POINT_COUNT * INTERVAL_MS, INT64_MAX, points, POINT_COUNT),
+      0);
+  assert_int_equal(time_series_query_range(series, START_TIME, INT64_MAX, points, 10), 10);
+}
+
+// Downsampling aggregates min, max, mean and last per bucket
+static void test_time_series_store_query_downsample_success(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series* series = time_series_store_get(store, "downsample", true);
+  time_series_bucket buckets[4];
+
+  for (int i = 0; i < 100; i++)
+  {
+    assert_int_equal(time_series_append(series, START_TIME + i * 1000, i), 0);
+  }
+
+  // 10 second buckets over the first 40 seconds
+  size_t count
+      = time_series_query_downsample(series, START_TIME, START_TIME + 39999, 10000, buckets, 4);
+  assert_int_equal(count, 4);
+  for (size_t b = 0; b < count; b++)
+  {
+    assert_int_equal(buckets[b].start_time, START_TIME + (int64_t)b * 10000);
+    assert_int_equal(buckets[b].count, 10);
+    assert_true(buckets[b].min == b * 10.0);
+    assert_true(buckets[b].max == b * 10.0 + 9);
+    assert_true(buckets[b].last == b * 10.0 + 9);
+    assert_true(buckets[b].mean == b * 10.0 + 4.5);
+  }
+
+  // Stops at max_buckets
+  assert_int_equal(
+      time_series_query_downsample(series, START_TIME, INT64_MAX, 10000, buckets, 2), 2);
+}
+
+// Points older than the last point are rejected
+static void test_time_series_store_append_out_of_order_failure(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series* series = time_series_store_get(store, "ordered", true);
+
+  assert_int_equal(time_series_append(series, START_TIME, 1.0), 0);
+  assert_int_equal(time_series_append(series, START_TIME, 2.0), 0);
+  assert_int_equal(time_series_append(series, START_TIME - 1, 3.0), -1);
+  assert_int_equal(series->point_count, 2);
+}
+
+// Series are found by name, and only created on request
+static void test_time_series_store_get_success(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  char name[32];
+
+  assert_null(time_series_store_get(store, "missing", false));
+  for (int i = 0; i < 20; i++)
+  {
+    sprintf(name, "devices/%d", i);
+    assert_non_null(time_series_store_get(store, name, true));
+  }
+  assert_int_equal(store->count, 20);
+  assert_string_equal(time_series_store_get(store, "devices/7", false)->name, "devices/7");
+  assert_int_equal(time_series_store_memory(store), 0);
+
+  assert_int_equal(time_series_append(time_series_store_get(store, "devices/7", false), 1, 1), 0);
+  assert_int_equal(time_series_store_memory(store), sizeof(time_series_chunk));
+}
+
+// Series past max_series are not created, existing ones are still found
+static void test_time_series_store_max_series_failure(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series_store_options options = { .max_series = 2 };
+
+  time_series_store_destroy(store);
+  time_series_store_init(store, &options);
+  assert_non_null(time_series_store_get(store, "devices/1", true));
+  assert_non_null(time_series_store_get(store, "devices/2", true));
+
+  assert_null(time_series_store_get(store, "devices/3", true));
+  assert_null(time_series_store_get(store, "devices/4", true));
+  assert_int_equal(store->count, 2);
+  assert_int_equal(store->rejected_series, 2);
+  assert_string_equal(time_series_store_get(store, "devices/2", true)->name, "devices/2");
+}
+
+// Chunks older than the retention are freed as new chunks start, the rest stays queryable
+static void test_time_series_store_retention_success(void** state)
+{
+  time_series_store* store = (time_series_store*)*state;
+  time_series_store_options options = { .retention = 24 * 3600 * 1000LL };
+  time_series* series;
+  time_series_iterator iterator;
+  time_series_point point;
+  int64_t last_time = START_TIME + (int64_t)(3 * POINT_COUNT - 1) * INTERVAL_MS;
+  uint64_t decoded = 0;
+
+  time_series_store_destroy(store);
+  time_series_store_init(store, &options);
+  series = time_series_store_get(store, "retained", true);
+  for (int i = 0; i < POINT_COUNT; i++)
+  {
+    assert_int_equal(
+        time_series_append(series, START_TIME + (int64_t)i * INTERVAL_MS, gauge_value(i)), 0);
+  }
+
+  // 10000 points every 5 seconds span about 14 hours, within the retention, so none are freed
+  assert_int_equal(series->head->start_time, START_TIME);
+  for (int i = POINT_COUNT; i < 3 * POINT_COUNT; i++)
+  {
+    assert_int_equal(
+        time_series_append(series, START_TIME + (int64_t)i * INTERVAL_MS, gauge_value(i)), 0);
+  }
+
+  // Only the first chunk may start before the retention, as it ends within it
+  assert_true(series->head->end_time >= last_time - options.retention);
+  assert_true(series->head->start_time > START_TIME);
+  assert_true(series->point_count < 3 * POINT_COUNT);
+
+  time_series_iterator_init(&iterator, series, INT64_MIN, INT64_MAX);
+  while (time_series_iterator_next(&iterator, &point))
+  {
+    decoded++;
+  }
+  assert_int_equal(decoded, series->point_count);
+  assert_int_equal(point.timestamp, last_time);
+}
+
+int test_time_series_store()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(
+        test_time_series_store_regular_series_round_trip_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_time_series_store_irregular_series_round_trip_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_time_series_store_query_range_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_time_series_store_query_downsample_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_time_series_store_append_out_of_order_failure, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_time_series_store_get_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_time_series_store_max_series_failure, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_time_series_store_retention_success, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("time_series_store", tests, NULL, NULL);
+}
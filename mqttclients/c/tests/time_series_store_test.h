@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef TIME_SERIES_STORE_TEST_H
+#define TIME_SERIES_STORE_TEST_H
+
+#include "time_series_store.h"
+
+int test_time_series_store();
+
+#endif // TIME_SERIES_STORE_TEST_H
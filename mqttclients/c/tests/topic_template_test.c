@@ -0,0 +1,132 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "topic_template_test.h"
+
+#define POSITION_TOPIC(level) "vehicles/" level "/position"
+#define REQUEST_TOPIC(level) "vehicles/" level "/command/" level "/request"
+
+static void test_topic_template_constants_success(void** state)
+{
+  assert_string_equal(TOPIC_FILTER(POSITION_TOPIC), "vehicles/+/position");
+  assert_string_equal(TOPIC_FILTER(REQUEST_TOPIC), "vehicles/+/command/+/request");
+  assert_string_equal(POSITION_TOPIC("vehicle03"), "vehicles/vehicle03/position");
+
+  assert_int_equal(TOPIC_PLACEHOLDERS(POSITION_TOPIC), 1);
+  assert_int_equal(TOPIC_PLACEHOLDERS(REQUEST_TOPIC), 2);
+  assert_int_equal(
+      TOPIC_SIZE(POSITION_TOPIC), strlen(TOPIC_FILTER(POSITION_TOPIC)) + TOPIC_LEVEL_MAX_LENGTH);
+  assert_int_equal(
+      TOPIC_SIZE(REQUEST_TOPIC),
+      strlen(TOPIC_FILTER(REQUEST_TOPIC)) - 1 + 2 * TOPIC_LEVEL_MAX_LENGTH);
+}
+
+static void test_topic_template_round_trip_success(void** state)
+{
+  char topic[TOPIC_SIZE(REQUEST_TOPIC)];
+  char value[TOPIC_LEVEL_MAX_LENGTH + 1];
+  topic_level levels[2];
+
+  assert_int_equal(
+      TOPIC_FORMAT(topic, REQUEST_TOPIC, "vehicle03", "unlock"),
+      strlen("vehicles/vehicle03/command/unlock/request"));
+  assert_string_equal(topic, "vehicles/vehicle03/command/unlock/request");
+
+  assert_true(TOPIC_MATCH(topic, REQUEST_TOPIC, levels));
+  // The levels point into the topic.
+  assert_ptr_equal(levels[0].value, topic + strlen("vehicles/"));
+  assert_int_equal(levels[0].length, strlen("vehicle03"));
+  assert_true(topic_level_copy(&levels[1], value, sizeof(value)));
+  assert_string_equal(value, "unlock");
+}
+
+static void test_topic_template_longest_level_success(void** state)
+{
+  char topic[TOPIC_SIZE(POSITION_TOPIC)];
+  char value[TOPIC_LEVEL_MAX_LENGTH + 1];
+  topic_level levels[1];
+
+  memset(value, 'v', TOPIC_LEVEL_MAX_LENGTH);
+  value[TOPIC_LEVEL_MAX_LENGTH] = '\0';
+
+  assert_int_equal(TOPIC_FORMAT(topic, POSITION_TOPIC, value), sizeof(topic) - 1);
+  assert_true(TOPIC_MATCH(topic, POSITION_TOPIC, levels));
+  assert_int_equal(levels[0].length, TOPIC_LEVEL_MAX_LENGTH);
+  // The empty level is a valid topic level.
+  assert_int_equal(TOPIC_FORMAT(topic, POSITION_TOPIC, ""), strlen("vehicles//position"));
+  assert_true(TOPIC_MATCH(topic, POSITION_TOPIC, levels));
+  assert_int_equal(levels[0].length, 0);
+}
+
+static void test_topic_template_wildcard_success(void** state)
+{
+  char filter[TOPIC_SIZE(REQUEST_TOPIC)];
+
+  assert_int_equal(
+      TOPIC_FORMAT(filter, REQUEST_TOPIC, "+", "unlock"),
+      strlen("vehicles/+/command/unlock/request"));
+  assert_string_equal(filter, "vehicles/+/command/unlock/request");
+  assert_int_equal(
+      TOPIC_FORMAT(filter, REQUEST_TOPIC, "+", "+"), strlen(TOPIC_FILTER(REQUEST_TOPIC)));
+  assert_string_equal(filter, TOPIC_FILTER(REQUEST_TOPIC));
+}
+
+static void test_topic_template_format_failure(void** state)
+{
+  char topic[TOPIC_SIZE(POSITION_TOPIC)];
+  char value[TOPIC_LEVEL_MAX_LENGTH + 2];
+  const char* values[] = { "vehicle03", "unlock" };
+
+  memset(value, 'v', TOPIC_LEVEL_MAX_LENGTH + 1);
+  value[TOPIC_LEVEL_MAX_LENGTH + 1] = '\0';
+
+  assert_int_equal(TOPIC_FORMAT(topic, POSITION_TOPIC, value), -1);
+  assert_int_equal(TOPIC_FORMAT(topic, POSITION_TOPIC, "vehicle/03"), -1);
+  assert_int_equal(TOPIC_FORMAT(topic, POSITION_TOPIC, "vehicle+"), -1);
+  assert_int_equal(TOPIC_FORMAT(topic, POSITION_TOPIC, "#"), -1);
+  // Checked at compile time by TOPIC_FORMAT.
+  assert_int_equal(
+      topic_template_format(topic, sizeof(topic), TOPIC_FILTER(POSITION_TOPIC), values, 2), -1);
+  assert_int_equal(
+      topic_template_format(topic, sizeof(topic), TOPIC_FILTER(REQUEST_TOPIC), values, 1), -1);
+  assert_int_equal(topic_template_format(topic, 10, TOPIC_FILTER(POSITION_TOPIC), values, 1), -1);
+}
+
+static void test_topic_template_match_failure(void** state)
+{
+  topic_level levels[2];
+  char value[4];
+
+  assert_false(TOPIC_MATCH("vehicles/vehicle03/command/unlock", REQUEST_TOPIC, levels));
+  assert_false(TOPIC_MATCH("vehicles/vehicle03/command/unlock/request/", REQUEST_TOPIC, levels));
+  assert_false(TOPIC_MATCH("vehicles/vehicle03/status/unlock/request", REQUEST_TOPIC, levels));
+  assert_false(TOPIC_MATCH("devices/vehicle03/command/unlock/request", REQUEST_TOPIC, levels));
+  assert_false(topic_template_match(
+      "vehicles/vehicle03/position", TOPIC_FILTER(POSITION_TOPIC), levels, 2));
+
+  assert_true(TOPIC_MATCH("vehicles/vehicle03/command/unlock/request", REQUEST_TOPIC, levels));
+  assert_false(topic_level_copy(&levels[0], value, sizeof(value)));
+}
+
+int test_topic_template()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_topic_template_constants_success),
+    cmocka_unit_test(test_topic_template_round_trip_success),
+    cmocka_unit_test(test_topic_template_longest_level_success),
+    cmocka_unit_test(test_topic_template_wildcard_success),
+    cmocka_unit_test(test_topic_template_format_failure),
+    cmocka_unit_test(test_topic_template_match_failure)
+  };
+  return cmocka_run_group_tests_name("topic_template", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef TOPIC_TEMPLATE_TEST_H
+#define TOPIC_TEMPLATE_TEST_H
+
+#include "topic_template.h"
+
+int test_topic_template();
+
+#endif // TOPIC_TEMPLATE_TEST_H
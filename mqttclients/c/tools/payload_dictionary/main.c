@@ -0,0 +1,414 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Trains the compression dictionaries of payload_compression on the payloads of a traffic_capture
+ * directory, and measures what they save on another capture.
+ *
+ * train writes <dictionary directory>/<id>.zdict. Dictionaries are never overwritten: a new
+ * dictionary gets a new id, is deployed to the receivers, and then to the publishers, which
+ * compress with the highest id they have.
+ *
+ * bench compresses every payload of a capture with each dictionary of the directory, and reports
+ * the bytes on the wire, content type included, and the time to compress and decompress a payload.
+ *
+ * Usage: payload_dictionary train <capture directory> <dictionary directory> <id> [size KiB]
+ *                                 [topic filter]
+ *        payload_dictionary bench <capture directory> <dictionary directory> [topic filter]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zdict.h>
+
+#include "logging.h"
+#include "message_journal.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "payload_compression.h"
+
+/* Payloads read from a capture at most. zstd needs about 100 times the size of the dictionary. */
+#define MAX_SAMPLE_BYTES (256 * 1024 * 1024)
+#define BUFFER_LENGTH (64 * 1024)
+
+typedef struct payload_set
+{
+  uint8_t* data;
+  size_t* sizes;
+  size_t count;
+  size_t capacity;
+  size_t length;
+  size_t data_capacity;
+  size_t skipped;
+} payload_set;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool _is_compressed(const message_journal_record* record)
+{
+  mosquitto_property* props = NULL;
+  char* content_type = NULL;
+  bool compressed = false;
+
+  if (record->properties_length > 0 && message_journal_record_properties(record, &props) == 0
+      && mosquitto_property_read_string(props, MQTT_PROP_CONTENT_TYPE, &content_type, false)
+          != NULL)
+  {
+    compressed = strncmp(
+                     content_type,
+                     PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX,
+                     strlen(PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX))
+        == 0;
+  }
+  free(content_type);
+  mosquitto_property_free_all(&props);
+  return compressed;
+}
+
+static int _add_payload(payload_set* set, const void* payload, size_t length)
+{
+  if (set->count == set->capacity)
+  {
+    size_t capacity = set->capacity == 0 ? 4096 : set->capacity * 2;
+    size_t* sizes = realloc(set->sizes, capacity * sizeof(size_t));
+    if (sizes == NULL)
+    {
+      return -1;
+    }
+    set->sizes = sizes;
+    set->capacity = capacity;
+  }
+  if (set->length + length > set->data_capacity)
+  {
+    size_t capacity = set->data_capacity == 0 ? 1024 * 1024 : set->data_capacity * 2;
+    while (capacity < set->length + length)
+    {
+      capacity *= 2;
+    }
+    uint8_t* data = realloc(set->data, capacity);
+    if (data == NULL)
+    {
+      return -1;
+    }
+    set->data = data;
+    set->data_capacity = capacity;
+  }
+  memcpy(set->data + set->length, payload, length);
+  set->sizes[set->count++] = length;
+  set->length += length;
+  return 0;
+}
+
+/* Reads the payloads of a capture on the topic filter, leaving out the ones already compressed. */
+static int _read_payloads(const char* capture, const char* filter, payload_set* set)
+{
+  message_journal_reader reader;
+  message_journal_record record;
+  char topic[UINT16_MAX + 1];
+  bool matches = true;
+  int result;
+
+  if (message_journal_reader_open(&reader, capture) != 0)
+  {
+    return -1;
+  }
+  while ((result = message_journal_reader_next(&reader, &record)) == 1
+         && set->length < MAX_SAMPLE_BYTES)
+  {
+    if (filter != NULL)
+    {
+      memcpy(topic, record.topic, record.topic_length);
+      topic[record.topic_length] = '\0';
+      mosquitto_topic_matches_sub(filter, topic, &matches);
+    }
+    if (!matches || record.payload_length == 0 || _is_compressed(&record))
+    {
+      set->skipped++;
+    }
+    else if (_add_payload(set, record.payload, record.payload_length) != 0)
+    {
+      result = -1;
+      break;
+    }
+  }
+  message_journal_reader_close(&reader);
+  if (result < 0)
+  {
+    LOG_ERROR("Failed to read the payloads of %s", capture);
+    return -1;
+  }
+  if (set->count == 0)
+  {
+    LOG_ERROR("No payload to use in %s", capture);
+    return -1;
+  }
+  return 0;
+}
+
+static void _free_payloads(payload_set* set)
+{
+  free(set->data);
+  free(set->sizes);
+}
+
+static int _train(int argc, char* argv[])
+{
+  payload_set set = { 0 };
+  ZDICT_params_t params = { 0 };
+  char path[4096];
+  uint8_t* dictionary = NULL;
+  long long id = strtoll(argv[4], NULL, 10);
+  size_t capacity = argc > 5 ? (size_t)atoi(argv[5]) * 1024
+                             : PAYLOAD_COMPRESSION_DEFAULT_DICTIONARY_SIZE;
+  size_t size = 0;
+  size_t header;
+  int fd = -1;
+  int result = EXIT_FAILURE;
+
+  if (id <= 0 || id > UINT32_MAX || capacity == 0)
+  {
+    fprintf(stderr, "Invalid dictionary id or size\n");
+    return EXIT_FAILURE;
+  }
+  snprintf(
+      path, sizeof(path), "%s/%lld%s", argv[3], id, PAYLOAD_COMPRESSION_DICTIONARY_EXTENSION);
+  params.dictID = (unsigned)id;
+  params.compressionLevel = PAYLOAD_COMPRESSION_DEFAULT_LEVEL;
+
+  if (_read_payloads(argv[2], argc > 6 ? argv[6] : NULL, &set) != 0)
+  {
+    _free_payloads(&set);
+    return EXIT_FAILURE;
+  }
+
+  if ((dictionary = malloc(capacity)) == NULL)
+  {
+    LOG_ERROR("Failed to allocate the dictionary");
+  }
+  else if (ZDICT_isError(
+               size = ZDICT_trainFromBuffer(dictionary, capacity, set.data, set.sizes, set.count)))
+  {
+    LOG_ERROR("Failed to train the dictionary: %s", ZDICT_getErrorName(size));
+  }
+  else if (ZDICT_isError(header = ZDICT_getDictHeaderSize(dictionary, size)))
+  {
+    LOG_ERROR("Failed to read the dictionary: %s", ZDICT_getErrorName(header));
+  }
+  /* The trained dictionary gets a random id, so its content is finalized again with the id. */
+  else if (ZDICT_isError(
+               size = ZDICT_finalizeDictionary(
+                   dictionary,
+                   capacity,
+                   dictionary + header,
+                   size - header,
+                   set.data,
+                   set.sizes,
+                   set.count,
+                   params)))
+  {
+    LOG_ERROR("Failed to finalize the dictionary: %s", ZDICT_getErrorName(size));
+  }
+  else if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0)
+  {
+    LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+  }
+  else if (write(fd, dictionary, size) != (ssize_t)size || fsync(fd) != 0)
+  {
+    LOG_ERROR("Failed to write %s: %s", path, strerror(errno));
+    unlink(path);
+  }
+  else
+  {
+    LOG_INFO(
+        APP_LOG_TAG,
+        "Trained dictionary %lld (%zu bytes) on %zu payloads (%zu bytes, %zu skipped) into %s",
+        id,
+        size,
+        set.count,
+        set.length,
+        set.skipped,
+        path);
+    result = EXIT_SUCCESS;
+  }
+
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  free(dictionary);
+  _free_payloads(&set);
+  return result;
+}
+
+static void _report(const char* name, const payload_set* set, size_t bytes, size_t wire_bytes)
+{
+  printf(
+      "%-24s %10.1f %10.1f %7.1f%%\n",
+      name,
+      (double)bytes / set->count,
+      (double)wire_bytes / set->count,
+      100.0 * wire_bytes / set->length);
+}
+
+static int _bench(int argc, char* argv[])
+{
+  payload_set set = { 0 };
+  payload_codec codec;
+  ZSTD_CCtx* cctx = NULL;
+  uint8_t* compressed = malloc(BUFFER_LENGTH);
+  uint8_t* decompressed = malloc(BUFFER_LENGTH);
+  int result = EXIT_FAILURE;
+
+  if (compressed == NULL || decompressed == NULL
+      || _read_payloads(argv[2], argc > 4 ? argv[4] : NULL, &set) != 0)
+  {
+    free(compressed);
+    free(decompressed);
+    return EXIT_FAILURE;
+  }
+  if (payload_codec_init(&codec, PAYLOAD_COMPRESSION_DEFAULT_LEVEL) != 0)
+  {
+    _free_payloads(&set);
+    free(compressed);
+    free(decompressed);
+    return EXIT_FAILURE;
+  }
+
+  if (payload_codec_load_dictionaries(&codec, argv[3]) <= 0)
+  {
+    LOG_ERROR("No dictionary in %s", argv[3]);
+  }
+  else if ((cctx = ZSTD_createCCtx()) == NULL)
+  {
+    LOG_ERROR("Failed to create the zstd context");
+  }
+  else
+  {
+    size_t bytes = 0;
+
+    printf("%zu payloads of %.1f bytes on average\n", set.count, (double)set.length / set.count);
+    printf(
+        "%-24s %10s %10s %8s %12s %14s\n",
+        "",
+        "payload",
+        "wire",
+        "ratio",
+        "compress",
+        "decompress");
+    _report("uncompressed", &set, set.length, set.length);
+
+    /* zstd without a dictionary, for reference. */
+    for (size_t i = 0, offset = 0; i < set.count; offset += set.sizes[i++])
+    {
+      size_t length = ZSTD_compressCCtx(
+          cctx, compressed, BUFFER_LENGTH, set.data + offset, set.sizes[i], codec.level);
+      bytes += ZSTD_isError(length) || length >= set.sizes[i] ? set.sizes[i] : length;
+    }
+    _report("zstd, no dictionary", &set, bytes, bytes);
+
+    for (uint32_t d = 0; d < codec.dictionary_count; d++)
+    {
+      char name[32];
+      size_t wire_bytes = 0;
+      int64_t compress_ns = 0;
+      int64_t decompress_ns = 0;
+      size_t failures = 0;
+
+      bytes = 0;
+      payload_codec_use_dictionary(&codec, codec.dictionaries[d].id);
+      for (size_t i = 0, offset = 0; i < set.count; offset += set.sizes[i++])
+      {
+        const mosquitto_property* props = NULL;
+        struct mosquitto_message message = { 0 };
+        size_t length = 0;
+        int64_t start = now_ns();
+
+        if (!payload_codec_compress(
+                &codec,
+                set.data + offset,
+                set.sizes[i],
+                compressed,
+                BUFFER_LENGTH,
+                &length,
+                &props))
+        {
+          compress_ns += now_ns() - start;
+          bytes += set.sizes[i];
+          wire_bytes += set.sizes[i];
+          continue;
+        }
+        compress_ns += now_ns() - start;
+        bytes += length;
+        /* The content type property: identifier, length and string. */
+        wire_bytes += length + 3 + strlen(PAYLOAD_COMPRESSION_CONTENT_TYPE_PREFIX)
+            + (size_t)snprintf(NULL, 0, "%" PRIu32, codec.current->id);
+
+        message.topic = "";
+        message.payload = compressed;
+        message.payloadlen = (int)length;
+        start = now_ns();
+        if (payload_codec_decompress(&codec, &message, props, decompressed, BUFFER_LENGTH, &length)
+                != 1
+            || length != set.sizes[i] || memcmp(decompressed, set.data + offset, length) != 0)
+        {
+          failures++;
+        }
+        decompress_ns += now_ns() - start;
+      }
+
+      snprintf(name, sizeof(name), "dictionary %" PRIu32, codec.dictionaries[d].id);
+      printf(
+          "%-24s %10.1f %10.1f %7.1f%% %9.0f ns %11.0f ns\n",
+          name,
+          (double)bytes / set.count,
+          (double)wire_bytes / set.count,
+          100.0 * wire_bytes / set.length,
+          (double)compress_ns / set.count,
+          (double)decompress_ns / set.count);
+      if (failures > 0)
+      {
+        LOG_ERROR("%zu payloads did not decompress to the original", failures);
+      }
+    }
+    result = EXIT_SUCCESS;
+  }
+
+  ZSTD_freeCCtx(cctx);
+  payload_codec_destroy(&codec);
+  _free_payloads(&set);
+  free(compressed);
+  free(decompressed);
+  return result;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 5 && strcmp(argv[1], "train") == 0)
+  {
+    return _train(argc, argv);
+  }
+  if (argc >= 4 && strcmp(argv[1], "bench") == 0)
+  {
+    return _bench(argc, argv);
+  }
+
+  fprintf(
+      stderr,
+      "Usage: %s train <capture directory> <dictionary directory> <id> [size KiB] [topic filter]\n"
+      "       %s bench <capture directory> <dictionary directory> [topic filter]\n",
+      argv[0],
+      argv[0]);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,161 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Records the messages published on topic filters into a message_journal directory, with their
+ * topic, QoS, retain flag, MQTT v5 properties, payload and receive time, to be replayed by
+ * traffic_replay. The subscription uses QoS 2 and retain as published, so the messages are
+ * recorded with the QoS and retain flag they were published with.
+ *
+ * Usage: traffic_capture <env file> <capture directory> <topic filter>...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "message_journal.h"
+#include "mosquitto.h"
+#include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define CAPTURE_QOS 2
+
+static message_journal journal;
+static char** topic_filters;
+static int topic_filter_count;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void on_connect_with_subscribe(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  on_connect(mosq, obj, reason_code, flags, props);
+  if (reason_code != 0)
+  {
+    return;
+  }
+
+  int result = mosquitto_subscribe_multiple(
+      mosq,
+      NULL,
+      topic_filter_count,
+      topic_filters,
+      CAPTURE_QOS,
+      MQTT_SUB_OPT_RETAIN_AS_PUBLISHED,
+      NULL);
+  if (result != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Error subscribing: %s", mosquitto_strerror(result));
+    keep_running = 0;
+  }
+}
+
+/* Replaces on_message, which logs every message, so capturing keeps up with busy topics. */
+static void on_capture_message(
+    struct mosquitto* mosq,
+    void* obj,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  message_journal_append(&journal, message, props, now_ns());
+}
+
+int main(int argc, char* argv[])
+{
+  struct mosquitto* mosq = NULL;
+  int result = MOSQ_ERR_SUCCESS;
+  mqtt_client_connection_settings connection_settings;
+  message_journal_options options = { 0 };
+  int journal_result = -1;
+
+  mqtt_client_obj obj = { 0 };
+  obj.mqtt_version = MQTT_VERSION;
+
+  if (argc < 4)
+  {
+    fprintf(stderr, "Usage: %s <env file> <capture directory> <topic filter>...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  options.directory = argv[2];
+  topic_filters = argv + 3;
+  topic_filter_count = argc - 3;
+
+  if (!mqtt_client_load_settings(argv[1], &connection_settings))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((result = mosquitto_lib_init()) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to initialize mosquitto: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (mosq = mqtt_client_new(false, &connection_settings, on_connect_with_subscribe, &obj))
+      == NULL)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((journal_result = message_journal_open(&journal, &options)) != 0)
+  {
+    LOG_ERROR("Failed to open the capture directory %s", options.directory);
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (result = mosquitto_connect_bind_v5(
+           mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else
+  {
+    mosquitto_message_v5_callback_set(mosq, on_capture_message);
+    if ((result = mosquitto_loop_start(mosq)) != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else
+    {
+      LOG_INFO(CLIENT_LOG_TAG, "Capturing to %s, press Ctrl+C to stop", options.directory);
+      while (keep_running)
+      {
+        sleep(1);
+      }
+    }
+  }
+
+  if (mosq != NULL)
+  {
+    mosquitto_disconnect_v5(mosq, result, NULL);
+    mosquitto_loop_stop(mosq, false);
+    mosquitto_destroy(mosq);
+  }
+  if (journal_result == 0)
+  {
+    message_journal_close(&journal);
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Captured %llu messages (%llu bytes, %llu dropped)",
+        (unsigned long long)journal.appended,
+        (unsigned long long)journal.appended_bytes,
+        (unsigned long long)journal.dropped);
+  }
+  mosquitto_lib_cleanup();
+  return result;
+}
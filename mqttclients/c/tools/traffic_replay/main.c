@@ -0,0 +1,414 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Publishes the messages recorded by traffic_capture to the broker of the env file, with their
+ * topic, QoS, retain flag, MQTT v5 properties and payload, keeping the time between them divided
+ * by a speed factor: 1 replays the capture as it was recorded, 10 ten times faster, and max as
+ * fast as the broker accepts them. The messages are spread over parallel connections by topic, so
+ * the messages of a topic keep their order, each connection replaying its share on its own
+ * thread. The client ids of the connections are MQTT_CLIENT_ID followed by the connection number.
+ * The connections are opened concurrently, and the time of each phase of their connects is printed.
+ *
+ * Usage: traffic_replay <env file> <capture directory> [speed|max] [connections]
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "message_journal.h"
+#include "mosquitto.h"
+#include "mqtt_connect.h"
+#include "mqtt_setup.h"
+
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define MAX_CONNECTIONS 1024
+/* Messages a connection may have queued or in flight before its thread waits for the broker. */
+#define MAX_PENDING_MESSAGES 1000
+#define MAX_SLEEP_NS 100000000
+#define WAIT_NS 100000
+#define CONNECT_TIMEOUT_MS 10000
+/* Threads opening the connections, each resolving the hostname for its share of them. */
+#define CONNECT_THREADS 8
+#define DRAIN_TIMEOUT_NS 10000000000LL
+
+typedef struct replayer
+{
+  /* First, as the callbacks are passed the mqtt_client_obj. */
+  mqtt_client_obj obj;
+  uint32_t index;
+  struct mosquitto* mosq;
+  pthread_t thread;
+  char* client_id;
+  uint64_t published;
+  uint64_t completed;
+  uint64_t bytes;
+  uint64_t failed;
+  int64_t max_lag_ns;
+} replayer;
+
+static const char* capture_directory;
+static double speed = 1;
+static uint32_t connection_count = 1;
+static int64_t first_timestamp_ns;
+static int64_t start_ns;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ns(int64_t ns)
+{
+  struct timespec delay = { ns / 1000000000, ns % 1000000000 };
+  nanosleep(&delay, NULL);
+}
+
+/* FNV-1a of the topic, which is not NUL terminated in a record. */
+static uint32_t topic_hash(const char* topic, uint16_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (uint16_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ (unsigned char)topic[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* Replaces on_publish, which logs every message. Called once a QoS 0 message is written to the
+ * socket, or acknowledged by the broker for QoS 1 and 2. */
+static void on_replay_publish(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int reason_code,
+    const mosquitto_property* props)
+{
+  replayer* r = obj;
+  __atomic_store_n(&r->completed, r->completed + 1, __ATOMIC_RELEASE);
+}
+
+/* Waits until the record is due, returns how late it is. */
+static int64_t wait_until_due(const message_journal_record* record)
+{
+  int64_t due_ns = start_ns + (int64_t)((record->timestamp_ns - first_timestamp_ns) / speed);
+  int64_t now = now_ns();
+
+  while (now < due_ns && keep_running)
+  {
+    sleep_ns(due_ns - now < MAX_SLEEP_NS ? due_ns - now : MAX_SLEEP_NS);
+    now = now_ns();
+  }
+  return now - due_ns;
+}
+
+static void wait_for_pending(replayer* r, uint64_t max_pending, int64_t deadline_ns)
+{
+  while (r->published - __atomic_load_n(&r->completed, __ATOMIC_ACQUIRE) > max_pending
+         && keep_running && now_ns() < deadline_ns)
+  {
+    sleep_ns(WAIT_NS);
+  }
+}
+
+static void* replay(void* arg)
+{
+  replayer* r = arg;
+  message_journal_reader reader;
+  message_journal_record record;
+  char* topic = malloc(UINT16_MAX + 1);
+  int rc = 0;
+
+  if (topic == NULL || message_journal_reader_open(&reader, capture_directory) != 0)
+  {
+    LOG_ERROR("Connection %u failed to read %s", r->index, capture_directory);
+    free(topic);
+    return NULL;
+  }
+
+  while (keep_running && (rc = message_journal_reader_next(&reader, &record)) == 1)
+  {
+    mosquitto_property* props = NULL;
+
+    if (topic_hash(record.topic, record.topic_length) % connection_count != r->index)
+    {
+      continue;
+    }
+    if (speed > 0)
+    {
+      int64_t lag_ns = wait_until_due(&record);
+      if (lag_ns > r->max_lag_ns)
+      {
+        r->max_lag_ns = lag_ns;
+      }
+    }
+    wait_for_pending(r, MAX_PENDING_MESSAGES - 1, INT64_MAX);
+
+    memcpy(topic, record.topic, record.topic_length);
+    topic[record.topic_length] = '\0';
+    if ((rc = message_journal_record_publish_properties(&record, &props)) == MOSQ_ERR_SUCCESS)
+    {
+      rc = mosquitto_publish_v5(
+          r->mosq,
+          NULL,
+          topic,
+          (int)record.payload_length,
+          record.payload,
+          record.qos,
+          record.retain,
+          props);
+    }
+    mosquitto_property_free_all(&props);
+
+    if (rc == MOSQ_ERR_SUCCESS)
+    {
+      r->published++;
+      r->bytes += record.payload_length;
+    }
+    else if (r->failed++ == 0)
+    {
+      LOG_ERROR(
+          "Connection %u failed to publish on %s: %s", r->index, topic, mosquitto_strerror(rc));
+    }
+  }
+  if (rc < 0)
+  {
+    LOG_ERROR("Connection %u failed to read %s", r->index, capture_directory);
+  }
+
+  wait_for_pending(r, 0, now_ns() + DRAIN_TIMEOUT_NS);
+  message_journal_reader_close(&reader);
+  free(topic);
+  return NULL;
+}
+
+/* Finds the time span of the capture. */
+static bool read_capture(uint64_t* count, int64_t* duration_ns)
+{
+  message_journal_reader reader;
+  message_journal_record record;
+  int64_t last_timestamp_ns = 0;
+  int rc;
+
+  *count = 0;
+  if (message_journal_reader_open(&reader, capture_directory) != 0)
+  {
+    return false;
+  }
+  while ((rc = message_journal_reader_next(&reader, &record)) == 1)
+  {
+    if (*count == 0)
+    {
+      first_timestamp_ns = record.timestamp_ns;
+    }
+    last_timestamp_ns = record.timestamp_ns;
+    (*count)++;
+  }
+  message_journal_reader_close(&reader);
+  *duration_ns = last_timestamp_ns - first_timestamp_ns;
+  return rc == 0;
+}
+
+static bool create_replayers(
+    replayer* replayers,
+    const mqtt_client_connection_settings* connection_settings,
+    struct mosquitto** clients)
+{
+  mqtt_client_connection_settings settings = *connection_settings;
+
+  for (uint32_t i = 0; i < connection_count; i++)
+  {
+    replayer* r = &replayers[i];
+
+    r->index = i;
+    r->obj.mqtt_version = MQTT_VERSION;
+    if (connection_settings->client_id != NULL)
+    {
+      size_t length = strlen(connection_settings->client_id) + 12;
+      if ((r->client_id = malloc(length)) == NULL)
+      {
+        return false;
+      }
+      snprintf(r->client_id, length, "%s-%u", connection_settings->client_id, i);
+    }
+    settings.client_id = r->client_id;
+
+    if ((r->mosq = mqtt_client_new(false, &settings, NULL, &r->obj)) == NULL)
+    {
+      return false;
+    }
+    mosquitto_publish_v5_callback_set(r->mosq, on_replay_publish);
+    clients[i] = r->mosq;
+  }
+  return true;
+}
+
+/* Opens the connections concurrently, then starts the network thread of each one. */
+static bool connect_replayers(
+    replayer* replayers,
+    const mqtt_client_connection_settings* connection_settings)
+{
+  struct mosquitto** clients = calloc(connection_count, sizeof(struct mosquitto*));
+  mqtt_connect_timing* timings = calloc(connection_count, sizeof(mqtt_connect_timing));
+  int64_t connect_start_ns = now_ns();
+  size_t connected = 0;
+  int result = MOSQ_ERR_SUCCESS;
+
+  if (clients == NULL || timings == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+  }
+  else if (create_replayers(replayers, connection_settings, clients))
+  {
+    connected = mqtt_client_connect_all(
+        clients, connection_count, CONNECT_THREADS, CONNECT_TIMEOUT_MS, timings);
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Opened %zu of %u connections in %.3f ms",
+        connected,
+        connection_count,
+        (now_ns() - connect_start_ns) / 1e6);
+    mqtt_client_print_connect_timings(timings, connection_count);
+    for (uint32_t i = 0; i < connection_count; i++)
+    {
+      if (timings[i].result != MOSQ_ERR_SUCCESS)
+      {
+        LOG_ERROR("Connection %u failed to connect: %s", i, mosquitto_strerror(timings[i].result));
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < connection_count && connected == connection_count; i++)
+  {
+    if ((result = mosquitto_loop_start(replayers[i].mosq)) != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
+      break;
+    }
+  }
+
+  free(clients);
+  free(timings);
+  return connected == connection_count && result == MOSQ_ERR_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+  int result = MOSQ_ERR_SUCCESS;
+  mqtt_client_connection_settings connection_settings;
+  replayer* replayers = NULL;
+  uint32_t started = 0;
+  uint64_t count = 0;
+  int64_t duration_ns = 0;
+
+  if (argc > 3)
+  {
+    speed = strcmp(argv[3], "max") == 0 ? 0 : atof(argv[3]);
+  }
+  if (argc > 4)
+  {
+    connection_count = (uint32_t)atoi(argv[4]);
+  }
+  if (argc < 3 || (argc > 3 && speed <= 0 && strcmp(argv[3], "max") != 0)
+      || connection_count == 0 || connection_count > MAX_CONNECTIONS)
+  {
+    fprintf(
+        stderr, "Usage: %s <env file> <capture directory> [speed|max] [connections]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  capture_directory = argv[2];
+
+  if (!read_capture(&count, &duration_ns))
+  {
+    LOG_ERROR("Failed to read the capture directory %s", capture_directory);
+    return EXIT_FAILURE;
+  }
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Replaying %llu messages captured over %.3f s at %s speed on %u connections",
+      (unsigned long long)count,
+      duration_ns / 1e9,
+      argc > 3 ? argv[3] : "1",
+      connection_count);
+
+  if (!mqtt_client_load_settings(argv[1], &connection_settings))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((result = mosquitto_lib_init()) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to initialize mosquitto: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((replayers = calloc(connection_count, sizeof(replayer))) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    result = MOSQ_ERR_NOMEM;
+  }
+  else if (!connect_replayers(replayers, &connection_settings))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else
+  {
+    uint64_t published = 0;
+    uint64_t bytes = 0;
+    uint64_t failed = 0;
+    int64_t max_lag_ns = 0;
+    double elapsed;
+
+    start_ns = now_ns();
+    for (; started < connection_count; started++)
+    {
+      if (pthread_create(&replayers[started].thread, NULL, replay, &replayers[started]) != 0)
+      {
+        LOG_ERROR("Failed to start connection %u", started);
+        keep_running = 0;
+        result = MOSQ_ERR_UNKNOWN;
+        break;
+      }
+    }
+    for (uint32_t i = 0; i < started; i++)
+    {
+      pthread_join(replayers[i].thread, NULL);
+      published += replayers[i].published;
+      bytes += replayers[i].bytes;
+      failed += replayers[i].failed;
+      max_lag_ns = replayers[i].max_lag_ns > max_lag_ns ? replayers[i].max_lag_ns : max_lag_ns;
+    }
+    elapsed = (now_ns() - start_ns) / 1e9;
+
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Replayed %llu messages (%llu bytes, %llu failed) in %.3f s: %.0f messages/s, %.2fx the "
+        "captured rate, at most %.3f ms late",
+        (unsigned long long)published,
+        (unsigned long long)bytes,
+        (unsigned long long)failed,
+        elapsed,
+        published / elapsed,
+        elapsed > 0 ? duration_ns / 1e9 / elapsed : 0,
+        max_lag_ns / 1e6);
+  }
+
+  for (uint32_t i = 0; replayers != NULL && i < connection_count; i++)
+  {
+    if (replayers[i].mosq != NULL)
+    {
+      mosquitto_disconnect_v5(replayers[i].mosq, result, NULL);
+      mosquitto_loop_stop(replayers[i].mosq, false);
+      mosquitto_destroy(replayers[i].mosq);
+    }
+    free(replayers[i].client_id);
+  }
+  free(replayers);
+  mosquitto_lib_cleanup();
+  return result;
+}
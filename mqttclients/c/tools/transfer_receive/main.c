@@ -0,0 +1,148 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Receives the files sent by transfer_send on a transfer topic into a directory. A transfer
+ * interrupted by a disconnect or a restart resumes from the chunks already written.
+ *
+ * Usage: transfer_receive <env file> <directory> <transfer topic>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "chunked_transfer.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+
+static chunked_transfer_receiver receiver;
+
+void on_connect_with_subscribe(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  on_connect(mosq, obj, reason_code, flags, props);
+  if (reason_code != 0)
+  {
+    return;
+  }
+
+  int result = chunked_transfer_receiver_subscribe(&receiver, mosq);
+  if (result != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Error subscribing: %s", mosquitto_strerror(result));
+    keep_running = 0;
+  }
+}
+
+/* Replaces on_message and on_publish, which log every message. */
+static void on_transfer_message(
+    struct mosquitto* mosq,
+    void* obj,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  chunked_transfer_receiver_handle_message(&receiver, mosq, message, props);
+}
+
+static void on_file_received(const char* name, const char* path, uint64_t size, void* context)
+{
+  LOG_INFO(CLIENT_LOG_TAG, "Received %s (%llu bytes) in %s", name, (unsigned long long)size, path);
+}
+
+int main(int argc, char* argv[])
+{
+  struct mosquitto* mosq = NULL;
+  int result = MOSQ_ERR_SUCCESS;
+  mqtt_client_connection_settings connection_settings;
+  chunked_transfer_receiver_options options = { 0 };
+  int receiver_result = -1;
+
+  mqtt_client_obj obj = { 0 };
+  obj.mqtt_version = MQTT_VERSION;
+
+  if (argc < 4)
+  {
+    fprintf(stderr, "Usage: %s <env file> <directory> <transfer topic>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  options.directory = argv[2];
+  options.topic = argv[3];
+  options.on_complete = on_file_received;
+
+  if (!mqtt_client_load_settings(argv[1], &connection_settings))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((receiver_result = chunked_transfer_receiver_init(&receiver, &options)) != 0)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((result = mosquitto_lib_init()) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to initialize mosquitto: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (mosq = mqtt_client_new(false, &connection_settings, on_connect_with_subscribe, &obj))
+      == NULL)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (result = mosquitto_connect_bind_v5(
+           mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else
+  {
+    mosquitto_message_v5_callback_set(mosq, on_transfer_message);
+    mosquitto_publish_v5_callback_set(mosq, NULL);
+    if ((result = mosquitto_loop_start(mosq)) != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else
+    {
+      LOG_INFO(CLIENT_LOG_TAG, "Receiving into %s, press Ctrl+C to stop", options.directory);
+      while (keep_running)
+      {
+        sleep(1);
+      }
+    }
+  }
+
+  if (mosq != NULL)
+  {
+    mosquitto_disconnect_v5(mosq, result, NULL);
+    mosquitto_loop_stop(mosq, false);
+    mosquitto_destroy(mosq);
+  }
+  if (receiver_result == 0)
+  {
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Received %llu files, %llu chunks (%llu bytes, %llu duplicates, %llu checksum failures)",
+        (unsigned long long)receiver.files_completed,
+        (unsigned long long)receiver.chunks_received,
+        (unsigned long long)receiver.bytes_received,
+        (unsigned long long)receiver.duplicates,
+        (unsigned long long)receiver.checksum_failures);
+    chunked_transfer_receiver_destroy(&receiver);
+  }
+  mosquitto_lib_cleanup();
+  return result;
+}
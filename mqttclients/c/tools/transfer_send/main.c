@@ -0,0 +1,195 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Sends a file to transfer_receive with the chunked_transfer protocol, ex. a firmware image for a
+ * vehicle. The acknowledgements are received on <transfer topic>/<client id>/response. Running it
+ * again with the same file resumes an interrupted transfer where it stopped.
+ *
+ * Usage: transfer_send <env file> <file> <transfer topic> [chunk KiB] [window]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunked_transfer.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define RESPONSE_SUFFIX "/response"
+
+static chunked_transfer_sender sender;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void on_connect_with_subscribe(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  on_connect(mosq, obj, reason_code, flags, props);
+  if (reason_code != 0)
+  {
+    return;
+  }
+
+  int result = mosquitto_subscribe_v5(
+      mosq, NULL, sender.options.response_topic, CHUNKED_TRANSFER_QOS, 0, NULL);
+  if (result != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Error subscribing: %s", mosquitto_strerror(result));
+    keep_running = 0;
+    return;
+  }
+  /* Chunks in flight may have been lost with the previous connection. */
+  chunked_transfer_sender_reconnected(&sender);
+}
+
+/* Replaces on_message and on_publish, which log every message. */
+static void on_transfer_message(
+    struct mosquitto* mosq,
+    void* obj,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  chunked_transfer_sender_handle_message(&sender, message, props);
+}
+
+static char* response_topic(const char* topic, const char* client_id)
+{
+  size_t length = strlen(topic) + 1 + strlen(client_id) + strlen(RESPONSE_SUFFIX) + 1;
+  char* response = malloc(length);
+
+  if (response != NULL)
+  {
+    snprintf(response, length, "%s/%s%s", topic, client_id, RESPONSE_SUFFIX);
+  }
+  return response;
+}
+
+int main(int argc, char* argv[])
+{
+  struct mosquitto* mosq = NULL;
+  int result = MOSQ_ERR_SUCCESS;
+  mqtt_client_connection_settings connection_settings;
+  chunked_transfer_sender_options options = { 0 };
+  char* response = NULL;
+  int sender_result = -1;
+  int64_t start_ns = 0;
+
+  mqtt_client_obj obj = { 0 };
+  obj.mqtt_version = MQTT_VERSION;
+
+  if (argc < 4)
+  {
+    fprintf(
+        stderr, "Usage: %s <env file> <file> <transfer topic> [chunk KiB] [window]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  options.path = argv[2];
+  options.topic = argv[3];
+  options.chunk_size = argc > 4 ? (uint32_t)atoi(argv[4]) * 1024 : 0;
+  options.window = argc > 5 ? (uint32_t)atoi(argv[5]) : 0;
+
+  if (!mqtt_client_load_settings(argv[1], &connection_settings))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      connection_settings.client_id == NULL
+      || (options.response_topic = response
+          = response_topic(options.topic, connection_settings.client_id))
+          == NULL)
+  {
+    LOG_ERROR("A client id is needed to receive the acknowledgements");
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((sender_result = chunked_transfer_sender_init(&sender, &options)) != 0)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((result = mosquitto_lib_init()) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to initialize mosquitto: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (mosq = mqtt_client_new(false, &connection_settings, on_connect_with_subscribe, &obj))
+      == NULL)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (result = mosquitto_connect_bind_v5(
+           mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else
+  {
+    mosquitto_message_v5_callback_set(mosq, on_transfer_message);
+    mosquitto_publish_v5_callback_set(mosq, NULL);
+    if ((result = mosquitto_loop_start(mosq)) != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else
+    {
+      LOG_INFO(
+          CLIENT_LOG_TAG,
+          "Sending %s (%llu bytes in %u chunks) to %s",
+          options.path,
+          (unsigned long long)sender.size,
+          sender.chunk_count,
+          options.topic);
+      start_ns = now_ns();
+      if (chunked_transfer_sender_run(&sender, mosq) != 0)
+      {
+        LOG_ERROR("Transfer of %s did not complete", options.path);
+        result = MOSQ_ERR_UNKNOWN;
+      }
+      else
+      {
+        double elapsed = (now_ns() - start_ns) / 1e9;
+        LOG_INFO(
+            CLIENT_LOG_TAG,
+            "Sent %llu bytes in %.3f s (%.1f MB/s), %llu chunks resumed, %llu retransmitted",
+            (unsigned long long)sender.bytes_sent,
+            elapsed,
+            sender.bytes_sent / elapsed / 1e6,
+            (unsigned long long)sender.resumed_chunks,
+            (unsigned long long)sender.retransmits);
+      }
+    }
+  }
+
+  if (mosq != NULL)
+  {
+    mosquitto_disconnect_v5(mosq, result, NULL);
+    mosquitto_loop_stop(mosq, false);
+    mosquitto_destroy(mosq);
+  }
+  if (sender_result == 0)
+  {
+    chunked_transfer_sender_destroy(&sender);
+  }
+  free(response);
+  mosquitto_lib_cleanup();
+  return result;
+}
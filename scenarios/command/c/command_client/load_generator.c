@@ -0,0 +1,330 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uuid/uuid.h>
+
+#include "load_generator.h"
+#include "logging.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "protobuf_arena.h"
+#include "protobuf_rpc.h"
+#include "unlock_command.pb-c.h"
+
+#define COMMAND_CONTENT_TYPE "application/protobuf"
+#define QOS_LEVEL 1
+
+#define NS_PER_SEC 1000000000LL
+#define NS_PER_US 1000.0
+#define RESPONSE_ARENA_SIZE 1024
+#define MAX_REQUEST_PAYLOAD_LENGTH 256
+#define DRAIN_POLL_NS 1000000
+
+static const double reported_percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+
+static int64_t _now_ns(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void _sleep_until_ns(int64_t deadline_ns)
+{
+  struct timespec ts = { .tv_sec = deadline_ns / NS_PER_SEC, .tv_nsec = deadline_ns % NS_PER_SEC };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+}
+
+int load_generator_init(load_generator* generator, int rate, int timeout_sec)
+{
+  uuid_t run_id;
+
+  memset(generator, 0, sizeof(load_generator));
+  /* Enough slots for every request that can be in flight before it times out. */
+  generator->capacity = (uint32_t)rate * (uint32_t)(timeout_sec + 1) + 1;
+  generator->timeout_ns = (int64_t)timeout_sec * NS_PER_SEC;
+  generator->requests = calloc(generator->capacity, sizeof(load_generator_request));
+  if (generator->requests == NULL)
+  {
+    LOG_ERROR("Failed to allocate memory for pending requests.");
+    return -1;
+  }
+  if (memory_arena_init(&generator->response_arena, RESPONSE_ARENA_SIZE) != 0)
+  {
+    free(generator->requests);
+    generator->requests = NULL;
+    return -1;
+  }
+
+  uuid_generate(run_id);
+  memcpy(&generator->run_id, run_id, sizeof(generator->run_id));
+  latency_histogram_reset(&generator->latency);
+  pthread_mutex_init(&generator->lock, NULL);
+  return 0;
+}
+
+void load_generator_destroy(load_generator* generator)
+{
+  if (generator->requests != NULL)
+  {
+    free(generator->requests);
+    generator->requests = NULL;
+    memory_arena_destroy(&generator->response_arena);
+    pthread_mutex_destroy(&generator->lock);
+  }
+}
+
+/* Counts the requests that have waited longer than the timeout. The oldest pending request is
+ * always checked first, so this is O(1) amortized per request. */
+static void _expire_requests(load_generator* generator, int64_t now_ns)
+{
+  pthread_mutex_lock(&generator->lock);
+  while (generator->oldest_pending < generator->next_sequence)
+  {
+    load_generator_request* request
+        = &generator->requests[generator->oldest_pending % generator->capacity];
+    if (request->pending)
+    {
+      if (request->intended_send_time_ns + generator->timeout_ns > now_ns)
+      {
+        break;
+      }
+      request->pending = false;
+      generator->timed_out++;
+    }
+    generator->oldest_pending++;
+  }
+  pthread_mutex_unlock(&generator->lock);
+}
+
+static void _send_request(
+    load_generator* generator,
+    struct mosquitto* mosq,
+    const char* request_topic,
+    const char* response_topic,
+    UnlockRequest* request,
+    int64_t intended_send_time_ns)
+{
+  uint8_t payload_buf[MAX_REQUEST_PAYLOAD_LENGTH];
+  uint8_t correlation_data[LOAD_GENERATOR_CORRELATION_LENGTH];
+  mosquitto_property* proplist = NULL;
+  uint64_t sequence = generator->next_sequence;
+  int64_t wall_clock_ns = _now_ns(CLOCK_REALTIME);
+  size_t payload_len;
+  int rc;
+
+  request->when->seconds = wall_clock_ns / NS_PER_SEC;
+  request->when->nanos = (int32_t)(wall_clock_ns % NS_PER_SEC);
+  payload_len = unlock_request__get_packed_size(request);
+  if (payload_len > sizeof(payload_buf)
+      || unlock_request__pack(request, payload_buf) != payload_len)
+  {
+    LOG_ERROR("Failure serializing payload.");
+    generator->publish_errors++;
+    return;
+  }
+
+  memcpy(correlation_data, &generator->run_id, sizeof(generator->run_id));
+  memcpy(correlation_data + sizeof(generator->run_id), &sequence, sizeof(sequence));
+
+  /* Registered before publishing, the response can arrive before mosquitto_publish_v5 returns. */
+  pthread_mutex_lock(&generator->lock);
+  load_generator_request* pending = &generator->requests[sequence % generator->capacity];
+  pending->sequence = sequence;
+  pending->intended_send_time_ns = intended_send_time_ns;
+  pending->pending = true;
+  generator->next_sequence++;
+  generator->sent++;
+  pthread_mutex_unlock(&generator->lock);
+
+  if ((rc = mosquitto_property_add_string(&proplist, MQTT_PROP_RESPONSE_TOPIC, response_topic))
+          != MOSQ_ERR_SUCCESS
+      || (rc = mosquitto_property_add_string(
+              &proplist, MQTT_PROP_CONTENT_TYPE, COMMAND_CONTENT_TYPE))
+          != MOSQ_ERR_SUCCESS
+      || (rc = mosquitto_property_add_binary(
+              &proplist, MQTT_PROP_CORRELATION_DATA, correlation_data, sizeof(correlation_data)))
+          != MOSQ_ERR_SUCCESS
+      || (rc = protobuf_rpc_add_deadline(&proplist, (uint32_t)(generator->timeout_ns / NS_PER_SEC)))
+          != MOSQ_ERR_SUCCESS
+      || (rc = mosquitto_publish_v5(
+              mosq,
+              NULL,
+              request_topic,
+              (int)payload_len,
+              payload_buf,
+              QOS_LEVEL,
+              false,
+              proplist))
+          != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(rc));
+    generator->publish_errors++;
+  }
+
+  mosquitto_property_free_all(&proplist);
+}
+
+static void _print_report(load_generator* generator, int64_t elapsed_ns)
+{
+  pthread_mutex_lock(&generator->lock);
+  uint64_t completed = generator->received + generator->timed_out;
+
+  LOG_INFO(CLIENT_LOG_TAG, "Load test results:");
+  printf(
+      "\tSent: %llu (%.1f requests/s)\n",
+      (unsigned long long)generator->sent,
+      elapsed_ns > 0 ? (double)generator->sent * NS_PER_SEC / (double)elapsed_ns : 0);
+  printf("\tReceived: %llu\n", (unsigned long long)generator->received);
+  printf(
+      "\tTimed out: %llu (%.4f%%)\n",
+      (unsigned long long)generator->timed_out,
+      completed > 0 ? 100.0 * (double)generator->timed_out / (double)completed : 0);
+  printf("\tFailed: %llu\n", (unsigned long long)generator->failed);
+  printf("\tLate responses: %llu\n", (unsigned long long)generator->late);
+  printf("\tPublish errors: %llu\n", (unsigned long long)generator->publish_errors);
+  printf("\tMax send lag: %.1f us\n", (double)generator->max_send_lag_ns / NS_PER_US);
+  printf("\tLatency (us, from intended send time):\n");
+  for (size_t i = 0; i < sizeof(reported_percentiles) / sizeof(reported_percentiles[0]); i++)
+  {
+    printf(
+        "\t\tp%-6g %.1f\n",
+        reported_percentiles[i],
+        (double)latency_histogram_value_at_percentile(
+            &generator->latency, reported_percentiles[i])
+            / NS_PER_US);
+  }
+  printf("\t\tmax     %.1f\n", (double)generator->latency.max / NS_PER_US);
+  printf("\t\tmean    %.1f\n", latency_histogram_mean(&generator->latency) / NS_PER_US);
+  pthread_mutex_unlock(&generator->lock);
+}
+
+void load_generator_run(
+    load_generator* generator,
+    struct mosquitto* mosq,
+    const char* request_topic,
+    const char* response_topic,
+    char* requested_from,
+    int rate,
+    int duration_sec)
+{
+  UnlockRequest proto_unlock_request = UNLOCK_REQUEST__INIT;
+  Google__Protobuf__Timestamp proto_timestamp = GOOGLE__PROTOBUF__TIMESTAMP__INIT;
+  uint64_t request_count = (uint64_t)rate * (uint64_t)duration_sec;
+  int64_t interval_ns = NS_PER_SEC / rate;
+  int64_t start_ns;
+  int64_t now_ns;
+  int64_t last_intended_ns = 0;
+
+  proto_unlock_request.requestedfrom = requested_from;
+  proto_unlock_request.when = &proto_timestamp;
+
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Sending %d unlock requests/s for %d s to %s",
+      rate,
+      duration_sec,
+      request_topic);
+
+  start_ns = _now_ns(CLOCK_MONOTONIC);
+  for (uint64_t i = 0; i < request_count && keep_running; i++)
+  {
+    /* The schedule is fixed up front: if sending falls behind, requests go out back to back until
+     * it catches up, and their latency still counts from when they should have been sent. */
+    int64_t intended_ns = start_ns + (int64_t)i * interval_ns;
+    _sleep_until_ns(intended_ns);
+    now_ns = _now_ns(CLOCK_MONOTONIC);
+    if (now_ns - intended_ns > generator->max_send_lag_ns)
+    {
+      generator->max_send_lag_ns = now_ns - intended_ns;
+    }
+
+    _expire_requests(generator, now_ns);
+    _send_request(
+        generator, mosq, request_topic, response_topic, &proto_unlock_request, intended_ns);
+    last_intended_ns = intended_ns;
+  }
+  now_ns = _now_ns(CLOCK_MONOTONIC);
+
+  /* Wait for the outstanding responses, or until the last request times out. */
+  while (keep_running && now_ns < last_intended_ns + generator->timeout_ns)
+  {
+    _expire_requests(generator, now_ns);
+    pthread_mutex_lock(&generator->lock);
+    bool done = generator->received + generator->timed_out == generator->sent;
+    pthread_mutex_unlock(&generator->lock);
+    if (done)
+    {
+      break;
+    }
+    _sleep_until_ns(now_ns + DRAIN_POLL_NS);
+    now_ns = _now_ns(CLOCK_MONOTONIC);
+  }
+  _expire_requests(generator, INT64_MAX);
+
+  _print_report(generator, now_ns - start_ns);
+}
+
+void load_generator_handle_response(
+    load_generator* generator,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  int64_t now_ns = _now_ns(CLOCK_MONOTONIC);
+  void* correlation_data;
+  uint16_t correlation_data_len;
+  uint64_t run_id;
+  uint64_t sequence;
+
+  if (mosquitto_property_read_binary(
+          props, MQTT_PROP_CORRELATION_DATA, &correlation_data, &correlation_data_len, false)
+      == NULL)
+  {
+    LOG_ERROR("Message does not have a correlation data property");
+    return;
+  }
+  if (correlation_data_len != LOAD_GENERATOR_CORRELATION_LENGTH)
+  {
+    free(correlation_data);
+    return;
+  }
+  memcpy(&run_id, correlation_data, sizeof(run_id));
+  memcpy(&sequence, (uint8_t*)correlation_data + sizeof(run_id), sizeof(sequence));
+  free(correlation_data);
+  if (run_id != generator->run_id)
+  {
+    return;
+  }
+
+  ProtobufCAllocator allocator = protobuf_arena_allocator(&generator->response_arena);
+  UnlockResponse* unlock_response
+      = unlock_response__unpack(&allocator, message->payloadlen, message->payload);
+  bool succeed = unlock_response != NULL && unlock_response->succeed;
+  memory_arena_reset(&generator->response_arena);
+
+  pthread_mutex_lock(&generator->lock);
+  load_generator_request* request = &generator->requests[sequence % generator->capacity];
+  if (request->pending && request->sequence == sequence)
+  {
+    request->pending = false;
+    generator->received++;
+    if (!succeed)
+    {
+      generator->failed++;
+    }
+    latency_histogram_record(
+        &generator->latency, (uint64_t)(now_ns - request->intended_send_time_ns));
+  }
+  else
+  {
+    generator->late++;
+  }
+  pthread_mutex_unlock(&generator->lock);
+}
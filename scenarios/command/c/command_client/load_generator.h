@@ -0,0 +1,103 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency_histogram.h"
+#include "memory_arena.h"
+#include "mosquitto.h"
+
+/* Correlation data of load generator requests: a random run id followed by the sequence number,
+ * so responses cached by the server for a previous run are never mistaken for this one. */
+#define LOAD_GENERATOR_CORRELATION_LENGTH 16
+
+typedef struct load_generator_request
+{
+  uint64_t sequence;
+  int64_t intended_send_time_ns;
+  bool pending;
+} load_generator_request;
+
+/*
+ * Open-loop load generator for the unlock command. Requests are sent on a fixed schedule that does
+ * not wait for responses, and latency is measured from the time a request was scheduled to be sent
+ * rather than the time it was actually sent, so a stalled sender does not hide the delay it caused
+ * (coordinated omission).
+ */
+typedef struct load_generator
+{
+  pthread_mutex_t lock;
+  load_generator_request* requests;
+  uint32_t capacity;
+  uint64_t run_id;
+  uint64_t next_sequence;
+  uint64_t oldest_pending;
+  int64_t timeout_ns;
+  latency_histogram latency;
+  memory_arena response_arena;
+  uint64_t sent;
+  uint64_t received;
+  uint64_t timed_out;
+  uint64_t failed;
+  uint64_t late;
+  uint64_t publish_errors;
+  int64_t max_send_lag_ns;
+} load_generator;
+
+/**
+ * @brief Initializes a load_generator. The load_generator must be freed with
+ * load_generator_destroy().
+ *
+ * @param generator The load_generator to initialize.
+ * @param rate The number of requests to send per second.
+ * @param timeout_sec How long to wait for a response before counting a request as timed out.
+ * @return int 0 on success, -1 on failure.
+ */
+int load_generator_init(load_generator* generator, int rate, int timeout_sec);
+
+/**
+ * @brief Sends unlock requests at a fixed rate, waits for the outstanding responses and prints the
+ * latency report. Returns early if keep_running is cleared.
+ *
+ * @param generator The load_generator to run.
+ * @param mosq The connected mosquitto client, with its loop running.
+ * @param request_topic The topic to send the requests to.
+ * @param response_topic The topic the responses are expected on.
+ * @param requested_from The requestedFrom field of the requests.
+ * @param rate The number of requests to send per second.
+ * @param duration_sec How long to send requests for.
+ */
+void load_generator_run(
+    load_generator* generator,
+    struct mosquitto* mosq,
+    const char* request_topic,
+    const char* response_topic,
+    char* requested_from,
+    int rate,
+    int duration_sec);
+
+/**
+ * @brief Records the latency of a response. Called from the mosquitto loop thread.
+ *
+ * @param generator The load_generator that sent the request.
+ * @param message The received response.
+ * @param props The properties of the received response.
+ */
+void load_generator_handle_response(
+    load_generator* generator,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props);
+
+/**
+ * @brief Frees the memory of a load_generator.
+ *
+ * @param generator The load_generator to free.
+ */
+void load_generator_destroy(load_generator* generator);
+
+#endif /* LOAD_GENERATOR_H */
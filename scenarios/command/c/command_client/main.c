@@ -4,18 +4,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <uuid/uuid.h>
 
+#include "load_generator.h"
 #include "logging.h"
+#include "memory_arena.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
 #include "mqtt_protocol.h"
 #include "mqtt_setup.h"
+#include "protobuf_arena.h"
+#include "protobuf_rpc.h"
+#include "topic_template.h"
 #include "unlock_command.pb-c.h"
 
 #define COMMAND_TARGET_CLIENT_ID "vehicle03"
-#define COMMAND_TARGET_CLIENT_ID_LEN 9
+#define COMMAND_METHOD_NAME "unlock"
 #define COMMAND_CONTENT_TYPE "application/protobuf"
 #define COMMAND_TIMEOUT_SEC 10
 #define COMMAND_MIN_RATE_SEC 2
@@ -25,6 +31,16 @@
 
 #define UUID_LENGTH 37
 
+// Setting COMMAND_LOAD_RATE to a number of requests per second replaces the interactive loop with
+// an open-loop latency benchmark of the unlock command.
+#define LOAD_RATE_ENV "COMMAND_LOAD_RATE"
+#define LOAD_DURATION_ENV "COMMAND_LOAD_DURATION_SEC"
+#define DEFAULT_LOAD_DURATION_SEC 10
+
+// Each arena only needs to hold a single message. Requests are packed on the main thread and
+// responses are unpacked on the mosquitto loop thread, so each thread gets its own arena.
+#define MESSAGE_ARENA_SIZE 1024
+
 #define CONTINUE_IF_ERROR(rc)                                            \
   if (true)                                                              \
   {                                                                      \
@@ -33,7 +49,7 @@
       LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(rc)); \
       mosquitto_property_free_all(&proplist);                            \
       proplist = NULL;                                                   \
-      free(payload_buf);                                                 \
+      memory_arena_reset(&request_arena);                                \
       payload_buf = NULL;                                                \
       continue;                                                          \
     }                                                                    \
@@ -41,16 +57,14 @@
 
 static uuid_t pending_correlation_id;
 static time_t last_command_sent_time;
-static char response_topic[COMMAND_TARGET_CLIENT_ID_LEN + 34];
-
-char* get_response_topic()
-{
-  if (strlen(response_topic) == 0)
-  {
-    sprintf(response_topic, "vehicles/%s/command/unlock/response", COMMAND_TARGET_CLIENT_ID);
-  }
-  return response_topic;
-}
+static memory_arena request_arena;
+static memory_arena response_arena;
+static load_generator generator;
+static int load_rate;
+static int load_duration_sec;
+// Topics of the unlock method of the target, from the templates of protobuf_rpc.h.
+static char request_topic[TOPIC_SIZE(PROTOBUF_RPC_REQUEST_TOPIC)];
+static char response_topic[TOPIC_SIZE(PROTOBUF_RPC_RESPONSE_TOPIC)];
 
 // Custom callback for when a message is received.
 // prints the message information from the command response and validates that the correlation data
@@ -62,10 +76,11 @@ void handle_message(
 {
   void* correlation_data;
   uint16_t correlation_data_len;
+  ProtobufCAllocator allocator = protobuf_arena_allocator(&response_arena);
 
-  // deserialize the protobuf payload
+  // deserialize the protobuf payload into the arena, it is released by resetting the arena
   UnlockResponse* unlock_response
-      = unlock_response__unpack(NULL, message->payloadlen, message->payload);
+      = unlock_response__unpack(&allocator, message->payloadlen, message->payload);
   if (unlock_response == NULL)
   {
     LOG_ERROR("Failure deserializing protobuf payload");
@@ -84,7 +99,7 @@ void handle_message(
       == NULL)
   {
     LOG_ERROR("Message does not have a correlation data property");
-    unlock_response__free_unpacked(unlock_response, NULL);
+    memory_arena_reset(&response_arena);
     unlock_response = NULL;
     return;
   }
@@ -104,10 +119,56 @@ void handle_message(
 
   free(correlation_data);
   correlation_data = NULL;
-  unlock_response__free_unpacked(unlock_response, NULL);
+  memory_arena_reset(&response_arena);
   unlock_response = NULL;
 }
 
+// Callback for responses in load mode, only records the latency of the response.
+void handle_load_response(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  load_generator_handle_response(&generator, message, props);
+}
+
+// Reads the load mode settings. Must be called after mqtt_client_init() has loaded the .env file
+// and before connecting, so every response goes to the load mode handler.
+int load_mode_init(mqtt_client_obj* obj)
+{
+  if (!set_int_connection_setting(&load_rate, LOAD_RATE_ENV, 0)
+      || !set_int_connection_setting(
+          &load_duration_sec, LOAD_DURATION_ENV, DEFAULT_LOAD_DURATION_SEC))
+  {
+    return -1;
+  }
+  if (load_rate <= 0)
+  {
+    return 0;
+  }
+  obj->handle_message = handle_load_response;
+  return load_generator_init(&generator, load_rate, COMMAND_TIMEOUT_SEC);
+}
+
+// Fills the request and response topics of the unlock method of the target.
+int command_topics_init(void)
+{
+  if (TOPIC_FORMAT(
+          request_topic, PROTOBUF_RPC_REQUEST_TOPIC, COMMAND_TARGET_CLIENT_ID, COMMAND_METHOD_NAME)
+          < 0
+      || TOPIC_FORMAT(
+             response_topic,
+             PROTOBUF_RPC_RESPONSE_TOPIC,
+             COMMAND_TARGET_CLIENT_ID,
+             COMMAND_METHOD_NAME)
+          < 0)
+  {
+    LOG_ERROR("Invalid command topics for target %s.", COMMAND_TARGET_CLIENT_ID);
+    return -1;
+  }
+  return 0;
+}
+
 /* Callback called when the client receives a CONNACK message from the broker and we want to
  * subscribe on connect. */
 void on_connect_with_subscribe(
@@ -125,7 +186,7 @@ void on_connect_with_subscribe(
    * connection drops and is automatically resumed by the client, then the
    * subscriptions will be recreated when the client reconnects. */
   if (keep_running
-      && (result = mosquitto_subscribe_v5(mosq, NULL, get_response_topic(), QOS_LEVEL, 0, NULL))
+      && (result = mosquitto_subscribe_v5(mosq, NULL, response_topic, QOS_LEVEL, 0, NULL))
           != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
@@ -150,10 +211,26 @@ int main(int argc, char* argv[])
   obj.mqtt_version = MQTT_VERSION;
   obj.handle_message = handle_message;
 
-  if ((mosq = mqtt_client_init(true, argv[1], on_connect_with_subscribe, &obj)) == NULL)
+  if (command_topics_init() != 0)
+  {
+    mosq = NULL;
+    result = MOSQ_ERR_INVAL;
+  }
+  else if (
+      memory_arena_init(&request_arena, MESSAGE_ARENA_SIZE) != 0
+      || memory_arena_init(&response_arena, MESSAGE_ARENA_SIZE) != 0)
+  {
+    mosq = NULL;
+    result = MOSQ_ERR_NOMEM;
+  }
+  else if ((mosq = mqtt_client_init(true, argv[1], on_connect_with_subscribe, &obj)) == NULL)
   {
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (load_mode_init(&obj) != 0)
+  {
+    result = MOSQ_ERR_INVAL;
+  }
   else if (
       (result = mosquitto_connect_bind_v5(
            mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
@@ -167,18 +244,26 @@ int main(int argc, char* argv[])
     LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (load_rate > 0)
+  {
+    load_generator_run(
+        &generator,
+        mosq,
+        request_topic,
+        response_topic,
+        obj.client_id,
+        load_rate,
+        load_duration_sec);
+  }
   else
   {
-    char pub_topic[COMMAND_TARGET_CLIENT_ID_LEN + 33];
-    sprintf(pub_topic, "vehicles/%s/command/unlock/request", COMMAND_TARGET_CLIENT_ID);
-
     // Set up protobuf unlock payload
     UnlockRequest proto_unlock_request = UNLOCK_REQUEST__INIT;
     void* payload_buf;
     size_t proto_payload_len;
     Google__Protobuf__Timestamp proto_timestamp = GOOGLE__PROTOBUF__TIMESTAMP__INIT;
     proto_unlock_request.requestedfrom = obj.client_id;
-    proto_timestamp.nanos = 0;
+    struct timespec now;
 
     mosquitto_property* proplist = NULL;
     time_t current_time;
@@ -209,10 +294,12 @@ int main(int argc, char* argv[])
       {
         last_command_sent_time = current_time;
 
-        proto_timestamp.seconds = current_time;
+        clock_gettime(CLOCK_REALTIME, &now);
+        proto_timestamp.seconds = now.tv_sec;
+        proto_timestamp.nanos = (int32_t)now.tv_nsec;
         proto_unlock_request.when = &proto_timestamp;
         proto_payload_len = unlock_request__get_packed_size(&proto_unlock_request);
-        payload_buf = malloc(proto_payload_len);
+        payload_buf = memory_arena_alloc(&request_arena, proto_payload_len);
 
         if (payload_buf == NULL)
         {
@@ -223,13 +310,13 @@ int main(int argc, char* argv[])
         if (unlock_request__pack(&proto_unlock_request, payload_buf) != proto_payload_len)
         {
           LOG_ERROR("Failure serializing payload.");
-          free(payload_buf);
+          memory_arena_reset(&request_arena);
           payload_buf = NULL;
           continue;
         }
 
         CONTINUE_IF_ERROR(mosquitto_property_add_string(
-            &proplist, MQTT_PROP_RESPONSE_TOPIC, get_response_topic()));
+            &proplist, MQTT_PROP_RESPONSE_TOPIC, response_topic));
         CONTINUE_IF_ERROR(
             mosquitto_property_add_string(&proplist, MQTT_PROP_CONTENT_TYPE, COMMAND_CONTENT_TYPE));
 
@@ -237,6 +324,8 @@ int main(int argc, char* argv[])
 
         CONTINUE_IF_ERROR(mosquitto_property_add_binary(
             &proplist, MQTT_PROP_CORRELATION_DATA, pending_correlation_id, UUID_LENGTH));
+        // the server drops the request instead of executing it once the client stops waiting
+        CONTINUE_IF_ERROR(protobuf_rpc_add_deadline(&proplist, COMMAND_TIMEOUT_SEC));
 
         LOG_INFO(
             CLIENT_LOG_TAG,
@@ -245,12 +334,19 @@ int main(int argc, char* argv[])
             asctime(localtime(&proto_unlock_request.when->seconds)));
 
         CONTINUE_IF_ERROR(mosquitto_publish_v5(
-            mosq, NULL, pub_topic, proto_payload_len, payload_buf, QOS_LEVEL, false, proplist));
+            mosq,
+            NULL,
+            request_topic,
+            proto_payload_len,
+            payload_buf,
+            QOS_LEVEL,
+            false,
+            proplist));
 
         mosquitto_property_free_all(&proplist);
         proplist = NULL;
 
-        free(payload_buf);
+        memory_arena_reset(&request_arena);
         payload_buf = NULL;
       }
     }
@@ -262,6 +358,15 @@ int main(int argc, char* argv[])
     mosquitto_loop_stop(mosq, false);
     mosquitto_destroy(mosq);
   }
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Response arena: %zu allocations, %zu heap fallbacks, %zu bytes peak",
+      response_arena.alloc_count,
+      response_arena.overflow_count,
+      response_arena.high_water_mark);
+  memory_arena_destroy(&request_arena);
+  memory_arena_destroy(&response_arena);
+  load_generator_destroy(&generator);
   mosquitto_lib_cleanup();
   return result;
 }
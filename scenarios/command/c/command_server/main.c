@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "logging.h"
 #include "mosquitto.h"
@@ -12,137 +13,104 @@
 #include "mqtt_protocol.h"
 #include "mqtt_setup.h"
 
+#include "protobuf_rpc.h"
 #include "unlock_command.pb-c.h"
 
 #define QOS_LEVEL 1
 #define MQTT_VERSION MQTT_PROTOCOL_V5
 
-#define COMMAND_CONTENT_TYPE "application/protobuf"
-
-#define RETURN_IF_ERROR(rc)                                                    \
-  do                                                                           \
-  {                                                                            \
-    if (rc != MOSQ_ERR_SUCCESS)                                                \
-    {                                                                          \
-      LOG_ERROR("Failure while sending response: %s", mosquitto_strerror(rc)); \
-      free(response_topic);                                                    \
-      response_topic = NULL;                                                   \
-      free(correlation_data);                                                  \
-      correlation_data = NULL;                                                 \
-      mosquitto_property_free_all(&response_props);                            \
-      response_props = NULL;                                                   \
-      free(payload_buf);                                                       \
-      payload_buf = NULL;                                                      \
-      return;                                                                  \
-    }                                                                          \
-  } while (0)
-
-// Function to execute unlock request. For this sample, it just prints the request information.
-bool handle_unlock(char* payload, int payload_length)
+// Requests are unpacked into this arena, which only needs to hold a single request.
+#define REQUEST_ARENA_SIZE 1024
+
+// Responses are kept long enough to answer QoS 1 redeliveries after a reconnect or broker failover.
+#define RESPONSE_CACHE_CAPACITY 1024
+#define RESPONSE_CACHE_TTL_SEC 300
+
+// When set, the server joins this shared subscription group and serves the commands of every
+// vehicle, with the broker load balancing requests between all servers of the group.
+#define SHARE_GROUP_ENV "COMMAND_SHARE_GROUP"
+#define ALL_VEHICLES "+"
+
+static protobuf_rpc_server rpc_server;
+static memory_arena request_arena;
+static response_cache sent_responses;
+
+// Implementation of the Unlock method of the Commands service. For this sample, it just prints the
+// request information.
+static void command_server__unlock(
+    Commands_Service* service,
+    const UnlockRequest* input,
+    UnlockResponse_Closure closure,
+    void* closure_data)
 {
-  UnlockRequest* unlock_request = unlock_request__unpack(NULL, payload_length, payload);
-  if (unlock_request == NULL)
-  {
-    LOG_ERROR("Failure deserializing protobuf payload");
-    return false;
-  }
-  else
-  {
-    printf(
-        "\tUnlock request sent from %s at %s",
-        unlock_request->requestedfrom,
-        asctime(localtime(&unlock_request->when->seconds)));
-    LOG_INFO(SERVER_LOG_TAG, "Vehicle successfully unlocked");
-    unlock_request__free_unpacked(unlock_request, NULL);
-    return true;
-  }
+  UnlockResponse proto_unlock_response = UNLOCK_RESPONSE__INIT;
+  const protobuf_rpc_request_context* context = (protobuf_rpc_request_context*)closure_data;
+
+  printf(
+      "\tUnlock request for %.*s sent from %s at %s",
+      (int)context->client_id_length,
+      context->client_id,
+      input->requestedfrom,
+      input->when != NULL ? asctime(localtime(&input->when->seconds)) : "unknown time\n");
+  LOG_INFO(SERVER_LOG_TAG, "Vehicle successfully unlocked");
+
+  proto_unlock_response.succeed = true;
+  LOG_INFO(
+      SERVER_LOG_TAG,
+      "Sending unlock response (on topic %s):\n\tSucceed: %s",
+      context->response_topic,
+      proto_unlock_response.succeed ? "True" : "False");
+  closure(&proto_unlock_response, closure_data);
 }
 
-// Custom callback for when a message is received.
-// Executes vehicle unlock and sends the response.
-void handle_message(
-    struct mosquitto* mosq,
-    const struct mosquitto_message* message,
-    const mosquitto_property* props)
-{
-  char* response_topic;
-  void* correlation_data;
-  uint16_t correlation_data_len;
-  mosquitto_property* response_props = NULL;
+static Commands_Service commands_service = COMMANDS__INIT(command_server__);
 
-  bool command_succeed = handle_unlock(message->payload, message->payloadlen);
+// Fills the response sent for requests that can't be unpacked. Unlock is the only method of the
+// Commands service.
+static void command_server_init_error_response(
+    const protobuf_rpc_method* method,
+    ProtobufCMessage* output)
+{
+  UnlockResponse* unlock_response = (UnlockResponse*)output;
 
-  UnlockResponse proto_unlock_response = UNLOCK_RESPONSE__INIT;
-  void* payload_buf;
-  unsigned proto_payload_len;
-  proto_unlock_response.succeed = command_succeed;
-  if (command_succeed == false)
-  {
-    proto_unlock_response.errordetail = "Error executing unlock request";
-  }
-  proto_payload_len = unlock_response__get_packed_size(&proto_unlock_response);
-  payload_buf = malloc(proto_payload_len);
-  if (payload_buf == NULL)
-  {
-    LOG_ERROR("Failed to allocate memory for payload buffer.");
-    return;
-  }
+  unlock_response->succeed = false;
+  unlock_response->errordetail = "Error executing unlock request";
+  printf("\tError: %s\n", unlock_response->errordetail);
+}
 
-  if (unlock_response__pack(&proto_unlock_response, payload_buf) != proto_payload_len)
-  {
-    LOG_ERROR("Failure serializing payload.");
-    free(payload_buf);
-    payload_buf = NULL;
-    return;
-  }
-  if (mosquitto_property_read_string(props, MQTT_PROP_RESPONSE_TOPIC, &response_topic, false)
-      == NULL)
-  {
-    LOG_ERROR("Message does not have a response topic property");
-    return;
-  }
+static int command_server_init(const char* client_id)
+{
+  rpc_server.arena = &request_arena;
+  rpc_server.response_cache = &sent_responses;
+  rpc_server.share_group = getenv(SHARE_GROUP_ENV);
+  rpc_server.init_error_response = command_server_init_error_response;
 
-  if (mosquitto_property_read_binary(
-          props, MQTT_PROP_CORRELATION_DATA, &correlation_data, &correlation_data_len, false)
-      == NULL)
+  if (rpc_server.share_group != NULL)
   {
-    LOG_ERROR("Message does not have a correlation data property");
-    return;
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "Serving commands for all vehicles in shared subscription group %s",
+        rpc_server.share_group);
   }
 
-  RETURN_IF_ERROR(mosquitto_property_add_binary(
-      &response_props, MQTT_PROP_CORRELATION_DATA, correlation_data, correlation_data_len));
-  RETURN_IF_ERROR(
-      mosquitto_property_add_string(&response_props, MQTT_PROP_CONTENT_TYPE, COMMAND_CONTENT_TYPE));
+  return protobuf_rpc_server_init(
+      &rpc_server,
+      (ProtobufCService*)&commands_service,
+      rpc_server.share_group != NULL ? ALL_VEHICLES : client_id,
+      QOS_LEVEL);
+}
 
-  LOG_INFO(
-      SERVER_LOG_TAG,
-      "Sending unlock response (on topic %s):\n\tSucceed: %s",
-      response_topic,
-      proto_unlock_response.succeed ? "True" : "False");
-  if (command_succeed == false)
+// Custom callback for when a message is received.
+// Dispatches the request to the Commands service, which executes it and sends the response.
+void handle_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  if (!protobuf_rpc_server_handle_message(&rpc_server, mosq, message, props))
   {
-    printf("\tError: %s\n", proto_unlock_response.errordetail);
+    LOG_WARNING("Received message on unexpected topic %s", message->topic);
   }
-
-  RETURN_IF_ERROR(mosquitto_publish_v5(
-      mosq,
-      NULL,
-      response_topic,
-      proto_payload_len,
-      payload_buf,
-      QOS_LEVEL,
-      false,
-      response_props));
-
-  free(response_topic);
-  response_topic = NULL;
-  free(correlation_data);
-  correlation_data = NULL;
-  mosquitto_property_free_all(&response_props);
-  response_props = NULL;
-  free(payload_buf);
-  payload_buf = NULL;
 }
 
 /* Callback called when the client receives a CONNACK message from the broker and we want to
@@ -157,16 +125,12 @@ void on_connect_with_subscribe(
   on_connect(mosq, obj, reason_code, flags, props);
 
   int result;
-  mqtt_client_obj* client_obj = (mqtt_client_obj*)obj;
-  char sub_topic[strlen(client_obj->client_id) + 33];
-  sprintf(sub_topic, "vehicles/%s/command/unlock/request", client_obj->client_id);
 
   /* Making subscriptions in the on_connect() callback means that if the
    * connection drops and is automatically resumed by the client, then the
    * subscriptions will be recreated when the client reconnects. */
   if (keep_running
-      && (result = mosquitto_subscribe_v5(mosq, NULL, sub_topic, QOS_LEVEL, 0, NULL))
-          != MOSQ_ERR_SUCCESS)
+      && (result = protobuf_rpc_server_subscribe(&rpc_server, mosq)) != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
     keep_running = 0;
@@ -194,6 +158,22 @@ int main(int argc, char* argv[])
   {
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (
+      memory_arena_init(&request_arena, REQUEST_ARENA_SIZE) != 0
+      || response_cache_init(
+             &sent_responses,
+             RESPONSE_CACHE_CAPACITY,
+             PROTOBUF_RPC_RESPONSE_BUFFER_SIZE,
+             RESPONSE_CACHE_TTL_SEC)
+          != 0)
+  {
+    result = MOSQ_ERR_NOMEM;
+  }
+  else if (command_server_init(obj.client_id) != 0)
+  {
+    LOG_ERROR("Failed to initialize the RPC server.");
+    result = MOSQ_ERR_UNKNOWN;
+  }
   else if (
       (result = mosquitto_connect_bind_v5(
            mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
@@ -211,6 +191,7 @@ int main(int argc, char* argv[])
   {
     while (keep_running)
     {
+      sleep(1);
     }
   }
 
@@ -220,6 +201,32 @@ int main(int argc, char* argv[])
     mosquitto_loop_stop(mosq, false);
     mosquitto_destroy(mosq);
   }
+  if (rpc_server.expired_count > 0)
+  {
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "Dropped %llu requests received after their deadline",
+        (unsigned long long)rpc_server.expired_count);
+  }
+  protobuf_rpc_server_destroy(&rpc_server);
+  if (request_arena.alloc_count > 0)
+  {
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "Request arena: %zu allocations, %zu heap fallbacks, %zu bytes peak",
+        request_arena.alloc_count,
+        request_arena.overflow_count,
+        request_arena.high_water_mark);
+  }
+  memory_arena_destroy(&request_arena);
+  if (sent_responses.hits > 0)
+  {
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "Response cache: %zu redelivered requests answered from the cache",
+        sent_responses.hits);
+  }
+  response_cache_destroy(&sent_responses);
   mosquitto_lib_cleanup();
   return result;
 }
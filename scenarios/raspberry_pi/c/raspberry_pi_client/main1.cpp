@@ -1,67 +1,147 @@
+#include <chrono>
 #include <iostream>
+#include <memory_resource>
 #include <string>
-#include <thread>
-#include <chrono>
+#include <vector>
 
-#include "./../sensors/bme280.c"
 #include "./../sensors/bme280.h"
+#include "window_aggregator.h"
+#include "allocation_guard.h"
 #include "logging.h"
 #include "mosquitto.h"
-#include "mqtt_callbacks.h"
+#include "mqtt_coroutines.h"
 #include "mqtt_setup.h"
 
 constexpr char PUB_TOPIC[] = "devices/rasp";
 constexpr int QOS_LEVEL = 1;
 constexpr int MQTT_VERSION = MQTT_PROTOCOL_V311;
 
-int main(int argc, char* argv[])
+// The sensor is read every SAMPLE_INTERVAL_MS and one summary of the readings is published every
+// WINDOW_SEC, instead of publishing every reading.
+constexpr int DEFAULT_SAMPLE_INTERVAL_MS = 100;
+constexpr int DEFAULT_WINDOW_SEC = 5;
+constexpr size_t MAX_PAYLOAD_LENGTH = 512;
+// Memory of the coroutine frames and of the client, allocated at startup. Flows publishing
+// summaries take about 1 KiB each while they wait for their PUBACK.
+constexpr int DEFAULT_MEMORY_POOL_KB = 64;
+
+// Held in the frame of the flow publishing it rather than on the heap.
+struct SummaryPayload {
+    char data[MAX_PAYLOAD_LENGTH];
+    int length;
+};
+
+// Runs as its own flow, so sampling keeps its pace while the summary waits for its PUBACK.
+Task<> publishSummary(CoroutineClient& client, SummaryPayload payload, SamplingStats& stats)
 {
-    std::string payload;
-    struct mosquitto* mosq;
-    int result = MOSQ_ERR_SUCCESS;
+    co_await client.publish(PUB_TOPIC, std::string_view(payload.data, payload.length), QOS_LEVEL);
+    stats.published++;
+}
 
-    mqtt_client_obj obj = { 0 };
-    obj.mqtt_version = MQTT_VERSION;
+// Stops sampling and sets result when a summary doesn't fit in its payload.
+Task<> sample(CoroutineClient& client, Bme280Reader& reader, int sampleIntervalMs, int windowSec, SamplingStats& stats, int& result)
+{
+    SummaryPayload summary;
+    WindowAggregator window;
 
-    try {
-        mosq = mqtt_client_init(true, argv[1], on_connect, &obj);
-        if (!mosq) {
-            throw std::runtime_error("Failed to initialize MQTT client.");
+    if (co_await client.connect() != 0) {
+        co_return;
+    }
+
+    auto nextSample = std::chrono::steady_clock::now();
+    auto windowEnd = nextSample + std::chrono::seconds(windowSec);
+    while (keep_running) {
+        co_await client.sleepUntil(nextSample);
+        nextSample += std::chrono::milliseconds(sampleIntervalMs);
+        double cpuStart = SamplingStats::threadCpuSeconds();
+
+        Bme280Data reading;
+        stats.samples++;
+        if (bme280Read(&reader, &reading) == EXIT_SUCCESS) {
+            window.add(reading);
+        } else {
+            stats.readErrors++;
         }
 
-        result = mosquitto_connect_bind_v5(mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, nullptr, nullptr);
-        if (result != MOSQ_ERR_SUCCESS) {
-            throw std::runtime_error("Failed to connect: " + std::string(mosquitto_strerror(result)));
+        if (std::chrono::steady_clock::now() >= windowEnd && window.count() > 0) {
+            summary.length = window.format(summary.data, sizeof(summary.data), windowSec);
+            window.reset();
+            if (summary.length < 0) {
+                LOG_ERROR("Summary does not fit in the payload.");
+                result = MOSQ_ERR_UNKNOWN;
+                co_return;
+            }
+
+            client.spawn(publishSummary(client, summary, stats));
+        }
+        while (std::chrono::steady_clock::now() >= windowEnd) {
+            windowEnd += std::chrono::seconds(windowSec);
         }
+        stats.cpuSeconds += SamplingStats::threadCpuSeconds() - cpuStart;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    char sampleIntervalEnv[] = "SAMPLE_INTERVAL_MS";
+    char windowEnv[] = "WINDOW_SEC";
+    char memoryPoolEnv[] = "MEMORY_POOL_KB";
+    int sampleIntervalMs;
+    int windowSec;
+    int memoryPoolKb;
+    mqtt_client_connection_settings settings;
+    int result = MOSQ_ERR_SUCCESS;
+    Bme280Reader reader;
+    bool sensorOpened = false;
+    SamplingStats stats;
 
-        result = mosquitto_loop_start(mosq);
-        if (result != MOSQ_ERR_SUCCESS) {
-            throw std::runtime_error("Failure starting mosquitto loop: " + std::string(mosquitto_strerror(result)));
+    try {
+        if (!mqtt_client_load_settings(argv[1], &settings) || mosquitto_lib_init() != MOSQ_ERR_SUCCESS) {
+            throw std::runtime_error("Failed to initialize MQTT client.");
         }
 
-        while (keep_running) {
-            Bme280Data bme280 = readBME280();
+        if (!set_int_connection_setting(&sampleIntervalMs, sampleIntervalEnv, DEFAULT_SAMPLE_INTERVAL_MS)
+            || !set_int_connection_setting(&windowSec, windowEnv, DEFAULT_WINDOW_SEC)
+            || !set_int_connection_setting(&memoryPoolKb, memoryPoolEnv, DEFAULT_MEMORY_POOL_KB)
+            || sampleIntervalMs <= 0 || windowSec <= 0 || memoryPoolKb <= 0) {
+            throw std::runtime_error("Invalid sampling settings.");
+        }
 
-            payload = "Temp: " + std::to_string(bme280.temperature) + "°C Pressure: " + std::to_string(bme280.pressure) + " hPa Humidity: " + std::to_string(bme280.humidity) + "%.";
+        // Everything the event loop allocates comes from this pool, which only takes memory from
+        // the heap once the buffer is used up: built with STATIC_ALLOCATION, the allocation guard
+        // traps it, so that MEMORY_POOL_KB can be raised.
+        std::vector<std::byte> memoryPoolBuffer(static_cast<size_t>(memoryPoolKb) * 1024);
+        std::pmr::monotonic_buffer_resource memoryArena(memoryPoolBuffer.data(), memoryPoolBuffer.size());
+        std::pmr::unsynchronized_pool_resource memoryPool(&memoryArena);
+        setCoroutineFrameResource(&memoryPool);
+        CoroutineClient client(settings, MQTT_VERSION, std::string(), &memoryPool);
 
-            result = mosquitto_publish_v5(mosq, nullptr, PUB_TOPIC, static_cast<int>(payload.length()), payload.c_str(), QOS_LEVEL, false, nullptr);
-            if (result != MOSQ_ERR_SUCCESS) {
-                throw std::runtime_error("Failure while publishing: " + std::string(mosquitto_strerror(result)));
-            }
+        if (bme280Open(&reader, BME280_DEVICE_DIR) != EXIT_SUCCESS) {
+            throw std::runtime_error("Failed to open the BME280 sensor.");
+        }
+        sensorOpened = true;
 
-            std::this_thread::sleep_for(std::chrono::seconds(5));
+        // Sampling, publishing and the connection all run on this thread, and from here on only
+        // libmosquitto allocates, for the packets it sends.
+        client.spawn(sample(client, reader, sampleIntervalMs, windowSec, stats, result));
+        allocation_guard_seal();
+        client.run();
+        if (client.failedFlows() > 0) {
+            result = MOSQ_ERR_UNKNOWN;
         }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         result = MOSQ_ERR_UNKNOWN;
     }
+    allocation_guard_unseal();
 
-    if (mosq) {
-        mosquitto_disconnect_v5(mosq, result, nullptr);
-        mosquitto_loop_stop(mosq, false);
-        mosquitto_destroy(mosq);
+    if (sensorOpened) {
+        bme280Close(&reader);
     }
+    stats.print();
+    allocation_guard_print_stats();
+
     mosquitto_lib_cleanup();
 
     return result;
-}
\ No newline at end of file
+}
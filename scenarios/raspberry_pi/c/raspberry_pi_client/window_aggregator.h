@@ -0,0 +1,93 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef WINDOW_AGGREGATOR_H
+#define WINDOW_AGGREGATOR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+
+#include "./../sensors/bme280.h"
+
+// Running min/max/mean/last of one gauge, in constant memory whatever the length of the window.
+struct GaugeWindow {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    float last = 0.0f;
+    double sum = 0.0;
+
+    void add(float value) {
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        last = value;
+        sum += value;
+    }
+};
+
+// Aggregates the readings of one window into a single summary message.
+class WindowAggregator {
+public:
+    void add(const Bme280Data& reading) {
+        temperature_.add(reading.temperature);
+        pressure_.add(reading.pressure);
+        humidity_.add(reading.humidity);
+        count_++;
+    }
+
+    uint32_t count() const { return count_; }
+
+    void reset() { *this = WindowAggregator(); }
+
+    // Formats the summary into buffer, returns the length of the summary or -1 if it did not fit.
+    int format(char* buffer, size_t size, int windowSeconds) const {
+        int length = snprintf(buffer, size,
+                              "Window: %ds Samples: %u "
+                              "Temp: min %.2f mean %.2f max %.2f last %.2f°C "
+                              "Pressure: min %.2f mean %.2f max %.2f last %.2f hPa "
+                              "Humidity: min %.2f mean %.2f max %.2f last %.2f%%.",
+                              windowSeconds, count_,
+                              temperature_.min, temperature_.sum / count_, temperature_.max,
+                              temperature_.last,
+                              pressure_.min, pressure_.sum / count_, pressure_.max, pressure_.last,
+                              humidity_.min, humidity_.sum / count_, humidity_.max, humidity_.last);
+        return length < 0 || static_cast<size_t>(length) >= size ? -1 : length;
+    }
+
+private:
+    GaugeWindow temperature_;
+    GaugeWindow pressure_;
+    GaugeWindow humidity_;
+    uint32_t count_ = 0;
+};
+
+// What the downsampling saves and costs: readings taken per message published, and the CPU time
+// the sampling thread spends per reading (reading, aggregating and publishing).
+struct SamplingStats {
+    uint64_t samples = 0;
+    uint64_t readErrors = 0;
+    uint64_t published = 0;
+    double cpuSeconds = 0.0;
+
+    static double threadCpuSeconds() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    void print() const {
+        printf("Samples: %llu (%llu read errors), messages published: %llu\n",
+               static_cast<unsigned long long>(samples),
+               static_cast<unsigned long long>(readErrors),
+               static_cast<unsigned long long>(published));
+        if (published > 0) {
+            printf("Reduction ratio: %.1f:1\n", static_cast<double>(samples) / published);
+        }
+        if (samples > 0) {
+            printf("CPU per sample: %.2f us\n", cpuSeconds * 1e6 / samples);
+        }
+    }
+};
+
+#endif
@@ -1,49 +1,371 @@
 #include "bme280.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-// /sys/bus/iio/devices/iio:device0 is link to -> /sys/devices/platform/soc/fe804000.i2c/i2c-1/1-0076/iio:device0
-#define HUMIDITY "/sys/bus/iio/devices/iio:device0/in_humidityrelative_input"
-#define PRESSURE "/sys/bus/iio/devices/iio:device0/in_pressure_input"
-#define TEMPERATURE "/sys/bus/iio/devices/iio:device0/in_temp_input"
+#define HUMIDITY "humidityrelative"
+#define PRESSURE "pressure"
+#define TEMPERATURE "temp"
 
-static int readGauge(float *value, const char *filePath) {
-    FILE *inputStream = fopen(filePath, "r");
-    if (inputStream == NULL) {
-        perror("Failed to open file");
+#define ATTRIBUTE_LENGTH 32
+#define MAX_SCAN_ELEMENTS 16
+#define SCAN_ELEMENT_NAME_LENGTH 64
+
+// A scan element enabled in the buffer, only used to compute the layout of a scan.
+typedef struct ScanElement {
+    char name[SCAN_ELEMENT_NAME_LENGTH];
+    int index;
+    Bme280Channel channel;
+} ScanElement;
+
+static void resetChannel(Bme280Channel *channel) {
+    memset(channel, 0, sizeof(Bme280Channel));
+    channel->fd = -1;
+    channel->scale = 1.0;
+}
+
+static void resetReader(Bme280Reader *reader) {
+    resetChannel(&reader->humidity);
+    resetChannel(&reader->pressure);
+    resetChannel(&reader->temperature);
+    reader->bufferFd = -1;
+    reader->bufferEnableFd = -1;
+    reader->scanSize = 0;
+}
+
+static int openAttribute(const char *deviceDir, const char *name, int flags) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", deviceDir, name) >= (int)sizeof(path)) {
+        return -1;
+    }
+    return open(path, flags | O_CLOEXEC);
+}
+
+// Reads an attribute from the start of the file. sysfs regenerates the content of an attribute on
+// every read at offset 0, so the file can stay open between readings.
+static int readAttribute(int fd, char *value, size_t length) {
+    ssize_t bytesRead = pread(fd, value, length - 1, 0);
+    if (bytesRead <= 0) {
         return EXIT_FAILURE;
     }
+    value[bytesRead] = '\0';
+    return EXIT_SUCCESS;
+}
+
+static int readGauge(float *value, int fd) {
+    char text[ATTRIBUTE_LENGTH];
+    char *end;
 
-    if (fscanf(inputStream, "%f", value) != 1) {
+    if (readAttribute(fd, text, sizeof(text)) == EXIT_FAILURE) {
         perror("Failed to read file");
-        fclose(inputStream);
         return EXIT_FAILURE;
     }
+    *value = strtof(text, &end);
+    if (end == text) {
+        fprintf(stderr, "Failed to parse reading: %s\n", text);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
 
-    fclose(inputStream);
+static int readNamedAttribute(const char *deviceDir, const char *name, char *value, size_t length) {
+    int fd = openAttribute(deviceDir, name, O_RDONLY);
+    int result;
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    result = readAttribute(fd, value, length);
+    close(fd);
+    return result;
+}
+
+static int writeNamedAttribute(const char *deviceDir, const char *name, const char *value) {
+    int fd = openAttribute(deviceDir, name, O_WRONLY | O_TRUNC);
+    ssize_t length = (ssize_t)strlen(value);
+    int result;
+    if (fd < 0) {
+        perror("Failed to open attribute");
+        return EXIT_FAILURE;
+    }
+    result = write(fd, value, (size_t)length) == length ? EXIT_SUCCESS : EXIT_FAILURE;
+    close(fd);
+    return result;
+}
+
+static int openGauge(Bme280Channel *channel, const char *deviceDir, const char *name) {
+    char attribute[NAME_MAX + 1];
+    snprintf(attribute, sizeof(attribute), "in_%s_input", name);
+    channel->fd = openAttribute(deviceDir, attribute, O_RDONLY);
+    if (channel->fd < 0) {
+        perror("Failed to open file");
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
 
-Bme280Data readBME280() {
-    Bme280Data readings;
+int bme280Open(Bme280Reader *reader, const char *deviceDir) {
+    resetReader(reader);
+    if (openGauge(&reader->humidity, deviceDir, HUMIDITY) == EXIT_FAILURE ||
+        openGauge(&reader->pressure, deviceDir, PRESSURE) == EXIT_FAILURE ||
+        openGauge(&reader->temperature, deviceDir, TEMPERATURE) == EXIT_FAILURE) {
+        bme280Close(reader);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Parses the in_<name>_type attribute of a scan element, ex. "le:s32/32>>0".
+static int parseScanType(Bme280Channel *channel, const char *type) {
+    char endian;
+    char sign;
+    unsigned storageBits;
+
+    if (sscanf(type, "%ce:%c%u/%u>>%u", &endian, &sign, &channel->bits, &storageBits,
+               &channel->shift) != 5 ||
+        (storageBits != 8 && storageBits != 16 && storageBits != 32 && storageBits != 64) ||
+        channel->bits == 0 || channel->bits > storageBits) {
+        fprintf(stderr, "Unsupported scan element type: %s\n", type);
+        return EXIT_FAILURE;
+    }
+    channel->bigEndian = endian == 'b';
+    channel->isSigned = sign == 's';
+    channel->storageBytes = storageBits / 8;
+    return EXIT_SUCCESS;
+}
+
+// The scale and offset attributes are optional, IIO only provides them when they are not 1 and 0.
+static void readConversion(Bme280Channel *channel, const char *deviceDir, const char *name) {
+    char attribute[NAME_MAX + 1];
+    char value[ATTRIBUTE_LENGTH];
+
+    snprintf(attribute, sizeof(attribute), "in_%s_scale", name);
+    if (readNamedAttribute(deviceDir, attribute, value, sizeof(value)) == EXIT_SUCCESS) {
+        channel->scale = strtod(value, NULL);
+    }
+    snprintf(attribute, sizeof(attribute), "in_%s_offset", name);
+    if (readNamedAttribute(deviceDir, attribute, value, sizeof(value)) == EXIT_SUCCESS) {
+        channel->valueOffset = strtod(value, NULL);
+    }
+}
+
+// Reads the index and type of every enabled scan element. The enabled elements are listed from
+// the device rather than assumed, since others (ex. the timestamp) change the layout of a scan.
+static int readScanElements(const char *deviceDir, ScanElement *elements, int *count) {
+    char scanDir[PATH_MAX];
+    char attribute[NAME_MAX + 1];
+    char value[ATTRIBUTE_LENGTH];
+    struct dirent *entry;
+    DIR *dir;
+
+    snprintf(scanDir, sizeof(scanDir), "%s/scan_elements", deviceDir);
+    if ((dir = opendir(scanDir)) == NULL) {
+        perror("Failed to open scan elements");
+        return EXIT_FAILURE;
+    }
+
+    *count = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        ScanElement *element = &elements[*count];
+
+        if (length < 7 || length - 6 >= SCAN_ELEMENT_NAME_LENGTH ||
+            strncmp(entry->d_name, "in_", 3) != 0 ||
+            strcmp(entry->d_name + length - 3, "_en") != 0 ||
+            readNamedAttribute(scanDir, entry->d_name, value, sizeof(value)) == EXIT_FAILURE ||
+            atoi(value) != 1) {
+            continue;
+        }
+        if (*count == MAX_SCAN_ELEMENTS) {
+            fprintf(stderr, "Too many scan elements enabled\n");
+            closedir(dir);
+            return EXIT_FAILURE;
+        }
+
+        memcpy(element->name, entry->d_name + 3, length - 6);
+        element->name[length - 6] = '\0';
+        snprintf(attribute, sizeof(attribute), "in_%s_index", element->name);
+        if (readNamedAttribute(scanDir, attribute, value, sizeof(value)) == EXIT_FAILURE) {
+            closedir(dir);
+            return EXIT_FAILURE;
+        }
+        element->index = atoi(value);
+        snprintf(attribute, sizeof(attribute), "in_%s_type", element->name);
+        resetChannel(&element->channel);
+        if (readNamedAttribute(scanDir, attribute, value, sizeof(value)) == EXIT_FAILURE ||
+            parseScanType(&element->channel, value) == EXIT_FAILURE) {
+            closedir(dir);
+            return EXIT_FAILURE;
+        }
+        (*count)++;
+    }
+    closedir(dir);
+    return EXIT_SUCCESS;
+}
+
+static int compareScanElements(const void *a, const void *b) {
+    return ((const ScanElement *)a)->index - ((const ScanElement *)b)->index;
+}
+
+// Elements are stored in index order, each aligned to its own storage size, and the scan is padded
+// to the alignment of its largest element.
+static int computeScanLayout(Bme280Reader *reader, const char *deviceDir, ScanElement *elements,
+                             int count) {
+    Bme280Channel *channels[] = {&reader->humidity, &reader->pressure, &reader->temperature};
+    const char *names[] = {HUMIDITY, PRESSURE, TEMPERATURE};
+    size_t offset = 0;
+    unsigned largest = 1;
+
+    qsort(elements, (size_t)count, sizeof(ScanElement), compareScanElements);
+    for (int i = 0; i < count; i++) {
+        unsigned bytes = elements[i].channel.storageBytes;
+        offset = (offset + bytes - 1) / bytes * bytes;
+        elements[i].channel.offset = offset;
+        offset += bytes;
+        largest = bytes > largest ? bytes : largest;
+
+        for (int c = 0; c < 3; c++) {
+            if (strcmp(elements[i].name, names[c]) == 0) {
+                *channels[c] = elements[i].channel;
+                readConversion(channels[c], deviceDir, names[c]);
+            }
+        }
+    }
+    reader->scanSize = (offset + largest - 1) / largest * largest;
+
+    for (int c = 0; c < 3; c++) {
+        if (channels[c]->storageBytes == 0) {
+            fprintf(stderr, "Scan element %s is not enabled\n", names[c]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (reader->scanSize > BME280_MAX_SCAN_SIZE) {
+        fprintf(stderr, "Scan of %zu bytes is too large\n", reader->scanSize);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int bme280OpenBuffered(Bme280Reader *reader, const char *deviceDir, const char *bufferDevice) {
+    ScanElement elements[MAX_SCAN_ELEMENTS];
+    int count;
+
+    resetReader(reader);
+    if (writeNamedAttribute(deviceDir, "scan_elements/in_" HUMIDITY "_en", "1") == EXIT_FAILURE ||
+        writeNamedAttribute(deviceDir, "scan_elements/in_" PRESSURE "_en", "1") == EXIT_FAILURE ||
+        writeNamedAttribute(deviceDir, "scan_elements/in_" TEMPERATURE "_en", "1") ==
+            EXIT_FAILURE ||
+        readScanElements(deviceDir, elements, &count) == EXIT_FAILURE ||
+        computeScanLayout(reader, deviceDir, elements, count) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    reader->bufferEnableFd = openAttribute(deviceDir, "buffer/enable", O_WRONLY);
+    if (reader->bufferEnableFd < 0 || pwrite(reader->bufferEnableFd, "1", 1, 0) != 1) {
+        perror("Failed to enable buffer");
+        bme280Close(reader);
+        return EXIT_FAILURE;
+    }
+
+    reader->bufferFd = open(bufferDevice, O_RDONLY | O_CLOEXEC);
+    if (reader->bufferFd < 0) {
+        perror("Failed to open buffer");
+        bme280Close(reader);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static float decodeChannel(const Bme280Channel *channel, const unsigned char *scan) {
+    uint64_t raw = 0;
+    int64_t value;
+
+    for (unsigned i = 0; i < channel->storageBytes; i++) {
+        unsigned byte = channel->bigEndian ? i : channel->storageBytes - 1 - i;
+        raw = (raw << 8) | scan[channel->offset + byte];
+    }
+    raw >>= channel->shift;
+    if (channel->bits < 64) {
+        raw &= (UINT64_C(1) << channel->bits) - 1;
+        if (channel->isSigned && (raw & (UINT64_C(1) << (channel->bits - 1)))) {
+            raw |= ~((UINT64_C(1) << channel->bits) - 1);
+        }
+    }
+    value = channel->isSigned ? (int64_t)raw : (int64_t)(raw & INT64_MAX);
+
+    // Same units as the in_*_input attributes: input = (raw + offset) * scale
+    return (float)(((double)value + channel->valueOffset) * channel->scale);
+}
+
+int bme280Read(Bme280Reader *reader, Bme280Data *data) {
     float rawHumidity = 0.0f;
     float rawPressure = 0.0f;
     float rawTemperature = 0.0f;
 
-    if (readGauge(&rawHumidity, HUMIDITY) == EXIT_FAILURE ||
-        readGauge(&rawPressure, PRESSURE) == EXIT_FAILURE ||
-        readGauge(&rawTemperature, TEMPERATURE) == EXIT_FAILURE) {
+    if (reader->bufferFd >= 0) {
+        if (read(reader->bufferFd, reader->scan, reader->scanSize) != (ssize_t)reader->scanSize) {
+            perror("Failed to read buffer");
+            return EXIT_FAILURE;
+        }
+        rawHumidity = decodeChannel(&reader->humidity, reader->scan);
+        rawPressure = decodeChannel(&reader->pressure, reader->scan);
+        rawTemperature = decodeChannel(&reader->temperature, reader->scan);
+    } else if (readGauge(&rawHumidity, reader->humidity.fd) == EXIT_FAILURE ||
+               readGauge(&rawPressure, reader->pressure.fd) == EXIT_FAILURE ||
+               readGauge(&rawTemperature, reader->temperature.fd) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    data->humidity = rawHumidity;
+    data->pressure = rawPressure * 10.0f;
+    data->temperature = rawTemperature / 1000.0f;
+    return EXIT_SUCCESS;
+}
+
+void bme280Close(Bme280Reader *reader) {
+    int *fds[] = {&reader->humidity.fd, &reader->pressure.fd, &reader->temperature.fd,
+                  &reader->bufferFd};
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0) {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+    if (reader->bufferEnableFd >= 0) {
+        if (pwrite(reader->bufferEnableFd, "0", 1, 0) != 1) {
+            perror("Failed to disable buffer");
+        }
+        close(reader->bufferEnableFd);
+        reader->bufferEnableFd = -1;
+    }
+}
+
+Bme280Data readBME280() {
+    static Bme280Reader reader;
+    static bool opened = false;
+    Bme280Data readings = {0};
+
+    if (!opened) {
+        if (bme280Open(&reader, BME280_DEVICE_DIR) == EXIT_FAILURE) {
+            fprintf(stderr, "Error opening sensors\n");
+            return readings;
+        }
+        opened = true;
+    }
+
+    if (bme280Read(&reader, &readings) == EXIT_FAILURE) {
         fprintf(stderr, "Error reading sensors\n");
         return readings;
     }
 
-    readings.humidity = rawHumidity;
-    readings.pressure = rawPressure * 10.0f;
-    readings.temperature = rawTemperature / 1000.0f;
-
     printf("Humidity: %.2f\n", readings.humidity);
     printf("Pressure: %.2f hPa\n", readings.pressure);
     printf("Temperature: %.2f°C\n", readings.temperature);
 
     return readings;
-}
\ No newline at end of file
+}
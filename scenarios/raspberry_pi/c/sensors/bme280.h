@@ -1,12 +1,73 @@
 #ifndef BME280_DATA_H
 #define BME280_DATA_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// IIO device of the BME280, /sys/bus/iio/devices/iio:device0 is link to
+// -> /sys/devices/platform/soc/fe804000.i2c/i2c-1/1-0076/iio:device0
+#define BME280_DEVICE_DIR "/sys/bus/iio/devices/iio:device0"
+#define BME280_BUFFER_DEVICE "/dev/iio:device0"
+
+#define BME280_MAX_SCAN_SIZE 64
+
 typedef struct Bme280Data {
     float humidity;
     float pressure;
     float temperature;
 } Bme280Data;
 
+// Where a channel is found in a scan of the IIO buffer, and how to convert it.
+typedef struct Bme280Channel {
+    int fd;
+    size_t offset;
+    unsigned storageBytes;
+    unsigned bits;
+    unsigned shift;
+    bool isSigned;
+    bool bigEndian;
+    double scale;
+    double valueOffset;
+} Bme280Channel;
+
+// Keeps the attribute files of the sensor open between readings, so that a reading is three
+// pread() calls instead of opening, parsing and closing three files. In buffered mode the readings
+// come from the IIO character device instead, one scan per reading.
+typedef struct Bme280Reader {
+    Bme280Channel humidity;
+    Bme280Channel pressure;
+    Bme280Channel temperature;
+    int bufferFd;
+    int bufferEnableFd;
+    size_t scanSize;
+    unsigned char scan[BME280_MAX_SCAN_SIZE];
+} Bme280Reader;
+
+// Opens the in_*_input attributes of the IIO device in deviceDir, ex. BME280_DEVICE_DIR or a fake
+// device created with bme280FakeCreate(). Returns EXIT_SUCCESS or EXIT_FAILURE.
+int bme280Open(Bme280Reader *reader, const char *deviceDir);
+
+// Enables the humidity, pressure and temperature scan elements and the buffer of the IIO device in
+// deviceDir, and reads scans from bufferDevice, ex. BME280_BUFFER_DEVICE. A trigger must already be
+// set in deviceDir/trigger/current_trigger. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int bme280OpenBuffered(Bme280Reader *reader, const char *deviceDir, const char *bufferDevice);
+
+// Reads one set of readings, blocking until the next scan in buffered mode. Returns EXIT_SUCCESS or
+// EXIT_FAILURE.
+int bme280Read(Bme280Reader *reader, Bme280Data *data);
+
+// Closes the files of the reader, and disables the buffer in buffered mode.
+void bme280Close(Bme280Reader *reader);
+
+// Reads and prints the sensor at BME280_DEVICE_DIR, keeping its attributes open between calls.
 Bme280Data readBME280();
 
-#endif
\ No newline at end of file
+#ifdef __cplusplus
+}
+#endif
+
+#endif
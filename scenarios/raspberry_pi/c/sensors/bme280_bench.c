@@ -0,0 +1,168 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+// Reads a fake BME280 IIO device in every mode of the reader, and a mock I2C bus with the I2C
+// driver, checks the readings and prints the time per reading, so both can be verified and
+// measured without the sensor.
+//
+// Usage: bme280_bench [readings]
+
+#define _XOPEN_SOURCE 700
+#include "bme280.h"
+#include "bme280_fake.h"
+#include "bme280_i2c_mock.h"
+#include <ftw.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_READINGS 100000
+#define NS_PER_SEC 1000000000.0
+
+static const Bme280Data expected = {.humidity = 45.5f, .pressure = 1013.25f, .temperature = 21.5f};
+
+// Compensation example of the datasheet, 25.08 °C.
+static const Bme280Calibration calibration = {27504, 26435, -1000, 36477, -10685, 3024,
+                                              2855,  140,   -7,    15500, -14600, 6000,
+                                              75,    362,   0,     319,   50,     30};
+#define EXAMPLE_ADC_T 519888
+#define EXAMPLE_ADC_P 415148
+#define EXAMPLE_ADC_H 30000
+#define EXAMPLE_TEMPERATURE 2508
+
+// Reads one set of readings the way readBME280() did before the reader kept its files open.
+static int readWithStdio(const char *deviceDir, Bme280Data *data) {
+    const char *names[] = {"in_humidityrelative_input", "in_pressure_input", "in_temp_input"};
+    float values[3];
+    char path[PATH_MAX];
+
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%s", deviceDir, names[i]);
+        FILE *inputStream = fopen(path, "r");
+        if (inputStream == NULL) {
+            return EXIT_FAILURE;
+        }
+        if (fscanf(inputStream, "%f", &values[i]) != 1) {
+            fclose(inputStream);
+            return EXIT_FAILURE;
+        }
+        fclose(inputStream);
+    }
+    data->humidity = values[0];
+    data->pressure = values[1] * 10.0f;
+    data->temperature = values[2] / 1000.0f;
+    return EXIT_SUCCESS;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / NS_PER_SEC;
+}
+
+static int check(const char *mode, const Bme280Data *data) {
+    if (fabsf(data->humidity - expected.humidity) > 0.01f ||
+        fabsf(data->pressure - expected.pressure) > 0.01f ||
+        fabsf(data->temperature - expected.temperature) > 0.01f) {
+        fprintf(stderr, "%s: unexpected reading %.3f %.3f %.3f\n", mode, data->humidity,
+                data->pressure, data->temperature);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void report(const char *mode, double start, long readings) {
+    printf("%-10s %10.0f ns/reading\n", mode, (now() - start) * NS_PER_SEC / readings);
+}
+
+static int benchI2c(long readings) {
+    Bme280I2cMock mock;
+    Bme280I2cBus bus;
+    Bme280Device device;
+    Bme280Measurement measurement;
+    double start;
+
+    bme280I2cMockInit(&mock, &calibration, &bus);
+    bme280I2cMockSetRaw(&mock, EXAMPLE_ADC_T, EXAMPLE_ADC_P, EXAMPLE_ADC_H);
+    if (bme280Init(&device, &bus) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    start = now();
+    for (long i = 0; i < readings; i++) {
+        if (bme280ReadMeasurement(&device, &measurement) == EXIT_FAILURE ||
+            measurement.temperature != EXAMPLE_TEMPERATURE) {
+            fprintf(stderr, "i2c: unexpected temperature %d\n", measurement.temperature);
+            return EXIT_FAILURE;
+        }
+    }
+    report("i2c mock", start, readings);
+    printf("%-10s %10.2f transactions/reading\n", "i2c mock",
+           (double)(mock.readTransactions - 3) / readings);
+    return EXIT_SUCCESS;
+}
+
+static int removeEntry(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+int main(int argc, char *argv[]) {
+    long readings = argc > 1 ? atol(argv[1]) : DEFAULT_READINGS;
+    char deviceDir[] = "/tmp/bme280_benchXXXXXX";
+    char bufferPath[PATH_MAX];
+    Bme280Reader reader;
+    Bme280Data data;
+    int result = EXIT_FAILURE;
+    double start;
+
+    if (readings <= 0 || mkdtemp(deviceDir) == NULL) {
+        perror("Failed to create fake device");
+        return EXIT_FAILURE;
+    }
+    snprintf(bufferPath, sizeof(bufferPath), "%s/buffer.bin", deviceDir);
+    if (bme280FakeCreate(deviceDir, &expected) == EXIT_FAILURE ||
+        bme280FakeWriteScans(bufferPath, &expected, (size_t)readings) == EXIT_FAILURE) {
+        goto cleanup;
+    }
+
+    start = now();
+    for (long i = 0; i < readings; i++) {
+        if (readWithStdio(deviceDir, &data) == EXIT_FAILURE || check("stdio", &data)) {
+            goto cleanup;
+        }
+    }
+    report("stdio", start, readings);
+
+    if (bme280Open(&reader, deviceDir) == EXIT_FAILURE) {
+        goto cleanup;
+    }
+    start = now();
+    for (long i = 0; i < readings; i++) {
+        if (bme280Read(&reader, &data) == EXIT_FAILURE || check("pread", &data)) {
+            bme280Close(&reader);
+            goto cleanup;
+        }
+    }
+    report("pread", start, readings);
+    bme280Close(&reader);
+
+    if (bme280OpenBuffered(&reader, deviceDir, bufferPath) == EXIT_FAILURE) {
+        goto cleanup;
+    }
+    start = now();
+    for (long i = 0; i < readings; i++) {
+        if (bme280Read(&reader, &data) == EXIT_FAILURE || check("buffered", &data)) {
+            bme280Close(&reader);
+            goto cleanup;
+        }
+    }
+    report("buffered", start, readings);
+    bme280Close(&reader);
+
+    result = benchI2c(readings);
+
+cleanup:
+    nftw(deviceDir, removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+    return result;
+}
@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include "bme280_fake.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// Raw scan values are in milli-percent, Pa and milli-degrees, converted with the scale attributes.
+#define SCAN_SIZE 24
+#define TIMESTAMP_OFFSET 16
+
+static int writeFile(const char *deviceDir, const char *name, const char *value) {
+    char path[PATH_MAX];
+    FILE *file;
+
+    snprintf(path, sizeof(path), "%s/%s", deviceDir, name);
+    if ((file = fopen(path, "w")) == NULL) {
+        perror("Failed to create fake attribute");
+        return EXIT_FAILURE;
+    }
+    fputs(value, file);
+    fputc('\n', file);
+    return fclose(file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int makeDir(const char *deviceDir, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", deviceDir, name);
+    if (mkdir(path, 0755) != 0) {
+        perror("Failed to create fake directory");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int bme280FakeCreate(const char *deviceDir, const Bme280Data *values) {
+    char humidity[32];
+    char pressure[32];
+    char temperature[32];
+
+    snprintf(humidity, sizeof(humidity), "%.3f", values->humidity);
+    snprintf(pressure, sizeof(pressure), "%.5f", values->pressure / 10.0f);
+    snprintf(temperature, sizeof(temperature), "%d", (int)(values->temperature * 1000.0f));
+
+    if (writeFile(deviceDir, "in_humidityrelative_input", humidity) == EXIT_FAILURE ||
+        writeFile(deviceDir, "in_pressure_input", pressure) == EXIT_FAILURE ||
+        writeFile(deviceDir, "in_temp_input", temperature) == EXIT_FAILURE ||
+        writeFile(deviceDir, "in_humidityrelative_scale", "0.001") == EXIT_FAILURE ||
+        writeFile(deviceDir, "in_pressure_scale", "0.001") == EXIT_FAILURE ||
+        makeDir(deviceDir, "buffer") == EXIT_FAILURE ||
+        writeFile(deviceDir, "buffer/enable", "0") == EXIT_FAILURE ||
+        makeDir(deviceDir, "scan_elements") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_humidityrelative_en", "0") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_humidityrelative_index", "0") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_humidityrelative_type", "le:u32/32>>0") ==
+            EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_pressure_en", "0") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_pressure_index", "1") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_pressure_type", "le:u32/32>>0") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_temp_en", "0") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_temp_index", "2") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_temp_type", "le:s32/32>>0") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_timestamp_en", "1") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_timestamp_index", "3") == EXIT_FAILURE ||
+        writeFile(deviceDir, "scan_elements/in_timestamp_type", "le:s64/64>>0") == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void putLittleEndian(unsigned char *scan, uint64_t value, unsigned bytes) {
+    for (unsigned i = 0; i < bytes; i++) {
+        scan[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+int bme280FakeWriteScans(const char *bufferPath, const Bme280Data *values, size_t count) {
+    unsigned char scan[SCAN_SIZE] = {0};
+    FILE *file;
+
+    putLittleEndian(scan, (uint32_t)(values->humidity * 1000.0f + 0.5f), 4);
+    putLittleEndian(scan + 4, (uint32_t)(values->pressure * 100.0f + 0.5f), 4);
+    putLittleEndian(scan + 8, (uint32_t)(int32_t)(values->temperature * 1000.0f), 4);
+
+    if ((file = fopen(bufferPath, "ab")) == NULL) {
+        perror("Failed to create fake buffer");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        putLittleEndian(scan + TIMESTAMP_OFFSET, (uint64_t)i, 8);
+        if (fwrite(scan, sizeof(scan), 1, file) != 1) {
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+    }
+    return fclose(file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,25 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef BME280_FAKE_H
+#define BME280_FAKE_H
+
+#include "bme280.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Creates the sysfs attributes of a BME280 IIO device in deviceDir (which must exist), reporting
+// the given readings. The scan elements are laid out as on the device: humidity, pressure,
+// temperature and timestamp, so any Linux machine can exercise both reader modes.
+int bme280FakeCreate(const char *deviceDir, const Bme280Data *values);
+
+// Appends count scans of the given readings to bufferPath, which stands in for /dev/iio:deviceN.
+int bme280FakeWriteScans(const char *bufferPath, const Bme280Data *values, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
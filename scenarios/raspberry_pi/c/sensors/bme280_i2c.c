@@ -0,0 +1,209 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include "bme280_i2c.h"
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// ctrl_meas 0x27 = 001 001 11: temperature oversampling x1, pressure oversampling x1, normal mode.
+// ctrl_hum 0x01: humidity oversampling x1, only applied after the next write of ctrl_meas.
+#define BME280_CTRL_HUM 0x01
+#define BME280_CTRL_MEAS 0x27
+
+static int linuxReadRegisters(void *context, uint8_t reg, uint8_t *data, size_t length) {
+    Bme280LinuxI2c *i2c = (Bme280LinuxI2c *)context;
+
+    // Writing the register address and reading from it in one I2C_RDWR transaction (with a
+    // repeated start in between) instead of a write() followed by a read().
+    struct i2c_msg messages[2] = {
+        {.addr = i2c->address, .flags = 0, .len = 1, .buf = &reg},
+        {.addr = i2c->address, .flags = I2C_M_RD, .len = (uint16_t)length, .buf = data},
+    };
+    struct i2c_rdwr_ioctl_data transaction = {.msgs = messages, .nmsgs = 2};
+
+    if (ioctl(i2c->fd, I2C_RDWR, &transaction) < 0) {
+        perror("Failed to read registers");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int linuxWriteRegister(void *context, uint8_t reg, uint8_t value) {
+    Bme280LinuxI2c *i2c = (Bme280LinuxI2c *)context;
+    uint8_t buf[2] = {reg, value};
+
+    if (write(i2c->fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+        perror("Failed to write register");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int bme280LinuxI2cOpen(Bme280LinuxI2c *i2c, const char *path, uint16_t address, Bme280I2cBus *bus) {
+    i2c->address = address;
+    i2c->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (i2c->fd < 0) {
+        perror("Error opening I2C device");
+        return EXIT_FAILURE;
+    }
+    // Sets the address used by write(), I2C_RDWR messages carry their own.
+    if (ioctl(i2c->fd, I2C_SLAVE, address) < 0) {
+        perror("Error setting I2C address");
+        bme280LinuxI2cClose(i2c);
+        return EXIT_FAILURE;
+    }
+
+    bus->readRegisters = linuxReadRegisters;
+    bus->writeRegister = linuxWriteRegister;
+    bus->context = i2c;
+    return EXIT_SUCCESS;
+}
+
+void bme280LinuxI2cClose(Bme280LinuxI2c *i2c) {
+    if (i2c->fd >= 0) {
+        close(i2c->fd);
+        i2c->fd = -1;
+    }
+}
+
+void bme280ParseCalibration(
+    Bme280Calibration *calibration,
+    const uint8_t calib00[BME280_CALIB00_LENGTH],
+    const uint8_t calib26[BME280_CALIB26_LENGTH]) {
+    // 0x88-0x9F hold little endian 16 bit words, 0xA1 holds dig_H1.
+    calibration->digT1 = (uint16_t)(calib00[1] << 8 | calib00[0]);
+    calibration->digT2 = (int16_t)(calib00[3] << 8 | calib00[2]);
+    calibration->digT3 = (int16_t)(calib00[5] << 8 | calib00[4]);
+    calibration->digP1 = (uint16_t)(calib00[7] << 8 | calib00[6]);
+    calibration->digP2 = (int16_t)(calib00[9] << 8 | calib00[8]);
+    calibration->digP3 = (int16_t)(calib00[11] << 8 | calib00[10]);
+    calibration->digP4 = (int16_t)(calib00[13] << 8 | calib00[12]);
+    calibration->digP5 = (int16_t)(calib00[15] << 8 | calib00[14]);
+    calibration->digP6 = (int16_t)(calib00[17] << 8 | calib00[16]);
+    calibration->digP7 = (int16_t)(calib00[19] << 8 | calib00[18]);
+    calibration->digP8 = (int16_t)(calib00[21] << 8 | calib00[20]);
+    calibration->digP9 = (int16_t)(calib00[23] << 8 | calib00[22]);
+    calibration->digH1 = calib00[25];
+
+    // 0xE1-0xE7, dig_H4 and dig_H5 are 12 bit values sharing the nibbles of 0xE5.
+    calibration->digH2 = (int16_t)(calib26[1] << 8 | calib26[0]);
+    calibration->digH3 = calib26[2];
+    calibration->digH4 = (int16_t)((int8_t)calib26[3] * 16 | (calib26[4] & 0x0F));
+    calibration->digH5 = (int16_t)((int8_t)calib26[5] * 16 | calib26[4] >> 4);
+    calibration->digH6 = (int8_t)calib26[6];
+}
+
+// Returns the temperature in 0.01 °C and the fine temperature used by the other formulas.
+static int32_t compensateTemperature(const Bme280Calibration *c, int32_t adcT, int32_t *tFine) {
+    int32_t var1 = (((adcT >> 3) - ((int32_t)c->digT1 * 2)) * (int32_t)c->digT2) >> 11;
+    int32_t var2 = (((((adcT >> 4) - (int32_t)c->digT1) * ((adcT >> 4) - (int32_t)c->digT1)) >> 12)
+                    * (int32_t)c->digT3)
+                   >> 14;
+    *tFine = var1 + var2;
+    return (*tFine * 5 + 128) >> 8;
+}
+
+// Returns the pressure in Pa as Q24.8. The datasheet left shifts signed values, multiplications
+// are used instead since shifting a negative value is undefined in C.
+static uint32_t compensatePressure(const Bme280Calibration *c, int32_t adcP, int32_t tFine) {
+    int64_t var1 = (int64_t)tFine - 128000;
+    int64_t var2 = var1 * var1 * (int64_t)c->digP6;
+    int64_t p;
+
+    var2 = var2 + var1 * (int64_t)c->digP5 * ((int64_t)1 << 17);
+    var2 = var2 + (int64_t)c->digP4 * ((int64_t)1 << 35);
+    var1 = ((var1 * var1 * (int64_t)c->digP3) >> 8) + var1 * (int64_t)c->digP2 * ((int64_t)1 << 12);
+    var1 = ((((int64_t)1 << 47) + var1) * (int64_t)c->digP1) >> 33;
+    if (var1 == 0) {
+        return 0; // avoid a division by zero
+    }
+    p = 1048576 - adcP;
+    p = ((p * ((int64_t)1 << 31) - var2) * 3125) / var1;
+    var1 = ((int64_t)c->digP9 * (p >> 13) * (p >> 13)) >> 25;
+    var2 = ((int64_t)c->digP8 * p) >> 19;
+    p = ((p + var1 + var2) >> 8) + (int64_t)c->digP7 * 16;
+    return (uint32_t)p;
+}
+
+// Returns the relative humidity in % as Q22.10.
+static uint32_t compensateHumidity(const Bme280Calibration *c, int32_t adcH, int32_t tFine) {
+    int32_t v = tFine - 76800;
+
+    v = (((adcH * 16384) - ((int32_t)c->digH4 * 1048576) - ((int32_t)c->digH5 * v) + 16384) >> 15)
+        * (((((((v * (int32_t)c->digH6) >> 10) * (((v * (int32_t)c->digH3) >> 11) + 32768)) >> 10)
+             + 2097152)
+                * (int32_t)c->digH2
+            + 8192)
+           >> 14);
+    v = v - (((((v >> 15) * (v >> 15)) >> 7) * (int32_t)c->digH1) >> 4);
+    v = v < 0 ? 0 : v;
+    v = v > 419430400 ? 419430400 : v;
+    return (uint32_t)(v >> 12);
+}
+
+void bme280Compensate(
+    const Bme280Calibration *calibration,
+    int32_t adcT,
+    int32_t adcP,
+    int32_t adcH,
+    Bme280Measurement *measurement) {
+    int32_t tFine;
+
+    measurement->temperature = compensateTemperature(calibration, adcT, &tFine);
+    measurement->pressure = compensatePressure(calibration, adcP, tFine);
+    measurement->humidity = compensateHumidity(calibration, adcH, tFine);
+}
+
+int bme280Init(Bme280Device *device, const Bme280I2cBus *bus) {
+    uint8_t chipId;
+    uint8_t calib00[BME280_CALIB00_LENGTH];
+    uint8_t calib26[BME280_CALIB26_LENGTH];
+
+    device->bus = *bus;
+    if (bus->readRegisters(bus->context, BME280_CHIP_ID_REG, &chipId, 1) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    if (chipId != BME280_CHIP_ID) {
+        fprintf(stderr, "Unexpected chip id 0x%02X, not a BME280\n", chipId);
+        return EXIT_FAILURE;
+    }
+
+    // The calibration never changes, so it is read once here rather than with every measurement.
+    if (bus->readRegisters(bus->context, BME280_CALIB00_REG, calib00, sizeof(calib00)) ==
+            EXIT_FAILURE ||
+        bus->readRegisters(bus->context, BME280_CALIB26_REG, calib26, sizeof(calib26)) ==
+            EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    bme280ParseCalibration(&device->calibration, calib00, calib26);
+
+    if (bus->writeRegister(bus->context, BME280_CTRL_HUM_REG, BME280_CTRL_HUM) == EXIT_FAILURE ||
+        bus->writeRegister(bus->context, BME280_CTRL_MEAS_REG, BME280_CTRL_MEAS) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int bme280ReadMeasurement(Bme280Device *device, Bme280Measurement *measurement) {
+    uint8_t data[BME280_DATA_LENGTH];
+
+    // 0xF7-0xFE: press_msb, press_lsb, press_xlsb, temp_msb, temp_lsb, temp_xlsb, hum_msb, hum_lsb.
+    // Reading them in one burst guarantees the three values come from the same measurement.
+    if (device->bus.readRegisters(device->bus.context, BME280_DATA_REG, data, sizeof(data)) ==
+        EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    // Pressure and temperature are 20 bits, the upper 4 bits of xlsb are the least significant.
+    int32_t adcP = (int32_t)data[0] << 12 | (int32_t)data[1] << 4 | data[2] >> 4;
+    int32_t adcT = (int32_t)data[3] << 12 | (int32_t)data[4] << 4 | data[5] >> 4;
+    int32_t adcH = (int32_t)data[6] << 8 | data[7];
+
+    bme280Compensate(&device->calibration, adcT, adcP, adcH, measurement);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef BME280_I2C_H
+#define BME280_I2C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BME280_I2C_DEVICE "/dev/i2c-1"
+#define BME280_I2C_ADDR 0x76
+
+#define BME280_CHIP_ID_REG 0xD0
+#define BME280_CHIP_ID 0x60
+#define BME280_CALIB00_REG 0x88
+#define BME280_CALIB26_REG 0xE1
+#define BME280_CTRL_HUM_REG 0xF2
+#define BME280_CTRL_MEAS_REG 0xF4
+#define BME280_DATA_REG 0xF7
+
+#define BME280_CALIB00_LENGTH 26
+#define BME280_CALIB26_LENGTH 7
+#define BME280_DATA_LENGTH 8
+
+// Register access of the I2C bus the sensor is on. readRegisters must write the register address
+// and read length bytes from it in a single transaction, so consecutive registers are read without
+// the sensor updating them in between.
+typedef struct Bme280I2cBus {
+    int (*readRegisters)(void *context, uint8_t reg, uint8_t *data, size_t length);
+    int (*writeRegister)(void *context, uint8_t reg, uint8_t value);
+    void *context;
+} Bme280I2cBus;
+
+// Calibration coefficients, unique to each sensor and stored in its non-volatile memory.
+typedef struct Bme280Calibration {
+    uint16_t digT1;
+    int16_t digT2;
+    int16_t digT3;
+    uint16_t digP1;
+    int16_t digP2;
+    int16_t digP3;
+    int16_t digP4;
+    int16_t digP5;
+    int16_t digP6;
+    int16_t digP7;
+    int16_t digP8;
+    int16_t digP9;
+    uint8_t digH1;
+    int16_t digH2;
+    uint8_t digH3;
+    int16_t digH4;
+    int16_t digH5;
+    int8_t digH6;
+} Bme280Calibration;
+
+typedef struct Bme280Device {
+    Bme280I2cBus bus;
+    Bme280Calibration calibration;
+} Bme280Device;
+
+// Compensated readings in the fixed point formats of the Bosch reference driver.
+typedef struct Bme280Measurement {
+    int32_t temperature; // 0.01 °C
+    uint32_t pressure;   // Pa, Q24.8
+    uint32_t humidity;   // %RH, Q22.10
+} Bme280Measurement;
+
+// The Linux I2C character device, ex. /dev/i2c-1.
+typedef struct Bme280LinuxI2c {
+    int fd;
+    uint16_t address;
+} Bme280LinuxI2c;
+
+// Opens the I2C bus at path for the sensor at address, and fills bus to access it. Returns
+// EXIT_SUCCESS or EXIT_FAILURE.
+int bme280LinuxI2cOpen(Bme280LinuxI2c *i2c, const char *path, uint16_t address, Bme280I2cBus *bus);
+
+void bme280LinuxI2cClose(Bme280LinuxI2c *i2c);
+
+// Checks the chip id, reads the calibration once and starts normal mode with x1 oversampling of
+// every measurement. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int bme280Init(Bme280Device *device, const Bme280I2cBus *bus);
+
+// Reads the pressure, temperature and humidity registers in a single burst and compensates them.
+// Returns EXIT_SUCCESS or EXIT_FAILURE.
+int bme280ReadMeasurement(Bme280Device *device, Bme280Measurement *measurement);
+
+// Parses the two calibration blocks, read from BME280_CALIB00_REG and BME280_CALIB26_REG.
+void bme280ParseCalibration(
+    Bme280Calibration *calibration,
+    const uint8_t calib00[BME280_CALIB00_LENGTH],
+    const uint8_t calib26[BME280_CALIB26_LENGTH]);
+
+// Compensates raw ADC values with the integer formulas of the datasheet. tFine, the fine
+// temperature shared by the three formulas, is computed per call rather than kept in a global.
+void bme280Compensate(
+    const Bme280Calibration *calibration,
+    int32_t adcT,
+    int32_t adcP,
+    int32_t adcH,
+    Bme280Measurement *measurement);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
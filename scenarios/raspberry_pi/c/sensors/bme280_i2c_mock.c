@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include "bme280_i2c_mock.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int mockReadRegisters(void *context, uint8_t reg, uint8_t *data, size_t length) {
+    Bme280I2cMock *mock = (Bme280I2cMock *)context;
+
+    if (reg + length > BME280_REGISTER_COUNT) {
+        return EXIT_FAILURE;
+    }
+    memcpy(data, &mock->registers[reg], length);
+    mock->readTransactions++;
+    return EXIT_SUCCESS;
+}
+
+static int mockWriteRegister(void *context, uint8_t reg, uint8_t value) {
+    Bme280I2cMock *mock = (Bme280I2cMock *)context;
+
+    mock->registers[reg] = value;
+    mock->writeTransactions++;
+    return EXIT_SUCCESS;
+}
+
+static void putWord(uint8_t *registers, unsigned reg, uint16_t value) {
+    registers[reg] = (uint8_t)value;
+    registers[reg + 1] = (uint8_t)(value >> 8);
+}
+
+void bme280I2cMockInit(Bme280I2cMock *mock, const Bme280Calibration *c, Bme280I2cBus *bus) {
+    uint8_t *r = mock->registers;
+    const uint16_t words[] = {
+        c->digT1,
+        (uint16_t)c->digT2,
+        (uint16_t)c->digT3,
+        c->digP1,
+        (uint16_t)c->digP2,
+        (uint16_t)c->digP3,
+        (uint16_t)c->digP4,
+        (uint16_t)c->digP5,
+        (uint16_t)c->digP6,
+        (uint16_t)c->digP7,
+        (uint16_t)c->digP8,
+        (uint16_t)c->digP9,
+    };
+
+    memset(mock, 0, sizeof(Bme280I2cMock));
+    r[BME280_CHIP_ID_REG] = BME280_CHIP_ID;
+    for (unsigned i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        putWord(r, BME280_CALIB00_REG + 2 * i, words[i]);
+    }
+    r[BME280_CALIB00_REG + 25] = c->digH1;
+    putWord(r, BME280_CALIB26_REG, (uint16_t)c->digH2);
+    r[BME280_CALIB26_REG + 2] = c->digH3;
+    r[BME280_CALIB26_REG + 3] = (uint8_t)((uint16_t)c->digH4 >> 4);
+    r[BME280_CALIB26_REG + 4] = (uint8_t)((c->digH4 & 0x0F) | (c->digH5 & 0x0F) << 4);
+    r[BME280_CALIB26_REG + 5] = (uint8_t)((uint16_t)c->digH5 >> 4);
+    r[BME280_CALIB26_REG + 6] = (uint8_t)c->digH6;
+
+    bus->readRegisters = mockReadRegisters;
+    bus->writeRegister = mockWriteRegister;
+    bus->context = mock;
+}
+
+void bme280I2cMockSetRaw(Bme280I2cMock *mock, int32_t adcT, int32_t adcP, int32_t adcH) {
+    uint8_t *data = &mock->registers[BME280_DATA_REG];
+
+    data[0] = (uint8_t)(adcP >> 12);
+    data[1] = (uint8_t)(adcP >> 4);
+    data[2] = (uint8_t)(adcP << 4);
+    data[3] = (uint8_t)(adcT >> 12);
+    data[4] = (uint8_t)(adcT >> 4);
+    data[5] = (uint8_t)(adcT << 4);
+    data[6] = (uint8_t)(adcH >> 8);
+    data[7] = (uint8_t)adcH;
+}
@@ -0,0 +1,36 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef BME280_I2C_MOCK_H
+#define BME280_I2C_MOCK_H
+
+#include "bme280_i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BME280_REGISTER_COUNT 256
+
+// In memory register map of a BME280, standing in for the I2C bus in tests and benchmarks.
+typedef struct Bme280I2cMock {
+    uint8_t registers[BME280_REGISTER_COUNT];
+    unsigned long readTransactions;
+    unsigned long writeTransactions;
+} Bme280I2cMock;
+
+// Resets the registers to those of a BME280 with the given calibration, and fills bus to access
+// them.
+void bme280I2cMockInit(
+    Bme280I2cMock *mock,
+    const Bme280Calibration *calibration,
+    Bme280I2cBus *bus);
+
+// Sets the raw ADC values returned by the next reads of the data registers.
+void bme280I2cMockSetRaw(Bme280I2cMock *mock, int32_t adcT, int32_t adcP, int32_t adcH);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,23 +4,167 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "logging.h"
+#include "message_journal.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
 #include "mqtt_setup.h"
+#include "time_series_store.h"
 
 #define SUB_TOPIC "devices/+"
 #define QOS_LEVEL 1
 #define MQTT_VERSION MQTT_PROTOCOL_V311
 
+#define MAX_SERIES_NAME_LENGTH 256
+#define MAX_PAYLOAD_LENGTH 1024
+/* Bounds of the readings: three series per device, kept for a week. */
+#define DEFAULT_MAX_SERIES 3072
+#define DEFAULT_RETENTION_HOURS (7 * 24)
+
+/* Gauges of the raspberry_pi_client payloads, stored as <topic>/<series suffix>. */
+static const char* const gauge_labels[] = { "Temp: ", "Pressure: ", "Humidity: " };
+static const char* const gauge_series[] = { "temperature", "pressure", "humidity" };
+
+/* Readings of every device, only accessed from the mosquitto loop thread until it is stopped. */
+static time_series_store readings;
+
+/* Journal of the received messages, opened when JOURNAL_DIR is set. */
+static message_journal journal;
+/* Result of message_journal_open_from_env(), 1 when the journal is open. */
+static int journal_opened = 0;
+
+/* Parses the value following label, either a single reading ("Temp: 21.50°C") or the mean of a
+ * window summary ("Temp: min 21.40 mean 21.52 max 21.60 last 21.55°C"). */
+static bool parse_gauge(const char* payload, const char* label, double* value)
+{
+  const char* text = strstr(payload, label);
+  char* end;
+
+  if (text == NULL)
+  {
+    return false;
+  }
+  text += strlen(label);
+  if (strncmp(text, "min ", 4) == 0)
+  {
+    if ((text = strstr(text, "mean ")) == NULL)
+    {
+      return false;
+    }
+    text += strlen("mean ");
+  }
+  *value = strtod(text, &end);
+  return end != text;
+}
+
 void handle_message(
     struct mosquitto* mosq,
     const struct mosquitto_message* message,
     const mosquitto_property* props)
 {
-  printf("\tPayload: %s\n", (char*)message->payload);
+  char payload[MAX_PAYLOAD_LENGTH];
+  char series_name[MAX_SERIES_NAME_LENGTH];
+  struct timespec now;
+  int64_t timestamp;
+  size_t length = (size_t)message->payloadlen < sizeof(payload) - 1 ? (size_t)message->payloadlen
+                                                                    : sizeof(payload) - 1;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (journal_opened > 0)
+  {
+    message_journal_append(
+        &journal, message, props, (int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+  }
+
+  printf("\tPayload: %.*s\n", message->payloadlen, (char*)message->payload);
+
+  /* Payloads are not null terminated. */
+  memcpy(payload, message->payload, length);
+  payload[length] = '\0';
+  timestamp = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+  for (size_t i = 0; i < sizeof(gauge_labels) / sizeof(gauge_labels[0]); i++)
+  {
+    double value;
+    time_series* series;
+
+    if (!parse_gauge(payload, gauge_labels[i], &value))
+    {
+      continue;
+    }
+    snprintf(series_name, sizeof(series_name), "%s/%s", message->topic, gauge_series[i]);
+    if ((series = time_series_store_get(&readings, series_name, true)) != NULL)
+    {
+      time_series_append(series, timestamp, value);
+    }
+  }
+}
+
+/* Prints the size of each series, and its hourly means over the last day. */
+static void print_readings(void)
+{
+  time_series_bucket buckets[24];
+  struct timespec now;
+  int64_t to;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  to = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+  if (readings.rejected_series > 0)
+  {
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "%llu series not stored, past TIME_SERIES_MAX_SERIES",
+        (unsigned long long)readings.rejected_series);
+  }
+  for (size_t i = 0; i < readings.count; i++)
+  {
+    const time_series* series = &readings.series[i];
+    size_t count = time_series_query_downsample(
+        series, to - 24 * 3600 * 1000LL, to, 3600 * 1000LL, buckets, 24);
+
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "%s: %llu points in %zu bytes (%.2f bytes/point)",
+        series->name,
+        (unsigned long long)series->point_count,
+        series->chunk_count * sizeof(time_series_chunk),
+        series->point_count > 0
+            ? (double)(series->chunk_count * sizeof(time_series_chunk)) / series->point_count
+            : 0);
+    for (size_t b = 0; b < count; b++)
+    {
+      printf(
+          "\t%lld: mean %.2f (%u points)\n",
+          (long long)buckets[b].start_time,
+          buckets[b].mean,
+          buckets[b].count);
+    }
+  }
+}
+
+/* Initializes the readings with the bounds of the .env file, loaded by mqtt_client_init(). */
+static bool readings_init(void)
+{
+  time_series_store_options options = { 0 };
+  int max_series;
+  int retention_hours;
+
+  if (!set_int_connection_setting(&max_series, "TIME_SERIES_MAX_SERIES", DEFAULT_MAX_SERIES)
+      || !set_int_connection_setting(
+          &retention_hours, "TIME_SERIES_RETENTION_HOURS", DEFAULT_RETENTION_HOURS)
+      || max_series < 0 || retention_hours < 0)
+  {
+    LOG_ERROR("Invalid time series settings");
+    return false;
+  }
+  options.max_series = (size_t)max_series;
+  options.retention = (int64_t)retention_hours * 3600 * 1000;
+  time_series_store_init(&readings, &options);
+  return true;
 }
 
 /* Callback called when the client receives a CONNACK message from the broker and we want to
@@ -70,6 +214,14 @@ int main(int argc, char* argv[])
   {
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (!readings_init())
+  {
+    result = MOSQ_ERR_INVAL;
+  }
+  else if ((journal_opened = message_journal_open_from_env(&journal)) < 0)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
   else if (
       (result = mosquitto_connect_bind_v5(
            mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
@@ -87,7 +239,6 @@ int main(int argc, char* argv[])
   {
     while (keep_running)
     {
-
       sleep(5);
     }
   }
@@ -98,6 +249,20 @@ int main(int argc, char* argv[])
     mosquitto_loop_stop(mosq, false);
     mosquitto_destroy(mosq);
   }
+  if (journal_opened > 0)
+  {
+    message_journal_close(&journal);
+    LOG_INFO(
+        SERVER_LOG_TAG,
+        "Journaled %llu messages (%llu bytes, %llu dropped) in %llu syncs, longest %.3f ms",
+        (unsigned long long)journal.appended,
+        (unsigned long long)journal.appended_bytes,
+        (unsigned long long)journal.dropped,
+        (unsigned long long)journal.syncs,
+        journal.max_sync_ns / 1e6);
+  }
+  print_readings();
+  time_series_store_destroy(&readings);
   mosquitto_lib_cleanup();
   return result;
 }
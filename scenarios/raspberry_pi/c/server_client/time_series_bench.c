@@ -0,0 +1,147 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Measures the time_series_store with synthetic sensor history: every device reports temperature,
+ * pressure and humidity every 5 seconds, with a little jitter, for the given number of weeks.
+ *
+ * Usage: time_series_bench [devices] [weeks]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "time_series_store.h"
+
+#define DEFAULT_DEVICES 10
+#define DEFAULT_WEEKS 4
+#define INTERVAL_MS 5000
+#define JITTER_MS 20
+#define MS_PER_HOUR (3600 * 1000LL)
+#define MS_PER_DAY (24 * MS_PER_HOUR)
+#define MS_PER_WEEK (7 * MS_PER_DAY)
+#define START_TIME 1700000000000LL
+#define QUERY_COUNT 100
+#define MAX_BUCKETS 168
+
+static const char* const gauges[] = { "temperature", "pressure", "humidity" };
+static const double baselines[] = { 21.0, 1013.25, 45.0 };
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+  int devices = argc > 1 ? atoi(argv[1]) : DEFAULT_DEVICES;
+  int weeks = argc > 2 ? atoi(argv[2]) : DEFAULT_WEEKS;
+  int series_count = devices * 3;
+  int64_t samples = weeks * MS_PER_WEEK / INTERVAL_MS;
+  time_series_store store;
+  time_series_store_options options = { 0 };
+  time_series** series;
+  time_series_point* points;
+  time_series_bucket buckets[MAX_BUCKETS];
+  uint64_t point_count = 0;
+  uint64_t decoded = 0;
+  double start;
+  char name[64];
+
+  if (devices <= 0 || weeks <= 0)
+  {
+    fprintf(stderr, "Usage: %s [devices] [weeks]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  time_series_store_init(&store, &options);
+  series = malloc((size_t)series_count * sizeof(time_series*));
+  points = malloc(MS_PER_DAY / INTERVAL_MS * 2 * sizeof(time_series_point));
+  if (series == NULL || points == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  for (int s = 0; s < series_count; s++)
+  {
+    snprintf(name, sizeof(name), "devices/rasp%d/%s", s / 3, gauges[s % 3]);
+    time_series_store_get(&store, name, true);
+  }
+  for (int s = 0; s < series_count; s++)
+  {
+    series[s] = &store.series[s];
+  }
+
+  /* Readings change in steps of 0.01 like the sensor output, and drift slowly. */
+  srand(1);
+  start = now_seconds();
+  for (int64_t i = 0; i < samples; i++)
+  {
+    int64_t timestamp = START_TIME + i * INTERVAL_MS + rand() % JITTER_MS;
+    for (int s = 0; s < series_count; s++)
+    {
+      double value = baselines[s % 3] + (double)((i / 60 + s) % 200) / 100.0;
+      if (time_series_append(series[s], timestamp, value) != 0)
+      {
+        return EXIT_FAILURE;
+      }
+      point_count++;
+    }
+  }
+  double ingest_seconds = now_seconds() - start;
+  size_t memory = time_series_store_memory(&store);
+
+  printf(
+      "Ingest: %llu points in %.2f s (%.1f M points/s)\n",
+      (unsigned long long)point_count,
+      ingest_seconds,
+      point_count / ingest_seconds / 1e6);
+  printf(
+      "Memory: %.1f MB, %.2f bytes/point (16 bytes uncompressed)\n",
+      memory / 1e6,
+      (double)memory / point_count);
+
+  /* One day of raw points from a random day of a random series. */
+  start = now_seconds();
+  for (int q = 0; q < QUERY_COUNT; q++)
+  {
+    int64_t from = START_TIME + (rand() % (weeks * 7)) * MS_PER_DAY;
+    decoded += time_series_query_range(
+        series[rand() % series_count],
+        from,
+        from + MS_PER_DAY - 1,
+        points,
+        MS_PER_DAY / INTERVAL_MS * 2);
+  }
+  double range_seconds = now_seconds() - start;
+  printf(
+      "Range query (1 day): %.1f us/query, %.1f M points/s\n",
+      range_seconds * 1e6 / QUERY_COUNT,
+      decoded / range_seconds / 1e6);
+
+  /* One week of hourly buckets from the last week of a random series. */
+  decoded = 0;
+  start = now_seconds();
+  for (int q = 0; q < QUERY_COUNT; q++)
+  {
+    int64_t to = START_TIME + weeks * MS_PER_WEEK;
+    size_t count = time_series_query_downsample(
+        series[rand() % series_count], to - MS_PER_WEEK, to, MS_PER_HOUR, buckets, MAX_BUCKETS);
+    for (size_t b = 0; b < count; b++)
+    {
+      decoded += buckets[b].count;
+    }
+  }
+  double downsample_seconds = now_seconds() - start;
+  printf(
+      "Downsample query (1 week, hourly): %.1f us/query, %.1f M points/s\n",
+      downsample_seconds * 1e6 / QUERY_COUNT,
+      decoded / downsample_seconds / 1e6);
+
+  free(points);
+  free(series);
+  time_series_store_destroy(&store);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "bme280_i2c_test.h"
+
+// Calibration and raw values of the compensation example in the BMP280 datasheet, the humidity
+// coefficients are typical values of a BME280.
+static const Bme280Calibration example_calibration
+    = { 27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000,
+        75,    362,   0,     319,   50,     30 };
+#define EXAMPLE_ADC_T 519888
+#define EXAMPLE_ADC_P 415148
+#define EXAMPLE_ADC_H 30000
+
+typedef struct test_sensor
+{
+  Bme280I2cMock mock;
+  Bme280I2cBus bus;
+  Bme280Device device;
+} test_sensor;
+
+static int setup(void** state)
+{
+  test_sensor* sensor = malloc(sizeof(test_sensor));
+  if (sensor == NULL)
+  {
+    return -1;
+  }
+  bme280I2cMockInit(&sensor->mock, &example_calibration, &sensor->bus);
+  bme280I2cMockSetRaw(&sensor->mock, EXAMPLE_ADC_T, EXAMPLE_ADC_P, EXAMPLE_ADC_H);
+  *state = sensor;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  free(*state);
+  return 0;
+}
+
+// Compensated values match the datasheet example: 25.08 °C and 100653 Pa
+static void test_bme280_i2c_compensate_datasheet_example_success(void** state)
+{
+  test_sensor* sensor = (test_sensor*)*state;
+  Bme280Measurement measurement;
+
+  assert_int_equal(bme280Init(&sensor->device, &sensor->bus), EXIT_SUCCESS);
+  assert_int_equal(bme280ReadMeasurement(&sensor->device, &measurement), EXIT_SUCCESS);
+
+  assert_int_equal(measurement.temperature, 2508);
+  assert_int_equal(measurement.pressure / 256, 100653);
+  // 52.86 %RH, the floating point formula of the datasheet gives 52.864
+  assert_int_equal(measurement.humidity, 54130);
+}
+
+// Init reads the calibration once and enables humidity before starting normal mode, each
+// measurement is then a single burst read
+static void test_bme280_i2c_single_transaction_per_measurement_success(void** state)
+{
+  test_sensor* sensor = (test_sensor*)*state;
+  Bme280Measurement measurement;
+
+  assert_int_equal(bme280Init(&sensor->device, &sensor->bus), EXIT_SUCCESS);
+  assert_int_equal(sensor->mock.readTransactions, 3);
+  assert_int_equal(sensor->mock.writeTransactions, 2);
+  assert_int_equal(sensor->mock.registers[BME280_CTRL_HUM_REG], 0x01);
+  assert_int_equal(sensor->mock.registers[BME280_CTRL_MEAS_REG], 0x27);
+
+  for (int i = 0; i < 10; i++)
+  {
+    assert_int_equal(bme280ReadMeasurement(&sensor->device, &measurement), EXIT_SUCCESS);
+  }
+  assert_int_equal(sensor->mock.readTransactions, 13);
+  assert_int_equal(sensor->mock.writeTransactions, 2);
+}
+
+// Negative dig_H4, dig_H5 and dig_H6 survive the nibble packing of 0xE4-0xE6
+static void test_bme280_i2c_parse_negative_humidity_calibration_success(void** state)
+{
+  test_sensor* sensor = (test_sensor*)*state;
+  Bme280Calibration calibration = example_calibration;
+  calibration.digH4 = -319;
+  calibration.digH5 = -50;
+  calibration.digH6 = -30;
+  calibration.digP4 = -2855;
+
+  bme280I2cMockInit(&sensor->mock, &calibration, &sensor->bus);
+  assert_int_equal(bme280Init(&sensor->device, &sensor->bus), EXIT_SUCCESS);
+
+  assert_int_equal(sensor->device.calibration.digH4, -319);
+  assert_int_equal(sensor->device.calibration.digH5, -50);
+  assert_int_equal(sensor->device.calibration.digH6, -30);
+  assert_int_equal(sensor->device.calibration.digP4, -2855);
+  assert_int_equal(sensor->device.calibration.digH1, 75);
+}
+
+// Humidity is clamped to 0 - 100 %RH
+static void test_bme280_i2c_humidity_clamped_success(void** state)
+{
+  Bme280Measurement measurement;
+
+  bme280Compensate(&example_calibration, EXAMPLE_ADC_T, EXAMPLE_ADC_P, 0, &measurement);
+  assert_int_equal(measurement.humidity, 0);
+  bme280Compensate(&example_calibration, EXAMPLE_ADC_T, EXAMPLE_ADC_P, 0xFFFF, &measurement);
+  assert_int_equal(measurement.humidity, 100 * 1024);
+}
+
+// A device with another chip id is rejected
+static void test_bme280_i2c_wrong_chip_id_failure(void** state)
+{
+  test_sensor* sensor = (test_sensor*)*state;
+  sensor->mock.registers[BME280_CHIP_ID_REG] = 0x58; // BMP280
+
+  assert_int_equal(bme280Init(&sensor->device, &sensor->bus), EXIT_FAILURE);
+}
+
+int test_bme280_i2c()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(
+        test_bme280_i2c_compensate_datasheet_example_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_bme280_i2c_single_transaction_per_measurement_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_bme280_i2c_parse_negative_humidity_calibration_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_bme280_i2c_humidity_clamped_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_bme280_i2c_wrong_chip_id_failure, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("bme280_i2c", tests, NULL, NULL);
+}
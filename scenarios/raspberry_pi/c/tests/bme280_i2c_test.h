@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef BME280_I2C_TEST_H
+#define BME280_I2C_TEST_H
+
+#include "bme280_i2c.h"
+#include "bme280_i2c_mock.h"
+
+int test_bme280_i2c();
+
+#endif // BME280_I2C_TEST_H
@@ -0,0 +1,13 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "bme280_i2c_test.h"
+
+int main()
+{
+  int result = 0;
+
+  result += test_bme280_i2c();
+
+  return result;
+}
@@ -0,0 +1,154 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "core_consumer.h"
+#include "core_runtime.h"
+#include "logging.h"
+#include "position_consumer.h"
+
+/* Position of a vehicle, sent to the core owning the vehicle. */
+typedef struct vehicle_position
+{
+  geojson_coordinates coordinates;
+  position_sequence sequence;
+  char vehicle[CORE_TASK_DATA_SIZE - sizeof(geojson_coordinates) - sizeof(position_sequence)];
+} vehicle_position;
+
+/* Runs on the core owning the vehicle, so the sequence tracker, the geofences and the heatmap shard
+ * of each core only see its vehicles. */
+static void _update_vehicle(core_shard* shard, void* data)
+{
+  vehicle_position* position = data;
+
+  position_consumer_update(
+      shard->state, position->vehicle, &position->sequence, &position->coordinates);
+}
+
+/* Sent to every core each second, so that cores receiving no position deliver the positions held
+ * too long and close their heatmap windows too. The first core publishes the windows closed by
+ * every core. */
+static void _tick(core_shard* shard, void* data)
+{
+  position_consumer_tick(shard->state, shard->mosq);
+}
+
+/* Called on the core receiving the message, which hands the position to the core owning its
+ * vehicle. */
+static void _handle_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  core_shard* shard = core_runtime_current();
+  position_consumer* consumer = shard->state;
+  geojson_point json_message = geojson_point_init();
+  vehicle_position position = { 0 };
+
+  if (position_consumer_parse(consumer, message, props, &json_message) == 0
+      && position_consumer_read(
+          consumer,
+          message->topic,
+          props,
+          position.vehicle,
+          sizeof(position.vehicle),
+          &position.sequence))
+  {
+    uint32_t owner = core_runtime_shard_for_key(shard->runtime, position.vehicle);
+
+    position.coordinates = json_message.coordinates;
+    if (owner == shard->index)
+    {
+      _update_vehicle(shard, &position);
+    }
+    else if (
+        core_runtime_send(shard->runtime, owner, _update_vehicle, &position, sizeof(position))
+        != 0)
+    {
+      LOG_ERROR(
+          "Dropped the position of %s, the mailbox of core %u is full", position.vehicle, owner);
+    }
+  }
+
+  geojson_point_destroy(&json_message);
+}
+
+static int _init_core(core_shard* shard)
+{
+  position_consumer* consumer = malloc(sizeof(position_consumer));
+
+  if (consumer == NULL)
+  {
+    return -1;
+  }
+  if (position_consumer_init(consumer, shard->index) != 0)
+  {
+    free(consumer);
+    return -1;
+  }
+  shard->state = consumer;
+  return 0;
+}
+
+static void _destroy_core(core_shard* shard)
+{
+  position_consumer_destroy(shard->state);
+  free(shard->state);
+  shard->state = NULL;
+}
+
+int core_consumer_run(
+    const mqtt_client_connection_settings* connection_settings,
+    int core_count,
+    int mqtt_version,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props))
+{
+  core_runtime runtime;
+  core_runtime_options options = { 0 };
+  core_shard_stats stats;
+
+  options.core_count = (uint32_t)core_count;
+  options.connect = true;
+  options.connection_settings = connection_settings;
+  options.mqtt_version = mqtt_version;
+  options.on_connect_with_subscribe = on_connect_with_subscribe;
+  options.handle_message = _handle_message;
+  options.shard_init = _init_core;
+  options.shard_destroy = _destroy_core;
+  if (core_runtime_start(&runtime, &options) != 0)
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  while (keep_running)
+  {
+    sleep(1);
+    for (uint32_t i = 0; i < runtime.core_count; i++)
+    {
+      core_runtime_send(&runtime, i, _tick, NULL, 0);
+    }
+  }
+
+  core_runtime_stats(&runtime, &stats);
+  core_runtime_stop(&runtime);
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Received %llu messages (%llu bytes) on %u cores, %.2f us per message, %llu positions sent "
+      "to other cores, %llu dropped, %llu reconnects",
+      (unsigned long long)stats.messages,
+      (unsigned long long)stats.message_bytes,
+      runtime.core_count,
+      stats.messages > 0 ? stats.handler_ns / 1e3 / stats.messages : 0,
+      (unsigned long long)stats.tasks_sent,
+      (unsigned long long)stats.mailbox_full,
+      (unsigned long long)stats.reconnects);
+  return MOSQ_ERR_SUCCESS;
+}
@@ -0,0 +1,32 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef CORE_CONSUMER_H
+#define CORE_CONSUMER_H
+
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+
+/**
+ * @brief Receives the positions on a connection per core with CONSUMER_CORES, see core_runtime.h,
+ * until keep_running is cleared. Each core has its own position_consumer, and the positions of a
+ * vehicle are handled by the core owning it, picked by hashing the vehicle id.
+ *
+ * @param connection_settings The settings the connections of the cores are made with.
+ * @param core_count The number of cores to receive on.
+ * @param mqtt_version The MQTT version of the connections.
+ * @param on_connect_with_subscribe The callback subscribing each connection.
+ * @return int MOSQ_ERR_SUCCESS, or MOSQ_ERR_UNKNOWN if the cores failed to start.
+ */
+int core_consumer_run(
+    const mqtt_client_connection_settings* connection_settings,
+    int core_count,
+    int mqtt_version,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props));
+
+#endif /* CORE_CONSUMER_H */
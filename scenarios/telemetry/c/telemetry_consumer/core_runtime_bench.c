@@ -0,0 +1,319 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Measures how the core_runtime scales with the number of cores, without a broker: every core
+ * generates vehicle positions as if they had been received on its connection, and checks each of
+ * them against the geofences of the core owning the vehicle, sending it through the mailbox of
+ * that core when it is another one. The run is repeated with 1, 2, 4... cores up to the number
+ * given.
+ *
+ * Usage: core_runtime_bench [max cores] [positions per core] [fences] [vehicles]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core_runtime.h"
+#include "geofence.h"
+
+#define DEFAULT_POSITIONS_PER_CORE 1000000
+#define DEFAULT_FENCES 10000
+#define DEFAULT_VEHICLES 100000
+#define RING_POINTS 12
+#define BATCH_SIZE 256
+#define AREA_X -122.8
+#define AREA_Y 47.1
+#define AREA_SIZE 1.0
+#define FENCE_RADIUS 0.01
+#define VEHICLE_STEP 0.001
+#define GOLDEN_RATIO 0.6180339887498949
+
+typedef struct vehicle_position
+{
+  double x;
+  double y;
+  char vehicle[CORE_TASK_DATA_SIZE - 2 * sizeof(double)];
+} vehicle_position;
+
+typedef struct bench_shard
+{
+  geofence_engine geofences;
+  uint64_t random;
+  uint64_t generated;
+  uint64_t updated;
+  uint64_t sent;
+  bool generating;
+  bool pending;
+  uint32_t pending_owner;
+  vehicle_position pending_position;
+} bench_shard;
+
+static double* rings;
+static int fence_count = DEFAULT_FENCES;
+static int vehicle_count = DEFAULT_VEHICLES;
+static uint64_t positions_per_core = DEFAULT_POSITIONS_PER_CORE;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64, so every core draws its own positions without sharing the state of rand(). */
+static double next_random(uint64_t* state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void count_update(bench_shard* state)
+{
+  __atomic_store_n(&state->updated, state->updated + 1, __ATOMIC_RELEASE);
+}
+
+static void update_geofences(core_shard* shard, void* data)
+{
+  bench_shard* state = shard->state;
+  vehicle_position* position = data;
+
+  geofence_engine_update(
+      &state->geofences, position->vehicle, position->x, position->y, NULL, NULL);
+  count_update(state);
+}
+
+/* Sends a position to the core owning its vehicle, returns false if its mailbox is full. */
+static bool route(core_shard* shard, uint32_t owner, vehicle_position* position)
+{
+  bench_shard* state = shard->state;
+
+  if (owner == shard->index)
+  {
+    update_geofences(shard, position);
+    return true;
+  }
+  if (core_runtime_send(shard->runtime, owner, update_geofences, position, sizeof(*position)) != 0)
+  {
+    return false;
+  }
+  __atomic_store_n(&state->sent, state->sent + 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+/* Generates a batch of positions, then sends itself to generate the next one, so the mailbox and
+ * the positions of the other cores run in between. */
+static void generate(core_shard* shard, void* data)
+{
+  bench_shard* state = shard->state;
+
+  for (int i = 0; i < BATCH_SIZE && state->generated < positions_per_core; i++)
+  {
+    vehicle_position position;
+    uint32_t owner;
+    uint32_t vehicle;
+    double offset;
+
+    if (state->pending)
+    {
+      if (!route(shard, state->pending_owner, &state->pending_position))
+      {
+        break;
+      }
+      state->pending = false;
+      state->generated++;
+      continue;
+    }
+
+    vehicle = (uint32_t)(next_random(&state->random) * vehicle_count);
+    offset = vehicle * GOLDEN_RATIO;
+    position.x = AREA_X + (offset - floor(offset)) * AREA_SIZE
+        + (next_random(&state->random) - 0.5) * VEHICLE_STEP;
+    offset = vehicle * GOLDEN_RATIO * GOLDEN_RATIO;
+    position.y = AREA_Y + (offset - floor(offset)) * AREA_SIZE
+        + (next_random(&state->random) - 0.5) * VEHICLE_STEP;
+    snprintf(position.vehicle, sizeof(position.vehicle), "vehicle%u", vehicle);
+    owner = core_runtime_shard_for_key(shard->runtime, position.vehicle);
+
+    if (!route(shard, owner, &position))
+    {
+      state->pending = true;
+      state->pending_owner = owner;
+      state->pending_position = position;
+      break;
+    }
+    state->generated++;
+  }
+
+  if (state->generated < positions_per_core
+      && core_runtime_send(shard->runtime, shard->index, generate, NULL, 0) != 0)
+  {
+    /* The main thread restarts the generation once the mailbox has room again. */
+    __atomic_store_n(&state->generating, false, __ATOMIC_RELEASE);
+  }
+}
+
+static int init_shard(core_shard* shard)
+{
+  bench_shard* state = calloc(1, sizeof(bench_shard));
+
+  if (state == NULL)
+  {
+    return -1;
+  }
+  shard->state = state;
+  state->random = 0x9E3779B97F4A7C15ULL * (shard->index + 1);
+
+  /* Every core has its own copy of the geofences, allocated on its NUMA node. */
+  geofence_engine_init(&state->geofences);
+  for (int f = 0; f < fence_count; f++)
+  {
+    if (geofence_engine_add(&state->geofences, "fence") < 0
+        || geofence_engine_add_ring(
+               &state->geofences, rings + (size_t)f * RING_POINTS * 2, RING_POINTS)
+            != 0)
+    {
+      return -1;
+    }
+  }
+  return geofence_engine_build(&state->geofences);
+}
+
+static void destroy_shard(core_shard* shard)
+{
+  bench_shard* state = shard->state;
+  geofence_engine_destroy(&state->geofences);
+  free(state);
+}
+
+static double run(uint32_t core_count, uint64_t* sent, core_shard_stats* stats)
+{
+  core_runtime runtime;
+  core_runtime_options options = { 0 };
+  uint64_t total = positions_per_core * core_count;
+  uint64_t updated = 0;
+  int64_t start;
+  double elapsed;
+
+  options.core_count = core_count;
+  options.shard_init = init_shard;
+  options.shard_destroy = destroy_shard;
+  if (core_runtime_start(&runtime, &options) != 0)
+  {
+    return -1;
+  }
+
+  start = now_ns();
+  while (updated < total)
+  {
+    updated = 0;
+    for (uint32_t i = 0; i < core_count; i++)
+    {
+      bench_shard* state = runtime.shards[i]->state;
+      updated += __atomic_load_n(&state->updated, __ATOMIC_ACQUIRE);
+      if (!__atomic_load_n(&state->generating, __ATOMIC_ACQUIRE)
+          && core_runtime_send(&runtime, i, generate, NULL, 0) == 0)
+      {
+        __atomic_store_n(&state->generating, true, __ATOMIC_RELAXED);
+      }
+    }
+    usleep(100);
+  }
+  elapsed = (now_ns() - start) / 1e9;
+
+  *sent = 0;
+  for (uint32_t i = 0; i < core_count; i++)
+  {
+    bench_shard* state = runtime.shards[i]->state;
+    *sent += __atomic_load_n(&state->sent, __ATOMIC_RELAXED);
+  }
+  core_runtime_stats(&runtime, stats);
+  core_runtime_stop(&runtime);
+  return elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t max_cores = argc > 1 ? (uint32_t)atoi(argv[1]) : (uint32_t)(online > 0 ? online : 1);
+  double single_core_rate = 0;
+
+  if (argc > 2)
+  {
+    positions_per_core = (uint64_t)atoll(argv[2]);
+  }
+  if (argc > 3)
+  {
+    fence_count = atoi(argv[3]);
+  }
+  if (argc > 4)
+  {
+    vehicle_count = atoi(argv[4]);
+  }
+  if (max_cores == 0 || positions_per_core == 0 || fence_count <= 0 || vehicle_count <= 0)
+  {
+    fprintf(
+        stderr, "Usage: %s [max cores] [positions per core] [fences] [vehicles]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if ((rings = malloc((size_t)fence_count * RING_POINTS * 2 * sizeof(double))) == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (int f = 0; f < fence_count; f++)
+  {
+    double* ring = rings + (size_t)f * RING_POINTS * 2;
+    double center_x = AREA_X + rand() / (double)RAND_MAX * AREA_SIZE;
+    double center_y = AREA_Y + rand() / (double)RAND_MAX * AREA_SIZE;
+
+    for (int i = 0; i < RING_POINTS; i++)
+    {
+      double angle = 2 * M_PI * i / RING_POINTS;
+      double r = FENCE_RADIUS * (0.4 + 0.6 * rand() / (double)RAND_MAX);
+      ring[2 * i] = center_x + r * cos(angle);
+      ring[2 * i + 1] = center_y + r * sin(angle);
+    }
+  }
+
+  printf("cores  positions/s  per core  scaling  cross-core  mailbox full\n");
+  for (uint32_t cores = 1;; cores = cores * 2 > max_cores ? max_cores : cores * 2)
+  {
+    core_shard_stats stats;
+    uint64_t sent;
+    double elapsed = run(cores, &sent, &stats);
+    double rate;
+
+    if (elapsed < 0)
+    {
+      return EXIT_FAILURE;
+    }
+    rate = positions_per_core * cores / elapsed;
+    if (cores == 1)
+    {
+      single_core_rate = rate;
+    }
+    printf(
+        "%5u  %11.0f  %8.0f  %6.2fx  %9.1f%%  %12llu\n",
+        cores,
+        rate,
+        rate / cores,
+        rate / single_core_rate,
+        100.0 * sent / (positions_per_core * cores),
+        (unsigned long long)stats.mailbox_full);
+    if (cores == max_cores)
+    {
+      break;
+    }
+  }
+
+  free(rings);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Measures the geofence_engine with random star shaped fences spread over an area of about 1 by 1
+ * degree, and vehicles moving across it: the positions evaluated per second by
+ * geofence_engine_update(), the fences left to test per position by the grid, and the time taken
+ * to test the same positions against every fence edge by edge instead.
+ *
+ * Usage: geofence_bench [fences] [positions] [vehicles]
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "geofence.h"
+
+#define DEFAULT_FENCES 10000
+#define DEFAULT_POSITIONS 2000000
+#define DEFAULT_VEHICLES 1000
+#define MAX_RING_POINTS 32
+#define BRUTE_FORCE_POSITIONS 2000
+#define AREA_X -122.8
+#define AREA_Y 47.1
+#define AREA_SIZE 1.0
+#define MAX_FENCE_RADIUS 0.01
+#define VEHICLE_STEP 0.0005
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double random_between(double min, double max)
+{
+  return min + rand() / (double)RAND_MAX * (max - min);
+}
+
+static bool ring_contains(const double* ring, int point_count, double x, double y)
+{
+  bool inside = false;
+  for (int i = 0, j = point_count - 1; i < point_count; j = i++)
+  {
+    double xi = ring[2 * i];
+    double yi = ring[2 * i + 1];
+    double xj = ring[2 * j];
+    double yj = ring[2 * j + 1];
+    if ((yi > y) != (yj > y) && x < xi + (y - yi) * (xj - xi) / (yj - yi))
+    {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+static void count_transition(
+    const char* vehicle,
+    uint32_t fence,
+    const char* name,
+    geofence_transition transition,
+    void* context)
+{
+  (*(uint64_t*)context)++;
+}
+
+int main(int argc, char* argv[])
+{
+  geofence_engine engine;
+  int fences = argc > 1 ? atoi(argv[1]) : DEFAULT_FENCES;
+  int positions = argc > 2 ? atoi(argv[2]) : DEFAULT_POSITIONS;
+  int vehicles = argc > 3 ? atoi(argv[3]) : DEFAULT_VEHICLES;
+  double* rings;
+  int* point_counts;
+  double* vehicle_xy;
+  char (*vehicle_ids)[32];
+  uint32_t* inside;
+  uint64_t transitions = 0;
+  uint64_t grid_matches = 0;
+  uint64_t brute_force_matches = 0;
+  int64_t start;
+  double build_elapsed;
+  double update_elapsed;
+  double grid_elapsed;
+  double brute_force_elapsed;
+
+  if (fences <= 0 || positions <= 0 || vehicles <= 0)
+  {
+    fprintf(stderr, "Usage: %s [fences] [positions] [vehicles]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  rings = malloc((size_t)fences * MAX_RING_POINTS * 2 * sizeof(double));
+  point_counts = malloc((size_t)fences * sizeof(int));
+  vehicle_xy = malloc((size_t)vehicles * 2 * sizeof(double));
+  vehicle_ids = malloc((size_t)vehicles * sizeof(*vehicle_ids));
+  inside = malloc((size_t)fences * sizeof(uint32_t));
+  if (rings == NULL || point_counts == NULL || vehicle_xy == NULL || vehicle_ids == NULL
+      || inside == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  srand(1);
+  geofence_engine_init(&engine);
+  start = now_ns();
+  for (int f = 0; f < fences; f++)
+  {
+    double* ring = rings + (size_t)f * MAX_RING_POINTS * 2;
+    double center_x = random_between(AREA_X, AREA_X + AREA_SIZE);
+    double center_y = random_between(AREA_Y, AREA_Y + AREA_SIZE);
+    double radius = random_between(MAX_FENCE_RADIUS / 10, MAX_FENCE_RADIUS);
+    char name[32];
+
+    point_counts[f] = 4 + rand() % (MAX_RING_POINTS - 3);
+    for (int i = 0; i < point_counts[f]; i++)
+    {
+      double angle = 2 * M_PI * i / point_counts[f];
+      double r = radius * random_between(0.4, 1);
+      ring[2 * i] = center_x + r * cos(angle);
+      ring[2 * i + 1] = center_y + r * sin(angle);
+    }
+    snprintf(name, sizeof(name), "fence%d", f);
+    if (geofence_engine_add(&engine, name) < 0
+        || geofence_engine_add_ring(&engine, ring, (size_t)point_counts[f]) != 0)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+  if (geofence_engine_build(&engine) != 0)
+  {
+    return EXIT_FAILURE;
+  }
+  build_elapsed = (now_ns() - start) / 1e9;
+  printf(
+      "build: %d fences, %zu edges, %ux%u grid in %.3f s\n",
+      fences,
+      engine.edge_count,
+      engine.columns,
+      engine.rows,
+      build_elapsed);
+
+  for (int v = 0; v < vehicles; v++)
+  {
+    snprintf(vehicle_ids[v], sizeof(vehicle_ids[v]), "vehicle%d", v);
+    vehicle_xy[2 * v] = random_between(AREA_X, AREA_X + AREA_SIZE);
+    vehicle_xy[2 * v + 1] = random_between(AREA_Y, AREA_Y + AREA_SIZE);
+  }
+
+  /* Vehicles take turns moving a small random step, like positions arriving from a fleet. */
+  start = now_ns();
+  for (int p = 0; p < positions; p++)
+  {
+    int v = p % vehicles;
+    vehicle_xy[2 * v] += random_between(-VEHICLE_STEP, VEHICLE_STEP);
+    vehicle_xy[2 * v + 1] += random_between(-VEHICLE_STEP, VEHICLE_STEP);
+    geofence_engine_update(
+        &engine,
+        vehicle_ids[v],
+        vehicle_xy[2 * v],
+        vehicle_xy[2 * v + 1],
+        count_transition,
+        &transitions);
+  }
+  update_elapsed = (now_ns() - start) / 1e9;
+  printf(
+      "update: %d positions of %d vehicles in %.3f s (%.0f positions/s, %.3f us each), %llu "
+      "transitions\n",
+      positions,
+      vehicles,
+      update_elapsed,
+      positions / update_elapsed,
+      update_elapsed * 1e6 / positions,
+      (unsigned long long)transitions);
+  printf(
+      "grid: %.2f candidate fences per position\n",
+      (double)engine.candidates / engine.queries);
+
+  /* The same positions with and without the grid, on a subset small enough for every fence. */
+  srand(2);
+  start = now_ns();
+  for (int p = 0; p < BRUTE_FORCE_POSITIONS; p++)
+  {
+    double x = random_between(AREA_X, AREA_X + AREA_SIZE);
+    double y = random_between(AREA_Y, AREA_Y + AREA_SIZE);
+    grid_matches += geofence_engine_contains(&engine, x, y, inside, (size_t)fences);
+  }
+  grid_elapsed = (now_ns() - start) / 1e9;
+
+  srand(2);
+  start = now_ns();
+  for (int p = 0; p < BRUTE_FORCE_POSITIONS; p++)
+  {
+    double x = random_between(AREA_X, AREA_X + AREA_SIZE);
+    double y = random_between(AREA_Y, AREA_Y + AREA_SIZE);
+    for (int f = 0; f < fences; f++)
+    {
+      brute_force_matches
+          += ring_contains(rings + (size_t)f * MAX_RING_POINTS * 2, point_counts[f], x, y);
+    }
+  }
+  brute_force_elapsed = (now_ns() - start) / 1e9;
+  printf(
+      "brute force: %.3f us per position against every fence, %.3f us with the grid (%.0fx), "
+      "%llu and %llu matches\n",
+      brute_force_elapsed * 1e6 / BRUTE_FORCE_POSITIONS,
+      grid_elapsed * 1e6 / BRUTE_FORCE_POSITIONS,
+      brute_force_elapsed / grid_elapsed,
+      (unsigned long long)brute_force_matches,
+      (unsigned long long)grid_matches);
+
+  geofence_engine_destroy(&engine);
+  free(rings);
+  free(point_counts);
+  free(vehicle_xy);
+  free(vehicle_ids);
+  free(inside);
+  return brute_force_matches == grid_matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "geofence_consumer.h"
+#include "logging.h"
+#include "mqtt_setup.h"
+
+static char* geofence_file = NULL;
+/* Stats of the destroyed geofences. Each thread has its own vehicles, so their counts add up. */
+static uint64_t queries = 0;
+static uint64_t candidates = 0;
+static uint64_t vehicles = 0;
+
+static void _print_geofence_event(
+    const char* vehicle,
+    uint32_t fence,
+    const char* name,
+    geofence_transition transition,
+    void* context)
+{
+  printf(
+      "\t%s %s geofence %s\n",
+      vehicle,
+      transition == GEOFENCE_ENTER ? "entered" : "exited",
+      name);
+}
+
+bool geofence_consumer_init(void)
+{
+  return set_char_connection_setting(&geofence_file, "GEOFENCE_FILE", false);
+}
+
+int geofence_consumer_create(geofence_engine** engine)
+{
+  int fence_count;
+
+  if (geofence_file == NULL)
+  {
+    *engine = NULL;
+    return 0;
+  }
+  if ((*engine = malloc(sizeof(geofence_engine))) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return -1;
+  }
+  geofence_engine_init(*engine);
+  if ((fence_count = geojson_file_to_geofences(geofence_file, *engine)) < 0)
+  {
+    geofence_engine_destroy(*engine);
+    free(*engine);
+    *engine = NULL;
+    return -1;
+  }
+  LOG_INFO(CLIENT_LOG_TAG, "Loaded %d geofences from %s", fence_count, geofence_file);
+  return 0;
+}
+
+void geofence_consumer_update(
+    geofence_engine* engine,
+    const char* vehicle,
+    const geojson_coordinates* coordinates)
+{
+  if (engine != NULL)
+  {
+    geofence_engine_update(
+        engine, vehicle, coordinates->x, coordinates->y, _print_geofence_event, NULL);
+  }
+}
+
+void geofence_consumer_destroy(geofence_engine* engine)
+{
+  if (engine == NULL)
+  {
+    return;
+  }
+  __atomic_fetch_add(&queries, engine->queries, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&candidates, engine->candidates, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&vehicles, engine->vehicle_count, __ATOMIC_RELAXED);
+  geofence_engine_destroy(engine);
+  free(engine);
+}
+
+void geofence_consumer_log_stats(void)
+{
+  if (geofence_file == NULL)
+  {
+    return;
+  }
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Checked %llu positions of %llu vehicles, %.2f candidate geofences per position",
+      (unsigned long long)queries,
+      (unsigned long long)vehicles,
+      queries > 0 ? (double)candidates / queries : 0);
+}
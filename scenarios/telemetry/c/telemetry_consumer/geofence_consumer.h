@@ -0,0 +1,52 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef GEOFENCE_CONSUMER_H
+#define GEOFENCE_CONSUMER_H
+
+#include <stdbool.h>
+
+#include "geo_json_handler.h"
+#include "geofence.h"
+
+/*
+ * Geofences of the telemetry_consumer, loaded from the GeoJSON file set in GEOFENCE_FILE. Each
+ * thread handling positions loads its own copy, and prints the vehicles entering and leaving them.
+ */
+
+/**
+ * @brief Reads GEOFENCE_FILE.
+ *
+ * @return bool true on success, false if the setting is invalid.
+ */
+bool geofence_consumer_init(void);
+
+/**
+ * @brief Loads the geofences of a thread. Must be freed with geofence_consumer_destroy().
+ *
+ * @param engine Set to the geofences, or to NULL when GEOFENCE_FILE is not set.
+ * @return int 0 on success, -1 on failure.
+ */
+int geofence_consumer_create(geofence_engine** engine);
+
+/**
+ * @brief Checks the position of a vehicle against the geofences, printing the ones it entered or
+ * exited. Does nothing if engine is NULL.
+ */
+void geofence_consumer_update(
+    geofence_engine* engine,
+    const char* vehicle,
+    const geojson_coordinates* coordinates);
+
+/**
+ * @brief Adds the stats of the geofences to the ones logged by geofence_consumer_log_stats() and
+ * frees them. Can be called from any thread, does nothing if engine is NULL.
+ */
+void geofence_consumer_destroy(geofence_engine* engine);
+
+/**
+ * @brief Logs the stats of the destroyed geofences, if GEOFENCE_FILE is set.
+ */
+void geofence_consumer_log_stats(void);
+
+#endif /* GEOFENCE_CONSUMER_H */
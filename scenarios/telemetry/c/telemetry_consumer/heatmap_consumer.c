@@ -0,0 +1,169 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "heatmap_consumer.h"
+#include "logging.h"
+#include "mqtt_setup.h"
+#include "telemetry_topics.h"
+
+#define QOS_LEVEL 1
+#define HEATMAP_MAX_CELLS 4096
+#define HEATMAP_MAX_VEHICLES 16384
+
+static int heatmap_precision = 0;
+static int heatmap_window_sec = 0;
+static int heatmap_slide_sec = 0;
+static geo_heatmap heatmap;
+static char heatmap_topic[TOPIC_SIZE(HEATMAP_TOPIC)];
+/* Only used by the thread of shard 0, which publishes the heatmap. */
+static char* heatmap_payload = NULL;
+static size_t heatmap_payload_size = 0;
+
+/* Heatmap windows follow the wall clock, so that they line up with those of the dashboards. */
+static int64_t _now_ms(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Publishes a closed window of the heatmap on the connection passed as context. Windows without
+ * positions are not published. */
+static void _publish_summary(const geo_heatmap_summary* summary, void* context)
+{
+  struct mosquitto* mosq = context;
+  int length;
+  int result;
+
+  if (summary->cell_count == 0)
+  {
+    return;
+  }
+  if ((length = geo_heatmap_format_summary(summary, heatmap_payload, heatmap_payload_size)) < 0)
+  {
+    LOG_ERROR("Failed to format the heatmap of %u cells", summary->cell_count);
+  }
+  else if (
+      (result = mosquitto_publish_v5(
+           mosq, NULL, heatmap_topic, length, heatmap_payload, QOS_LEVEL, false, NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to publish the heatmap: %s", mosquitto_strerror(result));
+  }
+}
+
+/* The topic is named after the grid and the windows, ex. heatmaps/geohash5-60s/summary or
+ * heatmaps/geohash5-60s-10s/summary for sliding windows. */
+bool heatmap_consumer_init(uint32_t shard_count)
+{
+  geo_heatmap_options options = { 0 };
+  char name[TOPIC_LEVEL_MAX_LENGTH + 1];
+
+  if (!set_int_connection_setting(&heatmap_precision, "HEATMAP_PRECISION", 0)
+      || !set_int_connection_setting(&heatmap_window_sec, "HEATMAP_WINDOW_SEC", 60)
+      || !set_int_connection_setting(&heatmap_slide_sec, "HEATMAP_SLIDE_SEC", 0))
+  {
+    heatmap_precision = 0;
+    return false;
+  }
+  if (heatmap_precision <= 0)
+  {
+    return true;
+  }
+  if (heatmap_window_sec <= 0 || heatmap_slide_sec < 0 || heatmap_slide_sec > heatmap_window_sec)
+  {
+    LOG_ERROR(
+        "HEATMAP_WINDOW_SEC must be positive and HEATMAP_SLIDE_SEC at most HEATMAP_WINDOW_SEC");
+    heatmap_precision = 0;
+    return false;
+  }
+  if (heatmap_slide_sec == 0 || heatmap_slide_sec == heatmap_window_sec)
+  {
+    snprintf(name, sizeof(name), "geohash%d-%ds", heatmap_precision, heatmap_window_sec);
+  }
+  else
+  {
+    snprintf(
+        name,
+        sizeof(name),
+        "geohash%d-%ds-%ds",
+        heatmap_precision,
+        heatmap_window_sec,
+        heatmap_slide_sec);
+  }
+  TOPIC_FORMAT(heatmap_topic, HEATMAP_TOPIC, name);
+
+  options.precision = (uint32_t)heatmap_precision;
+  options.window_ms = (uint32_t)heatmap_window_sec * 1000;
+  options.slide_ms = (uint32_t)heatmap_slide_sec * 1000;
+  options.shard_count = shard_count;
+  options.max_cells = HEATMAP_MAX_CELLS;
+  options.max_vehicles = HEATMAP_MAX_VEHICLES;
+  if (geo_heatmap_init(&heatmap, &options, _now_ms()) != 0)
+  {
+    heatmap_precision = 0;
+    return false;
+  }
+  heatmap_payload_size
+      = GEO_HEATMAP_SUMMARY_JSON_MAX_LENGTH + HEATMAP_MAX_CELLS * GEO_HEATMAP_CELL_JSON_MAX_LENGTH;
+  if ((heatmap_payload = malloc(heatmap_payload_size)) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    heatmap_consumer_destroy();
+    return false;
+  }
+  LOG_INFO(CLIENT_LOG_TAG, "Publishing the heatmap of the positions to %s", heatmap_topic);
+  return true;
+}
+
+bool heatmap_consumer_enabled(void) { return heatmap_precision > 0; }
+
+void heatmap_consumer_update(
+    uint32_t shard,
+    const char* vehicle,
+    const geojson_coordinates* coordinates)
+{
+  if (heatmap_precision > 0)
+  {
+    geo_heatmap_update(&heatmap, shard, vehicle, coordinates->x, coordinates->y, _now_ms());
+  }
+}
+
+void heatmap_consumer_tick(uint32_t shard, struct mosquitto* mosq)
+{
+  if (heatmap_precision <= 0)
+  {
+    return;
+  }
+  geo_heatmap_advance(&heatmap, shard, _now_ms());
+  if (shard == 0)
+  {
+    geo_heatmap_collect(&heatmap, _publish_summary, mosq);
+  }
+}
+
+void heatmap_consumer_destroy(void)
+{
+  geo_heatmap_stats stats;
+
+  if (heatmap_precision > 0)
+  {
+    geo_heatmap_read_stats(&heatmap, &stats);
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Added %llu positions to the heatmap, %llu of untracked vehicles, %llu cells and %llu "
+        "windows dropped",
+        (unsigned long long)stats.positions,
+        (unsigned long long)stats.dropped_vehicles,
+        (unsigned long long)stats.dropped_cells,
+        (unsigned long long)stats.dropped_windows);
+    geo_heatmap_destroy(&heatmap);
+    heatmap_precision = 0;
+  }
+  free(heatmap_payload);
+  heatmap_payload = NULL;
+}
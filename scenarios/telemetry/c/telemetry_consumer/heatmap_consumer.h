@@ -0,0 +1,56 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef HEATMAP_CONSUMER_H
+#define HEATMAP_CONSUMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "geo_heatmap.h"
+#include "geo_json_handler.h"
+#include "mosquitto.h"
+
+/*
+ * Heatmap of the positions received by the telemetry_consumer, published to HEATMAP_TOPIC when
+ * HEATMAP_PRECISION is set. Each thread handling positions updates its own shard, and the thread of
+ * shard 0 publishes the windows once every shard closed them.
+ */
+
+/**
+ * @brief Reads HEATMAP_PRECISION, HEATMAP_WINDOW_SEC (60 by default) and HEATMAP_SLIDE_SEC (0 by
+ * default), and allocates the heatmap if HEATMAP_PRECISION is set. Must be freed with
+ * heatmap_consumer_destroy().
+ *
+ * @param shard_count The number of threads handling positions.
+ * @return bool true on success, false if the settings are invalid or on allocation failure.
+ */
+bool heatmap_consumer_init(uint32_t shard_count);
+
+/**
+ * @brief Whether HEATMAP_PRECISION is set.
+ */
+bool heatmap_consumer_enabled(void);
+
+/**
+ * @brief Adds the position of a vehicle to a shard of the heatmap, if HEATMAP_PRECISION is set.
+ * Only called by the thread of the shard.
+ */
+void heatmap_consumer_update(
+    uint32_t shard,
+    const char* vehicle,
+    const geojson_coordinates* coordinates);
+
+/**
+ * @brief Closes the windows of a shard that ended, if HEATMAP_PRECISION is set. On shard 0, also
+ * publishes the windows closed by every shard on mosq. Called each second by the thread of the
+ * shard, so that windows close even when positions stop.
+ */
+void heatmap_consumer_tick(uint32_t shard, struct mosquitto* mosq);
+
+/**
+ * @brief Logs the stats of the heatmap and frees it, once no thread uses it anymore.
+ */
+void heatmap_consumer_destroy(void);
+
+#endif /* HEATMAP_CONSUMER_H */
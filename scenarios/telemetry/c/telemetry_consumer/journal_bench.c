@@ -0,0 +1,145 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Measures the message_journal with position messages like the ones of telemetry_producer: the
+ * latency of each append while the sync thread commits in the background, the append throughput,
+ * and the time to read the journal back and to seek into it.
+ *
+ * Usage: journal_bench <directory> [messages] [sync batch] [sync interval ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "latency_histogram.h"
+#include "message_journal.h"
+
+#define DEFAULT_MESSAGES 1000000
+#define VEHICLES 100
+#define NS_PER_US 1000.0
+#define SEEK_COUNT 1000
+
+static const double reported_percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+
+static int64_t now_ns(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[])
+{
+  message_journal journal;
+  message_journal_options options = { 0 };
+  message_journal_reader reader;
+  message_journal_record record;
+  latency_histogram latency;
+  struct mosquitto_message message = { 0 };
+  char topic[64];
+  char payload[128];
+  int messages = argc > 2 ? atoi(argv[2]) : DEFAULT_MESSAGES;
+  int64_t first_timestamp;
+  int64_t start;
+  double append_elapsed;
+  double read_elapsed;
+  uint64_t read_count = 0;
+  uint64_t read_bytes = 0;
+
+  if (argc < 2 || messages <= 0)
+  {
+    fprintf(stderr, "Usage: %s <directory> [messages] [sync batch] [sync interval ms]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  options.directory = argv[1];
+  options.sync_batch = argc > 3 ? (uint32_t)atoi(argv[3]) : 0;
+  options.sync_interval_ms = argc > 4 ? (uint32_t)atoi(argv[4]) : 0;
+  if (message_journal_open(&journal, &options) != 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  latency_histogram_reset(&latency);
+  message.topic = topic;
+  message.payload = payload;
+  message.qos = 1;
+  first_timestamp = now_ns(CLOCK_REALTIME);
+  start = now_ns(CLOCK_MONOTONIC);
+  for (int i = 0; i < messages; i++)
+  {
+    int64_t append_start;
+
+    snprintf(topic, sizeof(topic), "vehicles/vehicle%d/position", i % VEHICLES);
+    message.payloadlen = snprintf(
+        payload,
+        sizeof(payload),
+        "{\"type\":\"Point\",\"coordinates\":[%.6f,%.6f]}",
+        47.6 + (i % 1000) * 1e-5,
+        -122.3 - (i % 1000) * 1e-5);
+
+    append_start = now_ns(CLOCK_MONOTONIC);
+    message_journal_append(&journal, &message, NULL, now_ns(CLOCK_REALTIME));
+    latency_histogram_record(&latency, (uint64_t)(now_ns(CLOCK_MONOTONIC) - append_start));
+  }
+  append_elapsed = (now_ns(CLOCK_MONOTONIC) - start) / 1e9;
+  message_journal_close(&journal);
+
+  printf(
+      "append: %llu messages, %.1f MB in %.3f s (%.0f messages/s, %.1f MB/s), %llu dropped\n",
+      (unsigned long long)journal.appended,
+      journal.appended_bytes / 1e6,
+      append_elapsed,
+      journal.appended / append_elapsed,
+      journal.appended_bytes / 1e6 / append_elapsed,
+      (unsigned long long)journal.dropped);
+  printf(
+      "sync: %llu group commits, longest %.3f ms\n",
+      (unsigned long long)journal.syncs,
+      journal.max_sync_ns / 1e6);
+  printf("append latency (us):\n");
+  for (size_t i = 0; i < sizeof(reported_percentiles) / sizeof(reported_percentiles[0]); i++)
+  {
+    printf(
+        "\tp%-6g %.2f\n",
+        reported_percentiles[i],
+        latency_histogram_value_at_percentile(&latency, reported_percentiles[i]) / NS_PER_US);
+  }
+  printf("\tmax     %.2f\n", latency.max / NS_PER_US);
+
+  if (message_journal_reader_open(&reader, argv[1]) != 0)
+  {
+    return EXIT_FAILURE;
+  }
+  start = now_ns(CLOCK_MONOTONIC);
+  while (message_journal_reader_next(&reader, &record) == 1)
+  {
+    read_count++;
+    read_bytes += record.payload_length;
+  }
+  read_elapsed = (now_ns(CLOCK_MONOTONIC) - start) / 1e9;
+  printf(
+      "read: %llu messages, %.1f MB of payload in %.3f s (%.0f messages/s)\n",
+      (unsigned long long)read_count,
+      read_bytes / 1e6,
+      read_elapsed,
+      read_count / read_elapsed);
+
+  /* Seeks spread over the time the messages of this run were appended. */
+  srand(1);
+  start = now_ns(CLOCK_MONOTONIC);
+  for (int i = 0; i < SEEK_COUNT; i++)
+  {
+    double position = (double)rand() / RAND_MAX;
+    int64_t target = first_timestamp + (int64_t)(position * append_elapsed * 1e9);
+    message_journal_reader_seek(&reader, target);
+    message_journal_reader_next(&reader, &record);
+  }
+  printf(
+      "seek: %.1f us per seek\n",
+      (now_ns(CLOCK_MONOTONIC) - start) / NS_PER_US / SEEK_COUNT);
+  message_journal_reader_close(&reader);
+  return EXIT_SUCCESS;
+}
@@ -3,16 +3,45 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "core_consumer.h"
 #include "geo_json_handler.h"
 #include "logging.h"
+#include "message_journal.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
 #include "mqtt_setup.h"
+#include "position_consumer.h"
+#include "telemetry_topics.h"
 
-#define SUB_TOPIC "vehicles/+/position"
+#define SUB_TOPIC TOPIC_FILTER(VEHICLE_POSITION_TOPIC)
+/* With CONSUMER_CORES, the broker spreads the positions over the connections of the cores. */
+#define SHARED_SUB_TOPIC "$share/telemetry_consumer/" SUB_TOPIC
 #define QOS_LEVEL 1
-#define MQTT_VERSION MQTT_PROTOCOL_V311
+/* The sequence of the positions and the content type of the compressed ones are MQTT v5
+ * properties. */
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+
+#define MAX_VEHICLE_ID_LENGTH (TOPIC_LEVEL_MAX_LENGTH + 1)
+/* Longest wait for a message of the mosquitto loop, so the timers still run without positions. */
+#define LOOP_TIMEOUT_MS 1000
+#define TICK_INTERVAL_MS 1000
+#define RECONNECT_DELAY_SEC 1
+
+/* Journal of the received messages, opened when JOURNAL_DIR is set. Only appended to from the
+ * mosquitto loop thread. */
+static message_journal journal;
+/* Result of message_journal_open_from_env(), 1 when the journal is open. */
+static int journal_opened = 0;
+
+/* Handles the positions without CONSUMER_CORES, only used from the mosquitto loop thread. */
+static position_consumer consumer;
+static bool consumer_initialized = false;
+
+static const char* sub_topic = SUB_TOPIC;
 
 // Custom callback for when a message is received.
 void print_point_telemetry_message(
@@ -21,16 +50,27 @@ void print_point_telemetry_message(
     const mosquitto_property* props)
 {
   geojson_point json_message = geojson_point_init();
+  char vehicle[MAX_VEHICLE_ID_LENGTH];
+  position_sequence sequence;
 
-  int rc = mosquitto_payload_to_geojson_point(message, &json_message);
-  if (rc == 0)
+  /* Messages are journaled as received, so a replay publishes them compressed as well. */
+  if (journal_opened > 0)
   {
-    printf("\ttype: %s\n", json_message.type);
-    printf("\tcoordinates: %f, %f\n", json_message.coordinates.x, json_message.coordinates.y);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    message_journal_append(
+        &journal, message, props, (int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
   }
-  else
+
+  if (position_consumer_parse(&consumer, message, props, &json_message) == 0)
   {
-    LOG_ERROR("Failure parsing JSON: %s", (char*)message->payload);
+    printf("\ttype: %s\n", json_message.type);
+    printf("\tcoordinates: %f, %f\n", json_message.coordinates.x, json_message.coordinates.y);
+    if (position_consumer_read(
+            &consumer, message->topic, props, vehicle, sizeof(vehicle), &sequence))
+    {
+      position_consumer_update(&consumer, vehicle, &sequence, &json_message.coordinates);
+    }
   }
 
   geojson_point_destroy(&json_message);
@@ -53,7 +93,7 @@ void on_connect_with_subscribe(
    * connection drops and is automatically resumed by the client, then the
    * subscriptions will be recreated when the client reconnects. */
   if (keep_running
-      && (result = mosquitto_subscribe_v5(mosq, NULL, SUB_TOPIC, QOS_LEVEL, 0, NULL))
+      && (result = mosquitto_subscribe_v5(mosq, NULL, sub_topic, QOS_LEVEL, 0, NULL))
           != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
@@ -66,19 +106,83 @@ void on_connect_with_subscribe(
   }
 }
 
+/* Runs the mosquitto loop on this thread, between the ticks of the position_consumer, and
+ * reconnects when the connection is lost. */
+static void run_loop(struct mosquitto* mosq)
+{
+  struct timespec now;
+  int64_t next_tick_ms = 0;
+  int result;
+
+  while (keep_running)
+  {
+    if ((result = mosquitto_loop(mosq, LOOP_TIMEOUT_MS, 1)) != MOSQ_ERR_SUCCESS && keep_running)
+    {
+      LOG_ERROR("Connection lost: %s", mosquitto_strerror(result));
+      sleep(RECONNECT_DELAY_SEC);
+      if ((result = mosquitto_reconnect(mosq)) != MOSQ_ERR_SUCCESS)
+      {
+        LOG_ERROR("Failed to reconnect: %s", mosquitto_strerror(result));
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 >= next_tick_ms)
+    {
+      position_consumer_tick(&consumer, mosq);
+      next_tick_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 + TICK_INTERVAL_MS;
+    }
+  }
+}
+
 /*
  * This sample receives telemetry messages from the broker.
  */
 int main(int argc, char* argv[])
 {
-  struct mosquitto* mosq;
+  struct mosquitto* mosq = NULL;
   int result = MOSQ_ERR_SUCCESS;
+  mqtt_client_connection_settings connection_settings;
+  int core_count;
 
   mqtt_client_obj obj;
   obj.handle_message = print_point_telemetry_message;
   obj.mqtt_version = MQTT_VERSION;
 
-  if ((mosq = mqtt_client_init(false, argv[1], on_connect_with_subscribe, &obj)) == NULL)
+  if (!mqtt_client_load_settings(argv[1], &connection_settings)
+      || !set_int_connection_setting(&core_count, "CONSUMER_CORES", 0))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (!position_consumer_setup(core_count > 0 ? (uint32_t)core_count : 1))
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (core_count > 0)
+  {
+    if (getenv("JOURNAL_DIR") != NULL)
+    {
+      LOG_WARNING("JOURNAL_DIR is ignored with CONSUMER_CORES");
+    }
+    sub_topic = SHARED_SUB_TOPIC;
+    result = core_consumer_run(
+        &connection_settings, core_count, obj.mqtt_version, on_connect_with_subscribe);
+  }
+  else if ((result = mosquitto_lib_init()) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to initialize mosquitto: %s", mosquitto_strerror(result));
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (
+      (mosq = mqtt_client_new(false, &connection_settings, on_connect_with_subscribe, &obj))
+      == NULL)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if ((journal_opened = message_journal_open_from_env(&journal)) < 0)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (!(consumer_initialized = position_consumer_init(&consumer, 0) == 0))
   {
     result = MOSQ_ERR_UNKNOWN;
   }
@@ -90,24 +194,33 @@ int main(int argc, char* argv[])
     LOG_ERROR("Failed to connect: %s", mosquitto_strerror(result));
     result = MOSQ_ERR_UNKNOWN;
   }
-  else if ((result = mosquitto_loop_start(mosq)) != MOSQ_ERR_SUCCESS)
-  {
-    LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
-    result = MOSQ_ERR_UNKNOWN;
-  }
   else
   {
-    while (keep_running)
-    {
-    }
+    run_loop(mosq);
   }
 
   if (mosq != NULL)
   {
     mosquitto_disconnect_v5(mosq, result, NULL);
-    mosquitto_loop_stop(mosq, false);
     mosquitto_destroy(mosq);
   }
+  if (journal_opened > 0)
+  {
+    message_journal_close(&journal);
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Journaled %llu messages (%llu bytes, %llu dropped) in %llu syncs, longest %.3f ms",
+        (unsigned long long)journal.appended,
+        (unsigned long long)journal.appended_bytes,
+        (unsigned long long)journal.dropped,
+        (unsigned long long)journal.syncs,
+        journal.max_sync_ns / 1e6);
+  }
+  if (consumer_initialized)
+  {
+    position_consumer_destroy(&consumer);
+  }
+  position_consumer_cleanup();
   mosquitto_lib_cleanup();
   return result;
 }
@@ -0,0 +1,184 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geofence_consumer.h"
+#include "heatmap_consumer.h"
+#include "logging.h"
+#include "position_consumer.h"
+#include "telemetry_topics.h"
+
+/* Longest decompressed position accepted, with its terminating null. */
+#define MAX_PAYLOAD_LENGTH 256
+
+/* Result of payload_codec_init_from_env(), 1 when COMPRESSION_DICTIONARY_DIR is set. */
+static int compression = 0;
+static int compression_level = 0;
+/* Stats of the codecs of the destroyed position_consumers. */
+static uint64_t decompressed = 0;
+static uint64_t decompress_failures = 0;
+
+/* Checks a position against the geofences and adds it to the heatmap, once the sequence tracker
+ * let it through if SEQUENCE_WINDOW is set. */
+static void _deliver_position(const char* vehicle, const void* item, void* context)
+{
+  position_consumer* consumer = context;
+
+  geofence_consumer_update(consumer->geofences, vehicle, item);
+  heatmap_consumer_update(consumer->shard, vehicle, item);
+}
+
+bool position_consumer_setup(uint32_t shard_count)
+{
+  payload_codec codec;
+
+  /* The codec only checks the compression settings, each thread has its own. */
+  if ((compression = payload_codec_init_from_env(&codec)) < 0)
+  {
+    return false;
+  }
+  if (compression > 0)
+  {
+    compression_level = codec.level;
+    payload_codec_destroy(&codec);
+  }
+  return geofence_consumer_init() && heatmap_consumer_init(shard_count) && sequence_consumer_init();
+}
+
+void position_consumer_cleanup(void)
+{
+  geofence_consumer_log_stats();
+  heatmap_consumer_destroy();
+  sequence_consumer_log_stats();
+  if (compression > 0)
+  {
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Decompressed %llu positions, %llu failures",
+        (unsigned long long)decompressed,
+        (unsigned long long)decompress_failures);
+  }
+}
+
+int position_consumer_init(position_consumer* consumer, uint32_t shard)
+{
+  memset(consumer, 0, sizeof(position_consumer));
+  consumer->shard = shard;
+  if (compression > 0)
+  {
+    if (payload_codec_init(&consumer->codec, compression_level) != 0)
+    {
+      return -1;
+    }
+    consumer->compression = true;
+    if (payload_codec_load_dictionaries(&consumer->codec, getenv("COMPRESSION_DICTIONARY_DIR"))
+        <= 0)
+    {
+      position_consumer_destroy(consumer);
+      return -1;
+    }
+  }
+  if (geofence_consumer_create(&consumer->geofences) != 0
+      || sequence_consumer_create(&consumer->sequences) != 0)
+  {
+    position_consumer_destroy(consumer);
+    return -1;
+  }
+  return 0;
+}
+
+int position_consumer_parse(
+    position_consumer* consumer,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    geojson_point* point)
+{
+  struct mosquitto_message decompressed_message;
+  char buffer[MAX_PAYLOAD_LENGTH];
+  size_t length;
+  int result;
+
+  if (consumer->compression)
+  {
+    result = payload_codec_decompress(
+        &consumer->codec, message, props, buffer, MAX_PAYLOAD_LENGTH - 1, &length);
+    if (result < 0)
+    {
+      return -1;
+    }
+    if (result > 0)
+    {
+      /* Null-terminated like the payloads of mosquitto, for the JSON parser. */
+      buffer[length] = '\0';
+      decompressed_message = *message;
+      decompressed_message.payload = buffer;
+      decompressed_message.payloadlen = (int)length;
+      message = &decompressed_message;
+    }
+  }
+  if (mosquitto_payload_to_geojson_point(message, point) != 0)
+  {
+    LOG_ERROR("Failure parsing JSON: %s", (char*)message->payload);
+    return -1;
+  }
+  return 0;
+}
+
+bool position_consumer_read(
+    const position_consumer* consumer,
+    const char* topic,
+    const mosquitto_property* props,
+    char* vehicle,
+    size_t size,
+    position_sequence* sequence)
+{
+  topic_level levels[1];
+
+  if (consumer->geofences == NULL && consumer->sequences == NULL && !heatmap_consumer_enabled())
+  {
+    return false;
+  }
+  if (!TOPIC_MATCH(topic, VEHICLE_POSITION_TOPIC, levels)
+      || !topic_level_copy(&levels[0], vehicle, size))
+  {
+    LOG_ERROR("Unexpected topic for a position: %s", topic);
+    return false;
+  }
+  sequence_consumer_read(props, sequence);
+  return true;
+}
+
+void position_consumer_update(
+    position_consumer* consumer,
+    const char* vehicle,
+    const position_sequence* sequence,
+    const geojson_coordinates* coordinates)
+{
+  sequence_consumer_handle(
+      consumer->sequences, vehicle, sequence, coordinates, _deliver_position, consumer);
+}
+
+void position_consumer_tick(position_consumer* consumer, struct mosquitto* mosq)
+{
+  sequence_consumer_expire(consumer->sequences, _deliver_position, consumer);
+  heatmap_consumer_tick(consumer->shard, mosq);
+}
+
+void position_consumer_destroy(position_consumer* consumer)
+{
+  geofence_consumer_destroy(consumer->geofences);
+  consumer->geofences = NULL;
+  sequence_consumer_destroy(consumer->sequences);
+  consumer->sequences = NULL;
+  if (consumer->compression)
+  {
+    __atomic_fetch_add(&decompressed, consumer->codec.decompressed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(
+        &decompress_failures, consumer->codec.decompress_failures, __ATOMIC_RELAXED);
+    payload_codec_destroy(&consumer->codec);
+    consumer->compression = false;
+  }
+}
@@ -0,0 +1,105 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_CONSUMER_H
+#define POSITION_CONSUMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "geo_json_handler.h"
+#include "geofence.h"
+#include "mosquitto.h"
+#include "payload_compression.h"
+#include "sequence_consumer.h"
+
+/*
+ * Handling of the positions received by the telemetry_consumer: decompression, parsing, then the
+ * sequence tracking of sequence_consumer.h, the geofences of geofence_consumer.h and the heatmap of
+ * heatmap_consumer.h. The mosquitto loop thread, or each core with CONSUMER_CORES, has its own
+ * position_consumer, and only handles the positions of the vehicles it owns.
+ */
+
+/* State of the thread handling the positions of a shard of the vehicles. */
+typedef struct position_consumer
+{
+  uint32_t shard;
+  geofence_engine* geofences;
+  sequence_tracker* sequences;
+  payload_codec codec;
+  bool compression;
+} position_consumer;
+
+/**
+ * @brief Reads the settings of the features and allocates the state they share. Must be freed
+ * with position_consumer_cleanup().
+ *
+ * @param shard_count The number of threads handling positions.
+ * @return bool true on success, false if the settings are invalid or on failure.
+ */
+bool position_consumer_setup(uint32_t shard_count);
+
+/**
+ * @brief Logs the stats of the destroyed position_consumers and frees the state they share.
+ */
+void position_consumer_cleanup(void);
+
+/**
+ * @brief Initializes the position_consumer of a thread. Must be freed with
+ * position_consumer_destroy() by the same thread.
+ *
+ * @param consumer The position_consumer to initialize.
+ * @param shard The shard of the heatmap the thread updates, 0 for the first one.
+ * @return int 0 on success, -1 on failure.
+ */
+int position_consumer_init(position_consumer* consumer, uint32_t shard);
+
+/**
+ * @brief Decompresses the payload of a message if it was compressed, and parses it.
+ *
+ * @return int 0 on success, -1 if the message is not a valid position.
+ */
+int position_consumer_parse(
+    position_consumer* consumer,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    geojson_point* point);
+
+/**
+ * @brief Copies the vehicle id of a vehicles/<vehicle id>/position topic and reads the sequence of
+ * the position, if any of the features is on.
+ *
+ * @return bool true if the position is to be passed to position_consumer_update().
+ */
+bool position_consumer_read(
+    const position_consumer* consumer,
+    const char* topic,
+    const mosquitto_property* props,
+    char* vehicle,
+    size_t size,
+    position_sequence* sequence);
+
+/**
+ * @brief Checks the position of a vehicle owned by the thread against the geofences and adds it
+ * to the heatmap, in the order of its sequence.
+ */
+void position_consumer_update(
+    position_consumer* consumer,
+    const char* vehicle,
+    const position_sequence* sequence,
+    const geojson_coordinates* coordinates);
+
+/**
+ * @brief Called each second, delivers the positions held too long and closes the heatmap windows
+ * that ended. The first shard publishes the closed windows on mosq.
+ */
+void position_consumer_tick(position_consumer* consumer, struct mosquitto* mosq);
+
+/**
+ * @brief Frees the memory of a position_consumer, adding its stats to the ones logged by
+ * position_consumer_cleanup().
+ */
+void position_consumer_destroy(position_consumer* consumer);
+
+#endif /* POSITION_CONSUMER_H */
@@ -0,0 +1,160 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mqtt_setup.h"
+#include "sequence_consumer.h"
+#include "topic_template.h"
+
+/* The memory of each tracker is allocated up front, for this many vehicles. */
+#define SEQUENCE_MAX_VEHICLES 16384
+
+static int sequence_window = 0;
+static int sequence_max_delay_ms = 0;
+/* Stats of the destroyed trackers. */
+static sequence_tracker_stats destroyed_stats;
+
+/* Only used for delays, so the clock doesn't need to follow the wall clock. */
+static int64_t _now_ms(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool sequence_consumer_init(void)
+{
+  if (!set_int_connection_setting(&sequence_window, "SEQUENCE_WINDOW", 8)
+      || !set_int_connection_setting(&sequence_max_delay_ms, "SEQUENCE_MAX_DELAY_MS", 2000))
+  {
+    return false;
+  }
+  if (sequence_window < 0 || sequence_window > SEQUENCE_TRACKER_MAX_WINDOW
+      || sequence_max_delay_ms < 0)
+  {
+    LOG_ERROR(
+        "SEQUENCE_WINDOW must be at most %d and SEQUENCE_MAX_DELAY_MS not negative",
+        SEQUENCE_TRACKER_MAX_WINDOW);
+    sequence_window = 0;
+    return false;
+  }
+  return true;
+}
+
+int sequence_consumer_create(sequence_tracker** tracker)
+{
+  sequence_tracker_options options;
+
+  *tracker = NULL;
+  if (sequence_window == 0)
+  {
+    return 0;
+  }
+  memset(&options, 0, sizeof(sequence_tracker_options));
+  options.max_sources = SEQUENCE_MAX_VEHICLES;
+  /* Vehicle ids are a level of the position topics. */
+  options.max_id_length = TOPIC_LEVEL_MAX_LENGTH;
+  options.window = (uint32_t)sequence_window;
+  options.item_size = sizeof(geojson_coordinates);
+  options.max_delay_ms = (uint32_t)sequence_max_delay_ms;
+  if ((*tracker = malloc(sizeof(sequence_tracker))) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return -1;
+  }
+  if (sequence_tracker_init(*tracker, &options) != 0)
+  {
+    free(*tracker);
+    *tracker = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void sequence_consumer_read(const mosquitto_property* props, position_sequence* sequence)
+{
+  sequence->valid = sequence_window > 0
+      && sequence_property_read(props, &sequence->session, &sequence->sequence);
+}
+
+void sequence_consumer_handle(
+    sequence_tracker* tracker,
+    const char* vehicle,
+    const position_sequence* sequence,
+    const geojson_coordinates* coordinates,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  if (tracker != NULL && sequence->valid)
+  {
+    sequence_tracker_push(
+        tracker,
+        vehicle,
+        sequence->session,
+        sequence->sequence,
+        coordinates,
+        _now_ms(),
+        deliver,
+        context);
+  }
+  else
+  {
+    deliver(vehicle, coordinates, context);
+  }
+}
+
+void sequence_consumer_expire(
+    sequence_tracker* tracker,
+    sequence_deliver_callback deliver,
+    void* context)
+{
+  if (tracker != NULL)
+  {
+    sequence_tracker_expire(tracker, _now_ms(), deliver, context);
+  }
+}
+
+void sequence_consumer_destroy(sequence_tracker* tracker)
+{
+  const sequence_tracker_stats* stats;
+
+  if (tracker == NULL)
+  {
+    return;
+  }
+  /* Trackers may be destroyed on their own thread, the stats are read once they all are. */
+  stats = &tracker->stats;
+  __atomic_fetch_add(&destroyed_stats.delivered, stats->delivered, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&destroyed_stats.duplicates, stats->duplicates, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&destroyed_stats.reordered, stats->reordered, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&destroyed_stats.gaps, stats->gaps, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&destroyed_stats.late, stats->late, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&destroyed_stats.restarts, stats->restarts, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&destroyed_stats.untracked, stats->untracked, __ATOMIC_RELAXED);
+  sequence_tracker_destroy(tracker);
+  free(tracker);
+}
+
+void sequence_consumer_log_stats(void)
+{
+  if (sequence_window == 0)
+  {
+    return;
+  }
+  LOG_INFO(
+      CLIENT_LOG_TAG,
+      "Delivered %llu positions in sequence, %llu duplicates, %llu reordered, %llu gaps, %llu "
+      "late, %llu restarts, %llu of untracked vehicles",
+      (unsigned long long)destroyed_stats.delivered,
+      (unsigned long long)destroyed_stats.duplicates,
+      (unsigned long long)destroyed_stats.reordered,
+      (unsigned long long)destroyed_stats.gaps,
+      (unsigned long long)destroyed_stats.late,
+      (unsigned long long)destroyed_stats.restarts,
+      (unsigned long long)destroyed_stats.untracked);
+}
@@ -0,0 +1,82 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SEQUENCE_CONSUMER_H
+#define SEQUENCE_CONSUMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "geo_json_handler.h"
+#include "mosquitto.h"
+#include "sequence_tracker.h"
+
+/*
+ * Duplicate suppression and reordering of the positions of each vehicle of the telemetry_consumer,
+ * by the sequence the producer stamps them with, when SEQUENCE_WINDOW is set. Each thread handling
+ * positions creates its own tracker, for the vehicles it owns.
+ */
+
+/* Sequence of a position, read from its SEQUENCE_PROPERTY. */
+typedef struct position_sequence
+{
+  uint32_t session;
+  uint32_t sequence;
+  bool valid;
+} position_sequence;
+
+/**
+ * @brief Reads SEQUENCE_WINDOW (8 by default, 0 to turn the tracking off) and
+ * SEQUENCE_MAX_DELAY_MS (2000 by default) and checks them.
+ *
+ * @return bool true on success, false if the settings are invalid.
+ */
+bool sequence_consumer_init(void);
+
+/**
+ * @brief Allocates the tracker of a thread. Must be freed with sequence_consumer_destroy().
+ *
+ * @param tracker Set to the tracker, or to NULL when SEQUENCE_WINDOW is 0.
+ * @return int 0 on success, -1 on failure.
+ */
+int sequence_consumer_create(sequence_tracker** tracker);
+
+/**
+ * @brief Reads the sequence of a position, valid only if the tracking is on and the position has
+ * a valid SEQUENCE_PROPERTY.
+ */
+void sequence_consumer_read(const mosquitto_property* props, position_sequence* sequence);
+
+/**
+ * @brief Passes the position of a vehicle to deliver in the order of its sequence, right away if
+ * tracker is NULL or the position has no sequence.
+ */
+void sequence_consumer_handle(
+    sequence_tracker* tracker,
+    const char* vehicle,
+    const position_sequence* sequence,
+    const geojson_coordinates* coordinates,
+    sequence_deliver_callback deliver,
+    void* context);
+
+/**
+ * @brief Delivers the positions held longer than SEQUENCE_MAX_DELAY_MS, so that vehicles that
+ * stopped sending still get them through. Does nothing if tracker is NULL.
+ */
+void sequence_consumer_expire(
+    sequence_tracker* tracker,
+    sequence_deliver_callback deliver,
+    void* context);
+
+/**
+ * @brief Adds the stats of a tracker to the ones logged by sequence_consumer_log_stats() and
+ * frees it. Can be called from any thread, does nothing if tracker is NULL.
+ */
+void sequence_consumer_destroy(sequence_tracker* tracker);
+
+/**
+ * @brief Logs the stats of the destroyed trackers, if SEQUENCE_WINDOW is set.
+ */
+void sequence_consumer_log_stats(void);
+
+#endif /* SEQUENCE_CONSUMER_H */
@@ -4,15 +4,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "geo_json_handler.h"
 #include "logging.h"
 #include "mosquitto.h"
+#include "mqtt_protocol.h"
 #include "mqtt_setup.h"
+#include "payload_compression.h"
+#include "sequence_tracker.h"
+#include "telemetry_topics.h"
 
 #define QOS_LEVEL 1
-#define MQTT_VERSION MQTT_PROTOCOL_V311
+/* The sequence of the positions and the content type of the compressed ones are MQTT v5
+ * properties. */
+#define MQTT_VERSION MQTT_PROTOCOL_V5
 
 /* We format the doubles to 6 decimal points, and the format is fixed, so the max length is when
  * both coordinates are negative, ex {"type":"Point","coordinates":[-83.551071,-36.169784]} which is
@@ -33,6 +40,14 @@ int main(int argc, char* argv[])
 {
   struct mosquitto* mosq;
   int result = MOSQ_ERR_SUCCESS;
+  /* Compresses the positions when COMPRESSION_DICTIONARY_DIR is set, see payload_compression.h. */
+  payload_codec codec;
+  int compression = 0;
+  char topic[TOPIC_SIZE(VEHICLE_POSITION_TOPIC)];
+  /* Positions are numbered from 1 in each session, which starts with the producer, so the consumer
+   * drops duplicates and reorders them, see sequence_tracker.h. */
+  uint32_t session = (uint32_t)time(NULL);
+  uint32_t sequence = 0;
 
   mqtt_client_obj obj = { 0 };
   obj.mqtt_version = MQTT_VERSION;
@@ -41,6 +56,15 @@ int main(int argc, char* argv[])
   {
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (TOPIC_FORMAT(topic, VEHICLE_POSITION_TOPIC, obj.client_id) < 0)
+  {
+    LOG_ERROR("Client id %s is not a valid topic level", obj.client_id);
+    result = MOSQ_ERR_INVAL;
+  }
+  else if ((compression = payload_codec_init_from_env(&codec)) < 0)
+  {
+    result = MOSQ_ERR_UNKNOWN;
+  }
   else if (
       (result = mosquitto_connect_bind_v5(
            mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
@@ -56,9 +80,11 @@ int main(int argc, char* argv[])
   }
   else
   {
-    char topic[strlen(obj.client_id) + 17];
-    sprintf(topic, "vehicles/%s/position", obj.client_id);
-    mosquitto_payload payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+    char payload_buffer[MAX_PAYLOAD_LENGTH];
+    mosquitto_payload payload = mosquitto_payload_from_buffer(payload_buffer, MAX_PAYLOAD_LENGTH);
+    char compressed[MAX_PAYLOAD_LENGTH];
+    size_t compressed_length;
+    mosquitto_property* props = NULL;
     geojson_point json_point = geojson_point_init();
     strcpy(json_point.type, "Point");
 
@@ -72,8 +98,31 @@ int main(int argc, char* argv[])
       }
       else
       {
-        result = mosquitto_publish_v5(
-            mosq, NULL, topic, payload.payload_length, payload.payload, QOS_LEVEL, false, NULL);
+        const mosquitto_property* codec_props = NULL;
+        const void* data = payload.payload;
+        int length = payload.payload_length;
+
+        if (compression > 0
+            && payload_codec_compress(
+                &codec,
+                payload.payload,
+                payload.payload_length,
+                compressed,
+                sizeof(compressed),
+                &compressed_length,
+                &codec_props))
+        {
+          data = compressed;
+          length = (int)compressed_length;
+        }
+        /* The properties of the codec are shared by its messages, the sequence is added to a
+         * copy. */
+        if ((result = mosquitto_property_copy_all(&props, codec_props)) == MOSQ_ERR_SUCCESS
+            && (result = sequence_property_add(&props, session, ++sequence)) == MOSQ_ERR_SUCCESS)
+        {
+          result = mosquitto_publish_v5(mosq, NULL, topic, length, data, QOS_LEVEL, false, props);
+        }
+        mosquitto_property_free_all(&props);
       }
 
       if (result != MOSQ_ERR_SUCCESS)
@@ -83,7 +132,6 @@ int main(int argc, char* argv[])
 
       sleep(5);
     }
-    mosquitto_payload_destroy(&payload);
     geojson_point_destroy(&json_point);
   }
 
@@ -93,6 +141,17 @@ int main(int argc, char* argv[])
     mosquitto_loop_stop(mosq, false);
     mosquitto_destroy(mosq);
   }
+  if (compression > 0)
+  {
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Compressed %llu positions from %llu to %llu bytes, %llu sent as is",
+        (unsigned long long)codec.compressed,
+        (unsigned long long)codec.compressed_input_bytes,
+        (unsigned long long)codec.compressed_output_bytes,
+        (unsigned long long)codec.sent_as_is);
+    payload_codec_destroy(&codec);
+  }
   mosquitto_lib_cleanup();
   return result;
 }
@@ -0,0 +1,487 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Measures QoS 0 publishing from several threads sharing a connection, with 1, 2, 4... threads up
+ * to the number given:
+ * - direct: every thread calls mosquitto_publish_v5() on a client running mosquitto_loop_start(),
+ *   so they contend on the locks of the client and each packet is its own write.
+ * - queue: every thread publishes to its own lane of a publish_queue, whose network thread
+ *   coalesces the packets of all the lanes into one write per loop iteration.
+ * A run ends once every message is written to the socket. Write syscalls are the write() and
+ * writev() calls the kernel counts in /proc/self/io, plus the sendmsg() calls of the queue.
+ *
+ * Then measures the latency of commands published every millisecond while bulk threads saturate
+ * the connection, from the command lane to a second client subscribed to the commands, with the
+ * command lane as a bulk lane, as a high priority lane, and as a high priority lane with an
+ * unsent limit.
+ *
+ * Usage: publish_queue_bench [max threads] [messages per thread] [env file]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "latency_histogram.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "publish_queue.h"
+
+#define DEFAULT_MAX_THREADS 32
+#define DEFAULT_MESSAGES_PER_THREAD 200000
+#define PAYLOAD_SIZE 32
+/* bench/<two digits thread index> */
+#define TOPIC_LENGTH 8
+#define MQTT_VERSION MQTT_PROTOCOL_V311
+/* Fixed header, topic length, topic and payload. */
+#define PACKET_SIZE (2 + 2 + TOPIC_LENGTH + PAYLOAD_SIZE)
+#define DRAIN_POLL_US 100
+
+#define LATENCY_BULK_THREADS 4
+#define LATENCY_RUN_NS 5000000000LL
+#define COMMAND_INTERVAL_NS 1000000
+#define COMMAND_TOPIC "bench/command"
+#define UNSENT_LIMIT (16 * 1024)
+#define SUBSCRIBE_WAIT_US 1000000
+#define NS_PER_US 1000.0
+
+typedef struct latency_run
+{
+  const char* name;
+  int bulk_threads;
+  publish_queue_priority command_priority;
+  uint32_t unsent_limit;
+} latency_run;
+
+static const latency_run latency_runs[] = {
+  { "idle", 0, PUBLISH_QUEUE_PRIORITY_HIGH, 0 },
+  { "bulk", LATENCY_BULK_THREADS, PUBLISH_QUEUE_PRIORITY_BULK, 0 },
+  { "high", LATENCY_BULK_THREADS, PUBLISH_QUEUE_PRIORITY_HIGH, 0 },
+  { "high, unsent limit", LATENCY_BULK_THREADS, PUBLISH_QUEUE_PRIORITY_HIGH, UNSENT_LIMIT },
+};
+
+typedef struct bench_thread
+{
+  struct mosquitto* mosq;
+  publish_queue* queue;
+  int index;
+} bench_thread;
+
+static mqtt_client_connection_settings connection_settings;
+static uint64_t messages_per_thread = DEFAULT_MESSAGES_PER_THREAD;
+/* Written by the loop thread of the subscriber. */
+static latency_histogram command_latency;
+static pthread_mutex_t command_latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool stop_publishing;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Write syscalls of the process so far, as counted by the kernel. */
+static uint64_t write_syscalls(void)
+{
+  FILE* file = fopen("/proc/self/io", "r");
+  char line[64];
+  unsigned long long count = 0;
+
+  while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+  {
+    if (sscanf(line, "syscw: %llu", &count) == 1)
+    {
+      break;
+    }
+  }
+  if (file != NULL)
+  {
+    fclose(file);
+  }
+  return count;
+}
+
+static void* publish_direct(void* argument)
+{
+  bench_thread* thread = argument;
+  char topic[TOPIC_LENGTH + 1];
+  char payload[PAYLOAD_SIZE] = { 0 };
+
+  snprintf(topic, sizeof(topic), "bench/%02d", thread->index);
+  for (uint64_t i = 0; i < messages_per_thread; i++)
+  {
+    memcpy(payload, &i, sizeof(i));
+    while (mosquitto_publish_v5(thread->mosq, NULL, topic, PAYLOAD_SIZE, payload, 0, false, NULL)
+           != MOSQ_ERR_SUCCESS)
+    {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void* publish_queued(void* argument)
+{
+  bench_thread* thread = argument;
+  publish_queue_lane* lane = publish_queue_lane_open(thread->queue, PUBLISH_QUEUE_PRIORITY_BULK);
+  char topic[TOPIC_LENGTH + 1];
+  char payload[PAYLOAD_SIZE] = { 0 };
+
+  if (lane == NULL)
+  {
+    return NULL;
+  }
+  snprintf(topic, sizeof(topic), "bench/%02d", thread->index);
+  for (uint64_t i = 0; i < messages_per_thread; i++)
+  {
+    memcpy(payload, &i, sizeof(i));
+    while (publish_queue_publish(lane, topic, payload, PAYLOAD_SIZE, false) != 0)
+    {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void* publish_until_stopped(void* argument)
+{
+  bench_thread* thread = argument;
+  publish_queue_lane* lane = publish_queue_lane_open(thread->queue, PUBLISH_QUEUE_PRIORITY_BULK);
+  char topic[TOPIC_LENGTH + 1];
+  char payload[PAYLOAD_SIZE] = { 0 };
+
+  if (lane == NULL)
+  {
+    return NULL;
+  }
+  snprintf(topic, sizeof(topic), "bench/%02d", thread->index);
+  while (!__atomic_load_n(&stop_publishing, __ATOMIC_RELAXED))
+  {
+    if (publish_queue_publish(lane, topic, payload, PAYLOAD_SIZE, false) != 0)
+    {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static int run_threads(int thread_count, bench_thread* threads, void* (*publish)(void*))
+{
+  pthread_t ids[thread_count];
+
+  for (int i = 0; i < thread_count; i++)
+  {
+    threads[i].index = i;
+    if (pthread_create(&ids[i], NULL, publish, &threads[i]) != 0)
+    {
+      LOG_ERROR("Failed to start publishing thread %d", i);
+      return -1;
+    }
+  }
+  for (int i = 0; i < thread_count; i++)
+  {
+    pthread_join(ids[i], NULL);
+  }
+  return 0;
+}
+
+/* Returns the elapsed seconds, or -1 on failure. */
+static double run_direct(int thread_count, uint64_t* writes)
+{
+  mqtt_client_obj obj = { 0 };
+  struct mosquitto* mosq;
+  bench_thread threads[thread_count];
+  uint64_t start_writes;
+  int64_t start;
+  double elapsed = -1;
+
+  obj.mqtt_version = MQTT_VERSION;
+  if ((mosq = mqtt_client_new(false, &connection_settings, NULL, &obj)) == NULL)
+  {
+    return -1;
+  }
+  if (mosquitto_connect_bind_v5(
+          mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL)
+          == MOSQ_ERR_SUCCESS
+      && mosquitto_loop_start(mosq) == MOSQ_ERR_SUCCESS)
+  {
+    memset(threads, 0, sizeof(threads));
+    for (int i = 0; i < thread_count; i++)
+    {
+      threads[i].mosq = mosq;
+    }
+    start_writes = write_syscalls();
+    start = now_ns();
+    if (run_threads(thread_count, threads, publish_direct) == 0)
+    {
+      while (mosquitto_want_write(mosq))
+      {
+        usleep(DRAIN_POLL_US);
+      }
+      elapsed = (now_ns() - start) / 1e9;
+      *writes = write_syscalls() - start_writes;
+    }
+    mosquitto_disconnect_v5(mosq, MQTT_RC_NORMAL_DISCONNECTION, NULL);
+    mosquitto_loop_stop(mosq, false);
+  }
+  mosquitto_destroy(mosq);
+  return elapsed;
+}
+
+static double run_queued(int thread_count, uint64_t* writes, publish_queue_stats* stats)
+{
+  publish_queue queue;
+  publish_queue_options options = { 0 };
+  bench_thread threads[thread_count];
+  uint64_t total_bytes = (uint64_t)thread_count * messages_per_thread * PACKET_SIZE;
+  uint64_t start_writes;
+  int64_t start;
+  double elapsed = -1;
+
+  options.mqtt_version = MQTT_VERSION;
+  options.max_lanes = (uint32_t)thread_count;
+  if (publish_queue_init(&queue, &options) != 0)
+  {
+    return -1;
+  }
+  if (publish_queue_start(&queue, &connection_settings) == 0)
+  {
+    memset(threads, 0, sizeof(threads));
+    for (int i = 0; i < thread_count; i++)
+    {
+      threads[i].queue = &queue;
+    }
+    start_writes = write_syscalls();
+    start = now_ns();
+    if (run_threads(thread_count, threads, publish_queued) == 0)
+    {
+      do
+      {
+        usleep(DRAIN_POLL_US);
+        publish_queue_read_stats(&queue, stats);
+      } while (stats->bytes < total_bytes && keep_running);
+      elapsed = (now_ns() - start) / 1e9;
+      *writes = write_syscalls() - start_writes + stats->writes;
+    }
+  }
+  publish_queue_destroy(&queue);
+  return elapsed;
+}
+
+static void handle_command(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  int64_t sent_ns;
+
+  if (message->payloadlen == sizeof(sent_ns))
+  {
+    memcpy(&sent_ns, message->payload, sizeof(sent_ns));
+    pthread_mutex_lock(&command_latency_mutex);
+    latency_histogram_record(&command_latency, (uint64_t)(now_ns() - sent_ns));
+    pthread_mutex_unlock(&command_latency_mutex);
+  }
+}
+
+static void on_connect_with_subscribe(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  int result;
+
+  on_connect(mosq, obj, reason_code, flags, props);
+  if ((result = mosquitto_subscribe_v5(mosq, NULL, COMMAND_TOPIC, 0, 0, NULL)) != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
+  }
+}
+
+/* Publishes a command every COMMAND_INTERVAL_NS while the bulk threads publish as fast as they can,
+ * and prints the latency of the commands received by the subscriber. */
+static int run_latency(const latency_run* run)
+{
+  publish_queue queue;
+  publish_queue_options options = { 0 };
+  publish_queue_lane* lane;
+  bench_thread threads[LATENCY_BULK_THREADS] = { 0 };
+  pthread_t ids[LATENCY_BULK_THREADS];
+  int started = 0;
+  int64_t end;
+  int64_t next;
+  latency_histogram latency;
+
+  options.mqtt_version = MQTT_VERSION;
+  options.unsent_limit = run->unsent_limit;
+  if (publish_queue_init(&queue, &options) != 0)
+  {
+    return -1;
+  }
+  if (publish_queue_start(&queue, &connection_settings) != 0
+      || (lane = publish_queue_lane_open(&queue, run->command_priority)) == NULL)
+  {
+    publish_queue_destroy(&queue);
+    return -1;
+  }
+
+  __atomic_store_n(&stop_publishing, false, __ATOMIC_RELAXED);
+  for (; started < run->bulk_threads; started++)
+  {
+    threads[started].queue = &queue;
+    threads[started].index = started;
+    if (pthread_create(&ids[started], NULL, publish_until_stopped, &threads[started]) != 0)
+    {
+      LOG_ERROR("Failed to start publishing thread %d", started);
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&command_latency_mutex);
+  latency_histogram_reset(&command_latency);
+  pthread_mutex_unlock(&command_latency_mutex);
+  end = now_ns() + LATENCY_RUN_NS;
+  for (next = now_ns(); next < end && keep_running; next += COMMAND_INTERVAL_NS)
+  {
+    struct timespec deadline = { next / 1000000000, next % 1000000000 };
+    int64_t sent_ns;
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    sent_ns = now_ns();
+    publish_queue_publish(lane, COMMAND_TOPIC, &sent_ns, sizeof(sent_ns), false);
+  }
+
+  __atomic_store_n(&stop_publishing, true, __ATOMIC_RELAXED);
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(ids[i], NULL);
+  }
+  publish_queue_destroy(&queue);
+  /* Leaves time for the last commands to arrive. */
+  usleep(SUBSCRIBE_WAIT_US);
+  pthread_mutex_lock(&command_latency_mutex);
+  latency = command_latency;
+  pthread_mutex_unlock(&command_latency_mutex);
+
+  printf(
+      "%-18s  %8llu  %8.0f  %8.0f  %8.0f  %8.0f\n",
+      run->name,
+      (unsigned long long)latency.total_count,
+      latency_histogram_value_at_percentile(&latency, 50) / NS_PER_US,
+      latency_histogram_value_at_percentile(&latency, 99) / NS_PER_US,
+      latency_histogram_value_at_percentile(&latency, 99.9) / NS_PER_US,
+      latency.max / NS_PER_US);
+  return 0;
+}
+
+static void run_latencies(void)
+{
+  mqtt_client_connection_settings subscriber_settings = connection_settings;
+  mqtt_client_obj obj = { 0 };
+  char client_id[256];
+  struct mosquitto* mosq;
+
+  /* The publish queue connects with the client id of the settings. */
+  if (connection_settings.client_id != NULL)
+  {
+    snprintf(client_id, sizeof(client_id), "%s-commands", connection_settings.client_id);
+    subscriber_settings.client_id = client_id;
+  }
+  obj.mqtt_version = MQTT_VERSION;
+  obj.handle_message = handle_command;
+  if ((mosq = mqtt_client_new(false, &subscriber_settings, on_connect_with_subscribe, &obj))
+      == NULL)
+  {
+    return;
+  }
+  if (mosquitto_connect_bind_v5(
+          mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL)
+          == MOSQ_ERR_SUCCESS
+      && mosquitto_loop_start(mosq) == MOSQ_ERR_SUCCESS)
+  {
+    usleep(SUBSCRIBE_WAIT_US);
+    printf("\ncommand lane        commands       p50       p99     p99.9       max (us)\n");
+    for (size_t i = 0; i < sizeof(latency_runs) / sizeof(latency_runs[0]) && keep_running; i++)
+    {
+      if (run_latency(&latency_runs[i]) != 0)
+      {
+        break;
+      }
+    }
+    mosquitto_disconnect_v5(mosq, MQTT_RC_NORMAL_DISCONNECTION, NULL);
+    mosquitto_loop_stop(mosq, false);
+  }
+  mosquitto_destroy(mosq);
+}
+
+int main(int argc, char* argv[])
+{
+  int max_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+
+  if (argc > 2)
+  {
+    messages_per_thread = (uint64_t)atoll(argv[2]);
+  }
+  if (max_threads <= 0 || max_threads > PUBLISH_QUEUE_MAX_LANES || messages_per_thread == 0)
+  {
+    fprintf(stderr, "Usage: %s [max threads] [messages per thread] [env file]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  mosquitto_lib_init();
+  if (!mqtt_client_load_settings(argc > 3 ? argv[3] : NULL, &connection_settings))
+  {
+    mosquitto_lib_cleanup();
+    return EXIT_FAILURE;
+  }
+
+  printf("threads  mode    messages/s  write syscalls/msg  lane full\n");
+  for (int threads = 1;; threads = threads * 2 > max_threads ? max_threads : threads * 2)
+  {
+    uint64_t messages = (uint64_t)threads * messages_per_thread;
+    publish_queue_stats stats;
+    uint64_t writes;
+    double elapsed;
+
+    if ((elapsed = run_direct(threads, &writes)) < 0)
+    {
+      break;
+    }
+    printf(
+        "%7d  direct  %10.0f  %18.3f  %9s\n",
+        threads,
+        messages / elapsed,
+        (double)writes / messages,
+        "-");
+
+    if ((elapsed = run_queued(threads, &writes, &stats)) < 0)
+    {
+      break;
+    }
+    printf(
+        "%7d  queue   %10.0f  %18.3f  %9llu\n",
+        threads,
+        messages / elapsed,
+        (double)writes / messages,
+        (unsigned long long)stats.lane_full);
+
+    if (threads == max_threads || !keep_running)
+    {
+      break;
+    }
+  }
+  run_latencies();
+
+  mosquitto_lib_cleanup();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,14 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef TELEMETRY_TOPICS_H
+#define TELEMETRY_TOPICS_H
+
+#include "topic_template.h"
+
+/* The producers publish the position of their vehicle, named after their client id. */
+#define VEHICLE_POSITION_TOPIC(vehicle) "vehicles/" vehicle "/position"
+/* The consumer publishes the heatmap of the positions, named after its grid and windows. */
+#define HEATMAP_TOPIC(heatmap) "heatmaps/" heatmap "/summary"
+
+#endif /* TELEMETRY_TOPICS_H */